@@ -38,6 +38,11 @@ const struct proxy_conn *proxy_conn_create(pool *p, const char *uri,
   unsigned int flags);
 #define PROXY_CONN_CREATE_FL_USE_DNS_TTL	0x0001
 
+/* Skip discovering the addresses for the URI; the caller is expected to
+ * provide them using proxy_conn_set_addrs().
+ */
+#define PROXY_CONN_CREATE_FL_NO_RESOLVE		0x0002
+
 const pr_netaddr_t *proxy_conn_get_addr(const struct proxy_conn *,
   array_header **);
 int proxy_conn_get_dns_ttl(const struct proxy_conn *pconn);
@@ -50,6 +55,13 @@ const char *proxy_conn_get_uri(const struct proxy_conn *pconn);
 const char *proxy_conn_get_username(const struct proxy_conn *pconn);
 const char *proxy_conn_get_password(const struct proxy_conn *pconn);
 int proxy_conn_get_tls(const struct proxy_conn *pconn);
+
+/* Sets the addresses of the connection from the given list of IP address
+ * strings, e.g. as previously resolved; the first address is the primary
+ * address.
+ */
+int proxy_conn_set_addrs(const struct proxy_conn *pconn, array_header *addrs);
+
 int proxy_conn_use_dns_srv(const struct proxy_conn *pconn);
 int proxy_conn_use_dns_txt(const struct proxy_conn *pconn);
 int proxy_conn_send_proxy_v1(pool *p, conn_t *conn);
@@ -0,0 +1,64 @@
+/*
+ * ProFTPD - mod_proxy forward destination cache API
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_PROXY_FORWARD_DSTCACHE_H
+#define MOD_PROXY_FORWARD_DSTCACHE_H
+
+#include "mod_proxy.h"
+
+/* Default lifetime, in seconds, of cached destination addresses. */
+#define PROXY_FORWARD_DSTCACHE_DEFAULT_TTL		60
+
+/* Default lifetime, in seconds, of cached failures to resolve a
+ * destination.
+ */
+#define PROXY_FORWARD_DSTCACHE_DEFAULT_NEGATIVE_TTL	10
+
+/* Cache of resolved forward proxy destinations, keyed by URI, shared by all
+ * session processes via the ProxyTables directory.
+ */
+int proxy_forward_dstcache_init(pool *p, const char *tables_dir, int flags);
+
+int proxy_forward_dstcache_sess_init(pool *p, const char *tables_dir,
+  int flags);
+int proxy_forward_dstcache_sess_free(pool *p);
+
+/* Returns the cached IP addresses (as strings) for the given URI, with the
+ * last-known-good address, if any, first.  Returns NULL with errno set to
+ * ENOENT if there is no unexpired entry, or EHOSTUNREACH if the URI is
+ * cached as unresolvable.
+ */
+array_header *proxy_forward_dstcache_get(pool *p, const char *uri);
+
+/* Caches the given IP address strings for the URI, for ttl seconds.  A NULL
+ * or empty list caches the URI as unresolvable.
+ */
+int proxy_forward_dstcache_add(pool *p, const char *uri, array_header *addrs,
+  int ttl);
+
+/* Records the address to which a connection for the URI last succeeded. */
+int proxy_forward_dstcache_set_good_addr(pool *p, const char *uri,
+  const char *addr);
+
+#endif /* MOD_PROXY_FORWARD_DSTCACHE_H */
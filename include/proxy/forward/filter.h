@@ -0,0 +1,80 @@
+/*
+ * ProFTPD - mod_proxy forward destination filter API
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_PROXY_FORWARD_FILTER_H
+#define MOD_PROXY_FORWARD_FILTER_H
+
+#include "mod_proxy.h"
+
+/* Number of recent decisions remembered by a filter. */
+#define PROXY_FORWARD_FILTER_DECISION_CACHE_SIZE	16
+
+/* Compiled set of ProxyForwardTo rules.  Rules are one of:
+ *
+ *   [!]host:name[:port]     exact (case-insensitive) host, optional port
+ *   [!]cidr:network/len     IPv4/IPv6 network of the destination address
+ *   [!]pattern              regular expression against "host:port"
+ *
+ * A destination is rejected if it matches any negated rule, or if there are
+ * any non-negated rules and it matches none of them.
+ */
+struct proxy_forward_filter;
+
+struct proxy_forward_filter *proxy_forward_filter_create(pool *p);
+
+/* Compiles the given rule into the filter.  The regex_flags (e.g.
+ * REG_ICASE) only apply to regular expression rules.
+ */
+int proxy_forward_filter_add_rule(struct proxy_forward_filter *filter,
+  const char *rule, int regex_flags);
+
+/* Returns the number of rules in the filter. */
+int proxy_forward_filter_count(struct proxy_forward_filter *filter);
+
+/* Returns zero if the given destination is allowed, -1 with errno set to
+ * EPERM if it is rejected.  The address, if not NULL, is the resolved
+ * address of the destination, used for any CIDR rules.
+ */
+int proxy_forward_filter_check(struct proxy_forward_filter *filter,
+  const char *hostport, const pr_netaddr_t *addr);
+
+/* Checks a destination in two steps, so that it can be rejected before its
+ * name is resolved: first its "host:port" name against the host and regular
+ * expression rules, then its resolved addresses against the CIDR rules.
+ *
+ * The name is rejected if it matches a negated rule, or if it matches no
+ * allowing rule and there are no allowing CIDR rules, which might still
+ * allow it.  The addresses are then rejected if any of them matches a
+ * negated CIDR rule, or if neither the name nor any of the addresses
+ * matches an allowing rule.  Both return -1 with errno set to EPERM when
+ * rejecting.
+ */
+int proxy_forward_filter_check_name(struct proxy_forward_filter *filter,
+  const char *hostport);
+int proxy_forward_filter_check_addrs(struct proxy_forward_filter *filter,
+  const char *hostport, const pr_netaddr_t *addr, array_header *other_addrs);
+
+int proxy_forward_filter_free(struct proxy_forward_filter *filter);
+
+#endif /* MOD_PROXY_FORWARD_FILTER_H */
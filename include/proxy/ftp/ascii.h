@@ -0,0 +1,55 @@
+/*
+ * ProFTPD - mod_proxy FTP ASCII translation API
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_PROXY_FTP_ASCII_H
+#define MOD_PROXY_FTP_ASCII_H
+
+#include "mod_proxy.h"
+
+struct proxy_ftp_ascii;
+
+/* Translate LF line endings (e.g. from the backend) to CRLF. */
+#define PROXY_FTP_ASCII_TO_CRLF		1
+
+/* Translate CRLF line endings (e.g. from the frontend) to LF. */
+#define PROXY_FTP_ASCII_FROM_CRLF	2
+
+/* Allocates a streaming translation context for a single data transfer;
+ * line endings split across calls are handled.
+ */
+struct proxy_ftp_ascii *proxy_ftp_ascii_alloc(pool *p, int direction);
+
+/* Translates the given data.  The returned output buffer is owned by the
+ * context, and is only valid until the next call.
+ */
+int proxy_ftp_ascii_translate(struct proxy_ftp_ascii *xlate, const char *in,
+  size_t inlen, char **out, size_t *outlen);
+
+/* Returns any data held back by the context, e.g. a trailing CR, at the end
+ * of the transfer.
+ */
+int proxy_ftp_ascii_finish(struct proxy_ftp_ascii *xlate, char **out,
+  size_t *outlen);
+
+#endif /* MOD_PROXY_FTP_ASCII_H */
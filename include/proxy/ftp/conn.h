@@ -27,6 +27,9 @@
 
 #include "mod_proxy.h"
 
+/* Default number of pooled listening sockets for backend data transfers. */
+#define PROXY_FTP_CONN_LISTEN_POOL_DEFAULT_SIZE		4
+
 conn_t *proxy_ftp_conn_accept(pool *p, conn_t *data_conn, conn_t *ctrl_conn,
   int frontend_data);
 conn_t *proxy_ftp_conn_connect(pool *p, const pr_netaddr_t *local_addr,
@@ -34,4 +37,16 @@ conn_t *proxy_ftp_conn_connect(pool *p, const pr_netaddr_t *local_addr,
 conn_t *proxy_ftp_conn_listen(pool *p, const pr_netaddr_t *bind_addr,
   int frontend_data);
 
+/* Closes a backend data listening conn, as returned by
+ * proxy_ftp_conn_listen().  If the conn uses a pooled socket, that socket is
+ * left listening, for reuse by later transfers.
+ */
+int proxy_ftp_conn_listen_close(pool *p, conn_t *conn);
+
+/* Keep up to size listening sockets open, for reuse across active data
+ * transfers with backend servers.
+ */
+int proxy_ftp_conn_listen_pool_init(pool *p, unsigned int size);
+int proxy_ftp_conn_listen_pool_free(void);
+
 #endif /* MOD_PROXY_FTP_CONN_H */
@@ -31,4 +31,57 @@ pr_buffer_t *proxy_ftp_data_recv(pool *p, conn_t *conn, int frontend_data);
 int proxy_ftp_data_send(pool *p, conn_t *conn, pr_buffer_t *pbuf,
   int frontend_data);
 
+/* Coarse-clock bookkeeping for the idle, no-transfer, and stalled timers
+ * during a data transfer.  Activity is noted via touch(), and the actual
+ * timer resets are applied at most once per tick.  A tick of zero resets
+ * the timers on every touch, which is the behavior outside of a transfer.
+ */
+#define PROXY_FTP_DATA_TIMER_IDLE		0x001
+#define PROXY_FTP_DATA_TIMER_NOXFER		0x002
+#define PROXY_FTP_DATA_TIMER_STALLED		0x004
+#define PROXY_FTP_DATA_TIMER_ALL		0x007
+
+/* Returns the effective tick, which is clamped to stay below the smallest
+ * configured TimeoutIdle/TimeoutNoTransfer/TimeoutStalled value.
+ */
+int proxy_ftp_data_timers_start(int tick);
+int proxy_ftp_data_timers_stop(void);
+
+/* Returns the number of timers actually reset. */
+int proxy_ftp_data_timers_touch(int timers);
+int proxy_ftp_data_timers_flush(void);
+
+/* Returns the number of seconds until the pending timer resets are due,
+ * zero if they are due now, or -1 if there are no pending resets.
+ */
+int proxy_ftp_data_timers_get_delay(void);
+
+int proxy_ftp_data_timers_get_stats(unsigned long *nresets,
+  unsigned long *ndeferred);
+
+/* Bulk transfers: rather than polling the control connections for every
+ * buffer relayed, the relay keeps moving data for as long as more is
+ * immediately available, in batches bounded by bytes and by time.  The
+ * control connections are polled between batches, so that commands like
+ * ABOR and STAT are still handled within the batch time budget.
+ */
+#define PROXY_FTP_DATA_BULK_DEFAULT_MAX_BYTES		(4 * 1024 * 1024)
+#define PROXY_FTP_DATA_BULK_DEFAULT_MAX_MILLIS		250
+
+/* A max_bytes of zero disables bulk transfers. */
+int proxy_ftp_data_bulk_start(off_t max_bytes, unsigned int max_millis);
+int proxy_ftp_data_bulk_stop(void);
+
+/* Notes that a buffer of nbytes was relayed.  Returns TRUE if the current
+ * batch may continue, or FALSE if the control connections are due to be
+ * polled, which also ends the batch.
+ */
+int proxy_ftp_data_bulk_next(size_t nbytes);
+
+/* Ends the current batch early, e.g. when no more data is available. */
+int proxy_ftp_data_bulk_end(void);
+
+int proxy_ftp_data_bulk_get_stats(unsigned long *nbatches,
+  unsigned long *nbuffers);
+
 #endif /* MOD_PROXY_FTP_DATA_H */
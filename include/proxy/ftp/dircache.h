@@ -0,0 +1,66 @@
+/*
+ * ProFTPD - mod_proxy FTP directory cache API
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_PROXY_FTP_DIRCACHE_H
+#define MOD_PROXY_FTP_DIRCACHE_H
+
+#include "mod_proxy.h"
+#include "proxy/session.h"
+
+/* Default number of MLST/SIZE/MDTM requests for the same directory, after
+ * which we fetch (and then answer from) a single MLSD snapshot.
+ */
+#define PROXY_FTP_DIRCACHE_DEFAULT_BURST	3
+
+/* Default lifetime, in seconds, of a directory snapshot. */
+#define PROXY_FTP_DIRCACHE_DEFAULT_LIFETIME	5
+
+/* Maximum number of entries kept from a single directory snapshot. */
+#define PROXY_FTP_DIRCACHE_MAX_ENTRIES		32768
+
+int proxy_ftp_dircache_init(pool *p, struct proxy_session *proxy_sess,
+  unsigned int burst, int lifetime);
+int proxy_ftp_dircache_free(struct proxy_session *proxy_sess);
+
+/* Notes every command seen on the frontend control connection, invalidating
+ * any snapshot for commands which might modify the backend filesystem (or
+ * the facts the backend would report).
+ */
+int proxy_ftp_dircache_note_cmd(struct proxy_session *proxy_sess,
+  cmd_rec *cmd);
+
+/* Adds the given MLSD text (one or more CRLF-terminated lines) to the
+ * snapshot for the given directory.  Returns the number of entries added.
+ */
+int proxy_ftp_dircache_add_text(struct proxy_session *proxy_sess,
+  const char *dir, const char *text, size_t textlen);
+
+/* Returns the response to use for the given MLST/SIZE/MDTM command, or NULL
+ * (with errno set to ENOENT) if the command should be proxied to the backend
+ * server as usual.
+ */
+pr_response_t *proxy_ftp_dircache_get_resp(pool *p,
+  struct proxy_session *proxy_sess, cmd_rec *cmd, unsigned int *resp_nlines);
+
+#endif /* MOD_PROXY_FTP_DIRCACHE_H */
@@ -42,4 +42,19 @@
 unsigned long proxy_ftp_facts_get_opts(void);
 void proxy_ftp_facts_parse_opts(char *facts);
 
+/* An RFC 3659 entry, "[facts] SP pathname", as sent in MLSD data. */
+struct proxy_ftp_facts_entry {
+  /* All of the facts, including the final ';'. */
+  const char *facts;
+  const char *path;
+
+  /* The values of these facts, if present; NULL otherwise. */
+  const char *type;
+  const char *size;
+  const char *modify;
+};
+
+int proxy_ftp_facts_parse_entry(pool *p, const char *text, size_t textlen,
+  struct proxy_ftp_facts_entry *entry);
+
 #endif /* MOD_PROXY_FTP_FACTS_H */
@@ -0,0 +1,78 @@
+/*
+ * ProFTPD - mod_proxy FTP MODE Z API
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_PROXY_FTP_MODEZ_H
+#define MOD_PROXY_FTP_MODEZ_H
+
+#include "mod_proxy.h"
+
+struct proxy_ftp_modez;
+
+/* Compress data, e.g. uploads to the backend. */
+#define PROXY_FTP_MODEZ_DEFLATE		1
+
+/* Decompress data, e.g. downloads from the backend. */
+#define PROXY_FTP_MODEZ_INFLATE		2
+
+/* Use an adaptive compression level, tuned to the measured throughput. */
+#define PROXY_FTP_MODEZ_LEVEL_ADAPTIVE	0
+
+/* Allocates a streaming MODE Z (zlib) context for a single data transfer.
+ * The level is only used for compression, and is either 1-9, or
+ * PROXY_FTP_MODEZ_LEVEL_ADAPTIVE.  Returns NULL, with errno set to ENOSYS,
+ * if zlib support is not available.
+ */
+struct proxy_ftp_modez *proxy_ftp_modez_alloc(pool *p, int direction,
+  int level);
+
+/* Compresses/decompresses the given data.  The returned output buffer is owned
+ * by the context, and is only valid until the next call; the output may be
+ * empty, as zlib buffers data internally.
+ *
+ * Decompressed output is limited to a bounded buffer.  If that fills up,
+ * proxy_ftp_modez_pending() returns TRUE, and the caller should call this
+ * again with no input (and with the previous input buffer left untouched)
+ * for the rest of the output; new input fails with EAGAIN until then.
+ */
+int proxy_ftp_modez_process(struct proxy_ftp_modez *modez, const char *in,
+  size_t inlen, char **out, size_t *outlen);
+
+/* Returns any data remaining at the end of the transfer.  For decompression,
+ * returns -1 with errno set to EPIPE if the compressed stream was truncated.
+ */
+int proxy_ftp_modez_finish(struct proxy_ftp_modez *modez, char **out,
+  size_t *outlen);
+
+/* Returns TRUE if decompression stopped with input left to process, FALSE
+ * otherwise.
+ */
+int proxy_ftp_modez_pending(struct proxy_ftp_modez *modez);
+
+/* Returns the current compression level. */
+int proxy_ftp_modez_get_level(struct proxy_ftp_modez *modez);
+
+/* Releases the zlib resources of the context. */
+int proxy_ftp_modez_free(struct proxy_ftp_modez *modez);
+
+#endif /* MOD_PROXY_FTP_MODEZ_H */
@@ -27,27 +27,60 @@
 
 #include "mod_proxy.h"
 
+/* Buffer sizes sufficient for formatting any PORT/PASV address (6 numbers of
+ * 3 digits max each, 5 separators, and a NUL), and any EPRT/EPSV address.
+ */
+#define PROXY_FTP_MSG_ADDR_BUFSZ		24
+#define PROXY_FTP_MSG_EXT_ADDR_BUFSZ		64
+
 /* Format a string containg the address for use in a PORT command or a
  * PASV response.
  */
 const char *proxy_ftp_msg_fmt_addr(pool *, const pr_netaddr_t *,
   unsigned short, int);
 
+/* As above, but formats into the given buffer, which must be at least
+ * PROXY_FTP_MSG_ADDR_BUFSZ bytes.  Returns the length of the formatted
+ * string, or -1 on error.
+ */
+int proxy_ftp_msg_fmt_addr2(const pr_netaddr_t *addr, unsigned short port,
+  int use_masqaddr, char *buf, size_t bufsz);
+
 /* Format a string containg the address for use in an EPRT command or an
  * EPSV response.
  */
 const char *proxy_ftp_msg_fmt_ext_addr(pool *, const pr_netaddr_t *,
   unsigned short, int, int);
 
+/* As above, but formats into the given buffer; PROXY_FTP_MSG_EXT_ADDR_BUFSZ
+ * bytes suffice for any address.  Returns the length of the formatted
+ * string, or -1 on error.
+ */
+int proxy_ftp_msg_fmt_ext_addr2(const pr_netaddr_t *addr, unsigned short port,
+  int cmd_id, int use_masqaddr, char *buf, size_t bufsz);
+
 /* Parse the address/port out of a string, e.g. from a PORT command or from
  * a PASV response.
  */
 const pr_netaddr_t *proxy_ftp_msg_parse_addr(pool *, const char *, int);
 
+/* As above, but parses the first msglen bytes of the message into the
+ * caller-provided address.  Returns 0 on success, or -1 on error.
+ */
+int proxy_ftp_msg_parse_addr2(const char *msg, size_t msglen, int addr_family,
+  pr_netaddr_t *addr);
+
 /* Parse the address/port out of a string, e.g. from an EPRT command or from
  * an EPSV response.
  */
 const pr_netaddr_t *proxy_ftp_msg_parse_ext_addr(pool *, const char *,
   const pr_netaddr_t *, int, const char *);
 
+/* As above, but parses the first msglen bytes of the message into the
+ * caller-provided address.  Returns 0 on success, or -1 on error.
+ */
+int proxy_ftp_msg_parse_ext_addr2(const char *msg, size_t msglen,
+  const pr_netaddr_t *addr, int cmd_id, const char *net_proto,
+  pr_netaddr_t *res);
+
 #endif /* MOD_PROXY_FTP_MSG_H */
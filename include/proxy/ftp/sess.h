@@ -34,6 +34,17 @@
 #define PROXY_FTP_SESS_TLS_XFER_PROTECTION_POLICY_CLEAR		-1
 
 int proxy_ftp_sess_get_feat(pool *, const struct proxy_session *proxy_sess);
+
+/* Parses the given FEAT response text in place, recording the well-known
+ * features as PROXY_SESS_FEAT_FL flags on the session, and any others in the
+ * session's backend_features table (allocated from the given pool, if
+ * needed).  The NUL-terminated buffer is modified, and must live as long as
+ * the table; it may be handed over in chunks of complete lines.  Returns the
+ * number of features parsed, or -1 on error.
+ */
+int proxy_ftp_sess_parse_feat(pool *p, char *buf, size_t buflen,
+  struct proxy_session *proxy_sess);
+
 int proxy_ftp_sess_send_auth_tls(pool *p,
   const struct proxy_session *proxy_sess);
 int proxy_ftp_sess_send_host(pool *, const struct proxy_session *proxy_sess);
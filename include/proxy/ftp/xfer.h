@@ -28,6 +28,28 @@
 #include "mod_proxy.h"
 #include "proxy/session.h"
 
+struct proxy_ftp_datastore {
+  /* Data transfer callbacks */
+  int (*dataxfer_get)(pool *p, void *dsh, unsigned int vhost_id,
+    const char *backend_uri, unsigned long *flags, time_t *updated);
+  int (*dataxfer_set)(pool *p, void *dsh, unsigned int vhost_id,
+    const char *backend_uri, unsigned long flags, time_t updated);
+
+  int (*init)(pool *p, const char *path, int flags);
+  void *(*open)(pool *p, const char *path, unsigned long opts);
+  int (*close)(pool *p, void *dsh);
+
+  /* Datastore handle returned by the open callback. */
+  void *dsh;
+};
+
+int proxy_ftp_xfer_init(pool *p, const char *tables_path, int flags);
+int proxy_ftp_xfer_free(pool *p);
+
+int proxy_ftp_xfer_sess_init(pool *p, struct proxy_session *proxy_sess,
+  int flags);
+int proxy_ftp_xfer_sess_free(pool *p);
+
 int proxy_ftp_xfer_prepare_active(int, cmd_rec *, const char *,
   struct proxy_session *, int);
 const pr_netaddr_t *proxy_ftp_xfer_prepare_passive(int, cmd_rec *, const char *,
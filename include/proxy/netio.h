@@ -41,6 +41,14 @@ int proxy_netio_use(int strm_type, pr_netio_t *netio);
  */
 int proxy_netio_using(int strm_type, pr_netio_t **netio);
 
+/* Binds the given netio, or the core NetIO if null, to the given stream.
+ * The Proxy NetIO API functions then dispatch I/O on that stream directly
+ * to its bound netio, rather than (un)registering NetIOs for every call.
+ * Streams opened via the Proxy NetIO and Inet APIs are bound automatically,
+ * to the netio in use for their stream type at the time.
+ */
+int proxy_netio_bind(pr_netio_stream_t *nstrm, pr_netio_t *netio);
+
 /* Proxied versions of the core NetIO API functions; see include/netio.h. */
 
 pr_netio_stream_t *proxy_netio_open(pool *p, int strm_type, int fd, int mode);
@@ -29,8 +29,17 @@
 
 int proxy_random_init(void);
 
+/* Seed the generator with the given value, yielding a repeatable sequence
+ * of numbers.  Mostly useful for testing.
+ */
+void proxy_random_seed(uint64_t seed);
+
 /* Return the next random number between the given min/max numbers, inclusive.
+ * Returns -1, with errno set to EINVAL, if max is less than min.
  */
 long proxy_random_next(long min, long max);
 
+/* Randomly permute the elements of the given list, in place. */
+int proxy_random_shuffle(array_header *list);
+
 #endif /* MOD_PROXY_RANDOM_H */
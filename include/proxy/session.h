@@ -35,6 +35,7 @@ struct proxy_session {
   int connect_timeout;
   int connect_timerno;
   int linger_timeout;
+  int timer_tick;
 
   /* Frontend connection */
   conn_t *frontend_ctrl_conn;
@@ -60,8 +61,14 @@ struct proxy_session {
   /* Which protocol are we proxying? */
   int use_ftp, use_ssh;
 
-  /* Features supported by backend server. */
+  /* Features supported by backend server.  The well-known features are
+   * recorded as bits in backend_feat_flags (with the AUTH and MLST values
+   * kept separately); any other features are kept in the table.
+   */
   pr_table_t *backend_features;
+  unsigned long backend_feat_flags;
+  const char *backend_auth_feat;
+  const char *backend_mlst_feat;
 
   /* Data transfer pool, for things like the frontend/backend address
    * objects.
@@ -71,12 +78,39 @@ struct proxy_session {
   /* Data transfer policy: PASV, EPSV, PORT, EPRT, or client. */
   int dataxfer_policy;
 
+  /* What we have learned about the data transfer commands supported by the
+   * backend server, so that later transfers can skip known failures.  The
+   * failures are also recorded in the datastore, for later sessions to the
+   * same backend server.
+   */
+  unsigned long dataxfer_flags;
+
   /* Directory list policy: LIST, or client. */
   int dirlist_policy;
   unsigned long dirlist_opts;
   void *dirlist_ctx;
+
+  /* Directory snapshot cache, for MLST/SIZE/MDTM bursts.  May be null. */
+  void *dircache_ctx;
+};
+
+/* Per-session context, holding the state consulted on hot paths, such as
+ * the per-command handlers and the per-packet SSH handling.  Reaching it
+ * requires no lookups; the session.notes table mirrors the proxy session,
+ * as "mod_proxy.proxy-session", for compatibility.
+ */
+struct proxy_session_ctx {
+  const struct proxy_session *proxy_sess;
+
+  /* Adaptive write buffering state, for TLS on the backend data
+   * connection.
+   */
+  off_t tls_adaptive_bytes;
+  uint64_t tls_adaptive_ms;
 };
 
+#define PROXY_SESSION_NOTE_KEY				"mod_proxy.proxy-session"
+
 /* Zero indicates "do what the client does". */
 
 #define PROXY_SESS_DATA_TRANSFER_POLICY_DEFAULT		0
@@ -84,6 +118,27 @@ struct proxy_session {
 #define PROXY_SESS_DIRECTORY_LIST_POLICY_DEFAULT	0
 #define PROXY_SESS_DIRECTORY_LIST_POLICY_LIST		1
 
+/* Data transfer negotiation flags. */
+#define PROXY_SESS_DATA_TRANSFER_FL_EPSV_FAILED		0x0001
+#define PROXY_SESS_DATA_TRANSFER_FL_EPRT_FAILED		0x0002
+#define PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL		0x0004
+#define PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL_FAILED	0x0008
+#define PROXY_SESS_DATA_TRANSFER_FL_MODE_Z		0x0010
+#define PROXY_SESS_DATA_TRANSFER_FL_MODE_Z_FAILED	0x0020
+#define PROXY_SESS_DATA_TRANSFER_FL_DATASTORE_LOADED	0x0040
+
+/* Backend server FEAT flags. */
+#define PROXY_SESS_FEAT_FL_EPSV				0x0001
+#define PROXY_SESS_FEAT_FL_EPRT				0x0002
+#define PROXY_SESS_FEAT_FL_MLST				0x0004
+#define PROXY_SESS_FEAT_FL_UTF8				0x0008
+#define PROXY_SESS_FEAT_FL_REST_STREAM			0x0010
+#define PROXY_SESS_FEAT_FL_AUTH				0x0020
+#define PROXY_SESS_FEAT_FL_PBSZ				0x0040
+#define PROXY_SESS_FEAT_FL_SIZE				0x0080
+#define PROXY_SESS_FEAT_FL_MDTM				0x0100
+#define PROXY_SESS_FEAT_FL_HOST				0x0200
+
 /* Default MaxLoginAttempts */
 #define PROXY_SESS_MAX_LOGIN_ATTEMPTS			3
 
@@ -91,6 +146,21 @@ const struct proxy_session *proxy_session_alloc(pool *p);
 int proxy_session_free(pool *p, const struct proxy_session *proxy_sess);
 int proxy_session_reset_dataxfer(struct proxy_session *proxy_sess);
 
+/* Returns the per-session context; this is never NULL. */
+struct proxy_session_ctx *proxy_session_get_ctx(void);
+
+/* Returns the current proxy session, or NULL with errno set to ENOENT if
+ * there is none.  Only when no session has been set is the session.notes
+ * table consulted.
+ */
+const struct proxy_session *proxy_session_get_current(void);
+
+/* Makes the given proxy session the current one, and mirrors it in the
+ * session.notes table.  A NULL session clears the current session, and
+ * its note.
+ */
+int proxy_session_set_current(const struct proxy_session *proxy_sess);
+
 int proxy_session_check_password(pool *p, const char *user, const char *passwd);
 int proxy_session_setup_env(pool *p, const char *user, int flags);
 #define PROXY_SESSION_FL_CHECK_LOGIN_ACL		0x00001
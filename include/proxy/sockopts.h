@@ -0,0 +1,92 @@
+/*
+ * ProFTPD - mod_proxy socket options API
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+
+#ifndef MOD_PROXY_SOCKOPTS_H
+#define MOD_PROXY_SOCKOPTS_H
+
+#include "mod_proxy.h"
+
+/* Connection roles, each of which may have its own socket options profile. */
+#define PROXY_SOCKOPTS_ROLE_FRONTEND_CTRL		0
+#define PROXY_SOCKOPTS_ROLE_BACKEND_CTRL		1
+#define PROXY_SOCKOPTS_ROLE_FRONTEND_DATA		2
+#define PROXY_SOCKOPTS_ROLE_BACKEND_DATA		3
+#define PROXY_SOCKOPTS_ROLE_SSH				4
+
+#define PROXY_SOCKOPTS_ROLE_COUNT			5
+
+/* A profile of kernel socket options.  Options which are -1 (or NULL) are
+ * left as the kernel, or the core Inet API, set them.
+ */
+struct proxy_sockopts {
+  int nodelay;
+  int quickack;
+
+  /* In bytes. */
+  int notsent_lowat;
+
+  /* In microseconds. */
+  int busy_poll;
+
+  /* In milliseconds. */
+  int user_timeout;
+
+  /* TCP congestion control algorithm, e.g. "bbr" or "cubic". */
+  const char *congestion;
+
+  /* Differentiated Services codepoint, from 0 to 63. */
+  int dscp;
+};
+
+/* Returns the role for the given name, e.g. "backend-data", or -1 with
+ * errno set to ENOENT if the name is unknown.
+ */
+int proxy_sockopts_get_role(const char *name);
+const char *proxy_sockopts_get_role_name(int role);
+
+/* Resets all options in the given profile to -1/NULL. */
+int proxy_sockopts_clear(struct proxy_sockopts *opts);
+
+/* Parses a list of "name value" option pairs, and/or the names of the
+ * built-in "latency" and "throughput" profiles, into the given profile.  On
+ * failure, returns -1 with errno set to EINVAL, and the unparseable text is
+ * provided in `bad_text`, if not NULL.
+ */
+int proxy_sockopts_parse(pool *p, struct proxy_sockopts *opts, int argc,
+  char **argv, const char **bad_text);
+
+/* Sets (or, for a NULL profile, clears) the profile to use for the role. */
+int proxy_sockopts_set_profile(int role, const struct proxy_sockopts *opts);
+const struct proxy_sockopts *proxy_sockopts_get_profile(int role);
+
+/* Applies the role's profile, if any, to the given socket/connection.
+ * Options not supported by the platform are skipped.
+ */
+int proxy_sockopts_apply(int fd, int role);
+int proxy_sockopts_apply_conn(conn_t *conn, int role);
+
+int proxy_sockopts_free(void);
+
+#endif /* MOD_PROXY_SOCKOPTS_H */
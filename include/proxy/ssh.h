@@ -27,6 +27,7 @@
 
 #include "mod_proxy.h"
 #include "proxy/session.h"
+#include "proxy/ssh/kexcost.h"
 
 /* ProxySFTPOptions values.  NOTE: Make sure these do NOT collide with existing
  * PROXY_OPT_ values defined in mod_proxy.h.
@@ -58,6 +59,12 @@ struct proxy_ssh_datastore {
     const char *backend_uri, const char *algo,
     const unsigned char *hostkey_data, uint32_t hostkey_datalen);
 
+  /* KEX cost callbacks */
+  array_header *(*kexcosts_get)(pool *p, void *dsh, unsigned int vhost_id,
+    const char *backend_uri);
+  int (*kexcost_set)(pool *p, void *dsh, unsigned int vhost_id,
+    const char *backend_uri, const struct proxy_ssh_kexcost *cost);
+
   int (*init)(pool *p, const char *path, int flags);
   void *(*open)(pool *p, const char *path, unsigned long opts);
   int (*close)(pool *p, void *dsh);
@@ -0,0 +1,71 @@
+/*
+ * ProFTPD - mod_proxy SSH KEX cost API
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#ifndef MOD_PROXY_SSH_KEXCOST_H
+#define MOD_PROXY_SSH_KEXCOST_H
+
+#include "mod_proxy.h"
+
+/* Default minimum estimated security strength, in bits, of the key exchange
+ * algorithms which may be promoted by ProxySFTPAdaptiveKeyExchanges.
+ */
+#define PROXY_SSH_KEXCOST_DEFAULT_MIN_BITS	112
+
+/* Recorded cost of a key exchange algorithm, for a given backend server. */
+struct proxy_ssh_kexcost {
+  const char *algo;
+
+  /* Average wall clock and CPU time, in microseconds. */
+  unsigned long wall_usecs;
+  unsigned long cpu_usecs;
+
+  /* Number of samples in the averages. */
+  unsigned int count;
+};
+
+/* Returns the estimated security strength, in bits, of the given key exchange
+ * algorithm, or -1 with errno set to ENOENT for unknown algorithms (including
+ * pseudo-algorithms such as "ext-info-c").
+ */
+int proxy_ssh_kexcost_get_security_bits(const char *algo);
+
+/* Folds a new sample into the averages of the given cost. */
+int proxy_ssh_kexcost_update(struct proxy_ssh_kexcost *cost,
+  unsigned long wall_usecs, unsigned long cpu_usecs);
+
+/* Reorders the given comma-separated KEXINIT list of key exchange algorithms,
+ * using the recorded costs (a list of struct proxy_ssh_kexcost pointers).
+ * Algorithms meeting the min_bits security floor come first: those with no
+ * recorded cost (so that they are tried, and measured), then the rest from
+ * cheapest to most expensive.  These are followed by the algorithms below the
+ * floor, then by any unknown names, each in their original order.
+ */
+const char *proxy_ssh_kexcost_reorder(pool *p, const char *algos,
+  const array_header *costs, unsigned int min_bits);
+
+/* Logs the given recorded costs for a backend to the trace log. */
+void proxy_ssh_kexcost_dump(const char *backend_uri,
+  const array_header *costs);
+
+#endif /* MOD_PROXY_SSH_KEXCOST_H */
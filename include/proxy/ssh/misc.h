@@ -28,8 +28,44 @@
 #include "mod_proxy.h"
 
 #if defined(PR_USE_OPENSSL)
+/* A name-list, as sent in a KEXINIT, compiled so that each name has an ID
+ * (its position in the list), for negotiating against the peer's name-lists
+ * without splitting our own list each time.
+ */
+struct proxy_ssh_namelist {
+  const char *names;
+  unsigned int count;
+  const char **elts;
+  size_t *lens;
+
+  /* Bitmask of the name lengths (modulo 32) in the list. */
+  unsigned int lenmask;
+
+  /* Open-addressed table of name IDs (plus one; zero means empty). */
+  unsigned int *ids;
+  unsigned int idsz;
+};
+
 int proxy_ssh_misc_namelist_contains(pool *, const char *, const char *);
 const char *proxy_ssh_misc_namelist_shared(pool *, const char *, const char *);
+
+/* Compiles the given comma-separated name-list; empty and duplicate names
+ * are skipped.
+ */
+struct proxy_ssh_namelist *proxy_ssh_misc_namelist_compile(pool *p,
+  const char *names);
+
+/* Returns the ID of the given name in the compiled list, or -1 (with
+ * ENOENT) if not present.
+ */
+int proxy_ssh_misc_namelist_get_id(const struct proxy_ssh_namelist *list,
+  const char *name, size_t namelen);
+
+/* Returns the ID of the first name in the compiled list which also appears in
+ * the given name-list, or -1 (with ENOENT) if there is none.
+ */
+int proxy_ssh_misc_namelist_negotiate(const struct proxy_ssh_namelist *list,
+  const char *names);
 #endif /* PR_USE_OPENSSL */
 
 #endif /* MOD_PROXY_SSH_MISC_H */
@@ -0,0 +1,77 @@
+/*
+ * ProFTPD - mod_proxy SSH packet logging API
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+
+#ifndef MOD_PROXY_SSH_PKTLOG_H
+#define MOD_PROXY_SSH_PKTLOG_H
+
+#include "mod_proxy.h"
+
+/* Policies for logging proxied SSH packets, as commands in the LOG_CMD
+ * phase (e.g. for ExtendedLog).
+ */
+#define PROXY_SSH_PKTLOG_POLICY_ALL		1
+#define PROXY_SSH_PKTLOG_POLICY_NONE		2
+
+/* Log packets only if an ExtendedLog, for the given server, would log
+ * SSH commands.
+ */
+#define PROXY_SSH_PKTLOG_POLICY_AUTO		3
+
+/* Prepares the packet logging for the session, using the given policy
+ * and sample rate.  A sample rate of N logs only one of every N channel
+ * data and window adjust packets; other message types are not sampled.
+ * A sample rate of 0 or 1 logs every such packet.  All message types are
+ * logged, unless restricted via proxy_ssh_pktlog_set_msg_type().
+ */
+int proxy_ssh_pktlog_init(pool *p, server_rec *s, int policy,
+  unsigned int sample_rate);
+int proxy_ssh_pktlog_free(void);
+
+/* Enables, or disables, the logging of packets of the given message type.
+ * The first call disables all other message types; only the types
+ * explicitly enabled are then logged.
+ */
+int proxy_ssh_pktlog_set_msg_type(unsigned char msg_type, int enabled);
+
+/* Returns TRUE if a packet of the given message type should be logged,
+ * FALSE otherwise.  Note that this advances the sampling for the sampled
+ * message types.
+ */
+int proxy_ssh_pktlog_want_msg_type(unsigned char msg_type);
+
+/* Returns a cmd_rec, ready for dispatching, for logging a packet of the
+ * given message type, using the given command name.  These cmd_recs are
+ * allocated once per message type and direction, and reused.  Returns NULL,
+ * with errno set to EPERM, if packet logging has not been initialized.
+ */
+cmd_rec *proxy_ssh_pktlog_get_cmd(unsigned char msg_type, const char *name,
+  int from_frontend);
+
+/* Returns TRUE if any ExtendedLog configured for the given server would
+ * log SSH commands, FALSE otherwise.
+ */
+int proxy_ssh_pktlog_have_extendedlog(server_rec *s);
+
+#endif /* MOD_PROXY_SSH_PKTLOG_H */
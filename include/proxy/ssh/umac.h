@@ -34,6 +34,10 @@ int proxy_ssh_umac_final(struct umac_ctx *ctx, unsigned char tag[],
   const unsigned char nonce[8]);
 int proxy_ssh_umac_delete(struct umac_ctx *ctx);
 
+/* Select the NH kernel, by name, or the fastest one available if NULL. */
+int proxy_ssh_umac_set_impl(const char *name);
+const char *proxy_ssh_umac_get_impl(void);
+
 struct umac_ctx *proxy_ssh_umac128_alloc(void);
 struct umac_ctx *proxy_ssh_umac128_new(const unsigned char key[]);
 void proxy_ssh_umac128_init(struct umac_ctx *ctx, const unsigned char key[]);
@@ -43,5 +47,7 @@ int proxy_ssh_umac128_update(struct umac_ctx *ctx, const unsigned char *input,
 int proxy_ssh_umac128_final(struct umac_ctx *ctx, unsigned char tag[],
   const unsigned char nonce[8]);
 int proxy_ssh_umac128_delete(struct umac_ctx *ctx);
+int proxy_ssh_umac128_set_impl(const char *name);
+const char *proxy_ssh_umac128_get_impl(void);
 
 #endif /* MOD_PROXY_SSH_UMAC_H */
@@ -66,6 +66,8 @@
 #define PROXY_TLS_OPT_NO_SESSION_CACHE		0x0200
 #define PROXY_TLS_OPT_NO_SESSION_TICKETS	0x0400
 #define PROXY_TLS_OPT_ALLOW_WEAK_SECURITY	0x0800
+#define PROXY_TLS_OPT_NO_VERIFY_CACHE		0x1000
+#define PROXY_TLS_OPT_LOG_ALL_DIAGS		0x2000
 
 /* ProxyTLSProtocol handling */
 #define PROXY_TLS_PROTO_SSL_V3		0x0001
@@ -110,6 +112,134 @@ int proxy_tls_using_tls(void);
 /* Implements the ProxyTLSEngine MatchClient functionality. */
 int proxy_tls_match_client_tls(void);
 
+/* ProxyTLSBufferPolicy connection roles and policies.  The record buffers
+ * of a connection may be released whenever they drain, saving memory on
+ * mostly idle connections; kept for the life of the connection, saving an
+ * allocation per record on busy ones; or kept, and used to read ahead as
+ * much data as is available.
+ */
+#define PROXY_TLS_BUFFER_ROLE_CTRL		0
+#define PROXY_TLS_BUFFER_ROLE_DATA		1
+
+#define PROXY_TLS_BUFFER_POLICY_RELEASE		1
+#define PROXY_TLS_BUFFER_POLICY_KEEP		2
+#define PROXY_TLS_BUFFER_POLICY_READ_AHEAD	3
+
+#define PROXY_TLS_DEFAULT_READ_BUFFER_LEN	(64 * 1024)
+
+/* Which events a caller relaying data from a stream should poll its fd for.
+ * With the PENDING flag, the stream already has buffered data, and the
+ * caller should not wait at all.
+ */
+#define PROXY_TLS_POLL_FL_READ			0x001
+#define PROXY_TLS_POLL_FL_WRITE			0x002
+#define PROXY_TLS_POLL_FL_PENDING		0x004
+
+int proxy_tls_get_poll_flags(pr_netio_stream_t *nstrm);
+
+/* ProxyTLSShutdownPolicy, for data connections.  When closing a data
+ * connection, we may send our 'close_notify', and wait for the server's
+ * (bidirectional); only send ours (unidirectional); or send ours, and leave
+ * the server's to be collected in the background, for up to the linger time
+ * (deferred).
+ */
+#define PROXY_TLS_SHUTDOWN_POLICY_BIDIRECTIONAL		1
+#define PROXY_TLS_SHUTDOWN_POLICY_UNIDIRECTIONAL	2
+#define PROXY_TLS_SHUTDOWN_POLICY_DEFERRED		3
+
+#define PROXY_TLS_DEFAULT_SHUTDOWN_LINGER_MS	5000
+
+/* The most deferred shutdowns pending at once; beyond this, the oldest is
+ * abandoned.
+ */
+#define PROXY_TLS_MAX_DEFERRED_SHUTDOWNS	8
+
+#ifdef PR_USE_OPENSSL
+/* Cache of successfully verified server certificate chains, keyed by the
+ * SHA-256 digests of the leaf certificate, the presented chain, and the
+ * expected host name.  A cached entry lets a later handshake with the same
+ * chain skip path building and host name matching.
+ */
+struct proxy_tls_verify_cache_stats {
+  unsigned long lookups;
+  unsigned long hits;
+  unsigned long misses;
+  unsigned long expired;
+  unsigned long adds;
+  unsigned long evictions;
+};
+
+int proxy_tls_verify_cache_add(X509 *cert, STACK_OF(X509) *chain,
+  const char *host);
+
+/* Returns zero if a current verification result is cached for the given
+ * certificate, chain, and host; otherwise, returns -1 with errno set to
+ * ENOENT.
+ */
+int proxy_tls_verify_cache_get(X509 *cert, STACK_OF(X509) *chain,
+  const char *host);
+void proxy_tls_verify_cache_clear(void);
+int proxy_tls_verify_cache_get_stats(struct proxy_tls_verify_cache_stats *);
+
+/* Checks the OCSP response stapled by the server, if any, for the server
+ * certificate: its signature, its validity period, and the certificate
+ * status.  Returns zero if there is no response, or it reports the
+ * certificate as not revoked; otherwise, returns -1 with errno set, e.g.
+ * to EPERM.
+ */
+int proxy_tls_verify_stapled_ocsp(SSL *ssl);
+
+/* TLS diagnostics.  Once initialized, the handshake events for an SSL are
+ * recorded, unformatted, into a ring buffer of the given number of events;
+ * they are only formatted and logged when flushed, e.g. on handshake failure.
+ */
+#define PROXY_TLS_DIAGS_DEFAULT_COUNT		64
+
+/* Log every event as it happens, rather than only on flush. */
+#define PROXY_TLS_DIAGS_FL_LOG_ALL		0x0001
+
+int proxy_tls_diags_init(pool *p, unsigned int count, unsigned long flags);
+int proxy_tls_diags_free(void);
+
+/* Installs the diagnostic callbacks on the given SSL, if diagnostics are
+ * enabled, and clears any previously recorded events.
+ */
+int proxy_tls_diags_set_callbacks(SSL *ssl);
+
+/* Logs, then clears, the recorded events.  Returns the number of events
+ * logged.
+ */
+int proxy_tls_diags_flush(void);
+unsigned int proxy_tls_diags_get_count(void);
+
+/* Read-ahead is only supported for the data role, since control responses
+ * are awaited by polling the socket itself.  A read buffer length of zero
+ * uses the OpenSSL default.
+ */
+int proxy_tls_set_buffer_policy(int role, int policy, size_t read_buflen);
+int proxy_tls_get_buffer_policy(int role, int *policy, size_t *read_buflen);
+
+/* Applies the role's buffer policy to the given SSL. */
+int proxy_tls_apply_buffer_policy(SSL *ssl, int role);
+
+/* A linger time of zero uses the default. */
+int proxy_tls_set_shutdown_policy(int policy, unsigned int linger_ms);
+int proxy_tls_get_shutdown_policy(int *policy, unsigned int *linger_ms);
+
+/* Ends the TLS session of a data connection on the given fd, according to
+ * the shutdown policy.  The SSL is freed, or handed off to be reaped later;
+ * the caller still closes its fd.  Returns 1 if the shutdown was deferred,
+ * 0 otherwise.
+ */
+int proxy_tls_end_data_sess(SSL *ssl, int fd);
+
+/* Frees any deferred shutdowns which have completed, or whose linger time
+ * has passed; if force is TRUE, frees all of them.  Returns the number
+ * still pending.
+ */
+int proxy_tls_reap_data_sess(int force);
+#endif /* PR_USE_OPENSSL */
+
 /* Defines the datastore interface. */
 struct proxy_tls_datastore {
 #ifdef PR_USE_OPENSSL
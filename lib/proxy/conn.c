@@ -33,6 +33,7 @@
 #include "proxy/netio.h"
 #include "proxy/inet.h"
 #include "proxy/session.h"
+#include "proxy/sockopts.h"
 #include "proxy/tls.h"
 #include "proxy/uri.h"
 
@@ -117,7 +118,7 @@ int proxy_conn_connect_timeout_cb(CALLBACK_FRAME) {
   const struct proxy_session *proxy_sess;
   const pr_netaddr_t *server_addr;
 
-  proxy_sess = pr_table_get(session.notes, "mod_proxy.proxy-session", NULL);
+  proxy_sess = proxy_session_get_current();
   server_addr = pr_table_get(session.notes, "mod_proxy.proxy-connect-address",
     NULL);
 
@@ -416,6 +417,10 @@ const struct proxy_conn *proxy_conn_create(pool *p, const char *uri,
       "from %s DNS records", remote_port, uri, use_dns_srv ? "SRV" : "TXT");
   }
 
+  if (flags & PROXY_CONN_CREATE_FL_NO_RESOLVE) {
+    return pconn;
+  }
+
   if (use_dns_srv == TRUE) {
     pconn2 = proxy_conn_use_dns_srv_addrs(p, uri, pconn, flags);
     xerrno = errno;
@@ -438,6 +443,62 @@ const struct proxy_conn *proxy_conn_create(pool *p, const char *uri,
   return pconn2;
 }
 
+int proxy_conn_set_addrs(const struct proxy_conn *pconn, array_header *addrs) {
+  register unsigned int i;
+  struct proxy_conn *conn;
+  const pr_netaddr_t *conn_addr = NULL;
+  array_header *conn_addrs = NULL;
+  char **elts;
+
+  if (pconn == NULL ||
+      addrs == NULL ||
+      addrs->nelts == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  conn = (struct proxy_conn *) pconn;
+
+  elts = addrs->elts;
+  for (i = 0; i < addrs->nelts; i++) {
+    pr_netaddr_t *addr;
+
+    addr = (pr_netaddr_t *) pr_netaddr_get_addr(conn->pconn_pool, elts[i],
+      NULL);
+    if (addr == NULL) {
+      pr_trace_msg(trace_channel, 3,
+        "unable to use address '%s' for URI '%s': %s", elts[i],
+        conn->pconn_uri, strerror(errno));
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (pr_netaddr_set_port2(addr, conn->pconn_port) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "unable to set port %d from URI '%s': %s", conn->pconn_port,
+        conn->pconn_uri, strerror(errno));
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (conn_addr == NULL) {
+      conn_addr = addr;
+      continue;
+    }
+
+    if (conn_addrs == NULL) {
+      conn_addrs = make_array(conn->pconn_pool, addrs->nelts - 1,
+        sizeof(pr_netaddr_t *));
+    }
+
+    *((pr_netaddr_t **) push_array(conn_addrs)) = addr;
+  }
+
+  conn->pconn_addr = conn_addr;
+  conn->pconn_addrs = conn_addrs;
+  return 0;
+}
+
 void proxy_conn_free(const struct proxy_conn *pconn) {
   if (pconn == NULL) {
     return;
@@ -833,6 +894,12 @@ conn_t *proxy_conn_get_server_conn(pool *p, struct proxy_session *proxy_sess,
     (void) pr_inet_set_default_family(p, default_inet_family);
   }
 
+  /* Apply any socket options before connecting, so that options such as the
+   * congestion control algorithm take effect from the first segment.
+   */
+  (void) proxy_sockopts_apply_conn(server_conn, proxy_sess->use_ssh ?
+    PROXY_SOCKOPTS_ROLE_SSH : PROXY_SOCKOPTS_ROLE_BACKEND_CTRL);
+
   pr_trace_msg(trace_channel, 12,
     "connecting to backend address %s#%u from %s#%u", remote_ipstr, remote_port,
     pr_netaddr_get_ipstr(server_conn->local_addr), server_conn->local_port);
@@ -28,6 +28,8 @@
 #include "proxy/netio.h"
 #include "proxy/inet.h"
 #include "proxy/forward.h"
+#include "proxy/forward/dstcache.h"
+#include "proxy/forward/filter.h"
 #include "proxy/tls.h"
 #include "proxy/ftp/ctrl.h"
 #include "proxy/ftp/sess.h"
@@ -35,6 +37,12 @@
 static int proxy_method = PROXY_FORWARD_METHOD_USER_WITH_PROXY_AUTH;
 static int forward_retry_count = PROXY_DEFAULT_RETRY_COUNT;
 
+/* Lifetimes of cached destination addresses, and of failures to resolve
+ * destinations; zero if not caching.
+ */
+static int forward_dstcache_ttl = 0;
+static int forward_dstcache_negative_ttl = 0;
+
 /* handle_user_passthru flags */
 #define PROXY_FORWARD_USER_PASSTHRU_FL_PARSE_DSTADDR	0x001
 #define PROXY_FORWARD_USER_PASSTHRU_FL_CONNECT_DSTADDR	0x002
@@ -42,6 +50,8 @@ static int forward_retry_count = PROXY_DEFAULT_RETRY_COUNT;
 
 static const char *trace_channel = "proxy.forward";
 
+extern xaset_t *server_list;
+
 int proxy_forward_use_proxy_auth(void) {
   switch (proxy_method) {
     case PROXY_FORWARD_METHOD_USER_NO_PROXY_AUTH:
@@ -55,7 +65,76 @@ int proxy_forward_use_proxy_auth(void) {
   return TRUE;
 }
 
+/* Compiles all of the ProxyForwardTo rules for a server into a single filter,
+ * stashed in the first ProxyForwardTo config_rec.
+ */
+static struct proxy_forward_filter *forward_compile_filter(xaset_t *conf) {
+  config_rec *c, *first;
+  struct proxy_forward_filter *filter;
+
+  first = c = find_config(conf, CONF_PARAM, "ProxyForwardTo", FALSE);
+  if (c == NULL) {
+    return NULL;
+  }
+
+  if (c->argv[2] != NULL) {
+    return c->argv[2];
+  }
+
+  filter = proxy_forward_filter_create(c->pool);
+
+  while (c != NULL) {
+    const char *rule;
+    int regex_flags;
+
+    pr_signals_handle();
+
+    rule = c->argv[0];
+    regex_flags = *((int *) c->argv[1]);
+
+    if (proxy_forward_filter_add_rule(filter, rule, regex_flags) < 0) {
+      pr_trace_msg(trace_channel, 1,
+        "error adding ProxyForwardTo rule '%s': %s", rule, strerror(errno));
+    }
+
+    c = find_config_next(c, c->next, CONF_PARAM, "ProxyForwardTo", FALSE);
+  }
+
+  pr_trace_msg(trace_channel, 9, "compiled %d ProxyForwardTo %s",
+    proxy_forward_filter_count(filter),
+    proxy_forward_filter_count(filter) != 1 ? "rules" : "rule");
+
+  first->argv[2] = filter;
+  return filter;
+}
+
 int proxy_forward_init(pool *p, const char *tables_dir) {
+  server_rec *s;
+  int use_dstcache = FALSE;
+
+  if (server_list == NULL) {
+    return 0;
+  }
+
+  for (s = (server_rec *) server_list->xas_list; s; s = s->next) {
+    config_rec *c;
+
+    (void) forward_compile_filter(s->conf);
+
+    c = find_config(s->conf, CONF_PARAM, "ProxyForwardDestinationCache",
+      FALSE);
+    if (c != NULL &&
+        *((int *) c->argv[0]) == TRUE) {
+      use_dstcache = TRUE;
+    }
+  }
+
+  if (use_dstcache == TRUE) {
+    if (proxy_forward_dstcache_init(p, tables_dir, 0) < 0) {
+      return -1;
+    }
+  }
+
   return 0;
 }
 
@@ -70,6 +149,10 @@ int proxy_forward_sess_free(pool *p, struct proxy_session *proxy_sess) {
   proxy_method = PROXY_FORWARD_METHOD_USER_WITH_PROXY_AUTH;
   forward_retry_count = PROXY_DEFAULT_RETRY_COUNT;
 
+  (void) proxy_forward_dstcache_sess_free(p);
+  forward_dstcache_ttl = 0;
+  forward_dstcache_negative_ttl = 0;
+
   return 0;
 }
 
@@ -124,6 +207,21 @@ int proxy_forward_sess_init(pool *p, const char *tables_dir,
     forward_retry_count = *((int *) c->argv[0]);
   }
 
+  c = find_config(main_server->conf, CONF_PARAM,
+    "ProxyForwardDestinationCache", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    if (proxy_forward_dstcache_sess_init(p, tables_dir, 0) < 0) {
+      /* Not fatal; we simply resolve every destination. */
+      pr_trace_msg(trace_channel, 3,
+        "unable to use destination cache: %s", strerror(errno));
+
+    } else {
+      forward_dstcache_ttl = *((int *) c->argv[1]);
+      forward_dstcache_negative_ttl = *((int *) c->argv[2]);
+    }
+  }
+
   return 0;
 }
 
@@ -234,6 +332,14 @@ static int forward_connect(pool *p, struct proxy_session *proxy_sess,
         server_conn = proxy_conn_get_server_conn(p, proxy_sess, dst_addr);
         if (server_conn != NULL) {
           proxy_sess->dst_addr = dst_addr;
+
+          if (forward_dstcache_ttl > 0) {
+            /* Have later sessions try this address first. */
+            (void) proxy_forward_dstcache_set_good_addr(p,
+              proxy_conn_get_uri(proxy_sess->dst_pconn),
+              pr_netaddr_get_ipstr(dst_addr));
+          }
+
           break;
         }
       }
@@ -365,44 +471,109 @@ static int forward_connect(pool *p, struct proxy_session *proxy_sess,
   return 0;
 }
 
-static int forward_dst_filter(pool *p, const char *hostport) {
-#ifdef PR_USE_REGEX
-  config_rec *c;
-  pr_regex_t *pre;
-  int negated = FALSE, res;
+/* Checks the destination name against ProxyForwardTo, before resolving it,
+ * so that a rejected destination costs no DNS lookup.
+ */
+static int forward_dst_filter_name(const char *hostport) {
+  struct proxy_forward_filter *filter;
 
-  c = find_config(main_server->conf, CONF_PARAM, "ProxyForwardTo", FALSE);
-  if (c == NULL) {
+  filter = forward_compile_filter(main_server->conf);
+  if (filter == NULL) {
     return 0;
   }
 
-  pre = c->argv[0];
-  negated = *((int *) c->argv[1]);
+  return proxy_forward_filter_check_name(filter, hostport);
+}
 
-  res = pr_regexp_exec(pre, hostport, 0, NULL, 0, 0, 0);
-  if (res == 0) {
-    /* Pattern matched */
-    if (negated == TRUE) {
-      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-        "host/port '%.100s' matched ProxyForwardTo !%s, rejecting",
-        hostport, pr_regexp_get_pattern(pre));
+/* Checks the resolved addresses of the destination against any ProxyForwardTo
+ * CIDR rules.
+ */
+static int forward_dst_filter_addrs(const char *hostport,
+    const struct proxy_conn *pconn) {
+  struct proxy_forward_filter *filter;
+  const pr_netaddr_t *addr;
+  array_header *other_addrs = NULL;
 
-      errno = EPERM;
-      return -1;
-    }
+  filter = forward_compile_filter(main_server->conf);
+  if (filter == NULL) {
+    return 0;
+  }
 
-  } else {
-    /* Pattern NOT matched */
-    if (negated == FALSE) {
+  addr = proxy_conn_get_addr(pconn, &other_addrs);
+  if (addr == NULL) {
+    return 0;
+  }
+
+  return proxy_forward_filter_check_addrs(filter, hostport, addr, other_addrs);
+}
+
+/* Creates the connection for the destination URI, using the destination
+ * cache (if enabled) to avoid resolving the destination name.
+ */
+static const struct proxy_conn *forward_conn_create(pool *p, const char *uri) {
+  const struct proxy_conn *pconn;
+  int xerrno;
+
+  if (forward_dstcache_ttl > 0) {
+    array_header *addrs;
+
+    addrs = proxy_forward_dstcache_get(p, uri);
+    if (addrs != NULL) {
+      pconn = proxy_conn_create(proxy_pool, uri,
+        PROXY_CONN_CREATE_FL_NO_RESOLVE);
+      if (pconn != NULL) {
+        if (proxy_conn_set_addrs(pconn, addrs) == 0) {
+          return pconn;
+        }
+
+        proxy_conn_free(pconn);
+      }
+
+    } else if (errno == EHOSTUNREACH) {
       (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-        "host/port '%.100s' did not match ProxyForwardTo %s, rejecting",
-        hostport, pr_regexp_get_pattern(pre));
-      errno = EPERM;
-      return -1;
+        "unable to resolve URI '%.100s' (cached)", uri);
+      errno = EINVAL;
+      return NULL;
     }
   }
-#endif /* PR_USE_REGEX */
-  return 0;
+
+  /* Note: We deliberately use proxy_pool, rather than the given pool, here
+   * so that the created structure (especially the pr_netaddr_t) are
+   * longer-lived.
+   */
+  pconn = proxy_conn_create(proxy_pool, uri, 0);
+  xerrno = errno;
+
+  if (forward_dstcache_ttl > 0) {
+    if (pconn != NULL) {
+      const pr_netaddr_t *addr;
+      array_header *addrs, *other_addrs = NULL;
+
+      addr = proxy_conn_get_addr(pconn, &other_addrs);
+      addrs = make_array(p, 2, sizeof(char *));
+      *((const char **) push_array(addrs)) = pr_netaddr_get_ipstr(addr);
+
+      if (other_addrs != NULL) {
+        register unsigned int i;
+        pr_netaddr_t **elts;
+
+        elts = other_addrs->elts;
+        for (i = 0; i < other_addrs->nelts; i++) {
+          *((const char **) push_array(addrs)) = pr_netaddr_get_ipstr(elts[i]);
+        }
+      }
+
+      (void) proxy_forward_dstcache_add(p, uri, addrs, forward_dstcache_ttl);
+
+    } else if (xerrno == EINVAL &&
+               forward_dstcache_negative_ttl > 0) {
+      (void) proxy_forward_dstcache_add(p, uri, NULL,
+        forward_dstcache_negative_ttl);
+    }
+  }
+
+  errno = xerrno;
+  return pconn;
 }
 
 static int forward_cmd_parse_dst(pool *p, const char *arg, char **name,
@@ -466,17 +637,13 @@ static int forward_cmd_parse_dst(pool *p, const char *arg, char **name,
   proto = default_proto;
 
   hostport = pstrcat(p, host, ":", port, NULL);
-  if (forward_dst_filter(p, hostport) < 0) {
+  uri = pstrcat(p, proto, "://", hostport, NULL);
+
+  if (forward_dst_filter_name(hostport) < 0) {
     return -1;
   }
 
-  uri = pstrcat(p, proto, "://", hostport, NULL);
-
-  /* Note: We deliberately use proxy_pool, rather than the given pool, here
-   * so that the created structure (especially the pr_netaddr_t) are
-   * longer-lived.
-   */
-  *pconn = proxy_conn_create(proxy_pool, uri, 0);
+  *pconn = forward_conn_create(p, uri);
   if (*pconn == NULL) {
     int xerrno = errno;
 
@@ -487,6 +654,17 @@ static int forward_cmd_parse_dst(pool *p, const char *arg, char **name,
     return -1;
   }
 
+  /* Now that we know its addresses, check them against any CIDR rules. */
+  if (forward_dst_filter_addrs(hostport, *pconn) < 0) {
+    int xerrno = errno;
+
+    proxy_conn_free(*pconn);
+    *pconn = NULL;
+
+    errno = xerrno;
+    return -1;
+  }
+
   return 0;
 }
 
@@ -511,17 +689,13 @@ static int forward_cmd_parse_sni(pool *p, const struct proxy_conn **pconn) {
     hostport = pstrdup(p, sni);
   }
 
-  if (forward_dst_filter(p, hostport) < 0) {
+  uri = pstrcat(p, "ftp://", hostport, NULL);
+
+  if (forward_dst_filter_name(hostport) < 0) {
     return -1;
   }
 
-  uri = pstrcat(p, "ftp://", hostport, NULL);
-
-  /* Note: We deliberately use proxy_pool, rather than the given pool, here
-   * so that the created structure (especially the pr_netaddr_t) are
-   * longer-lived.
-   */
-  *pconn = proxy_conn_create(proxy_pool, uri, 0);
+  *pconn = forward_conn_create(p, uri);
   if (*pconn == NULL) {
     int xerrno = errno;
 
@@ -532,6 +706,17 @@ static int forward_cmd_parse_sni(pool *p, const struct proxy_conn **pconn) {
     return -1;
   }
 
+  /* Now that we know its addresses, check them against any CIDR rules. */
+  if (forward_dst_filter_addrs(hostport, *pconn) < 0) {
+    int xerrno = errno;
+
+    proxy_conn_free(*pconn);
+    *pconn = NULL;
+
+    errno = xerrno;
+    return -1;
+  }
+
   return 0;
 }
 
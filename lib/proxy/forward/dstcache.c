@@ -0,0 +1,453 @@
+/*
+ * ProFTPD - mod_proxy forward destination cache API
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_proxy.h"
+
+#include "proxy/db.h"
+#include "proxy/forward/dstcache.h"
+
+#define PROXY_FORWARD_DB_SCHEMA_NAME		"proxy_forward"
+#define PROXY_FORWARD_DB_SCHEMA_VERSION		1
+
+static struct proxy_dbh *dstcache_dbh = NULL;
+
+static const char *trace_channel = "proxy.forward.dstcache";
+
+static int dstcache_add_schema(pool *p, struct proxy_dbh *dbh) {
+  int res;
+  const char *stmt, *errstr = NULL;
+
+  /* CREATE TABLE proxy_forward_dsts (
+   *   dst_uri TEXT NOT NULL PRIMARY KEY,
+   *   addrs TEXT NOT NULL,
+   *   good_addr TEXT NOT NULL,
+   *   expires INTEGER NOT NULL
+   * );
+   *
+   * The addrs column holds the space-separated IP addresses of the
+   * destination; it is empty for destinations which failed to resolve.
+   */
+  stmt = "CREATE TABLE IF NOT EXISTS proxy_forward_dsts (dst_uri TEXT NOT NULL PRIMARY KEY, addrs TEXT NOT NULL, good_addr TEXT NOT NULL, expires INTEGER NOT NULL);";
+  res = proxy_db_exec_stmt(p, dbh, stmt, &errstr);
+  if (res < 0) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error executing '%s': %s", stmt, errstr);
+    errno = EPERM;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int dstcache_truncate_db_tables(pool *p, struct proxy_dbh *dbh) {
+  int res;
+  const char *stmt, *errstr = NULL;
+
+  /* Resolved addresses from a previous run are not to be trusted. */
+  stmt = "DELETE FROM proxy_forward_dsts;";
+  res = proxy_db_exec_stmt(p, dbh, stmt, &errstr);
+  if (res < 0) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error executing '%s': %s", stmt, errstr);
+    errno = EPERM;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int dstcache_prune(pool *p, time_t now) {
+  int res;
+  long expires;
+  const char *stmt, *errstr = NULL;
+  array_header *results;
+
+  stmt = "DELETE FROM proxy_forward_dsts WHERE expires <= ?;";
+  res = proxy_db_prepare_stmt(p, dstcache_dbh, stmt);
+  if (res < 0) {
+    return -1;
+  }
+
+  expires = (long) now;
+  res = proxy_db_bind_stmt(p, dstcache_dbh, stmt, 1, PROXY_DB_BIND_TYPE_LONG,
+    (void *) &expires, 0);
+  if (res < 0) {
+    return -1;
+  }
+
+  results = proxy_db_exec_prepared_stmt(p, dstcache_dbh, stmt, &errstr);
+  if (results == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error executing '%s': %s", stmt, errstr ? errstr : strerror(errno));
+    errno = EPERM;
+    return -1;
+  }
+
+  return 0;
+}
+
+array_header *proxy_forward_dstcache_get(pool *p, const char *uri) {
+  int res;
+  long now;
+  const char *stmt, *errstr = NULL;
+  char *addrs, *good_addr, *ptr;
+  array_header *results, *cached;
+
+  if (p == NULL ||
+      uri == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (dstcache_dbh == NULL) {
+    errno = EPERM;
+    return NULL;
+  }
+
+  stmt = "SELECT addrs, good_addr FROM proxy_forward_dsts WHERE dst_uri = ? AND expires > ?;";
+  res = proxy_db_prepare_stmt(p, dstcache_dbh, stmt);
+  if (res < 0) {
+    return NULL;
+  }
+
+  res = proxy_db_bind_stmt(p, dstcache_dbh, stmt, 1, PROXY_DB_BIND_TYPE_TEXT,
+    (void *) uri, -1);
+  if (res < 0) {
+    return NULL;
+  }
+
+  now = (long) time(NULL);
+  res = proxy_db_bind_stmt(p, dstcache_dbh, stmt, 2, PROXY_DB_BIND_TYPE_LONG,
+    (void *) &now, 0);
+  if (res < 0) {
+    return NULL;
+  }
+
+  results = proxy_db_exec_prepared_stmt(p, dstcache_dbh, stmt, &errstr);
+  if (results == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error executing '%s': %s", stmt, errstr ? errstr : strerror(errno));
+    errno = EPERM;
+    return NULL;
+  }
+
+  if (results->nelts != 2) {
+    pr_trace_msg(trace_channel, 17, "no cached addresses for URI '%.100s'",
+      uri);
+    errno = ENOENT;
+    return NULL;
+  }
+
+  addrs = ((char **) results->elts)[0];
+  good_addr = ((char **) results->elts)[1];
+
+  if (addrs == NULL ||
+      *addrs == '\0') {
+    pr_trace_msg(trace_channel, 17, "URI '%.100s' cached as unresolvable",
+      uri);
+    errno = EHOSTUNREACH;
+    return NULL;
+  }
+
+  cached = make_array(p, 2, sizeof(char *));
+
+  /* The last-known-good address, if still among the resolved addresses,
+   * goes first, so that it is tried first.
+   */
+  if (good_addr != NULL &&
+      *good_addr != '\0') {
+    size_t good_addrlen;
+
+    good_addrlen = strlen(good_addr);
+
+    for (ptr = addrs; ptr != NULL && *ptr != '\0';) {
+      char *next;
+      size_t addrlen;
+
+      next = strchr(ptr, ' ');
+      addrlen = next != NULL ? (size_t) (next - ptr) : strlen(ptr);
+
+      if (addrlen == good_addrlen &&
+          strncmp(ptr, good_addr, addrlen) == 0) {
+        *((char **) push_array(cached)) = good_addr;
+        break;
+      }
+
+      ptr = next != NULL ? next + 1 : NULL;
+    }
+  }
+
+  for (ptr = addrs; ptr != NULL && *ptr != '\0';) {
+    char *next;
+
+    next = strchr(ptr, ' ');
+    if (next != NULL) {
+      *next++ = '\0';
+    }
+
+    if (cached->nelts == 0 ||
+        strcmp(ptr, ((char **) cached->elts)[0]) != 0) {
+      *((char **) push_array(cached)) = ptr;
+    }
+
+    ptr = next;
+  }
+
+  pr_trace_msg(trace_channel, 17, "found %d cached %s for URI '%.100s'",
+    cached->nelts, cached->nelts != 1 ? "addresses" : "address", uri);
+  return cached;
+}
+
+int proxy_forward_dstcache_add(pool *p, const char *uri, array_header *addrs,
+    int ttl) {
+  int res;
+  long expires;
+  time_t now;
+  const char *stmt, *errstr = NULL;
+  char *addrs_text = "";
+  array_header *results;
+
+  if (p == NULL ||
+      uri == NULL ||
+      ttl < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (dstcache_dbh == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (addrs != NULL) {
+    register unsigned int i;
+    char **elts;
+
+    elts = addrs->elts;
+    for (i = 0; i < addrs->nelts; i++) {
+      addrs_text = pstrcat(p, addrs_text, i > 0 ? " " : "", elts[i], NULL);
+    }
+  }
+
+  now = time(NULL);
+
+  /* Opportunistically drop any expired entries, so that the table only
+   * grows with the set of recently used destinations.
+   */
+  (void) dstcache_prune(p, now);
+
+  stmt = "INSERT OR REPLACE INTO proxy_forward_dsts (dst_uri, addrs, good_addr, expires) VALUES (?, ?, '', ?);";
+  res = proxy_db_prepare_stmt(p, dstcache_dbh, stmt);
+  if (res < 0) {
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dstcache_dbh, stmt, 1, PROXY_DB_BIND_TYPE_TEXT,
+    (void *) uri, -1);
+  if (res < 0) {
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dstcache_dbh, stmt, 2, PROXY_DB_BIND_TYPE_TEXT,
+    (void *) addrs_text, -1);
+  if (res < 0) {
+    return -1;
+  }
+
+  expires = (long) (now + ttl);
+  res = proxy_db_bind_stmt(p, dstcache_dbh, stmt, 3, PROXY_DB_BIND_TYPE_LONG,
+    (void *) &expires, 0);
+  if (res < 0) {
+    return -1;
+  }
+
+  results = proxy_db_exec_prepared_stmt(p, dstcache_dbh, stmt, &errstr);
+  if (results == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error executing '%s': %s", stmt, errstr ? errstr : strerror(errno));
+    errno = EPERM;
+    return -1;
+  }
+
+  pr_trace_msg(trace_channel, 17, "cached %s for URI '%.100s' for %d %s",
+    *addrs_text != '\0' ? addrs_text : "resolution failure", uri, ttl,
+    ttl != 1 ? "secs" : "sec");
+  return 0;
+}
+
+int proxy_forward_dstcache_set_good_addr(pool *p, const char *uri,
+    const char *addr) {
+  int res;
+  const char *stmt, *errstr = NULL;
+  array_header *results;
+
+  if (p == NULL ||
+      uri == NULL ||
+      addr == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (dstcache_dbh == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  stmt = "UPDATE proxy_forward_dsts SET good_addr = ? WHERE dst_uri = ?;";
+  res = proxy_db_prepare_stmt(p, dstcache_dbh, stmt);
+  if (res < 0) {
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dstcache_dbh, stmt, 1, PROXY_DB_BIND_TYPE_TEXT,
+    (void *) addr, -1);
+  if (res < 0) {
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dstcache_dbh, stmt, 2, PROXY_DB_BIND_TYPE_TEXT,
+    (void *) uri, -1);
+  if (res < 0) {
+    return -1;
+  }
+
+  results = proxy_db_exec_prepared_stmt(p, dstcache_dbh, stmt, &errstr);
+  if (results == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error executing '%s': %s", stmt, errstr ? errstr : strerror(errno));
+    errno = EPERM;
+    return -1;
+  }
+
+  pr_trace_msg(trace_channel, 17,
+    "recorded last-known-good address %s for URI '%.100s'", addr, uri);
+  return 0;
+}
+
+int proxy_forward_dstcache_init(pool *p, const char *tables_dir, int flags) {
+  int db_flags, res, xerrno = 0;
+  struct proxy_dbh *dbh = NULL;
+  const char *db_path = NULL;
+
+  if (p == NULL ||
+      tables_dir == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  db_path = pdircat(p, tables_dir, "proxy-forward.db", NULL);
+  db_flags = PROXY_DB_OPEN_FL_SCHEMA_VERSION_CHECK|PROXY_DB_OPEN_FL_INTEGRITY_CHECK|PROXY_DB_OPEN_FL_VACUUM;
+  if (flags & PROXY_DB_OPEN_FL_SKIP_VACUUM) {
+    /* If the caller needs us to skip the vacuum, we will. */
+    db_flags &= ~PROXY_DB_OPEN_FL_VACUUM;
+  }
+
+  PRIVS_ROOT
+  dbh = proxy_db_open_with_version(p, db_path, PROXY_FORWARD_DB_SCHEMA_NAME,
+    PROXY_FORWARD_DB_SCHEMA_VERSION, db_flags);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (dbh == NULL) {
+    (void) pr_log_pri(PR_LOG_NOTICE, MOD_PROXY_VERSION
+      ": error opening database '%s' for schema '%s', version %u: %s",
+      db_path, PROXY_FORWARD_DB_SCHEMA_NAME, PROXY_FORWARD_DB_SCHEMA_VERSION,
+      strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  res = dstcache_add_schema(p, dbh);
+  if (res < 0) {
+    xerrno = errno;
+    (void) pr_log_debug(DEBUG0, MOD_PROXY_VERSION
+      ": error creating schema in database '%s' for '%s': %s", db_path,
+      PROXY_FORWARD_DB_SCHEMA_NAME, strerror(xerrno));
+    (void) proxy_db_close(p, dbh);
+    errno = xerrno;
+    return -1;
+  }
+
+  res = dstcache_truncate_db_tables(p, dbh);
+  if (res < 0) {
+    xerrno = errno;
+    (void) proxy_db_close(p, dbh);
+    errno = xerrno;
+    return -1;
+  }
+
+  (void) proxy_db_close(p, dbh);
+  return 0;
+}
+
+int proxy_forward_dstcache_sess_init(pool *p, const char *tables_dir,
+    int flags) {
+  int xerrno = 0;
+  struct proxy_dbh *dbh;
+  const char *db_path;
+
+  if (p == NULL ||
+      tables_dir == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (dstcache_dbh != NULL) {
+    return 0;
+  }
+
+  db_path = pdircat(p, tables_dir, "proxy-forward.db", NULL);
+
+  PRIVS_ROOT
+  dbh = proxy_db_open_with_version(p, db_path, PROXY_FORWARD_DB_SCHEMA_NAME,
+    PROXY_FORWARD_DB_SCHEMA_VERSION, 0);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (dbh == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error opening database '%s' for schema '%s', version %u: %s",
+      db_path, PROXY_FORWARD_DB_SCHEMA_NAME, PROXY_FORWARD_DB_SCHEMA_VERSION,
+      strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  dstcache_dbh = dbh;
+  return 0;
+}
+
+int proxy_forward_dstcache_sess_free(pool *p) {
+  if (dstcache_dbh != NULL) {
+    if (proxy_db_close(p, dstcache_dbh) < 0) {
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error closing %s database: %s", PROXY_FORWARD_DB_SCHEMA_NAME,
+        strerror(errno));
+    }
+
+    dstcache_dbh = NULL;
+  }
+
+  return 0;
+}
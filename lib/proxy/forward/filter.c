@@ -0,0 +1,790 @@
+/*
+ * ProFTPD - mod_proxy forward destination filter
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_proxy.h"
+
+#include "proxy/forward/filter.h"
+
+/* Rules matched by a destination, by action. */
+struct filter_actions {
+  const char *allow_rule;
+  const char *deny_rule;
+};
+
+/* Binary prefix tree of CIDR rules, one bit per level. */
+struct cidr_node {
+  struct cidr_node *children[2];
+  struct filter_actions actions;
+};
+
+struct regex_rule {
+  const char *rule;
+  int negated;
+#ifdef PR_USE_REGEX
+  pr_regex_t *pre;
+#endif /* PR_USE_REGEX */
+};
+
+struct filter_decision {
+  unsigned int hash;
+  char key[256];
+  int allowed;
+  const char *rule;
+  unsigned long used;
+};
+
+struct proxy_forward_filter {
+  pool *pool;
+  int rule_count;
+  int allow_count;
+  const char *allow_rule;
+  int cidr_count;
+  int cidr_allow_count;
+
+  /* Exact "host" and "host:port" rules. */
+  pr_table_t *hosts;
+
+  struct cidr_node *cidr4;
+  struct cidr_node *cidr6;
+
+  array_header *regexes;
+
+  /* Recent decisions, evicted least-recently-used first. */
+  struct filter_decision decisions[PROXY_FORWARD_FILTER_DECISION_CACHE_SIZE];
+  unsigned long decision_clock;
+};
+
+static const char *trace_channel = "proxy.forward.filter";
+
+static void filter_set_action(struct filter_actions *actions,
+    const char *rule, int negated) {
+  if (negated == TRUE) {
+    if (actions->deny_rule == NULL) {
+      actions->deny_rule = rule;
+    }
+
+  } else {
+    if (actions->allow_rule == NULL) {
+      actions->allow_rule = rule;
+    }
+  }
+}
+
+static void filter_merge_actions(struct filter_actions *matched,
+    const struct filter_actions *actions) {
+  if (matched->deny_rule == NULL) {
+    matched->deny_rule = actions->deny_rule;
+  }
+
+  if (matched->allow_rule == NULL) {
+    matched->allow_rule = actions->allow_rule;
+  }
+}
+
+static char *filter_lower(pool *p, const char *text, size_t len) {
+  register size_t i;
+  char *lower;
+
+  lower = pstrndup(p, text, len);
+  for (i = 0; i < len; i++) {
+    lower[i] = tolower((int) lower[i]);
+  }
+
+  return lower;
+}
+
+static int filter_add_host(struct proxy_forward_filter *filter,
+    const char *rule, const char *spec, int negated) {
+  char *key, *ptr;
+  struct filter_actions *actions;
+
+  if (*spec == '\0') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* A single colon separates an optional port; more than one means an IPv6
+   * address, with no port.
+   */
+  ptr = strchr(spec, ':');
+  if (ptr != NULL &&
+      strchr(ptr + 1, ':') == NULL) {
+    char *tmp = NULL;
+    long port;
+
+    port = strtol(ptr + 1, &tmp, 10);
+    if (ptr == spec ||
+        (tmp != NULL && *tmp) ||
+        port < 1 ||
+        port > 65535) {
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  key = filter_lower(filter->pool, spec, strlen(spec));
+
+  actions = (struct filter_actions *) pr_table_get(filter->hosts, key, NULL);
+  if (actions == NULL) {
+    actions = pcalloc(filter->pool, sizeof(struct filter_actions));
+    if (pr_table_add(filter->hosts, key, actions,
+        sizeof(struct filter_actions)) < 0) {
+      return -1;
+    }
+  }
+
+  filter_set_action(actions, rule, negated);
+  return 0;
+}
+
+static int filter_add_cidr(struct proxy_forward_filter *filter,
+    const char *rule, const char *spec, int negated) {
+  register int i;
+  unsigned char addr[16];
+  int family, max_bits, bits;
+  char *network, *ptr;
+  struct cidr_node **root, *node;
+
+  network = pstrdup(filter->pool, spec);
+
+  ptr = strchr(network, '/');
+  if (ptr != NULL) {
+    *ptr = '\0';
+  }
+
+  if (pr_inet_pton(AF_INET, network, addr) == 1) {
+    family = AF_INET;
+    max_bits = 32;
+    root = &(filter->cidr4);
+
+#if defined(PR_USE_IPV6)
+  } else if (pr_inet_pton(AF_INET6, network, addr) == 1) {
+    family = AF_INET6;
+    max_bits = 128;
+    root = &(filter->cidr6);
+#endif /* PR_USE_IPV6 */
+
+  } else {
+    errno = EINVAL;
+    return -1;
+  }
+
+  bits = max_bits;
+  if (ptr != NULL) {
+    char *tmp = NULL;
+    long len;
+
+    len = strtol(ptr + 1, &tmp, 10);
+    if (*(ptr + 1) == '\0' ||
+        (tmp != NULL && *tmp) ||
+        len < 0 ||
+        len > max_bits) {
+      errno = EINVAL;
+      return -1;
+    }
+
+    bits = (int) len;
+  }
+
+  if (*root == NULL) {
+    *root = pcalloc(filter->pool, sizeof(struct cidr_node));
+  }
+
+  node = *root;
+  for (i = 0; i < bits; i++) {
+    int bit;
+
+    bit = (addr[i / 8] >> (7 - (i % 8))) & 0x01;
+    if (node->children[bit] == NULL) {
+      node->children[bit] = pcalloc(filter->pool, sizeof(struct cidr_node));
+    }
+
+    node = node->children[bit];
+  }
+
+  filter_set_action(&(node->actions), rule, negated);
+
+  pr_trace_msg(trace_channel, 17, "added %s CIDR rule '%s' (%d bits)",
+    family == AF_INET ? "IPv4" : "IPv6", rule, bits);
+  return 0;
+}
+
+static int filter_add_regex(struct proxy_forward_filter *filter,
+    const char *rule, const char *pattern, int negated, int regex_flags) {
+#ifdef PR_USE_REGEX
+  pr_regex_t *pre;
+  struct regex_rule *rr;
+  int res;
+
+  pre = pr_regexp_alloc(&proxy_module);
+
+  res = pr_regexp_compile(pre, pattern, REG_EXTENDED|REG_NOSUB|regex_flags);
+  if (res != 0) {
+    char errstr[200] = {'\0'};
+
+    pr_regexp_error(res, pre, errstr, sizeof(errstr));
+    pr_regexp_free(NULL, pre);
+
+    pr_trace_msg(trace_channel, 3,
+      "'%s' failed regex compilation: %s", pattern, errstr);
+    errno = EINVAL;
+    return -1;
+  }
+
+  rr = push_array(filter->regexes);
+  rr->rule = rule;
+  rr->negated = negated;
+  rr->pre = pre;
+
+  return 0;
+#else
+  errno = ENOSYS;
+  return -1;
+#endif /* PR_USE_REGEX */
+}
+
+struct proxy_forward_filter *proxy_forward_filter_create(pool *p) {
+  pool *filter_pool;
+  struct proxy_forward_filter *filter;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  filter_pool = make_sub_pool(p);
+  pr_pool_tag(filter_pool, "Proxy Forward Filter Pool");
+
+  filter = pcalloc(filter_pool, sizeof(struct proxy_forward_filter));
+  filter->pool = filter_pool;
+  filter->hosts = pr_table_alloc(filter_pool, 0);
+  filter->regexes = make_array(filter_pool, 1, sizeof(struct regex_rule));
+
+  return filter;
+}
+
+int proxy_forward_filter_add_rule(struct proxy_forward_filter *filter,
+    const char *rule, int regex_flags) {
+  const char *spec;
+  int negated = FALSE, res;
+
+  if (filter == NULL ||
+      rule == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  rule = pstrdup(filter->pool, rule);
+
+  spec = rule;
+  if (*spec == '!') {
+    negated = TRUE;
+    spec++;
+  }
+
+  if (*spec == '\0') {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (strncmp(spec, "host:", 5) == 0) {
+    res = filter_add_host(filter, rule, spec + 5, negated);
+
+  } else if (strncmp(spec, "cidr:", 5) == 0) {
+    res = filter_add_cidr(filter, rule, spec + 5, negated);
+    if (res == 0) {
+      filter->cidr_count++;
+      if (negated == FALSE) {
+        filter->cidr_allow_count++;
+      }
+    }
+
+  } else {
+    res = filter_add_regex(filter, rule, spec, negated, regex_flags);
+  }
+
+  if (res < 0) {
+    return -1;
+  }
+
+  filter->rule_count++;
+  if (negated == FALSE) {
+    filter->allow_count++;
+    filter->allow_rule = rule;
+  }
+
+  /* Any previous decisions may no longer hold. */
+  memset(filter->decisions, 0, sizeof(filter->decisions));
+  return 0;
+}
+
+int proxy_forward_filter_count(struct proxy_forward_filter *filter) {
+  if (filter == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return filter->rule_count;
+}
+
+static void filter_match_hosts(struct proxy_forward_filter *filter,
+    const char *hostport, struct filter_actions *matched) {
+  pool *tmp_pool;
+  char *key, *ptr;
+  const struct filter_actions *actions;
+
+  if (pr_table_count(filter->hosts) <= 0) {
+    return;
+  }
+
+  tmp_pool = make_sub_pool(filter->pool);
+  key = filter_lower(tmp_pool, hostport, strlen(hostport));
+
+  actions = pr_table_get(filter->hosts, key, NULL);
+  if (actions != NULL) {
+    filter_merge_actions(matched, actions);
+  }
+
+  /* Rules without a port apply to any port. */
+  ptr = strrchr(key, ':');
+  if (ptr != NULL) {
+    *ptr = '\0';
+
+    actions = pr_table_get(filter->hosts, key, NULL);
+    if (actions != NULL) {
+      filter_merge_actions(matched, actions);
+    }
+  }
+
+  destroy_pool(tmp_pool);
+}
+
+static void filter_match_cidrs(struct proxy_forward_filter *filter,
+    const pr_netaddr_t *addr, struct filter_actions *matched) {
+  register int i;
+  const unsigned char *bytes = NULL;
+  int bits = 0;
+  struct cidr_node *node = NULL;
+
+  switch (pr_netaddr_get_family(addr)) {
+    case AF_INET:
+      node = filter->cidr4;
+      bytes = pr_netaddr_get_inaddr(addr);
+      bits = 32;
+      break;
+
+#if defined(PR_USE_IPV6)
+    case AF_INET6:
+      bytes = pr_netaddr_get_inaddr(addr);
+
+      /* IPv4-mapped IPv6 addresses are matched against the IPv4 rules. */
+      if (pr_netaddr_is_v4mappedv6(addr) == TRUE) {
+        node = filter->cidr4;
+        bytes += 12;
+        bits = 32;
+
+      } else {
+        node = filter->cidr6;
+        bits = 128;
+      }
+      break;
+#endif /* PR_USE_IPV6 */
+  }
+
+  if (bytes == NULL) {
+    return;
+  }
+
+  /* Every prefix along the path matches the address. */
+  for (i = 0; node != NULL; i++) {
+    filter_merge_actions(matched, &(node->actions));
+
+    if (i == bits) {
+      break;
+    }
+
+    node = node->children[(bytes[i / 8] >> (7 - (i % 8))) & 0x01];
+  }
+}
+
+static void filter_match_regexes(struct proxy_forward_filter *filter,
+    const char *hostport, struct filter_actions *matched) {
+#ifdef PR_USE_REGEX
+  register unsigned int i;
+  struct regex_rule *rules;
+
+  rules = filter->regexes->elts;
+  for (i = 0; i < filter->regexes->nelts; i++) {
+    struct regex_rule *rr;
+
+    rr = &(rules[i]);
+
+    /* No need to look further for rules we have already matched. */
+    if (rr->negated == TRUE) {
+      if (matched->deny_rule != NULL) {
+        continue;
+      }
+
+    } else {
+      if (matched->allow_rule != NULL) {
+        continue;
+      }
+    }
+
+    if (pr_regexp_exec(rr->pre, hostport, 0, NULL, 0, 0, 0) == 0) {
+      if (rr->negated == TRUE) {
+        matched->deny_rule = rr->rule;
+
+      } else {
+        matched->allow_rule = rr->rule;
+      }
+    }
+  }
+#endif /* PR_USE_REGEX */
+}
+
+/* Decisions are keyed by "host:port address", hashed using FNV-1a. */
+static unsigned int filter_hash(const char *hostport, const char *ipstr) {
+  const unsigned char *ptr;
+  unsigned int hash = 2166136261U;
+
+  for (ptr = (const unsigned char *) hostport; *ptr; ptr++) {
+    hash = (hash ^ *ptr) * 16777619U;
+  }
+
+  hash = (hash ^ ' ') * 16777619U;
+
+  for (ptr = (const unsigned char *) ipstr; *ptr; ptr++) {
+    hash = (hash ^ *ptr) * 16777619U;
+  }
+
+  return hash;
+}
+
+static struct filter_decision *filter_get_decision(
+    struct proxy_forward_filter *filter, unsigned int hash,
+    const char *hostport, const char *ipstr) {
+  register unsigned int i;
+  size_t hostport_len;
+
+  hostport_len = strlen(hostport);
+
+  for (i = 0; i < PROXY_FORWARD_FILTER_DECISION_CACHE_SIZE; i++) {
+    struct filter_decision *decision;
+
+    decision = &(filter->decisions[i]);
+    if (decision->used > 0 &&
+        decision->hash == hash &&
+        strncmp(decision->key, hostport, hostport_len) == 0 &&
+        decision->key[hostport_len] == ' ' &&
+        strcmp(decision->key + hostport_len + 1, ipstr) == 0) {
+      decision->used = ++filter->decision_clock;
+      return decision;
+    }
+  }
+
+  return NULL;
+}
+
+static void filter_add_decision(struct proxy_forward_filter *filter,
+    unsigned int hash, const char *hostport, const char *ipstr, int allowed,
+    const char *rule) {
+  register unsigned int i;
+  struct filter_decision *decision = NULL;
+
+  if (strlen(hostport) + strlen(ipstr) + 1 >= sizeof(decision->key)) {
+    return;
+  }
+
+  for (i = 0; i < PROXY_FORWARD_FILTER_DECISION_CACHE_SIZE; i++) {
+    if (decision == NULL ||
+        filter->decisions[i].used < decision->used) {
+      decision = &(filter->decisions[i]);
+    }
+  }
+
+  pr_snprintf(decision->key, sizeof(decision->key)-1, "%s %s", hostport,
+    ipstr);
+  decision->hash = hash;
+  decision->allowed = allowed;
+  decision->rule = rule;
+  decision->used = ++filter->decision_clock;
+}
+
+static int filter_log_decision(const char *hostport, int allowed,
+    const char *rule) {
+  if (allowed == TRUE) {
+    return 0;
+  }
+
+  if (rule != NULL &&
+      *rule == '!') {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "host/port '%.100s' matched ProxyForwardTo %s, rejecting",
+      hostport, rule);
+
+  } else if (rule != NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "host/port '%.100s' did not match ProxyForwardTo %s, rejecting",
+      hostport, rule);
+
+  } else {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "host/port '%.100s' did not match any ProxyForwardTo rules, rejecting",
+      hostport);
+  }
+
+  errno = EPERM;
+  return -1;
+}
+
+int proxy_forward_filter_check(struct proxy_forward_filter *filter,
+    const char *hostport, const pr_netaddr_t *addr) {
+  unsigned int hash;
+  int allowed = TRUE;
+  const char *ipstr, *rule = NULL;
+  struct filter_decision *decision;
+  struct filter_actions matched;
+
+  if (filter == NULL ||
+      hostport == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (filter->rule_count == 0) {
+    return 0;
+  }
+
+  ipstr = addr != NULL ? pr_netaddr_get_ipstr(addr) : "";
+  hash = filter_hash(hostport, ipstr);
+
+  decision = filter_get_decision(filter, hash, hostport, ipstr);
+  if (decision != NULL) {
+    pr_trace_msg(trace_channel, 19,
+      "using cached decision for host/port '%.100s'", hostport);
+    return filter_log_decision(hostport, decision->allowed, decision->rule);
+  }
+
+  memset(&matched, 0, sizeof(matched));
+
+  filter_match_hosts(filter, hostport, &matched);
+  if (matched.deny_rule == NULL &&
+      addr != NULL) {
+    filter_match_cidrs(filter, addr, &matched);
+  }
+
+  if (matched.deny_rule == NULL) {
+    filter_match_regexes(filter, hostport, &matched);
+  }
+
+  if (matched.deny_rule != NULL) {
+    allowed = FALSE;
+    rule = matched.deny_rule;
+
+  } else if (filter->allow_count > 0 &&
+             matched.allow_rule == NULL) {
+    allowed = FALSE;
+
+    /* With a single rule, we can say which one was not matched. */
+    if (filter->allow_count == 1) {
+      rule = filter->allow_rule;
+    }
+  }
+
+  filter_add_decision(filter, hash, hostport, ipstr, allowed, rule);
+  return filter_log_decision(hostport, allowed, rule);
+}
+
+/* Decisions made on the name alone are cached under a marker which is not a
+ * valid address.
+ */
+#define PROXY_FORWARD_FILTER_NAME_KEY	"*"
+
+int proxy_forward_filter_check_name(struct proxy_forward_filter *filter,
+    const char *hostport) {
+  unsigned int hash;
+  int allowed = TRUE;
+  const char *rule = NULL;
+  struct filter_decision *decision;
+  struct filter_actions matched;
+
+  if (filter == NULL ||
+      hostport == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (filter->rule_count == 0) {
+    return 0;
+  }
+
+  hash = filter_hash(hostport, PROXY_FORWARD_FILTER_NAME_KEY);
+
+  decision = filter_get_decision(filter, hash, hostport,
+    PROXY_FORWARD_FILTER_NAME_KEY);
+  if (decision != NULL) {
+    pr_trace_msg(trace_channel, 19,
+      "using cached decision for host/port '%.100s'", hostport);
+    return filter_log_decision(hostport, decision->allowed, decision->rule);
+  }
+
+  memset(&matched, 0, sizeof(matched));
+
+  filter_match_hosts(filter, hostport, &matched);
+  if (matched.deny_rule == NULL) {
+    filter_match_regexes(filter, hostport, &matched);
+  }
+
+  if (matched.deny_rule != NULL) {
+    allowed = FALSE;
+    rule = matched.deny_rule;
+
+  } else if (filter->allow_count > 0 &&
+             matched.allow_rule == NULL) {
+    if (filter->cidr_allow_count > 0) {
+      /* One of its addresses may yet match a CIDR rule. */
+      pr_trace_msg(trace_channel, 19,
+        "host/port '%.100s' left to ProxyForwardTo CIDR rules", hostport);
+
+    } else {
+      allowed = FALSE;
+
+      if (filter->allow_count == 1) {
+        rule = filter->allow_rule;
+      }
+    }
+  }
+
+  filter_add_decision(filter, hash, hostport, PROXY_FORWARD_FILTER_NAME_KEY,
+    allowed, rule);
+  return filter_log_decision(hostport, allowed, rule);
+}
+
+/* Returns -1 if the address matches a negated CIDR rule; otherwise, notes
+ * whether it matches an allowing one.
+ */
+static int filter_check_addr(struct proxy_forward_filter *filter,
+    const char *hostport, const pr_netaddr_t *addr, int *allowed) {
+  struct filter_actions matched;
+
+  memset(&matched, 0, sizeof(matched));
+  filter_match_cidrs(filter, addr, &matched);
+
+  if (matched.deny_rule != NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "host/port '%.100s' address %s matched ProxyForwardTo %s, rejecting",
+      hostport, pr_netaddr_get_ipstr(addr), matched.deny_rule);
+    errno = EPERM;
+    return -1;
+  }
+
+  if (matched.allow_rule != NULL) {
+    pr_trace_msg(trace_channel, 19,
+      "host/port '%.100s' address %s matched ProxyForwardTo %s", hostport,
+      pr_netaddr_get_ipstr(addr), matched.allow_rule);
+    *allowed = TRUE;
+  }
+
+  return 0;
+}
+
+int proxy_forward_filter_check_addrs(struct proxy_forward_filter *filter,
+    const char *hostport, const pr_netaddr_t *addr,
+    array_header *other_addrs) {
+  int allowed = FALSE;
+  struct filter_actions matched;
+
+  if (filter == NULL ||
+      hostport == NULL ||
+      addr == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* The name has already been checked against the other rules. */
+  if (filter->cidr_count == 0) {
+    return 0;
+  }
+
+  /* We may connect to any of the addresses; none may be denied, and one
+   * allowed suffices.
+   */
+  if (filter_check_addr(filter, hostport, addr, &allowed) < 0) {
+    return -1;
+  }
+
+  if (other_addrs != NULL) {
+    register unsigned int i;
+    pr_netaddr_t **elts;
+
+    elts = other_addrs->elts;
+    for (i = 0; i < other_addrs->nelts; i++) {
+      if (filter_check_addr(filter, hostport, elts[i], &allowed) < 0) {
+        return -1;
+      }
+    }
+  }
+
+  if (allowed == TRUE ||
+      filter->allow_count == 0) {
+    return 0;
+  }
+
+  /* No address matched; the name must have matched an allow rule. */
+  memset(&matched, 0, sizeof(matched));
+  filter_match_hosts(filter, hostport, &matched);
+  if (matched.allow_rule == NULL) {
+    filter_match_regexes(filter, hostport, &matched);
+  }
+
+  if (matched.allow_rule != NULL) {
+    return 0;
+  }
+
+  return filter_log_decision(hostport, FALSE,
+    filter->allow_count == 1 ? filter->allow_rule : NULL);
+}
+
+int proxy_forward_filter_free(struct proxy_forward_filter *filter) {
+#ifdef PR_USE_REGEX
+  register unsigned int i;
+  struct regex_rule *rules;
+#endif /* PR_USE_REGEX */
+
+  if (filter == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+#ifdef PR_USE_REGEX
+  rules = filter->regexes->elts;
+  for (i = 0; i < filter->regexes->nelts; i++) {
+    pr_regexp_free(NULL, rules[i].pre);
+  }
+#endif /* PR_USE_REGEX */
+
+  destroy_pool(filter->pool);
+  return 0;
+}
@@ -0,0 +1,246 @@
+/*
+ * ProFTPD - mod_proxy FTP ASCII translation implementation
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_proxy.h"
+
+#include "proxy/ftp/ascii.h"
+
+struct proxy_ftp_ascii {
+  pool *pool;
+  int direction;
+
+  /* For TO_CRLF: whether the last byte we emitted was a CR.  For FROM_CRLF:
+   * whether we are holding back a CR from the end of the previous input,
+   * pending a look at the next byte.
+   */
+  int have_cr;
+
+  /* Output buffer, reused (and grown as needed) across calls. */
+  char *buf;
+  size_t bufsz;
+};
+
+static const char *trace_channel = "proxy.ftp.ascii";
+
+struct proxy_ftp_ascii *proxy_ftp_ascii_alloc(pool *p, int direction) {
+  pool *xlate_pool;
+  struct proxy_ftp_ascii *xlate;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (direction != PROXY_FTP_ASCII_TO_CRLF &&
+      direction != PROXY_FTP_ASCII_FROM_CRLF) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  xlate_pool = make_sub_pool(p);
+  pr_pool_tag(xlate_pool, "Proxy FTP ASCII translation pool");
+
+  xlate = pcalloc(xlate_pool, sizeof(struct proxy_ftp_ascii));
+  xlate->pool = xlate_pool;
+  xlate->direction = direction;
+
+  return xlate;
+}
+
+static void ascii_ensure_bufsz(struct proxy_ftp_ascii *xlate, size_t sz) {
+  size_t new_sz;
+
+  if (xlate->bufsz >= sz) {
+    return;
+  }
+
+  new_sz = xlate->bufsz > 0 ? xlate->bufsz : 1024;
+  while (new_sz < sz) {
+    new_sz *= 2;
+  }
+
+  pr_trace_msg(trace_channel, 19,
+    "growing ASCII translation buffer from %lu to %lu bytes",
+    (unsigned long) xlate->bufsz, (unsigned long) new_sz);
+
+  /* The previous buffer is reclaimed along with the pool. */
+  xlate->buf = palloc(xlate->pool, new_sz);
+  xlate->bufsz = new_sz;
+}
+
+/* Insert a CR before every LF which does not already have one.  We scan for
+ * LFs using memchr(3), which is usually vectorized, and copy the runs of
+ * bytes between them in bulk.
+ */
+static size_t ascii_to_crlf(struct proxy_ftp_ascii *xlate, const char *in,
+    size_t inlen) {
+  const char *ptr, *end;
+  char *dst;
+
+  ptr = in;
+  end = in + inlen;
+  dst = xlate->buf;
+
+  while (ptr < end) {
+    const char *lf;
+    size_t len;
+
+    lf = memchr(ptr, '\n', end - ptr);
+    if (lf == NULL) {
+      len = end - ptr;
+      memcpy(dst, ptr, len);
+      dst += len;
+      xlate->have_cr = (ptr[len-1] == '\r');
+      break;
+    }
+
+    len = lf - ptr;
+    if (len > 0) {
+      memcpy(dst, ptr, len);
+      dst += len;
+      xlate->have_cr = (lf[-1] == '\r');
+    }
+
+    if (xlate->have_cr == FALSE) {
+      *dst++ = '\r';
+    }
+
+    *dst++ = '\n';
+    xlate->have_cr = FALSE;
+    ptr = lf + 1;
+  }
+
+  return dst - xlate->buf;
+}
+
+/* Remove the CR from every CRLF; lone CRs are left as is. */
+static size_t ascii_from_crlf(struct proxy_ftp_ascii *xlate, const char *in,
+    size_t inlen) {
+  const char *ptr, *end;
+  char *dst;
+
+  ptr = in;
+  end = in + inlen;
+  dst = xlate->buf;
+
+  if (xlate->have_cr == TRUE) {
+    xlate->have_cr = FALSE;
+
+    if (*ptr != '\n') {
+      *dst++ = '\r';
+    }
+  }
+
+  while (ptr < end) {
+    const char *cr;
+    size_t len;
+
+    cr = memchr(ptr, '\r', end - ptr);
+    if (cr == NULL) {
+      len = end - ptr;
+      memcpy(dst, ptr, len);
+      dst += len;
+      break;
+    }
+
+    len = cr - ptr;
+    memcpy(dst, ptr, len);
+    dst += len;
+
+    if (cr + 1 == end) {
+      /* We need to see the next byte before deciding what to do with
+       * this CR.
+       */
+      xlate->have_cr = TRUE;
+      break;
+    }
+
+    if (cr[1] != '\n') {
+      *dst++ = '\r';
+    }
+
+    ptr = cr + 1;
+  }
+
+  return dst - xlate->buf;
+}
+
+int proxy_ftp_ascii_translate(struct proxy_ftp_ascii *xlate, const char *in,
+    size_t inlen, char **out, size_t *outlen) {
+
+  if (xlate == NULL ||
+      in == NULL ||
+      out == NULL ||
+      outlen == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (inlen == 0) {
+    *out = xlate->buf;
+    *outlen = 0;
+    return 0;
+  }
+
+  switch (xlate->direction) {
+    case PROXY_FTP_ASCII_TO_CRLF:
+      /* Worst case: every byte is a bare LF. */
+      ascii_ensure_bufsz(xlate, inlen * 2);
+      *outlen = ascii_to_crlf(xlate, in, inlen);
+      break;
+
+    case PROXY_FTP_ASCII_FROM_CRLF:
+      /* Worst case: a held-back lone CR, plus the input as is. */
+      ascii_ensure_bufsz(xlate, inlen + 1);
+      *outlen = ascii_from_crlf(xlate, in, inlen);
+      break;
+  }
+
+  *out = xlate->buf;
+  return 0;
+}
+
+int proxy_ftp_ascii_finish(struct proxy_ftp_ascii *xlate, char **out,
+    size_t *outlen) {
+
+  if (xlate == NULL ||
+      out == NULL ||
+      outlen == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  *outlen = 0;
+
+  if (xlate->direction == PROXY_FTP_ASCII_FROM_CRLF &&
+      xlate->have_cr == TRUE) {
+    ascii_ensure_bufsz(xlate, 1);
+    xlate->buf[0] = '\r';
+    *outlen = 1;
+  }
+
+  xlate->have_cr = FALSE;
+  *out = xlate->buf;
+  return 0;
+}
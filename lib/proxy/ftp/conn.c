@@ -26,10 +26,40 @@
 
 #include "include/proxy/inet.h"
 #include "include/proxy/netio.h"
+#include "include/proxy/random.h"
+#include "include/proxy/sockopts.h"
 #include "include/proxy/ftp/conn.h"
 
 static const char *trace_channel = "proxy.ftp.conn";
 
+/* Pool of listening sockets, kept open across active data transfers with
+ * backend servers.  Each pooled socket is bound, optioned, and listening;
+ * callers are handed a conn for a dup(2) of the socket, so that the pooled
+ * socket survives whatever happens to that conn.
+ */
+struct listen_entry {
+  int fd;
+  const pr_netaddr_t *addr;
+  unsigned long last_used;
+
+  /* The fd of the conn most recently handed out for this socket. */
+  int conn_fd;
+};
+
+static pool *listen_pool = NULL;
+static array_header *listen_entries = NULL;
+static unsigned int listen_pool_size = 0;
+static unsigned long listen_seqno = 0;
+
+/* Free port allocator over the PassivePorts range: the ports, in random
+ * order, and the index of the next port to try.  Resuming from where the
+ * last search stopped avoids probing the same busy ports on every transfer.
+ */
+static array_header *listen_ports = NULL;
+static int listen_ports_min = -1, listen_ports_max = -1;
+static unsigned int listen_ports_idx = 0;
+static int listen_ports_warned = FALSE;
+
 static int set_conn_socket_opts(pool *p, conn_t *conn, int rcvbufsz,
     int sndbufsz, struct tcp_keepalive *keepalive, int reuse_port) {
   int res;
@@ -63,6 +93,14 @@ static int set_conn_socket_opts(pool *p, conn_t *conn, int rcvbufsz,
   return res;
 }
 
+static int get_sockopts_role(int frontend_data) {
+  if (frontend_data) {
+    return PROXY_SOCKOPTS_ROLE_FRONTEND_DATA;
+  }
+
+  return PROXY_SOCKOPTS_ROLE_BACKEND_DATA;
+}
+
 conn_t *proxy_ftp_conn_accept(pool *p, conn_t *data_conn, conn_t *ctrl_conn,
     int frontend_data) {
   conn_t *conn;
@@ -126,6 +164,9 @@ conn_t *proxy_ftp_conn_accept(pool *p, conn_t *data_conn, conn_t *ctrl_conn,
     pr_pool_tag(conn->pool, "proxy backend data accept conn pool");
   }
 
+  /* Not all socket options are inherited from the listening socket. */
+  (void) proxy_sockopts_apply_conn(conn, get_sockopts_role(frontend_data));
+
   pr_trace_msg(trace_channel, 9,
     "accepted connection from server '%s'", conn->remote_name);
   return conn;
@@ -162,6 +203,7 @@ conn_t *proxy_ftp_conn_connect(pool *p, const pr_netaddr_t *bind_addr,
 
   pr_inet_set_proto_opts(session.pool, conn,
     main_server->tcp_mss_len, 1, IPTOS_THROUGHPUT, 1);
+  (void) proxy_sockopts_apply_conn(conn, get_sockopts_role(frontend_data));
   pr_inet_generate_socket_event("proxy.data-connect", main_server,
     conn->local_addr, conn->listen_fd);
 
@@ -239,9 +281,346 @@ conn_t *proxy_ftp_conn_connect(pool *p, const pr_netaddr_t *bind_addr,
   return opened;
 }
 
+/* Binds a new socket to the given port, without logging a failure; in a
+ * busy PassivePorts range, many ports are expected to be in use.
+ */
+static int listen_portrange_bind(const pr_netaddr_t *bind_addr, int port) {
+  pr_netaddr_t addr;
+  int fd, on = 1, xerrno;
+
+  fd = socket(pr_netaddr_get_family(bind_addr), SOCK_STREAM, IPPROTO_TCP);
+  if (fd < 0) {
+    return -1;
+  }
+
+  (void) setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void *) &on, sizeof(on));
+
+  memcpy(&addr, bind_addr, sizeof(addr));
+  pr_netaddr_set_port(&addr, htons(port));
+
+  if (bind(fd, pr_netaddr_get_sockaddr(&addr),
+      pr_netaddr_get_sockaddr_len(&addr)) < 0) {
+    xerrno = errno;
+    (void) close(fd);
+
+    errno = xerrno;
+    return -1;
+  }
+
+  return fd;
+}
+
+static conn_t *listen_portrange_conn(const pr_netaddr_t *bind_addr,
+    int min_port, int max_port) {
+  register unsigned int i;
+  int *ports;
+
+  if (listen_ports == NULL ||
+      listen_ports_min != min_port ||
+      listen_ports_max != max_port) {
+    int port;
+
+    listen_ports = make_array(session.pool, max_port - min_port + 1,
+      sizeof(int));
+    for (port = min_port; port <= max_port; port++) {
+      *((int *) push_array(listen_ports)) = port;
+    }
+
+    (void) proxy_random_shuffle(listen_ports);
+    listen_ports_min = min_port;
+    listen_ports_max = max_port;
+    listen_ports_idx = 0;
+  }
+
+  ports = listen_ports->elts;
+  for (i = 0; i < (unsigned int) listen_ports->nelts; i++) {
+    conn_t *conn;
+    int fd, port;
+
+    port = ports[listen_ports_idx];
+    listen_ports_idx = (listen_ports_idx + 1) % listen_ports->nelts;
+
+    fd = listen_portrange_bind(bind_addr, port);
+    if (fd < 0) {
+      int xerrno = errno;
+
+      if (xerrno == EADDRINUSE) {
+        continue;
+      }
+
+      pr_trace_msg(trace_channel, 3, "error binding to %s#%d: %s",
+        pr_netaddr_get_ipstr(bind_addr), port, strerror(xerrno));
+
+      errno = xerrno;
+      return NULL;
+    }
+
+    /* As for a pooled socket, the connection uses the socket as bound. */
+    conn = pr_inet_create_conn(session.pool, fd, bind_addr, INPORT_ANY, FALSE);
+    if (conn == NULL) {
+      (void) close(fd);
+      return NULL;
+    }
+
+    (void) pr_inet_get_conn_info(conn, fd);
+    if (conn->local_addr == NULL) {
+      pr_inet_close(session.pool, conn);
+      return NULL;
+    }
+
+    return conn;
+  }
+
+  errno = EADDRINUSE;
+  return NULL;
+}
+
+static void listen_entry_remove(unsigned int idx) {
+  struct listen_entry *entries;
+
+  entries = listen_entries->elts;
+  (void) close(entries[idx].fd);
+
+  if (idx != (unsigned int) listen_entries->nelts - 1) {
+    memcpy(&(entries[idx]), &(entries[listen_entries->nelts - 1]),
+      sizeof(struct listen_entry));
+  }
+
+  listen_entries->nelts--;
+}
+
+/* A pooled socket can only be reused if it is still listening, and has no
+ * pending connections (e.g. a late connection for an earlier, failed
+ * transfer).
+ */
+static int listen_entry_usable(struct listen_entry *entry) {
+  fd_set rfds;
+  struct timeval tv;
+  int res;
+
+#if defined(SO_ACCEPTCONN)
+  int listening = 0;
+  socklen_t len = sizeof(listening);
+
+  if (getsockopt(entry->fd, SOL_SOCKET, SO_ACCEPTCONN, (void *) &listening,
+      &len) < 0 ||
+      listening == 0) {
+    return FALSE;
+  }
+#endif /* SO_ACCEPTCONN */
+
+  FD_ZERO(&rfds);
+  FD_SET(entry->fd, &rfds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+
+  res = select(entry->fd + 1, &rfds, NULL, NULL, &tv);
+  if (res != 0) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static conn_t *listen_pool_get(const pr_netaddr_t *bind_addr) {
+  register unsigned int i;
+  struct listen_entry *entries, *entry = NULL;
+  unsigned int count = 0;
+  int fd;
+  conn_t *conn;
+
+  if (listen_entries == NULL) {
+    return NULL;
+  }
+
+  entries = listen_entries->elts;
+  for (i = 0; i < (unsigned int) listen_entries->nelts;) {
+    if (pr_netaddr_cmp(entries[i].addr, bind_addr) == 0 &&
+        listen_entry_usable(&(entries[i])) == FALSE) {
+      pr_trace_msg(trace_channel, 9,
+        "discarding unusable pooled listening socket fd %d", entries[i].fd);
+      listen_entry_remove(i);
+      continue;
+    }
+
+    i++;
+  }
+
+  for (i = 0; i < (unsigned int) listen_entries->nelts; i++) {
+    if (pr_netaddr_cmp(entries[i].addr, bind_addr) != 0) {
+      continue;
+    }
+
+    count++;
+    if (entry == NULL ||
+        entries[i].last_used < entry->last_used) {
+      entry = &(entries[i]);
+    }
+  }
+
+  /* Rotate through a full set of sockets for this address, so that
+   * consecutive transfers use different ports.
+   */
+  if (entry == NULL ||
+      count < listen_pool_size) {
+    return NULL;
+  }
+
+  fd = dup(entry->fd);
+  if (fd < 0) {
+    pr_trace_msg(trace_channel, 3,
+      "error duplicating pooled listening socket fd %d: %s", entry->fd,
+      strerror(errno));
+    return NULL;
+  }
+
+  conn = pr_inet_create_conn(session.pool, fd, bind_addr, INPORT_ANY, FALSE);
+  if (conn == NULL) {
+    (void) close(fd);
+    return NULL;
+  }
+
+  (void) pr_inet_get_conn_info(conn, fd);
+  if (conn->local_addr == NULL) {
+    pr_inet_close(session.pool, conn);
+    return NULL;
+  }
+
+  entry->last_used = ++listen_seqno;
+  entry->conn_fd = conn->listen_fd;
+
+  pr_trace_msg(trace_channel, 9, "reusing pooled listening socket for %s#%u",
+    pr_netaddr_get_ipstr(bind_addr), conn->local_port);
+  return conn;
+}
+
+static void listen_pool_add(conn_t *conn) {
+  register unsigned int i;
+  struct listen_entry *entries, *entry;
+  int fd;
+
+  if (listen_entries == NULL) {
+    return;
+  }
+
+  /* Make room, if need be, by evicting the least recently used socket. */
+  if ((unsigned int) listen_entries->nelts >= listen_pool_size) {
+    unsigned int idx = 0;
+
+    entries = listen_entries->elts;
+    for (i = 1; i < (unsigned int) listen_entries->nelts; i++) {
+      if (entries[i].last_used < entries[idx].last_used) {
+        idx = i;
+      }
+    }
+
+    listen_entry_remove(idx);
+  }
+
+  fd = dup(conn->listen_fd);
+  if (fd < 0) {
+    pr_trace_msg(trace_channel, 3,
+      "error duplicating listening socket fd %d: %s", conn->listen_fd,
+      strerror(errno));
+    return;
+  }
+
+  entry = push_array(listen_entries);
+  entry->fd = fd;
+  entry->addr = pr_netaddr_dup(listen_pool, conn->local_addr);
+  entry->last_used = ++listen_seqno;
+  entry->conn_fd = conn->listen_fd;
+
+  pr_trace_msg(trace_channel, 9,
+    "added listening socket for %s#%u to pool (%d/%u)",
+    pr_netaddr_get_ipstr(conn->local_addr), conn->local_port,
+    listen_entries->nelts, listen_pool_size);
+}
+
+int proxy_ftp_conn_listen_close(pool *p, conn_t *conn) {
+  register unsigned int i;
+  struct listen_entry *entries;
+
+  if (p == NULL ||
+      conn == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (listen_entries != NULL &&
+      conn->listen_fd != -1) {
+    entries = listen_entries->elts;
+    for (i = 0; i < (unsigned int) listen_entries->nelts; i++) {
+      if (entries[i].conn_fd != conn->listen_fd) {
+        continue;
+      }
+
+      /* Close our copy of the socket, but without the shutdown(2) of
+       * proxy_inet_close(), which would stop the pooled socket from
+       * listening.
+       */
+      entries[i].conn_fd = -1;
+
+      if (conn->instrm != NULL) {
+        proxy_netio_close(conn->instrm);
+        conn->instrm = NULL;
+      }
+
+      if (conn->outstrm != NULL) {
+        proxy_netio_close(conn->outstrm);
+        conn->outstrm = NULL;
+      }
+
+      pr_inet_close(p, conn);
+      return 0;
+    }
+  }
+
+  proxy_inet_close(p, conn);
+  pr_inet_close(p, conn);
+  return 0;
+}
+
+int proxy_ftp_conn_listen_pool_init(pool *p, unsigned int size) {
+  if (p == NULL ||
+      size == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  (void) proxy_ftp_conn_listen_pool_free();
+
+  listen_pool = make_sub_pool(p);
+  pr_pool_tag(listen_pool, "Proxy FTP listen pool");
+
+  listen_entries = make_array(listen_pool, size, sizeof(struct listen_entry));
+  listen_pool_size = size;
+  listen_seqno = 0;
+
+  return 0;
+}
+
+int proxy_ftp_conn_listen_pool_free(void) {
+  if (listen_entries != NULL) {
+    while (listen_entries->nelts > 0) {
+      listen_entry_remove(listen_entries->nelts - 1);
+    }
+
+    listen_entries = NULL;
+  }
+
+  if (listen_pool != NULL) {
+    destroy_pool(listen_pool);
+    listen_pool = NULL;
+  }
+
+  listen_pool_size = 0;
+  return 0;
+}
+
 conn_t *proxy_ftp_conn_listen(pool *p, const pr_netaddr_t *bind_addr,
     int frontend_data) {
-  int res;
+  int pooled = FALSE, res;
   conn_t *conn = NULL;
   config_rec *c;
 
@@ -251,22 +630,32 @@ conn_t *proxy_ftp_conn_listen(pool *p, const pr_netaddr_t *bind_addr,
     return NULL;
   }
 
-  c = find_config(main_server->conf, CONF_PARAM, "PassivePorts", FALSE);
-  if (c != NULL) {
-    int pasv_min_port = *((int *) c->argv[0]);
-    int pasv_max_port = *((int *) c->argv[1]);
+  if (frontend_data == FALSE) {
+    conn = listen_pool_get(bind_addr);
+    if (conn != NULL) {
+      pooled = TRUE;
+    }
+  }
 
-    conn = pr_inet_create_conn_portrange(session.pool, bind_addr,
-      pasv_min_port, pasv_max_port);
-    if (conn == NULL) {
-      /* If not able to open a passive port in the given range, default to
-       * normal behavior (using INPORT_ANY), and log the failure.  This
-       * indicates a too-small range configuration.
-       */
-      pr_log_pri(PR_LOG_WARNING,
-        "unable to find open port in PassivePorts range %d-%d: "
-        "defaulting to INPORT_ANY (consider defining a larger PassivePorts "
-        "range)", pasv_min_port, pasv_max_port);
+  if (conn == NULL) {
+    c = find_config(main_server->conf, CONF_PARAM, "PassivePorts", FALSE);
+    if (c != NULL) {
+      int pasv_min_port = *((int *) c->argv[0]);
+      int pasv_max_port = *((int *) c->argv[1]);
+
+      conn = listen_portrange_conn(bind_addr, pasv_min_port, pasv_max_port);
+      if (conn == NULL &&
+          listen_ports_warned == FALSE) {
+        /* If not able to open a passive port in the given range, default to
+         * normal behavior (using INPORT_ANY), and log the failure, once per
+         * session.  This indicates a too-small range configuration.
+         */
+        pr_log_pri(PR_LOG_WARNING,
+          "unable to find open port in PassivePorts range %d-%d: "
+          "defaulting to INPORT_ANY (consider defining a larger PassivePorts "
+          "range)", pasv_min_port, pasv_max_port);
+        listen_ports_warned = TRUE;
+      }
     }
   }
 
@@ -284,13 +673,16 @@ conn_t *proxy_ftp_conn_listen(pool *p, const pr_netaddr_t *bind_addr,
     return NULL;
   }
 
-  /* Make sure that necessary socket options are set on the socket prior
-   * to the call to listen(2).
-   */
-  pr_inet_set_proto_opts(session.pool, conn, main_server->tcp_mss_len, 1,
-    IPTOS_THROUGHPUT, 1);
-  pr_inet_generate_socket_event("proxy.data-listen", main_server,
-    conn->local_addr, conn->listen_fd);
+  if (pooled == FALSE) {
+    /* Make sure that necessary socket options are set on the socket prior
+     * to the call to listen(2).  Pooled sockets already have them.
+     */
+    pr_inet_set_proto_opts(session.pool, conn, main_server->tcp_mss_len, 1,
+      IPTOS_THROUGHPUT, 1);
+    (void) proxy_sockopts_apply_conn(conn, get_sockopts_role(frontend_data));
+    pr_inet_generate_socket_event("proxy.data-listen", main_server,
+      conn->local_addr, conn->listen_fd);
+  }
 
   pr_inet_set_block(session.pool, conn);
 
@@ -309,9 +701,11 @@ conn_t *proxy_ftp_conn_listen(pool *p, const pr_netaddr_t *bind_addr,
       ntohs(pr_netaddr_get_port(bind_addr)), strerror(xerrno));
 
     if (!frontend_data) {
-      proxy_inet_close(session.pool, conn);
+      (void) proxy_ftp_conn_listen_close(session.pool, conn);
+
+    } else {
+      pr_inet_close(session.pool, conn);
     }
-    pr_inet_close(session.pool, conn);
 
     errno = xerrno;
     return NULL;
@@ -334,5 +728,10 @@ conn_t *proxy_ftp_conn_listen(pool *p, const pr_netaddr_t *bind_addr,
       conn->listen_fd, PR_NETIO_IO_WR);
   }
 
+  if (frontend_data == FALSE &&
+      pooled == FALSE) {
+    listen_pool_add(conn);
+  }
+
   return conn;
 }
@@ -29,6 +29,280 @@
 
 static const char *trace_channel = "proxy.ftp.data";
 
+/* Each timer reset costs a handful of syscalls (blocking signals, re-arming
+ * the alarm), which adds up when relaying small buffers.  So during a
+ * transfer, we only note which timers saw activity, and apply the resets at
+ * most once per tick, using time(3) as a cheap coarse clock.
+ */
+static int data_timer_tick = 0;
+static int data_timer_pending = 0;
+static time_t data_timer_last_reset = 0;
+static unsigned long data_timer_nresets = 0;
+static unsigned long data_timer_ndeferred = 0;
+
+/* Bulk transfer batches are timed in milliseconds, as the batch time budget
+ * bounds how long a command on the control connection may wait.
+ */
+static off_t data_bulk_max_bytes = 0;
+static unsigned int data_bulk_max_millis = 0;
+static off_t data_bulk_batch_bytes = 0;
+static uint64_t data_bulk_batch_start_ms = 0;
+static unsigned long data_bulk_nbatches = 0;
+static unsigned long data_bulk_nbuffers = 0;
+
+static unsigned int data_timers_count(int timers) {
+  unsigned int count = 0;
+
+  if (timers & PROXY_FTP_DATA_TIMER_IDLE) {
+    count++;
+  }
+
+  if (timers & PROXY_FTP_DATA_TIMER_NOXFER) {
+    count++;
+  }
+
+  if (timers & PROXY_FTP_DATA_TIMER_STALLED) {
+    count++;
+  }
+
+  return count;
+}
+
+static int data_timers_reset(int timers) {
+  unsigned int count;
+
+  if (timers & PROXY_FTP_DATA_TIMER_NOXFER) {
+    pr_timer_reset(PR_TIMER_NOXFER, ANY_MODULE);
+  }
+
+  if (timers & PROXY_FTP_DATA_TIMER_STALLED) {
+    pr_timer_reset(PR_TIMER_STALLED, ANY_MODULE);
+  }
+
+  if (timers & PROXY_FTP_DATA_TIMER_IDLE) {
+    pr_timer_reset(PR_TIMER_IDLE, ANY_MODULE);
+  }
+
+  count = data_timers_count(timers);
+  data_timer_nresets += count;
+  return (int) count;
+}
+
+int proxy_ftp_data_timers_start(int tick) {
+  register unsigned int i;
+  int timeout_ids[3] = {
+    PR_DATA_TIMEOUT_IDLE,
+    PR_DATA_TIMEOUT_NO_TRANSFER,
+    PR_DATA_TIMEOUT_STALLED
+  };
+
+  if (tick < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* A deferred reset may be applied up to one tick (plus the coarseness of
+   * the clock) late; keeping the tick below the smallest configured timeout
+   * ensures that no timer can expire while activity is still pending.
+   */
+  for (i = 0; i < 3; i++) {
+    int timeout;
+
+    timeout = pr_data_get_timeout(timeout_ids[i]);
+    if (timeout > 0 &&
+        tick >= timeout) {
+      tick = timeout - 1;
+    }
+  }
+
+  data_timer_tick = tick;
+  data_timer_pending = 0;
+  data_timer_nresets = data_timer_ndeferred = 0;
+
+  /* Apply the first touch immediately. */
+  data_timer_last_reset = 0;
+
+  pr_trace_msg(trace_channel, 17, "using data transfer timer tick of %d %s",
+    tick, tick != 1 ? "secs" : "sec");
+  return tick;
+}
+
+int proxy_ftp_data_timers_stop(void) {
+  int res;
+
+  res = proxy_ftp_data_timers_flush();
+
+  if (data_timer_tick > 0) {
+    pr_trace_msg(trace_channel, 17,
+      "data transfer timers: %lu resets, %lu deferred", data_timer_nresets,
+      data_timer_ndeferred);
+  }
+
+  data_timer_tick = 0;
+  return res;
+}
+
+int proxy_ftp_data_timers_touch(int timers) {
+  timers &= PROXY_FTP_DATA_TIMER_ALL;
+  if (timers == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (data_timer_tick > 0) {
+    if ((time(NULL) - data_timer_last_reset) < data_timer_tick) {
+      data_timer_pending |= timers;
+      data_timer_ndeferred += data_timers_count(timers);
+      return 0;
+    }
+  }
+
+  data_timer_pending |= timers;
+  return proxy_ftp_data_timers_flush();
+}
+
+int proxy_ftp_data_timers_flush(void) {
+  int res;
+
+  if (data_timer_pending == 0) {
+    return 0;
+  }
+
+  res = data_timers_reset(data_timer_pending);
+  data_timer_pending = 0;
+
+  if (data_timer_tick > 0) {
+    data_timer_last_reset = time(NULL);
+  }
+
+  return res;
+}
+
+int proxy_ftp_data_timers_get_delay(void) {
+  time_t elapsed;
+
+  if (data_timer_pending == 0 ||
+      data_timer_tick == 0) {
+    return -1;
+  }
+
+  elapsed = time(NULL) - data_timer_last_reset;
+  if (elapsed >= data_timer_tick) {
+    return 0;
+  }
+
+  return (int) (data_timer_tick - elapsed);
+}
+
+int proxy_ftp_data_timers_get_stats(unsigned long *nresets,
+    unsigned long *ndeferred) {
+  if (nresets == NULL &&
+      ndeferred == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (nresets != NULL) {
+    *nresets = data_timer_nresets;
+  }
+
+  if (ndeferred != NULL) {
+    *ndeferred = data_timer_ndeferred;
+  }
+
+  return 0;
+}
+
+int proxy_ftp_data_bulk_start(off_t max_bytes, unsigned int max_millis) {
+  if (max_bytes < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (max_millis == 0) {
+    max_millis = PROXY_FTP_DATA_BULK_DEFAULT_MAX_MILLIS;
+  }
+
+  data_bulk_max_bytes = max_bytes;
+  data_bulk_max_millis = max_millis;
+  data_bulk_batch_bytes = 0;
+  data_bulk_batch_start_ms = 0;
+  data_bulk_nbatches = data_bulk_nbuffers = 0;
+
+  if (max_bytes > 0) {
+    pr_trace_msg(trace_channel, 17,
+      "using bulk data transfer batches of %" PR_LU " bytes, %u ms",
+      (pr_off_t) max_bytes, max_millis);
+  }
+
+  return 0;
+}
+
+int proxy_ftp_data_bulk_stop(void) {
+  if (data_bulk_max_bytes > 0) {
+    pr_trace_msg(trace_channel, 17,
+      "bulk data transfer: %lu buffers in %lu batches", data_bulk_nbuffers,
+      data_bulk_nbatches);
+  }
+
+  data_bulk_max_bytes = 0;
+  data_bulk_batch_bytes = 0;
+  data_bulk_batch_start_ms = 0;
+  return 0;
+}
+
+int proxy_ftp_data_bulk_next(size_t nbytes) {
+  uint64_t now;
+
+  if (data_bulk_max_bytes == 0) {
+    return FALSE;
+  }
+
+  data_bulk_nbuffers++;
+
+  (void) pr_gettimeofday_millis(&now);
+  if (data_bulk_batch_start_ms == 0) {
+    data_bulk_batch_start_ms = now;
+    data_bulk_nbatches++;
+  }
+
+  data_bulk_batch_bytes += nbytes;
+  if (data_bulk_batch_bytes >= data_bulk_max_bytes ||
+      (now - data_bulk_batch_start_ms) >= data_bulk_max_millis) {
+    pr_trace_msg(trace_channel, 19,
+      "bulk data transfer batch of %" PR_LU " bytes done, polling control "
+      "connections", (pr_off_t) data_bulk_batch_bytes);
+    return proxy_ftp_data_bulk_end();
+  }
+
+  return TRUE;
+}
+
+int proxy_ftp_data_bulk_end(void) {
+  data_bulk_batch_bytes = 0;
+  data_bulk_batch_start_ms = 0;
+  return 0;
+}
+
+int proxy_ftp_data_bulk_get_stats(unsigned long *nbatches,
+    unsigned long *nbuffers) {
+  if (nbatches == NULL &&
+      nbuffers == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (nbatches != NULL) {
+    *nbatches = data_bulk_nbatches;
+  }
+
+  if (nbuffers != NULL) {
+    *nbuffers = data_bulk_nbuffers;
+  }
+
+  return 0;
+}
+
 pr_buffer_t *proxy_ftp_data_recv(pool *p, conn_t *data_conn,
     int frontend_data) {
   int nread;
@@ -74,9 +348,7 @@ pr_buffer_t *proxy_ftp_data_recv(pool *p, conn_t *data_conn,
       return pbuf;
     }
 
-    pr_timer_reset(PR_TIMER_NOXFER, ANY_MODULE);
-    pr_timer_reset(PR_TIMER_STALLED, ANY_MODULE);
-    pr_timer_reset(PR_TIMER_IDLE, ANY_MODULE);
+    (void) proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_ALL);
 
     pr_trace_msg(trace_channel, 15, "received %d bytes of data", nread);
 
@@ -162,9 +434,7 @@ int proxy_ftp_data_send(pool *p, conn_t *data_conn, pr_buffer_t *pbuf,
     return -1;
   }
 
-  pr_timer_reset(PR_TIMER_NOXFER, ANY_MODULE);
-  pr_timer_reset(PR_TIMER_STALLED, ANY_MODULE);
-  pr_timer_reset(PR_TIMER_IDLE, ANY_MODULE);
+  (void) proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_ALL);
 
   return nwrote;
 }
@@ -0,0 +1,284 @@
+/*
+ * ProFTPD - mod_proxy FTP database implementation
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_proxy.h"
+
+#include "proxy/db.h"
+#include "proxy/ftp/xfer.h"
+#include "proxy/ftp/db.h"
+
+static const char *trace_channel = "proxy.ftp.db";
+
+#define PROXY_FTP_DB_SCHEMA_NAME		"proxy_ftp"
+#define PROXY_FTP_DB_SCHEMA_VERSION		1
+
+static unsigned long db_opts = 0UL;
+
+static int ftp_db_get_dataxfer(pool *p, void *dsh, unsigned int vhost_id,
+    const char *backend_uri, unsigned long *flags, time_t *updated) {
+  int res, xerrno;
+  struct proxy_dbh *dbh;
+  const char *stmt, *errstr = NULL;
+  array_header *results;
+
+  dbh = dsh;
+
+  stmt = "SELECT flags, updated FROM proxy_ftp_dataxfer WHERE vhost_id = ? AND backend_uri = ?;";
+  res = proxy_db_prepare_stmt(p, dbh, stmt);
+  if (res < 0) {
+    xerrno = errno;
+    (void) pr_log_debug(DEBUG3, MOD_PROXY_VERSION
+      ": error preparing statement '%s': %s", stmt, strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dbh, stmt, 1, PROXY_DB_BIND_TYPE_INT,
+    (void *) &vhost_id, 0);
+  if (res < 0) {
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dbh, stmt, 2, PROXY_DB_BIND_TYPE_TEXT,
+    (void *) backend_uri, -1);
+  if (res < 0) {
+    return -1;
+  }
+
+  results = proxy_db_exec_prepared_stmt(p, dbh, stmt, &errstr);
+  if (results == NULL ||
+      results->nelts == 0) {
+    errno = ENOENT;
+    return -1;
+  }
+
+  /* We expect 2 items: the flags, and when they were last updated. */
+  if (results->nelts != 2) {
+    pr_log_debug(DEBUG3, MOD_PROXY_VERSION
+      ": expected 2 results from statement '%s', got %d", stmt,
+      results->nelts);
+    errno = EINVAL;
+    return -1;
+  }
+
+  *flags = strtoul(((char **) results->elts)[0], NULL, 10);
+  *updated = (time_t) strtol(((char **) results->elts)[1], NULL, 10);
+
+  pr_trace_msg(trace_channel, 19,
+    "retrieved data transfer flags %lu for vhost ID %u, URI '%s'", *flags,
+    vhost_id, backend_uri);
+  return 0;
+}
+
+static int ftp_db_set_dataxfer(pool *p, void *dsh, unsigned int vhost_id,
+    const char *backend_uri, unsigned long flags, time_t updated) {
+  int res, xerrno = 0;
+  struct proxy_dbh *dbh;
+  const char *stmt, *errstr = NULL;
+  array_header *results;
+  long flags_val, updated_val;
+
+  dbh = dsh;
+
+  stmt = "INSERT OR REPLACE INTO proxy_ftp_dataxfer (vhost_id, backend_uri, flags, updated) VALUES (?, ?, ?, ?);";
+  res = proxy_db_prepare_stmt(p, dbh, stmt);
+  if (res < 0) {
+    xerrno = errno;
+    (void) pr_log_debug(DEBUG3, MOD_PROXY_VERSION
+      ": error preparing statement '%s': %s", stmt, strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dbh, stmt, 1, PROXY_DB_BIND_TYPE_INT,
+    (void *) &vhost_id, 0);
+  if (res < 0) {
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dbh, stmt, 2, PROXY_DB_BIND_TYPE_TEXT,
+    (void *) backend_uri, -1);
+  if (res < 0) {
+    return -1;
+  }
+
+  flags_val = (long) flags;
+  res = proxy_db_bind_stmt(p, dbh, stmt, 3, PROXY_DB_BIND_TYPE_LONG,
+    (void *) &flags_val, 0);
+  if (res < 0) {
+    return -1;
+  }
+
+  updated_val = (long) updated;
+  res = proxy_db_bind_stmt(p, dbh, stmt, 4, PROXY_DB_BIND_TYPE_LONG,
+    (void *) &updated_val, 0);
+  if (res < 0) {
+    return -1;
+  }
+
+  results = proxy_db_exec_prepared_stmt(p, dbh, stmt, &errstr);
+  if (results == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error executing '%s': %s", stmt, errstr ? errstr : strerror(errno));
+    errno = EPERM;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Initialization routines */
+
+static int ftp_db_add_schema(pool *p, void *dbh, const char *db_path) {
+  int res;
+  const char *stmt, *errstr = NULL;
+
+  /* CREATE TABLE proxy_ftp_dataxfer (
+   *   vhost_id INTEGER NOT NULL,
+   *   backend_uri STRING NOT NULL,
+   *   flags INTEGER NOT NULL,
+   *   updated INTEGER NOT NULL,
+   *   PRIMARY KEY (vhost_id, backend_uri)
+   * );
+   */
+  stmt = "CREATE TABLE IF NOT EXISTS proxy_ftp_dataxfer (vhost_id INTEGER NOT NULL, backend_uri STRING NOT NULL, flags INTEGER NOT NULL, updated INTEGER NOT NULL, PRIMARY KEY (vhost_id, backend_uri));";
+  res = proxy_db_exec_stmt(p, dbh, stmt, &errstr);
+  if (res < 0) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error executing '%s': %s", stmt, errstr);
+    errno = EPERM;
+    return -1;
+  }
+
+  /* Note that we deliberately do NOT truncate the dataxfer table; what we
+   * learned about the backend servers remains useful across restarts.
+   */
+
+  return 0;
+}
+
+static int ftp_db_init(pool *p, const char *tables_path, int flags) {
+  int db_flags, res, xerrno = 0;
+  struct proxy_dbh *dbh = NULL;
+  const char *db_path = NULL;
+
+  if (tables_path == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  db_path = pdircat(p, tables_path, "proxy-ftp.db", NULL);
+  db_flags = PROXY_DB_OPEN_FL_SCHEMA_VERSION_CHECK|PROXY_DB_OPEN_FL_INTEGRITY_CHECK|PROXY_DB_OPEN_FL_VACUUM;
+  if (flags & PROXY_DB_OPEN_FL_SKIP_VACUUM) {
+    /* If the caller needs us to skip the vacuum, we will. */
+    db_flags &= ~PROXY_DB_OPEN_FL_VACUUM;
+  }
+
+  PRIVS_ROOT
+  dbh = proxy_db_open_with_version(p, db_path, PROXY_FTP_DB_SCHEMA_NAME,
+    PROXY_FTP_DB_SCHEMA_VERSION, db_flags);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (dbh == NULL) {
+    (void) pr_log_pri(PR_LOG_NOTICE, MOD_PROXY_VERSION
+      ": error opening database '%s' for schema '%s', version %u: %s",
+      db_path, PROXY_FTP_DB_SCHEMA_NAME, PROXY_FTP_DB_SCHEMA_VERSION,
+      strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  res = ftp_db_add_schema(p, dbh, db_path);
+  if (res < 0) {
+    xerrno = errno;
+    (void) pr_log_debug(DEBUG0, MOD_PROXY_VERSION
+      ": error creating schema in database '%s' for '%s': %s", db_path,
+      PROXY_FTP_DB_SCHEMA_NAME, strerror(xerrno));
+    (void) proxy_db_close(p, dbh);
+    errno = xerrno;
+    return -1;
+  }
+
+  (void) proxy_db_close(p, dbh);
+  return 0;
+}
+
+static int ftp_db_close(pool *p, void *dbh) {
+  if (dbh != NULL) {
+    if (proxy_db_close(p, dbh) < 0) {
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error closing %s database: %s", PROXY_FTP_DB_SCHEMA_NAME,
+        strerror(errno));
+    }
+  }
+
+  return 0;
+}
+
+static void *ftp_db_open(pool *p, const char *tables_dir, unsigned long opts) {
+  int xerrno = 0;
+  struct proxy_dbh *dbh;
+  const char *db_path;
+
+  db_path = pdircat(p, tables_dir, "proxy-ftp.db", NULL);
+
+  PRIVS_ROOT
+  dbh = proxy_db_open_with_version(p, db_path, PROXY_FTP_DB_SCHEMA_NAME,
+    PROXY_FTP_DB_SCHEMA_VERSION, 0);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (dbh == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error opening database '%s' for schema '%s', version %u: %s",
+      db_path, PROXY_FTP_DB_SCHEMA_NAME, PROXY_FTP_DB_SCHEMA_VERSION,
+      strerror(xerrno));
+    errno = xerrno;
+    return NULL;
+  }
+
+  db_opts = opts;
+  return dbh;
+}
+
+int proxy_ftp_db_as_datastore(struct proxy_ftp_datastore *ds, void *ds_data,
+    size_t ds_datasz) {
+  if (ds == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  (void) ds_data;
+  (void) ds_datasz;
+
+  ds->dataxfer_get = ftp_db_get_dataxfer;
+  ds->dataxfer_set = ftp_db_set_dataxfer;
+
+  ds->init = ftp_db_init;
+  ds->open = ftp_db_open;
+  ds->close = ftp_db_close;
+
+  return 0;
+}
@@ -0,0 +1,840 @@
+/*
+ * ProFTPD - mod_proxy FTP directory cache API
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_proxy.h"
+
+#include "proxy/conn.h"
+#include "proxy/inet.h"
+#include "proxy/netio.h"
+#include "proxy/ftp/conn.h"
+#include "proxy/ftp/ctrl.h"
+#include "proxy/ftp/data.h"
+#include "proxy/ftp/dircache.h"
+#include "proxy/ftp/facts.h"
+#include "proxy/ftp/msg.h"
+
+/* Tracks the single directory snapshot we keep per session, and the burst of
+ * MLST/SIZE/MDTM requests which leads us to fetch it.
+ */
+struct dircache_ctx {
+  pool *pool;
+  unsigned int burst;
+  int lifetime;
+
+  /* Set when fetching a snapshot from the backend fails; we do not try
+   * again for this session.
+   */
+  int disabled;
+
+  /* Set when the frontend has started preparing a data transfer (e.g. via
+   * PASV or REST), during which we must not use the backend control
+   * connection for our own MLSD.
+   */
+  int xfer_pending;
+
+  /* Current burst of requests for a directory. */
+  char burst_dir[PR_TUNABLE_PATH_MAX+1];
+  unsigned int burst_count;
+  time_t burst_last;
+
+  /* Current snapshot. */
+  pool *snapshot_pool;
+  const char *snapshot_dir;
+  time_t snapshot_ts;
+  pr_table_t *entries;
+  int nentries;
+};
+
+static const char *trace_channel = "proxy.ftp.dircache";
+
+static void dircache_clear(struct dircache_ctx *ctx) {
+  if (ctx->snapshot_pool != NULL) {
+    destroy_pool(ctx->snapshot_pool);
+    ctx->snapshot_pool = NULL;
+  }
+
+  ctx->snapshot_dir = NULL;
+  ctx->snapshot_ts = 0;
+  ctx->entries = NULL;
+  ctx->nentries = 0;
+
+  ctx->burst_dir[0] = '\0';
+  ctx->burst_count = 0;
+  ctx->burst_last = 0;
+}
+
+int proxy_ftp_dircache_init(pool *p, struct proxy_session *proxy_sess,
+    unsigned int burst, int lifetime) {
+  struct dircache_ctx *ctx;
+  pool *ctx_pool;
+
+  if (p == NULL ||
+      proxy_sess == NULL ||
+      burst == 0 ||
+      lifetime < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  (void) proxy_ftp_dircache_free(proxy_sess);
+
+  ctx_pool = make_sub_pool(p);
+  pr_pool_tag(ctx_pool, "Proxy Directory Cache Context Pool");
+
+  ctx = pcalloc(ctx_pool, sizeof(struct dircache_ctx));
+  ctx->pool = ctx_pool;
+  ctx->burst = burst;
+  ctx->lifetime = lifetime;
+
+  proxy_sess->dircache_ctx = (void *) ctx;
+  return 0;
+}
+
+int proxy_ftp_dircache_free(struct proxy_session *proxy_sess) {
+  if (proxy_sess == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (proxy_sess->dircache_ctx != NULL) {
+    struct dircache_ctx *ctx;
+
+    ctx = proxy_sess->dircache_ctx;
+
+    destroy_pool(ctx->pool);
+    proxy_sess->dircache_ctx = NULL;
+  }
+
+  return 0;
+}
+
+/* Does the MDTM command use the "set" form, i.e. "MDTM YYYYMMDDHHMMSS path"? */
+static int is_mdtm_set(cmd_rec *cmd) {
+  const char *ts;
+  size_t i;
+
+  if (cmd->argc < 3) {
+    return FALSE;
+  }
+
+  ts = cmd->argv[1];
+  for (i = 0; i < 14; i++) {
+    if (!PR_ISDIGIT(ts[i])) {
+      return FALSE;
+    }
+  }
+
+  return (ts[14] == '\0' || ts[14] == '.');
+}
+
+int proxy_ftp_dircache_note_cmd(struct proxy_session *proxy_sess,
+    cmd_rec *cmd) {
+  struct dircache_ctx *ctx;
+
+  if (proxy_sess == NULL ||
+      cmd == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ctx = proxy_sess->dircache_ctx;
+  if (ctx == NULL) {
+    return 0;
+  }
+
+  switch (pr_cmd_get_id(cmd->argv[0])) {
+    /* These commands do not change anything that a snapshot would show. */
+    case PR_CMD_MLST_ID:
+    case PR_CMD_SIZE_ID:
+    case PR_CMD_NOOP_ID:
+    case PR_CMD_PWD_ID:
+    case PR_CMD_XPWD_ID:
+    case PR_CMD_TYPE_ID:
+    case PR_CMD_STAT_ID:
+    case PR_CMD_FEAT_ID:
+    case PR_CMD_SYST_ID:
+    case PR_CMD_HELP_ID:
+    case PR_CMD_MODE_ID:
+    case PR_CMD_STRU_ID:
+      return 0;
+
+    case PR_CMD_MDTM_ID:
+      if (is_mdtm_set(cmd) == FALSE) {
+        return 0;
+      }
+      break;
+
+    /* These commands start preparing a data transfer; until that transfer
+     * happens, we leave the backend control connection alone.
+     */
+    case PR_CMD_EPRT_ID:
+    case PR_CMD_EPSV_ID:
+    case PR_CMD_PASV_ID:
+    case PR_CMD_PORT_ID:
+      ctx->xfer_pending = TRUE;
+      return 0;
+
+    case PR_CMD_LIST_ID:
+    case PR_CMD_MLSD_ID:
+    case PR_CMD_NLST_ID:
+    case PR_CMD_RETR_ID:
+    case PR_CMD_ABOR_ID:
+      ctx->xfer_pending = FALSE;
+      return 0;
+
+    case PR_CMD_REST_ID:
+      ctx->xfer_pending = TRUE;
+      break;
+
+    case PR_CMD_APPE_ID:
+    case PR_CMD_STOR_ID:
+    case PR_CMD_STOU_ID:
+      ctx->xfer_pending = FALSE;
+      break;
+
+    default:
+      /* Anything else (e.g. CWD, DELE, RNTO, SITE, OPTS) might change what
+       * the backend would report.
+       */
+      break;
+  }
+
+  if (ctx->snapshot_dir != NULL ||
+      ctx->burst_count > 0) {
+    pr_trace_msg(trace_channel, 17,
+      "%s command invalidates directory snapshot", (char *) cmd->argv[0]);
+  }
+
+  dircache_clear(ctx);
+  return 0;
+}
+
+/* Splits the given path into its directory (which may be the empty string,
+ * for the current directory) and its name.
+ */
+static int split_path(pool *p, const char *path, const char **dir,
+    const char **name) {
+  char *ptr;
+
+  ptr = strrchr(path, '/');
+  if (ptr == NULL) {
+    *dir = "";
+    *name = path;
+
+  } else {
+    if (ptr[1] == '\0') {
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (ptr == path) {
+      *dir = "/";
+
+    } else {
+      *dir = pstrndup(p, path, ptr - path);
+    }
+
+    *name = ptr + 1;
+  }
+
+  if (strcmp(*name, ".") == 0 ||
+      strcmp(*name, "..") == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int add_line(struct dircache_ctx *ctx, const char *line,
+    size_t linelen) {
+  struct proxy_ftp_facts_entry *entry;
+
+  entry = pcalloc(ctx->snapshot_pool, sizeof(struct proxy_ftp_facts_entry));
+  if (proxy_ftp_facts_parse_entry(ctx->snapshot_pool, line, linelen,
+      entry) < 0) {
+    return -1;
+  }
+
+  if (entry->type != NULL &&
+      (strcasecmp(entry->type, "cdir") == 0 ||
+       strcasecmp(entry->type, "pdir") == 0)) {
+    return 0;
+  }
+
+  if (pr_table_add(ctx->entries, entry->path, entry,
+      sizeof(struct proxy_ftp_facts_entry)) < 0) {
+    return -1;
+  }
+
+  ctx->nentries++;
+  return 1;
+}
+
+int proxy_ftp_dircache_add_text(struct proxy_session *proxy_sess,
+    const char *dir, const char *text, size_t textlen) {
+  struct dircache_ctx *ctx;
+  const char *ptr, *end;
+  int count = 0;
+
+  if (proxy_sess == NULL ||
+      dir == NULL ||
+      text == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  ctx = proxy_sess->dircache_ctx;
+  if (ctx == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  if (ctx->snapshot_dir == NULL ||
+      strcmp(ctx->snapshot_dir, dir) != 0) {
+    int max_ents = PROXY_FTP_DIRCACHE_MAX_ENTRIES;
+
+    if (ctx->snapshot_pool != NULL) {
+      destroy_pool(ctx->snapshot_pool);
+    }
+
+    ctx->snapshot_pool = make_sub_pool(ctx->pool);
+    pr_pool_tag(ctx->snapshot_pool, "Proxy Directory Cache Snapshot Pool");
+
+    ctx->snapshot_dir = pstrdup(ctx->snapshot_pool, dir);
+    ctx->snapshot_ts = time(NULL);
+    ctx->entries = pr_table_nalloc(ctx->snapshot_pool, 0, 256);
+    (void) pr_table_ctl(ctx->entries, PR_TABLE_CTL_SET_MAX_ENTS, &max_ents);
+    ctx->nentries = 0;
+  }
+
+  ptr = text;
+  end = text + textlen;
+
+  while (ptr < end) {
+    const char *eol;
+    size_t linelen;
+
+    pr_signals_handle();
+
+    eol = memchr(ptr, '\n', end - ptr);
+    if (eol == NULL) {
+      eol = end;
+    }
+
+    linelen = eol - ptr;
+    if (linelen > 0 &&
+        ptr[linelen-1] == '\r') {
+      linelen--;
+    }
+
+    if (linelen > 0) {
+      if (ctx->nentries >= PROXY_FTP_DIRCACHE_MAX_ENTRIES) {
+        pr_trace_msg(trace_channel, 9,
+          "directory snapshot for '%s' is full (%d entries), ignoring rest",
+          dir, ctx->nentries);
+        break;
+      }
+
+      if (add_line(ctx, ptr, linelen) > 0) {
+        count++;
+      }
+    }
+
+    ptr = eol + 1;
+  }
+
+  return count;
+}
+
+/* Fetches an MLSD snapshot of the given directory from the backend server,
+ * using our own passive data connection.
+ */
+static int dircache_fetch(pool *p, struct proxy_session *proxy_sess,
+    const char *dir) {
+  int res, xerrno = 0, use_epsv = FALSE, read_error = FALSE;
+  pool *tmp_pool;
+  cmd_rec *cmd;
+  pr_response_t *resp;
+  unsigned int resp_nlines = 0;
+  const pr_netaddr_t *remote_addr = NULL;
+  pr_netaddr_t remote_na;
+  conn_t *data_conn;
+  char *carry;
+  size_t carry_len = 0, carry_sz;
+  int carry_overflow = FALSE;
+
+  tmp_pool = make_sub_pool(p);
+  pr_pool_tag(tmp_pool, "Proxy Directory Cache fetch pool");
+
+  if (proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_MODE_Z) {
+    /* We want an uncompressed listing; the next transfer will switch the
+     * backend server back to MODE Z as needed.
+     */
+    cmd = pr_cmd_alloc(tmp_pool, 2, C_MODE, "S");
+    cmd->arg = pstrdup(tmp_pool, "S");
+
+    res = proxy_ftp_ctrl_send_cmd(tmp_pool, proxy_sess->backend_ctrl_conn,
+      cmd);
+    if (res < 0) {
+      xerrno = errno;
+      destroy_pool(tmp_pool);
+      errno = xerrno;
+      return -1;
+    }
+
+    resp = proxy_ftp_ctrl_recv_resp(tmp_pool, proxy_sess->backend_ctrl_conn,
+      &resp_nlines, 0);
+    if (resp == NULL ||
+        resp->num[0] != '2') {
+      xerrno = (resp == NULL ? errno : EPERM);
+      destroy_pool(tmp_pool);
+      errno = xerrno;
+      return -1;
+    }
+
+    proxy_sess->dataxfer_flags &= ~PROXY_SESS_DATA_TRANSFER_FL_MODE_Z;
+  }
+
+  if (pr_netaddr_get_family(proxy_sess->backend_ctrl_conn->remote_addr) != AF_INET ||
+      (proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_EPSV) ||
+      (proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_EPRT)) {
+    use_epsv = TRUE;
+  }
+
+  cmd = pr_cmd_alloc(tmp_pool, 1, use_epsv ? C_EPSV : C_PASV);
+  res = proxy_ftp_ctrl_send_cmd(tmp_pool, proxy_sess->backend_ctrl_conn, cmd);
+  if (res < 0) {
+    xerrno = errno;
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  resp = proxy_ftp_ctrl_recv_resp(tmp_pool, proxy_sess->backend_ctrl_conn,
+    &resp_nlines, 0);
+  if (resp == NULL) {
+    xerrno = errno;
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  if (use_epsv == TRUE &&
+      strncmp(resp->num, R_229, 4) == 0) {
+    if (proxy_ftp_msg_parse_ext_addr2(resp->msg, strlen(resp->msg),
+        proxy_sess->backend_ctrl_conn->remote_addr, PR_CMD_EPSV_ID, NULL,
+        &remote_na) == 0) {
+      remote_addr = &remote_na;
+    }
+
+  } else if (use_epsv == FALSE &&
+             strncmp(resp->num, R_227, 4) == 0) {
+    if (proxy_ftp_msg_parse_addr2(resp->msg, strlen(resp->msg),
+        pr_netaddr_get_family(proxy_sess->backend_ctrl_conn->remote_addr),
+        &remote_na) == 0) {
+      remote_addr = &remote_na;
+    }
+  }
+
+  if (remote_addr == NULL) {
+    pr_trace_msg(trace_channel, 9, "unable to use %s response '%s %s'",
+      (char *) cmd->argv[0], resp->num, resp->msg);
+    destroy_pool(tmp_pool);
+    errno = EPERM;
+    return -1;
+  }
+
+  if (!(proxy_opts & PROXY_OPT_ALLOW_FOREIGN_ADDRESS) &&
+      pr_netaddr_cmp(remote_addr,
+        proxy_sess->backend_ctrl_conn->remote_addr) != 0) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "Refused %s address %s (address mismatch with %s)",
+      (char *) cmd->argv[0], pr_netaddr_get_ipstr(remote_addr),
+      pr_netaddr_get_ipstr(proxy_sess->backend_ctrl_conn->remote_addr));
+    destroy_pool(tmp_pool);
+    errno = EPERM;
+    return -1;
+  }
+
+  data_conn = proxy_ftp_conn_connect(tmp_pool,
+    proxy_sess->backend_ctrl_conn->local_addr, remote_addr, FALSE);
+  if (data_conn == NULL) {
+    xerrno = errno;
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  if (*dir != '\0') {
+    cmd = pr_cmd_alloc(tmp_pool, 2, C_MLSD, dir);
+    cmd->arg = pstrdup(tmp_pool, dir);
+
+  } else {
+    cmd = pr_cmd_alloc(tmp_pool, 1, C_MLSD);
+  }
+
+  res = proxy_ftp_ctrl_send_cmd(tmp_pool, proxy_sess->backend_ctrl_conn, cmd);
+  if (res < 0) {
+    xerrno = errno;
+    proxy_inet_close(tmp_pool, data_conn);
+    pr_inet_close(tmp_pool, data_conn);
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  resp = proxy_ftp_ctrl_recv_resp(tmp_pool, proxy_sess->backend_ctrl_conn,
+    &resp_nlines, 0);
+  if (resp == NULL ||
+      resp->num[0] != '1') {
+    xerrno = (resp == NULL ? errno : EPERM);
+    proxy_inet_close(tmp_pool, data_conn);
+    pr_inet_close(tmp_pool, data_conn);
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  if (proxy_netio_postopen(data_conn->instrm) < 0 ||
+      proxy_netio_postopen(data_conn->outstrm) < 0) {
+    xerrno = errno;
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "postopen error for backend directory cache data connection: %s",
+      strerror(xerrno));
+    proxy_inet_close(tmp_pool, data_conn);
+    pr_inet_close(tmp_pool, data_conn);
+
+    /* We still need to consume the closing response for the MLSD. */
+    (void) proxy_ftp_ctrl_recv_resp(tmp_pool, proxy_sess->backend_ctrl_conn,
+      &resp_nlines, 0);
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  /* Lines may span reads; any partial line is carried over to the next
+   * read.  This is the maximum size of one line, as for dirlists; a longer
+   * line is discarded entirely, up to its LF, rather than cached with part
+   * of it missing.
+   */
+  carry_sz = (PR_TUNABLE_PATH_MAX * 2) + 256;
+  carry = palloc(tmp_pool, carry_sz);
+
+  while (TRUE) {
+    pr_buffer_t *pbuf;
+    const char *buf, *eol;
+    size_t buflen;
+
+    pr_signals_handle();
+
+    pbuf = proxy_ftp_data_recv(tmp_pool, data_conn, FALSE);
+    if (pbuf == NULL) {
+      xerrno = errno;
+
+      if (xerrno == EAGAIN ||
+          xerrno == EINTR) {
+        continue;
+      }
+
+      pr_trace_msg(trace_channel, 9,
+        "error reading MLSD data for '%s': %s", dir, strerror(xerrno));
+      read_error = TRUE;
+      break;
+    }
+
+    buf = pbuf->buf;
+    buflen = pbuf->current - pbuf->buf;
+    if (buflen == 0) {
+      /* EOF */
+      if (carry_len > 0 &&
+          carry_overflow == FALSE) {
+        (void) proxy_ftp_dircache_add_text(proxy_sess, dir, carry, carry_len);
+      }
+
+      break;
+    }
+
+    eol = memchr(buf, '\n', buflen);
+    if (eol == NULL) {
+      /* No complete line yet. */
+      if (carry_overflow == FALSE) {
+        if (carry_len + buflen <= carry_sz) {
+          memcpy(carry + carry_len, buf, buflen);
+          carry_len += buflen;
+
+        } else {
+          pr_trace_msg(trace_channel, 9,
+            "MLSD line for '%s' exceeds %lu bytes, ignoring", dir,
+            (unsigned long) carry_sz);
+          carry_overflow = TRUE;
+          carry_len = 0;
+        }
+      }
+
+      continue;
+    }
+
+    if (carry_len > 0 ||
+        carry_overflow == TRUE) {
+      size_t len;
+
+      len = (eol - buf) + 1;
+      if (carry_overflow == FALSE) {
+        if (carry_len + len <= carry_sz) {
+          memcpy(carry + carry_len, buf, len);
+          (void) proxy_ftp_dircache_add_text(proxy_sess, dir, carry,
+            carry_len + len);
+
+        } else {
+          pr_trace_msg(trace_channel, 9,
+            "MLSD line for '%s' exceeds %lu bytes, ignoring", dir,
+            (unsigned long) carry_sz);
+        }
+      }
+
+      carry_len = 0;
+      carry_overflow = FALSE;
+      buf += len;
+      buflen -= len;
+    }
+
+    /* Find the last complete line in the remainder. */
+    eol = buf + buflen;
+    while (eol > buf &&
+           *(eol - 1) != '\n') {
+      eol--;
+    }
+
+    if (eol > buf) {
+      (void) proxy_ftp_dircache_add_text(proxy_sess, dir, buf, eol - buf);
+    }
+
+    if ((size_t) ((buf + buflen) - eol) <= carry_sz) {
+      carry_len = (buf + buflen) - eol;
+      memcpy(carry, eol, carry_len);
+
+    } else {
+      pr_trace_msg(trace_channel, 9,
+        "MLSD line for '%s' exceeds %lu bytes, ignoring", dir,
+        (unsigned long) carry_sz);
+      carry_overflow = TRUE;
+    }
+  }
+
+  proxy_inet_close(tmp_pool, data_conn);
+  pr_inet_close(tmp_pool, data_conn);
+
+  resp = proxy_ftp_ctrl_recv_resp(tmp_pool, proxy_sess->backend_ctrl_conn,
+    &resp_nlines, 0);
+  if (resp == NULL) {
+    xerrno = errno;
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  if (resp->num[0] != '2' ||
+      read_error == TRUE) {
+    /* Do not trust a partial listing. */
+    pr_trace_msg(trace_channel, 9,
+      "MLSD for '%s' failed (%s %s), discarding snapshot", dir, resp->num,
+      resp->msg);
+    destroy_pool(tmp_pool);
+    errno = EPERM;
+    return -1;
+  }
+
+  destroy_pool(tmp_pool);
+  return 0;
+}
+
+pr_response_t *proxy_ftp_dircache_get_resp(pool *p,
+    struct proxy_session *proxy_sess, cmd_rec *cmd,
+    unsigned int *resp_nlines) {
+  struct dircache_ctx *ctx;
+  struct proxy_ftp_facts_entry *entry;
+  const char *path, *dir = NULL, *name = NULL;
+  pr_response_t *resp;
+  int cmd_id;
+  time_t now;
+
+  if (p == NULL ||
+      proxy_sess == NULL ||
+      cmd == NULL ||
+      resp_nlines == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  ctx = proxy_sess->dircache_ctx;
+  if (ctx == NULL ||
+      ctx->disabled == TRUE) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  cmd_id = pr_cmd_get_id(cmd->argv[0]);
+  if (cmd_id != PR_CMD_MLST_ID &&
+      cmd_id != PR_CMD_SIZE_ID &&
+      cmd_id != PR_CMD_MDTM_ID) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  if (cmd->argc < 2 ||
+      (cmd_id == PR_CMD_MDTM_ID && is_mdtm_set(cmd) == TRUE)) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  path = cmd->arg;
+  if (split_path(p, path, &dir, &name) < 0) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  now = time(NULL);
+
+  if (ctx->snapshot_dir != NULL &&
+      (strcmp(ctx->snapshot_dir, dir) != 0 ||
+       (now - ctx->snapshot_ts) > ctx->lifetime)) {
+    dircache_clear(ctx);
+  }
+
+  if (ctx->snapshot_dir == NULL) {
+    if (strcmp(ctx->burst_dir, dir) != 0 ||
+        (now - ctx->burst_last) > ctx->lifetime) {
+      sstrncpy(ctx->burst_dir, dir, sizeof(ctx->burst_dir));
+      ctx->burst_count = 0;
+    }
+
+    ctx->burst_count++;
+    ctx->burst_last = now;
+
+    if (ctx->burst_count < ctx->burst) {
+      errno = ENOENT;
+      return NULL;
+    }
+
+    /* We can only use the backend control connection for our own MLSD if
+     * nothing else is in progress on it.
+     */
+    if (ctx->xfer_pending == TRUE ||
+        proxy_sess->backend_ctrl_conn == NULL ||
+        proxy_sess->backend_data_conn != NULL ||
+        (proxy_sess->backend_sess_flags & (SF_PASSIVE|SF_PORT|SF_XFER)) ||
+        !(proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_MLST)) {
+      errno = ENOENT;
+      return NULL;
+    }
+
+    pr_trace_msg(trace_channel, 12,
+      "%u requests for directory '%s', fetching MLSD snapshot",
+      ctx->burst_count, *dir ? dir : ".");
+    if (dircache_fetch(p, proxy_sess, dir) < 0) {
+      int xerrno = errno;
+
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error fetching directory snapshot for '%s', disabling directory "
+        "cache: %s", *dir ? dir : ".", strerror(xerrno));
+      dircache_clear(ctx);
+      ctx->disabled = TRUE;
+
+      errno = ENOENT;
+      return NULL;
+    }
+
+    if (ctx->snapshot_dir == NULL) {
+      /* Empty directory listing. */
+      errno = ENOENT;
+      return NULL;
+    }
+
+    pr_trace_msg(trace_channel, 15,
+      "cached %d entries for directory '%s'", ctx->nentries,
+      *dir ? dir : ".");
+  }
+
+  entry = (struct proxy_ftp_facts_entry *) pr_table_get(ctx->entries, name,
+    NULL);
+  if (entry == NULL) {
+    /* Let the backend server answer for names not in the listing. */
+    errno = ENOENT;
+    return NULL;
+  }
+
+  resp = pcalloc(p, sizeof(pr_response_t));
+
+  switch (cmd_id) {
+    case PR_CMD_SIZE_ID:
+      /* In ASCII mode, the size would need translating; let the backend
+       * server handle that.
+       */
+      if (entry->size == NULL ||
+          entry->type == NULL ||
+          strcasecmp(entry->type, "file") != 0 ||
+          (session.sf_flags & SF_ASCII)) {
+        errno = ENOENT;
+        return NULL;
+      }
+
+      resp->num = R_213;
+      resp->msg = pstrdup(p, entry->size);
+      *resp_nlines = 1;
+      break;
+
+    case PR_CMD_MDTM_ID: {
+      char *modify, *ptr;
+
+      if (entry->modify == NULL) {
+        errno = ENOENT;
+        return NULL;
+      }
+
+      /* MDTM responses do not usually include any fractional seconds. */
+      modify = pstrdup(p, entry->modify);
+      ptr = strchr(modify, '.');
+      if (ptr != NULL) {
+        *ptr = '\0';
+      }
+
+      resp->num = R_213;
+      resp->msg = modify;
+      *resp_nlines = 1;
+      break;
+    }
+
+    case PR_CMD_MLST_ID:
+      resp->num = R_250;
+      resp->msg = pstrcat(p, "Start of list for ", path, "\r\n ",
+        entry->facts, " ", path, "\r\n", R_250, " End of list", NULL);
+      *resp_nlines = 3;
+      break;
+  }
+
+  pr_trace_msg(trace_channel, 17, "answering %s for '%s' from snapshot",
+    (char *) cmd->argv[0], path);
+  return resp;
+}
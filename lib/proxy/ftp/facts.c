@@ -47,6 +47,41 @@ static unsigned long facts_opts = PROXY_FTP_FACTS_OPT_SHOW_MODIFY|
 
 static const char *trace_channel = "proxy.ftp.facts";
 
+/* Note that fact names are case-insensitive. */
+static struct {
+  const char *name;
+  size_t namelen;
+  unsigned long opt;
+} known_facts[] = {
+  { "modify",		6,	PROXY_FTP_FACTS_OPT_SHOW_MODIFY },
+  { "perm",		4,	PROXY_FTP_FACTS_OPT_SHOW_PERM },
+  { "size",		4,	PROXY_FTP_FACTS_OPT_SHOW_SIZE },
+  { "type",		4,	PROXY_FTP_FACTS_OPT_SHOW_TYPE },
+  { "unique",		6,	PROXY_FTP_FACTS_OPT_SHOW_UNIQUE },
+  { "UNIX.group",	10,	PROXY_FTP_FACTS_OPT_SHOW_UNIX_GROUP },
+  { "UNIX.groupname",	14,	PROXY_FTP_FACTS_OPT_SHOW_UNIX_GROUP_NAME },
+  { "UNIX.mode",	9,	PROXY_FTP_FACTS_OPT_SHOW_UNIX_MODE },
+  { "UNIX.owner",	10,	PROXY_FTP_FACTS_OPT_SHOW_UNIX_OWNER },
+  { "UNIX.ownername",	14,	PROXY_FTP_FACTS_OPT_SHOW_UNIX_OWNER_NAME },
+  { NULL, 0, 0UL }
+};
+
+/* Returns the PROXY_FTP_FACTS_OPT_SHOW_ value for the given fact name, or
+ * zero if the fact is not one that we know.
+ */
+static unsigned long facts_get_opt(const char *name, size_t namelen) {
+  register unsigned int i;
+
+  for (i = 0; known_facts[i].name != NULL; i++) {
+    if (known_facts[i].namelen == namelen &&
+        strncasecmp(known_facts[i].name, name, namelen) == 0) {
+      return known_facts[i].opt;
+    }
+  }
+
+  return 0UL;
+}
+
 unsigned long proxy_ftp_facts_get_opts(void) {
   return facts_opts;
 }
@@ -61,49 +96,108 @@ void proxy_ftp_facts_parse_opts(char *facts) {
 
   ptr = strchr(facts, ';');
   while (ptr != NULL) {
+    unsigned long opt;
+
     pr_signals_handle();
 
     *ptr = '\0';
 
-    if (strcasecmp(facts, "modify") == 0) {
-      opts |= PROXY_FTP_FACTS_OPT_SHOW_MODIFY;
+    opt = facts_get_opt(facts, ptr - facts);
+    if (opt != 0UL) {
+      opts |= opt;
 
-    } else if (strcasecmp(facts, "perm") == 0) {
-      opts |= PROXY_FTP_FACTS_OPT_SHOW_PERM;
+    } else {
+      pr_trace_msg(trace_channel, 7,
+        "client requested unsupported fact '%s'", facts);
+    }
 
-    } else if (strcasecmp(facts, "size") == 0) {
-      opts |= PROXY_FTP_FACTS_OPT_SHOW_SIZE;
+    *ptr = ';';
+    facts = ptr + 1;
+    ptr = strchr(facts, ';');
+  }
 
-    } else if (strcasecmp(facts, "type") == 0) {
-      opts |= PROXY_FTP_FACTS_OPT_SHOW_TYPE;
+  facts_opts = opts;
+}
 
-    } else if (strcasecmp(facts, "unique") == 0) {
-      opts |= PROXY_FTP_FACTS_OPT_SHOW_UNIQUE;
+int proxy_ftp_facts_parse_entry(pool *p, const char *text, size_t textlen,
+    struct proxy_ftp_facts_entry *entry) {
+  const char *ptr, *facts_end = NULL, *path;
+  char *facts;
+  size_t facts_len, path_len;
+
+  if (p == NULL ||
+      text == NULL ||
+      entry == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
 
-    } else if (strcasecmp(facts, "UNIX.group") == 0) {
-      opts |= PROXY_FTP_FACTS_OPT_SHOW_UNIX_GROUP;
+  /* Each fact ends with ';', and a single space separates the facts from the
+   * pathname.  The pathname may itself contain "; ", so we use the first one.
+   */
+  for (ptr = text; ptr + 1 < text + textlen; ptr++) {
+    if (ptr[0] == ';' &&
+        ptr[1] == ' ') {
+      facts_end = ptr + 1;
+      break;
+    }
+  }
 
-    } else if (strcasecmp(facts, "UNIX.groupname") == 0) {
-      opts |= PROXY_FTP_FACTS_OPT_SHOW_UNIX_GROUP_NAME;
+  if (facts_end == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
 
-    } else if (strcasecmp(facts, "UNIX.mode") == 0) {
-      opts |= PROXY_FTP_FACTS_OPT_SHOW_UNIX_MODE;
+  facts_len = facts_end - text;
+  path = facts_end + 1;
+  path_len = textlen - (path - text);
+  if (path_len == 0) {
+    errno = EINVAL;
+    return -1;
+  }
 
-    } else if (strcasecmp(facts, "UNIX.owner") == 0) {
-      opts |= PROXY_FTP_FACTS_OPT_SHOW_UNIX_OWNER;
+  memset(entry, 0, sizeof(struct proxy_ftp_facts_entry));
+  facts = pstrndup(p, text, facts_len);
+  entry->facts = facts;
+  entry->path = pstrndup(p, path, path_len);
 
-    } else if (strcasecmp(facts, "UNIX.ownername") == 0) {
-      opts |= PROXY_FTP_FACTS_OPT_SHOW_UNIX_OWNER_NAME;
+  ptr = facts;
+  while (*ptr != '\0') {
+    const char *val, *end;
 
-    } else {
-      pr_trace_msg(trace_channel, 7,
-        "client requested unsupported fact '%s'", facts);
+    pr_signals_handle();
+
+    end = strchr(ptr, ';');
+    if (end == NULL) {
+      break;
     }
 
-    *ptr = ';';
-    facts = ptr + 1;
-    ptr = strchr(facts, ';');
+    val = memchr(ptr, '=', end - ptr);
+    if (val != NULL) {
+      size_t val_len;
+
+      val_len = end - (val + 1);
+
+      switch (facts_get_opt(ptr, val - ptr)) {
+        case PROXY_FTP_FACTS_OPT_SHOW_TYPE:
+          entry->type = pstrndup(p, val + 1, val_len);
+          break;
+
+        case PROXY_FTP_FACTS_OPT_SHOW_SIZE:
+          entry->size = pstrndup(p, val + 1, val_len);
+          break;
+
+        case PROXY_FTP_FACTS_OPT_SHOW_MODIFY:
+          entry->modify = pstrndup(p, val + 1, val_len);
+          break;
+
+        default:
+          break;
+      }
+    }
+
+    ptr = end + 1;
   }
 
-  facts_opts = opts;
+  return 0;
 }
@@ -0,0 +1,545 @@
+/*
+ * ProFTPD - mod_proxy FTP MODE Z implementation
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_proxy.h"
+
+#include "proxy/ftp/modez.h"
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+
+/* How much data we compress between measurements of the throughput, for
+ * adjusting the adaptive compression level.
+ */
+#define MODEZ_ADAPTIVE_WINDOW_SIZE	(1024 * 1024)
+
+#define MODEZ_ADAPTIVE_MIN_LEVEL	1
+#define MODEZ_ADAPTIVE_MAX_LEVEL	9
+#define MODEZ_ADAPTIVE_INITIAL_LEVEL	6
+
+/* The decompression output buffer is capped at this multiple of the transfer
+ * buffer size; deflate allows ratios of around 1000:1.
+ */
+#define MODEZ_INFLATE_MAX_BUFSZ_FACTOR	4
+
+struct proxy_ftp_modez {
+  pool *pool;
+  int direction;
+  z_stream stream;
+  int stream_ready;
+  int stream_end;
+
+  /* Output buffer, reused (and grown as needed) across calls. */
+  char *buf;
+  size_t bufsz;
+
+  /* For decompression, the output buffer does not grow past this size; any
+   * remaining input is left pending for the next call instead.
+   */
+  size_t max_bufsz;
+  int inflate_pending;
+
+  /* Current compression level, and any new level yet to be applied. */
+  int level;
+  int next_level;
+
+  /* For adaptive compression, we climb the level in one direction for as long
+   * as the throughput improves, and turn around when it does not.
+   */
+  int adaptive;
+  int level_step;
+  size_t window_len;
+  struct timeval window_start;
+  double window_rate;
+};
+
+static const char *trace_channel = "proxy.ftp.modez";
+
+/* zlib allocates its state from the context pool, so that nothing leaks if a
+ * transfer ends without proxy_ftp_modez_free() being called.
+ */
+static voidpf modez_zalloc(voidpf opaque, uInt items, uInt size) {
+  return palloc((pool *) opaque, (size_t) items * size);
+}
+
+static void modez_zfree(voidpf opaque, voidpf ptr) {
+  /* Reclaimed along with the pool. */
+}
+
+struct proxy_ftp_modez *proxy_ftp_modez_alloc(pool *p, int direction,
+    int level) {
+  int zres;
+  pool *modez_pool;
+  struct proxy_ftp_modez *modez;
+
+  if (p == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (direction != PROXY_FTP_MODEZ_DEFLATE &&
+      direction != PROXY_FTP_MODEZ_INFLATE) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (level != PROXY_FTP_MODEZ_LEVEL_ADAPTIVE &&
+      (level < 1 || level > 9)) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  modez_pool = make_sub_pool(p);
+  pr_pool_tag(modez_pool, "Proxy FTP MODE Z pool");
+
+  modez = pcalloc(modez_pool, sizeof(struct proxy_ftp_modez));
+  modez->pool = modez_pool;
+  modez->direction = direction;
+
+  if (level == PROXY_FTP_MODEZ_LEVEL_ADAPTIVE) {
+    modez->adaptive = TRUE;
+    modez->level = MODEZ_ADAPTIVE_INITIAL_LEVEL;
+
+    /* Start by trying cheaper levels. */
+    modez->level_step = -1;
+    gettimeofday(&(modez->window_start), NULL);
+
+  } else {
+    modez->level = level;
+  }
+
+  modez->next_level = modez->level;
+  modez->max_bufsz = pr_config_get_server_xfer_bufsz(PR_NETIO_IO_RD) *
+    MODEZ_INFLATE_MAX_BUFSZ_FACTOR;
+  if (modez->max_bufsz < 8192) {
+    modez->max_bufsz = 8192;
+  }
+
+  modez->stream.zalloc = modez_zalloc;
+  modez->stream.zfree = modez_zfree;
+  modez->stream.opaque = modez_pool;
+
+  if (direction == PROXY_FTP_MODEZ_DEFLATE) {
+    zres = deflateInit(&(modez->stream), modez->level);
+
+  } else {
+    /* Accept either zlib or gzip headers. */
+    zres = inflateInit2(&(modez->stream), 15 + 32);
+  }
+
+  if (zres != Z_OK) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error preparing %s stream (%d): %s",
+      direction == PROXY_FTP_MODEZ_DEFLATE ? "compression" : "decompression",
+      zres, modez->stream.msg ? modez->stream.msg : "unknown error");
+    destroy_pool(modez_pool);
+    errno = EPERM;
+    return NULL;
+  }
+
+  modez->stream_ready = TRUE;
+  return modez;
+}
+
+static void modez_ensure_bufsz(struct proxy_ftp_modez *modez, size_t sz) {
+  size_t new_sz;
+  char *new_buf;
+
+  if (modez->bufsz >= sz) {
+    return;
+  }
+
+  new_sz = modez->bufsz > 0 ? modez->bufsz : 8192;
+  while (new_sz < sz) {
+    new_sz *= 2;
+  }
+
+  pr_trace_msg(trace_channel, 19,
+    "growing MODE Z buffer from %lu to %lu bytes",
+    (unsigned long) modez->bufsz, (unsigned long) new_sz);
+
+  /* The previous buffer is reclaimed along with the pool; we need to keep
+   * whatever output it already holds.
+   */
+  new_buf = palloc(modez->pool, new_sz);
+  if (modez->bufsz > 0) {
+    memcpy(new_buf, modez->buf, modez->bufsz);
+  }
+
+  modez->buf = new_buf;
+  modez->bufsz = new_sz;
+}
+
+/* Measures the throughput over the last window of data, and picks the next
+ * compression level to try.  When compression is the bottleneck, a lower
+ * level is faster; when the network is, a higher level is.
+ */
+static void modez_adapt_level(struct proxy_ftp_modez *modez, size_t len) {
+  struct timeval now;
+  double elapsed, rate;
+  int level;
+
+  modez->window_len += len;
+  if (modez->window_len < MODEZ_ADAPTIVE_WINDOW_SIZE) {
+    return;
+  }
+
+  gettimeofday(&now, NULL);
+  elapsed = (now.tv_sec - modez->window_start.tv_sec) +
+    ((now.tv_usec - modez->window_start.tv_usec) / 1000000.0);
+  if (elapsed <= 0.0) {
+    elapsed = 0.000001;
+  }
+
+  rate = modez->window_len / elapsed;
+
+  if (modez->window_rate > 0.0 &&
+      rate < modez->window_rate) {
+    modez->level_step = -modez->level_step;
+  }
+
+  level = modez->level + modez->level_step;
+  if (level < MODEZ_ADAPTIVE_MIN_LEVEL ||
+      level > MODEZ_ADAPTIVE_MAX_LEVEL) {
+    modez->level_step = -modez->level_step;
+    level = modez->level + modez->level_step;
+  }
+
+  pr_trace_msg(trace_channel, 15,
+    "MODE Z throughput at level %d: %.0f bytes/sec (previously %.0f), "
+    "trying level %d", modez->level, rate, modez->window_rate, level);
+
+  modez->next_level = level;
+  modez->window_rate = rate;
+  modez->window_len = 0;
+  modez->window_start = now;
+}
+
+static int modez_deflate(struct proxy_ftp_modez *modez, const char *in,
+    size_t inlen, int flush, size_t *outlen) {
+  int zres;
+  size_t len = 0;
+
+  modez_ensure_bufsz(modez, deflateBound(&(modez->stream), inlen));
+
+  modez->stream.next_in = (Bytef *) in;
+  modez->stream.avail_in = inlen;
+
+  if (modez->next_level != modez->level) {
+    modez->stream.next_out = (Bytef *) modez->buf;
+    modez->stream.avail_out = modez->bufsz;
+
+    /* Any pending input is compressed at the old level first; if there is
+     * not enough room for that, we try again on the next call.
+     */
+    zres = deflateParams(&(modez->stream), modez->next_level,
+      Z_DEFAULT_STRATEGY);
+    if (zres == Z_OK) {
+      modez->level = modez->next_level;
+    }
+
+    len = modez->bufsz - modez->stream.avail_out;
+  }
+
+  while (TRUE) {
+    pr_signals_handle();
+
+    if (len == modez->bufsz) {
+      modez_ensure_bufsz(modez, modez->bufsz * 2);
+    }
+
+    modez->stream.next_out = (Bytef *) (modez->buf + len);
+    modez->stream.avail_out = modez->bufsz - len;
+
+    zres = deflate(&(modez->stream), flush);
+    len = modez->bufsz - modez->stream.avail_out;
+
+    if (zres == Z_STREAM_END) {
+      modez->stream_end = TRUE;
+      break;
+    }
+
+    if (zres != Z_OK &&
+        zres != Z_BUF_ERROR) {
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error compressing data (%d): %s", zres,
+        modez->stream.msg ? modez->stream.msg : "unknown error");
+      errno = EIO;
+      return -1;
+    }
+
+    /* Keep going while zlib fills the output buffer, or, when finishing,
+     * until it reports the end of the stream.
+     */
+    if (modez->stream.avail_out > 0 &&
+        modez->stream.avail_in == 0 &&
+        flush != Z_FINISH) {
+      break;
+    }
+  }
+
+  *outlen = len;
+  return 0;
+}
+
+static int modez_inflate(struct proxy_ftp_modez *modez, const char *in,
+    size_t inlen, size_t *outlen) {
+  int zres;
+  size_t len = 0, sz;
+
+  if (modez->stream_end == TRUE) {
+    pr_trace_msg(trace_channel, 9,
+      "ignoring %lu bytes of data after end of MODE Z stream",
+      (unsigned long) inlen);
+    modez->inflate_pending = FALSE;
+    *outlen = 0;
+    return 0;
+  }
+
+  /* With no input, we continue with whatever the last call left pending. */
+  if (inlen > 0) {
+    /* Optimistic estimate of the decompressed size. */
+    sz = inlen * 4;
+    if (sz > modez->max_bufsz) {
+      sz = modez->max_bufsz;
+    }
+
+    modez_ensure_bufsz(modez, sz);
+
+    modez->stream.next_in = (Bytef *) in;
+    modez->stream.avail_in = inlen;
+  }
+
+  modez->inflate_pending = FALSE;
+
+  while (TRUE) {
+    pr_signals_handle();
+
+    if (len == modez->bufsz) {
+      if (modez->bufsz >= modez->max_bufsz) {
+        /* Rather than growing the buffer for highly compressible data,
+         * return what we have; zlib keeps its place in the input.
+         */
+        modez->inflate_pending = TRUE;
+        break;
+      }
+
+      sz = modez->bufsz * 2;
+      if (sz > modez->max_bufsz) {
+        sz = modez->max_bufsz;
+      }
+
+      modez_ensure_bufsz(modez, sz);
+    }
+
+    modez->stream.next_out = (Bytef *) (modez->buf + len);
+    modez->stream.avail_out = modez->bufsz - len;
+
+    zres = inflate(&(modez->stream), Z_NO_FLUSH);
+    len = modez->bufsz - modez->stream.avail_out;
+
+    if (zres == Z_STREAM_END) {
+      modez->stream_end = TRUE;
+      break;
+    }
+
+    if (zres != Z_OK &&
+        zres != Z_BUF_ERROR) {
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error decompressing data (%d): %s", zres,
+        modez->stream.msg ? modez->stream.msg : "unknown error");
+      errno = EIO;
+      return -1;
+    }
+
+    if (modez->stream.avail_out > 0) {
+      /* All of the input has been consumed. */
+      break;
+    }
+  }
+
+  *outlen = len;
+  return 0;
+}
+
+int proxy_ftp_modez_process(struct proxy_ftp_modez *modez, const char *in,
+    size_t inlen, char **out, size_t *outlen) {
+  int res;
+  size_t len = 0;
+
+  if (modez == NULL ||
+      in == NULL ||
+      out == NULL ||
+      outlen == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (modez->inflate_pending == TRUE &&
+      inlen > 0) {
+    /* The pending input would be lost. */
+    errno = EAGAIN;
+    return -1;
+  }
+
+  if (inlen == 0 &&
+      modez->inflate_pending == FALSE) {
+    *out = modez->buf;
+    *outlen = 0;
+    return 0;
+  }
+
+  if (modez->direction == PROXY_FTP_MODEZ_DEFLATE) {
+    res = modez_deflate(modez, in, inlen, Z_NO_FLUSH, &len);
+    if (res == 0 &&
+        modez->adaptive == TRUE) {
+      modez_adapt_level(modez, inlen);
+    }
+
+  } else {
+    res = modez_inflate(modez, in, inlen, &len);
+  }
+
+  if (res < 0) {
+    return -1;
+  }
+
+  *out = modez->buf;
+  *outlen = len;
+  return 0;
+}
+
+int proxy_ftp_modez_finish(struct proxy_ftp_modez *modez, char **out,
+    size_t *outlen) {
+  size_t len = 0;
+
+  if (modez == NULL ||
+      out == NULL ||
+      outlen == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (modez->direction == PROXY_FTP_MODEZ_DEFLATE) {
+    if (modez->stream_end == FALSE) {
+      /* Make sure any pending level change does not use the buffer. */
+      modez->next_level = modez->level;
+
+      if (modez_deflate(modez, "", 0, Z_FINISH, &len) < 0) {
+        return -1;
+      }
+    }
+
+  } else if (modez->stream_end == FALSE) {
+    if (modez->inflate_pending == TRUE) {
+      pr_trace_msg(trace_channel, 3,
+        "MODE Z stream finished with decompressed data still pending");
+      errno = EAGAIN;
+      return -1;
+    }
+
+    pr_trace_msg(trace_channel, 3, "MODE Z stream ended prematurely");
+    errno = EPIPE;
+    return -1;
+  }
+
+  *out = modez->buf;
+  *outlen = len;
+  return 0;
+}
+
+int proxy_ftp_modez_get_level(struct proxy_ftp_modez *modez) {
+  if (modez == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return modez->level;
+}
+
+int proxy_ftp_modez_pending(struct proxy_ftp_modez *modez) {
+  if (modez == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  return modez->inflate_pending;
+}
+
+int proxy_ftp_modez_free(struct proxy_ftp_modez *modez) {
+  if (modez == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (modez->stream_ready == TRUE) {
+    if (modez->direction == PROXY_FTP_MODEZ_DEFLATE) {
+      deflateEnd(&(modez->stream));
+
+    } else {
+      inflateEnd(&(modez->stream));
+    }
+
+    modez->stream_ready = FALSE;
+  }
+
+  destroy_pool(modez->pool);
+  return 0;
+}
+
+#else /* !HAVE_ZLIB_H */
+
+struct proxy_ftp_modez *proxy_ftp_modez_alloc(pool *p, int direction,
+    int level) {
+  errno = ENOSYS;
+  return NULL;
+}
+
+int proxy_ftp_modez_process(struct proxy_ftp_modez *modez, const char *in,
+    size_t inlen, char **out, size_t *outlen) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int proxy_ftp_modez_finish(struct proxy_ftp_modez *modez, char **out,
+    size_t *outlen) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int proxy_ftp_modez_get_level(struct proxy_ftp_modez *modez) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int proxy_ftp_modez_pending(struct proxy_ftp_modez *modez) {
+  errno = ENOSYS;
+  return -1;
+}
+
+int proxy_ftp_modez_free(struct proxy_ftp_modez *modez) {
+  errno = ENOSYS;
+  return -1;
+}
+#endif /* HAVE_ZLIB_H */
@@ -27,60 +27,113 @@
 
 static const char *trace_channel = "proxy.ftp.msg";
 
-const char *proxy_ftp_msg_fmt_addr(pool *p, const pr_netaddr_t *addr,
-    unsigned short port, int use_masqaddr) {
-  char *addr_str, *msg, *ptr;
-  size_t msglen;
+/* Writes the decimal digits of the given number at the given position,
+ * returning the number of characters written.  Callers are responsible for
+ * ensuring that there is room for at least 5 characters.
+ */
+static size_t fmt_uint(char *buf, unsigned int num) {
+  char digits[8];
+  size_t i, len = 0;
 
-  if (p == NULL ||
-      addr == NULL) {
-    errno = EINVAL;
-    return NULL;
+  do {
+    digits[len++] = '0' + (num % 10);
+    num /= 10;
+  } while (num > 0 && len < sizeof(digits));
+
+  for (i = 0; i < len; i++) {
+    buf[i] = digits[len - i - 1];
   }
 
-  if (use_masqaddr) {
-    config_rec *c;
+  return len;
+}
 
-    /* TODO What about TLSMasqueradeAddress? */
+static const pr_netaddr_t *get_masq_addr(const pr_netaddr_t *addr) {
+  config_rec *c;
 
-    /* Handle MasqueradeAddress. */
-    c = find_config(main_server->conf, CONF_PARAM, "MasqueradeAddress", FALSE);
-    if (c != NULL) {
-      addr = c->argv[0];
-    }
+  /* TODO What about TLSMasqueradeAddress? */
+
+  /* Handle MasqueradeAddress. */
+  c = find_config(main_server->conf, CONF_PARAM, "MasqueradeAddress", FALSE);
+  if (c != NULL) {
+    addr = c->argv[0];
   }
 
-  addr_str = pstrdup(p, pr_netaddr_get_ipstr(addr));
+  return addr;
+}
 
-  /* Fixup the address string for use in PORT commands/PASV responses. */
-  ptr = strrchr(addr_str, ':');
-  if (ptr != NULL) {
-    addr_str = ptr + 1;
-  }
+int proxy_ftp_msg_fmt_addr2(const pr_netaddr_t *addr, unsigned short port,
+    int use_masqaddr, char *buf, size_t bufsz) {
+  const unsigned char *octets = NULL;
+  unsigned int i;
+  size_t len = 0;
 
-  for (ptr = addr_str; *ptr; ptr++) {
-    if (*ptr == '.') {
-      *ptr = ',';
-    }
+  if (addr == NULL ||
+      buf == NULL) {
+    errno = EINVAL;
+    return -1;
   }
 
-  /* Allocate enough room for 6 numbers (3 digits max each), 5 separators,
+  /* Make sure there is room for 6 numbers (3 digits max each), 5 separators,
    * and a trailing NUL.
    */
-  msglen = (6 * 3) + (5 * 1) + 1;
+  if (bufsz < PROXY_FTP_MSG_ADDR_BUFSZ) {
+    errno = ENOSPC;
+    return -1;
+  }
 
-  msg = pcalloc(p, msglen);
-  snprintf(msg, msglen, "%s,%u,%u", addr_str, (port >> 8) & 255, port & 255);
+  if (use_masqaddr) {
+    addr = get_masq_addr(addr);
+  }
 
-  return msg;
+  switch (pr_netaddr_get_family(addr)) {
+    case AF_INET:
+      octets = pr_netaddr_get_inaddr(addr);
+      break;
+
+#ifdef PR_USE_IPV6
+    case AF_INET6: {
+      const struct in6_addr *in6;
+
+      /* Only IPv4-mapped IPv6 addresses can be expressed in PORT commands
+       * and PASV responses.
+       */
+      in6 = pr_netaddr_get_inaddr(addr);
+      if (in6 != NULL &&
+          IN6_IS_ADDR_V4MAPPED(in6)) {
+        octets = ((const unsigned char *) in6) + 12;
+      }
+      break;
+    }
+#endif /* PR_USE_IPV6 */
+
+    default:
+      break;
+  }
+
+  if (octets == NULL) {
+    pr_trace_msg(trace_channel, 3,
+      "unable to format address %s for PORT/PASV", pr_netaddr_get_ipstr(addr));
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (i = 0; i < 4; i++) {
+    len += fmt_uint(buf + len, octets[i]);
+    buf[len++] = ',';
+  }
+
+  len += fmt_uint(buf + len, (port >> 8) & 255);
+  buf[len++] = ',';
+  len += fmt_uint(buf + len, port & 255);
+  buf[len] = '\0';
+
+  return (int) len;
 }
 
-const char *proxy_ftp_msg_fmt_ext_addr(pool *p, const pr_netaddr_t *addr,
-    unsigned short port, int cmd_id, int use_masqaddr) {
-  const char *addr_str;
-  char delim = '|', *msg;
-  int family = 0;
-  size_t addr_strlen, msglen;
+const char *proxy_ftp_msg_fmt_addr(pool *p, const pr_netaddr_t *addr,
+    unsigned short port, int use_masqaddr) {
+  char buf[PROXY_FTP_MSG_ADDR_BUFSZ];
+  int len;
 
   if (p == NULL ||
       addr == NULL) {
@@ -88,14 +141,29 @@ const char *proxy_ftp_msg_fmt_ext_addr(pool *p, const pr_netaddr_t *addr,
     return NULL;
   }
 
-  if (use_masqaddr) {
-    config_rec *c;
+  len = proxy_ftp_msg_fmt_addr2(addr, port, use_masqaddr, buf, sizeof(buf));
+  if (len < 0) {
+    return NULL;
+  }
 
-    /* Handle MasqueradeAddress. */
-    c = find_config(main_server->conf, CONF_PARAM, "MasqueradeAddress", FALSE);
-    if (c != NULL) {
-      addr = c->argv[0];
-    }
+  return pstrndup(p, buf, len);
+}
+
+int proxy_ftp_msg_fmt_ext_addr2(const pr_netaddr_t *addr, unsigned short port,
+    int cmd_id, int use_masqaddr, char *buf, size_t bufsz) {
+  const char *addr_str;
+  char delim = '|';
+  int family = 0;
+  size_t addr_strlen, len = 0;
+
+  if (addr == NULL ||
+      buf == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (use_masqaddr) {
+    addr = get_masq_addr(addr);
   }
 
   /* Format is <d>proto<d>ip address<d>port<d> (ASCII in network order),
@@ -116,66 +184,165 @@ const char *proxy_ftp_msg_fmt_ext_addr(pool *p, const pr_netaddr_t *addr,
     default:
       /* Unlikely to happen. */
       errno = EINVAL;
-      return NULL;
+      return -1;
   }
 
-  addr_str = pr_netaddr_get_ipstr(addr);
-  addr_strlen = strlen(addr_str);
-
-  /* 4 delimiters, the network protocol, the IP address, the port, and a NUL. */
-  msglen = (4 * 1) + addr_strlen + 6 + 1;
-
-  msg = pcalloc(p, msglen);
   switch (cmd_id) {
     case PR_CMD_EPRT_ID:
-      snprintf(msg, msglen, "%c%d%c%s%c%hu%c", delim, family, delim,
-        addr_str, delim, port, delim);
+      addr_str = pr_netaddr_get_ipstr(addr);
+      addr_strlen = strlen(addr_str);
+
+      /* 4 delimiters, the network protocol, the IP address, the port, and a
+       * NUL.
+       */
+      if (bufsz < (4 * 1) + 1 + addr_strlen + 5 + 1) {
+        errno = ENOSPC;
+        return -1;
+      }
+
+      buf[len++] = delim;
+      buf[len++] = '0' + family;
+      buf[len++] = delim;
+      memcpy(buf + len, addr_str, addr_strlen);
+      len += addr_strlen;
+      buf[len++] = delim;
+      len += fmt_uint(buf + len, port);
+      buf[len++] = delim;
       break;
 
     case PR_CMD_EPSV_ID:
-      snprintf(msg, msglen-1, "%c%c%c%u%c", delim, delim, delim, port, delim);
+      if (bufsz < (4 * 1) + 5 + 1) {
+        errno = ENOSPC;
+        return -1;
+      }
+
+      buf[len++] = delim;
+      buf[len++] = delim;
+      buf[len++] = delim;
+      len += fmt_uint(buf + len, port);
+      buf[len++] = delim;
       break;
 
     default:
       pr_trace_msg(trace_channel, 3, "invalid/unsupported command ID: %d",
         cmd_id);
       errno = EINVAL;
-      return NULL;
+      return -1;
   }
 
-  return msg;
+  buf[len] = '\0';
+  return (int) len;
 }
 
-const pr_netaddr_t *proxy_ftp_msg_parse_addr(pool *p, const char *msg,
-    int addr_family) {
-  int valid_fmt = FALSE;
-  const char *ptr;
-  char *addr_buf;
-  unsigned int h1, h2, h3, h4, p1, p2;
-  unsigned short port;
-  size_t addrlen;
-  pr_netaddr_t *addr;
+const char *proxy_ftp_msg_fmt_ext_addr(pool *p, const pr_netaddr_t *addr,
+    unsigned short port, int cmd_id, int use_masqaddr) {
+  char buf[PROXY_FTP_MSG_EXT_ADDR_BUFSZ];
+  int len;
 
   if (p == NULL ||
-      msg == NULL) {
+      addr == NULL) {
     errno = EINVAL;
     return NULL;
   }
 
+  len = proxy_ftp_msg_fmt_ext_addr2(addr, port, cmd_id, use_masqaddr, buf,
+    sizeof(buf));
+  if (len < 0) {
+    return NULL;
+  }
+
+  return pstrndup(p, buf, len);
+}
+
+/* Parses up to 3 digits (allowing leading zeros), returning the number of
+ * characters consumed, or zero if there are no digits.  Values beyond 999
+ * are reported as 1000, for the caller to reject.
+ */
+static size_t parse_octet(const char *ptr, const char *end,
+    unsigned int *num) {
+  const char *start = ptr;
+  unsigned int val = 0;
+
+  while (ptr < end &&
+         PR_ISDIGIT(*ptr)) {
+    if (val < 1000) {
+      val = (val * 10) + (*ptr - '0');
+    }
+
+    ptr++;
+  }
+
+  if (val > 1000) {
+    val = 1000;
+  }
+
+  *num = val;
+  return ptr - start;
+}
+
+/* Attempts to parse the "h1,h2,h3,h4,p1,p2" form starting at the given
+ * position.  As with the scanf(3) conversions we used to use, whitespace
+ * is allowed before each number after the first.
+ */
+static int parse_addr_tuple(const char *ptr, const char *end,
+    unsigned int *nums) {
+  unsigned int i;
+
+  for (i = 0; i < 6; i++) {
+    size_t len;
+
+    if (i > 0) {
+      if (ptr >= end ||
+          *ptr != ',') {
+        return -1;
+      }
+
+      ptr++;
+
+      while (ptr < end &&
+             PR_ISSPACE(*ptr)) {
+        ptr++;
+      }
+    }
+
+    len = parse_octet(ptr, end, &(nums[i]));
+    if (len == 0) {
+      return -1;
+    }
+
+    ptr += len;
+  }
+
+  return 0;
+}
+
+int proxy_ftp_msg_parse_addr2(const char *msg, size_t msglen, int addr_family,
+    pr_netaddr_t *addr) {
+  const char *ptr, *end;
+  int valid_fmt = FALSE;
+  unsigned int nums[6];
+  unsigned short port;
+  struct sockaddr *sa;
+
+  if (msg == NULL ||
+      addr == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
   /* Have to scan the message for the encoded address/port.  Note that we may
    * see some strange formats for PASV responses from FTP servers here.
    *
    * We can't predict where the expected address/port numbers start in the
    * string, so start from the beginning.
    */
+  end = msg + msglen;
+  for (ptr = msg; ptr < end && *ptr; ptr++) {
+    if (!PR_ISDIGIT(*ptr)) {
+      continue;
+    }
 
-  h1 = h2 = h3 = h4 = p1 = p2 = 0;
-  for (ptr = msg; *ptr; ptr++) {
-    pr_signals_handle();
-
-    h1 = h2 = h3 = h4 = p1 = p2 = 0;
-
-    if (sscanf(ptr, "%u,%u,%u,%u,%u,%u", &h1, &h2, &h3, &h4, &p1, &p2) == 6) {
+    if (parse_addr_tuple(ptr, end, nums) == 0) {
       valid_fmt = TRUE;
       break;
     }
@@ -183,63 +350,86 @@ const pr_netaddr_t *proxy_ftp_msg_parse_addr(pool *p, const char *msg,
 
   if (valid_fmt == FALSE) {
     pr_trace_msg(trace_channel, 12,
-      "unable to find PORT/PASV address/port format in '%s'", msg);
+      "unable to find PORT/PASV address/port format in '%.*s'", (int) msglen,
+      msg);
     errno = EPERM;
-    return NULL;
+    return -1;
   }
 
-  if (h1 > 255 || h2 > 255 || h3 > 255 || h4 > 255 ||
-      p1 > 255 || p2 > 255 ||
-      (h1|h2|h3|h4) == 0 ||
-      (p1|p2) == 0) {
+  if (nums[0] > 255 || nums[1] > 255 || nums[2] > 255 || nums[3] > 255 ||
+      nums[4] > 255 || nums[5] > 255 ||
+      (nums[0]|nums[1]|nums[2]|nums[3]) == 0 ||
+      (nums[4]|nums[5]) == 0) {
     pr_trace_msg(trace_channel, 9,
-      "message '%s' has invalid address/port value(s)", msg);
+      "message '%.*s' has invalid address/port value(s)", (int) msglen, msg);
     errno = EINVAL;
-    return NULL;
+    return -1;
   }
 
-  /* A dotted quad address has a maximum size of 16 bytes: 4 numbers of 3 digits
-   * (max), 3 periods, and 1 terminating NUL.
-   */
-  addrlen = 16;
+  pr_netaddr_clear(addr);
 
 #ifdef PR_USE_IPV6
-  /* Allow extra room for any necessary "::ffff:" prefix, for IPv6 sessions. */
-  addrlen += 7;
-#endif /* PR_USE_IPV6 */
+  if (pr_netaddr_use_ipv6() &&
+      addr_family == AF_INET6) {
+    unsigned char *octets;
 
-  addr_buf = pcalloc(p, addrlen);
+    /* Use the IPv4-mapped IPv6 address, i.e. "::ffff:h1.h2.h3.h4", for IPv6
+     * sessions.
+     */
+    pr_netaddr_set_family(addr, AF_INET6);
+    sa = pr_netaddr_get_sockaddr(addr);
+    if (sa != NULL) {
+      sa->sa_family = AF_INET6;
+    }
 
-#ifdef PR_USE_IPV6
-  if (pr_netaddr_use_ipv6()) {
-    if (addr_family == AF_INET6) {
-      snprintf(addr_buf, addrlen, "::ffff:%u.%u.%u.%u", h1, h2, h3, h4);
+    octets = pr_netaddr_get_inaddr(addr);
+    memset(octets, 0, 10);
+    octets[10] = octets[11] = 0xff;
+    octets[12] = nums[0];
+    octets[13] = nums[1];
+    octets[14] = nums[2];
+    octets[15] = nums[3];
 
-    } else {
-      snprintf(addr_buf, addrlen, "%u.%u.%u.%u", h1, h2, h3, h4);
+  } else {
+#endif /* PR_USE_IPV6 */
+    unsigned char *octets;
+
+    pr_netaddr_set_family(addr, AF_INET);
+    sa = pr_netaddr_get_sockaddr(addr);
+    if (sa != NULL) {
+      sa->sa_family = AF_INET;
     }
 
-  } else {
-    snprintf(addr_buf, addrlen, "%u.%u.%u.%u", h1, h2, h3, h4);
+    octets = pr_netaddr_get_inaddr(addr);
+    octets[0] = nums[0];
+    octets[1] = nums[1];
+    octets[2] = nums[2];
+    octets[3] = nums[3];
+#ifdef PR_USE_IPV6
   }
-#else
-  snprintf(addr_buf, addrlen, "%u.%u.%u.%u", h1, h2, h3, h4);
 #endif /* PR_USE_IPV6 */
 
-  addr = (pr_netaddr_t *) pr_netaddr_get_addr(p, addr_buf, NULL);
-  if (addr == NULL) {
-    int xerrno = errno;
+  port = (nums[4] << 8) + nums[5];
+  pr_netaddr_set_port2(addr, port);
 
-    pr_trace_msg(trace_channel, 7,
-      "unable to resolve '%s' from message '%s': %s", addr_buf, msg,
-      strerror(xerrno));
+  return 0;
+}
 
-    errno = xerrno;
+const pr_netaddr_t *proxy_ftp_msg_parse_addr(pool *p, const char *msg,
+    int addr_family) {
+  pr_netaddr_t na, *addr;
+
+  if (p == NULL ||
+      msg == NULL) {
+    errno = EINVAL;
     return NULL;
   }
 
-  port = (p1 << 8) + p2;
-  pr_netaddr_set_port2(addr, port);
+  if (proxy_ftp_msg_parse_addr2(msg, strlen(msg), addr_family, &na) < 0) {
+    return NULL;
+  }
+
+  addr = pr_netaddr_dup(p, &na);
 
   pr_trace_msg(trace_channel, 9, "parsed '%s' into %s %s#%u", msg,
     pr_netaddr_get_family(addr) == AF_INET ? "IPv4" : "IPv6",
@@ -248,60 +438,68 @@ const pr_netaddr_t *proxy_ftp_msg_parse_addr(pool *p, const char *msg,
   return addr;
 }
 
-const pr_netaddr_t *proxy_ftp_msg_parse_ext_addr(pool *p, const char *msg,
-    const pr_netaddr_t *addr, int cmd_id, const char *net_proto) {
-  pr_netaddr_t *res = NULL, na;
+int proxy_ftp_msg_parse_ext_addr2(const char *msg, size_t msglen,
+    const pr_netaddr_t *addr, int cmd_id, const char *net_proto,
+    pr_netaddr_t *res) {
+  const char *ptr, *end;
   int family = 0;
-  unsigned short port = 0;
-  char delim, *msg_str, *ptr;
-  size_t msglen;
+  unsigned int port = 0;
+  char delim;
 
-  if (p == NULL ||
-      msg == NULL ||
-      addr == NULL) {
+  if (msg == NULL ||
+      addr == NULL ||
+      res == NULL) {
     errno = EINVAL;
-    return NULL;
+    return -1;
   }
 
+  ptr = msg;
+  end = msg + msglen;
+
   if (cmd_id == PR_CMD_EPSV_ID) {
-    int decr = 0;
+    const char *start;
 
     /* First, find the opening '(' character. */
-    ptr = strchr(msg, '(');
-    if (ptr == NULL) {
+    start = memchr(msg, '(', msglen);
+    if (start == NULL) {
       pr_trace_msg(trace_channel, 12,
-        "missing starting '(' character for extended address in '%s'", msg);
+        "missing starting '(' character for extended address in '%.*s'",
+        (int) msglen, msg);
       errno = EINVAL;
-      return NULL;
+      return -1;
     }
 
     /* Make sure that one of the last characters is a closing ')'.  Note that
      * some servers may have a trailing '.' as well.
      */
-    msglen = strlen(ptr);
-    if (ptr[msglen-1] == ')') {
-      decr = 1;
+    if (end - start >= 2 &&
+        end[-1] == ')') {
+      end -= 1;
 
-    } else if (ptr[msglen-2] == ')') {
-      decr = 2;
+    } else if (end - start >= 3 &&
+               end[-2] == ')') {
+      end -= 2;
 
     } else {
       pr_trace_msg(trace_channel, 12,
-        "missing ending ')' character for extended address in '%s'", msg);
+        "missing ending ')' character for extended address in '%.*s'",
+        (int) msglen, msg);
       errno = EINVAL;
-      return NULL;
+      return -1;
     }
 
-    msg_str = pstrndup(p, ptr+1, msglen-decr-1);
-
-  } else {
-    msg_str = pstrdup(p, msg);
+    ptr = start + 1;
   }
 
   /* Format is <d>proto<d>ip address<d>port<d> (ASCII in network order),
    * where <d> is an arbitrary delimiter character.
    */
-  delim = *msg_str++;
+  if (ptr >= end) {
+    errno = EPROTOTYPE;
+    return -1;
+  }
+
+  delim = *ptr++;
 
   /* If the network protocol string (e.g. sent by client in EPSV command) is
    * null, then determine the protocol family from the address family we were
@@ -316,7 +514,8 @@ const pr_netaddr_t *proxy_ftp_msg_parse_ext_addr(pool *p, const char *msg,
   }
 
   if (net_proto == NULL) {
-    if (*msg_str == delim) {
+    if (ptr < end &&
+        *ptr == delim) {
       switch (pr_netaddr_get_family(addr)) {
         case AF_INET:
           family = 1;
@@ -335,7 +534,11 @@ const pr_netaddr_t *proxy_ftp_msg_parse_ext_addr(pool *p, const char *msg,
       }
 
     } else {
-      family = atoi(msg_str);
+      unsigned int num;
+
+      if (parse_octet(ptr, end, &num) > 0) {
+        family = (int) num;
+      }
     }
 
   } else {
@@ -344,12 +547,14 @@ const pr_netaddr_t *proxy_ftp_msg_parse_ext_addr(pool *p, const char *msg,
 
   switch (family) {
     case 1:
-      pr_trace_msg(trace_channel, 19, "parsed IPv4 address from '%s'", msg);
+      pr_trace_msg(trace_channel, 19, "parsed IPv4 address from '%.*s'",
+        (int) msglen, msg);
       break;
 
 #ifdef PR_USE_IPV6
     case 2:
-      pr_trace_msg(trace_channel, 19, "parsed IPv6 address from '%s'", msg);
+      pr_trace_msg(trace_channel, 19, "parsed IPv6 address from '%.*s'",
+        (int) msglen, msg);
       if (pr_netaddr_use_ipv6()) {
         break;
       }
@@ -359,115 +564,129 @@ const pr_netaddr_t *proxy_ftp_msg_parse_ext_addr(pool *p, const char *msg,
       pr_trace_msg(trace_channel, 12,
         "unsupported network protocol %d", family);
       errno = EPROTOTYPE;
-      return NULL;
+      return -1;
   }
 
-  /* Now, skip past those numeric characters that atoi() used. */
-  while (PR_ISDIGIT(*msg_str)) {
-    msg_str++;
+  /* Now, skip past the numeric protocol characters. */
+  while (ptr < end &&
+         PR_ISDIGIT(*ptr)) {
+    ptr++;
   }
 
   /* If the next character is not the delimiter, it's a badly formatted
    * parameter.
    */
-  if (*msg_str == delim) {
-    msg_str++;
+  if (ptr < end &&
+      *ptr == delim) {
+    ptr++;
 
   } else {
-    pr_trace_msg(trace_channel, 17, "rejecting badly formatted message '%s'",
-      msg_str);
+    pr_trace_msg(trace_channel, 17, "rejecting badly formatted message '%.*s'",
+      (int) msglen, msg);
     errno = EPERM;
-    return NULL;
+    return -1;
   }
 
-  pr_netaddr_clear(&na);
+  pr_netaddr_clear(res);
 
   /* If the next character IS the delimiter, then the address portion is
    * omitted (which is permissible).
    */
-  if (*msg_str == delim) {
-    pr_netaddr_set_family(&na, pr_netaddr_get_family(addr));
-    pr_netaddr_set_sockaddr(&na, pr_netaddr_get_sockaddr(addr));
-    msg_str++;
+  if (ptr < end &&
+      *ptr == delim) {
+    pr_netaddr_set_family(res, pr_netaddr_get_family(addr));
+    pr_netaddr_set_sockaddr(res, pr_netaddr_get_sockaddr(addr));
+    ptr++;
 
   } else {
-    ptr = strchr(msg_str, delim);
-    if (ptr == NULL) {
+    const char *addr_end;
+    char addr_str[PROXY_FTP_MSG_EXT_ADDR_BUFSZ];
+    size_t addr_len;
+    struct sockaddr *sa;
+    int fam;
+
+    addr_end = memchr(ptr, delim, end - ptr);
+    if (addr_end == NULL) {
       /* Badly formatted message. */
       errno = EINVAL;
-      return NULL;
+      return -1;
     }
 
-    /* Twiddle the string so that just the address portion will be processed
-     * by pr_inet_pton().
-     */
-    *ptr = '\0';
-
-    /* Use pr_inet_pton() to translate the address string into the address
-     * value.
-     */
-    switch (family) {
-      case 1: {
-        struct sockaddr *sa = NULL;
-
-        pr_netaddr_set_family(&na, AF_INET);
-        sa = pr_netaddr_get_sockaddr(&na);
-        if (sa) {
-          sa->sa_family = AF_INET;
-        }
-
-        if (pr_inet_pton(AF_INET, msg_str, pr_netaddr_get_inaddr(&na)) <= 0) {
-          pr_trace_msg(trace_channel, 2,
-            "error converting IPv4 address '%s': %s", msg_str, strerror(errno));
-          errno = EPERM;
-          return NULL;
-        }
-
-        break;
-      }
+    /* Copy just the address portion, for pr_inet_pton(). */
+    addr_len = addr_end - ptr;
+    if (addr_len >= sizeof(addr_str)) {
+      pr_trace_msg(trace_channel, 2,
+        "address in '%.*s' too long (%lu bytes)", (int) msglen, msg,
+        (unsigned long) addr_len);
+      errno = EPERM;
+      return -1;
+    }
 
-      case 2: {
-        struct sockaddr *sa = NULL;
+    memcpy(addr_str, ptr, addr_len);
+    addr_str[addr_len] = '\0';
 
-        pr_netaddr_set_family(&na, AF_INET6);
-        sa = pr_netaddr_get_sockaddr(&na);
-        if (sa) {
-          sa->sa_family = AF_INET6;
-        }
+    fam = (family == 1 ? AF_INET : AF_INET6);
 
-        if (pr_inet_pton(AF_INET6, msg_str, pr_netaddr_get_inaddr(&na)) <= 0) {
-          pr_trace_msg(trace_channel, 2,
-            "error converting IPv6 address '%s': %s", msg_str, strerror(errno));
-          errno = EPERM;
-          return NULL;
-        }
+    pr_netaddr_set_family(res, fam);
+    sa = pr_netaddr_get_sockaddr(res);
+    if (sa != NULL) {
+      sa->sa_family = fam;
+    }
 
-        break;
-      }
+    if (pr_inet_pton(fam, addr_str, pr_netaddr_get_inaddr(res)) <= 0) {
+      pr_trace_msg(trace_channel, 2,
+        "error converting IPv%d address '%s': %s", fam == AF_INET ? 4 : 6,
+        addr_str, strerror(errno));
+      errno = EPERM;
+      return -1;
     }
 
     /* Advance past the address portion of the argument. */
-    msg_str = ++ptr;
+    ptr = addr_end + 1;
   }
 
-  port = atoi(msg_str);
+  while (ptr < end &&
+         PR_ISDIGIT(*ptr)) {
+    if (port <= 65535) {
+      port = (port * 10) + (*ptr - '0');
+    }
 
-  while (PR_ISDIGIT(*msg_str)) {
-    msg_str++;
+    ptr++;
   }
 
-  /* If the next character is not the delimiter, it's a badly formatted
-   * parameter.
+  /* If the next character is not the delimiter, or the port is out of range,
+   * it's a badly formatted parameter.
    */
-  if (*msg_str != delim) {
-    pr_trace_msg(trace_channel, 17, "rejecting badly formatted message '%s'",
-      msg_str);
+  if (ptr >= end ||
+      *ptr != delim ||
+      port > 65535) {
+    pr_trace_msg(trace_channel, 17, "rejecting badly formatted message '%.*s'",
+      (int) msglen, msg);
     errno = EPERM;
+    return -1;
+  }
+
+  pr_netaddr_set_port(res, htons((unsigned short) port));
+  return 0;
+}
+
+const pr_netaddr_t *proxy_ftp_msg_parse_ext_addr(pool *p, const char *msg,
+    const pr_netaddr_t *addr, int cmd_id, const char *net_proto) {
+  pr_netaddr_t na, *res;
+
+  if (p == NULL ||
+      msg == NULL ||
+      addr == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (proxy_ftp_msg_parse_ext_addr2(msg, strlen(msg), addr, cmd_id, net_proto,
+      &na) < 0) {
     return NULL;
   }
 
   res = pr_netaddr_dup(p, &na);
-  pr_netaddr_set_port(res, htons(port));
 
   pr_trace_msg(trace_channel, 9, "parsed '%s' into %s %s#%u", msg,
     pr_netaddr_get_family(res) == AF_INET ? "IPv4" : "IPv6",
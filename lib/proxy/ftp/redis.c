@@ -0,0 +1,234 @@
+/*
+ * ProFTPD - mod_proxy FTP Redis implementation
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_proxy.h"
+
+#include "redis.h"
+#include "proxy/ftp/xfer.h"
+#include "proxy/ftp/redis.h"
+
+static const char *trace_channel = "proxy.ftp.redis";
+
+static void *redis_prefix = NULL;
+static size_t redis_prefixsz = 0;
+static unsigned long redis_opts = 0UL;
+
+static char *make_dataxfer_key(pool *p, const char *backend_uri) {
+  char *key;
+  size_t keysz;
+
+  keysz = strlen(backend_uri) + 64;
+  key = pcalloc(p, keysz + 1);
+  snprintf(key, keysz, "proxy_ftp_dataxfer:%s", backend_uri);
+
+  return key;
+}
+
+static char *make_dataxfer_field(pool *p, unsigned int vhost_id) {
+  char *field;
+  size_t fieldsz;
+
+  fieldsz = 32;
+  field = pcalloc(p, fieldsz);
+  snprintf(field, fieldsz - 1, "%u", vhost_id);
+
+  return field;
+}
+
+static int ftp_redis_get_dataxfer(pool *p, void *dsh, unsigned int vhost_id,
+    const char *backend_uri, unsigned long *flags, time_t *updated) {
+  int res, xerrno;
+  pool *tmp_pool;
+  pr_redis_t *redis;
+  pr_table_t *dataxfer_tab;
+  char *key, *field, *text;
+  const void *elt, *data = NULL;
+  size_t eltlen = 0, datalen = 0;
+  long updated_val = 0;
+
+  redis = dsh;
+
+  tmp_pool = make_sub_pool(p);
+  key = make_dataxfer_key(tmp_pool, backend_uri);
+
+  res = pr_redis_hash_getall(tmp_pool, redis, &proxy_module, key,
+    &dataxfer_tab);
+  xerrno = errno;
+
+  if (res < 0) {
+    if (xerrno != ENOENT) {
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error getting hash from Redis '%s': %s", key, strerror(xerrno));
+    }
+
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  if (dataxfer_tab == NULL) {
+    destroy_pool(tmp_pool);
+    errno = ENOENT;
+    return -1;
+  }
+
+  /* Each field is a vhost ID; each value is "flags updated". */
+  field = make_dataxfer_field(tmp_pool, vhost_id);
+
+  (void) pr_table_rewind(dataxfer_tab);
+  elt = pr_table_knext(dataxfer_tab, &eltlen);
+  while (elt != NULL) {
+    pr_signals_handle();
+
+    if (eltlen >= strlen(field) &&
+        strncmp(elt, field, eltlen) == 0) {
+      data = pr_table_kget(dataxfer_tab, elt, eltlen, &datalen);
+      break;
+    }
+
+    elt = pr_table_knext(dataxfer_tab, &eltlen);
+  }
+
+  if (data == NULL) {
+    destroy_pool(tmp_pool);
+    errno = ENOENT;
+    return -1;
+  }
+
+  text = pstrndup(tmp_pool, data, datalen);
+  if (sscanf(text, "%lu %ld", flags, &updated_val) != 2) {
+    pr_trace_msg(trace_channel, 3,
+      "ignoring malformed data transfer flags '%s' for '%s' in Redis hash "
+      "'%s'", text, field, key);
+    destroy_pool(tmp_pool);
+    errno = EINVAL;
+    return -1;
+  }
+
+  *updated = (time_t) updated_val;
+  destroy_pool(tmp_pool);
+
+  pr_trace_msg(trace_channel, 19,
+    "retrieved data transfer flags %lu for vhost ID %u, URI '%s'", *flags,
+    vhost_id, backend_uri);
+  return 0;
+}
+
+static int ftp_redis_set_dataxfer(pool *p, void *dsh, unsigned int vhost_id,
+    const char *backend_uri, unsigned long flags, time_t updated) {
+  int res, xerrno = 0;
+  pool *tmp_pool;
+  pr_redis_t *redis;
+  char *key, *field, *data;
+  size_t datasz;
+
+  redis = dsh;
+
+  tmp_pool = make_sub_pool(p);
+  key = make_dataxfer_key(tmp_pool, backend_uri);
+  field = make_dataxfer_field(tmp_pool, vhost_id);
+
+  datasz = 64;
+  data = pcalloc(tmp_pool, datasz);
+  snprintf(data, datasz - 1, "%lu %ld", flags, (long) updated);
+
+  res = pr_redis_hash_set(redis, &proxy_module, key, field, data,
+    strlen(data));
+  xerrno = errno;
+
+  if (res < 0) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error setting value for field '%s' in Redis hash '%s': %s",
+      field, key, strerror(xerrno));
+
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  destroy_pool(tmp_pool);
+  return 0;
+}
+
+/* Initialization routines */
+
+static int ftp_redis_init(pool *p, const char *tables_path, int flags) {
+  /* We currently don't need to do anything, at init time, to any existing
+   * FTP Redis keys.
+   */
+  return 0;
+}
+
+static int ftp_redis_close(pool *p, void *redis) {
+  if (redis != NULL) {
+    if (pr_redis_conn_close(redis) < 0) {
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error closing Redis connection: %s", strerror(errno));
+    }
+  }
+
+  return 0;
+}
+
+static void *ftp_redis_open(pool *p, const char *tables_dir,
+    unsigned long opts) {
+  int xerrno = 0;
+  pr_redis_t *redis;
+
+  redis = pr_redis_conn_new(p, &proxy_module, 0);
+  xerrno = errno;
+
+  if (redis == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error opening Redis connection: %s", strerror(xerrno));
+    errno = xerrno;
+    return NULL;
+  }
+
+  (void) pr_redis_conn_set_namespace(redis, &proxy_module, redis_prefix,
+    redis_prefixsz);
+  redis_opts = opts;
+
+  return redis;
+}
+
+int proxy_ftp_redis_as_datastore(struct proxy_ftp_datastore *ds,
+    void *ds_data, size_t ds_datasz) {
+  if (ds == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  redis_prefix = ds_data;
+  redis_prefixsz = ds_datasz;
+
+  ds->dataxfer_get = ftp_redis_get_dataxfer;
+  ds->dataxfer_set = ftp_redis_set_dataxfer;
+
+  ds->init = ftp_redis_init;
+  ds->open = ftp_redis_open;
+  ds->close = ftp_redis_close;
+
+  return 0;
+}
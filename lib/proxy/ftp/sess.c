@@ -30,7 +30,6 @@
 #include "proxy/ftp/sess.h"
 #include "proxy/ftp/ctrl.h"
 
-static const char *feat_crlf = "\r\n";
 static int tls_xfer_prot_policy = 1;
 
 static const char *trace_channel = "proxy.ftp.sess";
@@ -98,14 +97,172 @@ static int parse_feat(pool *p, const char *feat, array_header **res) {
   return vals->nelts;
 }
 
+/* The well-known FEAT names, which we track as flags rather than table
+ * entries, for cheaper checks later in the session.
+ */
+struct feat_name {
+  const char *name;
+  size_t namelen;
+  unsigned long flag;
+};
+
+static struct feat_name known_feats[] = {
+  { C_AUTH,	4,	PROXY_SESS_FEAT_FL_AUTH },
+  { C_EPRT,	4,	PROXY_SESS_FEAT_FL_EPRT },
+  { C_EPSV,	4,	PROXY_SESS_FEAT_FL_EPSV },
+  { C_HOST,	4,	PROXY_SESS_FEAT_FL_HOST },
+  { C_MDTM,	4,	PROXY_SESS_FEAT_FL_MDTM },
+  { C_MLST,	4,	PROXY_SESS_FEAT_FL_MLST },
+  { C_PBSZ,	4,	PROXY_SESS_FEAT_FL_PBSZ },
+  { C_REST,	4,	PROXY_SESS_FEAT_FL_REST_STREAM },
+  { C_SIZE,	4,	PROXY_SESS_FEAT_FL_SIZE },
+  { "UTF8",	4,	PROXY_SESS_FEAT_FL_UTF8 },
+  { NULL,	0,	0 }
+};
+
+static unsigned long get_feat_flag(const char *key, size_t keylen) {
+  register unsigned int i;
+
+  for (i = 0; known_feats[i].name != NULL; i++) {
+    if (known_feats[i].namelen == keylen &&
+        strncasecmp(known_feats[i].name, key, keylen) == 0) {
+      return known_feats[i].flag;
+    }
+  }
+
+  return 0;
+}
+
+int proxy_ftp_sess_parse_feat(pool *p, char *buf, size_t buflen,
+    struct proxy_session *proxy_sess) {
+  char *ptr, *end;
+  int count = 0;
+
+  if (p == NULL ||
+      buf == NULL ||
+      proxy_sess == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (proxy_sess->backend_features == NULL) {
+    proxy_sess->backend_features = pr_table_nalloc(p, 0, 4);
+  }
+
+  ptr = buf;
+  end = buf + buflen;
+
+  while (ptr < end) {
+    char *eol, *key, *val;
+    size_t linelen, keylen;
+    register size_t i;
+    unsigned long flag;
+
+    pr_signals_handle();
+
+    eol = memchr(ptr, '\n', end - ptr);
+    if (eol == NULL) {
+      eol = end;
+    }
+
+    linelen = eol - ptr;
+    if (linelen > 0 &&
+        ptr[linelen-1] == '\r') {
+      linelen--;
+    }
+
+    /* Some broken FTP servers send embedded NULs; treat them as the end of
+     * the line.
+     */
+    key = memchr(ptr, '\0', linelen);
+    if (key != NULL) {
+      linelen = key - ptr;
+    }
+
+    ptr[linelen] = '\0';
+
+    /* The FEAT response lines in which we are interested all start with
+     * a single space, per RFC spec.  Ignore any other lines.
+     */
+    if (linelen < 2 ||
+        ptr[0] != ' ') {
+      ptr = eol + 1;
+      continue;
+    }
+
+    key = ptr + 1;
+
+    /* Find the next space in the string, to delimit our key/value pairs. */
+    val = strchr(key, ' ');
+    if (val != NULL) {
+      keylen = val - key;
+      *val++ = '\0';
+
+    } else {
+      keylen = linelen - 1;
+
+      /* Point at the terminating NUL, for an empty value. */
+      val = key + keylen;
+    }
+
+    ptr = eol + 1;
+
+    if (keylen == 0) {
+      continue;
+    }
+
+    count++;
+
+    flag = get_feat_flag(key, keylen);
+    switch (flag) {
+      case 0:
+        break;
+
+      case PROXY_SESS_FEAT_FL_REST_STREAM:
+        /* Only the "REST STREAM" form is of interest to us. */
+        if (strcasecmp(val, "STREAM") != 0) {
+          flag = 0;
+        }
+        break;
+
+      case PROXY_SESS_FEAT_FL_AUTH:
+        proxy_sess->backend_auth_feat = val;
+        break;
+
+      case PROXY_SESS_FEAT_FL_MLST:
+        proxy_sess->backend_mlst_feat = val;
+        break;
+
+      default:
+        break;
+    }
+
+    if (flag != 0) {
+      proxy_sess->backend_feat_flags |= flag;
+      continue;
+    }
+
+    /* FEAT names are case-insensitive, but our table lookups (e.g. for
+     * PROT, MODE) use the uppercased command names.
+     */
+    for (i = 0; i < keylen; i++) {
+      key[i] = toupper((int) ((unsigned char) key[i]));
+    }
+
+    pr_table_add(proxy_sess->backend_features, key, val, 0);
+  }
+
+  return count;
+}
+
 int proxy_ftp_sess_get_feat(pool *p, const struct proxy_session *proxy_sess) {
   pool *tmp_pool;
   int flags, res, xerrno = 0;
   cmd_rec *cmd;
   pr_response_t *resp;
   unsigned int resp_nlines = 0;
-  char *feats, *feats_start, *token;
-  size_t feats_len = 0, token_len = 0;
+  char *feats;
+  size_t feats_len = 0;
 
   if (p == NULL ||
       proxy_sess == NULL) {
@@ -173,46 +330,18 @@ int proxy_ftp_sess_get_feat(pool *p, const struct proxy_session *proxy_sess) {
     return -1;
   }
 
-  ((struct proxy_session *) proxy_sess)->backend_features = pr_table_nalloc(p, 0, 4);
-
-  feats_start = feats = (char *) resp->msg;
-  feats_len = strlen(feats);
-
-  token = pr_str_get_token2(&feats, (char *) feat_crlf, &token_len);
-  while (token != NULL) {
-    pr_signals_handle();
-
-    if (token_len > 0) {
-      /* The FEAT response lines in which we are interested all start with
-       * a single space, per RFC spec.  Ignore any other lines.
-       */
-      if (token[0] == ' ') {
-        char *key, *val, *ptr;
-
-        /* Find the next space in the string, to delimit our key/value pairs. */
-        ptr = strchr(token + 1, ' ');
-        if (ptr != NULL) {
-          key = pstrndup(p, token + 1, ptr - token - 1);
-          val = pstrdup(p, ptr + 1);
-
-        } else {
-          key = pstrdup(p, token + 1);
-          val = pstrdup(p, "");
-        }
-
-        pr_table_add(proxy_sess->backend_features, key, val, 0);
-      }
-    }
-
-    feats = token + token_len + 1;
-
-    /* Don't advance past the end of our FEAT response. */
-    if (feats > feats_start + feats_len) {
-      break;
-    }
+  /* The parsed table entries point into this copy of the response, so it
+   * needs to come from the longer-lived pool.
+   */
+  feats_len = strlen(resp->msg);
+  feats = pstrndup(p, resp->msg, feats_len);
 
-    token = pr_str_get_token2(&feats, (char *) feat_crlf, &token_len);
-  }
+  res = proxy_ftp_sess_parse_feat(p, feats, feats_len,
+    (struct proxy_session *) proxy_sess);
+  pr_trace_msg(trace_channel, 17,
+    "parsed %d %s from backend %s response (flags %#lx)", res,
+    res != 1 ? "features" : "feature", (char *) cmd->argv[0],
+    proxy_sess->backend_feat_flags);
 
   destroy_pool(tmp_pool);
   return 0;
@@ -264,7 +393,7 @@ int proxy_ftp_sess_send_host(pool *p, const struct proxy_session *proxy_sess) {
     return -1;
   }
 
-  if (pr_table_get(proxy_sess->backend_features, C_HOST, NULL) == NULL) {
+  if (!(proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_HOST)) {
     pr_trace_msg(trace_channel, 9,
       "HOST not supported by backend server, ignoring");
     return 0;
@@ -303,6 +432,22 @@ int proxy_ftp_sess_send_host(pool *p, const struct proxy_session *proxy_sess) {
   return 0;
 }
 
+/* Reverts the backend control connection, whose streams are bound to the
+ * TLS NetIO, to the core NetIO.
+ */
+static void use_plain_ctrl_netio(conn_t *conn) {
+  proxy_netio_use(PR_NETIO_STRM_CTRL, NULL);
+
+  if (conn->instrm != NULL) {
+    (void) proxy_netio_bind(conn->instrm, NULL);
+  }
+
+  if (conn->outstrm != NULL &&
+      conn->outstrm != conn->instrm) {
+    (void) proxy_netio_bind(conn->outstrm, NULL);
+  }
+}
+
 int proxy_ftp_sess_send_auth_tls(pool *p,
     const struct proxy_session *proxy_sess) {
   int uri_tls, use_tls, xerrno;
@@ -346,7 +491,7 @@ int proxy_ftp_sess_send_auth_tls(pool *p,
   /* Check for any per-URI scheme-based TLS requirements. */
   uri_tls = proxy_conn_get_tls(proxy_sess->dst_pconn);
 
-  auth_feat = pr_table_get(proxy_sess->backend_features, C_AUTH, NULL);
+  auth_feat = proxy_sess->backend_auth_feat;
   if (auth_feat == NULL) {
     /* Backend server does not indicate that it supports AUTH via FEAT.
      *
@@ -430,7 +575,7 @@ int proxy_ftp_sess_send_auth_tls(pool *p,
   if (resp == NULL) {
     xerrno = errno;
 
-    proxy_netio_use(PR_NETIO_STRM_CTRL, NULL);
+    use_plain_ctrl_netio(proxy_sess->backend_ctrl_conn);
     destroy_pool(tmp_pool);
     errno = xerrno;
     return -1;
@@ -452,7 +597,7 @@ int proxy_ftp_sess_send_auth_tls(pool *p,
       "received unexpected %s response code %s from backend",
       (char *) cmd->argv[0], resp->num);
 
-    proxy_netio_use(PR_NETIO_STRM_CTRL, NULL);
+    use_plain_ctrl_netio(proxy_sess->backend_ctrl_conn);
     destroy_pool(tmp_pool);
     errno = EPERM;
     return -1;
@@ -517,7 +662,7 @@ int proxy_ftp_sess_send_pbsz_prot(pool *p,
    */
 
   /* PBSZ */
-  if (pr_table_get(proxy_sess->backend_features, C_PBSZ, NULL) != NULL) {
+  if (proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_PBSZ) {
     have_feat_pbsz = TRUE;
   }
 
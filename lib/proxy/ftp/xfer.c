@@ -30,12 +30,105 @@
 #include "include/proxy/ftp/ctrl.h"
 #include "include/proxy/ftp/msg.h"
 #include "include/proxy/ftp/xfer.h"
+#include "include/proxy/ftp/db.h"
+#include "include/proxy/ftp/redis.h"
 
 /* From response.c */
 extern pr_response_t *resp_list, *resp_err_list;
 
+static struct proxy_ftp_datastore xfer_ds;
+static const char *xfer_tables_path = NULL;
+
+/* The data transfer flags recording what a backend server rejected, and thus
+ * worth sharing with later sessions to that backend server.
+ */
+#define PROXY_FTP_XFER_SHARED_FLAGS \
+  (PROXY_SESS_DATA_TRANSFER_FL_EPSV_FAILED|PROXY_SESS_DATA_TRANSFER_FL_EPRT_FAILED|PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL_FAILED)
+
+/* How long, in seconds, we trust what was learned about a backend server;
+ * after that, we probe it again.
+ */
+#define PROXY_FTP_XFER_SHARED_FLAGS_TTL		86400
+
 static const char *trace_channel = "proxy.ftp.xfer";
 
+/* Merge in what earlier sessions learned about this backend server, once
+ * per session.
+ */
+static void xfer_load_flags(pool *p, struct proxy_session *proxy_sess) {
+  int res;
+  const char *backend_uri;
+  unsigned long flags = 0UL;
+  time_t now, updated = 0;
+
+  if (proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_DATASTORE_LOADED) {
+    return;
+  }
+
+  proxy_sess->dataxfer_flags |= PROXY_SESS_DATA_TRANSFER_FL_DATASTORE_LOADED;
+
+  if (xfer_ds.dsh == NULL) {
+    return;
+  }
+
+  backend_uri = proxy_conn_get_uri(proxy_sess->dst_pconn);
+  if (backend_uri == NULL) {
+    return;
+  }
+
+  res = (xfer_ds.dataxfer_get)(p, xfer_ds.dsh, main_server->sid, backend_uri,
+    &flags, &updated);
+  if (res < 0) {
+    if (errno != ENOENT) {
+      pr_trace_msg(trace_channel, 9,
+        "error getting data transfer flags for '%s': %s", backend_uri,
+        strerror(errno));
+    }
+
+    return;
+  }
+
+  time(&now);
+  if (updated + PROXY_FTP_XFER_SHARED_FLAGS_TTL < now) {
+    pr_trace_msg(trace_channel, 15,
+      "ignoring stale data transfer flags for '%s'", backend_uri);
+    return;
+  }
+
+  flags &= PROXY_FTP_XFER_SHARED_FLAGS;
+  pr_trace_msg(trace_channel, 15,
+    "using data transfer flags %lu learned for '%s'", flags, backend_uri);
+  proxy_sess->dataxfer_flags |= flags;
+}
+
+/* Record a rejection by the backend server, for this session and for later
+ * sessions to the same backend server.
+ */
+static void xfer_learn_flag(pool *p, struct proxy_session *proxy_sess,
+    unsigned long flag) {
+  int res;
+  const char *backend_uri;
+
+  proxy_sess->dataxfer_flags |= flag;
+
+  if (xfer_ds.dsh == NULL) {
+    return;
+  }
+
+  backend_uri = proxy_conn_get_uri(proxy_sess->dst_pconn);
+  if (backend_uri == NULL) {
+    return;
+  }
+
+  res = (xfer_ds.dataxfer_set)(p, xfer_ds.dsh, main_server->sid, backend_uri,
+    proxy_sess->dataxfer_flags & PROXY_FTP_XFER_SHARED_FLAGS, time(NULL));
+  if (res < 0) {
+    pr_trace_msg(trace_channel, 9,
+      "error storing data transfer flags for '%s': %s", backend_uri,
+      strerror(errno));
+  }
+}
+
 int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
     const char *error_code, struct proxy_session *proxy_sess, int flags) {
   int backend_family, bind_family, ipv6_backend, res, xerrno = 0;
@@ -44,8 +137,7 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
   pr_response_t *resp;
   unsigned int resp_nlines = 0;
   conn_t *data_conn = NULL;
-  char *active_cmd;
-  const char *resp_msg = NULL;
+  char *active_cmd, resp_msg[PROXY_FTP_MSG_EXT_ADDR_BUFSZ];
 
   if (cmd == NULL ||
       error_code == NULL ||
@@ -61,6 +153,8 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
     ipv6_backend = TRUE;
   }
 
+  xfer_load_flags(cmd->tmp_pool, proxy_sess);
+
   switch (policy_id) {
     case PR_CMD_PORT_ID:
       /* If we have an IPv6 address for the backend server, automatically switch
@@ -76,7 +170,7 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
        * to using PORT.
        */
       active_cmd = C_EPRT;
-      if (pr_table_get(proxy_sess->backend_features, C_EPRT, NULL) == NULL) {
+      if (!(proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_EPRT)) {
         pr_trace_msg(trace_channel, 19,
           "EPRT not supported by backend server (via FEAT), using PORT");
         if (proxy_sess->dataxfer_policy == PR_CMD_EPRT_ID) {
@@ -115,10 +209,12 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
       }
 
       if (pr_cmd_cmp(cmd, PR_CMD_EPRT_ID) == 0) {
+        policy_id = PR_CMD_EPRT_ID;
+
         /* If the remote host does not mention EPRT in its features, fall back
          * to using PORT.
          */
-        if (pr_table_get(proxy_sess->backend_features, C_EPRT, NULL) == NULL) {
+        if (!(proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_EPRT)) {
           pr_trace_msg(trace_channel, 19,
             "EPRT not supported by backend server (via FEAT), using PORT");
           if (proxy_sess->dataxfer_policy == PR_CMD_EPRT_ID) {
@@ -133,6 +229,15 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
       break;
   }
 
+  if (policy_id == PR_CMD_EPRT_ID &&
+      ipv6_backend == FALSE &&
+      (proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_EPRT_FAILED)) {
+    pr_trace_msg(trace_channel, 19,
+      "EPRT previously rejected by backend server, using PORT");
+    active_cmd = C_PORT;
+    policy_id = PR_CMD_PORT_ID;
+  }
+
   bind_addr = proxy_sess->src_addr;
   if (bind_addr == NULL) {
     bind_addr = session.c->local_addr;
@@ -212,8 +317,8 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
 
   if (proxy_sess->backend_data_conn != NULL) {
     /* Make sure that we only have one backend data connection. */
-    proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-    pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
     proxy_sess->backend_data_conn = NULL;
   }
 
@@ -231,20 +336,47 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
 
   proxy_sess->backend_data_conn = data_conn;
 
+  resp_msg[0] = '\0';
+
   switch (pr_cmd_get_id(active_cmd)) {
     case PR_CMD_PORT_ID:
-      resp_msg = proxy_ftp_msg_fmt_addr(cmd->tmp_pool, data_conn->local_addr,
-        data_conn->local_port, FALSE);
+      res = proxy_ftp_msg_fmt_addr2(data_conn->local_addr,
+        data_conn->local_port, FALSE, resp_msg, sizeof(resp_msg));
       break;
 
     case PR_CMD_EPRT_ID:
-      resp_msg = proxy_ftp_msg_fmt_ext_addr(cmd->tmp_pool,
-        data_conn->local_addr, data_conn->local_port, PR_CMD_EPRT_ID, FALSE);
+      res = proxy_ftp_msg_fmt_ext_addr2(data_conn->local_addr,
+        data_conn->local_port, PR_CMD_EPRT_ID, FALSE, resp_msg,
+        sizeof(resp_msg));
       break;
+
+    default:
+      res = -1;
+      errno = EINVAL;
+      break;
+  }
+
+  if (res < 0) {
+    xerrno = errno;
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error formatting %s address %s#%u: %s", active_cmd,
+      pr_netaddr_get_ipstr(data_conn->local_addr), data_conn->local_port,
+      strerror(xerrno));
+
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
+    proxy_sess->backend_data_conn = NULL;
+
+    pr_response_add_err(error_code,
+      _("Unable to build data connection: Internal error"));
+    pr_response_flush(&resp_err_list);
+
+    errno = xerrno;
+    return -1;
   }
 
   actv_cmd = pr_cmd_alloc(cmd->tmp_pool, 2, active_cmd, resp_msg);
-  actv_cmd->arg = (char *) resp_msg;
+  actv_cmd->arg = resp_msg;
 
   pr_cmd_clear_cache(actv_cmd);
 
@@ -256,8 +388,8 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
       "error sending %s to backend: %s", (char *) actv_cmd->argv[0],
       strerror(xerrno));
 
-    proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-    pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
     proxy_sess->backend_data_conn = NULL;
 
     pr_response_add_err(error_code, "%s: %s", (char *) cmd->argv[0],
@@ -276,8 +408,8 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
       "error receiving %s response from backend: %s",
       (char *) actv_cmd->argv[0], strerror(xerrno));
 
-    proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-    pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
     proxy_sess->backend_data_conn = NULL;
 
     pr_response_add_err(error_code, "%s: %s", (char *) cmd->argv[0],
@@ -293,14 +425,21 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
       "received non-2xx response from backend for %s: %s %s",
       (char *) actv_cmd->argv[0], resp->num, resp->msg);
 
-    proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-    pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
     proxy_sess->backend_data_conn = NULL;
 
-    if (policy_id == PR_CMD_EPRT_ID) {
+    if (policy_id == PR_CMD_EPRT_ID &&
+        ipv6_backend == FALSE) {
       /* If using EPRT failed, try again using PORT, and switch the
        * DataTransferPolicy (if EPRT) to be PORT, for future attempts.
+       * A permanent (5xx) failure also means that we need not try EPRT
+       * again for this backend server.
        */
+      if (resp->num[0] == '5') {
+        xfer_learn_flag(cmd->tmp_pool, proxy_sess,
+          PROXY_SESS_DATA_TRANSFER_FL_EPRT_FAILED);
+      }
 
       if (proxy_sess->dataxfer_policy == PR_CMD_EPRT_ID) {
         pr_trace_msg(trace_channel, 15,
@@ -322,6 +461,67 @@ int proxy_ftp_xfer_prepare_active(int policy_id, cmd_rec *cmd,
   return 0;
 }
 
+/* Once we know that only EPSV will be used with the backend server, i.e.
+ * because of our DataTransferPolicy or because the client sent EPSV ALL,
+ * tell the backend server so (once per session), per RFC 2428.  This lets
+ * any middleboxes between us and the backend server stop inspecting the
+ * control connection for data transfer addresses.
+ */
+static void xfer_send_epsv_all(cmd_rec *cmd, struct proxy_session *proxy_sess,
+    int flags) {
+  int res;
+  cmd_rec *epsv_cmd;
+  pr_response_t *resp;
+  unsigned int resp_nlines = 0;
+
+  if ((proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL) ||
+      (proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL_FAILED)) {
+    return;
+  }
+
+  if (proxy_sess->dataxfer_policy != PR_CMD_EPSV_ID &&
+      !(proxy_sess->frontend_sess_flags & SF_EPSV_ALL)) {
+    return;
+  }
+
+  epsv_cmd = pr_cmd_alloc(cmd->tmp_pool, 2, C_EPSV, "ALL");
+  epsv_cmd->arg = "ALL";
+
+  res = proxy_ftp_ctrl_send_cmd(cmd->tmp_pool, proxy_sess->backend_ctrl_conn,
+    epsv_cmd);
+  if (res < 0) {
+    pr_trace_msg(trace_channel, 9, "error sending EPSV ALL to backend: %s",
+      strerror(errno));
+    proxy_sess->dataxfer_flags |= PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL_FAILED;
+    return;
+  }
+
+  resp = proxy_ftp_ctrl_recv_resp(cmd->tmp_pool, proxy_sess->backend_ctrl_conn,
+    &resp_nlines, flags);
+  if (resp == NULL) {
+    pr_trace_msg(trace_channel, 9,
+      "error receiving EPSV ALL response from backend: %s", strerror(errno));
+    proxy_sess->dataxfer_flags |= PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL_FAILED;
+    return;
+  }
+
+  if (resp->num[0] != '2') {
+    pr_trace_msg(trace_channel, 9,
+      "backend server rejected EPSV ALL: %s %s", resp->num, resp->msg);
+    if (resp->num[0] == '5') {
+      xfer_learn_flag(cmd->tmp_pool, proxy_sess,
+        PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL_FAILED);
+
+    } else {
+      proxy_sess->dataxfer_flags |= PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL_FAILED;
+    }
+    return;
+  }
+
+  pr_trace_msg(trace_channel, 15, "EPSV ALL accepted by backend server");
+  proxy_sess->dataxfer_flags |= PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL;
+}
+
 const pr_netaddr_t *proxy_ftp_xfer_prepare_passive(int policy_id, cmd_rec *cmd,
     const char *error_code, struct proxy_session *proxy_sess, int flags) {
   int ipv6_backend, res, xerrno = 0;
@@ -349,6 +549,8 @@ const pr_netaddr_t *proxy_ftp_xfer_prepare_passive(int policy_id, cmd_rec *cmd,
     ipv6_backend = TRUE;
   }
 
+  xfer_load_flags(cmd->tmp_pool, proxy_sess);
+
   switch (policy_id) {
     case PR_CMD_PASV_ID:
       /* If we have an IPv6 address for the backend server, automatically switch
@@ -364,14 +566,14 @@ const pr_netaddr_t *proxy_ftp_xfer_prepare_passive(int policy_id, cmd_rec *cmd,
 
       passive_cmd = C_EPSV;
 
-      if (pr_table_get(proxy_sess->backend_features, C_EPSV, NULL) == NULL) {
+      if (!(proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_EPSV)) {
         epsv_supported = FALSE;
 
         /* If the remote host does not mention EPSV in its features, fall back
          * to using PASV.  Note, however, that some servers (e.g. pure-ftpd)
          * only mention EPRT in their FEAT to cover both EPRT and EPSV.
          */
-        if (pr_table_get(proxy_sess->backend_features, C_EPRT, NULL) != NULL) {
+        if (proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_EPRT) {
           epsv_supported = TRUE;
         }
       }
@@ -415,15 +617,19 @@ const pr_netaddr_t *proxy_ftp_xfer_prepare_passive(int policy_id, cmd_rec *cmd,
       }
 
       if (pr_cmd_cmp(cmd, PR_CMD_EPSV_ID) == 0) {
-        int epsv_supported = FALSE;
+        int epsv_supported = TRUE;
+
+        policy_id = PR_CMD_EPSV_ID;
+
+        if (!(proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_EPSV)) {
+          epsv_supported = FALSE;
 
-        if (pr_table_get(proxy_sess->backend_features, C_EPSV, NULL) == NULL) {
           /* If the remote host does not mention EPSV in its features, fall back
            * to using PASV.  Note, however, that some servers (e.g. pure-ftpd)
            * only mention EPRT in their FEAT to cover both EPRT and EPSV.
            */
 
-          if (pr_table_get(proxy_sess->backend_features, C_EPRT, NULL) != NULL) {
+          if (proxy_sess->backend_feat_flags & PROXY_SESS_FEAT_FL_EPRT) {
             epsv_supported = TRUE;
           }
         }
@@ -443,6 +649,19 @@ const pr_netaddr_t *proxy_ftp_xfer_prepare_passive(int policy_id, cmd_rec *cmd,
       break;
   }
 
+  if (policy_id == PR_CMD_EPSV_ID &&
+      ipv6_backend == FALSE &&
+      (proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_EPSV_FAILED)) {
+    pr_trace_msg(trace_channel, 19,
+      "EPSV previously rejected by backend server, using PASV");
+    passive_cmd = C_PASV;
+    policy_id = PR_CMD_PASV_ID;
+  }
+
+  if (pr_cmd_get_id(passive_cmd) == PR_CMD_EPSV_ID) {
+    xfer_send_epsv_all(cmd, proxy_sess, flags);
+  }
+
   pasv_cmd = pr_cmd_alloc(cmd->tmp_pool, 1, passive_cmd);
 
   switch (pr_cmd_get_id(pasv_cmd->argv[0])) {
@@ -495,10 +714,18 @@ const pr_netaddr_t *proxy_ftp_xfer_prepare_passive(int policy_id, cmd_rec *cmd,
       "received response code %s, but expected %s for %s command", resp->num,
       passive_respcode, (char *) pasv_cmd->argv[0]);
 
-    if (policy_id == PR_CMD_EPSV_ID) {
+    if (policy_id == PR_CMD_EPSV_ID &&
+        ipv6_backend == FALSE &&
+        !(proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL)) {
       /* If using EPSV failed, try again using PASV, and switch the
        * DataTransferPolicy (if EPSV) to be PASV, for future attempts.
+       * A permanent (5xx) failure also means that we need not try EPSV
+       * again for this backend server.
        */
+      if (resp->num[0] == '5') {
+        xfer_learn_flag(cmd->tmp_pool, proxy_sess,
+          PROXY_SESS_DATA_TRANSFER_FL_EPSV_FAILED);
+      }
 
       if (proxy_sess->dataxfer_policy == PR_CMD_EPSV_ID) {
         pr_trace_msg(trace_channel, 15,
@@ -591,3 +818,112 @@ const pr_netaddr_t *proxy_ftp_xfer_prepare_passive(int policy_id, cmd_rec *cmd,
     pr_netaddr_get_ipstr(remote_addr), ntohs(pr_netaddr_get_port(remote_addr)));
   return remote_addr;
 }
+
+int proxy_ftp_xfer_init(pool *p, const char *tables_path, int flags) {
+  int res;
+
+  if (p == NULL ||
+      tables_path == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memset(&xfer_ds, 0, sizeof(xfer_ds));
+
+  switch (proxy_datastore) {
+    case PROXY_DATASTORE_REDIS:
+      res = proxy_ftp_redis_as_datastore(&xfer_ds, proxy_datastore_data,
+        proxy_datastore_datasz);
+      break;
+
+    case PROXY_DATASTORE_SQLITE:
+      res = proxy_ftp_db_as_datastore(&xfer_ds, proxy_datastore_data,
+        proxy_datastore_datasz);
+      break;
+
+    default:
+      res = -1;
+      errno = EINVAL;
+      break;
+  }
+
+  if (res < 0) {
+    return -1;
+  }
+
+  res = (xfer_ds.init)(p, tables_path, flags);
+  if (res < 0) {
+    return -1;
+  }
+
+  xfer_tables_path = pstrdup(proxy_pool, tables_path);
+  return 0;
+}
+
+int proxy_ftp_xfer_free(pool *p) {
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (xfer_ds.dsh != NULL) {
+    int res;
+
+    res = (xfer_ds.close)(p, xfer_ds.dsh);
+    if (res < 0) {
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error closing datastore: %s", strerror(errno));
+    }
+
+    xfer_ds.dsh = NULL;
+  }
+
+  xfer_tables_path = NULL;
+  return 0;
+}
+
+int proxy_ftp_xfer_sess_init(pool *p, struct proxy_session *proxy_sess,
+    int flags) {
+  int xerrno;
+
+  if (p == NULL ||
+      proxy_sess == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (proxy_sess->use_ftp == FALSE ||
+      xfer_ds.open == NULL ||
+      xfer_tables_path == NULL) {
+    return 0;
+  }
+
+  PRIVS_ROOT
+  xfer_ds.dsh = (xfer_ds.open)(proxy_pool, xfer_tables_path, 0UL);
+  xerrno = errno;
+  PRIVS_RELINQUISH
+
+  if (xfer_ds.dsh == NULL) {
+    /* Without the datastore, we merely lose what other sessions learned
+     * about the backend servers; that is no reason to fail the session.
+     */
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error opening FTP datastore: %s", strerror(xerrno));
+  }
+
+  return 0;
+}
+
+int proxy_ftp_xfer_sess_free(pool *p) {
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (xfer_ds.dsh != NULL) {
+    (void) (xfer_ds.close)(p, xfer_ds.dsh);
+    xfer_ds.dsh = NULL;
+  }
+
+  return 0;
+}
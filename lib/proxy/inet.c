@@ -27,6 +27,24 @@
 #include "proxy/netio.h"
 #include "proxy/inet.h"
 
+/* Binds the streams of a newly opened connection to the NetIO currently in
+ * use for their stream type.
+ */
+static void inet_bind_conn(conn_t *conn, int strm_type) {
+  pr_netio_t *netio = NULL;
+
+  (void) proxy_netio_using(strm_type, &netio);
+
+  if (conn->instrm != NULL) {
+    (void) proxy_netio_bind(conn->instrm, netio);
+  }
+
+  if (conn->outstrm != NULL &&
+      conn->outstrm != conn->instrm) {
+    (void) proxy_netio_bind(conn->outstrm, netio);
+  }
+}
+
 conn_t *proxy_inet_accept(pool *p, conn_t *data_conn, conn_t *ctrl_conn,
     int rfd, int wfd, int resolve) {
   int xerrno;
@@ -39,6 +57,10 @@ conn_t *proxy_inet_accept(pool *p, conn_t *data_conn, conn_t *ctrl_conn,
   xerrno = errno;
   proxy_netio_set(PR_NETIO_STRM_DATA, curr_netio);
 
+  if (conn != NULL) {
+    inet_bind_conn(conn, PR_NETIO_STRM_DATA);
+  }
+
   errno = xerrno;
   return conn;
 }
@@ -177,6 +199,7 @@ conn_t *proxy_inet_openrw(pool *p, conn_t *conn, const pr_netaddr_t *addr,
      * unregister that cleanup here.
      */
     unregister_cleanup(new_conn->pool, new_conn, NULL);
+    inet_bind_conn(new_conn, strm_type);
   }
 
   errno = xerrno;
@@ -28,6 +28,9 @@
 
 static const char *trace_channel = "proxy.netio";
 
+/* Stream note for the NetIO bound to a stream. */
+#define PROXY_NETIO_NOTE	"mod_proxy.netio"
+
 static pr_netio_t *ctrl_netio = NULL;
 static pr_netio_t *data_netio = NULL;
 
@@ -199,6 +202,341 @@ int proxy_netio_set(int strm_type, pr_netio_t *netio) {
   return 0;
 }
 
+static pr_netio_t *netio_get_type_netio(int strm_type) {
+  pr_netio_t *netio = NULL;
+
+  switch (strm_type) {
+    case PR_NETIO_STRM_CTRL:
+      netio = ctrl_netio;
+      break;
+
+    case PR_NETIO_STRM_DATA:
+      netio = data_netio;
+      break;
+
+    default:
+      break;
+  }
+
+  return netio;
+}
+
+/* The NetIO bound to a stream is needed for every poll, read, and write on
+ * that stream.  Rather than look it up in the stream notes each time, we keep
+ * the bindings of the (few) open bound streams here; a stream's slot is
+ * cleared when its pool is destroyed.  Should all slots be in use, the stream
+ * notes are still consulted.
+ */
+#define PROXY_NETIO_BOUND_CACHE_SIZE	8
+
+static struct {
+  pr_netio_stream_t *nstrm;
+  pr_netio_t *netio;
+} bound_cache[PROXY_NETIO_BOUND_CACHE_SIZE];
+
+static void netio_bound_cache_cleanup_cb(void *data) {
+  register unsigned int i;
+
+  for (i = 0; i < PROXY_NETIO_BOUND_CACHE_SIZE; i++) {
+    if (bound_cache[i].nstrm == data) {
+      bound_cache[i].nstrm = NULL;
+      bound_cache[i].netio = NULL;
+      break;
+    }
+  }
+}
+
+static void netio_bound_cache_set(pr_netio_stream_t *nstrm,
+    pr_netio_t *netio) {
+  register unsigned int i;
+  int slot = -1;
+
+  for (i = 0; i < PROXY_NETIO_BOUND_CACHE_SIZE; i++) {
+    if (bound_cache[i].nstrm == nstrm) {
+      bound_cache[i].netio = netio;
+      return;
+    }
+
+    if (slot < 0 &&
+        bound_cache[i].nstrm == NULL) {
+      slot = i;
+    }
+  }
+
+  if (slot < 0) {
+    return;
+  }
+
+  bound_cache[slot].nstrm = nstrm;
+  bound_cache[slot].netio = netio;
+  register_cleanup(nstrm->strm_pool, nstrm, netio_bound_cache_cleanup_cb,
+    netio_bound_cache_cleanup_cb);
+}
+
+int proxy_netio_bind(pr_netio_stream_t *nstrm, pr_netio_t *netio) {
+  if (nstrm == NULL ||
+      nstrm->notes == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (netio == NULL) {
+    /* Bind the stream to the core NetIO callbacks, which are the defaults
+     * of an allocated NetIO.
+     */
+    netio = pr_alloc_netio2(nstrm->strm_pool, &proxy_module, "proxy");
+  }
+
+  if (pr_table_set(nstrm->notes, PROXY_NETIO_NOTE, netio,
+      sizeof(pr_netio_t *)) < 0) {
+    if (errno != ENOENT) {
+      return -1;
+    }
+
+    if (pr_table_add(nstrm->notes, pstrdup(nstrm->strm_pool, PROXY_NETIO_NOTE),
+        netio, sizeof(pr_netio_t *)) < 0) {
+      return -1;
+    }
+  }
+
+  netio_bound_cache_set(nstrm, netio);
+
+  pr_trace_msg(trace_channel, 19, "bound %s %s NetIO to %s stream (fd %d)",
+    netio->owner_name != NULL ? netio->owner_name : "core",
+    netio_strm_typestr(nstrm->strm_type),
+    nstrm->strm_mode == PR_NETIO_IO_RD ? "read" : "write", nstrm->strm_fd);
+  return 0;
+}
+
+static pr_netio_t *netio_get_bound(pr_netio_stream_t *nstrm) {
+  register unsigned int i;
+
+  for (i = 0; i < PROXY_NETIO_BOUND_CACHE_SIZE; i++) {
+    if (bound_cache[i].nstrm == nstrm) {
+      return bound_cache[i].netio;
+    }
+  }
+
+  if (nstrm->notes == NULL) {
+    return NULL;
+  }
+
+  return (pr_netio_t *) pr_table_get(nstrm->notes, PROXY_NETIO_NOTE, NULL);
+}
+
+/* The following dispatch directly to the NetIO bound to a stream, following
+ * the semantics of the corresponding core pr_netio_poll(), pr_netio_read(),
+ * and pr_netio_write() functions, without (un)registering any NetIOs.
+ */
+
+/* As the core does: if the client has gone away (i.e. a broken pipe on the
+ * control connection) during a data transfer, abort that transfer.
+ */
+static void netio_bound_check_epipe(pr_netio_stream_t *nstrm, int xerrno) {
+  if (xerrno == EPIPE &&
+      nstrm->strm_type == PR_NETIO_STRM_CTRL &&
+      (session.sf_flags & SF_XFER)) {
+    pr_trace_msg(trace_channel, 5,
+      "received EPIPE on control connection, setting 'aborted' "
+      "session flag");
+    session.sf_flags |= SF_ABORT;
+  }
+}
+
+static int netio_bound_poll(pr_netio_t *netio, pr_netio_stream_t *nstrm) {
+  int res;
+
+  if (nstrm->strm_fd == -1) {
+    errno = EBADF;
+    return -1;
+  }
+
+  /* Has this stream been aborted? */
+  if (nstrm->strm_flags & PR_NETIO_SESS_ABORT) {
+    nstrm->strm_flags &= ~PR_NETIO_SESS_ABORT;
+    return 1;
+  }
+
+  while (TRUE) {
+    run_schedule();
+    pr_signals_handle();
+
+    res = (netio->poll)(nstrm);
+    switch (res) {
+      case -1:
+        if (errno == EINTR) {
+          if (nstrm->strm_flags & PR_NETIO_SESS_ABORT) {
+            nstrm->strm_flags &= ~PR_NETIO_SESS_ABORT;
+            return 1;
+          }
+
+          continue;
+        }
+
+        nstrm->strm_errno = errno;
+        netio_bound_check_epipe(nstrm, nstrm->strm_errno);
+
+        errno = nstrm->strm_errno;
+        return -1;
+
+      case 0:
+        if (nstrm->strm_flags & PR_NETIO_SESS_ABORT) {
+          nstrm->strm_flags &= ~PR_NETIO_SESS_ABORT;
+          return 1;
+        }
+
+        /* An interruptible stream with a zero poll interval is a true,
+         * non-blocking poll.
+         */
+        if ((nstrm->strm_flags & PR_NETIO_SESS_INTR) &&
+            nstrm->strm_interval == 0) {
+          errno = EOF;
+          return -1;
+        }
+
+        continue;
+
+      default:
+        return 0;
+    }
+  }
+
+  /* Not reached. */
+  return -1;
+}
+
+static int netio_bound_read(pr_netio_t *netio, pr_netio_stream_t *nstrm,
+    char *buf, size_t bufsz, int bufmin) {
+  int bread = 0, total = 0;
+
+  if (buf == NULL ||
+      bufsz == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (nstrm->strm_fd == -1) {
+    errno = (nstrm->strm_errno ? nstrm->strm_errno : EBADF);
+    return -1;
+  }
+
+  if (bufmin < 1) {
+    bufmin = 1;
+  }
+
+  if ((size_t) bufmin > bufsz) {
+    bufmin = bufsz;
+  }
+
+  while (bufmin > 0) {
+    polling:
+    switch (netio_bound_poll(netio, nstrm)) {
+      case 1:
+        return -2;
+
+      case -1:
+        return -1;
+
+      default:
+        do {
+          pr_signals_handle();
+
+          /* An aborted transfer reads as EOF. */
+          if (nstrm->strm_type == PR_NETIO_STRM_DATA &&
+              XFER_ABORTED) {
+            bread = 0;
+            break;
+          }
+
+          bread = (netio->read)(nstrm, buf, bufsz);
+          if (bread == -1 &&
+              (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            goto polling;
+          }
+
+        } while (bread == -1 && errno == EINTR);
+        break;
+    }
+
+    if (bread == -1) {
+      nstrm->strm_errno = errno;
+      return -1;
+    }
+
+    if (bread == 0) {
+      /* EOF */
+      nstrm->strm_errno = 0;
+      break;
+    }
+
+    session.total_raw_in += bread;
+
+    buf += bread;
+    total += bread;
+    bufmin -= bread;
+    bufsz -= bread;
+  }
+
+  return total;
+}
+
+static int netio_bound_write(pr_netio_t *netio, pr_netio_stream_t *nstrm,
+    char *buf, size_t bufsz) {
+  int bwritten = 0, total = 0;
+
+  if (buf == NULL ||
+      bufsz == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (nstrm->strm_fd == -1) {
+    errno = (nstrm->strm_errno ? nstrm->strm_errno : EBADF);
+    return -1;
+  }
+
+  while (bufsz > 0) {
+    switch (netio_bound_poll(netio, nstrm)) {
+      case 1:
+        return -2;
+
+      case -1:
+        return -1;
+
+      default:
+        /* Writing to an aborted transfer is as for an aborted stream. */
+        if (nstrm->strm_type == PR_NETIO_STRM_DATA &&
+            XFER_ABORTED) {
+          return -2;
+        }
+
+        do {
+          pr_signals_handle();
+
+          bwritten = (netio->write)(nstrm, buf, bufsz);
+
+        } while (bwritten == -1 && errno == EINTR);
+        break;
+    }
+
+    if (bwritten == -1) {
+      nstrm->strm_errno = errno;
+      netio_bound_check_epipe(nstrm, nstrm->strm_errno);
+
+      errno = nstrm->strm_errno;
+      return -1;
+    }
+
+    session.total_raw_out += bwritten;
+
+    buf += bwritten;
+    total += bwritten;
+    bufsz -= bwritten;
+  }
+
+  return total;
+}
+
 int proxy_netio_close(pr_netio_stream_t *nstrm) {
   int strm_type = -1, res, xerrno;
   pr_netio_t *curr_netio = NULL;
@@ -229,19 +567,31 @@ pr_netio_stream_t *proxy_netio_open(pool *p, int strm_type, int fd, int mode) {
   xerrno = errno;
   proxy_netio_set(strm_type, curr_netio);
 
+  if (nstrm != NULL) {
+    if (proxy_netio_bind(nstrm, netio_get_type_netio(strm_type)) < 0) {
+      pr_trace_msg(trace_channel, 3, "error binding NetIO to %s stream: %s",
+        netio_strm_typestr(strm_type), strerror(errno));
+    }
+  }
+
   errno = xerrno;
   return nstrm;
 }
 
 int proxy_netio_poll(pr_netio_stream_t *nstrm) {
   int res, xerrno;
-  pr_netio_t *curr_netio;
+  pr_netio_t *bound_netio, *curr_netio;
 
   if (nstrm == NULL) {
     errno = EINVAL;
     return -1;
   }
 
+  bound_netio = netio_get_bound(nstrm);
+  if (bound_netio != NULL) {
+    return netio_bound_poll(bound_netio, nstrm);
+  }
+
   curr_netio = proxy_netio_unset(nstrm->strm_type, "netio_poll");
   res = pr_netio_poll(nstrm);
   xerrno = errno;
@@ -272,13 +622,25 @@ int proxy_netio_postopen(pr_netio_stream_t *nstrm) {
 int proxy_netio_printf(pr_netio_stream_t *nstrm, const char *fmt, ...) {
   int res, xerrno;
   va_list msg;
-  pr_netio_t *curr_netio = NULL;
+  pr_netio_t *bound_netio, *curr_netio = NULL;
 
   if (nstrm == NULL) {
     errno = EINVAL;
     return -1;
   }
 
+  bound_netio = netio_get_bound(nstrm);
+  if (bound_netio != NULL) {
+    char buf[PR_TUNABLE_BUFFER_SIZE];
+
+    va_start(msg, fmt);
+    pr_vsnprintf(buf, sizeof(buf), fmt, msg);
+    va_end(msg);
+    buf[sizeof(buf)-1] = '\0';
+
+    return netio_bound_write(bound_netio, nstrm, buf, strlen(buf));
+  }
+
   curr_netio = proxy_netio_unset(nstrm->strm_type, "netio_printf");
   va_start(msg, fmt);
   res = pr_netio_vprintf(nstrm, fmt, msg);
@@ -293,13 +655,18 @@ int proxy_netio_printf(pr_netio_stream_t *nstrm, const char *fmt, ...) {
 int proxy_netio_read(pr_netio_stream_t *nstrm, char *buf, size_t bufsz,
     int bufmin) {
   int res, xerrno;
-  pr_netio_t *curr_netio = NULL;
+  pr_netio_t *bound_netio, *curr_netio = NULL;
 
   if (nstrm == NULL) {
     errno = EINVAL;
     return -1;
   }
 
+  bound_netio = netio_get_bound(nstrm);
+  if (bound_netio != NULL) {
+    return netio_bound_read(bound_netio, nstrm, buf, bufsz, bufmin);
+  }
+
   curr_netio = proxy_netio_unset(nstrm->strm_type, "netio_read");
   res = pr_netio_read(nstrm, buf, bufsz, bufmin);
   xerrno = errno;
@@ -316,6 +683,12 @@ void proxy_netio_reset_poll_interval(pr_netio_stream_t *nstrm) {
     return;
   }
 
+  if (netio_get_bound(nstrm) != NULL) {
+    /* This only changes the stream's flags; no NetIO is involved. */
+    pr_netio_reset_poll_interval(nstrm);
+    return;
+  }
+
   curr_netio = proxy_netio_unset(nstrm->strm_type, "netio_reset_poll_interval");
   pr_netio_reset_poll_interval(nstrm);
   proxy_netio_set(nstrm->strm_type, curr_netio);
@@ -329,6 +702,11 @@ void proxy_netio_set_poll_interval(pr_netio_stream_t *nstrm,
     return;
   }
 
+  if (netio_get_bound(nstrm) != NULL) {
+    pr_netio_set_poll_interval(nstrm, secs);
+    return;
+  }
+
   curr_netio = proxy_netio_unset(nstrm->strm_type, "netio_set_poll_interval");
   pr_netio_set_poll_interval(nstrm, secs);
   proxy_netio_set(nstrm->strm_type, curr_netio);
@@ -336,13 +714,18 @@ void proxy_netio_set_poll_interval(pr_netio_stream_t *nstrm,
 
 int proxy_netio_shutdown(pr_netio_stream_t *nstrm, int how) {
   int res, xerrno;
-  pr_netio_t *curr_netio = NULL;
+  pr_netio_t *bound_netio, *curr_netio = NULL;
 
   if (nstrm == NULL) {
     errno = EINVAL;
     return -1;
   }
 
+  bound_netio = netio_get_bound(nstrm);
+  if (bound_netio != NULL) {
+    return (bound_netio->shutdown)(nstrm, how);
+  }
+
   curr_netio = proxy_netio_unset(nstrm->strm_type, "netio_shutdown");
   res = pr_netio_shutdown(nstrm, how);
   xerrno = errno;
@@ -354,13 +737,18 @@ int proxy_netio_shutdown(pr_netio_stream_t *nstrm, int how) {
 
 int proxy_netio_write(pr_netio_stream_t *nstrm, char *buf, size_t bufsz) {
   int res, xerrno;
-  pr_netio_t *curr_netio = NULL;
+  pr_netio_t *bound_netio, *curr_netio = NULL;
 
   if (nstrm == NULL) {
     errno = EINVAL;
     return -1;
   }
 
+  bound_netio = netio_get_bound(nstrm);
+  if (bound_netio != NULL) {
+    return netio_bound_write(bound_netio, nstrm, buf, bufsz);
+  }
+
   curr_netio = proxy_netio_unset(nstrm->strm_type, "netio_write");
   res = pr_netio_write(nstrm, buf, bufsz);
   xerrno = errno;
@@ -25,37 +25,202 @@
 #include "mod_proxy.h"
 #include "proxy/random.h"
 
+#if defined(HAVE_SYS_RANDOM_H)
+# include <sys/random.h>
+#endif /* HAVE_SYS_RANDOM_H */
+
+/* The generator is xoshiro256**, by David Blackman and Sebastiano Vigna; see
+ * https://prng.di.unimi.it/.  It is fast and statistically sound, but NOT
+ * cryptographically secure; it is only used for choosing among backends.
+ */
+static uint64_t random_state[4];
+
 static const char *trace_channel = "proxy.random";
 
-/* If random(3) is supported on this platform, seed it.  rand(3) is already
- * seeded by the core proftpd code.
+static uint64_t random_rotl(uint64_t x, int k) {
+  return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t random_next64(void) {
+  uint64_t res, t;
+
+  res = random_rotl(random_state[1] * 5, 7) * 9;
+  t = random_state[1] << 17;
+
+  random_state[2] ^= random_state[0];
+  random_state[3] ^= random_state[1];
+  random_state[1] ^= random_state[2];
+  random_state[0] ^= random_state[3];
+
+  random_state[2] ^= t;
+  random_state[3] = random_rotl(random_state[3], 45);
+
+  return res;
+}
+
+/* Returns a uniformly distributed number in [0, range), for a non-zero
+ * range, without the bias of a simple modulus.  For ranges which fit into
+ * 32 bits (i.e. all practical ones), this uses Lemire's multiply-and-shift
+ * method, which only needs a division in the rare case of a possibly
+ * biased draw.
+ */
+static uint64_t random_bounded(uint64_t range) {
+  uint64_t r, mask;
+
+  if (range <= 0xffffffffUL) {
+    uint32_t x, threshold;
+    uint64_t m;
+
+    x = (uint32_t) (random_next64() >> 32);
+    m = (uint64_t) x * range;
+
+    if ((uint32_t) m < (uint32_t) range) {
+      threshold = (uint32_t) (-((uint32_t) range)) % (uint32_t) range;
+
+      while ((uint32_t) m < threshold) {
+        x = (uint32_t) (random_next64() >> 32);
+        m = (uint64_t) x * range;
+      }
+    }
+
+    return m >> 32;
+  }
+
+  /* Larger ranges: rejection sampling, using the smallest covering mask. */
+  mask = range - 1;
+  mask |= mask >> 1;
+  mask |= mask >> 2;
+  mask |= mask >> 4;
+  mask |= mask >> 8;
+  mask |= mask >> 16;
+  mask |= mask >> 32;
+
+  do {
+    r = random_next64() & mask;
+  } while (r >= range);
+
+  return r;
+}
+
+/* Expands a single 64-bit seed into the generator state, using SplitMix64
+ * (as recommended by the xoshiro authors).  This also guarantees a non-zero
+ * state.
+ */
+void proxy_random_seed(uint64_t seed) {
+  register unsigned int i;
+
+  for (i = 0; i < 4; i++) {
+    uint64_t z;
+
+    seed += 0x9e3779b97f4a7c15ULL;
+    z = seed;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    random_state[i] = z ^ (z >> 31);
+  }
+}
+
+static int random_get_entropy(void *buf, size_t buflen) {
+  int fd;
+  ssize_t res;
+
+#if defined(HAVE_GETRANDOM)
+  res = getrandom(buf, buflen, GRND_NONBLOCK);
+  if (res == (ssize_t) buflen) {
+    return 0;
+  }
+
+  pr_trace_msg(trace_channel, 9, "getrandom(2) failed: %s", strerror(errno));
+#endif /* HAVE_GETRANDOM */
+
+  fd = open("/dev/urandom", O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  res = read(fd, buf, buflen);
+  (void) close(fd);
+
+  if (res != (ssize_t) buflen) {
+    errno = EIO;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Seed the generator, preferably from the kernel's entropy.  This is called
+ * in each session process, so that sessions do not share sequences.
  */
 int proxy_random_init(void) {
-#ifdef HAVE_RANDOM
   struct timeval tv;
+  uint64_t seed;
+
+  if (random_get_entropy(random_state, sizeof(random_state)) == 0 &&
+      (random_state[0] | random_state[1] | random_state[2] |
+       random_state[3]) != 0) {
+    return 0;
+  }
+
+  pr_trace_msg(trace_channel, 3,
+    "unable to obtain entropy for seeding (%s), using time and PID",
+    strerror(errno));
 
   gettimeofday(&tv, NULL);
-  srandom(getpid() ^ tv.tv_usec);
-#endif /* HAVE_RANDOM */
+  seed = ((uint64_t) tv.tv_sec << 32) ^ (uint64_t) tv.tv_usec ^
+    ((uint64_t) getpid() << 16);
 
+  proxy_random_seed(seed);
   return 0;
 }
 
 long proxy_random_next(long min, long max) {
-  long r, scaled;
-
-#if defined(HAVE_RANDOM)
-  r = random();
-  pr_trace_msg(trace_channel, 22, "obtained r = %ld from random(3)", r);
-#else
-  r = (long) rand();
-  pr_trace_msg(trace_channel, 22, "obtained r = %ld from rand(3)", r);
-#endif /* HAVE_RANDOM */
-
-  scaled = r % (max - min + 1) + min;
-  pr_trace_msg(trace_channel, 15,
-    "yielding scaled r = %ld (r = %ld, max = %ld, min = %ld)", scaled,
-    r, max, min);
-
-  return scaled;
+  uint64_t range;
+
+  if (max < min) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  range = (uint64_t) max - (uint64_t) min + 1;
+  if (range == 0) {
+    /* The full span of a 64-bit long. */
+    return (long) random_next64();
+  }
+
+  return (long) ((uint64_t) min + random_bounded(range));
+}
+
+int proxy_random_shuffle(array_header *list) {
+  register unsigned int i;
+  char *elts;
+  void *tmp;
+  size_t eltsz;
+
+  if (list == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (list->nelts < 2) {
+    return 0;
+  }
+
+  elts = list->elts;
+  eltsz = list->elt_size;
+  tmp = palloc(list->pool, eltsz);
+
+  /* Fisher-Yates, from the end. */
+  for (i = list->nelts - 1; i > 0; i--) {
+    unsigned int j;
+
+    j = (unsigned int) random_bounded((uint64_t) i + 1);
+    if (j != i) {
+      memcpy(tmp, elts + (i * eltsz), eltsz);
+      memcpy(elts + (i * eltsz), elts + (j * eltsz), eltsz);
+      memcpy(elts + (j * eltsz), tmp, eltsz);
+    }
+  }
+
+  return 0;
 }
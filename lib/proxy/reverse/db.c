@@ -499,15 +499,27 @@ static int reverse_db_add_shuffle(pool *p, struct proxy_dbh *dbh,
 static int reverse_db_shuffle_init(pool *p, struct proxy_dbh *dbh,
     unsigned int vhost_id, array_header *backends) {
   register unsigned int i;
+  array_header *ids;
 
+  /* Generate the entire permutation of backends up front; selection then
+   * simply consumes it in order.
+   */
+  ids = make_array(p, backends->nelts, sizeof(int));
   for (i = 0; i < backends->nelts; i++) {
-    int res;
+    *((int *) push_array(ids)) = i;
+  }
+
+  (void) proxy_random_shuffle(ids);
+
+  for (i = 0; i < ids->nelts; i++) {
+    int backend_id, res;
 
-    res = reverse_db_add_shuffle(p, dbh, vhost_id, i);
+    backend_id = ((int *) ids->elts)[i];
+    res = reverse_db_add_shuffle(p, dbh, vhost_id, backend_id);
     if (res < 0) {
       int xerrno = errno;
       pr_trace_msg(trace_channel, 6,
-        "error adding shuffle database entry for ID %d: %s", i,
+        "error adding shuffle database entry for ID %d: %s", backend_id,
         strerror(xerrno));
       errno = xerrno;
       return -1;
@@ -517,14 +529,16 @@ static int reverse_db_shuffle_init(pool *p, struct proxy_dbh *dbh,
   return 0;
 }
 
-static int reverse_db_shuffle_next(pool *p, struct proxy_dbh *dbh,
+/* Returns the next backend ID of the current permutation, or -1 with
+ * errno set to ENOENT if the permutation has been consumed.
+ */
+static int reverse_db_shuffle_first(pool *p, struct proxy_dbh *dbh,
     unsigned int vhost_id) {
-  int backend_id = -1, res;
+  int res;
   const char *stmt, *errstr = NULL;
   array_header *results;
-  unsigned int nrows = 0;
 
-  stmt = "SELECT COUNT(*) FROM proxy_vhost_reverse_shuffle WHERE vhost_id = ?;";
+  stmt = "SELECT avail_backend_id FROM proxy_vhost_reverse_shuffle WHERE vhost_id = ? ORDER BY rowid LIMIT 1;";
   res = proxy_db_prepare_stmt(p, dbh, stmt);
   if (res < 0) {
     return -1;
@@ -544,25 +558,29 @@ static int reverse_db_shuffle_next(pool *p, struct proxy_dbh *dbh,
     return -1;
   }
 
-  if (results->nelts != 1) {
-    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-      "expected 1 result from statement '%s', got %d", stmt,
-      results->nelts);
-    errno = EINVAL;
+  if (results->nelts == 0) {
+    errno = ENOENT;
     return -1;
   }
 
-  nrows = atoi(((char **) results->elts)[0]);
-  if (nrows == 0) {
+  return atoi(((char **) results->elts)[0]);
+}
+
+static int reverse_db_shuffle_next(pool *p, struct proxy_dbh *dbh,
+    unsigned int vhost_id) {
+  int backend_id, res;
+
+  backend_id = reverse_db_shuffle_first(p, dbh, vhost_id);
+  if (backend_id < 0 &&
+      errno == ENOENT) {
     res = reverse_db_shuffle_init(p, dbh, vhost_id, db_backends);
     if (res < 0) {
       return -1;
     }
 
-    nrows = db_backends->nelts;
+    backend_id = reverse_db_shuffle_first(p, dbh, vhost_id);
   }
 
-  backend_id = (int) proxy_random_next(0, nrows-1);
   return backend_id;
 }
 
@@ -236,26 +236,31 @@ static int redis_set_sorted_set_backends(pool *p, pr_redis_t *redis,
 
 /* ProxyReverseConnectPolicy: Shuffle */
 
-/* The implementation of shuffling here requires two Redis lists, the A and B
- * lists.  URIs are consumed (via random selection) from the A list and added
- * to the B list, until the A list is empty.  At which point, the B list is
- * renamed to the A list, and we start again.
+/* The implementation of shuffling here uses a Redis list holding a random
+ * permutation of the backend URIs.  URIs are consumed from the head of the
+ * list until it is empty, at which point a new permutation is generated.
  */
 
 static int reverse_redis_shuffle_init(pool *p, pr_redis_t *redis,
     unsigned int vhost_id, array_header *backends) {
-  return redis_set_list_backends(p, redis, "Shuffle", vhost_id, "A", backends);
+  array_header *shuffled;
+
+  shuffled = copy_array(p, backends);
+  (void) proxy_random_shuffle(shuffled);
+
+  return redis_set_list_backends(p, redis, "Shuffle", vhost_id, "A", shuffled);
 }
 
 static long reverse_redis_shuffle_next(pool *p, pr_redis_t *redis,
     unsigned int vhost_id) {
+  register unsigned int i;
   int res, xerrno;
   pool *tmp_pool;
-  char *akey, *bkey;
+  char *akey;
   const char *val;
-  size_t valsz;
+  array_header *backend_uris;
   uint64_t count = 0;
-  long idx;
+  long idx = -1;
 
   tmp_pool = make_sub_pool(p);
   akey = make_key(tmp_pool, "Shuffle", vhost_id, "A");
@@ -276,7 +281,8 @@ static long reverse_redis_shuffle_next(pool *p, pr_redis_t *redis,
   }
 
   if (count == 0) {
-    res = reverse_redis_shuffle_init(p, redis, vhost_id, redis_backends);
+    res = reverse_redis_shuffle_init(tmp_pool, redis, vhost_id,
+      redis_backends);
     xerrno = errno;
 
     if (res < 0) {
@@ -284,63 +290,59 @@ static long reverse_redis_shuffle_next(pool *p, pr_redis_t *redis,
       errno = xerrno;
       return -1;
     }
-
-    count = redis_backends->nelts;
   }
 
-  idx = proxy_random_next(0, count-1);
-
-/* XXX Now we want to remove that backend URI from the A list, and add it to
- * the B list.
- */
-
-  val = backend_uri_by_idx((int) idx);
-  xerrno = errno;
-
-  if (val == NULL) {
-    destroy_pool(tmp_pool);
-    errno = xerrno;
-    return -1;
-  }
-
-  valsz = strlen(val);
-  res = pr_redis_list_delete(redis, &proxy_module, akey, (void *) val, valsz);
-  xerrno = errno;
+  backend_uris = redis_get_list_backend_uris(tmp_pool, redis, "Shuffle",
+    vhost_id, "A");
+  if (backend_uris == NULL) {
+    xerrno = errno;
 
-  if (res < 0) {
     destroy_pool(tmp_pool);
     errno = xerrno;
     return -1;
   }
 
-  bkey = make_key(tmp_pool, "Shuffle", vhost_id, "B");
-
-  res = pr_redis_list_append(redis, &proxy_module, bkey, (void *) val, valsz);
-  xerrno = errno;
-
-  if (res < 0) {
+  if (backend_uris->nelts == 0) {
     destroy_pool(tmp_pool);
-    errno = xerrno;
+    errno = ENOENT;
     return -1;
   }
 
-  /* If count is one, it means we just removed the last backend from the A
-   * list.  Thus rename the B list to be the A list.
+  /* Consume URIs from the head of the permutation until we find one of the
+   * configured backends; any others are left over from a previous
+   * configuration.
    */
-  if (count == 1) {
-    res = pr_redis_rename(redis, &proxy_module, bkey, akey);
-    xerrno = errno;
+  for (i = 0; i < backend_uris->nelts && idx < 0; i++) {
+    register unsigned int j;
+
+    val = ((char **) backend_uris->elts)[i];
 
+    res = pr_redis_list_delete(redis, &proxy_module, akey, (void *) val,
+      strlen(val));
     if (res < 0) {
       pr_trace_msg(trace_channel, 3,
-        "error renaming Shuffle key '%s' to '%s': %s", bkey, akey,
-        strerror(xerrno));
-      idx = -1;
+        "error removing '%s' from Shuffle Redis list '%s': %s", val, akey,
+        strerror(errno));
+    }
+
+    for (j = 0; j < redis_backends->nelts; j++) {
+      const char *backend_uri;
+
+      backend_uri = backend_uri_by_idx((int) j);
+      if (backend_uri != NULL &&
+          strcmp(backend_uri, val) == 0) {
+        idx = (long) j;
+        break;
+      }
     }
   }
 
   destroy_pool(tmp_pool);
-  errno = xerrno;
+
+  if (idx < 0) {
+    errno = ENOENT;
+  }
+
   return idx;
 }
 
@@ -25,6 +25,8 @@
 #include "mod_proxy.h"
 #include "proxy/session.h"
 
+static struct proxy_session_ctx sess_ctx;
+
 static const char *trace_channel = "proxy.session";
 
 const struct proxy_session *proxy_session_alloc(pool *p) {
@@ -56,6 +58,7 @@ const struct proxy_session *proxy_session_alloc(pool *p) {
   proxy_sess->connect_timeout = -1;
   proxy_sess->connect_timerno = -1;
   proxy_sess->linger_timeout = -1;
+  proxy_sess->timer_tick = -1;
 
   proxy_sess->use_ftp = TRUE;
   proxy_sess->use_ssh = FALSE;
@@ -73,6 +76,10 @@ int proxy_session_free(pool *p, const struct proxy_session *proxy_sess) {
     return -1;
   }
 
+  if (sess_ctx.proxy_sess == proxy_sess) {
+    (void) proxy_session_set_current(NULL);
+  }
+
   /* Close any open connections. */
 
   sess = (struct proxy_session *) proxy_sess;
@@ -98,6 +105,94 @@ int proxy_session_free(pool *p, const struct proxy_session *proxy_sess) {
   return 0;
 }
 
+struct proxy_session_ctx *proxy_session_get_ctx(void) {
+  return &sess_ctx;
+}
+
+const struct proxy_session *proxy_session_get_current(void) {
+  const struct proxy_session *proxy_sess;
+
+  if (sess_ctx.proxy_sess != NULL) {
+    return sess_ctx.proxy_sess;
+  }
+
+  /* Fall back to the note, for sessions stashed there directly. */
+  proxy_sess = NULL;
+  if (session.notes != NULL) {
+    proxy_sess = pr_table_get(session.notes, PROXY_SESSION_NOTE_KEY, NULL);
+  }
+
+  if (proxy_sess == NULL) {
+    errno = ENOENT;
+  }
+
+  return proxy_sess;
+}
+
+int proxy_session_set_current(const struct proxy_session *proxy_sess) {
+  int res;
+
+  if (proxy_sess == NULL) {
+    memset(&sess_ctx, 0, sizeof(sess_ctx));
+
+    if (session.notes != NULL) {
+      (void) pr_table_remove(session.notes, PROXY_SESSION_NOTE_KEY, NULL);
+    }
+
+    return 0;
+  }
+
+  if (session.notes == NULL) {
+    sess_ctx.proxy_sess = proxy_sess;
+    return 0;
+  }
+
+  (void) pr_table_remove(session.notes, PROXY_SESSION_NOTE_KEY, NULL);
+  res = pr_table_add(session.notes, PROXY_SESSION_NOTE_KEY,
+    proxy_sess, sizeof(struct proxy_session));
+
+  if (res < 0 &&
+      errno == ENOSPC) {
+    int nents, nmaxents;
+
+    nents = pr_table_count(session.notes);
+    nmaxents = nents * 2;
+
+    /* Attempt to handle the unusual case where the table is full, since
+     * other modules may be relying on this note.
+     */
+    pr_trace_msg(trace_channel, 1,
+      "session notes table is full (%u), increasing entry limit to %u",
+      nents, nmaxents);
+
+    if (pr_table_ctl(session.notes, PR_TABLE_CTL_SET_MAX_ENTS,
+        &nmaxents) == 0) {
+      res = pr_table_add(session.notes, PROXY_SESSION_NOTE_KEY,
+        proxy_sess, sizeof(struct proxy_session));
+
+    } else {
+      pr_trace_msg(trace_channel, 1,
+        "error increasing session notes max entries: %s", strerror(errno));
+      errno = ENOSPC;
+    }
+  }
+
+  if (res < 0) {
+    int xerrno = errno;
+
+    pr_trace_msg(trace_channel, 1,
+      "error stashing proxy session note: %s", strerror(xerrno));
+
+    errno = xerrno;
+    return -1;
+  }
+
+  memset(&sess_ctx, 0, sizeof(sess_ctx));
+  sess_ctx.proxy_sess = proxy_sess;
+
+  return 0;
+}
+
 int proxy_session_reset_dataxfer(struct proxy_session *proxy_sess) {
   if (proxy_sess == NULL) {
     errno = EINVAL;
@@ -0,0 +1,456 @@
+/*
+ * ProFTPD - mod_proxy socket options implementation
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+
+#include "mod_proxy.h"
+#include "proxy/sockopts.h"
+
+static const char *trace_channel = "proxy.sockopts";
+
+/* Per-session profiles, indexed by role. */
+static struct proxy_sockopts sockopts_profiles[PROXY_SOCKOPTS_ROLE_COUNT];
+static int sockopts_configured[PROXY_SOCKOPTS_ROLE_COUNT];
+
+static const char *role_names[PROXY_SOCKOPTS_ROLE_COUNT] = {
+  "frontend-control",
+  "backend-control",
+  "frontend-data",
+  "backend-data",
+  "ssh"
+};
+
+int proxy_sockopts_get_role(const char *name) {
+  register unsigned int i;
+
+  if (name == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (i = 0; i < PROXY_SOCKOPTS_ROLE_COUNT; i++) {
+    if (strcasecmp(name, role_names[i]) == 0) {
+      return (int) i;
+    }
+  }
+
+  errno = ENOENT;
+  return -1;
+}
+
+const char *proxy_sockopts_get_role_name(int role) {
+  if (role < 0 ||
+      role >= PROXY_SOCKOPTS_ROLE_COUNT) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  return role_names[role];
+}
+
+int proxy_sockopts_clear(struct proxy_sockopts *opts) {
+  if (opts == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  opts->nodelay = -1;
+  opts->quickack = -1;
+  opts->notsent_lowat = -1;
+  opts->busy_poll = -1;
+  opts->user_timeout = -1;
+  opts->congestion = NULL;
+  opts->dscp = -1;
+
+  return 0;
+}
+
+static int parse_number(const char *text, int *num) {
+  char *ptr = NULL;
+  long val;
+
+  val = strtol(text, &ptr, 10);
+  if (ptr == NULL ||
+      *ptr != '\0' ||
+      ptr == text ||
+      val < 0 ||
+      val > INT_MAX) {
+    return -1;
+  }
+
+  *num = (int) val;
+  return 0;
+}
+
+/* Parses a DSCP value, either numeric or one of the well-known codepoint
+ * names (see RFC 4594 and RFC 8622), e.g. "EF", "AF41", or "CS1".
+ */
+static int parse_dscp(const char *text, int *dscp) {
+  size_t text_len;
+
+  text_len = strlen(text);
+
+  if (strcasecmp(text, "EF") == 0) {
+    *dscp = 46;
+    return 0;
+  }
+
+  if (strcasecmp(text, "LE") == 0) {
+    *dscp = 1;
+    return 0;
+  }
+
+  if (text_len == 3 &&
+      strncasecmp(text, "CS", 2) == 0 &&
+      text[2] >= '0' &&
+      text[2] <= '7') {
+    *dscp = (text[2] - '0') * 8;
+    return 0;
+  }
+
+  if (text_len == 4 &&
+      strncasecmp(text, "AF", 2) == 0 &&
+      text[2] >= '1' &&
+      text[2] <= '4' &&
+      text[3] >= '1' &&
+      text[3] <= '3') {
+    *dscp = ((text[2] - '0') * 8) + ((text[3] - '0') * 2);
+    return 0;
+  }
+
+  if (parse_number(text, dscp) < 0 ||
+      *dscp > 63) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/* The built-in profiles.  "latency" is for interactive control traffic:
+ * small, immediately sent writes, and prompt ACKs.  "throughput" is for bulk
+ * data traffic, where full segments matter more than prompt ones.
+ */
+static void set_latency_profile(struct proxy_sockopts *opts) {
+  opts->nodelay = TRUE;
+  opts->quickack = TRUE;
+  opts->notsent_lowat = 16384;
+}
+
+static void set_throughput_profile(struct proxy_sockopts *opts) {
+  opts->nodelay = FALSE;
+  opts->quickack = FALSE;
+}
+
+int proxy_sockopts_parse(pool *p, struct proxy_sockopts *opts, int argc,
+    char **argv, const char **bad_text) {
+  register int i;
+
+  if (p == NULL ||
+      opts == NULL ||
+      argv == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (i = 0; i < argc; i++) {
+    const char *name, *value;
+    int res = 0;
+
+    name = argv[i];
+
+    if (strcasecmp(name, "latency") == 0) {
+      set_latency_profile(opts);
+      continue;
+    }
+
+    if (strcasecmp(name, "throughput") == 0) {
+      set_throughput_profile(opts);
+      continue;
+    }
+
+    if (i + 1 >= argc) {
+      if (bad_text != NULL) {
+        *bad_text = name;
+      }
+
+      errno = EINVAL;
+      return -1;
+    }
+
+    value = argv[++i];
+
+    if (strcasecmp(name, "NoDelay") == 0) {
+      opts->nodelay = pr_str_is_boolean(value);
+      res = opts->nodelay;
+
+    } else if (strcasecmp(name, "QuickAck") == 0) {
+      opts->quickack = pr_str_is_boolean(value);
+      res = opts->quickack;
+
+    } else if (strcasecmp(name, "NotSentLowat") == 0) {
+      res = parse_number(value, &(opts->notsent_lowat));
+
+    } else if (strcasecmp(name, "BusyPoll") == 0) {
+      res = parse_number(value, &(opts->busy_poll));
+
+    } else if (strcasecmp(name, "UserTimeout") == 0) {
+      res = parse_number(value, &(opts->user_timeout));
+
+    } else if (strcasecmp(name, "CongestionControl") == 0) {
+      /* Linux limits these names to TCP_CA_NAME_MAX (16) bytes, including
+       * the NUL.
+       */
+      if (*value == '\0' ||
+          strlen(value) > 15) {
+        res = -1;
+
+      } else {
+        opts->congestion = pstrdup(p, value);
+      }
+
+    } else if (strcasecmp(name, "DSCP") == 0) {
+      res = parse_dscp(value, &(opts->dscp));
+
+    } else {
+      if (bad_text != NULL) {
+        *bad_text = name;
+      }
+
+      errno = EINVAL;
+      return -1;
+    }
+
+    if (res < 0) {
+      if (bad_text != NULL) {
+        *bad_text = value;
+      }
+
+      errno = EINVAL;
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int proxy_sockopts_set_profile(int role, const struct proxy_sockopts *opts) {
+  if (role < 0 ||
+      role >= PROXY_SOCKOPTS_ROLE_COUNT) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (opts == NULL) {
+    sockopts_configured[role] = FALSE;
+    return 0;
+  }
+
+  memcpy(&(sockopts_profiles[role]), opts, sizeof(struct proxy_sockopts));
+  sockopts_configured[role] = TRUE;
+  return 0;
+}
+
+const struct proxy_sockopts *proxy_sockopts_get_profile(int role) {
+  if (role < 0 ||
+      role >= PROXY_SOCKOPTS_ROLE_COUNT) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (sockopts_configured[role] == FALSE) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  return &(sockopts_profiles[role]);
+}
+
+static void set_int_opt(int fd, int role, int level, int opt,
+    const char *opt_name, int val) {
+  if (setsockopt(fd, level, opt, (void *) &val, sizeof(val)) < 0) {
+    pr_trace_msg(trace_channel, 3, "error setting %s %d on fd %d (%s): %s",
+      opt_name, val, fd, role_names[role], strerror(errno));
+    return;
+  }
+
+  pr_trace_msg(trace_channel, 17, "set %s %d on fd %d (%s)", opt_name, val, fd,
+    role_names[role]);
+}
+
+static void unsupported_opt(int role, const char *opt_name) {
+  pr_trace_msg(trace_channel, 7, "%s not supported on this platform, "
+    "ignoring for %s connection", opt_name, role_names[role]);
+}
+
+static void set_dscp(int fd, int role, int dscp) {
+  struct sockaddr_storage ss;
+  socklen_t sslen;
+
+  sslen = sizeof(ss);
+  memset(&ss, 0, sslen);
+
+  if (getsockname(fd, (struct sockaddr *) &ss, &sslen) < 0) {
+    pr_trace_msg(trace_channel, 3, "error getting address of fd %d: %s", fd,
+      strerror(errno));
+    return;
+  }
+
+  /* The DSCP occupies the upper six bits of the TOS/traffic class byte. */
+#if defined(PR_USE_IPV6) && defined(IPV6_TCLASS)
+  if (ss.ss_family == AF_INET6) {
+    set_int_opt(fd, role, IPPROTO_IPV6, IPV6_TCLASS, "IPV6_TCLASS", dscp << 2);
+    return;
+  }
+#endif /* PR_USE_IPV6 and IPV6_TCLASS */
+
+#if defined(IP_TOS)
+  if (ss.ss_family == AF_INET) {
+    set_int_opt(fd, role, IPPROTO_IP, IP_TOS, "IP_TOS", dscp << 2);
+    return;
+  }
+#endif /* IP_TOS */
+
+  unsupported_opt(role, "DSCP");
+}
+
+int proxy_sockopts_apply(int fd, int role) {
+  const struct proxy_sockopts *opts;
+
+  if (fd < 0 ||
+      role < 0 ||
+      role >= PROXY_SOCKOPTS_ROLE_COUNT) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (sockopts_configured[role] == FALSE) {
+    return 0;
+  }
+
+  opts = &(sockopts_profiles[role]);
+
+  if (opts->nodelay != -1) {
+    set_int_opt(fd, role, IPPROTO_TCP, TCP_NODELAY, "TCP_NODELAY",
+      opts->nodelay);
+  }
+
+  if (opts->quickack != -1) {
+#if defined(TCP_QUICKACK)
+    set_int_opt(fd, role, IPPROTO_TCP, TCP_QUICKACK, "TCP_QUICKACK",
+      opts->quickack);
+#else
+    unsupported_opt(role, "TCP_QUICKACK");
+#endif /* TCP_QUICKACK */
+  }
+
+  if (opts->notsent_lowat != -1) {
+#if defined(TCP_NOTSENT_LOWAT)
+    set_int_opt(fd, role, IPPROTO_TCP, TCP_NOTSENT_LOWAT, "TCP_NOTSENT_LOWAT",
+      opts->notsent_lowat);
+#else
+    unsupported_opt(role, "TCP_NOTSENT_LOWAT");
+#endif /* TCP_NOTSENT_LOWAT */
+  }
+
+  if (opts->busy_poll != -1) {
+#if defined(SO_BUSY_POLL)
+    set_int_opt(fd, role, SOL_SOCKET, SO_BUSY_POLL, "SO_BUSY_POLL",
+      opts->busy_poll);
+#else
+    unsupported_opt(role, "SO_BUSY_POLL");
+#endif /* SO_BUSY_POLL */
+  }
+
+  if (opts->user_timeout != -1) {
+#if defined(TCP_USER_TIMEOUT)
+    set_int_opt(fd, role, IPPROTO_TCP, TCP_USER_TIMEOUT, "TCP_USER_TIMEOUT",
+      opts->user_timeout);
+#else
+    unsupported_opt(role, "TCP_USER_TIMEOUT");
+#endif /* TCP_USER_TIMEOUT */
+  }
+
+  if (opts->congestion != NULL) {
+#if defined(TCP_CONGESTION)
+    if (setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION,
+        (void *) opts->congestion, strlen(opts->congestion)) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "error setting TCP_CONGESTION '%s' on fd %d (%s): %s",
+        opts->congestion, fd, role_names[role], strerror(errno));
+
+    } else {
+      pr_trace_msg(trace_channel, 17, "set TCP_CONGESTION '%s' on fd %d (%s)",
+        opts->congestion, fd, role_names[role]);
+    }
+#else
+    unsupported_opt(role, "TCP_CONGESTION");
+#endif /* TCP_CONGESTION */
+  }
+
+  if (opts->dscp != -1) {
+    set_dscp(fd, role, opts->dscp);
+  }
+
+  return 0;
+}
+
+int proxy_sockopts_apply_conn(conn_t *conn, int role) {
+  register unsigned int i;
+  int fds[3];
+
+  if (conn == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Before it is opened for reading/writing, a conn's socket is its
+   * listen_fd; afterwards, it is the rfd/wfd, which may be different.
+   */
+  fds[0] = conn->listen_fd;
+  fds[1] = conn->rfd;
+  fds[2] = conn->wfd;
+
+  for (i = 0; i < 3; i++) {
+    if (fds[i] < 0 ||
+        (i > 0 && fds[i] == fds[0]) ||
+        (i > 1 && fds[i] == fds[1])) {
+      continue;
+    }
+
+    if (proxy_sockopts_apply(fds[i], role) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+int proxy_sockopts_free(void) {
+  register unsigned int i;
+
+  for (i = 0; i < PROXY_SOCKOPTS_ROLE_COUNT; i++) {
+    sockopts_configured[i] = FALSE;
+  }
+
+  return 0;
+}
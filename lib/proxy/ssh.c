@@ -36,6 +36,7 @@
 #include "proxy/ssh/redis.h"
 #include "proxy/ssh/crypto.h"
 #include "proxy/ssh/packet.h"
+#include "proxy/ssh/pktlog.h"
 #include "proxy/ssh/interop.h"
 #include "proxy/ssh/kex.h"
 #include "proxy/ssh/keys.h"
@@ -849,6 +850,33 @@ int proxy_ssh_sess_init(pool *p, struct proxy_session *proxy_sess, int flags) {
 
   proxy_opts |= ssh_opts;
 
+  c = find_config(main_server->conf, CONF_PARAM, "ProxySFTPLogPackets", FALSE);
+  if (c != NULL) {
+    int policy;
+    unsigned int sample_rate;
+    array_header *msg_types;
+
+    policy = *((int *) c->argv[0]);
+    sample_rate = *((unsigned int *) c->argv[1]);
+    msg_types = c->argv[2];
+
+    if (proxy_ssh_pktlog_init(p, main_server, policy,
+        sample_rate) == 0 &&
+        msg_types != NULL) {
+      register unsigned int i;
+      unsigned char *types;
+
+      types = msg_types->elts;
+      for (i = 0; i < msg_types->nelts; i++) {
+        (void) proxy_ssh_pktlog_set_msg_type(types[i], TRUE);
+      }
+    }
+
+  } else {
+    (void) proxy_ssh_pktlog_init(p, main_server,
+      PROXY_SSH_PKTLOG_POLICY_ALL, 0);
+  }
+
   c = find_config(main_server->conf, CONF_PARAM, "ProxySFTPHostKey", FALSE);
   while (c != NULL) {
     const char *path;
@@ -954,6 +982,7 @@ int proxy_ssh_sess_free(pool *p) {
   }
 
   proxy_ssh_kex_sess_free();
+  proxy_ssh_pktlog_free();
 
   pr_event_unregister(&proxy_module, "mod_sftp.ssh2.auth-hostbased",
     ssh_ssh2_auth_completed_ev);
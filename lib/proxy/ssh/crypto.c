@@ -178,6 +178,21 @@ static struct proxy_ssh_digest digests[] = {
   { NULL, NULL, NULL, 0, FALSE, FALSE }
 };
 
+/* The resolved EVP types for the above ciphers and digests, by table index.
+ * The custom CTR and UMAC implementations allocate a new method object each
+ * time they are resolved, so we resolve each algorithm at most once, and reuse
+ * it for every key exchange (including rekeys).
+ *
+ * Prior to OpenSSL 1.1.x, those custom implementations are instead static
+ * structures, shared among key lengths; we do not cache them there.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && \
+    !defined(HAVE_LIBRESSL)
+# define PROXY_SSH_CRYPTO_CACHE_TYPES
+static const EVP_CIPHER *cipher_types[sizeof(ciphers) / sizeof(ciphers[0])];
+static const EVP_MD *digest_types[sizeof(digests) / sizeof(digests[0])];
+#endif /* OpenSSL 1.1.x and later */
+
 static const char *trace_channel = "proxy.ssh.crypto";
 
 #if OPENSSL_VERSION_NUMBER < 0x30000000L
@@ -961,6 +976,12 @@ const EVP_CIPHER *proxy_ssh_crypto_get_cipher(const char *name, size_t *key_len,
     if (strcmp(ciphers[i].name, name) == 0) {
       const EVP_CIPHER *cipher;
 
+#if defined(PROXY_SSH_CRYPTO_CACHE_TYPES)
+      if (cipher_types[i] != NULL) {
+        cipher = cipher_types[i];
+
+      } else
+#endif /* PROXY_SSH_CRYPTO_CACHE_TYPES */
       if (strcmp(name, "blowfish-ctr") == 0) {
 #if !defined(OPENSSL_NO_BF) && \
     OPENSSL_VERSION_NUMBER < 0x30000000L
@@ -1010,6 +1031,10 @@ const EVP_CIPHER *proxy_ssh_crypto_get_cipher(const char *name, size_t *key_len,
         cipher = ciphers[i].get_type();
       }
 
+#if defined(PROXY_SSH_CRYPTO_CACHE_TYPES)
+      cipher_types[i] = cipher;
+#endif /* PROXY_SSH_CRYPTO_CACHE_TYPES */
+
       if (key_len != NULL) {
         if (strcmp(name, "arcfour256") != 0) {
           *key_len = 0;
@@ -1053,6 +1078,12 @@ const EVP_MD *proxy_ssh_crypto_get_digest(const char *name, uint32_t *mac_len) {
     if (strcmp(digests[i].name, name) == 0) {
       const EVP_MD *digest = NULL;
 
+#if defined(PROXY_SSH_CRYPTO_CACHE_TYPES)
+      if (digest_types[i] != NULL) {
+        digest = digest_types[i];
+
+      } else
+#endif /* PROXY_SSH_CRYPTO_CACHE_TYPES */
 #if OPENSSL_VERSION_NUMBER > 0x000907000L
       if (strcmp(name, "umac-64@openssh.com") == 0 ||
           strcmp(name, "umac-64-etm@openssh.com") == 0) {
@@ -1069,6 +1100,10 @@ const EVP_MD *proxy_ssh_crypto_get_digest(const char *name, uint32_t *mac_len) {
         digest = digests[i].get_type();
       }
 
+#if defined(PROXY_SSH_CRYPTO_CACHE_TYPES)
+      digest_types[i] = digest;
+#endif /* PROXY_SSH_CRYPTO_CACHE_TYPES */
+
       if (mac_len != NULL) {
         *mac_len = digests[i].mac_len;
       }
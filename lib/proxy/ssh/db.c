@@ -210,6 +210,147 @@ static int ssh_db_update_hostkey(pool *p, void *dsh, unsigned int vhost_id,
   return 0;
 }
 
+static array_header *ssh_db_get_kexcosts(pool *p, void *dsh,
+    unsigned int vhost_id, const char *backend_uri) {
+  register int i;
+  int res, xerrno;
+  struct proxy_dbh *dbh;
+  const char *stmt, *errstr = NULL;
+  array_header *results, *costs;
+
+  dbh = dsh;
+
+  stmt = "SELECT algo, wall_usecs, cpu_usecs, count FROM proxy_ssh_kexcosts WHERE vhost_id = ? AND backend_uri = ?;";
+  res = proxy_db_prepare_stmt(p, dbh, stmt);
+  if (res < 0) {
+    xerrno = errno;
+    (void) pr_log_debug(DEBUG3, MOD_PROXY_VERSION
+      ": error preparing statement '%s': %s", stmt, strerror(xerrno));
+    errno = xerrno;
+    return NULL;
+  }
+
+  res = proxy_db_bind_stmt(p, dbh, stmt, 1, PROXY_DB_BIND_TYPE_INT,
+    (void *) &vhost_id, 0);
+  if (res < 0) {
+    return NULL;
+  }
+
+  res = proxy_db_bind_stmt(p, dbh, stmt, 2, PROXY_DB_BIND_TYPE_TEXT,
+    (void *) backend_uri, -1);
+  if (res < 0) {
+    return NULL;
+  }
+
+  results = proxy_db_exec_prepared_stmt(p, dbh, stmt, &errstr);
+  if (results == NULL ||
+      results->nelts == 0) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  /* We expect 4 items per row: algo, wall_usecs, cpu_usecs, and count. */
+  if (results->nelts % 4 != 0) {
+    pr_log_debug(DEBUG3, MOD_PROXY_VERSION
+      ": expected multiple of 4 results from statement '%s', got %d", stmt,
+      results->nelts);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  costs = make_array(p, results->nelts / 4, sizeof(struct proxy_ssh_kexcost *));
+  for (i = 0; i < results->nelts; i += 4) {
+    struct proxy_ssh_kexcost *cost;
+    char **elts;
+
+    elts = results->elts;
+
+    cost = pcalloc(p, sizeof(struct proxy_ssh_kexcost));
+    cost->algo = elts[i];
+    cost->wall_usecs = strtoul(elts[i+1], NULL, 10);
+    cost->cpu_usecs = strtoul(elts[i+2], NULL, 10);
+    cost->count = (unsigned int) strtoul(elts[i+3], NULL, 10);
+
+    *((struct proxy_ssh_kexcost **) push_array(costs)) = cost;
+  }
+
+  pr_trace_msg(trace_channel, 19,
+    "retrieved %d key exchange costs for vhost ID %u, URI '%s'", costs->nelts,
+    vhost_id, backend_uri);
+  return costs;
+}
+
+static int ssh_db_set_kexcost(pool *p, void *dsh, unsigned int vhost_id,
+    const char *backend_uri, const struct proxy_ssh_kexcost *cost) {
+  int res, xerrno = 0;
+  struct proxy_dbh *dbh;
+  const char *stmt, *errstr = NULL;
+  array_header *results;
+  long wall_usecs, cpu_usecs;
+  unsigned int count;
+
+  dbh = dsh;
+
+  stmt = "INSERT OR REPLACE INTO proxy_ssh_kexcosts (vhost_id, backend_uri, algo, wall_usecs, cpu_usecs, count) VALUES (?, ?, ?, ?, ?, ?);";
+  res = proxy_db_prepare_stmt(p, dbh, stmt);
+  if (res < 0) {
+    xerrno = errno;
+    (void) pr_log_debug(DEBUG3, MOD_PROXY_VERSION
+      ": error preparing statement '%s': %s", stmt, strerror(xerrno));
+    errno = xerrno;
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dbh, stmt, 1, PROXY_DB_BIND_TYPE_INT,
+    (void *) &vhost_id, 0);
+  if (res < 0) {
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dbh, stmt, 2, PROXY_DB_BIND_TYPE_TEXT,
+    (void *) backend_uri, -1);
+  if (res < 0) {
+    return -1;
+  }
+
+  res = proxy_db_bind_stmt(p, dbh, stmt, 3, PROXY_DB_BIND_TYPE_TEXT,
+    (void *) cost->algo, -1);
+  if (res < 0) {
+    return -1;
+  }
+
+  wall_usecs = (long) cost->wall_usecs;
+  res = proxy_db_bind_stmt(p, dbh, stmt, 4, PROXY_DB_BIND_TYPE_LONG,
+    (void *) &wall_usecs, 0);
+  if (res < 0) {
+    return -1;
+  }
+
+  cpu_usecs = (long) cost->cpu_usecs;
+  res = proxy_db_bind_stmt(p, dbh, stmt, 5, PROXY_DB_BIND_TYPE_LONG,
+    (void *) &cpu_usecs, 0);
+  if (res < 0) {
+    return -1;
+  }
+
+  count = cost->count;
+  res = proxy_db_bind_stmt(p, dbh, stmt, 6, PROXY_DB_BIND_TYPE_INT,
+    (void *) &count, 0);
+  if (res < 0) {
+    return -1;
+  }
+
+  results = proxy_db_exec_prepared_stmt(p, dbh, stmt, &errstr);
+  if (results == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error executing '%s': %s", stmt, errstr ? errstr : strerror(errno));
+    errno = EPERM;
+    return -1;
+  }
+
+  return 0;
+}
+
 /* Initialization routines */
 
 static int ssh_db_add_schema(pool *p, void *dbh, const char *db_path) {
@@ -247,7 +388,28 @@ static int ssh_db_add_schema(pool *p, void *dbh, const char *db_path) {
     return -1;
   }
 
-  /* Note that we deliberately do NOT truncate the hostkeys table. */
+  /* CREATE TABLE proxy_ssh_kexcosts (
+   *   vhost_id INTEGER NOT NULL,
+   *   backend_uri STRING NOT NULL,
+   *   algo TEXT NOT NULL,
+   *   wall_usecs INTEGER NOT NULL,
+   *   cpu_usecs INTEGER NOT NULL,
+   *   count INTEGER NOT NULL,
+   *   PRIMARY KEY (vhost_id, backend_uri, algo)
+   * );
+   */
+  stmt = "CREATE TABLE IF NOT EXISTS proxy_ssh_kexcosts (vhost_id INTEGER NOT NULL, backend_uri STRING NOT NULL, algo TEXT NOT NULL, wall_usecs INTEGER NOT NULL, cpu_usecs INTEGER NOT NULL, count INTEGER NOT NULL, PRIMARY KEY (vhost_id, backend_uri, algo));";
+  res = proxy_db_exec_stmt(p, dbh, stmt, &errstr);
+  if (res < 0) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error executing '%s': %s", stmt, errstr);
+    errno = EPERM;
+    return -1;
+  }
+
+  /* Note that we deliberately do NOT truncate the hostkeys or kexcosts
+   * tables; the recorded costs remain useful across restarts.
+   */
 
   return 0;
 }
@@ -428,6 +590,9 @@ int proxy_ssh_db_as_datastore(struct proxy_ssh_datastore *ds, void *ds_data,
   ds->hostkey_get = ssh_db_get_hostkey;
   ds->hostkey_update = ssh_db_update_hostkey;
 
+  ds->kexcosts_get = ssh_db_get_kexcosts;
+  ds->kexcost_set = ssh_db_set_kexcost;
+
   ds->init = ssh_db_init;
   ds->open = ssh_db_open;
   ds->close = ssh_db_close;
@@ -33,6 +33,7 @@
 #include "proxy/ssh/mac.h"
 #include "proxy/ssh/compress.h"
 #include "proxy/ssh/kex.h"
+#include "proxy/ssh/kexcost.h"
 #include "proxy/ssh/keys.h"
 #include "proxy/ssh/crypto.h"
 #include "proxy/ssh/disconnect.h"
@@ -78,6 +79,10 @@ static pool *kex_pool = NULL;
 static struct proxy_ssh_datastore *kex_ds = NULL;
 static int kex_verify_hostkeys = FALSE;
 
+/* For reordering our key exchanges based on their recorded costs. */
+static int kex_adaptive = FALSE;
+static unsigned int kex_min_security_bits = PROXY_SSH_KEXCOST_DEFAULT_MIN_BITS;
+
 struct proxy_ssh_kex_names {
   const char *kex_algo;
   const char *server_hostkey_algo;
@@ -190,6 +195,25 @@ static int kex_sent_kexinit = FALSE;
 static int use_strict_kex = FALSE;
 static int kex_done_first_kex = FALSE;
 
+/* Our KEXINIT name-lists, compiled once and reused for every negotiation
+ * (including rekeys) as long as the lists we send do not change.  These live
+ * in their own pool, since the Kex pool is recreated for each rekey.
+ */
+#define PROXY_SSH_KEX_OFFER_KEX			0
+#define PROXY_SSH_KEX_OFFER_HOSTKEY		1
+#define PROXY_SSH_KEX_OFFER_C2S_CIPHER		2
+#define PROXY_SSH_KEX_OFFER_S2C_CIPHER		3
+#define PROXY_SSH_KEX_OFFER_C2S_MAC		4
+#define PROXY_SSH_KEX_OFFER_S2C_MAC		5
+#define PROXY_SSH_KEX_OFFER_C2S_COMP		6
+#define PROXY_SSH_KEX_OFFER_S2C_COMP		7
+#define PROXY_SSH_KEX_OFFER_C2S_LANG		8
+#define PROXY_SSH_KEX_OFFER_S2C_LANG		9
+#define PROXY_SSH_KEX_OFFER_COUNT		10
+
+static pool *kex_offers_pool = NULL;
+static struct proxy_ssh_namelist *kex_offers[PROXY_SSH_KEX_OFFER_COUNT];
+
 /* Diffie-Hellman group moduli */
 
 static const char *dh_group1_str =
@@ -1719,6 +1743,136 @@ static const char *get_kexinit_hostkey_algo_list(pool *p) {
   return list;
 }
 
+static const char *get_backend_uri(void) {
+  const struct proxy_session *proxy_sess;
+
+  proxy_sess = proxy_session_get_current();
+  if (proxy_sess == NULL ||
+      proxy_sess->dst_pconn == NULL) {
+    errno = ENOENT;
+    return NULL;
+  }
+
+  return proxy_conn_get_uri(proxy_sess->dst_pconn);
+}
+
+/* Reorder our key exchanges, cheapest first, using the costs recorded for
+ * this backend, if any.
+ */
+static const char *get_adaptive_exchange_list(pool *p, const char *list) {
+  const char *backend_uri, *adaptive_list;
+  array_header *costs;
+
+  if (kex_adaptive == FALSE ||
+      kex_ds == NULL ||
+      kex_ds->kexcosts_get == NULL) {
+    return list;
+  }
+
+  backend_uri = get_backend_uri();
+  if (backend_uri == NULL) {
+    return list;
+  }
+
+  costs = (kex_ds->kexcosts_get)(p, kex_ds->dsh, main_server->sid,
+    backend_uri);
+  if (costs == NULL &&
+      errno != ENOENT) {
+    pr_trace_msg(trace_channel, 3,
+      "error retrieving key exchange costs for URI '%s': %s", backend_uri,
+      strerror(errno));
+  }
+
+  adaptive_list = proxy_ssh_kexcost_reorder(p, list, costs,
+    kex_min_security_bits);
+  if (adaptive_list == NULL) {
+    return list;
+  }
+
+  return adaptive_list;
+}
+
+static void record_kex_cost(pool *p, const char *algo,
+    const struct timeval *start_tv, const struct rusage *start_ru) {
+  register int i;
+  const char *backend_uri;
+  array_header *costs;
+  struct proxy_ssh_kexcost *cost = NULL;
+  struct timeval end_tv;
+  struct rusage end_ru;
+  long wall_usecs, cpu_usecs;
+
+  if (kex_adaptive == FALSE ||
+      kex_ds == NULL ||
+      kex_ds->kexcosts_get == NULL ||
+      kex_ds->kexcost_set == NULL) {
+    return;
+  }
+
+  backend_uri = get_backend_uri();
+  if (backend_uri == NULL) {
+    return;
+  }
+
+  gettimeofday(&end_tv, NULL);
+  if (getrusage(RUSAGE_SELF, &end_ru) < 0) {
+    memcpy(&end_ru, start_ru, sizeof(struct rusage));
+  }
+
+  wall_usecs = ((end_tv.tv_sec - start_tv->tv_sec) * 1000000L) +
+    (end_tv.tv_usec - start_tv->tv_usec);
+  cpu_usecs = ((end_ru.ru_utime.tv_sec - start_ru->ru_utime.tv_sec) +
+      (end_ru.ru_stime.tv_sec - start_ru->ru_stime.tv_sec)) * 1000000L +
+    (end_ru.ru_utime.tv_usec - start_ru->ru_utime.tv_usec) +
+    (end_ru.ru_stime.tv_usec - start_ru->ru_stime.tv_usec);
+
+  if (wall_usecs < 0) {
+    wall_usecs = 0;
+  }
+
+  if (cpu_usecs < 0) {
+    cpu_usecs = 0;
+  }
+
+  costs = (kex_ds->kexcosts_get)(p, kex_ds->dsh, main_server->sid,
+    backend_uri);
+  if (costs == NULL) {
+    costs = make_array(p, 1, sizeof(struct proxy_ssh_kexcost *));
+  }
+
+  for (i = 0; i < costs->nelts; i++) {
+    struct proxy_ssh_kexcost *elt;
+
+    elt = ((struct proxy_ssh_kexcost **) costs->elts)[i];
+    if (strcmp(elt->algo, algo) == 0) {
+      cost = elt;
+      break;
+    }
+  }
+
+  if (cost == NULL) {
+    cost = pcalloc(p, sizeof(struct proxy_ssh_kexcost));
+    cost->algo = pstrdup(p, algo);
+    *((struct proxy_ssh_kexcost **) push_array(costs)) = cost;
+  }
+
+  (void) proxy_ssh_kexcost_update(cost, (unsigned long) wall_usecs,
+    (unsigned long) cpu_usecs);
+
+  pr_trace_msg(trace_channel, 8,
+    "key exchange '%s' with URI '%s' took %ld usecs (%ld usecs CPU)", algo,
+    backend_uri, wall_usecs, cpu_usecs);
+
+  if ((kex_ds->kexcost_set)(p, kex_ds->dsh, main_server->sid, backend_uri,
+      cost) < 0) {
+    pr_trace_msg(trace_channel, 3,
+      "error recording key exchange cost for URI '%s': %s", backend_uri,
+      strerror(errno));
+  }
+
+  proxy_ssh_kexcost_dump(backend_uri, costs);
+}
+
 static struct proxy_ssh_kex *create_kex(pool *p) {
   struct proxy_ssh_kex *kex;
   const char *list;
@@ -1748,6 +1902,7 @@ static struct proxy_ssh_kex *create_kex(pool *p) {
   kex->rsa_encrypted_len = 0;
 
   list = get_kexinit_exchange_list(kex->pool);
+  list = get_adaptive_exchange_list(kex->pool, list);
   kex->client_names->kex_algo = list;
 
   list = get_kexinit_hostkey_algo_list(kex->pool);
@@ -2229,6 +2384,44 @@ static int setup_s2c_lang(struct proxy_ssh_kex *kex, const char *lang) {
   return 0;
 }
 
+/* Negotiates the algorithm for the given offer: the first name in our
+ * (client) list which the server also sent.  Our list is compiled on first
+ * use, and recompiled only if it changes.
+ */
+static const char *get_shared_algo(unsigned int offer_idx,
+    const char *client_list, const char *server_list) {
+  struct proxy_ssh_namelist *offer;
+  int id;
+
+  if (client_list == NULL ||
+      server_list == NULL) {
+    return NULL;
+  }
+
+  if (kex_offers_pool == NULL) {
+    kex_offers_pool = make_sub_pool(proxy_pool);
+    pr_pool_tag(kex_offers_pool, "Proxy SSH Kex Offers Pool");
+  }
+
+  offer = kex_offers[offer_idx];
+  if (offer == NULL ||
+      strcmp(offer->names, client_list) != 0) {
+    offer = proxy_ssh_misc_namelist_compile(kex_offers_pool, client_list);
+    if (offer == NULL) {
+      return NULL;
+    }
+
+    kex_offers[offer_idx] = offer;
+  }
+
+  id = proxy_ssh_misc_namelist_negotiate(offer, server_list);
+  if (id < 0) {
+    return NULL;
+  }
+
+  return offer->elts[id];
+}
+
 static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
   const char *kex_algo, *shared, *client_list, *server_list;
   const char *client_pref, *server_pref;
@@ -2270,7 +2463,7 @@ static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
     }
   }
 
-  kex_algo = proxy_ssh_misc_namelist_shared(kex->pool, client_list,
+  kex_algo = get_shared_algo(PROXY_SSH_KEX_OFFER_KEX, client_list,
     server_list);
   if (kex_algo != NULL) {
     /* Unlike the following algorithms, we wait to setup the chosen kex algo
@@ -2319,7 +2512,8 @@ static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
   pr_trace_msg(trace_channel, 8,
     "server-sent host key algorithms: %s", server_list);
 
-  shared = proxy_ssh_misc_namelist_shared(kex->pool, client_list, server_list);
+  shared = get_shared_algo(PROXY_SSH_KEX_OFFER_HOSTKEY, client_list,
+    server_list);
   if (shared != NULL) {
     if (setup_hostkey_algo(kex, shared) < 0) {
       destroy_pool(tmp_pool);
@@ -2347,7 +2541,8 @@ static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
   pr_trace_msg(trace_channel, 8, "server-sent client encryption algorithms: %s",
     server_list);
 
-  shared = proxy_ssh_misc_namelist_shared(kex->pool, client_list, server_list);
+  shared = get_shared_algo(PROXY_SSH_KEX_OFFER_C2S_CIPHER, client_list,
+    server_list);
   if (shared != NULL) {
     if (setup_c2s_encrypt_algo(kex, shared) < 0) {
       destroy_pool(tmp_pool);
@@ -2375,7 +2570,8 @@ static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
   pr_trace_msg(trace_channel, 8, "server-sent server encryption algorithms: %s",
     server_list);
 
-  shared = proxy_ssh_misc_namelist_shared(kex->pool, client_list, server_list);
+  shared = get_shared_algo(PROXY_SSH_KEX_OFFER_S2C_CIPHER, client_list,
+    server_list);
   if (shared != NULL) {
     if (setup_s2c_encrypt_algo(kex, shared) < 0) {
       destroy_pool(tmp_pool);
@@ -2405,7 +2601,7 @@ static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
 
   /* Ignore MAC/digests when authenticated encryption algorithms are used. */
   if (proxy_ssh_cipher_get_read_auth_size2() == 0) {
-    shared = proxy_ssh_misc_namelist_shared(kex->pool, client_list,
+    shared = get_shared_algo(PROXY_SSH_KEX_OFFER_C2S_MAC, client_list,
       server_list);
     if (shared != NULL) {
       if (setup_c2s_mac_algo(kex, shared) < 0) {
@@ -2444,7 +2640,7 @@ static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
 
   /* Ignore MAC/digests when authenticated encryption algorithms are used. */
   if (proxy_ssh_cipher_get_write_auth_size2() == 0) {
-    shared = proxy_ssh_misc_namelist_shared(kex->pool, client_list,
+    shared = get_shared_algo(PROXY_SSH_KEX_OFFER_S2C_MAC, client_list,
       server_list);
     if (shared != NULL) {
       if (setup_s2c_mac_algo(kex, shared) < 0) {
@@ -2481,7 +2677,8 @@ static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
   pr_trace_msg(trace_channel, 8,
     "server-sent client compression algorithms: %s", server_list);
 
-  shared = proxy_ssh_misc_namelist_shared(kex->pool, client_list, server_list);
+  shared = get_shared_algo(PROXY_SSH_KEX_OFFER_C2S_COMP, client_list,
+    server_list);
   if (shared != NULL) {
     if (setup_c2s_comp_algo(kex, shared) < 0) {
       destroy_pool(tmp_pool);
@@ -2509,7 +2706,8 @@ static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
   pr_trace_msg(trace_channel, 8,
     "server-sent server compression algorithms: %s", server_list);
 
-  shared = proxy_ssh_misc_namelist_shared(kex->pool, client_list, server_list);
+  shared = get_shared_algo(PROXY_SSH_KEX_OFFER_S2C_COMP, client_list,
+    server_list);
   if (shared != NULL) {
     if (setup_s2c_comp_algo(kex, shared) < 0) {
       destroy_pool(tmp_pool);
@@ -2537,7 +2735,8 @@ static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
   pr_trace_msg(trace_channel, 8,
     "server-sent client languages: %s", client_list);
 
-  shared = proxy_ssh_misc_namelist_shared(kex->pool, client_list, server_list);
+  shared = get_shared_algo(PROXY_SSH_KEX_OFFER_C2S_LANG, client_list,
+    server_list);
   if (shared != NULL) {
     if (setup_c2s_lang(kex, shared) < 0) {
       destroy_pool(tmp_pool);
@@ -2560,7 +2759,8 @@ static int get_session_names(struct proxy_ssh_kex *kex, int *correct_guess) {
   pr_trace_msg(trace_channel, 8,
     "server-sent server languages: %s", client_list);
 
-  shared = proxy_ssh_misc_namelist_shared(kex->pool, client_list, server_list);
+  shared = get_shared_algo(PROXY_SSH_KEX_OFFER_S2C_LANG, client_list,
+    server_list);
   if (shared != NULL) {
     if (setup_s2c_lang(kex, shared) < 0) {
       destroy_pool(tmp_pool);
@@ -2892,7 +3092,7 @@ static int handle_server_hostkey(pool *p,
   const unsigned char *stored_hostkey_data = NULL;
   uint32_t stored_hostkey_datalen = 0;
 
-  proxy_sess = pr_table_get(session.notes, "mod_proxy.proxy-session", NULL);
+  proxy_sess = proxy_session_get_current();
   if (proxy_sess == NULL) {
     /* Unlikely to occur. */
     errno = EINVAL;
@@ -4905,6 +5105,14 @@ int proxy_ssh_kex_handle(struct proxy_ssh_packet *pkt,
   int correct_guess = TRUE, res, sent_newkeys = FALSE;
   char msg_type;
   struct proxy_ssh_kex *kex;
+  struct timeval start_tv;
+  struct rusage start_ru;
+
+  /* Note when we start, for profiling the cost of this key exchange. */
+  gettimeofday(&start_tv, NULL);
+  if (getrusage(RUSAGE_SELF, &start_ru) < 0) {
+    memset(&start_ru, 0, sizeof(struct rusage));
+  }
 
   /* We may already have a kex structure, either from the client
    * initial connect (kex_first_kex not null), or because we
@@ -5143,6 +5351,9 @@ int proxy_ssh_kex_handle(struct proxy_ssh_packet *pkt,
       PROXY_SSH_DISCONNECT_BY_APPLICATION, NULL);
   }
 
+  record_kex_cost(pkt->pool, kex->session_names->kex_algo, &start_tv,
+    &start_ru);
+
   /* We've now completed our KEX, possibly our first. */
   kex_done_first_kex = TRUE;
 
@@ -5154,17 +5365,28 @@ int proxy_ssh_kex_handle(struct proxy_ssh_packet *pkt,
 int proxy_ssh_kex_sess_free(void) {
   kex_ds = NULL;
   kex_verify_hostkeys = FALSE;
+  kex_adaptive = FALSE;
+  kex_min_security_bits = PROXY_SSH_KEXCOST_DEFAULT_MIN_BITS;
 
   return 0;
 }
 
 int proxy_ssh_kex_sess_init(pool *p, struct proxy_ssh_datastore *ds,
     int verify_hostkeys) {
+  config_rec *c;
+
   (void) p;
 
   kex_ds = ds;
   kex_verify_hostkeys = verify_hostkeys;
 
+  c = find_config(main_server->conf, CONF_PARAM,
+    "ProxySFTPAdaptiveKeyExchanges", FALSE);
+  if (c != NULL) {
+    kex_adaptive = *((int *) c->argv[0]);
+    kex_min_security_bits = *((unsigned int *) c->argv[1]);
+  }
+
   return 0;
 }
 
@@ -5190,6 +5412,12 @@ int proxy_ssh_kex_free(void) {
     kex_pool = NULL;
   }
 
+  if (kex_offers_pool != NULL) {
+    destroy_pool(kex_offers_pool);
+    kex_offers_pool = NULL;
+    memset(kex_offers, 0, sizeof(kex_offers));
+  }
+
   return 0;
 }
 
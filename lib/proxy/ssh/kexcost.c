@@ -0,0 +1,247 @@
+/*
+ * ProFTPD - mod_proxy SSH KEX cost profiling
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+#include "mod_proxy.h"
+
+#include "proxy/ssh/kexcost.h"
+
+static const char *trace_channel = "proxy.ssh.kexcost";
+
+/* Once we have this many samples, older samples decay exponentially, so that
+ * the averages track changes in the backend's performance.
+ */
+#define PROXY_SSH_KEXCOST_MAX_WEIGHT		8
+
+/* Estimated security strengths, per NIST SP 800-57.  SHA1-based exchanges
+ * are rated at 80 bits, regardless of group size.  For the group exchanges,
+ * we assume the smallest group we request.
+ */
+static struct {
+  const char *algo;
+  int bits;
+} kex_strengths[] = {
+  { "curve448-sha512",				224 },
+  { "curve25519-sha256",			128 },
+  { "curve25519-sha256@libssh.org",		128 },
+  { "ecdh-sha2-nistp521",			256 },
+  { "ecdh-sha2-nistp384",			192 },
+  { "ecdh-sha2-nistp256",			128 },
+  { "diffie-hellman-group18-sha512",		192 },
+  { "diffie-hellman-group16-sha512",		128 },
+  { "diffie-hellman-group14-sha256",		112 },
+  { "diffie-hellman-group-exchange-sha256",	112 },
+  { "diffie-hellman-group-exchange-sha1",	80 },
+  { "diffie-hellman-group14-sha1",		80 },
+  { "diffie-hellman-group1-sha1",		80 },
+  { "rsa2048-sha256",				112 },
+  { "rsa1024-sha1",				80 },
+  { NULL, 0 }
+};
+
+/* Classes of algorithms, in the order in which they are offered. */
+#define KEXCOST_CLASS_UNMEASURED	0
+#define KEXCOST_CLASS_MEASURED		1
+#define KEXCOST_CLASS_WEAK		2
+#define KEXCOST_CLASS_UNKNOWN		3
+
+struct kexcost_entry {
+  const char *algo;
+  const struct proxy_ssh_kexcost *cost;
+  unsigned int idx;
+  int class;
+};
+
+int proxy_ssh_kexcost_get_security_bits(const char *algo) {
+  register unsigned int i;
+
+  if (algo == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  for (i = 0; kex_strengths[i].algo != NULL; i++) {
+    if (strcmp(kex_strengths[i].algo, algo) == 0) {
+      return kex_strengths[i].bits;
+    }
+  }
+
+  errno = ENOENT;
+  return -1;
+}
+
+static unsigned long update_avg(unsigned long avg, unsigned long sample,
+    unsigned int weight) {
+  if (sample >= avg) {
+    return avg + ((sample - avg) / weight);
+  }
+
+  return avg - ((avg - sample) / weight);
+}
+
+int proxy_ssh_kexcost_update(struct proxy_ssh_kexcost *cost,
+    unsigned long wall_usecs, unsigned long cpu_usecs) {
+  unsigned int weight;
+
+  if (cost == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (cost->count < PROXY_SSH_KEXCOST_MAX_WEIGHT) {
+    cost->count++;
+  }
+
+  /* Until we have enough samples, this is a plain running mean. */
+  weight = cost->count;
+  cost->wall_usecs = update_avg(cost->wall_usecs, wall_usecs, weight);
+  cost->cpu_usecs = update_avg(cost->cpu_usecs, cpu_usecs, weight);
+
+  return 0;
+}
+
+static const struct proxy_ssh_kexcost *get_cost(const array_header *costs,
+    const char *algo) {
+  register int i;
+  struct proxy_ssh_kexcost **elts;
+
+  if (costs == NULL) {
+    return NULL;
+  }
+
+  elts = costs->elts;
+  for (i = 0; i < costs->nelts; i++) {
+    if (elts[i] != NULL &&
+        elts[i]->count > 0 &&
+        strcmp(elts[i]->algo, algo) == 0) {
+      return elts[i];
+    }
+  }
+
+  return NULL;
+}
+
+static int kexcost_entry_cmp(const void *a, const void *b) {
+  const struct kexcost_entry *ea, *eb;
+
+  ea = a;
+  eb = b;
+
+  if (ea->class != eb->class) {
+    return ea->class < eb->class ? -1 : 1;
+  }
+
+  if (ea->class == KEXCOST_CLASS_MEASURED) {
+    if (ea->cost->wall_usecs != eb->cost->wall_usecs) {
+      return ea->cost->wall_usecs < eb->cost->wall_usecs ? -1 : 1;
+    }
+
+    if (ea->cost->cpu_usecs != eb->cost->cpu_usecs) {
+      return ea->cost->cpu_usecs < eb->cost->cpu_usecs ? -1 : 1;
+    }
+  }
+
+  /* Otherwise, preserve the configured order. */
+  return ea->idx < eb->idx ? -1 : (ea->idx > eb->idx ? 1 : 0);
+}
+
+const char *proxy_ssh_kexcost_reorder(pool *p, const char *algos,
+    const array_header *costs, unsigned int min_bits) {
+  register unsigned int i;
+  char *list, *ptr, *algo, *res = "";
+  array_header *entries;
+  struct kexcost_entry *elts;
+
+  if (p == NULL ||
+      algos == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  entries = make_array(p, 8, sizeof(struct kexcost_entry));
+
+  list = pstrdup(p, algos);
+  ptr = list;
+  while ((algo = strsep(&ptr, ",")) != NULL) {
+    struct kexcost_entry *entry;
+    int bits;
+
+    if (*algo == '\0') {
+      continue;
+    }
+
+    entry = push_array(entries);
+    entry->algo = algo;
+    entry->idx = entries->nelts - 1;
+    entry->cost = NULL;
+
+    bits = proxy_ssh_kexcost_get_security_bits(algo);
+    if (bits < 0) {
+      entry->class = KEXCOST_CLASS_UNKNOWN;
+
+    } else if ((unsigned int) bits < min_bits) {
+      entry->class = KEXCOST_CLASS_WEAK;
+
+    } else {
+      entry->cost = get_cost(costs, algo);
+      entry->class = entry->cost != NULL ? KEXCOST_CLASS_MEASURED :
+        KEXCOST_CLASS_UNMEASURED;
+    }
+  }
+
+  elts = entries->elts;
+  qsort(elts, entries->nelts, sizeof(struct kexcost_entry),
+    kexcost_entry_cmp);
+
+  for (i = 0; i < (unsigned int) entries->nelts; i++) {
+    res = pstrcat(p, res, *res ? "," : "", elts[i].algo, NULL);
+  }
+
+  pr_trace_msg(trace_channel, 17, "reordered key exchanges '%s' to '%s'",
+    algos, res);
+  return res;
+}
+
+void proxy_ssh_kexcost_dump(const char *backend_uri,
+    const array_header *costs) {
+  register int i;
+  struct proxy_ssh_kexcost **elts;
+
+  if (backend_uri == NULL ||
+      costs == NULL) {
+    return;
+  }
+
+  elts = costs->elts;
+  for (i = 0; i < costs->nelts; i++) {
+    if (elts[i] == NULL) {
+      continue;
+    }
+
+    pr_trace_msg(trace_channel, 9,
+      "backend '%s': key exchange '%s': wall %lu usecs, CPU %lu usecs "
+      "(%u %s)", backend_uri, elts[i]->algo, elts[i]->wall_usecs,
+      elts[i]->cpu_usecs, elts[i]->count,
+      elts[i]->count != 1 ? "samples" : "sample");
+  }
+}
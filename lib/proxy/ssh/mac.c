@@ -89,6 +89,8 @@ static size_t mac_blockszs[2] = { 0, 0 };
 static unsigned int read_mac_idx = 0;
 static unsigned int write_mac_idx = 0;
 
+static const char *trace_channel = "proxy.ssh.mac";
+
 static void clear_mac(struct proxy_ssh_mac *);
 
 static unsigned int get_next_read_index(void) {
@@ -1087,6 +1089,13 @@ int proxy_ssh_mac_init(void) {
   umac_write_ctxs[0] = NULL;
   umac_write_ctxs[1] = NULL;
 
+  /* Pick the fastest NH kernel this CPU supports for the UMAC digests. */
+  if (proxy_ssh_umac_set_impl(NULL) == 0 &&
+      proxy_ssh_umac128_set_impl(NULL) == 0) {
+    pr_trace_msg(trace_channel, 9, "using %s NH implementation for UMAC",
+      proxy_ssh_umac_get_impl());
+  }
+
   return 0;
 }
 
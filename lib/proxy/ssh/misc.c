@@ -26,65 +26,249 @@
 #include "proxy/ssh/misc.h"
 
 #if defined(PR_USE_OPENSSL)
+/* Returns the length of the name starting at the given position, i.e. up to
+ * the next comma or the end of the name-list.
+ */
+static size_t get_namelen(const char *ptr) {
+  const char *end;
+
+  end = strchr(ptr, ',');
+  if (end == NULL) {
+    return strlen(ptr);
+  }
+
+  return end - ptr;
+}
+
 int proxy_ssh_misc_namelist_contains(pool *p, const char *namelist,
     const char *name) {
-  register unsigned int i;
-  int res = FALSE;
-  pool *tmp_pool;
-  array_header *list;
-  const char **elts;
-
-  tmp_pool = make_sub_pool(p);
-  pr_pool_tag(tmp_pool, "Contains name pool");
-
-  list = pr_str_text_to_array(tmp_pool, namelist, ',');
-  elts = (const char **) list->elts;
-
-  for (i = 0; i < list->nelts; i++) {
-    if (strcmp(elts[i], name) == 0) {
-      res = TRUE;
-      break;
+  const char *ptr;
+  size_t namelen;
+
+  if (namelist == NULL ||
+      name == NULL) {
+    return FALSE;
+  }
+
+  namelen = strlen(name);
+
+  for (ptr = namelist; *ptr; ) {
+    size_t len;
+
+    len = get_namelen(ptr);
+    if (len == namelen &&
+        strncmp(ptr, name, len) == 0) {
+      return TRUE;
+    }
+
+    ptr += len;
+    if (*ptr == ',') {
+      ptr++;
     }
   }
 
-  destroy_pool(tmp_pool);
-  return res;
+  return FALSE;
 }
 
 const char *proxy_ssh_misc_namelist_shared(pool *p, const char *c2s_names,
     const char *s2c_names) {
-  register unsigned int i;
-  const char *name = NULL, **client_names, **server_names;
-  pool *tmp_pool;
-  array_header *client_list, *server_list;
+  const char *client_ptr;
+
+  if (c2s_names == NULL ||
+      s2c_names == NULL) {
+    return NULL;
+  }
+
+  for (client_ptr = c2s_names; *client_ptr; ) {
+    const char *server_ptr;
+    size_t client_len;
+
+    pr_signals_handle();
+
+    client_len = get_namelen(client_ptr);
+
+    for (server_ptr = s2c_names; client_len > 0 && *server_ptr; ) {
+      size_t server_len;
+
+      server_len = get_namelen(server_ptr);
+      if (server_len == client_len &&
+          strncmp(client_ptr, server_ptr, client_len) == 0) {
+        return pstrndup(p, client_ptr, client_len);
+      }
+
+      server_ptr += server_len;
+      if (*server_ptr == ',') {
+        server_ptr++;
+      }
+    }
+
+    client_ptr += client_len;
+    if (*client_ptr == ',') {
+      client_ptr++;
+    }
+  }
+
+  return NULL;
+}
+
+/* Algorithm names in the same family tend to share long prefixes (e.g.
+ * "aes128-ctr", "aes256-ctr"), so rather than hashing every byte, we mix the
+ * length with a few bytes from the start, middle, and end of the name; the
+ * probing resolves any collisions.
+ */
+static unsigned int namelist_hash(const char *name, size_t namelen) {
+  unsigned int h;
+
+  if (namelen == 0) {
+    return 0;
+  }
+
+  h = (unsigned int) namelen;
+  h = (h * 31) + (unsigned char) name[0];
+  h = (h * 31) + (unsigned char) name[namelen / 2];
+  h = (h * 31) + (unsigned char) name[namelen - 1];
+  h ^= (h >> 7);
+
+  return h;
+}
+
+static int namelist_lookup(const struct proxy_ssh_namelist *list,
+    const char *name, size_t namelen) {
+  unsigned int idx;
 
-  tmp_pool = make_sub_pool(p);
-  pr_pool_tag(tmp_pool, "Share name pool");
+  /* Most names not in the list can be rejected by length alone. */
+  if (!(list->lenmask & (1U << (namelen % 32)))) {
+    return -1;
+  }
+
+  idx = namelist_hash(name, namelen) & (list->idsz - 1);
+  while (list->ids[idx] != 0) {
+    unsigned int id;
+
+    id = list->ids[idx] - 1;
+    if (list->lens[id] == namelen &&
+        memcmp(list->elts[id], name, namelen) == 0) {
+      return (int) id;
+    }
+
+    idx = (idx + 1) & (list->idsz - 1);
+  }
 
-  client_list = pr_str_text_to_array(tmp_pool, c2s_names, ',');
-  client_names = (const char **) client_list->elts;
+  return -1;
+}
 
-  server_list = pr_str_text_to_array(tmp_pool, s2c_names, ',');
-  server_names = (const char **) server_list->elts;
+struct proxy_ssh_namelist *proxy_ssh_misc_namelist_compile(pool *p,
+    const char *names) {
+  struct proxy_ssh_namelist *list;
+  const char *ptr;
+  unsigned int count;
 
-  for (i = 0; i < client_list->nelts; i++) {
-    register unsigned int j;
+  if (p == NULL ||
+      names == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
 
-    if (name != NULL) {
-      break;
+  list = pcalloc(p, sizeof(struct proxy_ssh_namelist));
+  list->names = pstrdup(p, names);
+
+  /* An upper bound on the number of names, for sizing our tables. */
+  count = 1;
+  for (ptr = names; *ptr; ptr++) {
+    if (*ptr == ',') {
+      count++;
     }
+  }
 
-    for (j = 0; j < server_list->nelts; j++) {
-      if (strcmp(client_names[i], server_names[j]) == 0) {
-        name = client_names[i];
-        break;
+  list->elts = pcalloc(p, count * sizeof(const char *));
+  list->lens = pcalloc(p, count * sizeof(size_t));
+
+  for (list->idsz = 8; list->idsz < (count * 2); list->idsz *= 2);
+  list->ids = pcalloc(p, list->idsz * sizeof(unsigned int));
+
+  for (ptr = list->names; *ptr; ) {
+    size_t len;
+
+    len = get_namelen(ptr);
+    if (len > 0 &&
+        namelist_lookup(list, ptr, len) < 0) {
+      unsigned int idx;
+
+      idx = namelist_hash(ptr, len) & (list->idsz - 1);
+      while (list->ids[idx] != 0) {
+        idx = (idx + 1) & (list->idsz - 1);
       }
+
+      list->elts[list->count] = pstrndup(p, ptr, len);
+      list->lens[list->count] = len;
+      list->lenmask |= (1U << (len % 32));
+      list->ids[idx] = ++list->count;
+    }
+
+    ptr += len;
+    if (*ptr == ',') {
+      ptr++;
     }
   }
 
-  name = pstrdup(p, name);
-  destroy_pool(tmp_pool);
+  return list;
+}
+
+int proxy_ssh_misc_namelist_get_id(const struct proxy_ssh_namelist *list,
+    const char *name, size_t namelen) {
+  int id;
+
+  if (list == NULL ||
+      name == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  id = namelist_lookup(list, name, namelen);
+  if (id < 0) {
+    errno = ENOENT;
+  }
+
+  return id;
+}
+
+int proxy_ssh_misc_namelist_negotiate(const struct proxy_ssh_namelist *list,
+    const char *names) {
+  const char *ptr;
+  int best_id = -1;
+
+  if (list == NULL ||
+      names == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Our list is the client's list, and thus its order decides: we want the
+   * lowest of our IDs among the names the server sent.
+   */
+  for (ptr = names; *ptr && best_id != 0; ) {
+    size_t len;
+    int id;
+
+    len = get_namelen(ptr);
+    if (len > 0) {
+      id = namelist_lookup(list, ptr, len);
+      if (id >= 0 &&
+          (best_id < 0 || id < best_id)) {
+        best_id = id;
+      }
+    }
+
+    ptr += len;
+    if (*ptr == ',') {
+      ptr++;
+    }
+  }
+
+  if (best_id < 0) {
+    errno = ENOENT;
+  }
 
-  return name;
+  return best_id;
 }
 #endif /* PR_USE_OPENSSL */
@@ -43,7 +43,7 @@ static const char *trace_channel = "proxy.ssh.msg";
 static conn_t *get_backend_conn(void) {
   const struct proxy_session *proxy_sess;
 
-  proxy_sess = pr_table_get(session.notes, "mod_proxy.proxy-session", NULL);
+  proxy_sess = proxy_session_get_current();
   if (proxy_sess == NULL) {
     return NULL;
   }
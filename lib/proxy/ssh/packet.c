@@ -25,6 +25,7 @@
 #include "mod_proxy.h"
 #include "proxy/ssh/ssh2.h"
 #include "proxy/ssh/packet.h"
+#include "proxy/ssh/pktlog.h"
 #include "proxy/ssh/msg.h"
 #include "proxy/ssh/disconnect.h"
 #include "proxy/ssh/cipher.h"
@@ -414,11 +415,27 @@ static const char *get_msg_cmd_desc(unsigned char msg_type) {
 }
 
 void proxy_ssh_packet_log_cmd(struct proxy_ssh_packet *pkt, int from_frontend) {
+  unsigned char msg_type;
   cmd_rec *cmd;
   const char *pkt_cmd, *pkt_note, *pkt_note_text;
 
+  msg_type = proxy_ssh_packet_peek_msg_type(pkt);
+  if (proxy_ssh_pktlog_want_msg_type(msg_type) == FALSE) {
+    return;
+  }
+
   /* Get a short version of the packet type for our cmd_rec/logging. */
-  pkt_cmd = get_msg_cmd_desc(proxy_ssh_packet_peek_msg_type(pkt));
+  pkt_cmd = get_msg_cmd_desc(msg_type);
+
+  cmd = proxy_ssh_pktlog_get_cmd(msg_type, pkt_cmd, from_frontend);
+  if (cmd != NULL) {
+    pr_cmd_dispatch_phase(cmd, LOG_CMD, 0);
+    return;
+  }
+
+  /* Packet logging has not been set up for this session, so we fall back
+   * to a single-use cmd_rec.
+   */
 
   /* XXX What to use as the cmd_rec arg?  channel ID for CHANNEL_ commands;
    * what else?  Or maybe just hardcode "-" for now?
@@ -1944,7 +1961,7 @@ int proxy_ssh_packet_handle(void *data) {
   unsigned char msg_type;
   int from_frontend = FALSE;
 
-  proxy_sess = pr_table_get(session.notes, "mod_proxy.proxy-session", NULL);
+  proxy_sess = proxy_session_get_current();
   if (proxy_sess == NULL) {
     /* Unlikely to occur. */
     errno = EPERM;
@@ -0,0 +1,370 @@
+/*
+ * ProFTPD - mod_proxy SSH packet logging
+ * Copyright (c) 2026 TJ Saunders
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+
+#include "mod_proxy.h"
+
+#include "proxy/ssh/ssh2.h"
+#include "proxy/ssh/pktlog.h"
+
+static pool *pktlog_pool = NULL;
+static int pktlog_policy = PROXY_SSH_PKTLOG_POLICY_ALL;
+static unsigned int pktlog_sample_rate = 0, pktlog_sample_count = 0;
+
+/* Bitmask of the message types to be logged; only consulted once a message
+ * type has been explicitly configured.
+ */
+static unsigned char pktlog_msg_types[32];
+static int pktlog_have_msg_types = FALSE;
+
+/* The reusable cmd_recs, indexed by message type and direction, and the
+ * pools in which they were allocated.  A cmd_rec's cmd->pool (and tmp_pool)
+ * is a subpool of the latter, kept for a number of dispatches, so that what
+ * the LOG_CMD handlers allocate from it is released regularly, without
+ * creating pools for every packet.
+ */
+static cmd_rec **pktlog_cmds = NULL;
+static pool **pktlog_cmd_pools = NULL;
+static unsigned int *pktlog_cmd_uses = NULL;
+#define PROXY_SSH_PKTLOG_NCMDS			(256 * 2)
+#define PROXY_SSH_PKTLOG_CMD_POOL_MAX_USES	256
+
+static const char *pktlog_direction_note = "proxy.ssh.direction";
+
+static const char *trace_channel = "proxy.ssh.pktlog";
+
+static const char *pktlog_policy_name(int policy) {
+  switch (policy) {
+    case PROXY_SSH_PKTLOG_POLICY_ALL:
+      return "all";
+
+    case PROXY_SSH_PKTLOG_POLICY_NONE:
+      return "none";
+
+    case PROXY_SSH_PKTLOG_POLICY_AUTO:
+      return "auto";
+
+    default:
+      break;
+  }
+
+  return "unknown";
+}
+
+/* ExtendedLog command classes are a comma-separated list of class names,
+ * each of which may be negated with a '!' prefix; no list means "ALL".  We
+ * only care whether the classes of our packet cmd_recs survive.
+ */
+static int pktlog_classes_want_ssh(pool *p, const char *classes) {
+  int logged = 0;
+  char *ptr, *class;
+
+  if (classes == NULL) {
+    return TRUE;
+  }
+
+  ptr = pstrdup(p, classes);
+
+  class = pr_str_get_token(&ptr, (char *) ",");
+  while (class != NULL) {
+    int negated = FALSE, mask = 0;
+
+    pr_signals_handle();
+
+    while (PR_ISSPACE(*class)) {
+      class++;
+    }
+
+    if (*class == '!') {
+      negated = TRUE;
+      class++;
+    }
+
+    if (strcasecmp(class, "ALL") == 0) {
+      mask = CL_MISC|CL_SSH;
+
+    } else if (strcasecmp(class, "NONE") == 0) {
+      /* "NONE" is the same as "!ALL". */
+      mask = CL_MISC|CL_SSH;
+      negated = !negated;
+
+    } else if (strcasecmp(class, "MISC") == 0) {
+      mask = CL_MISC;
+
+    } else if (strcasecmp(class, "SSH") == 0) {
+      mask = CL_SSH;
+    }
+
+    if (negated == TRUE) {
+      logged &= ~mask;
+
+    } else {
+      logged |= mask;
+    }
+
+    class = pr_str_get_token(&ptr, (char *) ",");
+  }
+
+  return logged != 0 ? TRUE : FALSE;
+}
+
+int proxy_ssh_pktlog_have_extendedlog(server_rec *s) {
+  config_rec *c;
+  pool *tmp_pool;
+  int have_log = FALSE;
+
+  if (s == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  tmp_pool = make_sub_pool(s->pool);
+
+  /* The ExtendedLog parameters are: path, [classes, [format name]]. */
+  c = find_config(s->conf, CONF_PARAM, "ExtendedLog", TRUE);
+  while (c != NULL) {
+    const char *classes = NULL;
+
+    pr_signals_handle();
+
+    if (c->argc > 1) {
+      classes = c->argv[1];
+    }
+
+    if (pktlog_classes_want_ssh(tmp_pool, classes) == TRUE) {
+      pr_trace_msg(trace_channel, 17,
+        "ExtendedLog '%s' (classes %s) logs SSH commands",
+        (const char *) c->argv[0], classes ? classes : "ALL");
+      have_log = TRUE;
+      break;
+    }
+
+    c = find_config_next(c, c->next, CONF_PARAM, "ExtendedLog", TRUE);
+  }
+
+  destroy_pool(tmp_pool);
+  return have_log;
+}
+
+int proxy_ssh_pktlog_set_msg_type(unsigned char msg_type, int enabled) {
+  if (enabled != TRUE &&
+      enabled != FALSE) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (pktlog_have_msg_types == FALSE) {
+    memset(pktlog_msg_types, 0, sizeof(pktlog_msg_types));
+    pktlog_have_msg_types = TRUE;
+  }
+
+  if (enabled == TRUE) {
+    pktlog_msg_types[msg_type / 8] |= (1 << (msg_type % 8));
+
+  } else {
+    pktlog_msg_types[msg_type / 8] &= ~(1 << (msg_type % 8));
+  }
+
+  return 0;
+}
+
+int proxy_ssh_pktlog_want_msg_type(unsigned char msg_type) {
+  if (pktlog_policy == PROXY_SSH_PKTLOG_POLICY_NONE) {
+    return FALSE;
+  }
+
+  if (pktlog_have_msg_types == TRUE &&
+      !(pktlog_msg_types[msg_type / 8] & (1 << (msg_type % 8)))) {
+    return FALSE;
+  }
+
+  switch (msg_type) {
+    case PROXY_SSH_MSG_CHANNEL_WINDOW_ADJUST:
+    case PROXY_SSH_MSG_CHANNEL_DATA:
+    case PROXY_SSH_MSG_CHANNEL_EXTENDED_DATA:
+      if (pktlog_sample_rate > 1) {
+        unsigned int count;
+
+        count = pktlog_sample_count++;
+        if (pktlog_sample_count == pktlog_sample_rate) {
+          pktlog_sample_count = 0;
+        }
+
+        if (count != 0) {
+          return FALSE;
+        }
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
+cmd_rec *proxy_ssh_pktlog_get_cmd(unsigned char msg_type, const char *name,
+    int from_frontend) {
+  cmd_rec *cmd;
+  unsigned int idx;
+
+  if (name == NULL) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if (pktlog_pool == NULL) {
+    errno = EPERM;
+    return NULL;
+  }
+
+  idx = (msg_type * 2) + (from_frontend == TRUE ? 1 : 0);
+  cmd = pktlog_cmds[idx];
+
+  if (cmd == NULL) {
+    cmd = pr_cmd_alloc(pktlog_pool, 1, pstrdup(pktlog_pool, name));
+    cmd->arg = pstrdup(cmd->pool, "-");
+    cmd->cmd_class = CL_MISC|CL_SSH;
+
+    pktlog_cmds[idx] = cmd;
+    pktlog_cmd_pools[idx] = cmd->pool;
+    pktlog_cmd_uses[idx] = 0;
+
+  } else {
+    cmd->stash_index = -1;
+    cmd->stash_hash = 0;
+  }
+
+  if (pktlog_cmd_uses[idx] == 0) {
+    if (cmd->pool != pktlog_cmd_pools[idx]) {
+      /* Its tmp_pool is a subpool of this one. */
+      destroy_pool(cmd->pool);
+    }
+
+    cmd->pool = make_sub_pool(pktlog_cmd_pools[idx]);
+    pr_pool_tag(cmd->pool, "SSH packet log cmd_rec pool");
+
+    cmd->tmp_pool = make_sub_pool(cmd->pool);
+    pr_pool_tag(cmd->tmp_pool, "SSH packet log cmd_rec tmp pool");
+  }
+
+  pktlog_cmd_uses[idx]++;
+  if (pktlog_cmd_uses[idx] == PROXY_SSH_PKTLOG_CMD_POOL_MAX_USES) {
+    pktlog_cmd_uses[idx] = 0;
+  }
+
+  /* The only note we expect is the one indicating the destination/target
+   * for this packet, be it "frontend" or "backend", which is the same for
+   * every dispatch of this cmd_rec.  Discard any notes left by the previous
+   * dispatch.
+   */
+  if (pr_table_count(cmd->notes) != 1) {
+    (void) pr_table_empty(cmd->notes);
+
+    if (pr_table_add(cmd->notes, pktlog_direction_note,
+        from_frontend == TRUE ? "backend" : "frontend", 0) < 0) {
+      int xerrno = errno;
+
+      if (xerrno != EEXIST) {
+        pr_trace_msg(trace_channel, 8,
+          "error setting '%s' note: %s", pktlog_direction_note,
+          strerror(xerrno));
+      }
+    }
+  }
+
+  return cmd;
+}
+
+int proxy_ssh_pktlog_init(pool *p, server_rec *s, int policy,
+    unsigned int sample_rate) {
+  if (p == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  switch (policy) {
+    case PROXY_SSH_PKTLOG_POLICY_ALL:
+    case PROXY_SSH_PKTLOG_POLICY_NONE:
+      break;
+
+    case PROXY_SSH_PKTLOG_POLICY_AUTO:
+      if (s == NULL) {
+        errno = EINVAL;
+        return -1;
+      }
+
+      if (proxy_ssh_pktlog_have_extendedlog(s) == TRUE) {
+        policy = PROXY_SSH_PKTLOG_POLICY_ALL;
+
+      } else {
+        policy = PROXY_SSH_PKTLOG_POLICY_NONE;
+      }
+      break;
+
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  if (pktlog_pool != NULL) {
+    destroy_pool(pktlog_pool);
+  }
+
+  pktlog_pool = make_sub_pool(p);
+  pr_pool_tag(pktlog_pool, "Proxy SSH packet log pool");
+
+  pktlog_cmds = pcalloc(pktlog_pool,
+    PROXY_SSH_PKTLOG_NCMDS * sizeof(cmd_rec *));
+  pktlog_cmd_pools = pcalloc(pktlog_pool,
+    PROXY_SSH_PKTLOG_NCMDS * sizeof(pool *));
+  pktlog_cmd_uses = pcalloc(pktlog_pool,
+    PROXY_SSH_PKTLOG_NCMDS * sizeof(unsigned int));
+
+  pktlog_policy = policy;
+  pktlog_sample_rate = sample_rate;
+  pktlog_sample_count = 0;
+  pktlog_have_msg_types = FALSE;
+
+  pr_trace_msg(trace_channel, 9,
+    "logging SSH packets using '%s' policy, sample rate %u",
+    pktlog_policy_name(policy), sample_rate);
+  return 0;
+}
+
+int proxy_ssh_pktlog_free(void) {
+  if (pktlog_pool != NULL) {
+    destroy_pool(pktlog_pool);
+    pktlog_pool = NULL;
+  }
+
+  pktlog_cmds = NULL;
+  pktlog_cmd_pools = NULL;
+  pktlog_cmd_uses = NULL;
+  pktlog_policy = PROXY_SSH_PKTLOG_POLICY_ALL;
+  pktlog_sample_rate = pktlog_sample_count = 0;
+  pktlog_have_msg_types = FALSE;
+
+  return 0;
+}
@@ -217,6 +217,132 @@ static const unsigned char *ssh_redis_get_hostkey(pool *p, void *dsh,
   return hostkey_data;
 }
 
+static char *make_kexcosts_key(pool *p, const char *backend_uri) {
+  char *key;
+  size_t keysz;
+
+  keysz = strlen(backend_uri) + 64;
+  key = pcalloc(p, keysz + 1);
+  snprintf(key, keysz, "proxy_ssh_kexcosts:%s", backend_uri);
+
+  return key;
+}
+
+static array_header *ssh_redis_get_kexcosts(pool *p, void *dsh,
+    unsigned int vhost_id, const char *backend_uri) {
+  int res, xerrno;
+  pool *tmp_pool;
+  pr_redis_t *redis;
+  pr_table_t *kexcost_tab;
+  char *key;
+  const void *field;
+  size_t fieldlen = 0;
+  array_header *costs;
+
+  redis = dsh;
+
+  tmp_pool = make_sub_pool(p);
+  key = make_kexcosts_key(tmp_pool, backend_uri);
+
+  res = pr_redis_hash_getall(tmp_pool, redis, &proxy_module, key,
+    &kexcost_tab);
+  xerrno = errno;
+
+  if (res < 0) {
+    if (xerrno != ENOENT) {
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error getting hash from Redis '%s': %s", key, strerror(xerrno));
+    }
+
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return NULL;
+  }
+
+  if (kexcost_tab == NULL) {
+    destroy_pool(tmp_pool);
+    errno = ENOENT;
+    return NULL;
+  }
+
+  /* Each field is an algorithm; each value is "wall_usecs cpu_usecs count". */
+  costs = make_array(p, 0, sizeof(struct proxy_ssh_kexcost *));
+
+  (void) pr_table_rewind(kexcost_tab);
+  field = pr_table_knext(kexcost_tab, &fieldlen);
+  while (field != NULL) {
+    const void *data;
+    size_t datalen = 0;
+
+    pr_signals_handle();
+
+    data = pr_table_kget(kexcost_tab, field, fieldlen, &datalen);
+    if (data != NULL) {
+      struct proxy_ssh_kexcost *cost;
+      char *text;
+
+      cost = pcalloc(p, sizeof(struct proxy_ssh_kexcost));
+      cost->algo = pstrndup(p, field, fieldlen);
+
+      text = pstrndup(tmp_pool, data, datalen);
+      if (sscanf(text, "%lu %lu %u", &(cost->wall_usecs), &(cost->cpu_usecs),
+          &(cost->count)) == 3) {
+        *((struct proxy_ssh_kexcost **) push_array(costs)) = cost;
+
+      } else {
+        pr_trace_msg(trace_channel, 3,
+          "ignoring malformed key exchange cost '%s' for '%s' in Redis hash "
+          "'%s'", text, cost->algo, key);
+      }
+    }
+
+    field = pr_table_knext(kexcost_tab, &fieldlen);
+  }
+
+  destroy_pool(tmp_pool);
+
+  pr_trace_msg(trace_channel, 19,
+    "retrieved %d key exchange costs for vhost ID %u, URI '%s'", costs->nelts,
+    vhost_id, backend_uri);
+  return costs;
+}
+
+static int ssh_redis_set_kexcost(pool *p, void *dsh, unsigned int vhost_id,
+    const char *backend_uri, const struct proxy_ssh_kexcost *cost) {
+  int res, xerrno = 0;
+  pool *tmp_pool;
+  pr_redis_t *redis;
+  char *key, *data;
+  size_t datasz;
+
+  redis = dsh;
+
+  tmp_pool = make_sub_pool(p);
+  key = make_kexcosts_key(tmp_pool, backend_uri);
+
+  datasz = 64;
+  data = pcalloc(tmp_pool, datasz);
+  snprintf(data, datasz - 1, "%lu %lu %u", cost->wall_usecs, cost->cpu_usecs,
+    cost->count);
+
+  res = pr_redis_hash_set(redis, &proxy_module, key, cost->algo, data,
+    strlen(data));
+  xerrno = errno;
+
+  if (res < 0) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error setting value for field '%s' in Redis hash '%s': %s",
+      cost->algo, key, strerror(xerrno));
+
+    destroy_pool(tmp_pool);
+    errno = xerrno;
+    return -1;
+  }
+
+  destroy_pool(tmp_pool);
+  return 0;
+}
+
 /* Initialization routines */
 
 static int ssh_redis_init(pool *p, const char *tables_path, int flags) {
@@ -273,6 +399,9 @@ int proxy_ssh_redis_as_datastore(struct proxy_ssh_datastore *ds, void *ds_data,
   ds->hostkey_get = ssh_redis_get_hostkey;
   ds->hostkey_update = ssh_redis_update_hostkey;
 
+  ds->kexcosts_get = ssh_redis_get_kexcosts;
+  ds->kexcost_set = ssh_redis_set_kexcost;
+
   ds->init = ssh_redis_init;
   ds->open = ssh_redis_open;
   ds->close = ssh_redis_close;
@@ -552,6 +552,265 @@ static void nh_aux(void *kp, const void *dp, void *hp, UINT32 dlen)
 #endif  /* UMAC_OUTPUT_LENGTH */
 /* ---------------------------------------------------------------------- */
 
+/* ---------------------------------------------------------------------- */
+/* ----- Wide-word NH kernels ------------------------------------------- */
+/* ---------------------------------------------------------------------- */
+
+/* These compute exactly the same NH hash as the nh_aux() above, for any
+ * number of STREAMS, but use vector multiplies of the (key + data) word
+ * pairs.  Word i of the 32-byte block is paired with word i+4, so each
+ * half-block is one vector; stream s uses the key shifted by 4*s words.
+ * Sums are accumulated in 64-bit lanes and folded into the state at the
+ * end, which is equivalent modulo 2^64.  The scalar nh_aux() remains the
+ * fallback; the kernel is chosen at runtime via proxy_ssh_umac_set_impl().
+ */
+
+#if (__LITTLE_ENDIAN__) && !defined(PROXY_SSH_UMAC_NO_SIMD)
+# if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#  include <immintrin.h>
+#  define UMAC_HAVE_NH_SSE2	1
+#  if defined(__clang__) || \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#   define UMAC_HAVE_NH_AVX2	1
+#  endif
+# elif defined(__aarch64__) && defined(__ARM_NEON)
+#  include <arm_neon.h>
+#  define UMAC_HAVE_NH_NEON	1
+# endif
+#endif
+
+#if defined(UMAC_HAVE_NH_SSE2)
+static void nh_aux_sse2(void *kp, const void *dp, void *hp, UINT32 dlen)
+{
+    UWORD c = dlen / 32;
+    const UINT8 *k = (const UINT8 *)kp;
+    const UINT8 *d = (const UINT8 *)dp;
+    UINT64 *h = (UINT64 *)hp;
+    UINT64 sums[2];
+    __m128i acc[STREAMS];
+    int s;
+
+    for (s = 0; s < STREAMS; s++)
+        acc[s] = _mm_setzero_si128();
+
+    while (c--) {
+        __m128i d_lo, d_hi;
+
+        d_lo = _mm_loadu_si128((const __m128i *)d);
+        d_hi = _mm_loadu_si128((const __m128i *)(d + 16));
+
+        for (s = 0; s < STREAMS; s++) {
+            __m128i a, b;
+
+            a = _mm_add_epi32(d_lo,
+                _mm_loadu_si128((const __m128i *)(k + (16 * s))));
+            b = _mm_add_epi32(d_hi,
+                _mm_loadu_si128((const __m128i *)(k + (16 * s) + 16)));
+
+            /* Words 0 and 2, then words 1 and 3. */
+            acc[s] = _mm_add_epi64(acc[s], _mm_mul_epu32(a, b));
+            acc[s] = _mm_add_epi64(acc[s], _mm_mul_epu32(
+                _mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)));
+        }
+
+        d += 32;
+        k += 32;
+    }
+
+    for (s = 0; s < STREAMS; s++) {
+        _mm_storeu_si128((__m128i *)sums, acc[s]);
+        h[s] += sums[0] + sums[1];
+    }
+}
+#endif /* UMAC_HAVE_NH_SSE2 */
+
+#if defined(UMAC_HAVE_NH_AVX2)
+/* Same as nh_aux_sse2(), but handling two 32-byte blocks per iteration. */
+__attribute__((target("avx2")))
+static void nh_aux_avx2(void *kp, const void *dp, void *hp, UINT32 dlen)
+{
+    UWORD c = dlen / 32;
+    const UINT8 *k = (const UINT8 *)kp;
+    const UINT8 *d = (const UINT8 *)dp;
+    UINT64 *h = (UINT64 *)hp;
+    UINT64 sums[2];
+    __m256i acc[STREAMS];
+    __m128i acc128[STREAMS];
+    int s;
+
+    for (s = 0; s < STREAMS; s++)
+        acc[s] = _mm256_setzero_si256();
+
+    for (; c >= 2; c -= 2) {
+        __m256i d_lo, d_hi;
+
+        /* Lower lanes from the first block, upper lanes from the second. */
+        d_lo = _mm256_inserti128_si256(_mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i *)d)),
+            _mm_loadu_si128((const __m128i *)(d + 32)), 1);
+        d_hi = _mm256_inserti128_si256(_mm256_castsi128_si256(
+            _mm_loadu_si128((const __m128i *)(d + 16))),
+            _mm_loadu_si128((const __m128i *)(d + 48)), 1);
+
+        for (s = 0; s < STREAMS; s++) {
+            __m256i a, b;
+            const UINT8 *ks = k + (16 * s);
+
+            a = _mm256_add_epi32(d_lo, _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)ks)),
+                _mm_loadu_si128((const __m128i *)(ks + 32)), 1));
+            b = _mm256_add_epi32(d_hi, _mm256_inserti128_si256(
+                _mm256_castsi128_si256(
+                    _mm_loadu_si128((const __m128i *)(ks + 16))),
+                _mm_loadu_si128((const __m128i *)(ks + 48)), 1));
+
+            acc[s] = _mm256_add_epi64(acc[s], _mm256_mul_epu32(a, b));
+            acc[s] = _mm256_add_epi64(acc[s], _mm256_mul_epu32(
+                _mm256_srli_epi64(a, 32), _mm256_srli_epi64(b, 32)));
+        }
+
+        d += 64;
+        k += 64;
+    }
+
+    for (s = 0; s < STREAMS; s++) {
+        acc128[s] = _mm_add_epi64(_mm256_castsi256_si128(acc[s]),
+            _mm256_extracti128_si256(acc[s], 1));
+    }
+
+    if (c) {
+        /* One trailing block. */
+        __m128i d_lo, d_hi;
+
+        d_lo = _mm_loadu_si128((const __m128i *)d);
+        d_hi = _mm_loadu_si128((const __m128i *)(d + 16));
+
+        for (s = 0; s < STREAMS; s++) {
+            __m128i a, b;
+
+            a = _mm_add_epi32(d_lo,
+                _mm_loadu_si128((const __m128i *)(k + (16 * s))));
+            b = _mm_add_epi32(d_hi,
+                _mm_loadu_si128((const __m128i *)(k + (16 * s) + 16)));
+
+            acc128[s] = _mm_add_epi64(acc128[s], _mm_mul_epu32(a, b));
+            acc128[s] = _mm_add_epi64(acc128[s], _mm_mul_epu32(
+                _mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32)));
+        }
+    }
+
+    for (s = 0; s < STREAMS; s++) {
+        _mm_storeu_si128((__m128i *)sums, acc128[s]);
+        h[s] += sums[0] + sums[1];
+    }
+}
+#endif /* UMAC_HAVE_NH_AVX2 */
+
+#if defined(UMAC_HAVE_NH_NEON)
+static void nh_aux_neon(void *kp, const void *dp, void *hp, UINT32 dlen)
+{
+    UWORD c = dlen / 32;
+    const UINT8 *k = (const UINT8 *)kp;
+    const UINT8 *d = (const UINT8 *)dp;
+    UINT64 *h = (UINT64 *)hp;
+    uint64x2_t acc[STREAMS];
+    int s;
+
+    for (s = 0; s < STREAMS; s++)
+        acc[s] = vdupq_n_u64(0);
+
+    while (c--) {
+        uint32x4_t d_lo, d_hi;
+
+        d_lo = vreinterpretq_u32_u8(vld1q_u8(d));
+        d_hi = vreinterpretq_u32_u8(vld1q_u8(d + 16));
+
+        for (s = 0; s < STREAMS; s++) {
+            uint32x4_t a, b;
+
+            a = vaddq_u32(d_lo, vreinterpretq_u32_u8(vld1q_u8(k + (16 * s))));
+            b = vaddq_u32(d_hi,
+                vreinterpretq_u32_u8(vld1q_u8(k + (16 * s) + 16)));
+
+            acc[s] = vmlal_u32(acc[s], vget_low_u32(a), vget_low_u32(b));
+            acc[s] = vmlal_u32(acc[s], vget_high_u32(a), vget_high_u32(b));
+        }
+
+        d += 32;
+        k += 32;
+    }
+
+    for (s = 0; s < STREAMS; s++)
+        h[s] += vgetq_lane_u64(acc[s], 0) + vgetq_lane_u64(acc[s], 1);
+}
+#endif /* UMAC_HAVE_NH_NEON */
+
+static void (*nh_aux_impl)(void *, const void *, void *, UINT32) = nh_aux;
+static const char *nh_aux_impl_name = "scalar";
+
+int proxy_ssh_umac_set_impl(const char *name)
+/* Select the named NH kernel ("scalar", "sse2", "avx2", or "neon"), or,
+ * given NULL, the fastest one supported by this CPU.  Returns -1, with
+ * errno set to ENOENT, for an unknown or unsupported kernel.
+ */
+{
+    if (name == NULL) {
+#if defined(UMAC_HAVE_NH_AVX2)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+            return proxy_ssh_umac_set_impl("avx2");
+#endif
+#if defined(UMAC_HAVE_NH_SSE2)
+        return proxy_ssh_umac_set_impl("sse2");
+#elif defined(UMAC_HAVE_NH_NEON)
+        return proxy_ssh_umac_set_impl("neon");
+#else
+        return proxy_ssh_umac_set_impl("scalar");
+#endif
+    }
+
+    if (strcmp(name, "scalar") == 0) {
+        nh_aux_impl = nh_aux;
+        nh_aux_impl_name = "scalar";
+        return (0);
+    }
+
+#if defined(UMAC_HAVE_NH_SSE2)
+    if (strcmp(name, "sse2") == 0) {
+        nh_aux_impl = nh_aux_sse2;
+        nh_aux_impl_name = "sse2";
+        return (0);
+    }
+#endif
+
+#if defined(UMAC_HAVE_NH_AVX2)
+    if (strcmp(name, "avx2") == 0) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            nh_aux_impl = nh_aux_avx2;
+            nh_aux_impl_name = "avx2";
+            return (0);
+        }
+    }
+#endif
+
+#if defined(UMAC_HAVE_NH_NEON)
+    if (strcmp(name, "neon") == 0) {
+        nh_aux_impl = nh_aux_neon;
+        nh_aux_impl_name = "neon";
+        return (0);
+    }
+#endif
+
+    errno = ENOENT;
+    return (-1);
+}
+
+const char *proxy_ssh_umac_get_impl(void)
+{
+    return (nh_aux_impl_name);
+}
+
 
 /* ---------------------------------------------------------------------- */
 
@@ -565,7 +824,7 @@ static void nh_transform(nh_ctx *hc, const UINT8 *buf, UINT32 nbytes)
     UINT8 *key;
   
     key = hc->nh_key + hc->bytes_hashed;
-    nh_aux(key, buf, hc->state, nbytes);
+    nh_aux_impl(key, buf, hc->state, nbytes);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -748,7 +1007,7 @@ static void nh(nh_ctx *hc, const UINT8 *buf, UINT32 padded_len,
     ((UINT64 *)result)[3] = nbits;
 #endif
     
-    nh_aux(hc->nh_key, buf, result, padded_len);
+    nh_aux_impl(hc->nh_key, buf, result, padded_len);
 }
 
 /* ---------------------------------------------------------------------- */
@@ -1258,6 +1517,17 @@ int proxy_ssh_umac_update(struct umac_ctx *ctx, const unsigned char *input, long
     return (0);
 }
 
+int proxy_ssh_umac_set_impl(const char *name)
+{
+    errno = ENOSYS;
+    return (-1);
+}
+
+const char *proxy_ssh_umac_get_impl(void)
+{
+    return (NULL);
+}
+
 #endif /* OpenSSL-0.9.7 or later */
 
 /* ---------------------------------------------------------------------- */
@@ -35,5 +35,7 @@
 #define proxy_ssh_umac_final	proxy_ssh_umac128_final
 #define proxy_ssh_umac_delete	proxy_ssh_umac128_delete
 #define proxy_ssh_umac_ctx	proxy_ssh_umac128_ctx
+#define proxy_ssh_umac_set_impl	proxy_ssh_umac128_set_impl
+#define proxy_ssh_umac_get_impl	proxy_ssh_umac128_get_impl
 
 #include "umac.c"
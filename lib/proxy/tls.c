@@ -102,6 +102,46 @@ static int handshake_timed_out = FALSE;
 
 #define PROXY_TLS_SHUTDOWN_BIDIRECTIONAL	0x001
 
+/* ProxyTLSBufferPolicy, per connection role.  By default, control
+ * connections release their record buffers when idle, and data connections
+ * keep them, reading ahead.
+ */
+struct tls_buffer_policy {
+  int policy;
+  size_t read_buflen;
+};
+
+static struct tls_buffer_policy tls_buffer_policies[2] = {
+  { PROXY_TLS_BUFFER_POLICY_RELEASE, 0 },
+  { PROXY_TLS_BUFFER_POLICY_READ_AHEAD, PROXY_TLS_DEFAULT_READ_BUFFER_LEN }
+};
+
+/* ProxyTLSShutdownPolicy */
+static int tls_shutdown_policy = PROXY_TLS_SHUTDOWN_POLICY_DEFERRED;
+static unsigned int tls_shutdown_linger_ms = PROXY_TLS_DEFAULT_SHUTDOWN_LINGER_MS;
+
+/* Data connections whose TLS shutdown has been deferred, awaiting the
+ * server's 'close_notify'.  Each holds a duplicate of the connection's fd,
+ * so that the socket stays open after the connection itself is closed.
+ */
+struct tls_deferred_shutdown {
+  SSL *ssl;
+  int fd;
+  int sent_shutdown;
+  uint64_t expires_ms;
+};
+
+static struct tls_deferred_shutdown
+  tls_deferred_shutdowns[PROXY_TLS_MAX_DEFERRED_SHUTDOWNS];
+static unsigned int tls_deferred_count = 0;
+static int tls_deferred_timer_id = -1;
+
+/* The streams of the current backend data connection, both of which carry
+ * its SSL in their notes.
+ */
+static pr_netio_stream_t *tls_data_rd_nstrm = NULL;
+static pr_netio_stream_t *tls_data_wr_nstrm = NULL;
+
 /* Stream notes */
 #define PROXY_TLS_NETIO_NOTE			"mod_proxy.SSL"
 #define PROXY_TLS_ADAPTIVE_BYTES_COUNT_KEY	"mod_proxy.SSL.adaptive.bytes"
@@ -111,6 +151,27 @@ static int handshake_timed_out = FALSE;
 #define PROXY_TLS_MAX_SESSION_AGE		86400
 #define PROXY_TLS_MAX_SESSION_COUNT		1000
 
+/* Verified certificate caching */
+#define PROXY_TLS_VERIFY_CACHE_SIZE		32
+#define PROXY_TLS_VERIFY_CACHE_MAX_AGE		300
+#define PROXY_TLS_VERIFY_DIGEST_LEN		32
+
+struct tls_verify_cache_entry {
+  unsigned char digest[PROXY_TLS_VERIFY_DIGEST_LEN];
+  time_t expires;
+};
+
+static struct tls_verify_cache_entry
+  tls_verify_cache[PROXY_TLS_VERIFY_CACHE_SIZE];
+static struct proxy_tls_verify_cache_stats tls_verify_stats;
+
+/* The host name/address against which the server certificate in the current
+ * handshake is checked, and whether the verification result came from the
+ * cache.
+ */
+static char tls_verify_host[512];
+static int tls_verify_cached = FALSE;
+
 static SSL_CTX *ssl_ctx = NULL;
 static pr_netio_t *tls_ctrl_netio = NULL;
 static pr_netio_t *tls_data_netio = NULL;
@@ -127,6 +188,63 @@ static int netio_install_data(void);
 static void tls_tlsext_cb(SSL *, int, int, unsigned char *, int, void *);
 #endif /* !OPENSSL_NO_TLSEXT */
 
+/* TLS diagnostics (ProxyTLSOptions EnableDiags).  The callbacks only copy
+ * the raw event data into a per-session ring buffer; formatting and logging
+ * are deferred until the buffer is flushed, e.g. on a failed handshake.
+ */
+#define TLS_DIAG_EVENT_INFO			1
+#define TLS_DIAG_EVENT_MSG			2
+#define TLS_DIAG_EVENT_TLSEXT			3
+
+#define TLS_DIAG_INFO_STATE			1
+#define TLS_DIAG_INFO_ALERT			2
+#define TLS_DIAG_INFO_FAILED			3
+#define TLS_DIAG_INFO_ERROR			4
+
+/* Which events to record, and the trace levels of interest, as determined
+ * once at initialization.
+ */
+#define TLS_DIAG_FL_INFO			0x0001
+#define TLS_DIAG_FL_MSG				0x0002
+#define TLS_DIAG_FL_TLSEXT			0x0004
+#define TLS_DIAG_FL_TRACE9			0x0010
+#define TLS_DIAG_FL_TRACE19			0x0020
+#define TLS_DIAG_FL_TRACE21			0x0040
+
+/* Small event data (alerts, record headers) is kept inline; the larger
+ * handshake messages which are printed in detail use a buffer allocated on
+ * first use.
+ */
+#define TLS_DIAG_INLINE_DATALEN			8
+#define TLS_DIAG_MAX_DATALEN			2048
+
+struct tls_diag_event {
+  int type;
+
+  /* Info events */
+  int info_type, where, ret, xerrno;
+  const char *str, *state_str, *errors;
+
+  /* Message events */
+  int io_flag, version, content_type, ssl_version;
+
+  /* Extension events */
+  int server, ext_type;
+
+  /* The original data length, and how much of the data was kept. */
+  size_t datalen, data_keptlen;
+  const unsigned char *data;
+  unsigned char inline_data[TLS_DIAG_INLINE_DATALEN];
+  unsigned char *buf;
+};
+
+static pool *tls_diag_pool = NULL;
+static unsigned int tls_diag_mask = 0;
+static unsigned long tls_diag_flags = 0UL;
+static struct tls_diag_event *tls_diag_events = NULL;
+static unsigned int tls_diag_size = 0, tls_diag_start = 0, tls_diag_count = 0;
+static unsigned long tls_diag_dropped = 0;
+
 static int handshake_timeout_cb(CALLBACK_FRAME) {
   handshake_timed_out = TRUE;
   return 0;
@@ -497,6 +615,121 @@ static void tls_end_sess(SSL *ssl, int strms, int flags) {
   }
 }
 
+/* Advances the shutdown of a data connection's TLS session, on a
+ * non-blocking fd: sends our 'close_notify', then discards any data from the
+ * server until its 'close_notify' arrives.  Returns 1 when done, 0 if we
+ * need to wait for the fd, or -1 if the shutdown failed (e.g. the server
+ * has already closed the connection).
+ */
+static int tls_shutdown_step(SSL *ssl, int *sent_shutdown) {
+  BIO *rbio, *wbio;
+  int bread, bwritten, done = -1;
+  unsigned long rbio_rbytes, rbio_wbytes, wbio_rbytes, wbio_wbytes;
+
+  rbio = SSL_get_rbio(ssl);
+  rbio_rbytes = BIO_number_read(rbio);
+  rbio_wbytes = BIO_number_written(rbio);
+
+  wbio = SSL_get_wbio(ssl);
+  wbio_rbytes = BIO_number_read(wbio);
+  wbio_wbytes = BIO_number_written(wbio);
+
+  if (*sent_shutdown == FALSE) {
+    int res;
+
+    errno = 0;
+    res = SSL_shutdown(ssl);
+    if (res == 1) {
+      done = 1;
+
+    } else if (res == 0) {
+      *sent_shutdown = TRUE;
+
+    } else {
+      long err_code;
+
+      err_code = SSL_get_error(ssl, res);
+      if (err_code == SSL_ERROR_WANT_WRITE ||
+          err_code == SSL_ERROR_WANT_READ) {
+        done = 0;
+
+      } else {
+        pr_trace_msg(trace_channel, 17,
+          "error sending 'close_notify' on fd %d: %s", SSL_get_fd(ssl),
+          err_code == SSL_ERROR_SYSCALL ? strerror(errno) :
+            proxy_tls_get_errors());
+      }
+    }
+  }
+
+  if (*sent_shutdown == TRUE) {
+    while (TRUE) {
+      char buf[1024];
+      int res;
+      long err_code;
+
+      res = SSL_read(ssl, buf, sizeof(buf));
+      if (res > 0) {
+        continue;
+      }
+
+      err_code = SSL_get_error(ssl, res);
+      if (err_code == SSL_ERROR_ZERO_RETURN) {
+        done = 1;
+
+      } else if (err_code == SSL_ERROR_WANT_READ ||
+                 err_code == SSL_ERROR_WANT_WRITE) {
+        done = 0;
+      }
+
+      break;
+    }
+  }
+
+  bread = (BIO_number_read(rbio) - rbio_rbytes) +
+    (BIO_number_read(wbio) - wbio_rbytes);
+  bwritten = (BIO_number_written(rbio) - rbio_wbytes) +
+    (BIO_number_written(wbio) - wbio_wbytes);
+
+  if (bread > 0) {
+    session.total_raw_in += bread;
+  }
+
+  if (bwritten > 0) {
+    session.total_raw_out += bwritten;
+  }
+
+  return done;
+}
+
+static void tls_free_deferred_shutdown(unsigned int idx) {
+  struct tls_deferred_shutdown *deferred;
+
+  deferred = &(tls_deferred_shutdowns[idx]);
+  SSL_free(deferred->ssl);
+  (void) close(deferred->fd);
+
+  /* Keep the pending shutdowns contiguous. */
+  tls_deferred_count--;
+  if (idx != tls_deferred_count) {
+    memcpy(deferred, &(tls_deferred_shutdowns[tls_deferred_count]),
+      sizeof(struct tls_deferred_shutdown));
+  }
+
+  memset(&(tls_deferred_shutdowns[tls_deferred_count]), 0,
+    sizeof(struct tls_deferred_shutdown));
+}
+
+static int tls_deferred_shutdown_cb(CALLBACK_FRAME) {
+  if (proxy_tls_reap_data_sess(FALSE) > 0) {
+    /* Restart the timer. */
+    return 1;
+  }
+
+  tls_deferred_timer_id = -1;
+  return 0;
+}
+
 static int tls_readmore(int rfd) {
   fd_set rfds;
   struct timeval tv;
@@ -511,6 +744,18 @@ static int tls_readmore(int rfd) {
   return select(rfd + 1, &rfds, NULL, NULL, &tv);
 }
 
+static int tls_has_pending(SSL *ssl) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && \
+    !defined(HAVE_LIBRESSL)
+  /* Unlike SSL_pending(), this includes read-ahead data not yet processed
+   * into a record.
+   */
+  return SSL_has_pending(ssl);
+#else
+  return (SSL_pending(ssl) > 0);
+#endif /* OpenSSL-1.1.0 and later */
+}
+
 static int tls_writemore(int wfd) {
   fd_set wfds;
   struct timeval tv;
@@ -544,6 +789,19 @@ static ssize_t tls_read(SSL *ssl, void *buf, size_t len,
     /* read(2) returns only the generic error number -1 */
     count = -1;
 
+    if (nstrm_type == PR_NETIO_STRM_DATA &&
+        (err == SSL_ERROR_WANT_READ ||
+         err == SSL_ERROR_WANT_WRITE)) {
+      /* Rather than waiting here, let the caller's poller wait for the
+       * fd; see proxy_tls_get_poll_flags().
+       */
+      pr_trace_msg(trace_channel, 19,
+        "%s encountered while reading SSL data on fd %d, returning EAGAIN",
+        err == SSL_ERROR_WANT_READ ? "WANT_READ" : "WANT_WRITE", fd);
+      errno = EAGAIN;
+      return count;
+    }
+
     switch (err) {
       case SSL_ERROR_WANT_READ:
         /* OpenSSL needs more data from the wire to finish the current block,
@@ -606,7 +864,7 @@ static ssize_t tls_read(SSL *ssl, void *buf, size_t len,
 }
 
 static ssize_t tls_write(SSL *ssl, const void *buf, size_t len,
-    int nstrm_type, pr_table_t *notes) {
+    int nstrm_type) {
   ssize_t count;
   int lineno, xerrno = 0;
 
@@ -636,50 +894,42 @@ static ssize_t tls_write(SSL *ssl, const void *buf, size_t len,
     }
   }
 
-  if (nstrm_type == PR_NETIO_STRM_DATA) {
+  if (nstrm_type == PR_NETIO_STRM_DATA &&
+      count > 0) {
     BIO *wbio;
-    uint64_t *adaptive_bytes_written_ms = NULL, now;
-    off_t *adaptive_bytes_written_count = NULL;
-    const void *v;
-
-    v = pr_table_get(notes, PROXY_TLS_ADAPTIVE_BYTES_COUNT_KEY, NULL);
-    if (v != NULL) {
-      adaptive_bytes_written_count = (off_t *) v;
-    }
-
-    v = pr_table_get(notes, PROXY_TLS_ADAPTIVE_BYTES_MS_KEY, NULL);
-    if (v != NULL) {
-      adaptive_bytes_written_ms = (uint64_t *) v;
-    }
+    struct proxy_session_ctx *sess_ctx;
+    uint64_t now;
 
+    /* The adaptive write state lives in the session context, rather than
+     * being looked up in the stream notes on every write.
+     */
+    sess_ctx = proxy_session_get_ctx();
     (void) pr_gettimeofday_millis(&now);
 
     wbio = SSL_get_wbio(ssl);
 
-    if (adaptive_bytes_written_count != NULL) {
-      (*adaptive_bytes_written_count) += count;
-
-      if (*adaptive_bytes_written_count >= PROXY_TLS_DATA_ADAPTIVE_WRITE_BOOST_THRESHOLD) {
-        /* Boost the buffer size if we've written more than the "boost"
-         * threshold.
-         */
-        (void) BIO_set_write_buf_size(wbio,
-          PROXY_TLS_DATA_ADAPTIVE_WRITE_MAX_BUFFER_SIZE);
-      }
+    sess_ctx->tls_adaptive_bytes += count;
 
-      if (now > (*adaptive_bytes_written_ms + PROXY_TLS_DATA_ADAPTIVE_WRITE_BOOST_INTERVAL_MS)) {
-        /* If it's been longer than the boost interval since our last write,
-         * then reset the buffer size to the smaller version, assuming
-         * congestion (and thus closing of the TCP congestion window).
-         */
-        (void) BIO_set_write_buf_size(wbio,
-          PROXY_TLS_DATA_ADAPTIVE_WRITE_MIN_BUFFER_SIZE);
+    if (sess_ctx->tls_adaptive_bytes >= PROXY_TLS_DATA_ADAPTIVE_WRITE_BOOST_THRESHOLD) {
+      /* Boost the buffer size if we've written more than the "boost"
+       * threshold.
+       */
+      (void) BIO_set_write_buf_size(wbio,
+        PROXY_TLS_DATA_ADAPTIVE_WRITE_MAX_BUFFER_SIZE);
+    }
 
-        *adaptive_bytes_written_count = 0;
-      }
+    if (now > (sess_ctx->tls_adaptive_ms + PROXY_TLS_DATA_ADAPTIVE_WRITE_BOOST_INTERVAL_MS)) {
+      /* If it's been longer than the boost interval since our last write,
+       * then reset the buffer size to the smaller version, assuming
+       * congestion (and thus closing of the TCP congestion window).
+       */
+      (void) BIO_set_write_buf_size(wbio,
+        PROXY_TLS_DATA_ADAPTIVE_WRITE_MIN_BUFFER_SIZE);
 
-      *adaptive_bytes_written_ms = now;
+      sess_ctx->tls_adaptive_bytes = 0;
     }
+
+    sess_ctx->tls_adaptive_ms = now;
   }
 
   errno = xerrno;
@@ -1059,6 +1309,245 @@ static int cert_match_cn(pool *p, X509 *cert, const char *name,
   return matched;
 }
 
+static int tls_verify_cache_digest(X509 *cert, STACK_OF(X509) *chain,
+    const char *host, unsigned char *digest) {
+  register int i;
+  int count = 0;
+  unsigned char buf[(PROXY_TLS_VERIFY_DEPTH + 3) * PROXY_TLS_VERIFY_DIGEST_LEN];
+  unsigned int buflen = 0, mdlen = 0;
+  const EVP_MD *md;
+
+  if (chain != NULL) {
+    count = sk_X509_num(chain);
+  }
+
+  /* The leaf, the chain (which may also include the leaf), and the host
+   * name each contribute one digest; chains longer than our verify depth
+   * would fail verification anyway.
+   */
+  if (count > PROXY_TLS_VERIFY_DEPTH + 1) {
+    errno = E2BIG;
+    return -1;
+  }
+
+  md = EVP_sha256();
+
+  if (X509_digest(cert, md, buf, &mdlen) != 1) {
+    pr_trace_msg(trace_channel, 3,
+      "error computing certificate digest: %s", proxy_tls_get_errors());
+    errno = EPERM;
+    return -1;
+  }
+  buflen += mdlen;
+
+  for (i = 0; i < count; i++) {
+    if (X509_digest(sk_X509_value(chain, i), md, buf + buflen, &mdlen) != 1) {
+      pr_trace_msg(trace_channel, 3,
+        "error computing certificate digest: %s", proxy_tls_get_errors());
+      errno = EPERM;
+      return -1;
+    }
+    buflen += mdlen;
+  }
+
+  if (EVP_Digest(host, strlen(host), buf + buflen, &mdlen, md, NULL) != 1) {
+    errno = EPERM;
+    return -1;
+  }
+  buflen += mdlen;
+
+  if (EVP_Digest(buf, buflen, digest, &mdlen, md, NULL) != 1) {
+    errno = EPERM;
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Cached results must not outlive the validity period of any certificate
+ * in the chain.  Rather than computing the exact notAfter time, we simply
+ * do not cache chains containing a certificate which will expire before the
+ * maximum entry age is reached.
+ */
+static int tls_verify_cache_check_times(X509 *cert, time_t *expires) {
+  int res;
+
+  res = X509_cmp_time(X509_get_notBefore(cert), NULL);
+  if (res >= 0) {
+    /* Either not yet valid, or an error parsing the time. */
+    return -1;
+  }
+
+  res = X509_cmp_time(X509_get_notAfter(cert), expires);
+  if (res <= 0) {
+    return -1;
+  }
+
+  return 0;
+}
+
+int proxy_tls_verify_cache_add(X509 *cert, STACK_OF(X509) *chain,
+    const char *host) {
+  register int i;
+  int count = 0, idx = -1;
+  unsigned char digest[PROXY_TLS_VERIFY_DIGEST_LEN];
+  time_t now, expires;
+
+  if (cert == NULL ||
+      host == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  time(&now);
+  expires = now + PROXY_TLS_VERIFY_CACHE_MAX_AGE;
+
+  if (tls_verify_cache_check_times(cert, &expires) < 0) {
+    pr_trace_msg(trace_channel, 17,
+      "not caching verification result for certificate '%s': certificate "
+      "not valid for the next %d secs", tls_x509_name_oneline(
+      X509_get_subject_name(cert)), PROXY_TLS_VERIFY_CACHE_MAX_AGE);
+    errno = EPERM;
+    return -1;
+  }
+
+  if (chain != NULL) {
+    count = sk_X509_num(chain);
+  }
+
+  for (i = 0; i < count; i++) {
+    if (tls_verify_cache_check_times(sk_X509_value(chain, i), &expires) < 0) {
+      pr_trace_msg(trace_channel, 17,
+        "not caching verification result for certificate '%s': chain "
+        "certificate not valid for the next %d secs", tls_x509_name_oneline(
+        X509_get_subject_name(cert)), PROXY_TLS_VERIFY_CACHE_MAX_AGE);
+      errno = EPERM;
+      return -1;
+    }
+  }
+
+  if (tls_verify_cache_digest(cert, chain, host, digest) < 0) {
+    return -1;
+  }
+
+  /* Prefer an existing entry for this digest, then an unused/expired entry;
+   * failing that, evict the entry closest to expiring.
+   */
+  for (i = 0; i < PROXY_TLS_VERIFY_CACHE_SIZE; i++) {
+    if (tls_verify_cache[i].expires > 0 &&
+        memcmp(tls_verify_cache[i].digest, digest, sizeof(digest)) == 0) {
+      idx = i;
+      break;
+    }
+  }
+
+  if (idx < 0) {
+    for (i = 0; i < PROXY_TLS_VERIFY_CACHE_SIZE; i++) {
+      if (tls_verify_cache[i].expires <= now) {
+        idx = i;
+        break;
+      }
+
+      if (idx < 0 ||
+          tls_verify_cache[i].expires < tls_verify_cache[idx].expires) {
+        idx = i;
+      }
+    }
+
+    if (tls_verify_cache[idx].expires > now) {
+      tls_verify_stats.evictions++;
+    }
+  }
+
+  memcpy(tls_verify_cache[idx].digest, digest, sizeof(digest));
+  tls_verify_cache[idx].expires = expires;
+  tls_verify_stats.adds++;
+
+  pr_trace_msg(trace_channel, 17,
+    "cached verification result for certificate '%s' (host '%s') for %d secs",
+    tls_x509_name_oneline(X509_get_subject_name(cert)), host,
+    PROXY_TLS_VERIFY_CACHE_MAX_AGE);
+  return 0;
+}
+
+int proxy_tls_verify_cache_get(X509 *cert, STACK_OF(X509) *chain,
+    const char *host) {
+  register int i;
+  unsigned char digest[PROXY_TLS_VERIFY_DIGEST_LEN];
+  time_t now;
+
+  if (cert == NULL ||
+      host == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  tls_verify_stats.lookups++;
+
+  if (tls_verify_cache_digest(cert, chain, host, digest) < 0) {
+    tls_verify_stats.misses++;
+    errno = ENOENT;
+    return -1;
+  }
+
+  time(&now);
+
+  for (i = 0; i < PROXY_TLS_VERIFY_CACHE_SIZE; i++) {
+    if (tls_verify_cache[i].expires == 0 ||
+        memcmp(tls_verify_cache[i].digest, digest, sizeof(digest)) != 0) {
+      continue;
+    }
+
+    if (tls_verify_cache[i].expires <= now) {
+      tls_verify_cache[i].expires = 0;
+      tls_verify_stats.expired++;
+      break;
+    }
+
+    tls_verify_stats.hits++;
+    return 0;
+  }
+
+  tls_verify_stats.misses++;
+  errno = ENOENT;
+  return -1;
+}
+
+void proxy_tls_verify_cache_clear(void) {
+  memset(tls_verify_cache, 0, sizeof(tls_verify_cache));
+  memset(&tls_verify_stats, 0, sizeof(tls_verify_stats));
+}
+
+int proxy_tls_verify_cache_get_stats(
+    struct proxy_tls_verify_cache_stats *stats) {
+  if (stats == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  memcpy(stats, &tls_verify_stats, sizeof(tls_verify_stats));
+  return 0;
+}
+
+static void tls_verify_cache_add_peer(SSL *ssl, X509 *cert) {
+  if (*tls_verify_host == '\0' ||
+      (tls_opts & PROXY_TLS_OPT_NO_VERIFY_CACHE)) {
+    return;
+  }
+
+  /* A resumed session did not verify the chain during this handshake. */
+  if (SSL_session_reused(ssl)) {
+    return;
+  }
+
+  if (proxy_tls_verify_cache_add(cert, SSL_get_peer_cert_chain(ssl),
+      tls_verify_host) < 0) {
+    pr_trace_msg(trace_channel, 9,
+      "unable to cache server certificate verification result: %s",
+      strerror(errno));
+  }
+}
+
 static int check_server_cert(SSL *ssl, conn_t *conn, const char *host_name) {
   X509 *cert = NULL;
   int ok = -1;
@@ -1096,10 +1585,18 @@ static int check_server_cert(SSL *ssl, conn_t *conn, const char *host_name) {
     return -1;
   }
 
-  /* XXX If using OpenSSL-1.0.2/1.1.0, we might be able to use:
-   * X509_match_host() and X509_match_ip()/X509_match_ip_asc().
-   */
-
+  if (tls_verify_cached == TRUE) {
+    pr_trace_msg(trace_channel, 9,
+      "using cached verification result for '%s' server certificate",
+      conn->remote_name);
+    X509_free(cert);
+    return TRUE;
+  }
+
+  /* XXX If using OpenSSL-1.0.2/1.1.0, we might be able to use:
+   * X509_match_host() and X509_match_ip()/X509_match_ip_asc().
+   */
+
   ok = cert_match_ip_san(conn->pool, cert,
     pr_netaddr_get_ipstr(conn->remote_addr));
   if (ok == 0) {
@@ -1114,6 +1611,10 @@ static int check_server_cert(SSL *ssl, conn_t *conn, const char *host_name) {
     }
   }
 
+  if (ok == TRUE) {
+    tls_verify_cache_add_peer(ssl, cert);
+  }
+
   X509_free(cert);
   return ok;
 }
@@ -1129,8 +1630,45 @@ static void stash_stream_ssl(pr_netio_stream_t *nstrm, SSL *ssl) {
         nstrm->strm_type == PR_NETIO_STRM_CTRL ? "control" : "data",
         nstrm->strm_mode == PR_NETIO_IO_RD ? "read" : "write",
         strerror(errno));
+      return;
+    }
+  }
+
+  if (nstrm->strm_type == PR_NETIO_STRM_DATA) {
+    if (nstrm->strm_mode == PR_NETIO_IO_RD) {
+      tls_data_rd_nstrm = nstrm;
+
+    } else {
+      tls_data_wr_nstrm = nstrm;
+    }
+  }
+}
+
+/* Removes the SSL of the data connection from both of its streams, so that
+ * neither uses it once it has been freed.
+ */
+static void unstash_data_stream_ssl(pr_netio_stream_t *nstrm, SSL *ssl) {
+  pr_netio_stream_t *data_nstrms[3];
+  register unsigned int i;
+
+  data_nstrms[0] = nstrm;
+  data_nstrms[1] = tls_data_rd_nstrm;
+  data_nstrms[2] = tls_data_wr_nstrm;
+
+  for (i = 0; i < 3; i++) {
+    if (data_nstrms[i] == NULL ||
+        data_nstrms[i]->notes == NULL) {
+      continue;
+    }
+
+    if ((SSL *) pr_table_get(data_nstrms[i]->notes, PROXY_TLS_NETIO_NOTE,
+        NULL) == ssl) {
+      (void) pr_table_remove(data_nstrms[i]->notes, PROXY_TLS_NETIO_NOTE,
+        NULL);
     }
   }
+
+  tls_data_rd_nstrm = tls_data_wr_nstrm = NULL;
 }
 
 static int tls_verify_cb(int ok, X509_STORE_CTX *ctx) {
@@ -1224,6 +1762,40 @@ static int tls_verify_cb(int ok, X509_STORE_CTX *ctx) {
   return ok;
 }
 
+/* Consults the verified certificate cache before performing the full
+ * verification of the server's certificate chain.
+ */
+static int tls_cert_verify_cb(X509_STORE_CTX *ctx, void *user_data) {
+  X509 *cert;
+  STACK_OF(X509) *chain;
+
+  if (tls_verify_server == FALSE ||
+      *tls_verify_host == '\0' ||
+      (tls_opts & PROXY_TLS_OPT_NO_VERIFY_CACHE)) {
+    return X509_verify_cert(ctx);
+  }
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+  cert = X509_STORE_CTX_get0_cert(ctx);
+  chain = X509_STORE_CTX_get0_untrusted(ctx);
+#else
+  cert = ctx->cert;
+  chain = ctx->untrusted;
+#endif /* OpenSSL-1.1.x and later */
+
+  if (cert != NULL &&
+      proxy_tls_verify_cache_get(cert, chain, tls_verify_host) == 0) {
+    pr_trace_msg(trace_channel, 12,
+      "found cached verification result for certificate '%s' (host '%s')",
+      tls_x509_name_oneline(X509_get_subject_name(cert)), tls_verify_host);
+    X509_STORE_CTX_set_error(ctx, X509_V_OK);
+    tls_verify_cached = TRUE;
+    return 1;
+  }
+
+  return X509_verify_cert(ctx);
+}
+
 static int tls_get_cached_sess(pool *p, SSL *ssl, const char *host, int port) {
   char port_str[32], *sess_key = NULL;
   SSL_SESSION *sess = NULL;
@@ -1371,14 +1943,18 @@ static int tls_connect(conn_t *conn, const char *host_name,
 
   SSL_set_verify(ssl, SSL_VERIFY_PEER, tls_verify_cb);
 
+  (void) proxy_tls_apply_buffer_policy(ssl,
+    nstrm->strm_type == PR_NETIO_STRM_DATA ?
+      PROXY_TLS_BUFFER_ROLE_DATA : PROXY_TLS_BUFFER_ROLE_CTRL);
+
   /* This works with either rfd or wfd (I hope). */
   rbio = BIO_new_socket(conn->rfd, FALSE);
   wbio = BIO_new_socket(conn->rfd, FALSE);
   SSL_set_bio(ssl, rbio, wbio);
 
-#if !defined(OPENSSL_NO_TLSEXT)
-  SSL_set_tlsext_debug_callback(ssl, tls_tlsext_cb);
+  (void) proxy_tls_diags_set_callbacks(ssl);
 
+#if !defined(OPENSSL_NO_TLSEXT)
   /* We should be a well-behaved TLS client, and NOT send an SNI value
    * that is an IP address.  Per RFC 6066, literal IPv4/IPv6 addresses are NOT
    * permitted in the SNI.
@@ -1421,6 +1997,13 @@ static int tls_connect(conn_t *conn, const char *host_name,
       &proxy_module, handshake_timeout_cb, "SSL/TLS handshake");
   }
 
+  /* Key any cached verification results by both the name and the address
+   * we check the server certificate against.
+   */
+  pr_snprintf(tls_verify_host, sizeof(tls_verify_host)-1, "%s %s", host_name,
+    pr_netaddr_get_ipstr(conn->remote_addr));
+  tls_verify_cached = FALSE;
+
   /* Make sure that TCP_NODELAY is enabled for the handshake. */
   (void) pr_inet_set_proto_nodelay(conn->pool, conn, 1);
 
@@ -1473,6 +2056,7 @@ static int tls_connect(conn_t *conn, const char *host_name,
       (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
         "TLS negotiation timed out (%u seconds)", handshake_timeout);
       tls_end_sess(ssl, nstrm->strm_type, 0);
+      (void) proxy_tls_diags_flush();
       return -4;
     }
 
@@ -1548,6 +2132,7 @@ static int tls_connect(conn_t *conn, const char *host_name,
       tls_end_sess(ssl, nstrm->strm_type, 0);
     }
 
+    (void) proxy_tls_diags_flush();
     return -3;
   }
 
@@ -1615,6 +2200,7 @@ static int tls_connect(conn_t *conn, const char *host_name,
 
   if (check_server_cert(ssl, conn, host_name) < 0) {
     tls_end_sess(ssl, nstrm->strm_type, 0);
+    (void) proxy_tls_diags_flush();
     return -1;
   }
 
@@ -1699,7 +2285,7 @@ static int netio_close_cb(pr_netio_stream_t *nstrm) {
       const char *host_name;
       int remote_port;
 
-      proxy_sess = pr_table_get(session.notes, "mod_proxy.proxy-session", NULL);
+      proxy_sess = proxy_session_get_current();
       if (proxy_sess == NULL) {
         /* Unlikely to occur. */
         pr_trace_msg(trace_channel, 1, "missing proxy session unexpectedly");
@@ -1726,6 +2312,13 @@ static int netio_close_cb(pr_netio_stream_t *nstrm) {
     }
   }
 
+  if (nstrm == tls_data_rd_nstrm) {
+    tls_data_rd_nstrm = NULL;
+
+  } else if (nstrm == tls_data_wr_nstrm) {
+    tls_data_wr_nstrm = NULL;
+  }
+
   res = close(nstrm->strm_fd);
   nstrm->strm_fd = -1;
 
@@ -1743,12 +2336,24 @@ static pr_netio_stream_t *netio_open_cb(pr_netio_stream_t *nstrm, int fd,
 static int netio_poll_cb(pr_netio_stream_t *nstrm) {
   fd_set rfds, wfds;
   struct timeval tval;
+  int flags;
 
   FD_ZERO(&rfds);
   FD_ZERO(&wfds);
 
   if (nstrm->strm_mode == PR_NETIO_IO_RD) {
-    FD_SET(nstrm->strm_fd, &rfds);
+    flags = proxy_tls_get_poll_flags(nstrm);
+    if (flags & PROXY_TLS_POLL_FL_PENDING) {
+      return 1;
+    }
+
+    if (flags & PROXY_TLS_POLL_FL_READ) {
+      FD_SET(nstrm->strm_fd, &rfds);
+    }
+
+    if (flags & PROXY_TLS_POLL_FL_WRITE) {
+      FD_SET(nstrm->strm_fd, &wfds);
+    }
 
   } else {
     FD_SET(nstrm->strm_fd, &wfds);
@@ -1803,7 +2408,7 @@ static int netio_postopen_cb(pr_netio_stream_t *nstrm) {
       }
     }
 
-    proxy_sess = pr_table_get(session.notes, "mod_proxy.proxy-session", NULL);
+    proxy_sess = proxy_session_get_current();
     if (proxy_sess == NULL) {
       /* Unlikely to occur. */
       pr_trace_msg(trace_channel, 1, "missing proxy session unexpectedly");
@@ -1848,7 +2453,24 @@ static int netio_postopen_cb(pr_netio_stream_t *nstrm) {
         elapsed_ms);
     }
 
-    adaptive_ms = pcalloc(nstrm->strm_pool, sizeof(uint64_t));
+    if (nstrm->strm_type == PR_NETIO_STRM_DATA) {
+      struct proxy_session_ctx *sess_ctx;
+
+      /* The stream notes mirror the adaptive write state kept in the
+       * session context, which is what tls_write() uses.
+       */
+      sess_ctx = proxy_session_get_ctx();
+      sess_ctx->tls_adaptive_bytes = 0;
+      sess_ctx->tls_adaptive_ms = 0;
+
+      adaptive_ms = &(sess_ctx->tls_adaptive_ms);
+      adaptive_bytes = &(sess_ctx->tls_adaptive_bytes);
+
+    } else {
+      adaptive_ms = pcalloc(nstrm->strm_pool, sizeof(uint64_t));
+      adaptive_bytes = pcalloc(nstrm->strm_pool, sizeof(off_t));
+    }
+
     if (pr_table_add(nstrm->notes, PROXY_TLS_ADAPTIVE_BYTES_MS_KEY,
         adaptive_ms, sizeof(uint64_t)) < 0) {
       pr_trace_msg(trace_channel, 3,
@@ -1856,7 +2478,6 @@ static int netio_postopen_cb(pr_netio_stream_t *nstrm) {
         strerror(errno));
     }
 
-    adaptive_bytes = pcalloc(nstrm->strm_pool, sizeof(off_t));
     if (pr_table_add(nstrm->notes, PROXY_TLS_ADAPTIVE_BYTES_COUNT_KEY,
         adaptive_bytes, sizeof(off_t)) < 0) {
       pr_trace_msg(trace_channel, 3,
@@ -1941,6 +2562,16 @@ static pr_netio_stream_t *netio_reopen_cb(pr_netio_stream_t *nstrm, int fd,
 
 static int netio_shutdown_cb(pr_netio_stream_t *nstrm, int how) {
 
+  if (how == 0 &&
+      nstrm->strm_type == PR_NETIO_STRM_DATA &&
+      (proxy_sess_state & PROXY_SESS_STATE_BACKEND_HAS_DATA_TLS) &&
+      tls_shutdown_policy != PROXY_TLS_SHUTDOWN_POLICY_UNIDIRECTIONAL) {
+    /* We still need to read the server's 'close_notify'; see
+     * proxy_tls_end_data_sess().
+     */
+    return 0;
+  }
+
   if (how == 1 ||
       how == 2) {
     /* Closing this stream for writing; we need to send the 'close_notify'
@@ -1968,7 +2599,17 @@ static int netio_shutdown_cb(pr_netio_stream_t *nstrm, int how) {
       }
 
       ssl = (SSL *) pr_table_get(nstrm->notes, PROXY_TLS_NETIO_NOTE, NULL);
-      if (ssl != NULL) {
+      if (ssl != NULL &&
+          nstrm->strm_type == PR_NETIO_STRM_DATA) {
+        /* Note that this frees the SSL, or hands it off to be freed once
+         * the server's 'close_notify' arrives; the transfer is done either
+         * way, and its completion need not wait on the server.
+         */
+        unstash_data_stream_ssl(nstrm, ssl);
+        (void) proxy_tls_end_data_sess(ssl, nstrm->strm_fd);
+        proxy_sess_state &= ~PROXY_SESS_STATE_BACKEND_HAS_DATA_TLS;
+
+      } else if (ssl != NULL) {
         BIO *rbio, *wbio;
         int bread = 0, bwritten = 0;
         unsigned long rbio_rbytes, rbio_wbytes, wbio_rbytes, wbio_wbytes;
@@ -1986,10 +2627,6 @@ static int netio_shutdown_cb(pr_netio_stream_t *nstrm, int how) {
           SSL_shutdown(ssl);
         }
 
-        if (nstrm->strm_type == PR_NETIO_STRM_DATA) {
-          proxy_sess_state &= ~PROXY_SESS_STATE_BACKEND_HAS_DATA_TLS;
-        }
-
         bread = (BIO_number_read(rbio) - rbio_rbytes) +
           (BIO_number_read(wbio) - wbio_rbytes);
         bwritten = (BIO_number_written(rbio) - rbio_wbytes) +
@@ -2030,7 +2667,7 @@ static int netio_write_cb(pr_netio_stream_t *nstrm, char *buf, size_t buflen) {
     wbio_rbytes = BIO_number_read(wbio);
     wbio_wbytes = BIO_number_written(wbio);
 
-    res = tls_write(ssl, buf, buflen, nstrm->strm_type, nstrm->notes);
+    res = tls_write(ssl, buf, buflen, nstrm->strm_type);
 
     bread = (BIO_number_read(rbio) - rbio_rbytes) +
       (BIO_number_read(wbio) - wbio_rbytes);
@@ -2178,17 +2815,25 @@ static unsigned int tls_psk_cb(SSL *ssl, const char *psk_hint, char *identity,
 #endif /* PSK support */
 
 #if !defined(OPENSSL_NO_TLSEXT) && defined(TLSEXT_STATUSTYPE_ocsp)
-/* TODO: Do more than just log the received stapled OCSP response. */
-static int tls_ocsp_response_cb(SSL *ssl, void *user_data) {
+/* Stapled OCSP response caching */
+#define PROXY_TLS_OCSP_CACHE_SIZE		32
+#define PROXY_TLS_OCSP_MAX_SKEW			300
+
+struct tls_ocsp_cache_entry {
+  unsigned char cert_digest[PROXY_TLS_VERIFY_DIGEST_LEN];
+  unsigned char resp_digest[PROXY_TLS_VERIFY_DIGEST_LEN];
+  time_t expires;
+};
+
+static struct tls_ocsp_cache_entry tls_ocsp_cache[PROXY_TLS_OCSP_CACHE_SIZE];
+
+static void tls_print_ocsp_response(const unsigned char *ptr, int len) {
   BIO *bio = NULL;
   char *data = NULL;
   long datalen;
-  const unsigned char *ptr;
-  int len, res = 1;
 
   bio = BIO_new(BIO_s_mem());
 
-  len = SSL_get_tlsext_status_ocsp_resp(ssl, &ptr);
   BIO_puts(bio, "OCSP response: ");
   if (ptr == NULL) {
     BIO_puts(bio, "no response sent\n");
@@ -2200,7 +2845,6 @@ static int tls_ocsp_response_cb(SSL *ssl, void *user_data) {
     if (resp == NULL) {
       BIO_puts(bio, "response parse error\n");
       BIO_dump_indent(bio, (char *) ptr, len, 4);
-      res = 0;
 
     } else {
       BIO_puts(bio, "\n======================================\n");
@@ -2215,12 +2859,350 @@ static int tls_ocsp_response_cb(SSL *ssl, void *user_data) {
     data[datalen] = '\0';
   }
 
-  pr_trace_msg(trace_channel, 1, "%s", "stapled OCSP response:");
-  pr_trace_msg(trace_channel, 1, "%s", data);
+  pr_trace_msg(trace_channel, 12, "%s", "stapled OCSP response:");
+  pr_trace_msg(trace_channel, 12, "%s", data);
 
   BIO_free(bio);
+}
+
+static int tls_ocsp_cache_get(const unsigned char *cert_digest,
+    const unsigned char *resp_digest) {
+  register int i;
+  time_t now;
+
+  time(&now);
+
+  for (i = 0; i < PROXY_TLS_OCSP_CACHE_SIZE; i++) {
+    if (tls_ocsp_cache[i].expires > now &&
+        memcmp(tls_ocsp_cache[i].cert_digest, cert_digest,
+          PROXY_TLS_VERIFY_DIGEST_LEN) == 0 &&
+        memcmp(tls_ocsp_cache[i].resp_digest, resp_digest,
+          PROXY_TLS_VERIFY_DIGEST_LEN) == 0) {
+      return 0;
+    }
+  }
+
+  errno = ENOENT;
+  return -1;
+}
+
+static void tls_ocsp_cache_add(const unsigned char *cert_digest,
+    const unsigned char *resp_digest, ASN1_GENERALIZEDTIME *next_update) {
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L && \
+    !defined(HAVE_LIBRESSL)
+  register int i;
+  int idx = -1, days = 0, secs = 0;
+  time_t now;
+
+  /* Responses without a nextUpdate time may be refreshed at any time, and
+   * thus are not cached.
+   */
+  if (cert_digest == NULL ||
+      next_update == NULL) {
+    return;
+  }
+
+  if (ASN1_TIME_diff(&days, &secs, NULL, next_update) != 1 ||
+      days < 0 ||
+      secs < 0 ||
+      (days == 0 && secs == 0)) {
+    return;
+  }
+
+  time(&now);
+
+  /* Prefer the entry for this certificate, then an expired entry; failing
+   * that, replace the entry closest to expiring.
+   */
+  for (i = 0; i < PROXY_TLS_OCSP_CACHE_SIZE; i++) {
+    if (memcmp(tls_ocsp_cache[i].cert_digest, cert_digest,
+        PROXY_TLS_VERIFY_DIGEST_LEN) == 0) {
+      idx = i;
+      break;
+    }
+  }
+
+  if (idx < 0) {
+    for (i = 0; i < PROXY_TLS_OCSP_CACHE_SIZE; i++) {
+      if (tls_ocsp_cache[i].expires <= now) {
+        idx = i;
+        break;
+      }
+
+      if (idx < 0 ||
+          tls_ocsp_cache[i].expires < tls_ocsp_cache[idx].expires) {
+        idx = i;
+      }
+    }
+  }
+
+  memcpy(tls_ocsp_cache[idx].cert_digest, cert_digest,
+    PROXY_TLS_VERIFY_DIGEST_LEN);
+  memcpy(tls_ocsp_cache[idx].resp_digest, resp_digest,
+    PROXY_TLS_VERIFY_DIGEST_LEN);
+  tls_ocsp_cache[idx].expires = now + ((time_t) days * 86400) + secs;
+
+  pr_trace_msg(trace_channel, 17,
+    "cached stapled OCSP response for %d days, %d secs", days, secs);
+#endif /* OpenSSL-1.0.2 and later */
+}
+
+/* Returns a new reference to the issuer of the server certificate. */
+static X509 *tls_ocsp_find_issuer(SSL *ssl, X509 *cert) {
+  register int i;
+  STACK_OF(X509) *chain;
+  X509_STORE *store;
+  X509_STORE_CTX *store_ctx;
+  X509 *issuer = NULL;
+
+  chain = SSL_get_peer_cert_chain(ssl);
+  if (chain != NULL) {
+    for (i = 0; i < sk_X509_num(chain); i++) {
+      X509 *elt;
+
+      elt = sk_X509_value(chain, i);
+      if (X509_check_issued(elt, cert) == X509_V_OK) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+        X509_up_ref(elt);
+#else
+        CRYPTO_add(&(elt->references), 1, CRYPTO_LOCK_X509);
+#endif /* OpenSSL-1.1.x and later */
+        return elt;
+      }
+    }
+  }
+
+  /* The issuer may only be present in our trusted CAs.  Note that we cannot
+   * rely on the verified chain for this: when the verification result was
+   * cached, no chain was built for this handshake.
+   */
+  store = SSL_CTX_get_cert_store(SSL_get_SSL_CTX(ssl));
+  store_ctx = X509_STORE_CTX_new();
+  if (store != NULL &&
+      store_ctx != NULL &&
+      X509_STORE_CTX_init(store_ctx, store, cert, chain) == 1) {
+    if (X509_STORE_CTX_get1_issuer(&issuer, store_ctx, cert) != 1) {
+      issuer = NULL;
+    }
+  }
+
+  if (store_ctx != NULL) {
+    X509_STORE_CTX_free(store_ctx);
+  }
+
+  if (issuer == NULL) {
+    errno = ENOENT;
+  }
+
+  return issuer;
+}
+
+/* Verifies the stapled OCSP response, if any: its signature, its validity
+ * period, and the status of the server certificate.
+ */
+static int tls_verify_ocsp_response(SSL *ssl, X509 *cert,
+    OCSP_RESPONSE *resp, const unsigned char *cert_digest,
+    const unsigned char *resp_digest) {
+  int res, resp_status, cert_status = -1, reason = -1;
+  OCSP_BASICRESP *basic_resp;
+  OCSP_CERTID *cert_id;
+  X509 *issuer;
+  X509_STORE *store;
+  ASN1_GENERALIZEDTIME *revoked_at = NULL, *this_update = NULL,
+    *next_update = NULL;
+
+  resp_status = OCSP_response_status(resp);
+  if (resp_status != OCSP_RESPONSE_STATUS_SUCCESSFUL) {
+    /* Not an authoritative answer, e.g. "tryLater"; treat it as if no
+     * response had been stapled.
+     */
+    pr_trace_msg(trace_channel, 3,
+      "ignoring stapled OCSP response with status %s (%d)",
+      OCSP_response_status_str(resp_status), resp_status);
+    return 0;
+  }
+
+  basic_resp = OCSP_response_get1_basic(resp);
+  if (basic_resp == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error parsing stapled OCSP basic response: %s", proxy_tls_get_errors());
+    errno = EINVAL;
+    return -1;
+  }
+
+  store = SSL_CTX_get_cert_store(SSL_get_SSL_CTX(ssl));
+  res = OCSP_basic_verify(basic_resp, SSL_get_peer_cert_chain(ssl), store, 0);
+  if (res <= 0) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error verifying stapled OCSP response signature: %s",
+      proxy_tls_get_errors());
+    OCSP_BASICRESP_free(basic_resp);
+    errno = EPERM;
+    return -1;
+  }
+
+  /* Without the issuer, we cannot tell what the response says about the
+   * server certificate; it might say that it is revoked.
+   */
+  issuer = tls_ocsp_find_issuer(ssl, cert);
+  if (issuer == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "unable to find issuer of server certificate, cannot check stapled "
+      "OCSP response");
+    OCSP_BASICRESP_free(basic_resp);
+    errno = EPERM;
+    return -1;
+  }
+
+  cert_id = OCSP_cert_to_id(NULL, cert, issuer);
+  X509_free(issuer);
+  if (cert_id == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error obtaining OCSP ID for server certificate: %s",
+      proxy_tls_get_errors());
+    OCSP_BASICRESP_free(basic_resp);
+    errno = EPERM;
+    return -1;
+  }
+
+  res = OCSP_resp_find_status(basic_resp, cert_id, &cert_status, &reason,
+    &revoked_at, &this_update, &next_update);
+  OCSP_CERTID_free(cert_id);
+
+  if (res != 1) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "stapled OCSP response does not cover server certificate");
+    OCSP_BASICRESP_free(basic_resp);
+    errno = EPERM;
+    return -1;
+  }
+
+  if (OCSP_check_validity(this_update, next_update, PROXY_TLS_OCSP_MAX_SKEW,
+      -1) != 1) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "stapled OCSP response is not current: %s", proxy_tls_get_errors());
+    OCSP_BASICRESP_free(basic_resp);
+    errno = EPERM;
+    return -1;
+  }
+
+  switch (cert_status) {
+    case V_OCSP_CERTSTATUS_GOOD:
+      pr_trace_msg(trace_channel, 9,
+        "stapled OCSP response reports server certificate status 'good'");
+      tls_ocsp_cache_add(cert_digest, resp_digest, next_update);
+      break;
+
+    case V_OCSP_CERTSTATUS_REVOKED:
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "stapled OCSP response reports server certificate revoked (%s)",
+        reason >= 0 ? OCSP_crl_reason_str(reason) : "unknown reason");
+      OCSP_BASICRESP_free(basic_resp);
+      errno = EPERM;
+      return -1;
+
+    default:
+      pr_trace_msg(trace_channel, 3,
+        "stapled OCSP response reports server certificate status '%s'",
+        OCSP_cert_status_str(cert_status));
+      break;
+  }
+
+  OCSP_BASICRESP_free(basic_resp);
+  return 0;
+}
+
+static int tls_ocsp_response_cb(SSL *ssl, void *user_data) {
+  if (proxy_tls_verify_stapled_ocsp(ssl) < 0) {
+    if (tls_verify_server == TRUE) {
+      return 0;
+    }
+
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "ProxyTLSVerifyServer off, ignoring failed OCSP response verification");
+  }
+
+  return 1;
+}
+
+int proxy_tls_verify_stapled_ocsp(SSL *ssl) {
+  const unsigned char *ptr, *resp_ptr;
+  unsigned char cert_digest[PROXY_TLS_VERIFY_DIGEST_LEN];
+  unsigned char resp_digest[PROXY_TLS_VERIFY_DIGEST_LEN];
+  unsigned int digest_len = 0;
+  int cacheable = TRUE, len, res = 0, xerrno = 0;
+  OCSP_RESPONSE *resp;
+  X509 *cert;
+
+  if (ssl == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  len = SSL_get_tlsext_status_ocsp_resp(ssl, &ptr);
+
+  /* Only pay the cost of rendering the response if it will be logged. */
+  if (pr_trace_get_level(trace_channel) >= 12) {
+    tls_print_ocsp_response(ptr, len);
+  }
+
+  if (ptr == NULL) {
+    pr_trace_msg(trace_channel, 17, "no stapled OCSP response sent");
+    return 0;
+  }
+
+  resp_ptr = ptr;
+  resp = d2i_OCSP_RESPONSE(NULL, &resp_ptr, len);
+  if (resp == NULL) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error parsing stapled OCSP response: %s", proxy_tls_get_errors());
+    errno = EINVAL;
+    return -1;
+  }
+
+  cert = SSL_get_peer_certificate(ssl);
+  if (cert == NULL) {
+    OCSP_RESPONSE_free(resp);
+    return 0;
+  }
+
+  if (X509_digest(cert, EVP_sha256(), cert_digest, &digest_len) != 1 ||
+      EVP_Digest(ptr, len, resp_digest, &digest_len, EVP_sha256(),
+        NULL) != 1) {
+    pr_trace_msg(trace_channel, 3,
+      "error computing stapled OCSP response digests: %s",
+      proxy_tls_get_errors());
+    cacheable = FALSE;
+
+  } else if (tls_ocsp_cache_get(cert_digest, resp_digest) == 0) {
+    /* We have already verified this very response for this certificate. */
+    pr_trace_msg(trace_channel, 12,
+      "using cached verification of stapled OCSP response");
+    OCSP_RESPONSE_free(resp);
+    X509_free(cert);
+    return 0;
+  }
+
+  res = tls_verify_ocsp_response(ssl, cert, resp,
+    cacheable ? cert_digest : NULL, resp_digest);
+  xerrno = errno;
+
+  OCSP_RESPONSE_free(resp);
+  X509_free(cert);
+
+  errno = xerrno;
   return res;
 }
+#else
+int proxy_tls_verify_stapled_ocsp(SSL *ssl) {
+  if (ssl == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* No stapled OCSP response could have been requested. */
+  return 0;
+}
 #endif /* OCSP support */
 
 #if !defined(OPENSSL_NO_TLSEXT)
@@ -2356,6 +3338,7 @@ static int init_ssl_ctx(void) {
 #endif /* ECC support */
 
   SSL_CTX_set_options(ssl_ctx, ssl_opts);
+  SSL_CTX_set_cert_verify_callback(ssl_ctx, tls_cert_verify_cb, NULL);
 
 #if !defined(OPENSSL_NO_TLSEXT)
   if (set_next_protocol(ssl_ctx) < 0) {
@@ -2771,13 +3754,112 @@ static int tls_load_psk(const char *identity, const char *path) {
 }
 # endif /* PSK support */
 
-static void tls_info_cb(const SSL *ssl, int where, int ret) {
-  const char *str = "(unknown)";
-  int w;
+static void tls_diag_clear(void) {
+  tls_diag_start = tls_diag_count = 0;
+  tls_diag_dropped = 0;
+}
 
-  pr_signals_handle();
+/* Returns the next event slot in the ring buffer, overwriting the oldest
+ * event if the buffer is full.
+ */
+static struct tls_diag_event *tls_diag_next_event(int type) {
+  struct tls_diag_event *ev;
+  unsigned int idx;
 
-  w = where & ~SSL_ST_MASK;
+  if (tls_diag_pool == NULL) {
+    return NULL;
+  }
+
+  if (tls_diag_events == NULL) {
+    tls_diag_events = pcalloc(tls_diag_pool,
+      tls_diag_size * sizeof(struct tls_diag_event));
+  }
+
+  if (tls_diag_count == tls_diag_size) {
+    idx = tls_diag_start;
+    tls_diag_start = (tls_diag_start + 1) % tls_diag_size;
+    tls_diag_dropped++;
+
+  } else {
+    idx = (tls_diag_start + tls_diag_count) % tls_diag_size;
+    tls_diag_count++;
+  }
+
+  ev = &(tls_diag_events[idx]);
+  ev->type = type;
+  ev->datalen = ev->data_keptlen = 0;
+  ev->data = ev->inline_data;
+
+  return ev;
+}
+
+/* Keeps up to maxlen bytes of the given data for the event. */
+static void tls_diag_keep_data(struct tls_diag_event *ev,
+    const unsigned char *data, size_t datalen, size_t maxlen) {
+  size_t keptlen;
+
+  keptlen = datalen < maxlen ? datalen : maxlen;
+  if (keptlen > TLS_DIAG_MAX_DATALEN) {
+    keptlen = TLS_DIAG_MAX_DATALEN;
+  }
+
+  ev->datalen = datalen;
+
+  if (keptlen > TLS_DIAG_INLINE_DATALEN) {
+    if (ev->buf == NULL) {
+      ev->buf = palloc(tls_diag_pool, TLS_DIAG_MAX_DATALEN);
+    }
+
+    ev->data = ev->buf;
+    memcpy(ev->buf, data, keptlen);
+
+  } else if (keptlen > 0) {
+    memcpy(ev->inline_data, data, keptlen);
+  }
+
+  ev->data_keptlen = keptlen;
+}
+
+static void tls_diag_recorded(void) {
+  if (tls_diag_flags & PROXY_TLS_DIAGS_FL_LOG_ALL) {
+    (void) proxy_tls_diags_flush();
+  }
+}
+
+static void tls_info_cb(const SSL *ssl, int where, int ret) {
+  struct tls_diag_event *ev;
+  const char *str = "(unknown)";
+  int info_type, w;
+
+  if (!(tls_diag_mask & TLS_DIAG_FL_INFO)) {
+    return;
+  }
+
+  pr_signals_handle();
+
+  if (where & (SSL_CB_CONNECT_LOOP|SSL_CB_HANDSHAKE_START|
+               SSL_CB_HANDSHAKE_DONE|SSL_CB_LOOP)) {
+    info_type = TLS_DIAG_INFO_STATE;
+
+  } else if (where & SSL_CB_ALERT) {
+    info_type = TLS_DIAG_INFO_ALERT;
+
+  } else if ((where & SSL_CB_EXIT) &&
+             ret == 0) {
+    info_type = TLS_DIAG_INFO_FAILED;
+
+  } else if ((where & SSL_CB_EXIT) &&
+             ret < 0 &&
+             errno != 0 &&
+             errno != EAGAIN) {
+    /* Ignore EAGAIN errors */
+    info_type = TLS_DIAG_INFO_ERROR;
+
+  } else {
+    return;
+  }
+
+  w = where & ~SSL_ST_MASK;
 
   if (w & SSL_ST_CONNECT) {
     str = "connecting";
@@ -2816,58 +3898,70 @@ static void tls_info_cb(const SSL *ssl, int where, int ret) {
     }
   }
 
-  if (where & SSL_CB_CONNECT_LOOP) {
-    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-      "[tls.info] %s: %s", str, SSL_state_string_long(ssl));
+  if ((where & SSL_CB_HANDSHAKE_DONE) &&
+      (tls_diag_mask & TLS_DIAG_FL_TRACE9)) {
+    int reused;
 
-  } else if (where & SSL_CB_HANDSHAKE_START) {
-    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-      "[tls.info] %s: %s", str, SSL_state_string_long(ssl));
+    reused = SSL_session_reused((SSL *) ssl);
+    if (reused > 0) {
+      pr_trace_msg(trace_channel, 9,
+        "RESUMED SSL/TLS session: %s using cipher %s (%d bits)",
+        SSL_get_version(ssl), SSL_get_cipher_name(ssl),
+        SSL_get_cipher_bits(ssl, NULL));
+
+    } else {
+      pr_trace_msg(trace_channel, 9,
+        "negotiated NEW SSL/TLS session");
+    }
+  }
 
-  } else if (where & SSL_CB_HANDSHAKE_DONE) {
-    if (pr_trace_get_level(trace_channel) >= 9) {
-      int reused;
+  ev = tls_diag_next_event(TLS_DIAG_EVENT_INFO);
+  if (ev == NULL) {
+    return;
+  }
 
-      reused = SSL_session_reused((SSL *) ssl);
-      if (reused > 0) {
-        pr_trace_msg(trace_channel, 9,
-          "RESUMED SSL/TLS session: %s using cipher %s (%d bits)",
-          SSL_get_version(ssl), SSL_get_cipher_name(ssl),
-          SSL_get_cipher_bits(ssl, NULL));
+  ev->info_type = info_type;
+  ev->where = where;
+  ev->ret = ret;
+  ev->xerrno = errno;
+  ev->str = str;
+  ev->state_str = SSL_state_string_long(ssl);
+  ev->errors = NULL;
 
-      } else {
-        pr_trace_msg(trace_channel, 9,
-          "negotiated NEW SSL/TLS session");
-      }
-    }
+  if (info_type == TLS_DIAG_INFO_FAILED) {
+    /* The error queue is drained by this, so it must be read now. */
+    ev->errors = proxy_tls_get_errors();
+  }
 
-    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-      "[tls.info] %s: %s", str, SSL_state_string_long(ssl));
+  tls_diag_recorded();
+}
 
-  } else if (where & SSL_CB_LOOP) {
-    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-      "[tls.info] %s: %s", str, SSL_state_string_long(ssl));
+static void tls_diag_log_info(const struct tls_diag_event *ev) {
+  switch (ev->info_type) {
+    case TLS_DIAG_INFO_STATE:
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "[tls.info] %s: %s", ev->str, ev->state_str);
+      break;
 
-  } else if (where & SSL_CB_ALERT) {
-    str = (where & SSL_CB_READ) ? "reading" : "writing";
-    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-      "[tls.info] %s: SSL/TLS alert %s: %s", str,
-      SSL_alert_type_string_long(ret), SSL_alert_desc_string_long(ret));
+    case TLS_DIAG_INFO_ALERT:
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "[tls.info] %s: SSL/TLS alert %s: %s",
+        (ev->where & SSL_CB_READ) ? "reading" : "writing",
+        SSL_alert_type_string_long(ev->ret),
+        SSL_alert_desc_string_long(ev->ret));
+      break;
 
-  } else if (where & SSL_CB_EXIT) {
-    if (ret == 0) {
+    case TLS_DIAG_INFO_FAILED:
       (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-        "[tls.info] %s: failed in %s: %s", str, SSL_state_string_long(ssl),
-        proxy_tls_get_errors());
+        "[tls.info] %s: failed in %s: %s", ev->str, ev->state_str,
+        ev->errors);
+      break;
 
-    } else if (ret < 0 &&
-               errno != 0 &&
-               errno != EAGAIN) {
-      /* Ignore EAGAIN errors */
+    case TLS_DIAG_INFO_ERROR:
       (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-        "[tls.info] %s: error in %s (errno %d: %s)", str,
-        SSL_state_string_long(ssl), errno, strerror(errno));
-    }
+        "[tls.info] %s: error in %s (errno %d: %s)", ev->str, ev->state_str,
+        ev->xerrno, strerror(ev->xerrno));
+      break;
   }
 }
 
@@ -3527,7 +4621,7 @@ static void tls_print_server_hello(int io_flag, int version, int content_type,
 
 # if defined(SSL3_MT_NEWSESSION_TICKET)
 static void tls_print_ticket(int io_flag, int version, int content_type,
-    const unsigned char *buf, size_t buflen, SSL *ssl, void *arg) {
+    const unsigned char *buf, size_t buflen, int ssl_version) {
   BIO *bio;
   char *data = NULL;
   long datalen;
@@ -3545,7 +4639,7 @@ static void tls_print_ticket(int io_flag, int version, int content_type,
     BIO_printf(bio, "  ticket_lifetime_hint\n    %u (sec)\n", ticket_lifetime);
 
 #  if defined(TLS1_3_VERSION)
-    if (SSL_version(ssl) == TLS1_3_VERSION) {
+    if (ssl_version == TLS1_3_VERSION) {
       print_ticket_age = TRUE;
       print_extensions = TRUE;
     }
@@ -3583,11 +4677,20 @@ static void tls_print_ticket(int io_flag, int version, int content_type,
 # endif /* SSL3_MT_NEWSESSION_TICKET */
 
 #if !defined(OPENSSL_NO_TLSEXT)
-static void tls_tlsext_cb(SSL *ssl, int server, int type,
-    unsigned char *tlsext_data, int tlsext_datalen, void *user_data) {
+static void tls_diag_log_tlsext(const struct tls_diag_event *ev) {
+  const unsigned char *tlsext_data;
+  int server, type, tlsext_datalen, print_detail;
   char *extension_name = "(unknown)";
   int print_basic_info = TRUE;
 
+  server = ev->server;
+  type = ev->ext_type;
+  tlsext_data = ev->data;
+  tlsext_datalen = (int) ev->datalen;
+
+  /* Only extensions whose data was kept in full can be printed in detail. */
+  print_detail = (ev->data_keptlen == ev->datalen);
+
   /* Note: OpenSSL does not implement all possible extensions.  For the
    * "(unknown)" extensions, see:
    *
@@ -3602,7 +4705,8 @@ static void tls_tlsext_cb(SSL *ssl, int server, int type,
 
       extension_name = "server name";
 
-      if (pr_trace_get_level(trace_channel) >= 21 &&
+      if ((tls_diag_mask & TLS_DIAG_FL_TRACE21) &&
+          print_detail == TRUE &&
           tlsext_datalen >= 2) {
 
         /* We read 2 bytes for the extension length, 1 byte for the
@@ -3621,12 +4725,17 @@ static void tls_tlsext_cb(SSL *ssl, int server, int type,
           name_type = tlsext_data[0];
           tlsext_data += 1;
 
-          if (name_type == TLSEXT_NAMETYPE_host_name) {
+          if (name_type == TLSEXT_NAMETYPE_host_name &&
+              ext_len >= 3) {
             size_t name_len;
 
             name_len = (tlsext_data[0] << 8) | tlsext_data[1];
             tlsext_data += 2;
 
+            if (name_len > (size_t) (ext_len - 3)) {
+              name_len = ext_len - 3;
+            }
+
             bio = BIO_new(BIO_s_mem());
             BIO_printf(bio, "\n  %.*s (%lu)", (int) name_len, tlsext_data,
               (unsigned long) name_len);
@@ -3733,7 +4842,8 @@ static void tls_tlsext_cb(SSL *ssl, int server, int type,
 
       extension_name = "signature algorithms";
 
-      if (pr_trace_get_level(trace_channel) >= 21 &&
+      if ((tls_diag_mask & TLS_DIAG_FL_TRACE21) &&
+          print_detail == TRUE &&
           tlsext_datalen >= 2) {
         int len;
 
@@ -3834,7 +4944,8 @@ static void tls_tlsext_cb(SSL *ssl, int server, int type,
 
       extension_name = "supported versions";
 
-      if (pr_trace_get_level(trace_channel) >= 21) {
+      if ((tls_diag_mask & TLS_DIAG_FL_TRACE21) &&
+          print_detail == TRUE) {
         bio = BIO_new(BIO_s_mem());
 
         if (server) {
@@ -3900,7 +5011,8 @@ static void tls_tlsext_cb(SSL *ssl, int server, int type,
 
       extension_name = "PSK KEX modes";
 
-      if (pr_trace_get_level(trace_channel) >= 19) {
+      if ((tls_diag_mask & TLS_DIAG_FL_TRACE19) &&
+          print_detail == TRUE) {
         if (tlsext_datalen >= 1) {
           int len;
 
@@ -4001,13 +5113,75 @@ static void tls_tlsext_cb(SSL *ssl, int server, int type,
       tlsext_datalen != 1 ? "bytes" : "byte");
   }
 }
+
+static void tls_tlsext_cb(SSL *ssl, int server, int type,
+    unsigned char *tlsext_data, int tlsext_datalen, void *user_data) {
+  struct tls_diag_event *ev;
+  size_t maxlen = 0;
+
+  if (!(tls_diag_mask & TLS_DIAG_FL_TLSEXT)) {
+    return;
+  }
+
+  ev = tls_diag_next_event(TLS_DIAG_EVENT_TLSEXT);
+  if (ev == NULL) {
+    return;
+  }
+
+  ev->server = server;
+  ev->ext_type = type;
+
+  /* Only keep the data of those extensions which will be printed in detail,
+   * per the trace level.
+   */
+  switch (type) {
+# if defined(TLSEXT_TYPE_server_name)
+    case TLSEXT_TYPE_server_name:
+# endif /* TLSEXT_TYPE_server_name */
+# if defined(TLSEXT_TYPE_signature_algorithms)
+    case TLSEXT_TYPE_signature_algorithms:
+# endif /* TLSEXT_TYPE_signature_algorithms */
+# if defined(TLSEXT_TYPE_supported_versions)
+    case TLSEXT_TYPE_supported_versions:
+# endif /* TLSEXT_TYPE_supported_versions */
+      if (tls_diag_mask & TLS_DIAG_FL_TRACE21) {
+        maxlen = TLS_DIAG_MAX_DATALEN;
+      }
+      break;
+
+# if defined(TLSEXT_TYPE_psk_kex_modes)
+    case TLSEXT_TYPE_psk_kex_modes:
+      if (tls_diag_mask & TLS_DIAG_FL_TRACE19) {
+        maxlen = TLS_DIAG_MAX_DATALEN;
+      }
+      break;
+# endif /* TLSEXT_TYPE_psk_kex_modes */
+
+    default:
+      break;
+  }
+
+  tls_diag_keep_data(ev, tlsext_data,
+    tlsext_datalen > 0 ? (size_t) tlsext_datalen : 0, maxlen);
+  tls_diag_recorded();
+}
 #endif /* OPENSSL_NO_TLSEXT */
 
-static void tls_msg_cb(int io_flag, int version, int content_type,
-    const void *buf, size_t buflen, SSL *ssl, void *arg) {
+static void tls_diag_log_msg(const struct tls_diag_event *ev) {
+  int io_flag, version, content_type;
+  const void *buf;
+  size_t buflen, keptlen;
   char *action_str = NULL;
   char *version_str = NULL;
-  char *bytes_str = buflen != 1 ? "bytes" : "byte";
+  char *bytes_str;
+
+  io_flag = ev->io_flag;
+  version = ev->version;
+  content_type = ev->content_type;
+  buf = ev->data;
+  buflen = ev->datalen;
+  keptlen = ev->data_keptlen;
+  bytes_str = buflen != 1 ? "bytes" : "byte";
 
   if (io_flag == 0) {
     action_str = "received";
@@ -4090,7 +5264,8 @@ static void tls_msg_cb(int io_flag, int version, int content_type,
         pr_trace_msg(trace_channel, 27,
           "%s %s Alert (%u %s)", action_str, version_str,
           (unsigned int) buflen, bytes_str);
-        if (buflen == 2) {
+        if (buflen == 2 &&
+            keptlen == 2) {
           char *severity_str = NULL;
 
           /* Peek naughtily into the buffer. */
@@ -4214,7 +5389,7 @@ static void tls_msg_cb(int io_flag, int version, int content_type,
         pr_trace_msg(trace_channel, 27,
           "%s %s Handshake (%u %s)", action_str, version_str,
           (unsigned int) buflen, bytes_str);
-        if (buflen > 0) {
+        if (keptlen > 0) {
           /* Peek naughtily into the buffer. */
           switch (((const unsigned char *) buf)[0]) {
             case SSL3_MT_HELLO_REQUEST:
@@ -4228,13 +5403,15 @@ static void tls_msg_cb(int io_flag, int version, int content_type,
               size_t msglen;
 
               msg = buf;
-              msglen = buflen;
+              msglen = keptlen;
 
               (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
                 "[tls.msg] %s %s 'ClientHello' Handshake message (%u %s)",
                 action_str, version_str, (unsigned int) buflen, bytes_str);
-              tls_print_client_hello(io_flag, version, content_type, msg + 4,
-                msglen - 4, ssl, arg);
+              if (msglen > 4) {
+                tls_print_client_hello(io_flag, version, content_type,
+                  msg + 4, msglen - 4, NULL, NULL);
+              }
 
               break;
             }
@@ -4244,13 +5421,15 @@ static void tls_msg_cb(int io_flag, int version, int content_type,
               size_t msglen;
 
               msg = buf;
-              msglen = buflen;
+              msglen = keptlen;
 
               (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
                 "[tls.msg] %s %s 'ServerHello' Handshake message (%u %s)",
                 action_str, version_str, (unsigned int) buflen, bytes_str);
-              tls_print_server_hello(io_flag, version, content_type, msg + 4,
-                msglen - 4, ssl, arg);
+              if (msglen > 4) {
+                tls_print_server_hello(io_flag, version, content_type,
+                  msg + 4, msglen - 4, NULL, NULL);
+              }
 
               break;
             }
@@ -4261,13 +5440,15 @@ static void tls_msg_cb(int io_flag, int version, int content_type,
               size_t msglen;
 
               msg = buf;
-              msglen = buflen;
+              msglen = keptlen;
 
               (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
                 "[tls.msg] %s %s 'NewSessionTicket' Handshake message (%u %s)",
                 action_str, version_str, (unsigned int) buflen, bytes_str);
-              tls_print_ticket(io_flag, version, content_type, msg + 4,
-                msglen - 4, ssl, arg);
+              if (msglen >= 4) {
+                tls_print_ticket(io_flag, version, content_type, msg + 4,
+                  msglen - 4, ev->ssl_version);
+              }
 
               break;
             }
@@ -4336,7 +5517,7 @@ static void tls_msg_cb(int io_flag, int version, int content_type,
               long datalen;
 
               msg = buf;
-              msglen = buflen;
+              msglen = keptlen;
 
               (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
                 "[tls.msg] %s %s 'EncryptedExtensions' Handshake message "
@@ -4363,6 +5544,14 @@ static void tls_msg_cb(int io_flag, int version, int content_type,
 #  endif /* SSL3_MT_ENCRYPTED_EXTENSIONS */
           }
 
+          /* Only the messages printed in detail keep this much data. */
+          if (keptlen == TLS_DIAG_MAX_DATALEN &&
+              keptlen < buflen) {
+            (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+              "[tls.msg] (message details truncated to %lu bytes)",
+              (unsigned long) keptlen);
+          }
+
         } else {
           (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
             "[tls.msg] %s %s Handshake message, unknown type %d (%u %s)",
@@ -4377,7 +5566,8 @@ static void tls_msg_cb(int io_flag, int version, int content_type,
 #  if defined(SSL3_RT_HEADER)
   } else if (version == 0 &&
              content_type == SSL3_RT_HEADER &&
-             buflen == SSL3_RT_HEADER_LENGTH) {
+             buflen == SSL3_RT_HEADER_LENGTH &&
+             keptlen == SSL3_RT_HEADER_LENGTH) {
     const unsigned char *msg;
     const char *record_type;
     unsigned int msg_len;
@@ -4402,9 +5592,522 @@ static void tls_msg_cb(int io_flag, int version, int content_type,
       action_str, version, content_type, (unsigned int) buflen, bytes_str);
   }
 }
+
+static void tls_msg_cb(int io_flag, int version, int content_type,
+    const void *buf, size_t buflen, SSL *ssl, void *arg) {
+  struct tls_diag_event *ev;
+  size_t maxlen = TLS_DIAG_INLINE_DATALEN;
+
+  if (!(tls_diag_mask & TLS_DIAG_FL_MSG)) {
+    return;
+  }
+
+  ev = tls_diag_next_event(TLS_DIAG_EVENT_MSG);
+  if (ev == NULL) {
+    return;
+  }
+
+  ev->io_flag = io_flag;
+  ev->version = version;
+  ev->content_type = content_type;
+  ev->ssl_version = SSL_version(ssl);
+
+  /* Only the handshake messages which are printed in detail need all of
+   * their data; for the rest, the first few bytes suffice.
+   */
+  if (content_type == SSL3_RT_HANDSHAKE &&
+      buflen > 0) {
+    switch (((const unsigned char *) buf)[0]) {
+      case SSL3_MT_CLIENT_HELLO:
+      case SSL3_MT_SERVER_HELLO:
+#  if defined(SSL3_MT_NEWSESSION_TICKET)
+      case SSL3_MT_NEWSESSION_TICKET:
+#  endif /* SSL3_MT_NEWSESSION_TICKET */
+#  if defined(SSL3_MT_ENCRYPTED_EXTENSIONS)
+      case SSL3_MT_ENCRYPTED_EXTENSIONS:
+#  endif /* SSL3_MT_ENCRYPTED_EXTENSIONS */
+        maxlen = TLS_DIAG_MAX_DATALEN;
+        break;
+
+      default:
+        break;
+    }
+  }
+
+  tls_diag_keep_data(ev, buf, buflen, maxlen);
+  tls_diag_recorded();
+}
 # endif /* OpenSSL-0.9.7 or later */
+
+int proxy_tls_diags_init(pool *p, unsigned int count, unsigned long flags) {
+  int level;
+
+  if (p == NULL ||
+      count == 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  (void) proxy_tls_diags_free();
+
+  tls_diag_pool = make_sub_pool(p);
+  pr_pool_tag(tls_diag_pool, "Proxy TLS diagnostics pool");
+
+  tls_diag_size = count;
+  tls_diag_flags = flags;
+
+  /* Determine, once, which events to record and in how much detail, so
+   * that the callbacks need not check the trace levels for every event.
+   */
+  tls_diag_mask = TLS_DIAG_FL_INFO|TLS_DIAG_FL_MSG|TLS_DIAG_FL_TLSEXT;
+
+  level = pr_trace_get_level(trace_channel);
+  if (level >= 9) {
+    tls_diag_mask |= TLS_DIAG_FL_TRACE9;
+  }
+
+  if (level >= 19) {
+    tls_diag_mask |= TLS_DIAG_FL_TRACE19;
+  }
+
+  if (level >= 21) {
+    tls_diag_mask |= TLS_DIAG_FL_TRACE21;
+  }
+
+  return 0;
+}
+
+int proxy_tls_diags_free(void) {
+  if (tls_diag_pool != NULL) {
+    destroy_pool(tls_diag_pool);
+    tls_diag_pool = NULL;
+  }
+
+  tls_diag_events = NULL;
+  tls_diag_size = 0;
+  tls_diag_mask = 0;
+  tls_diag_flags = 0UL;
+  tls_diag_clear();
+
+  return 0;
+}
+
+int proxy_tls_diags_set_callbacks(SSL *ssl) {
+  if (ssl == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (tls_diag_mask == 0) {
+    /* Diagnostics are not enabled; avoid the callback overhead entirely. */
+    return 0;
+  }
+
+  /* Each handshake starts with an empty buffer. */
+  tls_diag_clear();
+
+  SSL_set_info_callback(ssl, tls_info_cb);
+# if OPENSSL_VERSION_NUMBER > 0x000907000L
+  SSL_set_msg_callback(ssl, tls_msg_cb);
+# endif /* OpenSSL-0.9.7 or later */
+# if !defined(OPENSSL_NO_TLSEXT)
+  SSL_set_tlsext_debug_callback(ssl, tls_tlsext_cb);
+# endif /* OPENSSL_NO_TLSEXT */
+
+  return 0;
+}
+
+int proxy_tls_diags_flush(void) {
+  register unsigned int i;
+  unsigned int count;
+
+  count = tls_diag_count;
+  if (count == 0) {
+    return 0;
+  }
+
+  if (tls_diag_dropped > 0) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "[tls.diags] %lu earlier %s dropped", tls_diag_dropped,
+      tls_diag_dropped != 1 ? "events" : "event");
+  }
+
+  for (i = 0; i < count; i++) {
+    const struct tls_diag_event *ev;
+
+    ev = &(tls_diag_events[(tls_diag_start + i) % tls_diag_size]);
+    switch (ev->type) {
+      case TLS_DIAG_EVENT_INFO:
+        tls_diag_log_info(ev);
+        break;
+
+# if OPENSSL_VERSION_NUMBER > 0x000907000L
+      case TLS_DIAG_EVENT_MSG:
+        tls_diag_log_msg(ev);
+        break;
+
+#  if !defined(OPENSSL_NO_TLSEXT)
+      case TLS_DIAG_EVENT_TLSEXT:
+        tls_diag_log_tlsext(ev);
+        break;
+#  endif /* OPENSSL_NO_TLSEXT */
+# endif /* OpenSSL-0.9.7 or later */
+
+      default:
+        break;
+    }
+  }
+
+  tls_diag_clear();
+  return (int) count;
+}
+
+unsigned int proxy_tls_diags_get_count(void) {
+  return tls_diag_count;
+}
+
+int proxy_tls_set_buffer_policy(int role, int policy, size_t read_buflen) {
+  if (role != PROXY_TLS_BUFFER_ROLE_CTRL &&
+      role != PROXY_TLS_BUFFER_ROLE_DATA) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  switch (policy) {
+    case PROXY_TLS_BUFFER_POLICY_RELEASE:
+    case PROXY_TLS_BUFFER_POLICY_KEEP:
+      break;
+
+    case PROXY_TLS_BUFFER_POLICY_READ_AHEAD:
+      if (role == PROXY_TLS_BUFFER_ROLE_CTRL) {
+        errno = EPERM;
+        return -1;
+      }
+      break;
+
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  tls_buffer_policies[role].policy = policy;
+  tls_buffer_policies[role].read_buflen = read_buflen;
+  return 0;
+}
+
+int proxy_tls_get_buffer_policy(int role, int *policy, size_t *read_buflen) {
+  if (role != PROXY_TLS_BUFFER_ROLE_CTRL &&
+      role != PROXY_TLS_BUFFER_ROLE_DATA) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (policy == NULL &&
+      read_buflen == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (policy != NULL) {
+    *policy = tls_buffer_policies[role].policy;
+  }
+
+  if (read_buflen != NULL) {
+    *read_buflen = tls_buffer_policies[role].read_buflen;
+  }
+
+  return 0;
+}
+
+int proxy_tls_apply_buffer_policy(SSL *ssl, int role) {
+  const struct tls_buffer_policy *policy;
+
+  if (ssl == NULL ||
+      (role != PROXY_TLS_BUFFER_ROLE_CTRL &&
+       role != PROXY_TLS_BUFFER_ROLE_DATA)) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  policy = &(tls_buffer_policies[role]);
+
+#if OPENSSL_VERSION_NUMBER >= 0x1000001fL
+  /* The SSL_CTX sets SSL_MODE_RELEASE_BUFFERS for every connection; undo
+   * that for the roles which keep their buffers.
+   */
+  if (policy->policy == PROXY_TLS_BUFFER_POLICY_RELEASE) {
+    SSL_set_mode(ssl, SSL_MODE_RELEASE_BUFFERS);
+
+  } else {
+    SSL_clear_mode(ssl, SSL_MODE_RELEASE_BUFFERS);
+  }
+#endif /* OpenSSL-1.0.0a and later */
+
+  if (policy->policy == PROXY_TLS_BUFFER_POLICY_READ_AHEAD) {
+    SSL_set_read_ahead(ssl, 1);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && \
+    !defined(HAVE_LIBRESSL)
+    if (policy->read_buflen > 0) {
+      SSL_set_default_read_buffer_len(ssl, policy->read_buflen);
+    }
+#endif /* OpenSSL-1.1.0 and later */
+
+  } else {
+    SSL_set_read_ahead(ssl, 0);
+  }
+
+  pr_trace_msg(trace_channel, 19, "using %s buffer policy for %s connection",
+    policy->policy == PROXY_TLS_BUFFER_POLICY_RELEASE ? "release" :
+      policy->policy == PROXY_TLS_BUFFER_POLICY_KEEP ? "keep" : "read-ahead",
+    role == PROXY_TLS_BUFFER_ROLE_DATA ? "data" : "control");
+  return 0;
+}
+
+int proxy_tls_set_shutdown_policy(int policy, unsigned int linger_ms) {
+  switch (policy) {
+    case PROXY_TLS_SHUTDOWN_POLICY_BIDIRECTIONAL:
+    case PROXY_TLS_SHUTDOWN_POLICY_UNIDIRECTIONAL:
+    case PROXY_TLS_SHUTDOWN_POLICY_DEFERRED:
+      break;
+
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  if (linger_ms == 0) {
+    linger_ms = PROXY_TLS_DEFAULT_SHUTDOWN_LINGER_MS;
+  }
+
+  tls_shutdown_policy = policy;
+  tls_shutdown_linger_ms = linger_ms;
+  return 0;
+}
+
+int proxy_tls_get_shutdown_policy(int *policy, unsigned int *linger_ms) {
+  if (policy == NULL &&
+      linger_ms == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  if (policy != NULL) {
+    *policy = tls_shutdown_policy;
+  }
+
+  if (linger_ms != NULL) {
+    *linger_ms = tls_shutdown_linger_ms;
+  }
+
+  return 0;
+}
+
+int proxy_tls_end_data_sess(SSL *ssl, int fd) {
+  struct tls_deferred_shutdown *deferred;
+  int flags, res, sent_shutdown = FALSE, deferred_fd;
+  uint64_t now, expires_ms;
+
+  if (ssl == NULL ||
+      fd < 0) {
+    errno = EINVAL;
+    return -1;
+  }
+
+  /* Whatever the policy, we never block on the server indefinitely. */
+  flags = fcntl(fd, F_GETFL);
+  if (flags >= 0 &&
+      !(flags & O_NONBLOCK)) {
+    (void) fcntl(fd, F_SETFL, flags|O_NONBLOCK);
+  }
+
+  res = tls_shutdown_step(ssl, &sent_shutdown);
+  if (res != 0 ||
+      tls_shutdown_policy == PROXY_TLS_SHUTDOWN_POLICY_UNIDIRECTIONAL) {
+    pr_trace_msg(trace_channel, 17, "TLS data session on fd %d %s", fd,
+      res == 1 ? "cleanly shut down" :
+        res == 0 ? "shut down without awaiting 'close_notify'" :
+        "shut down uncleanly");
+    SSL_free(ssl);
+    return 0;
+  }
+
+  (void) pr_gettimeofday_millis(&now);
+  expires_ms = now + tls_shutdown_linger_ms;
+
+  if (tls_shutdown_policy == PROXY_TLS_SHUTDOWN_POLICY_BIDIRECTIONAL) {
+    while (res == 0 &&
+           now < expires_ms) {
+      fd_set rfds, wfds;
+      struct timeval tv;
+      uint64_t remaining_ms;
+
+      FD_ZERO(&rfds);
+      FD_ZERO(&wfds);
+
+      if (SSL_want_write(ssl)) {
+        FD_SET(fd, &wfds);
+
+      } else {
+        FD_SET(fd, &rfds);
+      }
+
+      remaining_ms = expires_ms - now;
+      tv.tv_sec = remaining_ms / 1000;
+      tv.tv_usec = (remaining_ms % 1000) * 1000;
+
+      if (select(fd + 1, &rfds, &wfds, NULL, &tv) < 0) {
+        if (errno != EINTR) {
+          break;
+        }
+
+        pr_signals_handle();
+      }
+
+      res = tls_shutdown_step(ssl, &sent_shutdown);
+      (void) pr_gettimeofday_millis(&now);
+    }
+
+    pr_trace_msg(trace_channel, 17, "TLS data session on fd %d %s", fd,
+      res == 1 ? "cleanly shut down" :
+        res == 0 ? "shut down after timing out awaiting 'close_notify'" :
+        "shut down uncleanly");
+    SSL_free(ssl);
+    return 0;
+  }
+
+  /* Reap what we can now, and make room for this one if need be.  Since
+   * freeing an entry moves the last one into its slot, the table is not in
+   * deferral order; the oldest is the one which expires first.
+   */
+  if (proxy_tls_reap_data_sess(FALSE) == PROXY_TLS_MAX_DEFERRED_SHUTDOWNS) {
+    register unsigned int i;
+    unsigned int oldest_idx = 0;
+
+    for (i = 1; i < tls_deferred_count; i++) {
+      if (tls_deferred_shutdowns[i].expires_ms <
+          tls_deferred_shutdowns[oldest_idx].expires_ms) {
+        oldest_idx = i;
+      }
+    }
+
+    pr_trace_msg(trace_channel, 9,
+      "too many deferred TLS data shutdowns, abandoning oldest (fd %d)",
+      tls_deferred_shutdowns[oldest_idx].fd);
+    tls_free_deferred_shutdown(oldest_idx);
+  }
+
+  /* The caller closes its fd, so keep our own on the socket. */
+  deferred_fd = dup(fd);
+  if (deferred_fd < 0) {
+    pr_trace_msg(trace_channel, 9,
+      "error duplicating fd %d for deferred TLS shutdown: %s", fd,
+      strerror(errno));
+    SSL_free(ssl);
+    return 0;
+  }
+
+  if (SSL_set_fd(ssl, deferred_fd) != 1) {
+    pr_trace_msg(trace_channel, 9,
+      "error setting fd %d for deferred TLS shutdown: %s", deferred_fd,
+      proxy_tls_get_errors());
+    (void) close(deferred_fd);
+    SSL_free(ssl);
+    return 0;
+  }
+
+  deferred = &(tls_deferred_shutdowns[tls_deferred_count++]);
+  deferred->ssl = ssl;
+  deferred->fd = deferred_fd;
+  deferred->sent_shutdown = sent_shutdown;
+  deferred->expires_ms = expires_ms;
+
+  if (tls_deferred_timer_id < 0) {
+    tls_deferred_timer_id = pr_timer_add(1, -1, &proxy_module,
+      tls_deferred_shutdown_cb, "TLS data shutdown");
+  }
+
+  pr_trace_msg(trace_channel, 17,
+    "deferred TLS data session shutdown on fd %d (%u pending)", deferred_fd,
+    tls_deferred_count);
+  return 1;
+}
+
+int proxy_tls_reap_data_sess(int force) {
+  register unsigned int i;
+  uint64_t now;
+
+  (void) pr_gettimeofday_millis(&now);
+
+  i = 0;
+  while (i < tls_deferred_count) {
+    struct tls_deferred_shutdown *deferred;
+    int res = 0;
+
+    deferred = &(tls_deferred_shutdowns[i]);
+    if (force == FALSE) {
+      res = tls_shutdown_step(deferred->ssl, &(deferred->sent_shutdown));
+      if (res == 0 &&
+          now < deferred->expires_ms) {
+        i++;
+        continue;
+      }
+    }
+
+    pr_trace_msg(trace_channel, 17,
+      "deferred TLS data session on fd %d %s", deferred->fd,
+      res == 1 ? "cleanly shut down" :
+        res == 0 ? "abandoned awaiting 'close_notify'" :
+        "shut down uncleanly");
+    tls_free_deferred_shutdown(i);
+  }
+
+  if (force == TRUE &&
+      tls_deferred_timer_id >= 0) {
+    pr_timer_remove(tls_deferred_timer_id, &proxy_module);
+    tls_deferred_timer_id = -1;
+  }
+
+  return (int) tls_deferred_count;
+}
 #endif /* PR_USE_OPENSSL */
 
+int proxy_tls_get_poll_flags(pr_netio_stream_t *nstrm) {
+  int flags = PROXY_TLS_POLL_FL_READ;
+#if defined(PR_USE_OPENSSL)
+  SSL *ssl;
+#endif /* PR_USE_OPENSSL */
+
+  if (nstrm == NULL) {
+    errno = EINVAL;
+    return -1;
+  }
+
+#if defined(PR_USE_OPENSSL)
+  if (nstrm->notes == NULL) {
+    return flags;
+  }
+
+  ssl = (SSL *) pr_table_get(nstrm->notes, PROXY_TLS_NETIO_NOTE, NULL);
+  if (ssl == NULL) {
+    return flags;
+  }
+
+  /* Data already read ahead, or decrypted but not yet consumed, will not
+   * make the fd readable again.
+   */
+  if (tls_has_pending(ssl)) {
+    return PROXY_TLS_POLL_FL_PENDING;
+  }
+
+  if (SSL_want_write(ssl)) {
+    flags = PROXY_TLS_POLL_FL_WRITE;
+  }
+#endif /* PR_USE_OPENSSL */
+
+  return flags;
+}
+
 int proxy_tls_sess_init(pool *p, struct proxy_session *proxy_sess, int flags) {
 #if defined(PR_USE_OPENSSL)
   config_rec *c;
@@ -4474,6 +6177,42 @@ int proxy_tls_sess_init(pool *p, struct proxy_session *proxy_sess, int flags) {
     tls_protocol = *((unsigned int *) c->argv[0]);
   }
 
+  c = find_config(main_server->conf, CONF_PARAM, "ProxyTLSBufferPolicy",
+    FALSE);
+  while (c != NULL) {
+    int role, policy;
+    size_t read_buflen;
+
+    pr_signals_handle();
+
+    role = *((int *) c->argv[0]);
+    policy = *((int *) c->argv[1]);
+    read_buflen = *((size_t *) c->argv[2]);
+
+    if (proxy_tls_set_buffer_policy(role, policy, read_buflen) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "error setting ProxyTLSBufferPolicy: %s", strerror(errno));
+    }
+
+    c = find_config_next(c, c->next, CONF_PARAM, "ProxyTLSBufferPolicy",
+      FALSE);
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "ProxyTLSShutdownPolicy",
+    FALSE);
+  if (c != NULL) {
+    int policy;
+    unsigned int linger_ms;
+
+    policy = *((int *) c->argv[0]);
+    linger_ms = *((unsigned int *) c->argv[1]);
+
+    if (proxy_tls_set_shutdown_policy(policy, linger_ms) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "error setting ProxyTLSShutdownPolicy: %s", strerror(errno));
+    }
+  }
+
   disabled_proto = get_disabled_protocols(tls_protocol);
 
   /* Per the comments in <ssl/ssl.h>, SSL_CTX_set_options() uses |= on
@@ -4746,10 +6485,17 @@ int proxy_tls_sess_init(pool *p, struct proxy_session *proxy_sess, int flags) {
   }
 
   if (tls_opts & PROXY_TLS_OPT_ENABLE_DIAGS) {
-    SSL_CTX_set_info_callback(ssl_ctx, tls_info_cb);
-# if OPENSSL_VERSION_NUMBER > 0x000907000L
-    SSL_CTX_set_msg_callback(ssl_ctx, tls_msg_cb);
-# endif
+    unsigned long diag_flags = 0UL;
+
+    if (tls_opts & PROXY_TLS_OPT_LOG_ALL_DIAGS) {
+      diag_flags |= PROXY_TLS_DIAGS_FL_LOG_ALL;
+    }
+
+    if (proxy_tls_diags_init(p, PROXY_TLS_DIAGS_DEFAULT_COUNT,
+        diag_flags) < 0) {
+      pr_trace_msg(trace_channel, 3,
+        "error initializing TLS diagnostics: %s", strerror(errno));
+    }
   }
 
   if (netio_install_ctrl() < 0) {
@@ -4783,6 +6529,8 @@ int proxy_tls_sess_free(pool *p) {
     tls_opts = 0UL;
     tls_engine = PROXY_TLS_ENGINE_AUTO;
     tls_verify_server = TRUE;
+    memset(tls_verify_host, '\0', sizeof(tls_verify_host));
+    tls_verify_cached = FALSE;
     tls_cipher_suite = NULL;
 # if OPENSSL_VERSION_NUMBER >= 0x10101000L && \
      defined(TLS1_3_VERSION)
@@ -4800,6 +6548,29 @@ int proxy_tls_sess_free(pool *p) {
       tls_ds.dsh = NULL;
     }
 
+    pr_trace_msg(trace_channel, 9,
+      "verified certificate cache: %lu lookups, %lu hits, %lu misses, "
+      "%lu expired, %lu adds, %lu evictions", tls_verify_stats.lookups,
+      tls_verify_stats.hits, tls_verify_stats.misses, tls_verify_stats.expired,
+      tls_verify_stats.adds, tls_verify_stats.evictions);
+    proxy_tls_verify_cache_clear();
+# if !defined(OPENSSL_NO_TLSEXT) && defined(TLSEXT_STATUSTYPE_ocsp)
+    memset(tls_ocsp_cache, 0, sizeof(tls_ocsp_cache));
+# endif /* OCSP support */
+    (void) proxy_tls_diags_free();
+
+    tls_buffer_policies[PROXY_TLS_BUFFER_ROLE_CTRL].policy =
+      PROXY_TLS_BUFFER_POLICY_RELEASE;
+    tls_buffer_policies[PROXY_TLS_BUFFER_ROLE_CTRL].read_buflen = 0;
+    tls_buffer_policies[PROXY_TLS_BUFFER_ROLE_DATA].policy =
+      PROXY_TLS_BUFFER_POLICY_READ_AHEAD;
+    tls_buffer_policies[PROXY_TLS_BUFFER_ROLE_DATA].read_buflen =
+      PROXY_TLS_DEFAULT_READ_BUFFER_LEN;
+
+    (void) proxy_tls_reap_data_sess(TRUE);
+    tls_shutdown_policy = PROXY_TLS_SHUTDOWN_POLICY_DEFERRED;
+    tls_shutdown_linger_ms = PROXY_TLS_DEFAULT_SHUTDOWN_LINGER_MS;
+
     if (ssl_ctx != NULL) {
       if (init_ssl_ctx() < 0) {
         return -1;
@@ -30,24 +30,32 @@
 #include "proxy/random.h"
 #include "proxy/db.h"
 #include "proxy/session.h"
+#include "proxy/sockopts.h"
 #include "proxy/conn.h"
 #include "proxy/netio.h"
 #include "proxy/inet.h"
 #include "proxy/ssh.h"
 #include "proxy/tls.h"
 #include "proxy/forward.h"
+#include "proxy/forward/dstcache.h"
+#include "proxy/forward/filter.h"
 #include "proxy/reverse.h"
+#include "proxy/ftp/ascii.h"
 #include "proxy/ftp/conn.h"
 #include "proxy/ftp/ctrl.h"
 #include "proxy/ftp/data.h"
+#include "proxy/ftp/dircache.h"
 #include "proxy/ftp/dirlist.h"
 #include "proxy/ftp/facts.h"
+#include "proxy/ftp/modez.h"
 #include "proxy/ftp/msg.h"
 #include "proxy/ftp/sess.h"
 #include "proxy/ftp/xfer.h"
 #include "proxy/ssh/ssh2.h"
 #include "proxy/ssh/auth.h"
 #include "proxy/ssh/crypto.h"
+#include "proxy/ssh/packet.h"
+#include "proxy/ssh/pktlog.h"
 
 #if defined(HAVE_OSSL_PROVIDER_LOAD_OPENSSL)
 # include <openssl/provider.h>
@@ -63,6 +71,9 @@
 /* How long (in secs) to wait for the end-of-data-transfer response? */
 #define PROXY_LINGER_DEFAULT_TIMEOUT	3
 
+/* How often (in secs) to reset the transfer timers during data transfers? */
+#define PROXY_TIMER_DEFAULT_TICK	1
+
 extern xaset_t *server_list;
 extern module xfer_module;
 
@@ -85,6 +96,32 @@ static int proxy_role = PROXY_ROLE_REVERSE;
 static const char *proxy_tables_dir = NULL;
 static int proxy_tls_xfer_prot_policy = PROXY_FTP_SESS_TLS_XFER_PROTECTION_POLICY_REQUIRED;
 
+/* Set when the client asked for ASCII mode, but we asked the backend server
+ * for binary mode, and thus do the ASCII translation ourselves.
+ */
+static int proxy_ascii_xlate = FALSE;
+
+/* Set when the client itself asked for MODE Z, in which case the compressed
+ * data is relayed as is.
+ */
+static int proxy_client_mode_z = FALSE;
+
+/* The offset of the client's last REST command, for resuming interrupted
+ * downloads; -1 if we could not parse it.
+ */
+static off_t proxy_restart_pos = 0;
+
+/* How many times we try to resume an interrupted download (ProxyRetryCount).
+ */
+static int proxy_resume_count = PROXY_DEFAULT_RETRY_COUNT;
+
+/* The per-batch budgets for bulk data transfers (ProxyDataBulkTransfer); a
+ * max bytes of zero means that the control connections are polled for every
+ * buffer relayed.
+ */
+static off_t proxy_bulk_max_bytes = PROXY_FTP_DATA_BULK_DEFAULT_MAX_BYTES;
+static unsigned int proxy_bulk_max_millis = PROXY_FTP_DATA_BULK_DEFAULT_MAX_MILLIS;
+
 #if defined(HAVE_OSSL_PROVIDER_LOAD_OPENSSL)
 static OSSL_PROVIDER *legacy_provider = NULL;
 #endif /* HAVE_OSSL_PROVIDER_LOAD_OPENSSL */
@@ -204,8 +241,8 @@ MODRET proxy_abort(cmd_rec *cmd, struct proxy_session *proxy_sess,
   if (proxy_sess->backend_data_conn != NULL) {
     pr_trace_msg(trace_channel, 19, "received ABOR on frontend connection, "
       "closing backend data connection");
-    proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-    pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
     proxy_sess->backend_data_conn = NULL;
   }
 
@@ -502,6 +539,113 @@ static void proxy_restrict_session(void) {
 /* Configuration handlers
  */
 
+/* usage: ProxyDataBulkTransfer on|off [MaxBytes bytes] [MaxMillis millis] */
+MODRET set_proxydatabulktransfer(cmd_rec *cmd) {
+  register unsigned int i;
+  int engine;
+  off_t max_bytes = PROXY_FTP_DATA_BULK_DEFAULT_MAX_BYTES;
+  unsigned int max_millis = PROXY_FTP_DATA_BULK_DEFAULT_MAX_MILLIS;
+  config_rec *c;
+
+  if (cmd->argc < 2) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  for (i = 2; i < cmd->argc; i++) {
+    if (i+1 == cmd->argc) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "missing value for ",
+        (char *) cmd->argv[i], NULL));
+    }
+
+    if (strcasecmp(cmd->argv[i], "MaxBytes") == 0) {
+      if (pr_str_get_nbytes(cmd->argv[i+1], NULL, &max_bytes) < 0 ||
+          max_bytes <= 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid MaxBytes '",
+          (char *) cmd->argv[i+1], "'", NULL));
+      }
+
+    } else if (strcasecmp(cmd->argv[i], "MaxMillis") == 0) {
+      char *ptr = NULL;
+      unsigned long millis;
+
+      millis = strtoul(cmd->argv[i+1], &ptr, 10);
+      if (ptr == NULL ||
+          *ptr != '\0' ||
+          millis == 0 ||
+          millis > 60000) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid MaxMillis '",
+          (char *) cmd->argv[i+1], "'", NULL));
+      }
+
+      max_millis = (unsigned int) millis;
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown parameter: ",
+        (char *) cmd->argv[i], NULL));
+    }
+
+    i++;
+  }
+
+  if (engine == FALSE) {
+    max_bytes = 0;
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(off_t));
+  *((off_t *) c->argv[0]) = max_bytes;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = max_millis;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: ProxyDataListenPool on|off [size] */
+MODRET set_proxydatalistenpool(cmd_rec *cmd) {
+  config_rec *c;
+  int engine = -1;
+  unsigned int size = PROXY_FTP_CONN_LISTEN_POOL_DEFAULT_SIZE;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  if (cmd->argc > 2) {
+    int n;
+
+    n = atoi(cmd->argv[2]);
+    if (n < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "size must be greater than 0: ",
+        (char *) cmd->argv[2], NULL));
+    }
+
+    size = n;
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = size;
+
+  return PR_HANDLED(cmd);
+}
+
 /* usage: ProxyDataTransferPolicy "active"|"passive"|"pasv"|"epsv"|"port"|
  *          "eprt"|"client"
  */
@@ -586,6 +730,54 @@ MODRET set_proxydatastore(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: ProxyDirectoryCache on|off [burst [lifetime]] */
+MODRET set_proxydirectorycache(cmd_rec *cmd) {
+  config_rec *c;
+  int engine = -1, lifetime = PROXY_FTP_DIRCACHE_DEFAULT_LIFETIME;
+  unsigned int burst = PROXY_FTP_DIRCACHE_DEFAULT_BURST;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  if (cmd->argc > 2) {
+    int n;
+
+    n = atoi(cmd->argv[2]);
+    if (n < 1) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "burst must be greater than 0: ",
+        (char *) cmd->argv[2], NULL));
+    }
+
+    burst = n;
+  }
+
+  if (cmd->argc > 3) {
+    if (pr_str_get_duration(cmd->argv[3], &lifetime) < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "error parsing lifetime value '",
+        (char *) cmd->argv[3], "': ", strerror(errno), NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = burst;
+  c->argv[2] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[2]) = lifetime;
+
+  return PR_HANDLED(cmd);
+}
+
 /* usage: ProxyDirectoryListPolicy "client"|"LIST" [opt1 ... ]*/
 MODRET set_proxydirlistpolicy(cmd_rec *cmd) {
   config_rec *c;
@@ -652,6 +844,50 @@ MODRET set_proxyengine(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: ProxyForwardDestinationCache on|off [ttl [negative-ttl]] */
+MODRET set_proxyforwarddestinationcache(cmd_rec *cmd) {
+  config_rec *c;
+  int engine = -1, ttl = PROXY_FORWARD_DSTCACHE_DEFAULT_TTL,
+    negative_ttl = PROXY_FORWARD_DSTCACHE_DEFAULT_NEGATIVE_TTL;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  engine = get_boolean(cmd, 1);
+  if (engine == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  if (cmd->argc > 2) {
+    if (pr_str_get_duration(cmd->argv[2], &ttl) < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "error parsing TTL value '",
+        (char *) cmd->argv[2], "': ", strerror(errno), NULL));
+    }
+  }
+
+  if (cmd->argc > 3) {
+    if (pr_str_get_duration(cmd->argv[3], &negative_ttl) < 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool,
+        "error parsing negative TTL value '", (char *) cmd->argv[3], "': ",
+        strerror(errno), NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = engine;
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = ttl;
+  c->argv[2] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[2]) = negative_ttl;
+
+  return PR_HANDLED(cmd);
+}
+
 /* usage: ProxyForwardEnabled on|off */
 MODRET set_proxyforwardenabled(cmd_rec *cmd) {
   int enabled = -1, *note = NULL, res;
@@ -698,13 +934,11 @@ MODRET set_proxyforwardmethod(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
-/* usage: ProxyForwardTo [!]pattern [flags] */
+/* usage: ProxyForwardTo [!]pattern|host:name[:port]|cidr:network [flags] */
 MODRET set_proxyforwardto(cmd_rec *cmd) {
-#ifdef PR_USE_REGEX
   config_rec *c;
-  pr_regex_t *pre = NULL;
-  int negated = FALSE, regex_flags = REG_EXTENDED|REG_NOSUB, res = 0;
-  char *pattern;
+  struct proxy_forward_filter *filter;
+  int regex_flags = 0;
 
   if (cmd->argc-1 < 1 ||
       cmd->argc-1 > 2) {
@@ -736,35 +970,35 @@ MODRET set_proxyforwardto(cmd_rec *cmd) {
     regex_flags |= flags;
   }
 
-  pre = pr_regexp_alloc(&proxy_module);
-
-  pattern = cmd->argv[1];
-  if (*pattern == '!') {
-    negated = TRUE;
-    pattern++;
-  }
+  /* Check the rule now; the rules for each server are compiled together
+   * into a single filter at startup.
+   */
+  filter = proxy_forward_filter_create(cmd->tmp_pool);
+  if (proxy_forward_filter_add_rule(filter, cmd->argv[1], regex_flags) < 0) {
+    int xerrno = errno;
 
-  res = pr_regexp_compile(pre, pattern, regex_flags);
-  if (res != 0) {
-    char errstr[200] = {'\0'};
+    (void) proxy_forward_filter_free(filter);
 
-    pr_regexp_error(res, pre, errstr, sizeof(errstr));
-    pr_regexp_free(NULL, pre);
+    if (xerrno == ENOSYS) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "The ", (char *) cmd->argv[0],
+        " directive cannot be used with '", (char *) cmd->argv[1],
+        "' on this system, as you do not have POSIX compliant regex support",
+        NULL));
+    }
 
-    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "'", pattern, "' failed regex "
-      "compilation: ", errstr, NULL));
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid rule '",
+      (char *) cmd->argv[1], "'", NULL));
   }
+  (void) proxy_forward_filter_free(filter);
 
-  c = add_config_param(cmd->argv[0], 2, pre, NULL);
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = pstrdup(c->pool, cmd->argv[1]);
   c->argv[1] = palloc(c->pool, sizeof(int));
-  *((int *) c->argv[1]) = negated;
-  return PR_HANDLED(cmd);
+  *((int *) c->argv[1]) = regex_flags;
 
-#else /* no regular expression support at the moment */
-  CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "The ", param, " directive cannot be "
-    "used on this system, as you do not have POSIX compliant regex support",
-    NULL));
-#endif
+  /* The compiled filter is stashed in argv[2], once built. */
+  c->argv[2] = NULL;
+  return PR_HANDLED(cmd);
 }
 
 /* usage: ProxyLog path|"none" */
@@ -816,6 +1050,15 @@ MODRET set_proxyoptions(cmd_rec *cmd) {
     } else if (strcmp(cmd->argv[i], "AllowForeignAddress") == 0) {
       opts |= PROXY_OPT_ALLOW_FOREIGN_ADDRESS;
 
+    } else if (strcmp(cmd->argv[i], "TranslateASCII") == 0) {
+      opts |= PROXY_OPT_TRANSLATE_ASCII;
+
+    } else if (strcmp(cmd->argv[i], "UseModeZ") == 0) {
+      opts |= PROXY_OPT_USE_MODE_Z;
+
+    } else if (strcmp(cmd->argv[i], "ResumeDownloads") == 0) {
+      opts |= PROXY_OPT_RESUME_DOWNLOADS;
+
     } else {
       CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, ": unknown ProxyOption '",
         (char *) cmd->argv[i], "'", NULL));
@@ -1012,6 +1255,50 @@ MODRET set_proxyrole(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: ProxySFTPAdaptiveKeyExchanges on|off [min-security-bits] */
+MODRET set_proxysftpadaptivekeyexchanges(cmd_rec *cmd) {
+#if defined(PR_USE_OPENSSL)
+  int adaptive = -1;
+  unsigned int min_bits = PROXY_SSH_KEXCOST_DEFAULT_MIN_BITS;
+  config_rec *c;
+
+  if (cmd->argc < 2 ||
+      cmd->argc > 3) {
+    CONF_ERROR(cmd, "Wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  adaptive = get_boolean(cmd, 1);
+  if (adaptive == -1) {
+    CONF_ERROR(cmd, "expected Boolean parameter");
+  }
+
+  if (cmd->argc == 3) {
+    int bits;
+
+    bits = atoi(cmd->argv[2]);
+    if (bits <= 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "minimum security bits '",
+        (char *) cmd->argv[2], "' must be greater than zero", NULL));
+    }
+
+    min_bits = bits;
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = adaptive;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = min_bits;
+
+  return PR_HANDLED(cmd);
+#else
+  CONF_ERROR(cmd,
+    "Use of the ProxySFTPAdaptiveKeyExchanges directive requires OpenSSL support (--enable-openssl)");
+#endif /* PR_USE_OPENSSL */
+}
+
 /* usage: ProxySFTPCiphers algos */
 MODRET set_proxysftpciphers(cmd_rec *cmd) {
 #if defined(PR_USE_OPENSSL)
@@ -1212,6 +1499,113 @@ MODRET set_proxysftpkeyexchanges(cmd_rec *cmd) {
 #endif /* PR_USE_OPENSSL */
 }
 
+/* usage: ProxySFTPLogPackets all|auto|none [SampleRate count]
+ *          [MessageTypes type1 ...]
+ */
+MODRET set_proxysftplogpackets(cmd_rec *cmd) {
+#if defined(PR_USE_OPENSSL)
+  register unsigned int i;
+  int policy;
+  unsigned int sample_rate = 0;
+  array_header *msg_types = NULL;
+  config_rec *c;
+
+  if (cmd->argc < 2) {
+    CONF_ERROR(cmd, "Wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (strcasecmp(cmd->argv[1], "all") == 0) {
+    policy = PROXY_SSH_PKTLOG_POLICY_ALL;
+
+  } else if (strcasecmp(cmd->argv[1], "auto") == 0) {
+    policy = PROXY_SSH_PKTLOG_POLICY_AUTO;
+
+  } else if (strcasecmp(cmd->argv[1], "none") == 0) {
+    policy = PROXY_SSH_PKTLOG_POLICY_NONE;
+
+  } else {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown logging policy '",
+      (char *) cmd->argv[1], "'", NULL));
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+
+  for (i = 2; i < cmd->argc; i++) {
+    if (strcasecmp(cmd->argv[i], "SampleRate") == 0) {
+      int rate;
+
+      if (i+1 == cmd->argc) {
+        CONF_ERROR(cmd, "SampleRate requires a count");
+      }
+
+      rate = atoi(cmd->argv[i+1]);
+      if (rate <= 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "sample rate '",
+          (char *) cmd->argv[i+1], "' must be greater than zero", NULL));
+      }
+
+      sample_rate = rate;
+      i++;
+
+    } else if (strcasecmp(cmd->argv[i], "MessageTypes") == 0) {
+      if (i+1 == cmd->argc) {
+        CONF_ERROR(cmd, "MessageTypes requires at least one message type");
+      }
+
+      /* All of the remaining parameters are message types. */
+      msg_types = make_array(c->pool, 0, sizeof(unsigned char));
+
+      for (i = i+1; i < cmd->argc; i++) {
+        register unsigned int j;
+        const char *name;
+        int found = FALSE;
+
+        name = cmd->argv[i];
+        if (strncasecmp(name, "SSH_MSG_", 8) == 0) {
+          name += 8;
+        }
+
+        for (j = 1; j < 256; j++) {
+          const char *desc;
+
+          desc = proxy_ssh_packet_get_msg_type_desc((unsigned char) j);
+          if (strncmp(desc, "SSH_MSG_", 8) != 0) {
+            continue;
+          }
+
+          if (strcasecmp(desc + 8, name) == 0) {
+            *((unsigned char *) push_array(msg_types)) = (unsigned char) j;
+            found = TRUE;
+          }
+        }
+
+        if (found == FALSE) {
+          CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown message type '",
+            (char *) cmd->argv[i], "'", NULL));
+        }
+      }
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown parameter '",
+        (char *) cmd->argv[i], "'", NULL));
+    }
+  }
+
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = policy;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = sample_rate;
+  c->argv[2] = msg_types;
+
+  return PR_HANDLED(cmd);
+#else
+  CONF_ERROR(cmd,
+    "Use of the ProxySFTPLogPackets directive requires OpenSSL support (--enable-openssl)");
+#endif /* PR_USE_OPENSSL */
+}
+
 /* usage: ProxySFTPOptions opts */
 MODRET set_proxysftpoptions(cmd_rec *cmd) {
   register unsigned int i;
@@ -1423,6 +1817,42 @@ MODRET set_proxysftpverifyserver(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
+/* usage: ProxySocketOptions role ["latency"|"throughput"] [name value ...] */
+MODRET set_proxysocketoptions(cmd_rec *cmd) {
+  config_rec *c;
+  int role;
+  struct proxy_sockopts *opts;
+  const char *bad_text = NULL;
+
+  if (cmd->argc < 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  role = proxy_sockopts_get_role(cmd->argv[1]);
+  if (role < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown connection role: ",
+      (char *) cmd->argv[1], NULL));
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = role;
+
+  opts = palloc(c->pool, sizeof(struct proxy_sockopts));
+  proxy_sockopts_clear(opts);
+
+  if (proxy_sockopts_parse(c->pool, opts, cmd->argc - 2,
+      (char **) &(cmd->argv[2]), &bad_text) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "badly formatted parameter: ",
+      bad_text, NULL));
+  }
+
+  c->argv[1] = opts;
+  return PR_HANDLED(cmd);
+}
+
 /* usage: ProxySourceAddress address */
 MODRET set_proxysourceaddress(cmd_rec *cmd) {
   config_rec *c = NULL;
@@ -1603,7 +2033,117 @@ MODRET set_proxytimeoutlinger(cmd_rec *cmd) {
   return PR_HANDLED(cmd);
 }
 
-/* usage: ProxyTLSCACertificateFile path */
+/* usage: ProxyTimeoutTick secs */
+MODRET set_proxytimeouttick(cmd_rec *cmd) {
+  int tick = -1;
+  config_rec *c = NULL;
+  char *timespec;
+
+  CHECK_ARGS(cmd, 1);
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  timespec = cmd->argv[1];
+
+  if (pr_str_get_duration(timespec, &tick) < 0) {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "error parsing tick value '",
+      timespec, "': ", strerror(errno), NULL));
+  }
+
+  c = add_config_param(cmd->argv[0], 1, NULL);
+  c->argv[0] = pcalloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = tick;
+
+  return PR_HANDLED(cmd);
+}
+
+/* usage: ProxyTLSBufferPolicy control|data release|keep|read-ahead
+ *          [ReadBufferLength bytes]
+ */
+MODRET set_proxytlsbufferpolicy(cmd_rec *cmd) {
+#ifdef PR_USE_OPENSSL
+  register unsigned int i;
+  int role, policy;
+  size_t read_buflen = 0;
+  config_rec *c;
+
+  if (cmd->argc < 3) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (strcasecmp(cmd->argv[1], "control") == 0) {
+    role = PROXY_TLS_BUFFER_ROLE_CTRL;
+
+  } else if (strcasecmp(cmd->argv[1], "data") == 0) {
+    role = PROXY_TLS_BUFFER_ROLE_DATA;
+
+  } else {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown connection role: ",
+      (char *) cmd->argv[1], NULL));
+  }
+
+  if (strcasecmp(cmd->argv[2], "release") == 0) {
+    policy = PROXY_TLS_BUFFER_POLICY_RELEASE;
+
+  } else if (strcasecmp(cmd->argv[2], "keep") == 0) {
+    policy = PROXY_TLS_BUFFER_POLICY_KEEP;
+
+  } else if (strcasecmp(cmd->argv[2], "read-ahead") == 0) {
+    if (role == PROXY_TLS_BUFFER_ROLE_CTRL) {
+      CONF_ERROR(cmd, "read-ahead is only supported for data connections");
+    }
+
+    policy = PROXY_TLS_BUFFER_POLICY_READ_AHEAD;
+    read_buflen = PROXY_TLS_DEFAULT_READ_BUFFER_LEN;
+
+  } else {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown buffer policy: ",
+      (char *) cmd->argv[2], NULL));
+  }
+
+  for (i = 3; i < cmd->argc; i++) {
+    if (strcasecmp(cmd->argv[i], "ReadBufferLength") == 0) {
+      off_t len = 0;
+
+      if (i+1 == cmd->argc) {
+        CONF_ERROR(cmd, "ReadBufferLength requires a length");
+      }
+
+      if (policy != PROXY_TLS_BUFFER_POLICY_READ_AHEAD) {
+        CONF_ERROR(cmd, "ReadBufferLength requires the read-ahead policy");
+      }
+
+      if (pr_str_get_nbytes(cmd->argv[i+1], NULL, &len) < 0 ||
+          len <= 0) {
+        CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "invalid read buffer length '",
+          (char *) cmd->argv[i+1], "'", NULL));
+      }
+
+      read_buflen = (size_t) len;
+      i++;
+
+    } else {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown parameter: ",
+        (char *) cmd->argv[i], NULL));
+    }
+  }
+
+  c = add_config_param(cmd->argv[0], 3, NULL, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = role;
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = policy;
+  c->argv[2] = palloc(c->pool, sizeof(size_t));
+  *((size_t *) c->argv[2]) = read_buflen;
+
+  return PR_HANDLED(cmd);
+#else
+  CONF_ERROR(cmd, "Missing required OpenSSL support (see --enable-openssl configure option)");
+#endif /* PR_USE_OPENSSL */
+}
+
+/* usage: ProxyTLSCACertificateFile path */
 MODRET set_proxytlscacertfile(cmd_rec *cmd) {
 #ifdef PR_USE_OPENSSL
   int res;
@@ -1960,12 +2500,19 @@ MODRET set_proxytlsoptions(cmd_rec *cmd) {
     } else if (strcmp(cmd->argv[i], "EnableDiags") == 0) {
       opts |= PROXY_TLS_OPT_ENABLE_DIAGS;
 
+    } else if (strcmp(cmd->argv[i], "LogAllDiags") == 0) {
+      /* Logging all diagnostics implies enabling them. */
+      opts |= (PROXY_TLS_OPT_ENABLE_DIAGS|PROXY_TLS_OPT_LOG_ALL_DIAGS);
+
     } else if (strcmp(cmd->argv[i], "NoSessionCache") == 0) {
       opts |= PROXY_TLS_OPT_NO_SESSION_CACHE;
 
     } else if (strcmp(cmd->argv[i], "NoSessionTickets") == 0) {
       opts |= PROXY_TLS_OPT_NO_SESSION_TICKETS;
 
+    } else if (strcmp(cmd->argv[i], "NoVerifyCache") == 0) {
+      opts |= PROXY_TLS_OPT_NO_VERIFY_CACHE;
+
     } else {
       CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, ": unknown ProxyTLSOption '",
         cmd->argv[i], "'", NULL));
@@ -2170,6 +2717,69 @@ MODRET set_proxytlsprotocol(cmd_rec *cmd) {
 #endif /* PR_USE_OPENSSL */
 }
 
+/* usage: ProxyTLSShutdownPolicy bidirectional|unidirectional|deferred
+ *          [Linger secs]
+ */
+MODRET set_proxytlsshutdownpolicy(cmd_rec *cmd) {
+#ifdef PR_USE_OPENSSL
+  int policy;
+  unsigned int linger_ms = 0;
+  config_rec *c;
+
+  if (cmd->argc != 2 &&
+      cmd->argc != 4) {
+    CONF_ERROR(cmd, "wrong number of parameters");
+  }
+
+  CHECK_CONF(cmd, CONF_ROOT|CONF_VIRTUAL|CONF_GLOBAL);
+
+  if (strcasecmp(cmd->argv[1], "bidirectional") == 0) {
+    policy = PROXY_TLS_SHUTDOWN_POLICY_BIDIRECTIONAL;
+
+  } else if (strcasecmp(cmd->argv[1], "unidirectional") == 0) {
+    policy = PROXY_TLS_SHUTDOWN_POLICY_UNIDIRECTIONAL;
+
+  } else if (strcasecmp(cmd->argv[1], "deferred") == 0) {
+    policy = PROXY_TLS_SHUTDOWN_POLICY_DEFERRED;
+
+  } else {
+    CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown shutdown policy: ",
+      (char *) cmd->argv[1], NULL));
+  }
+
+  if (cmd->argc == 4) {
+    int linger = -1;
+
+    if (strcasecmp(cmd->argv[2], "Linger") != 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "unknown parameter: ",
+        (char *) cmd->argv[2], NULL));
+    }
+
+    if (policy == PROXY_TLS_SHUTDOWN_POLICY_UNIDIRECTIONAL) {
+      CONF_ERROR(cmd, "Linger is not supported for the unidirectional policy");
+    }
+
+    if (pr_str_get_duration(cmd->argv[3], &linger) < 0 ||
+        linger <= 0) {
+      CONF_ERROR(cmd, pstrcat(cmd->tmp_pool, "error parsing linger value '",
+        (char *) cmd->argv[3], "'", NULL));
+    }
+
+    linger_ms = (unsigned int) linger * 1000;
+  }
+
+  c = add_config_param(cmd->argv[0], 2, NULL, NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = policy;
+  c->argv[1] = palloc(c->pool, sizeof(unsigned int));
+  *((unsigned int *) c->argv[1]) = linger_ms;
+
+  return PR_HANDLED(cmd);
+#else
+  CONF_ERROR(cmd, "Missing required OpenSSL support (see --enable-openssl configure option)");
+#endif /* PR_USE_OPENSSL */
+}
+
 /* usage: ProxyTLSTimeoutHandshake timeout */
 MODRET set_proxytlstimeouthandshake(cmd_rec *cmd) {
 #ifdef PR_USE_OPENSSL
@@ -2322,7 +2932,7 @@ static void proxy_cmd_loop(server_rec *s, conn_t *conn) {
  */
 
 static int proxy_data_handle_resp(pool *p, struct proxy_session *proxy_sess,
-    cmd_rec *cmd) {
+    cmd_rec *cmd, int resuming) {
   int res, xerrno = 0;
   pr_response_t *resp;
   unsigned int resp_nlines = 0;
@@ -2335,13 +2945,18 @@ static int proxy_data_handle_resp(pool *p, struct proxy_session *proxy_sess,
       "error receiving %s response from backend: %s", (char *) cmd->argv[0],
       strerror(xerrno));
 
+    if (resuming == TRUE) {
+      errno = xerrno;
+      return -1;
+    }
+
     pr_response_add_err(R_500, _("%s: %s"), (char *) cmd->argv[0],
       strerror(xerrno));
     pr_response_flush(&resp_err_list);
 
     if (proxy_sess->backend_data_conn != NULL) {
-      proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-      pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+      (void) proxy_ftp_conn_listen_close(session.pool,
+        proxy_sess->backend_data_conn);
       proxy_sess->backend_data_conn = NULL;
     }
 
@@ -2349,6 +2964,28 @@ static int proxy_data_handle_resp(pool *p, struct proxy_session *proxy_sess,
     return -1;
   }
 
+  if (resuming == TRUE) {
+    /* The client already has its preliminary response for this transfer,
+     * and its data connection stays open.
+     */
+    if (resp->num[0] != '1') {
+      pr_trace_msg(trace_channel, 4,
+        "backend server refused to resume %s: %s %s", (char *) cmd->argv[0],
+        resp->num, resp->msg);
+
+      if (proxy_sess->backend_data_conn != NULL) {
+        (void) proxy_ftp_conn_listen_close(session.pool,
+          proxy_sess->backend_data_conn);
+        proxy_sess->backend_data_conn = NULL;
+      }
+
+      errno = EPERM;
+      return -1;
+    }
+
+    return 0;
+  }
+
   /* If the backend server responds with 4xx/5xx here, close the frontend
    * data connection.
    */
@@ -2363,8 +3000,8 @@ static int proxy_data_handle_resp(pool *p, struct proxy_session *proxy_sess,
     }
 
     if (proxy_sess->backend_data_conn != NULL) {
-      proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-      pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+      (void) proxy_ftp_conn_listen_close(session.pool,
+        proxy_sess->backend_data_conn);
       proxy_sess->backend_data_conn = NULL;
     }
 
@@ -2383,8 +3020,8 @@ static int proxy_data_handle_resp(pool *p, struct proxy_session *proxy_sess,
     }
 
     if (proxy_sess->backend_data_conn != NULL) {
-      proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-      pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+      (void) proxy_ftp_conn_listen_close(session.pool,
+        proxy_sess->backend_data_conn);
       proxy_sess->backend_data_conn = NULL;
     }
 
@@ -2402,11 +3039,13 @@ static int proxy_data_handle_resp(pool *p, struct proxy_session *proxy_sess,
 }
 
 static int proxy_data_prepare_backend_conn(struct proxy_session *proxy_sess,
-    cmd_rec *cmd, conn_t **backend) {
+    cmd_rec *cmd, conn_t **backend, int resuming) {
   int res, xerrno;
   conn_t *backend_conn = NULL;
 
-  /* XXX Should handle EPSV_ALL here, too. */
+  /* Note that EPSV ALL, if in effect, is handled when preparing the passive
+   * transfer; the backend data connection is the same.
+   */
   if (proxy_sess->backend_sess_flags & SF_PASSIVE) {
     const pr_netaddr_t *bind_addr = NULL, *local_addr = NULL;
 
@@ -2537,7 +3176,7 @@ static int proxy_data_prepare_backend_conn(struct proxy_session *proxy_sess,
      * (Issue #244).
      */
 
-    res = proxy_data_handle_resp(cmd->tmp_pool, proxy_sess, cmd);
+    res = proxy_data_handle_resp(cmd->tmp_pool, proxy_sess, cmd, resuming);
     if (res < 0) {
       return -1;
     }
@@ -2580,7 +3219,7 @@ static int proxy_data_prepare_backend_conn(struct proxy_session *proxy_sess,
       backend_conn->remote_port);
 
   } else if (proxy_sess->backend_sess_flags & SF_PORT) {
-    res = proxy_data_handle_resp(cmd->tmp_pool, proxy_sess, cmd);
+    res = proxy_data_handle_resp(cmd->tmp_pool, proxy_sess, cmd, resuming);
     if (res < 0) {
       return -1;
     }
@@ -2594,8 +3233,8 @@ static int proxy_data_prepare_backend_conn(struct proxy_session *proxy_sess,
       xerrno = errno;
 
       if (proxy_sess->backend_data_conn != NULL) {
-        proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-        pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+        (void) proxy_ftp_conn_listen_close(session.pool,
+          proxy_sess->backend_data_conn);
         proxy_sess->backend_data_conn = NULL;
       }
 
@@ -2607,9 +3246,9 @@ static int proxy_data_prepare_backend_conn(struct proxy_session *proxy_sess,
       return -1;
     }
 
-    /* We can close our listening socket now. */
-    proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-    pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+    /* We can close our listening socket now (or return it to the pool). */
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
     proxy_sess->backend_data_conn = backend_conn;
 
     if (proxy_netio_postopen(backend_conn->instrm) < 0) {
@@ -2833,7 +3472,7 @@ static int proxy_data_prepare_conns(struct proxy_session *proxy_sess,
     return -1;
   }
 
-  res = proxy_data_prepare_backend_conn(proxy_sess, cmd, backend);
+  res = proxy_data_prepare_backend_conn(proxy_sess, cmd, backend, FALSE);
   if (res < 0) {
     return -1;
   }
@@ -2846,13 +3485,331 @@ static int proxy_data_prepare_conns(struct proxy_session *proxy_sess,
   return 0;
 }
 
+/* Determines whether the backend server advertised MODE Z in its FEAT
+ * response, i.e. a "MODE Z" feature line.
+ */
+static int proxy_data_backend_has_mode_z(struct proxy_session *proxy_sess) {
+  const char *modes;
+
+  if (proxy_sess->backend_features == NULL) {
+    return FALSE;
+  }
+
+  modes = pr_table_get(proxy_sess->backend_features, C_MODE, NULL);
+  if (modes == NULL ||
+      strchr(modes, 'Z') == NULL) {
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+/* Switches the backend server into MODE Z, or back into MODE S, as needed
+ * for the next transfer.  We only send MODE commands when the mode changes.
+ */
+static int proxy_data_set_backend_mode(cmd_rec *cmd,
+    struct proxy_session *proxy_sess, int use_mode_z) {
+  int res, backend_mode_z = FALSE;
+  cmd_rec *mode_cmd;
+  pr_response_t *resp;
+  unsigned int resp_nlines = 0;
+  const char *mode;
+
+  if (proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_MODE_Z) {
+    backend_mode_z = TRUE;
+  }
+
+  if (backend_mode_z == use_mode_z) {
+    return 0;
+  }
+
+  mode = use_mode_z ? "Z" : "S";
+  mode_cmd = pr_cmd_alloc(cmd->tmp_pool, 2, C_MODE, mode);
+  mode_cmd->arg = pstrdup(cmd->tmp_pool, mode);
+
+  res = proxy_ftp_ctrl_send_cmd(cmd->tmp_pool, proxy_sess->backend_ctrl_conn,
+    mode_cmd);
+  if (res < 0) {
+    return -1;
+  }
+
+  resp = proxy_ftp_ctrl_recv_resp(cmd->tmp_pool,
+    proxy_sess->backend_ctrl_conn, &resp_nlines, 0);
+  if (resp == NULL) {
+    return -1;
+  }
+
+  if (resp->num[0] != '2') {
+    pr_trace_msg(trace_channel, 4,
+      "backend server rejected MODE %s: %s %s", mode, resp->num, resp->msg);
+    errno = EPERM;
+    return -1;
+  }
+
+  if (use_mode_z) {
+    proxy_sess->dataxfer_flags |= PROXY_SESS_DATA_TRANSFER_FL_MODE_Z;
+
+  } else {
+    proxy_sess->dataxfer_flags &= ~PROXY_SESS_DATA_TRANSFER_FL_MODE_Z;
+  }
+
+  pr_trace_msg(trace_channel, 15, "switched backend server to MODE %s", mode);
+  return 0;
+}
+
+/* Passes the given data through the MODE Z and ASCII translation filters in
+ * effect for this transfer, in the order appropriate for the direction:
+ * downloads are decompressed before translation, uploads are compressed
+ * after.
+ */
+static int proxy_data_filter(int xfer_direction, struct proxy_ftp_modez *modez,
+    struct proxy_ftp_ascii *xlate, char *data, size_t datalen, char **out,
+    size_t *outlen) {
+
+  *out = data;
+  *outlen = datalen;
+
+  if (modez != NULL &&
+      xfer_direction == PR_NETIO_IO_RD) {
+    if (proxy_ftp_modez_process(modez, *out, *outlen, out, outlen) < 0) {
+      return -1;
+    }
+  }
+
+  if (xlate != NULL) {
+    if (proxy_ftp_ascii_translate(xlate, *out, *outlen, out, outlen) < 0) {
+      return -1;
+    }
+  }
+
+  if (modez != NULL &&
+      xfer_direction == PR_NETIO_IO_WR) {
+    if (proxy_ftp_modez_process(modez, *out, *outlen, out, outlen) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int proxy_data_send_data(pool *p, conn_t *conn, char *data,
+    size_t datalen, int frontend_data) {
+  pr_buffer_t buf;
+
+  if (datalen == 0) {
+    return 0;
+  }
+
+  buf.buf = data;
+  buf.buflen = datalen;
+  buf.current = data + datalen;
+  buf.remaining = 0;
+
+  return proxy_ftp_data_send(p, conn, &buf, frontend_data);
+}
+
+/* Sends any data held back by the transfer filters, at the end of the
+ * transfer.
+ */
+static int proxy_data_filter_finish(pool *p, int xfer_direction,
+    struct proxy_ftp_modez *modez, struct proxy_ftp_ascii *xlate,
+    conn_t *conn, int frontend_data) {
+  char *data = NULL;
+  size_t datalen = 0;
+
+  if (modez != NULL &&
+      xfer_direction == PR_NETIO_IO_RD) {
+    if (proxy_ftp_modez_finish(modez, &data, &datalen) < 0) {
+      return -1;
+    }
+  }
+
+  if (xlate != NULL) {
+    /* E.g. a trailing CR. */
+    if (proxy_ftp_ascii_finish(xlate, &data, &datalen) < 0) {
+      return -1;
+    }
+
+    if (modez != NULL &&
+        xfer_direction == PR_NETIO_IO_WR &&
+        datalen > 0) {
+      if (proxy_ftp_modez_process(modez, data, datalen, &data,
+          &datalen) < 0) {
+        return -1;
+      }
+    }
+
+    if (proxy_data_send_data(p, conn, data, datalen, frontend_data) < 0) {
+      return -1;
+    }
+  }
+
+  if (modez != NULL &&
+      xfer_direction == PR_NETIO_IO_WR) {
+    if (proxy_ftp_modez_finish(modez, &data, &datalen) < 0) {
+      return -1;
+    }
+
+    if (proxy_data_send_data(p, conn, data, datalen, frontend_data) < 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int proxy_data_reopen_backend_conn(cmd_rec *cmd,
+    struct proxy_session *proxy_sess, off_t offset) {
+  int policy_id, res;
+  conn_t *backend_conn = NULL;
+  pr_response_t *resp;
+  unsigned int resp_nlines = 0;
+
+  policy_id = proxy_sess->dataxfer_policy;
+
+  if (proxy_sess->backend_sess_flags & SF_PASSIVE) {
+    const pr_netaddr_t *remote_addr;
+
+    if (policy_id != PR_CMD_PASV_ID &&
+        policy_id != PR_CMD_EPSV_ID) {
+      policy_id = PR_CMD_PASV_ID;
+      if (proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_EPSV_ALL) {
+        policy_id = PR_CMD_EPSV_ID;
+      }
+    }
+
+    remote_addr = proxy_ftp_xfer_prepare_passive(policy_id, cmd, R_425,
+      proxy_sess, 0);
+    if (remote_addr == NULL) {
+      return -1;
+    }
+
+    proxy_sess->backend_data_addr = remote_addr;
+
+  } else {
+    if (policy_id != PR_CMD_PORT_ID &&
+        policy_id != PR_CMD_EPRT_ID) {
+      policy_id = PR_CMD_PORT_ID;
+    }
+
+    res = proxy_ftp_xfer_prepare_active(policy_id, cmd, R_425, proxy_sess, 0);
+    if (res < 0) {
+      return -1;
+    }
+  }
+
+  if (offset > 0) {
+    cmd_rec *rest_cmd;
+    char offset_str[64];
+
+    memset(offset_str, '\0', sizeof(offset_str));
+    pr_snprintf(offset_str, sizeof(offset_str)-1, "%" PR_LU,
+      (pr_off_t) offset);
+
+    rest_cmd = pr_cmd_alloc(cmd->tmp_pool, 2, C_REST, offset_str);
+    rest_cmd->arg = pstrdup(cmd->tmp_pool, offset_str);
+
+    res = proxy_ftp_ctrl_send_cmd(cmd->tmp_pool,
+      proxy_sess->backend_ctrl_conn, rest_cmd);
+    if (res < 0) {
+      return -1;
+    }
+
+    resp = proxy_ftp_ctrl_recv_resp(cmd->tmp_pool,
+      proxy_sess->backend_ctrl_conn, &resp_nlines, 0);
+    if (resp == NULL) {
+      return -1;
+    }
+
+    if (resp->num[0] != '3') {
+      pr_trace_msg(trace_channel, 4,
+        "backend server rejected REST %s: %s %s", offset_str, resp->num,
+        resp->msg);
+      errno = EPERM;
+      return -1;
+    }
+  }
+
+  res = proxy_ftp_ctrl_send_cmd(cmd->tmp_pool, proxy_sess->backend_ctrl_conn,
+    cmd);
+  if (res < 0) {
+    return -1;
+  }
+
+  res = proxy_data_prepare_backend_conn(proxy_sess, cmd, &backend_conn, TRUE);
+  if (res < 0) {
+    return -1;
+  }
+
+  if (backend_conn == NULL) {
+    errno = EPERM;
+    return -1;
+  }
+
+  proxy_netio_set_poll_interval(backend_conn->instrm, 1);
+  return 0;
+}
+
+/* Reconnects the backend data connection for an interrupted download, and
+ * has the backend server resume sending the file at the given offset.  The
+ * frontend data connection is left as is, so that the client sees a single
+ * unbroken transfer.  Any response for the interrupted transfer must already
+ * have been read from the backend control connection.
+ */
+static int proxy_data_resume_download(cmd_rec *cmd,
+    struct proxy_session *proxy_sess, off_t offset) {
+  int res, xerrno;
+
+  if (proxy_sess->backend_data_conn != NULL) {
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
+    proxy_sess->backend_data_conn = NULL;
+  }
+
+  (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+    "resuming interrupted %s from backend at offset %" PR_LU,
+    (char *) cmd->argv[0], (pr_off_t) offset);
+
+  /* The client must not see any of the responses for our attempt. */
+  pr_response_block(TRUE);
+
+  res = proxy_data_reopen_backend_conn(cmd, proxy_sess, offset);
+  xerrno = errno;
+
+  pr_response_clear(&resp_err_list);
+  pr_response_block(FALSE);
+
+  if (res < 0) {
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "unable to resume %s from backend: %s", (char *) cmd->argv[0],
+      strerror(xerrno));
+
+    if (proxy_sess->backend_data_conn != NULL) {
+      (void) proxy_ftp_conn_listen_close(session.pool,
+        proxy_sess->backend_data_conn);
+      proxy_sess->backend_data_conn = NULL;
+    }
+
+    errno = xerrno;
+    return -1;
+  }
+
+  return 0;
+}
+
 MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
   int data_eof = FALSE, dst_xerrno = 0, res, xerrno;
-  int xfer_direction, xfer_ok = TRUE;
+  int xfer_direction, xfer_ok = TRUE, file_xfer = FALSE;
   unsigned int resp_nlines = 0;
   pr_response_t *resp;
   conn_t *frontend_conn = NULL, *backend_conn = NULL;
-  off_t bytes_transferred = 0;
+  off_t bytes_transferred = 0, restart_pos, resume_offset = 0;
+  int resume_count = 0;
+  pr_response_t *pending_resp = NULL;
+  unsigned int pending_resp_nlines = 0;
+  struct proxy_ftp_ascii *xlate = NULL;
+  struct proxy_ftp_modez *modez = NULL;
+  int bulk_batch = FALSE;
 
   /* We are handling a data transfer command (e.g. LIST, RETR, etc).
    *
@@ -2892,6 +3849,87 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
     }
   }
 
+  if (pr_cmd_cmp(cmd, PR_CMD_APPE_ID) == 0 ||
+      pr_cmd_cmp(cmd, PR_CMD_RETR_ID) == 0 ||
+      pr_cmd_cmp(cmd, PR_CMD_STOR_ID) == 0 ||
+      pr_cmd_cmp(cmd, PR_CMD_STOU_ID) == 0) {
+    file_xfer = TRUE;
+  }
+
+  /* If we asked the backend server for binary mode on behalf of an ASCII
+   * mode client, translate the file data ourselves.  Directory listings are
+   * sent in ASCII regardless of the transfer type, and are left alone.
+   */
+  if (proxy_ascii_xlate == TRUE &&
+      (session.sf_flags & SF_ASCII) &&
+      file_xfer == TRUE) {
+    xlate = proxy_ftp_ascii_alloc(cmd->tmp_pool,
+      xfer_direction == PR_NETIO_IO_RD ?
+        PROXY_FTP_ASCII_TO_CRLF : PROXY_FTP_ASCII_FROM_CRLF);
+  }
+
+  /* If configured, and the backend server supports it, compress file data
+   * on the backend leg of the transfer.  Directory listings are left
+   * uncompressed, as we may need to parse/translate them.
+   */
+  if ((proxy_opts & PROXY_OPT_USE_MODE_Z) &&
+      proxy_client_mode_z == FALSE &&
+      file_xfer == TRUE &&
+      !(proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_MODE_Z_FAILED) &&
+      proxy_data_backend_has_mode_z(proxy_sess) == TRUE) {
+    modez = proxy_ftp_modez_alloc(cmd->tmp_pool,
+      xfer_direction == PR_NETIO_IO_RD ?
+        PROXY_FTP_MODEZ_INFLATE : PROXY_FTP_MODEZ_DEFLATE,
+      PROXY_FTP_MODEZ_LEVEL_ADAPTIVE);
+    if (modez == NULL) {
+      pr_trace_msg(trace_channel, 3,
+        "unable to use MODE Z with backend server: %s", strerror(errno));
+      proxy_sess->dataxfer_flags |= PROXY_SESS_DATA_TRANSFER_FL_MODE_Z_FAILED;
+    }
+  }
+
+  /* A REST only applies to the transfer which follows it. */
+  restart_pos = proxy_restart_pos;
+  proxy_restart_pos = 0;
+
+  /* To resume an interrupted download, we need to know the file offset of
+   * the data we received; that is not the case for compressed data.
+   */
+  if ((proxy_opts & PROXY_OPT_RESUME_DOWNLOADS) &&
+      pr_cmd_cmp(cmd, PR_CMD_RETR_ID) == 0 &&
+      modez == NULL &&
+      proxy_client_mode_z == FALSE &&
+      restart_pos >= 0) {
+    resume_count = proxy_resume_count;
+    resume_offset = restart_pos;
+  }
+
+  res = proxy_data_set_backend_mode(cmd, proxy_sess,
+    (modez != NULL || proxy_client_mode_z == TRUE) ? TRUE : FALSE);
+  if (res < 0 &&
+      modez != NULL) {
+    /* Do not try again for this session. */
+    proxy_sess->dataxfer_flags |= PROXY_SESS_DATA_TRANSFER_FL_MODE_Z_FAILED;
+    proxy_ftp_modez_free(modez);
+    modez = NULL;
+
+    res = proxy_data_set_backend_mode(cmd, proxy_sess, proxy_client_mode_z);
+  }
+
+  if (res < 0) {
+    xerrno = errno;
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "unable to set transfer mode on backend server: %s", strerror(xerrno));
+
+    pr_response_add_err(R_451, _("%s: %s"), (char *) cmd->argv[0],
+      strerror(xerrno));
+    pr_response_flush(&resp_err_list);
+
+    pr_response_block(TRUE);
+    errno = xerrno;
+    return PR_ERROR(cmd);
+  }
+
   res = proxy_data_prepare_conns(proxy_sess, cmd, &frontend_conn,
     &backend_conn);
   if (res < 0) {
@@ -2945,26 +3983,40 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
       "TimeoutStalled");
   }
 
-  /* XXX Note: when reading/writing data from data connections, do NOT
-   * perform any sort of ASCII translation; we leave the data as is.
-   * (Or maybe we SHOULD perform the ASCII translation here, in case of
-   * ASCII translation error; the backend server can then be told that
-   * the data are binary, and thus relieve the backend of the translation
-   * burden.  Configurable?)
+  (void) proxy_ftp_data_timers_start(proxy_sess->timer_tick);
+  (void) proxy_ftp_data_bulk_start(proxy_bulk_max_bytes, proxy_bulk_max_millis);
+
+  /* Note: unless the TranslateASCII ProxyOption is in effect (see above),
+   * we do NOT perform any sort of ASCII translation when reading/writing
+   * data from data connections; we leave the data as is, and the backend
+   * server does any translation.  Similarly, we only (de)compress the data
+   * for the UseModeZ ProxyOption.
    */
 
   while (TRUE) {
-    fd_set rfds;
+    fd_set rfds, wfds;
     struct timeval tv;
     int backend_ctrlfd = -1, frontend_ctrlfd = -1, datafd = -1, maxfd = -1;
-    int frontend_data = FALSE;
+    int frontend_data = FALSE, timer_delay, timer_wakeup = FALSE;
+    int data_pending = FALSE, in_batch;
     conn_t *src_data_conn = NULL, *dst_data_conn = NULL;
 
     pr_signals_handle();
 
+    /* Within a bulk transfer batch, we only check whether more data is
+     * immediately available; the control connections wait for the next
+     * batch.
+     */
+    in_batch = bulk_batch;
+    bulk_batch = FALSE;
+
     if (data_eof == TRUE ||
         xfer_ok == FALSE) {
       tv.tv_sec = proxy_sess->linger_timeout;
+      in_batch = FALSE;
+
+    } else if (in_batch == TRUE) {
+      tv.tv_sec = 0;
 
     } else {
       tv.tv_sec = 15;
@@ -2972,7 +4024,29 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
 
     tv.tv_usec = 0;
 
+    if (in_batch == FALSE) {
+      /* The next batch, if any, starts afresh. */
+      (void) proxy_ftp_data_bulk_end();
+    }
+
+    /* If we have deferred timer resets, make sure we wake up in time to
+     * apply them, should the transfer stall.
+     */
+    timer_delay = proxy_ftp_data_timers_get_delay();
+    if (timer_delay == 0 ||
+        (timer_delay > 0 &&
+         (data_eof == TRUE || xfer_ok == FALSE))) {
+      (void) proxy_ftp_data_timers_flush();
+
+    } else if (timer_delay > 0 &&
+               in_batch == FALSE &&
+               timer_delay < tv.tv_sec) {
+      tv.tv_sec = timer_delay;
+      timer_wakeup = TRUE;
+    }
+
     FD_ZERO(&rfds);
+    FD_ZERO(&wfds);
 
     /* The source/origin data connection depends on our direction:
      * downloads (IO_RD) from the backend, uploads (IO_WR) to the backend.
@@ -3004,21 +4078,48 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
       }
     }
 
-    frontend_ctrlfd = PR_NETIO_FD(proxy_sess->frontend_ctrl_conn->instrm);
-    FD_SET(frontend_ctrlfd, &rfds);
-    if (frontend_ctrlfd > maxfd) {
-      maxfd = frontend_ctrlfd;
+    if (in_batch == FALSE) {
+      frontend_ctrlfd = PR_NETIO_FD(proxy_sess->frontend_ctrl_conn->instrm);
+      FD_SET(frontend_ctrlfd, &rfds);
+      if (frontend_ctrlfd > maxfd) {
+        maxfd = frontend_ctrlfd;
+      }
     }
 
     if (src_data_conn != NULL) {
+      int poll_flags = PROXY_TLS_POLL_FL_READ;
+
       datafd = PR_NETIO_FD(src_data_conn->instrm);
-      FD_SET(datafd, &rfds);
+
+      /* For TLS from the backend, data may already be buffered (which will
+       * not make the fd readable), or OpenSSL may need to write before it can
+       * read any more.
+       */
+      if (frontend_data == FALSE) {
+        poll_flags = proxy_tls_get_poll_flags(src_data_conn->instrm);
+        if (poll_flags < 0) {
+          poll_flags = PROXY_TLS_POLL_FL_READ;
+        }
+      }
+
+      if (poll_flags & PROXY_TLS_POLL_FL_PENDING) {
+        data_pending = TRUE;
+        tv.tv_sec = 0;
+        timer_wakeup = FALSE;
+
+      } else if (poll_flags & PROXY_TLS_POLL_FL_WRITE) {
+        FD_SET(datafd, &wfds);
+
+      } else {
+        FD_SET(datafd, &rfds);
+      }
+
       if (datafd > maxfd) {
         maxfd = datafd;
       }
     }
 
-    res = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+    res = select(maxfd + 1, &rfds, &wfds, NULL, &tv);
     if (res < 0) {
       xerrno = errno;
 
@@ -3037,12 +4138,14 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
       }
 
       if (proxy_sess->backend_data_conn != NULL) {
-        proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-        pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+        (void) proxy_ftp_conn_listen_close(session.pool,
+          proxy_sess->backend_data_conn);
         proxy_sess->backend_data_conn = NULL;
       }
 
       pr_timer_remove(PR_TIMER_STALLED, ANY_MODULE);
+      (void) proxy_ftp_data_timers_stop();
+      (void) proxy_ftp_data_bulk_stop();
       proxy_sess->frontend_sess_flags &= ~SF_XFER;
       proxy_sess->backend_sess_flags &= ~SF_XFER;
 
@@ -3055,6 +4158,24 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
       return PR_ERROR(cmd);
     }
 
+    if (datafd >= 0 &&
+        (data_pending == TRUE || FD_ISSET(datafd, &wfds))) {
+      /* The source data connection can make progress. */
+      FD_SET(datafd, &rfds);
+      if (res == 0) {
+        res = 1;
+      }
+    }
+
+    if (res == 0 &&
+        in_batch == TRUE) {
+      /* No more data for now; end the batch, and poll the control
+       * connections again.
+       */
+      (void) proxy_ftp_data_bulk_end();
+      continue;
+    }
+
     if (res == 0) {
       if (data_eof == TRUE ||
           xfer_ok == FALSE) {
@@ -3069,6 +4190,8 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
         }
 
         pr_timer_remove(PR_TIMER_STALLED, ANY_MODULE);
+        (void) proxy_ftp_data_timers_stop();
+        (void) proxy_ftp_data_bulk_stop();
         proxy_sess->frontend_sess_flags &= ~SF_XFER;
         proxy_sess->backend_sess_flags &= ~SF_XFER;
 
@@ -3082,6 +4205,12 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
         return PR_ERROR(cmd);
       }
 
+      if (timer_wakeup == TRUE) {
+        /* We only woke up to apply the deferred timer resets. */
+        (void) proxy_ftp_data_timers_flush();
+        continue;
+      }
+
       /* XXX Have MAX_RETRIES logic here. */
       (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
         "timed out waiting for readability on control/data connections, "
@@ -3104,6 +4233,9 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
           pr_timer_remove(PR_TIMER_STALLED, ANY_MODULE);
         }
 
+        (void) proxy_ftp_data_timers_stop();
+        (void) proxy_ftp_data_bulk_stop();
+
 #if PROFTPD_VERSION_NUMBER >= 0x0001030901
         pr_throttle_pause(bytes_transferred, TRUE, bytes_transferred);
 #else
@@ -3125,7 +4257,7 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
       pr_trace_msg(trace_channel, 19,
         "handling data connection during data transfer");
 
-      pr_timer_reset(PR_TIMER_IDLE, ANY_MODULE);
+      (void) proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_IDLE);
 
       pbuf = proxy_ftp_data_recv(cmd->tmp_pool, src_data_conn, frontend_data);
       if (pbuf == NULL) {
@@ -3142,11 +4274,42 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
           "error receiving from source data connection: %s",
           strerror(xerrno));
 
+        if (resume_count > 0) {
+          /* Collect the backend's response for the failed transfer, then
+           * try to pick up where we left off.
+           */
+          (void) proxy_ftp_conn_listen_close(session.pool,
+            proxy_sess->backend_data_conn);
+          proxy_sess->backend_data_conn = NULL;
+
+          pending_resp = proxy_ftp_ctrl_recv_resp(cmd->tmp_pool,
+            proxy_sess->backend_ctrl_conn, &pending_resp_nlines, 0);
+          if (pending_resp != NULL) {
+            resume_count--;
+
+            if (proxy_data_resume_download(cmd, proxy_sess,
+                resume_offset + bytes_transferred) == 0) {
+              pending_resp = NULL;
+              continue;
+            }
+          }
+
+          if (proxy_sess->frontend_data_conn != NULL) {
+            pr_inet_close(session.pool, proxy_sess->frontend_data_conn);
+            proxy_sess->frontend_data_conn = session.d = NULL;
+          }
+
+          proxy_sess->frontend_sess_flags &= ~SF_XFER;
+          proxy_sess->backend_sess_flags &= ~SF_XFER;
+          xfer_ok = FALSE;
+          dst_xerrno = xerrno;
+        }
+
       } else {
         size_t nread;
 
-        pr_timer_reset(PR_TIMER_NOXFER, ANY_MODULE);
-        pr_timer_reset(PR_TIMER_STALLED, ANY_MODULE);
+        (void) proxy_ftp_data_timers_touch(
+          PROXY_FTP_DATA_TIMER_NOXFER|PROXY_FTP_DATA_TIMER_STALLED);
 
         nread = pbuf->current - pbuf->buf;
 
@@ -3156,13 +4319,60 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
            * be flushed out to the waiting peer.
            */
 
+          if (resume_count > 0) {
+            /* Before we close the frontend data connection, find out whether
+             * the backend server thinks that it sent the entire file; if not,
+             * try to resume the download.
+             */
+            (void) proxy_ftp_conn_listen_close(session.pool,
+              proxy_sess->backend_data_conn);
+            proxy_sess->backend_data_conn = NULL;
+
+            pending_resp = proxy_ftp_ctrl_recv_resp(cmd->tmp_pool,
+              proxy_sess->backend_ctrl_conn, &pending_resp_nlines, 0);
+            if (pending_resp != NULL &&
+                pending_resp->num[0] == '4') {
+              resume_count--;
+
+              pr_trace_msg(trace_channel, 9,
+                "backend %s interrupted (%s %s) after %" PR_LU " bytes",
+                (char *) cmd->argv[0], pending_resp->num, pending_resp->msg,
+                (pr_off_t) bytes_transferred);
+
+              if (proxy_data_resume_download(cmd, proxy_sess,
+                  resume_offset + bytes_transferred) == 0) {
+                pending_resp = NULL;
+                continue;
+              }
+            }
+          }
+
           pr_trace_msg(trace_channel, 19,
             "read EOF on data connection, closing frontend/backend data "
             "connections");
 
-          proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-          pr_inet_close(session.pool, proxy_sess->backend_data_conn);
-          proxy_sess->backend_data_conn = NULL;
+          if ((modez != NULL || xlate != NULL) &&
+              dst_data_conn != NULL) {
+            if (proxy_data_filter_finish(cmd->tmp_pool, xfer_direction,
+                modez, xlate, dst_data_conn, !frontend_data) < 0) {
+              xerrno = errno;
+              (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+                "error finishing data transfer: %s", strerror(xerrno));
+              xfer_ok = FALSE;
+              dst_xerrno = xerrno;
+            }
+          }
+
+          if (modez != NULL) {
+            proxy_ftp_modez_free(modez);
+            modez = NULL;
+          }
+
+          if (proxy_sess->backend_data_conn != NULL) {
+            (void) proxy_ftp_conn_listen_close(session.pool,
+              proxy_sess->backend_data_conn);
+            proxy_sess->backend_data_conn = NULL;
+          }
 
           if (proxy_sess->frontend_data_conn != NULL) {
             pr_inet_close(session.pool, proxy_sess->frontend_data_conn);
@@ -3174,8 +4384,9 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
           data_eof = TRUE;
 
         } else {
-          size_t nwrote = 0;
+          size_t nsend, nwrote = 0;
           char *ptr;
+          pr_buffer_t *sbuf, xbuf;
 
           pr_trace_msg(trace_channel, 9,
             "received %lu bytes of data from source data connection",
@@ -3190,18 +4401,48 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
           pr_throttle_pause(bytes_transferred, FALSE);
 #endif /* Prior to ProFTPD 1.3.9rc1 */
 
+          sbuf = pbuf;
+          nsend = nread;
+
+          if (modez != NULL ||
+              xlate != NULL) {
+            char *filter_buf = NULL;
+            size_t filter_buflen = 0;
+
+            res = proxy_data_filter(xfer_direction, modez, xlate, pbuf->buf,
+              nread, &filter_buf, &filter_buflen);
+            if (res < 0) {
+              xerrno = errno;
+              (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+                "error filtering %lu bytes of data: %s", (unsigned long) nread,
+                strerror(xerrno));
+
+              /* Treat this like a failed write, below. */
+              filter_buflen = 0;
+              errno = xerrno;
+            }
+
+            xbuf.buf = filter_buf;
+            xbuf.buflen = filter_buflen;
+            xbuf.current = filter_buf + filter_buflen;
+            xbuf.remaining = 0;
+
+            sbuf = &xbuf;
+            nsend = filter_buflen;
+          }
+
           /* We use a loop in order to properly handle short writes.
            *
-           * Since we are writing the pbuf from the head, we need to advance
+           * Since we are writing the sbuf from the head, we need to advance
            * that pointer for every write.  So we store a pointer to the
            * original buffer here, to be restored after the writes.
            */
-          ptr = pbuf->buf;
+          ptr = sbuf->buf;
 
-          while (nwrote != nread) {
+          while (nwrote != nsend) {
             int len;
 
-            len = proxy_ftp_data_send(cmd->tmp_pool, dst_data_conn, pbuf,
+            len = proxy_ftp_data_send(cmd->tmp_pool, dst_data_conn, sbuf,
               !frontend_data);
             if (len < 0) {
               xerrno = errno;
@@ -3218,16 +4459,41 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
             }
 
             nwrote += len;
-            pbuf->buf += len;
+            sbuf->buf += len;
             res = len;
           }
 
-          /* Restore the pbuf. */
-          pbuf->buf = ptr;
+          /* Restore the sbuf. */
+          sbuf->buf = ptr;
 
-          if (nwrote == nread) {
+          /* Decompression stops once its (bounded) output buffer is full;
+           * send the rest of the output for this input before reading any
+           * more into pbuf.
+           */
+          while (res >= 0 &&
+                 nwrote == nsend &&
+                 modez != NULL &&
+                 proxy_ftp_modez_pending(modez) == TRUE) {
+            char *filter_buf = NULL;
+            size_t filter_buflen = 0;
+
+            pr_signals_handle();
+
+            res = proxy_data_filter(xfer_direction, modez, xlate, pbuf->buf,
+              0, &filter_buf, &filter_buflen);
+            if (res == 0) {
+              res = proxy_data_send_data(cmd->tmp_pool, dst_data_conn,
+                filter_buf, filter_buflen, !frontend_data);
+            }
+          }
+
+          if (nwrote == nsend) {
             pbuf->current = pbuf->buf;
             pbuf->remaining = pbuf->buflen;
+
+            if (res >= 0) {
+              bulk_batch = proxy_ftp_data_bulk_next(nread);
+            }
           }
 
           if (res < 0) {
@@ -3245,8 +4511,8 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
               "unable to proxy data between frontend/backend, "
               "closing data connections");
 
-            proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-            pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+            (void) proxy_ftp_conn_listen_close(session.pool,
+              proxy_sess->backend_data_conn);
             proxy_sess->backend_data_conn = NULL;
 
             if (proxy_sess->frontend_data_conn != NULL) {
@@ -3281,10 +4547,22 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
       pr_trace_msg(trace_channel, 19,
         "handling control connection after data transfer");
 
+      (void) proxy_ftp_data_timers_flush();
       pr_timer_reset(PR_TIMER_IDLE, ANY_MODULE);
 
-      resp = proxy_ftp_ctrl_recv_resp(cmd->tmp_pool,
-        proxy_sess->backend_ctrl_conn, &resp_nlines, 0);
+      if (pending_resp != NULL) {
+        /* We already read this response, when checking whether to resume
+         * the transfer.
+         */
+        resp = pending_resp;
+        resp_nlines = pending_resp_nlines;
+        pending_resp = NULL;
+
+      } else {
+        resp = proxy_ftp_ctrl_recv_resp(cmd->tmp_pool,
+          proxy_sess->backend_ctrl_conn, &resp_nlines, 0);
+      }
+
       if (resp == NULL) {
         xerrno = errno;
         (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
@@ -3297,8 +4575,8 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
         }
 
         if (proxy_sess->backend_data_conn != NULL) {
-          proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-          pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+          (void) proxy_ftp_conn_listen_close(session.pool,
+            proxy_sess->backend_data_conn);
           proxy_sess->backend_data_conn = NULL;
         }
 
@@ -3339,8 +4617,8 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
 
             case PR_NETIO_IO_WR:
               if (proxy_sess->backend_data_conn != NULL) {
-                proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-                pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+                (void) proxy_ftp_conn_listen_close(session.pool,
+                  proxy_sess->backend_data_conn);
                 proxy_sess->backend_data_conn = NULL;
               }
               break;
@@ -3366,6 +4644,8 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
           pr_response_flush(&resp_err_list);
 
           pr_timer_remove(PR_TIMER_STALLED, ANY_MODULE);
+          (void) proxy_ftp_data_timers_stop();
+          (void) proxy_ftp_data_bulk_stop();
           errno = xerrno;
           return PR_ERROR(cmd);
         }
@@ -3390,6 +4670,9 @@ MODRET proxy_data(struct proxy_session *proxy_sess, cmd_rec *cmd) {
     pr_timer_remove(PR_TIMER_STALLED, ANY_MODULE);
   }
 
+  (void) proxy_ftp_data_timers_stop();
+  (void) proxy_ftp_data_bulk_stop();
+
 #if PROFTPD_VERSION_NUMBER >= 0x0001030901
   pr_throttle_pause(bytes_transferred, TRUE, bytes_transferred);
 #else
@@ -3730,13 +5013,29 @@ MODRET proxy_eprt(cmd_rec *cmd, struct proxy_session *proxy_sess) {
 MODRET proxy_epsv(cmd_rec *cmd, struct proxy_session *proxy_sess) {
   int res, xerrno;
   conn_t *data_conn;
-  const char *epsv_msg;
+  char epsv_msg[PROXY_FTP_MSG_EXT_ADDR_BUFSZ];
   char resp_msg[PR_RESPONSE_BUFFER_SIZE];
   const pr_netaddr_t *bind_addr, *remote_addr;
   pr_response_t *resp;
   unsigned int resp_nlines = 1;
 
-  /* TODO: Handle any possible EPSV params, e.g. "EPSV ALL", properly. */
+  if (cmd->argc == 2 &&
+      strcasecmp(cmd->argv[1], "ALL") == 0) {
+    /* Per RFC 2428, the client is telling us that it will only use EPSV
+     * from now on; we do not need to prepare any data connection for this.
+     * If our data transfer commands to the backend server will also only
+     * be EPSV, we tell the backend server the same, when next needed.
+     */
+    proxy_sess->frontend_sess_flags |= SF_EPSV_ALL;
+
+    resp = palloc(cmd->tmp_pool, sizeof(pr_response_t));
+    resp->num = R_200;
+    resp->msg = _("EPSV ALL command successful");
+
+    (void) proxy_ftp_ctrl_send_resp(cmd->tmp_pool,
+      proxy_sess->frontend_ctrl_conn, resp, resp_nlines);
+    return PR_HANDLED(cmd);
+  }
 
   switch (proxy_sess->dataxfer_policy) {
     case PR_CMD_PORT_ID:
@@ -3792,8 +5091,8 @@ MODRET proxy_epsv(cmd_rec *cmd, struct proxy_session *proxy_sess) {
   if (data_conn == NULL) {
     xerrno = errno;
 
-    proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-    pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
     proxy_sess->backend_data_conn = NULL;
 
     pr_response_add_err(R_425,
@@ -3812,8 +5111,31 @@ MODRET proxy_epsv(cmd_rec *cmd, struct proxy_session *proxy_sess) {
 
   proxy_sess->frontend_data_conn = session.d = data_conn;
 
-  epsv_msg = proxy_ftp_msg_fmt_ext_addr(cmd->tmp_pool, data_conn->local_addr,
-    data_conn->local_port, cmd->cmd_id, TRUE);
+  epsv_msg[0] = '\0';
+  res = proxy_ftp_msg_fmt_ext_addr2(data_conn->local_addr,
+    data_conn->local_port, cmd->cmd_id, TRUE, epsv_msg, sizeof(epsv_msg));
+  if (res < 0) {
+    xerrno = errno;
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error formatting EPSV address %s#%u: %s",
+      pr_netaddr_get_ipstr(data_conn->local_addr), data_conn->local_port,
+      strerror(xerrno));
+
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
+    proxy_sess->backend_data_conn = NULL;
+
+    proxy_inet_close(session.pool, data_conn);
+    pr_inet_close(session.pool, data_conn);
+    proxy_sess->frontend_data_conn = session.d = NULL;
+
+    pr_response_add_err(R_425,
+      _("Unable to build data connection: Internal error"));
+    pr_response_flush(&resp_err_list);
+
+    errno = xerrno;
+    return PR_ERROR(cmd);
+  }
 
   (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
     "Entering Extended Passive Mode (%s)", epsv_msg);
@@ -3833,8 +5155,8 @@ MODRET proxy_epsv(cmd_rec *cmd, struct proxy_session *proxy_sess) {
   if (res < 0) {
     xerrno = errno;
 
-    proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-    pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
     proxy_sess->backend_data_conn = NULL;
 
     proxy_inet_close(session.pool, data_conn);
@@ -3856,7 +5178,7 @@ MODRET proxy_epsv(cmd_rec *cmd, struct proxy_session *proxy_sess) {
 MODRET proxy_pasv(cmd_rec *cmd, struct proxy_session *proxy_sess) {
   int res, xerrno;
   conn_t *data_conn;
-  const char *pasv_msg;
+  char pasv_msg[PROXY_FTP_MSG_ADDR_BUFSZ];
   char resp_msg[PR_RESPONSE_BUFFER_SIZE];
   const pr_netaddr_t *bind_addr, *remote_addr;
   pr_response_t *resp;
@@ -3935,8 +5257,8 @@ MODRET proxy_pasv(cmd_rec *cmd, struct proxy_session *proxy_sess) {
   if (data_conn == NULL) {
     xerrno = errno;
 
-    proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-    pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
     proxy_sess->backend_data_conn = NULL;
 
     pr_response_add_err(R_425,
@@ -3955,8 +5277,30 @@ MODRET proxy_pasv(cmd_rec *cmd, struct proxy_session *proxy_sess) {
 
   proxy_sess->frontend_data_conn = session.d = data_conn;
 
-  pasv_msg = proxy_ftp_msg_fmt_addr(cmd->tmp_pool, data_conn->local_addr,
-    data_conn->local_port, TRUE);
+  pasv_msg[0] = '\0';
+  res = proxy_ftp_msg_fmt_addr2(data_conn->local_addr, data_conn->local_port,
+    TRUE, pasv_msg, sizeof(pasv_msg));
+  if (res < 0) {
+    xerrno = errno;
+    (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+      "error formatting PASV address %s#%u: %s",
+      pr_netaddr_get_ipstr(data_conn->local_addr), data_conn->local_port,
+      strerror(xerrno));
+
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
+    proxy_sess->backend_data_conn = NULL;
+
+    pr_inet_close(session.pool, data_conn);
+    proxy_sess->frontend_data_conn = session.d = NULL;
+
+    pr_response_add_err(R_425,
+      _("Unable to build data connection: Internal error"));
+    pr_response_flush(&resp_err_list);
+
+    errno = xerrno;
+    return PR_ERROR(cmd);
+  }
 
   (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
     "Entering Passive Mode (%s).", pasv_msg);
@@ -3976,8 +5320,8 @@ MODRET proxy_pasv(cmd_rec *cmd, struct proxy_session *proxy_sess) {
   if (res < 0) {
     xerrno = errno;
 
-    proxy_inet_close(session.pool, proxy_sess->backend_data_conn);
-    pr_inet_close(session.pool, proxy_sess->backend_data_conn);
+    (void) proxy_ftp_conn_listen_close(session.pool,
+      proxy_sess->backend_data_conn);
     proxy_sess->backend_data_conn = NULL;
 
     pr_inet_close(session.pool, data_conn);
@@ -4236,48 +5580,17 @@ MODRET proxy_feat(cmd_rec *cmd, struct proxy_session *proxy_sess) {
   if (proxy_sess->backend_features == NULL) {
     if (MODRET_ISHANDLED(mr) &&
         resp != NULL) {
-      const char *feat_crlf = "\r\n";
-      char *feats, *token;
-      size_t token_len = 0;
+      char *feats;
+      size_t feats_len;
 
       pr_trace_msg(trace_channel, 9,
         "populating backend features based on FEAT response to frontend "
         "client");
 
-      proxy_sess->backend_features = pr_table_nalloc(proxy_pool, 0, 4);
-
-      feats = pstrdup(cmd->tmp_pool, resp->msg);
-      token = pr_str_get_token2(&feats, (char *) feat_crlf, &token_len);
-      while (token != NULL) {
-        pr_signals_handle();
-
-        if (token_len > 0) {
-          /* The FEAT response lines in which we are interested all start with
-           * a single space, per RFC spec.  Ignore any other lines.
-           */
-          if (token[0] == ' ') {
-            char *key, *val, *ptr;
-
-            /* Find the next space in the string, to delimit our key/value
-             * pairs.
-             */
-            ptr = strchr(token + 1, ' ');
-            if (ptr != NULL) {
-              key = pstrndup(proxy_pool, token + 1, ptr - token - 1);
-              val = pstrdup(proxy_pool, ptr + 1);
-
-            } else {
-              key = pstrdup(proxy_pool, token + 1);
-              val = pstrdup(proxy_pool, "");
-            }
-
-            pr_table_add(proxy_sess->backend_features, key, val, 0);
-          }
-        }
-
-        feats = token + token_len + 1;
-        token = pr_str_get_token2(&feats, (char *) feat_crlf, &token_len);
-      }
+      feats_len = strlen(resp->msg);
+      feats = pstrndup(proxy_pool, resp->msg, feats_len);
+      (void) proxy_ftp_sess_parse_feat(proxy_pool, feats, feats_len,
+        proxy_sess);
     }
   }
 
@@ -4543,12 +5856,29 @@ MODRET proxy_pass(cmd_rec *cmd, struct proxy_session *proxy_sess,
 }
 
 MODRET proxy_type(cmd_rec *cmd, struct proxy_session *proxy_sess) {
-  int res, xerrno;
+  int res, xerrno, xlate_ascii = FALSE;
   pr_response_t *resp;
   unsigned int resp_nlines = 0;
+  cmd_rec *type_cmd;
+
+  type_cmd = cmd;
+
+  if ((proxy_opts & PROXY_OPT_TRANSLATE_ASCII) &&
+      cmd->argc >= 2 &&
+      strcasecmp(cmd->argv[1], "A") == 0 &&
+      (cmd->argc == 2 ||
+       (cmd->argc == 3 &&
+        strcasecmp(cmd->argv[2], "N") == 0))) {
+    /* We do the ASCII translation ourselves, and ask the backend server for
+     * a binary transfer instead.
+     */
+    xlate_ascii = TRUE;
+    type_cmd = pr_cmd_alloc(cmd->tmp_pool, 2, C_TYPE, "I");
+    type_cmd->arg = "I";
+  }
 
   res = proxy_ftp_ctrl_send_cmd(cmd->tmp_pool, proxy_sess->backend_ctrl_conn,
-    cmd);
+    type_cmd);
   if (res < 0) {
     xerrno = errno;
     (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
@@ -4605,6 +5935,15 @@ MODRET proxy_type(cmd_rec *cmd, struct proxy_session *proxy_sess) {
       /* TYPE I(MAGE) or TYPE L 8. */
       session.sf_flags &= (SF_ALL^(SF_ASCII|SF_ASCII_OVERRIDE));
     }
+
+    proxy_ascii_xlate = xlate_ascii;
+    if (xlate_ascii == TRUE) {
+      pr_trace_msg(trace_channel, 15,
+        "using binary transfers with backend, translating ASCII locally");
+
+      /* Do not leak our binary mode to the client. */
+      resp->msg = pstrdup(cmd->tmp_pool, _("Type set to A"));
+    }
   }
 
   res = proxy_ftp_ctrl_send_resp(cmd->tmp_pool, proxy_sess->frontend_ctrl_conn,
@@ -4736,8 +6075,7 @@ MODRET proxy_any(cmd_rec *cmd) {
     return PR_ERROR(cmd);
   }
 
-  proxy_sess = (struct proxy_session *) pr_table_get(session.notes,
-    "mod_proxy.proxy-session", NULL);
+  proxy_sess = (struct proxy_session *) proxy_session_get_current();
   if (proxy_sess == NULL) {
     /* Unlikely to occur. */
     (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION, "%s",
@@ -4770,6 +6108,23 @@ MODRET proxy_any(cmd_rec *cmd) {
   pr_response_block(FALSE);
   pr_timer_reset(PR_TIMER_IDLE, ANY_MODULE);
 
+  /* Let the directory cache see every command, so that it can invalidate
+   * any snapshot as needed.
+   */
+  (void) proxy_ftp_dircache_note_cmd(proxy_sess, cmd);
+
+  if ((proxy_sess->frontend_sess_flags & SF_EPSV_ALL) &&
+      (cmd->cmd_id == PR_CMD_EPRT_ID ||
+       cmd->cmd_id == PR_CMD_PASV_ID ||
+       cmd->cmd_id == PR_CMD_PORT_ID)) {
+    /* Once the client has sent EPSV ALL, it may only use EPSV (RFC 2428). */
+    pr_response_add_err(R_500, _("Illegal %s command, EPSV ALL in effect"),
+      (char *) cmd->argv[0]);
+    pr_cmd_set_errno(cmd, EPERM);
+    errno = EPERM;
+    return PR_ERROR(cmd);
+  }
+
   /* Commands related to logins and data transfers are handled separately. */
 
   switch (cmd->cmd_id) {
@@ -5079,6 +6434,101 @@ MODRET proxy_any(cmd_rec *cmd) {
     }
   }
 
+  if (cmd->cmd_id == PR_CMD_MODE_ID &&
+      cmd->argc == 2) {
+    pr_response_t *resp = NULL;
+
+    /* Track the transfer mode that the client asked for, as that is also the
+     * mode of the backend server; compressed data from a MODE Z client is
+     * relayed as is.
+     */
+    mr = proxy_cmd(cmd, proxy_sess, &resp);
+    if (MODRET_ISHANDLED(mr) &&
+        resp != NULL &&
+        resp->num[0] == '2') {
+      if (strcasecmp(cmd->argv[1], "Z") == 0) {
+        proxy_client_mode_z = TRUE;
+        proxy_sess->dataxfer_flags |= PROXY_SESS_DATA_TRANSFER_FL_MODE_Z;
+
+      } else {
+        proxy_client_mode_z = FALSE;
+        proxy_sess->dataxfer_flags &= ~PROXY_SESS_DATA_TRANSFER_FL_MODE_Z;
+      }
+    }
+
+    return mr;
+  }
+
+  if (proxy_ascii_xlate == TRUE &&
+      (session.sf_flags & SF_ASCII)) {
+    /* The backend server only sees binary transfers, and thus its sizes and
+     * offsets would not match the ASCII data the client sees.  As mod_xfer
+     * does, refuse such requests in ASCII mode.
+     */
+    if (cmd->cmd_id == PR_CMD_SIZE_ID) {
+      pr_response_add_err(R_550, _("%s: SIZE not allowed in ASCII mode"),
+        cmd->arg);
+      pr_cmd_set_errno(cmd, EPERM);
+      errno = EPERM;
+      return PR_ERROR(cmd);
+    }
+
+    if (cmd->cmd_id == PR_CMD_REST_ID &&
+        cmd->argc == 2 &&
+        strspn(cmd->argv[1], "0") != strlen(cmd->argv[1])) {
+      pr_response_add_err(R_501,
+        _("%s: Resuming transfers not allowed in ASCII mode"),
+        (char *) cmd->argv[0]);
+      pr_cmd_set_errno(cmd, EPERM);
+      errno = EPERM;
+      return PR_ERROR(cmd);
+    }
+  }
+
+  if (cmd->cmd_id == PR_CMD_REST_ID &&
+      cmd->argc == 2) {
+    pr_response_t *resp = NULL;
+
+    /* Note the restart offset, in case we need to resume the download which
+     * follows.
+     */
+    mr = proxy_cmd(cmd, proxy_sess, &resp);
+    if (MODRET_ISHANDLED(mr) &&
+        resp != NULL &&
+        resp->num[0] == '3') {
+      char *ptr = NULL;
+
+      proxy_restart_pos = (off_t) strtoull(cmd->argv[1], &ptr, 10);
+      if (ptr == NULL ||
+          *ptr != '\0' ||
+          *((char *) cmd->argv[1]) == '-') {
+        proxy_restart_pos = -1;
+      }
+    }
+
+    return mr;
+  }
+
+  if (proxy_sess->dircache_ctx != NULL &&
+      (cmd->cmd_id == PR_CMD_MLST_ID ||
+       cmd->cmd_id == PR_CMD_SIZE_ID ||
+       cmd->cmd_id == PR_CMD_MDTM_ID)) {
+    pr_response_t *resp;
+    unsigned int resp_nlines = 0;
+
+    /* Bursts of these commands for the same directory can be answered from
+     * a single MLSD snapshot, rather than one backend round trip each.
+     */
+    resp = proxy_ftp_dircache_get_resp(cmd->tmp_pool, proxy_sess, cmd,
+      &resp_nlines);
+    if (resp != NULL) {
+      (void) proxy_ftp_ctrl_send_resp(cmd->tmp_pool,
+        proxy_sess->frontend_ctrl_conn, resp, resp_nlines);
+      pr_response_block(TRUE);
+      return PR_HANDLED(cmd);
+    }
+  }
+
   return proxy_cmd(cmd, proxy_sess, NULL);
 }
 
@@ -5133,8 +6583,7 @@ static void proxy_ctrl_read_ev(const void *event_data, void *user_data) {
 static void proxy_exit_ev(const void *event_data, void *user_data) {
   struct proxy_session *proxy_sess;
 
-  proxy_sess = (struct proxy_session *) pr_table_get(session.notes,
-    "mod_proxy.proxy-session", NULL);
+  proxy_sess = (struct proxy_session *) proxy_session_get_current();
   if (proxy_sess != NULL) {
     /* proxy_sess->frontend_ctrl_conn is session.c; let the core engine
      * close that connection.  If we try to close it here via pr_inet_close(),
@@ -5163,12 +6612,17 @@ static void proxy_exit_ev(const void *event_data, void *user_data) {
     }
 
     if (proxy_sess->backend_data_conn != NULL) {
-      proxy_inet_close(proxy_sess->pool, proxy_sess->backend_data_conn);
-      pr_inet_close(proxy_sess->pool, proxy_sess->backend_data_conn);
+      (void) proxy_ftp_conn_listen_close(proxy_sess->pool,
+        proxy_sess->backend_data_conn);
       proxy_sess->backend_data_conn = NULL;
     }
 
-    pr_table_remove(session.notes, "mod_proxy.proxy-session", NULL);
+#if defined(PR_USE_OPENSSL)
+    /* We are exiting; do not linger for any deferred TLS shutdowns. */
+    (void) proxy_tls_reap_data_sess(TRUE);
+#endif /* PR_USE_OPENSSL */
+
+    (void) proxy_session_set_current(NULL);
   }
 
   switch (proxy_role) {
@@ -5277,6 +6731,15 @@ static void proxy_postparse_ev(const void *event_data, void *user_data) {
     pr_session_disconnect(&proxy_module, PR_SESS_DISCONNECT_BAD_CONFIG,
       "Failed TLS initialization");
   }
+
+  if (proxy_ftp_xfer_init(proxy_pool, proxy_tables_dir, 0) < 0) {
+    pr_log_pri(PR_LOG_WARNING, MOD_PROXY_VERSION
+      ": unable to initialize FTP data transfer support, failing to start "
+      "up: %s", strerror(errno));
+
+    pr_session_disconnect(&proxy_module, PR_SESS_DISCONNECT_BAD_CONFIG,
+      "Failed FTP data transfer initialization");
+  }
 }
 
 static void proxy_restart_ev(const void *event_data, void *user_data) {
@@ -5284,6 +6747,7 @@ static void proxy_restart_ev(const void *event_data, void *user_data) {
   (void) proxy_reverse_free(proxy_pool);
   (void) proxy_ssh_free(proxy_pool);
   (void) proxy_tls_free(proxy_pool);
+  (void) proxy_ftp_xfer_free(proxy_pool);
 
   /* Do NOT close the database connection/handle here; we may have session
    * processes that have their own handles to that same file.
@@ -5311,15 +6775,17 @@ static void proxy_sess_reinit_ev(const void *event_data, void *user_data) {
    * and affects the entire daemon process.
    */
 
-  proxy_sess = (struct proxy_session *) pr_table_get(session.notes,
-    "mod_proxy.proxy-session", NULL);
+  proxy_sess = (struct proxy_session *) proxy_session_get_current();
   if (proxy_sess != NULL) {
     proxy_ssh_sess_free(proxy_pool);
     proxy_tls_sess_free(proxy_pool);
+    proxy_ftp_xfer_sess_free(proxy_pool);
     proxy_reverse_sess_free(proxy_pool, proxy_sess);
     proxy_forward_sess_free(proxy_pool, proxy_sess);
+    (void) proxy_ftp_conn_listen_pool_free();
+    (void) proxy_sockopts_free();
 
-    (void) pr_table_remove(session.notes, "mod_proxy.proxy-session", NULL);
+    (void) proxy_session_set_current(NULL);
     proxy_session_free(proxy_pool, proxy_sess);
   }
 
@@ -5348,6 +6814,7 @@ static void proxy_shutdown_ev(const void *event_data, void *user_data) {
   (void) proxy_reverse_free(proxy_pool);
   (void) proxy_ssh_free(proxy_pool);
   (void) proxy_tls_free(proxy_pool);
+  (void) proxy_ftp_xfer_free(proxy_pool);
 
   res = proxy_db_close(proxy_pool, NULL);
   if (res < 0) {
@@ -5377,7 +6844,7 @@ static void unblock_responses(void) {
   const struct proxy_session *proxy_sess;
   int block_responses = FALSE;
 
-  proxy_sess = pr_table_get(session.notes, "mod_proxy.proxy-session", NULL);
+  proxy_sess = proxy_session_get_current();
   if (proxy_sess != NULL &&
       proxy_sess->use_ssh == TRUE) {
     /* We do not want mod_core's response flushed to the frontend client
@@ -5569,42 +7036,11 @@ static int proxy_sess_init(void) {
   proxy_set_sess_defaults();
 
   /* Allocate our own session structure, for tracking proxy-specific
-   * fields.  Use the session.notes table for stashing/retrieving it as
-   * needed.
+   * fields.  Make it the current session, which also stashes it in the
+   * session.notes table, for other modules.
    */
   proxy_sess = (struct proxy_session *) proxy_session_alloc(proxy_pool);
-  res = pr_table_add(session.notes, "mod_proxy.proxy-session", proxy_sess,
-    sizeof(struct proxy_session));
-
-  if (res < 0 &&
-      errno == ENOSPC) {
-    int nents, nmaxents;
-
-    nents = pr_table_count(session.notes);
-    nmaxents = nents * 2;
-
-    /* Attempt to handle the unusual case where the table is full, since
-     * we really need this note.
-     */
-    pr_trace_msg(trace_channel, 1,
-      "session notes table is full (%u), increasing entry limit to %u",
-      nents, nmaxents);
-
-    if (pr_table_ctl(session.notes, PR_TABLE_CTL_SET_MAX_ENTS,
-        &nmaxents) == 0) {
-      res = pr_table_add(session.notes, "mod_proxy.proxy-session", proxy_sess,
-        sizeof(struct proxy_session));
-
-    } else {
-      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
-        "error increasing session notes max entries: %s", strerror(errno));
-
-      res = -1;
-      errno = ENOSPC;
-    }
-  }
-
-  if (res < 0) {
+  if (proxy_session_set_current(proxy_sess) < 0) {
     (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
       "error stashing proxy session note: %s", strerror(errno));
 
@@ -5627,6 +7063,18 @@ static int proxy_sess_init(void) {
     proxy_sess->dataxfer_policy = *((int *) c->argv[0]);
   }
 
+  c = find_config(main_server->conf, CONF_PARAM, "ProxyRetryCount", FALSE);
+  if (c != NULL) {
+    proxy_resume_count = *((int *) c->argv[0]);
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "ProxyDataBulkTransfer",
+    FALSE);
+  if (c != NULL) {
+    proxy_bulk_max_bytes = *((off_t *) c->argv[0]);
+    proxy_bulk_max_millis = *((unsigned int *) c->argv[1]);
+  }
+
   c = find_config(main_server->conf, CONF_PARAM, "ProxyDirectoryListPolicy",
     FALSE);
   if (c != NULL) {
@@ -5634,6 +7082,26 @@ static int proxy_sess_init(void) {
     proxy_sess->dirlist_opts = *((unsigned long *) c->argv[1]);
   }
 
+  c = find_config(main_server->conf, CONF_PARAM, "ProxyDirectoryCache", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    if (proxy_ftp_dircache_init(proxy_sess->pool, proxy_sess,
+        *((unsigned int *) c->argv[1]), *((int *) c->argv[2])) < 0) {
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error initializing directory cache: %s", strerror(errno));
+    }
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "ProxyDataListenPool", FALSE);
+  if (c != NULL &&
+      *((int *) c->argv[0]) == TRUE) {
+    if (proxy_ftp_conn_listen_pool_init(proxy_pool,
+        *((unsigned int *) c->argv[1])) < 0) {
+      (void) pr_log_writefile(proxy_logfd, MOD_PROXY_VERSION,
+        "error initializing data listen pool: %s", strerror(errno));
+    }
+  }
+
   c = find_config(main_server->conf, CONF_PARAM, "ProxyTimeoutConnect", FALSE);
   if (c != NULL) {
     proxy_sess->connect_timeout = *((int *) c->argv[0]);
@@ -5650,6 +7118,14 @@ static int proxy_sess_init(void) {
     proxy_sess->linger_timeout = PROXY_LINGER_DEFAULT_TIMEOUT;
   }
 
+  c = find_config(main_server->conf, CONF_PARAM, "ProxyTimeoutTick", FALSE);
+  if (c != NULL) {
+    proxy_sess->timer_tick = *((int *) c->argv[0]);
+
+  } else {
+    proxy_sess->timer_tick = PROXY_TIMER_DEFAULT_TICK;
+  }
+
   c = find_config(main_server->conf, CONF_PARAM,
     "ProxyTLSTransferProtectionPolicy", FALSE);
   if (c != NULL) {
@@ -5693,6 +7169,25 @@ static int proxy_sess_init(void) {
       "Unable to initialize TLS API");
   }
 
+  if (proxy_ftp_xfer_sess_init(proxy_pool, proxy_sess, 0) < 0) {
+    pr_session_disconnect(&proxy_module, PR_SESS_DISCONNECT_BY_APPLICATION,
+      "Unable to initialize FTP data transfer API");
+  }
+
+  c = find_config(main_server->conf, CONF_PARAM, "ProxySocketOptions", FALSE);
+  while (c != NULL) {
+    pr_signals_handle();
+
+    (void) proxy_sockopts_set_profile(*((int *) c->argv[0]), c->argv[1]);
+    c = find_config_next(c, c->next, CONF_PARAM, "ProxySocketOptions", FALSE);
+  }
+
+  /* Now that we know which protocol is being proxied, tune the frontend
+   * control connection.
+   */
+  (void) proxy_sockopts_apply_conn(session.c, proxy_sess->use_ssh ?
+    PROXY_SOCKOPTS_ROLE_SSH : PROXY_SOCKOPTS_ROLE_FRONTEND_CTRL);
+
   switch (proxy_role) {
     case PROXY_ROLE_REVERSE:
       if (proxy_reverse_sess_init(proxy_pool, proxy_tables_dir,
@@ -5742,10 +7237,14 @@ static int proxy_sess_init(void) {
  */
 
 static conftable proxy_conftab[] = {
+  { "ProxyDataBulkTransfer",	set_proxydatabulktransfer,	NULL },
+  { "ProxyDataListenPool",	set_proxydatalistenpool,	NULL },
   { "ProxyDataTransferPolicy",	set_proxydataxferpolicy,	NULL },
   { "ProxyDatastore",		set_proxydatastore,		NULL },
+  { "ProxyDirectoryCache",	set_proxydirectorycache,	NULL },
   { "ProxyDirectoryListPolicy",	set_proxydirlistpolicy,		NULL },
   { "ProxyEngine",		set_proxyengine,		NULL },
+  { "ProxyForwardDestinationCache", set_proxyforwarddestinationcache, NULL },
   { "ProxyForwardEnabled",	set_proxyforwardenabled,	NULL },
   { "ProxyForwardMethod",	set_proxyforwardmethod,		NULL },
   { "ProxyForwardTo",		set_proxyforwardto,		NULL },
@@ -5755,17 +7254,21 @@ static conftable proxy_conftab[] = {
   { "ProxyReverseConnectPolicy",set_proxyreverseconnectpolicy,	NULL },
   { "ProxyReverseServers",	set_proxyreverseservers,	NULL },
   { "ProxyRole",		set_proxyrole,			NULL },
+  { "ProxySocketOptions",	set_proxysocketoptions,		NULL },
   { "ProxySourceAddress",	set_proxysourceaddress,		NULL },
   { "ProxyTables",		set_proxytables,		NULL },
   { "ProxyTimeoutConnect",	set_proxytimeoutconnect,	NULL },
   { "ProxyTimeoutLinger",	set_proxytimeoutlinger,		NULL },
+  { "ProxyTimeoutTick",		set_proxytimeouttick,		NULL },
 
   /* SSH support */
+  { "ProxySFTPAdaptiveKeyExchanges", set_proxysftpadaptivekeyexchanges, NULL },
   { "ProxySFTPCiphers",		set_proxysftpciphers,		NULL },
   { "ProxySFTPCompression",	set_proxysftpcompression,	NULL },
   { "ProxySFTPDigests",		set_proxysftpdigests,		NULL },
   { "ProxySFTPHostKey",		set_proxysftphostkey,		NULL },
   { "ProxySFTPKeyExchanges",	set_proxysftpkeyexchanges,	NULL },
+  { "ProxySFTPLogPackets",	set_proxysftplogpackets,	NULL },
   { "ProxySFTPOptions",		set_proxysftpoptions,		NULL },
   { "ProxySFTPPassPhraseProvider", set_proxysftppassphraseprovider, NULL },
   { "ProxySFTPServerAlive",	set_proxysftpserveralive,	NULL },
@@ -5773,6 +7276,7 @@ static conftable proxy_conftab[] = {
   { "ProxySFTPVerifyServer",	set_proxysftpverifyserver,	NULL },
 
   /* TLS support */
+  { "ProxyTLSBufferPolicy",	set_proxytlsbufferpolicy,	NULL },
   { "ProxyTLSCACertificateFile",set_proxytlscacertfile,		NULL },
   { "ProxyTLSCACertificatePath",set_proxytlscacertpath,		NULL },
   { "ProxyTLSCARevocationFile",	set_proxytlscacrlfile,		NULL },
@@ -5784,6 +7288,7 @@ static conftable proxy_conftab[] = {
   { "ProxyTLSOptions",		set_proxytlsoptions,		NULL },
   { "ProxyTLSPreSharedKey",	set_proxytlspresharedkey,	NULL },
   { "ProxyTLSProtocol",		set_proxytlsprotocol,		NULL },
+  { "ProxyTLSShutdownPolicy",	set_proxytlsshutdownpolicy,	NULL },
   { "ProxyTLSTimeoutHandshake",	set_proxytlstimeouthandshake,	NULL },
   { "ProxyTLSTransferProtectionPolicy",	set_proxytlsxferprotpolicy,	NULL },
   { "ProxyTLSVerifyServer",	set_proxytlsverifyserver,	NULL },
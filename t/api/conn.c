@@ -123,6 +123,59 @@ START_TEST (conn_get_addr_test) {
 }
 END_TEST
 
+START_TEST (conn_set_addrs_test) {
+  int res;
+  const struct proxy_conn *pconn;
+  const char *ipstr, *url;
+  const pr_netaddr_t *pconn_addr;
+  array_header *addrs, *other_addrs = NULL;
+
+  res = proxy_conn_set_addrs(NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null arguments");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  url = "ftp://example.com:2121";
+  pconn = proxy_conn_create(p, url, PROXY_CONN_CREATE_FL_NO_RESOLVE);
+  ck_assert_msg(pconn != NULL,
+    "Failed to create pconn for URL '%s' as expected", url);
+
+  pconn_addr = proxy_conn_get_addr(pconn, NULL);
+  ck_assert_msg(pconn_addr == NULL, "Got address for unresolved pconn");
+
+  addrs = make_array(p, 0, sizeof(char *));
+
+  mark_point();
+  res = proxy_conn_set_addrs(pconn, addrs);
+  ck_assert_msg(res < 0, "Failed to handle empty addresses");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  *((char **) push_array(addrs)) = "127.0.0.2";
+  *((char **) push_array(addrs)) = "127.0.0.1";
+
+  res = proxy_conn_set_addrs(pconn, addrs);
+  ck_assert_msg(res == 0, "Failed to set addresses: %s", strerror(errno));
+
+  pconn_addr = proxy_conn_get_addr(pconn, &other_addrs);
+  ck_assert_msg(pconn_addr != NULL, "Failed to get address for pconn");
+  ipstr = pr_netaddr_get_ipstr(pconn_addr);
+  ck_assert_msg(strcmp(ipstr, "127.0.0.2") == 0,
+    "Expected IP address '127.0.0.2', got '%s'", ipstr);
+  ck_assert_msg(ntohs(pr_netaddr_get_port(pconn_addr)) == 2121,
+    "Expected port 2121, got %u", ntohs(pr_netaddr_get_port(pconn_addr)));
+
+  ck_assert_msg(other_addrs != NULL, "Failed to get other addresses");
+  ck_assert_msg(other_addrs->nelts == 1, "Expected 1 other address, got %u",
+    other_addrs->nelts);
+  ipstr = pr_netaddr_get_ipstr(((pr_netaddr_t **) other_addrs->elts)[0]);
+  ck_assert_msg(strcmp(ipstr, "127.0.0.1") == 0,
+    "Expected IP address '127.0.0.1', got '%s'", ipstr);
+
+  proxy_conn_free(pconn);
+}
+END_TEST
+
 START_TEST (conn_get_host_test) {
   const char *host, *url, *expected;
   const struct proxy_conn *pconn;
@@ -840,6 +893,7 @@ Suite *tests_get_conn_suite(void) {
 
   tcase_add_test(testcase, conn_create_test);
   tcase_add_test(testcase, conn_get_addr_test);
+  tcase_add_test(testcase, conn_set_addrs_test);
   tcase_add_test(testcase, conn_get_host_test);
   tcase_add_test(testcase, conn_get_port_test);
   tcase_add_test(testcase, conn_get_hostport_test);
@@ -0,0 +1,273 @@
+/*
+ * ProFTPD - mod_proxy testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Forward destination cache API tests. */
+
+#include "../tests.h"
+
+static pool *p = NULL;
+static const char *test_dir = "/tmp/mod_proxy-test-forward-dstcache";
+
+static int create_test_dir(void) {
+  int res;
+  mode_t perms;
+
+  perms = 0770;
+  res = mkdir(test_dir, perms);
+  ck_assert_msg(res == 0, "Failed to create tmp directory '%s': %s", test_dir,
+    strerror(errno));
+
+  res = chmod(test_dir, perms);
+  ck_assert_msg(res == 0, "Failed to set perms %04o on directory '%s': %s",
+    perms, test_dir, strerror(errno));
+
+  return 0;
+}
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = permanent_pool = proxy_pool = make_sub_pool(NULL);
+  }
+
+  (void) tests_rmpath(p, test_dir);
+  (void) create_test_dir();
+  proxy_db_init(p);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.db", 1, 20);
+    pr_trace_set_levels("proxy.forward.dstcache", 1, 20);
+  }
+}
+
+static void tear_down(void) {
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.db", 0, 0);
+    pr_trace_set_levels("proxy.forward.dstcache", 0, 0);
+  }
+
+  (void) proxy_forward_dstcache_sess_free(p);
+  proxy_db_free();
+  (void) tests_rmpath(p, test_dir);
+
+  if (p != NULL) {
+    destroy_pool(p);
+    p = permanent_pool = proxy_pool = NULL;
+  }
+}
+
+static void open_dstcache(void) {
+  int res;
+
+  res = proxy_forward_dstcache_init(p, test_dir, PROXY_DB_OPEN_FL_SKIP_VACUUM);
+  ck_assert_msg(res == 0, "Failed to init destination cache: %s",
+    strerror(errno));
+
+  res = proxy_forward_dstcache_sess_init(p, test_dir, 0);
+  ck_assert_msg(res == 0, "Failed to open destination cache: %s",
+    strerror(errno));
+}
+
+START_TEST (dstcache_init_test) {
+  int res;
+
+  res = proxy_forward_dstcache_init(NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null arguments");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_forward_dstcache_init(p, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null tables dir");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_forward_dstcache_sess_init(p, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null tables dir");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  open_dstcache();
+
+  res = proxy_forward_dstcache_sess_free(p);
+  ck_assert_msg(res == 0, "Failed to close destination cache: %s",
+    strerror(errno));
+}
+END_TEST
+
+START_TEST (dstcache_add_test) {
+  int res;
+  const char *uri;
+  array_header *addrs, *cached;
+
+  uri = "ftp://ftp.example.com:21";
+  addrs = make_array(p, 0, sizeof(char *));
+  *((char **) push_array(addrs)) = "127.0.0.1";
+
+  res = proxy_forward_dstcache_add(p, uri, addrs, 60);
+  ck_assert_msg(res < 0, "Failed to handle unopened cache");
+  ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  open_dstcache();
+
+  res = proxy_forward_dstcache_add(NULL, NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null arguments");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_forward_dstcache_add(p, uri, addrs, -1);
+  ck_assert_msg(res < 0, "Failed to handle negative TTL");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  cached = proxy_forward_dstcache_get(p, uri);
+  ck_assert_msg(cached == NULL, "Found uncached URI unexpectedly");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  *((char **) push_array(addrs)) = "::1";
+
+  res = proxy_forward_dstcache_add(p, uri, addrs, 60);
+  ck_assert_msg(res == 0, "Failed to add URI: %s", strerror(errno));
+
+  cached = proxy_forward_dstcache_get(p, uri);
+  ck_assert_msg(cached != NULL, "Failed to get cached URI: %s",
+    strerror(errno));
+  ck_assert_msg(cached->nelts == 2, "Expected 2 addresses, got %u",
+    cached->nelts);
+  ck_assert_msg(strcmp(((char **) cached->elts)[0], "127.0.0.1") == 0,
+    "Expected '127.0.0.1', got '%s'", ((char **) cached->elts)[0]);
+  ck_assert_msg(strcmp(((char **) cached->elts)[1], "::1") == 0,
+    "Expected '::1', got '%s'", ((char **) cached->elts)[1]);
+
+  /* An entry with no lifetime is expired immediately. */
+  res = proxy_forward_dstcache_add(p, uri, addrs, 0);
+  ck_assert_msg(res == 0, "Failed to add URI: %s", strerror(errno));
+
+  cached = proxy_forward_dstcache_get(p, uri);
+  ck_assert_msg(cached == NULL, "Found expired URI unexpectedly");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+}
+END_TEST
+
+START_TEST (dstcache_add_negative_test) {
+  int res;
+  const char *uri;
+  array_header *cached;
+
+  open_dstcache();
+
+  uri = "ftp://nosuchhost.example.com:21";
+  res = proxy_forward_dstcache_add(p, uri, NULL, 60);
+  ck_assert_msg(res == 0, "Failed to add unresolvable URI: %s",
+    strerror(errno));
+
+  cached = proxy_forward_dstcache_get(p, uri);
+  ck_assert_msg(cached == NULL, "Found addresses for unresolvable URI");
+  ck_assert_msg(errno == EHOSTUNREACH,
+    "Expected EHOSTUNREACH (%d), got %s (%d)", EHOSTUNREACH, strerror(errno),
+    errno);
+}
+END_TEST
+
+START_TEST (dstcache_set_good_addr_test) {
+  int res;
+  const char *uri;
+  array_header *addrs, *cached;
+
+  res = proxy_forward_dstcache_set_good_addr(NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null arguments");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  open_dstcache();
+
+  uri = "ftp://ftp.example.com:21";
+  addrs = make_array(p, 0, sizeof(char *));
+  *((char **) push_array(addrs)) = "127.0.0.1";
+  *((char **) push_array(addrs)) = "127.0.0.2";
+  *((char **) push_array(addrs)) = "127.0.0.3";
+
+  res = proxy_forward_dstcache_add(p, uri, addrs, 60);
+  ck_assert_msg(res == 0, "Failed to add URI: %s", strerror(errno));
+
+  res = proxy_forward_dstcache_set_good_addr(p, uri, "127.0.0.3");
+  ck_assert_msg(res == 0, "Failed to set good address: %s", strerror(errno));
+
+  cached = proxy_forward_dstcache_get(p, uri);
+  ck_assert_msg(cached != NULL, "Failed to get cached URI: %s",
+    strerror(errno));
+  ck_assert_msg(cached->nelts == 3, "Expected 3 addresses, got %u",
+    cached->nelts);
+  ck_assert_msg(strcmp(((char **) cached->elts)[0], "127.0.0.3") == 0,
+    "Expected '127.0.0.3', got '%s'", ((char **) cached->elts)[0]);
+  ck_assert_msg(strcmp(((char **) cached->elts)[1], "127.0.0.1") == 0,
+    "Expected '127.0.0.1', got '%s'", ((char **) cached->elts)[1]);
+  ck_assert_msg(strcmp(((char **) cached->elts)[2], "127.0.0.2") == 0,
+    "Expected '127.0.0.2', got '%s'", ((char **) cached->elts)[2]);
+
+  /* A good address which is no longer among the addresses is ignored. */
+  res = proxy_forward_dstcache_set_good_addr(p, uri, "127.0.0.4");
+  ck_assert_msg(res == 0, "Failed to set good address: %s", strerror(errno));
+
+  cached = proxy_forward_dstcache_get(p, uri);
+  ck_assert_msg(cached != NULL, "Failed to get cached URI: %s",
+    strerror(errno));
+  ck_assert_msg(cached->nelts == 3, "Expected 3 addresses, got %u",
+    cached->nelts);
+  ck_assert_msg(strcmp(((char **) cached->elts)[0], "127.0.0.1") == 0,
+    "Expected '127.0.0.1', got '%s'", ((char **) cached->elts)[0]);
+
+  /* Re-adding the URI forgets the good address. */
+  res = proxy_forward_dstcache_set_good_addr(p, uri, "127.0.0.2");
+  ck_assert_msg(res == 0, "Failed to set good address: %s", strerror(errno));
+
+  res = proxy_forward_dstcache_add(p, uri, addrs, 60);
+  ck_assert_msg(res == 0, "Failed to add URI: %s", strerror(errno));
+
+  cached = proxy_forward_dstcache_get(p, uri);
+  ck_assert_msg(cached != NULL, "Failed to get cached URI: %s",
+    strerror(errno));
+  ck_assert_msg(strcmp(((char **) cached->elts)[0], "127.0.0.1") == 0,
+    "Expected '127.0.0.1', got '%s'", ((char **) cached->elts)[0]);
+}
+END_TEST
+
+Suite *tests_get_forward_dstcache_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("forward.dstcache");
+  testcase = tcase_create("base");
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, dstcache_init_test);
+  tcase_add_test(testcase, dstcache_add_test);
+  tcase_add_test(testcase, dstcache_add_negative_test);
+  tcase_add_test(testcase, dstcache_set_good_addr_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
@@ -0,0 +1,575 @@
+/*
+ * ProFTPD - mod_proxy testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* Forward destination filter API tests. */
+
+#include "../tests.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = permanent_pool = make_sub_pool(NULL);
+  }
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.forward.filter", 1, 20);
+  }
+}
+
+static void tear_down(void) {
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.forward.filter", 0, 0);
+  }
+
+  if (p != NULL) {
+    destroy_pool(p);
+    p = permanent_pool = NULL;
+  }
+}
+
+static struct proxy_forward_filter *create_filter(const char **rules) {
+  register unsigned int i;
+  struct proxy_forward_filter *filter;
+
+  filter = proxy_forward_filter_create(p);
+  ck_assert_msg(filter != NULL, "Failed to create filter: %s",
+    strerror(errno));
+
+  for (i = 0; rules[i] != NULL; i++) {
+    int res;
+
+    res = proxy_forward_filter_add_rule(filter, rules[i], 0);
+    ck_assert_msg(res == 0, "Failed to add rule '%s': %s", rules[i],
+      strerror(errno));
+  }
+
+  return filter;
+}
+
+static void assert_check(struct proxy_forward_filter *filter,
+    const char *hostport, const char *ipstr, int allowed) {
+  int res;
+  const pr_netaddr_t *addr = NULL;
+
+  if (ipstr != NULL) {
+    addr = pr_netaddr_get_addr(p, ipstr, NULL);
+    ck_assert_msg(addr != NULL, "Failed to get address for '%s': %s", ipstr,
+      strerror(errno));
+  }
+
+  res = proxy_forward_filter_check(filter, hostport, addr);
+  if (allowed == TRUE) {
+    ck_assert_msg(res == 0, "Expected '%s' (%s) to be allowed: %s", hostport,
+      ipstr ? ipstr : "none", strerror(errno));
+
+  } else {
+    ck_assert_msg(res < 0, "Expected '%s' (%s) to be rejected", hostport,
+      ipstr ? ipstr : "none");
+    ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+      strerror(errno), errno);
+  }
+}
+
+START_TEST (filter_create_test) {
+  struct proxy_forward_filter *filter;
+  int res;
+
+  mark_point();
+  filter = proxy_forward_filter_create(NULL);
+  ck_assert_msg(filter == NULL, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_forward_filter_free(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null filter");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_forward_filter_count(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null filter");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  filter = proxy_forward_filter_create(p);
+  ck_assert_msg(filter != NULL, "Failed to create filter: %s",
+    strerror(errno));
+
+  res = proxy_forward_filter_count(filter);
+  ck_assert_msg(res == 0, "Expected 0 rules, got %d", res);
+
+  mark_point();
+  res = proxy_forward_filter_check(filter, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null host/port");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* An empty filter allows everything. */
+  assert_check(filter, "ftp.example.com:21", NULL, TRUE);
+
+  res = proxy_forward_filter_free(filter);
+  ck_assert_msg(res == 0, "Failed to free filter: %s", strerror(errno));
+}
+END_TEST
+
+START_TEST (filter_add_rule_test) {
+  register unsigned int i;
+  struct proxy_forward_filter *filter;
+  int res;
+  const char *bad_rules[] = {
+    "",
+    "!",
+    "host:",
+    "host::21",
+    "host:ftp.example.com:",
+    "host:ftp.example.com:0",
+    "host:ftp.example.com:65536",
+    "host:ftp.example.com:21x",
+    "cidr:",
+    "cidr:10.0.0.0/",
+    "cidr:10.0.0.0/33",
+    "cidr:10.0.0.0/-1",
+    "cidr:10.0.0.300/8",
+    "cidr:ftp.example.com/8",
+#ifdef PR_USE_REGEX
+    "(",
+#endif /* PR_USE_REGEX */
+    NULL
+  };
+
+  filter = proxy_forward_filter_create(p);
+
+  mark_point();
+  res = proxy_forward_filter_add_rule(NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null filter");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_forward_filter_add_rule(filter, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null rule");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  for (i = 0; bad_rules[i] != NULL; i++) {
+    mark_point();
+    res = proxy_forward_filter_add_rule(filter, bad_rules[i], 0);
+    ck_assert_msg(res < 0, "Failed to reject bad rule '%s'", bad_rules[i]);
+    ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+      strerror(errno), errno);
+  }
+
+  res = proxy_forward_filter_count(filter);
+  ck_assert_msg(res == 0, "Expected 0 rules, got %d", res);
+
+  mark_point();
+  res = proxy_forward_filter_add_rule(filter, "host:ftp.example.com:21", 0);
+  ck_assert_msg(res == 0, "Failed to add host rule: %s", strerror(errno));
+
+  res = proxy_forward_filter_add_rule(filter, "!cidr:10.0.0.0/8", 0);
+  ck_assert_msg(res == 0, "Failed to add CIDR rule: %s", strerror(errno));
+
+  res = proxy_forward_filter_add_rule(filter, "cidr:0.0.0.0/0", 0);
+  ck_assert_msg(res == 0, "Failed to add CIDR rule: %s", strerror(errno));
+
+#if defined(PR_USE_IPV6)
+  res = proxy_forward_filter_add_rule(filter, "cidr:2001:db8::/32", 0);
+  ck_assert_msg(res == 0, "Failed to add CIDR rule: %s", strerror(errno));
+#endif /* PR_USE_IPV6 */
+
+  res = proxy_forward_filter_count(filter);
+#if defined(PR_USE_IPV6)
+  ck_assert_msg(res == 4, "Expected 4 rules, got %d", res);
+#else
+  ck_assert_msg(res == 3, "Expected 3 rules, got %d", res);
+#endif /* PR_USE_IPV6 */
+
+  proxy_forward_filter_free(filter);
+}
+END_TEST
+
+START_TEST (filter_check_host_test) {
+  struct proxy_forward_filter *filter;
+  const char *rules[] = {
+    "host:ftp.example.com:21",
+    "host:ftp.example.org",
+    "!host:ftp.example.org:2121",
+    NULL
+  };
+
+  filter = create_filter(rules);
+
+  assert_check(filter, "ftp.example.com:21", NULL, TRUE);
+  assert_check(filter, "FTP.Example.COM:21", NULL, TRUE);
+  assert_check(filter, "ftp.example.com:2121", NULL, FALSE);
+  assert_check(filter, "www.example.com:21", NULL, FALSE);
+  assert_check(filter, "ftp.example.org:21", NULL, TRUE);
+  assert_check(filter, "ftp.example.org:990", NULL, TRUE);
+  assert_check(filter, "ftp.example.org:2121", NULL, FALSE);
+
+  /* Check again, for the cached decisions. */
+  assert_check(filter, "ftp.example.com:21", NULL, TRUE);
+  assert_check(filter, "ftp.example.org:2121", NULL, FALSE);
+
+  proxy_forward_filter_free(filter);
+}
+END_TEST
+
+START_TEST (filter_check_cidr_test) {
+  struct proxy_forward_filter *filter;
+  const char *rules[] = {
+    "cidr:192.168.0.0/16",
+    "!cidr:192.168.1.0/24",
+    "cidr:127.0.0.1",
+#if defined(PR_USE_IPV6)
+    "cidr:2001:db8::/32",
+#endif /* PR_USE_IPV6 */
+    NULL
+  };
+
+  filter = create_filter(rules);
+
+  assert_check(filter, "ftp.example.com:21", "192.168.2.1", TRUE);
+  assert_check(filter, "ftp.example.com:21", "192.168.1.1", FALSE);
+  assert_check(filter, "ftp.example.com:21", "10.0.0.1", FALSE);
+  assert_check(filter, "ftp.example.com:21", "127.0.0.1", TRUE);
+  assert_check(filter, "ftp.example.com:21", "127.0.0.2", FALSE);
+
+  /* Without an address, CIDR rules cannot match. */
+  assert_check(filter, "ftp.example.com:21", NULL, FALSE);
+
+#if defined(PR_USE_IPV6)
+  assert_check(filter, "ftp.example.com:21", "2001:db8::1", TRUE);
+  assert_check(filter, "ftp.example.com:21", "2001:db9::1", FALSE);
+
+  /* IPv4-mapped IPv6 addresses use the IPv4 rules. */
+  assert_check(filter, "ftp.example.com:21", "::ffff:192.168.2.1", TRUE);
+  assert_check(filter, "ftp.example.com:21", "::ffff:192.168.1.1", FALSE);
+#endif /* PR_USE_IPV6 */
+
+  proxy_forward_filter_free(filter);
+}
+END_TEST
+
+START_TEST (filter_check_regex_test) {
+#ifdef PR_USE_REGEX
+  struct proxy_forward_filter *filter;
+  const char *allow_rules[] = { "^ftp\\.example\\.com:21$", NULL };
+  const char *deny_rules[] = { "!^ftp\\.example\\.com:", NULL };
+  const char *mixed_rules[] = {
+    "^ftp\\.example\\.",
+    "!:2121$",
+    "host:ftp.example.net",
+    NULL
+  };
+  int res;
+
+  filter = create_filter(allow_rules);
+  assert_check(filter, "ftp.example.com:21", NULL, TRUE);
+  assert_check(filter, "ftp.example.com:2121", NULL, FALSE);
+  proxy_forward_filter_free(filter);
+
+  filter = create_filter(deny_rules);
+  assert_check(filter, "ftp.example.com:21", NULL, FALSE);
+  assert_check(filter, "ftp.example.org:21", NULL, TRUE);
+  proxy_forward_filter_free(filter);
+
+  filter = create_filter(mixed_rules);
+  assert_check(filter, "ftp.example.com:21", NULL, TRUE);
+  assert_check(filter, "ftp.example.net:21", NULL, TRUE);
+  assert_check(filter, "ftp.example.net:2121", NULL, FALSE);
+  assert_check(filter, "www.example.com:21", NULL, FALSE);
+  proxy_forward_filter_free(filter);
+
+  /* Regex flags, e.g. case-insensitive matching. */
+  filter = proxy_forward_filter_create(p);
+  res = proxy_forward_filter_add_rule(filter, "^ftp\\.example\\.com:21$",
+    REG_ICASE);
+  ck_assert_msg(res == 0, "Failed to add rule: %s", strerror(errno));
+  assert_check(filter, "FTP.EXAMPLE.COM:21", NULL, TRUE);
+  proxy_forward_filter_free(filter);
+#endif /* PR_USE_REGEX */
+}
+END_TEST
+
+START_TEST (filter_check_name_test) {
+  int res;
+  struct proxy_forward_filter *filter;
+  const char *rules[] = {
+    "host:ftp.example.com",
+    "!host:bad.example.com",
+    "cidr:192.168.0.0/16",
+    NULL
+  };
+  const char *no_cidr_allow_rules[] = {
+    "host:ftp.example.com",
+    "!cidr:10.0.0.0/8",
+    NULL
+  };
+
+  res = proxy_forward_filter_check_name(NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null filter");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  filter = create_filter(rules);
+
+  res = proxy_forward_filter_check_name(filter, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null host/port");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_forward_filter_check_name(filter, "ftp.example.com:21");
+  ck_assert_msg(res == 0, "Expected name to be allowed: %s", strerror(errno));
+
+  res = proxy_forward_filter_check_name(filter, "bad.example.com:21");
+  ck_assert_msg(res < 0, "Expected name to be rejected");
+  ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  /* An address may yet match the CIDR rule. */
+  res = proxy_forward_filter_check_name(filter, "www.example.com:21");
+  ck_assert_msg(res == 0, "Expected name to be allowed: %s", strerror(errno));
+
+  /* Check again, for the cached decisions. */
+  res = proxy_forward_filter_check_name(filter, "bad.example.com:21");
+  ck_assert_msg(res < 0, "Expected name to be rejected");
+
+  res = proxy_forward_filter_check_name(filter, "www.example.com:21");
+  ck_assert_msg(res == 0, "Expected name to be allowed: %s", strerror(errno));
+
+  proxy_forward_filter_free(filter);
+
+  /* Without any allowing CIDR rules, the name alone decides. */
+  filter = create_filter(no_cidr_allow_rules);
+
+  res = proxy_forward_filter_check_name(filter, "www.example.com:21");
+  ck_assert_msg(res < 0, "Expected name to be rejected");
+  ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  proxy_forward_filter_free(filter);
+}
+END_TEST
+
+static array_header *get_other_addrs(const char *ipstr) {
+  array_header *other_addrs;
+
+  other_addrs = make_array(p, 1, sizeof(pr_netaddr_t *));
+  *((const pr_netaddr_t **) push_array(other_addrs)) =
+    pr_netaddr_get_addr(p, ipstr, NULL);
+
+  return other_addrs;
+}
+
+START_TEST (filter_check_addrs_test) {
+  int res;
+  struct proxy_forward_filter *filter;
+  const pr_netaddr_t *allowed_addr, *denied_addr, *other_addr;
+  const char *rules[] = {
+    "host:ftp.example.com",
+    "cidr:192.168.0.0/16",
+    "!cidr:192.168.1.0/24",
+    NULL
+  };
+  const char *no_cidr_rules[] = { "host:ftp.example.com", NULL };
+
+  res = proxy_forward_filter_check_addrs(NULL, NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null filter");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  allowed_addr = pr_netaddr_get_addr(p, "192.168.2.1", NULL);
+  denied_addr = pr_netaddr_get_addr(p, "192.168.1.1", NULL);
+  other_addr = pr_netaddr_get_addr(p, "10.0.0.1", NULL);
+  ck_assert_msg(allowed_addr != NULL && denied_addr != NULL &&
+    other_addr != NULL, "Failed to get addresses: %s", strerror(errno));
+
+  filter = create_filter(rules);
+
+  res = proxy_forward_filter_check_addrs(filter, "www.example.com:21", NULL,
+    NULL);
+  ck_assert_msg(res < 0, "Failed to handle null address");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_forward_filter_check_addrs(filter, "www.example.com:21",
+    allowed_addr, NULL);
+  ck_assert_msg(res == 0, "Expected address to be allowed: %s",
+    strerror(errno));
+
+  res = proxy_forward_filter_check_addrs(filter, "www.example.com:21",
+    other_addr, NULL);
+  ck_assert_msg(res < 0, "Expected address to be rejected");
+  ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  /* One allowed address suffices, whichever it is. */
+  mark_point();
+  res = proxy_forward_filter_check_addrs(filter, "www.example.com:21",
+    other_addr, get_other_addrs("192.168.2.1"));
+  ck_assert_msg(res == 0, "Expected addresses to be allowed: %s",
+    strerror(errno));
+
+  res = proxy_forward_filter_check_addrs(filter, "www.example.com:21",
+    allowed_addr, get_other_addrs("10.0.0.1"));
+  ck_assert_msg(res == 0, "Expected addresses to be allowed: %s",
+    strerror(errno));
+
+  /* But any denied address rejects the destination. */
+  mark_point();
+  res = proxy_forward_filter_check_addrs(filter, "www.example.com:21",
+    allowed_addr, get_other_addrs("192.168.1.1"));
+  ck_assert_msg(res < 0, "Expected addresses to be rejected");
+  ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  res = proxy_forward_filter_check_addrs(filter, "ftp.example.com:21",
+    denied_addr, NULL);
+  ck_assert_msg(res < 0, "Expected address to be rejected");
+
+  /* An allowed name needs no allowed address. */
+  mark_point();
+  res = proxy_forward_filter_check_addrs(filter, "ftp.example.com:21",
+    other_addr, NULL);
+  ck_assert_msg(res == 0, "Expected address to be allowed: %s",
+    strerror(errno));
+
+  proxy_forward_filter_free(filter);
+
+  /* Without CIDR rules, there is nothing left to check. */
+  filter = create_filter(no_cidr_rules);
+
+  res = proxy_forward_filter_check_addrs(filter, "www.example.com:21",
+    other_addr, NULL);
+  ck_assert_msg(res == 0, "Expected address to be allowed: %s",
+    strerror(errno));
+
+  proxy_forward_filter_free(filter);
+}
+END_TEST
+
+/* Compares the filter against matching a single regex, as ProxyForwardTo
+ * previously did, for the same destinations.  Set TEST_VERBOSE to see the
+ * timings.
+ */
+START_TEST (filter_check_benchmark_test) {
+#ifdef PR_USE_REGEX
+  register unsigned int i;
+  struct proxy_forward_filter *filter;
+  pr_regex_t *pre;
+  const char *regex_rules[] = {
+    "^(ftp1|ftp2|ftp3|ftp4)\\.example\\.com:21$", NULL
+  };
+  const char *host_rules[] = {
+    "host:ftp1.example.com:21",
+    "host:ftp2.example.com:21",
+    "host:ftp3.example.com:21",
+    "host:ftp4.example.com:21",
+    NULL
+  };
+  const char *dsts[] = {
+    "ftp1.example.com:21",
+    "ftp3.example.com:21",
+    "ftp5.example.com:21",
+    "ftp2.example.com:2121",
+    NULL
+  };
+  unsigned int count = 20000;
+  struct timeval start_tv, end_tv;
+  long regex_usecs, filter_usecs, host_usecs;
+  int res;
+
+  pre = pr_regexp_alloc(NULL);
+  res = pr_regexp_compile(pre, regex_rules[0], REG_EXTENDED|REG_NOSUB);
+  ck_assert_msg(res == 0, "Failed to compile regex");
+
+  gettimeofday(&start_tv, NULL);
+  for (i = 0; i < count; i++) {
+    res = pr_regexp_exec(pre, dsts[i % 4], 0, NULL, 0, 0, 0);
+    ck_assert_msg((res == 0) == ((i % 4) < 2), "Unexpected regex result %d for "
+      "'%s'", res, dsts[i % 4]);
+  }
+  gettimeofday(&end_tv, NULL);
+  regex_usecs = ((end_tv.tv_sec - start_tv.tv_sec) * 1000000L) +
+    (end_tv.tv_usec - start_tv.tv_usec);
+  pr_regexp_free(NULL, pre);
+
+  filter = create_filter(regex_rules);
+  gettimeofday(&start_tv, NULL);
+  for (i = 0; i < count; i++) {
+    res = proxy_forward_filter_check(filter, dsts[i % 4], NULL);
+    ck_assert_msg((res == 0) == ((i % 4) < 2), "Unexpected filter result %d "
+      "for '%s'", res, dsts[i % 4]);
+  }
+  gettimeofday(&end_tv, NULL);
+  filter_usecs = ((end_tv.tv_sec - start_tv.tv_sec) * 1000000L) +
+    (end_tv.tv_usec - start_tv.tv_usec);
+  proxy_forward_filter_free(filter);
+
+  filter = create_filter(host_rules);
+  gettimeofday(&start_tv, NULL);
+  for (i = 0; i < count; i++) {
+    res = proxy_forward_filter_check(filter, dsts[i % 4], NULL);
+    ck_assert_msg((res == 0) == ((i % 4) < 2), "Unexpected filter result %d "
+      "for '%s'", res, dsts[i % 4]);
+  }
+  gettimeofday(&end_tv, NULL);
+  host_usecs = ((end_tv.tv_sec - start_tv.tv_sec) * 1000000L) +
+    (end_tv.tv_usec - start_tv.tv_usec);
+  proxy_forward_filter_free(filter);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stderr, "ProxyForwardTo checks (%u): single regex %ld usecs, "
+      "filter (regex) %ld usecs, filter (hosts) %ld usecs\n", count,
+      regex_usecs, filter_usecs, host_usecs);
+  }
+#endif /* PR_USE_REGEX */
+}
+END_TEST
+
+Suite *tests_get_forward_filter_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("forward.filter");
+  testcase = tcase_create("base");
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, filter_create_test);
+  tcase_add_test(testcase, filter_add_rule_test);
+  tcase_add_test(testcase, filter_check_host_test);
+  tcase_add_test(testcase, filter_check_cidr_test);
+  tcase_add_test(testcase, filter_check_regex_test);
+  tcase_add_test(testcase, filter_check_name_test);
+  tcase_add_test(testcase, filter_check_addrs_test);
+  tcase_add_test(testcase, filter_check_benchmark_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
@@ -0,0 +1,206 @@
+/*
+ * ProFTPD - mod_proxy testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* FTP ASCII translation API tests. */
+
+#include "../tests.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = permanent_pool = make_sub_pool(NULL);
+  }
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.ftp.ascii", 1, 20);
+  }
+}
+
+static void tear_down(void) {
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.ftp.ascii", 0, 0);
+  }
+
+  if (p != NULL) {
+    destroy_pool(p);
+    p = permanent_pool = NULL;
+  }
+}
+
+/* Translates the given text in two pieces, split at every possible offset,
+ * and checks that the result is always the same.
+ */
+static void assert_translate(int direction, const char *text,
+    const char *expected) {
+  size_t i, textlen;
+
+  textlen = strlen(text);
+
+  for (i = 0; i <= textlen; i++) {
+    struct proxy_ftp_ascii *xlate;
+    char *out, *res;
+    size_t outlen = 0;
+    int rc;
+
+    xlate = proxy_ftp_ascii_alloc(p, direction);
+    ck_assert_msg(xlate != NULL, "Failed to allocate context: %s",
+      strerror(errno));
+
+    rc = proxy_ftp_ascii_translate(xlate, text, i, &out, &outlen);
+    ck_assert_msg(rc == 0, "Failed to translate text: %s", strerror(errno));
+    res = pstrndup(p, out, outlen);
+
+    rc = proxy_ftp_ascii_translate(xlate, text + i, textlen - i, &out,
+      &outlen);
+    ck_assert_msg(rc == 0, "Failed to translate text: %s", strerror(errno));
+    res = pstrcat(p, res, pstrndup(p, out, outlen), NULL);
+
+    rc = proxy_ftp_ascii_finish(xlate, &out, &outlen);
+    ck_assert_msg(rc == 0, "Failed to finish translation: %s",
+      strerror(errno));
+    res = pstrcat(p, res, pstrndup(p, out, outlen), NULL);
+
+    ck_assert_msg(strcmp(res, expected) == 0,
+      "Expected '%s', got '%s' (split at %lu)", expected, res,
+      (unsigned long) i);
+  }
+}
+
+START_TEST (alloc_test) {
+  struct proxy_ftp_ascii *xlate;
+
+  mark_point();
+  xlate = proxy_ftp_ascii_alloc(NULL, 0);
+  ck_assert_msg(xlate == NULL, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  xlate = proxy_ftp_ascii_alloc(p, 0);
+  ck_assert_msg(xlate == NULL, "Failed to handle invalid direction");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  xlate = proxy_ftp_ascii_alloc(p, PROXY_FTP_ASCII_TO_CRLF);
+  ck_assert_msg(xlate != NULL, "Failed to allocate context: %s",
+    strerror(errno));
+}
+END_TEST
+
+START_TEST (translate_test) {
+  int res;
+  struct proxy_ftp_ascii *xlate;
+  char *out = NULL;
+  size_t outlen = 0;
+
+  mark_point();
+  res = proxy_ftp_ascii_translate(NULL, NULL, 0, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null context");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  xlate = proxy_ftp_ascii_alloc(p, PROXY_FTP_ASCII_TO_CRLF);
+
+  mark_point();
+  res = proxy_ftp_ascii_translate(xlate, NULL, 0, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null input");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_ascii_translate(xlate, "foo", 3, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null output");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_ascii_translate(xlate, "foo", 0, &out, &outlen);
+  ck_assert_msg(res == 0, "Failed to handle empty input: %s", strerror(errno));
+  ck_assert_msg(outlen == 0, "Expected 0, got %lu", (unsigned long) outlen);
+
+  mark_point();
+  assert_translate(PROXY_FTP_ASCII_TO_CRLF, "foo", "foo");
+  assert_translate(PROXY_FTP_ASCII_TO_CRLF, "a\nb\r\nc\n\n",
+    "a\r\nb\r\nc\r\n\r\n");
+  assert_translate(PROXY_FTP_ASCII_TO_CRLF, "\r\r\n\n", "\r\r\n\r\n");
+
+  mark_point();
+  assert_translate(PROXY_FTP_ASCII_FROM_CRLF, "foo\n", "foo\n");
+  assert_translate(PROXY_FTP_ASCII_FROM_CRLF, "a\r\nb\r\n\r\nc\r",
+    "a\nb\n\nc\r");
+  assert_translate(PROXY_FTP_ASCII_FROM_CRLF, "\r\r\n\rx\r\r", "\r\n\rx\r\r");
+}
+END_TEST
+
+START_TEST (finish_test) {
+  int res;
+  struct proxy_ftp_ascii *xlate;
+  char *out = NULL;
+  size_t outlen = 0;
+
+  mark_point();
+  res = proxy_ftp_ascii_finish(NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null context");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  xlate = proxy_ftp_ascii_alloc(p, PROXY_FTP_ASCII_FROM_CRLF);
+
+  mark_point();
+  res = proxy_ftp_ascii_finish(xlate, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null output");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_ascii_translate(xlate, "foo\r", 4, &out, &outlen);
+  ck_assert_msg(res == 0, "Failed to translate text: %s", strerror(errno));
+  ck_assert_msg(outlen == 3, "Expected 3, got %lu", (unsigned long) outlen);
+
+  mark_point();
+  res = proxy_ftp_ascii_finish(xlate, &out, &outlen);
+  ck_assert_msg(res == 0, "Failed to finish translation: %s", strerror(errno));
+  ck_assert_msg(outlen == 1, "Expected 1, got %lu", (unsigned long) outlen);
+  ck_assert_msg(out[0] == '\r', "Expected CR, got %c", out[0]);
+}
+END_TEST
+
+Suite *tests_get_ftp_ascii_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("ftp.ascii");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, alloc_test);
+  tcase_add_test(testcase, translate_test);
+  tcase_add_test(testcase, finish_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
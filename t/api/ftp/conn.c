@@ -256,6 +256,108 @@ START_TEST (listen_test) {
 }
 END_TEST
 
+START_TEST (listen_portrange_test) {
+  conn_t *conn, *busy_conn;
+  const pr_netaddr_t *bind_addr = NULL;
+  config_rec *c;
+  int port;
+
+  bind_addr = pr_netaddr_get_addr(p, "127.0.0.1", NULL);
+  ck_assert_msg(bind_addr != NULL, "Failed to address for 127.0.0.1: %s",
+    strerror(errno));
+  pr_netaddr_set_port((pr_netaddr_t *) bind_addr, htons(0));
+
+  /* Find a free port, and make it the only one in the PassivePorts range. */
+  mark_point();
+  conn = proxy_ftp_conn_listen(p, bind_addr, TRUE);
+  ck_assert_msg(conn != NULL, "Failed to listen: %s", strerror(errno));
+  port = conn->local_port;
+  pr_inet_close(p, conn);
+
+  c = add_config_param_set(&(main_server->conf), "PassivePorts", 2, NULL,
+    NULL);
+  c->argv[0] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[0]) = port;
+  c->argv[1] = palloc(c->pool, sizeof(int));
+  *((int *) c->argv[1]) = port;
+
+  mark_point();
+  conn = proxy_ftp_conn_listen(p, bind_addr, TRUE);
+  ck_assert_msg(conn != NULL, "Failed to listen: %s", strerror(errno));
+  ck_assert_msg(conn->local_port == port, "Expected port %d, got %d", port,
+    conn->local_port);
+
+  /* With every port in the range busy, any port is used instead. */
+  busy_conn = conn;
+
+  mark_point();
+  conn = proxy_ftp_conn_listen(p, bind_addr, TRUE);
+  ck_assert_msg(conn != NULL, "Failed to listen: %s", strerror(errno));
+  ck_assert_msg(conn->local_port != port, "Expected port other than %d", port);
+
+  pr_inet_close(p, conn);
+  pr_inet_close(p, busy_conn);
+}
+END_TEST
+
+START_TEST (listen_pool_test) {
+  int res;
+  conn_t *conn;
+  const pr_netaddr_t *bind_addr = NULL;
+  int port;
+
+  res = proxy_ftp_conn_listen_pool_init(NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ftp_conn_listen_pool_init(p, 0);
+  ck_assert_msg(res < 0, "Failed to handle zero size");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ftp_conn_listen_close(NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ftp_conn_listen_close(p, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null conn");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_conn_listen_pool_init(p, 1);
+  ck_assert_msg(res == 0, "Failed to init listen pool: %s", strerror(errno));
+
+  bind_addr = pr_netaddr_get_addr(p, "127.0.0.1", NULL);
+  ck_assert_msg(bind_addr != NULL, "Failed to address for 127.0.0.1: %s",
+    strerror(errno));
+  pr_netaddr_set_port((pr_netaddr_t *) bind_addr, htons(0));
+
+  mark_point();
+  conn = proxy_ftp_conn_listen(p, bind_addr, FALSE);
+  ck_assert_msg(conn != NULL, "Failed to listen: %s", strerror(errno));
+  port = conn->local_port;
+
+  res = proxy_ftp_conn_listen_close(p, conn);
+  ck_assert_msg(res == 0, "Failed to close listen conn: %s", strerror(errno));
+
+  /* With a full pool, the next listen reuses the pooled socket. */
+  mark_point();
+  conn = proxy_ftp_conn_listen(p, bind_addr, FALSE);
+  ck_assert_msg(conn != NULL, "Failed to listen: %s", strerror(errno));
+  ck_assert_msg(conn->local_port == port, "Expected port %d, got %d", port,
+    conn->local_port);
+
+  res = proxy_ftp_conn_listen_close(p, conn);
+  ck_assert_msg(res == 0, "Failed to close listen conn: %s", strerror(errno));
+
+  res = proxy_ftp_conn_listen_pool_free();
+  ck_assert_msg(res == 0, "Failed to free listen pool: %s", strerror(errno));
+}
+END_TEST
+
 Suite *tests_get_ftp_conn_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -268,6 +370,8 @@ Suite *tests_get_ftp_conn_suite(void) {
   tcase_add_test(testcase, accept_test);
   tcase_add_test(testcase, connect_test);
   tcase_add_test(testcase, listen_test);
+  tcase_add_test(testcase, listen_portrange_test);
+  tcase_add_test(testcase, listen_pool_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
@@ -165,6 +165,423 @@ START_TEST (send_test) {
 }
 END_TEST
 
+START_TEST (timers_test) {
+  int res;
+  unsigned long nresets = 0, ndeferred = 0;
+
+  mark_point();
+  res = proxy_ftp_data_timers_start(-1);
+  ck_assert_msg(res < 0, "Failed to handle negative tick");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_data_timers_touch(0);
+  ck_assert_msg(res < 0, "Failed to handle empty timers");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_data_timers_get_stats(NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null stats");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Without a tick, every touch resets the timers. */
+  res = proxy_ftp_data_timers_start(0);
+  ck_assert_msg(res == 0, "Expected tick 0, got %d", res);
+
+  res = proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_ALL);
+  ck_assert_msg(res == 3, "Expected 3 resets, got %d", res);
+
+  res = proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_IDLE);
+  ck_assert_msg(res == 1, "Expected 1 reset, got %d", res);
+
+  res = proxy_ftp_data_timers_get_delay();
+  ck_assert_msg(res == -1, "Expected no pending resets, got delay %d", res);
+
+  res = proxy_ftp_data_timers_get_stats(&nresets, &ndeferred);
+  ck_assert_msg(res == 0, "Failed to get stats: %s", strerror(errno));
+  ck_assert_msg(nresets == 4, "Expected 4 resets, got %lu", nresets);
+  ck_assert_msg(ndeferred == 0, "Expected 0 deferred, got %lu", ndeferred);
+
+  res = proxy_ftp_data_timers_stop();
+  ck_assert_msg(res == 0, "Expected no pending resets, got %d", res);
+}
+END_TEST
+
+START_TEST (timers_tick_test) {
+  int res;
+  unsigned long nresets = 0, ndeferred = 0;
+
+  res = proxy_ftp_data_timers_start(60);
+  ck_assert_msg(res == 60, "Expected tick 60, got %d", res);
+
+  /* The first touch is applied immediately; later touches are deferred. */
+  res = proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_ALL);
+  ck_assert_msg(res == 3, "Expected 3 resets, got %d", res);
+
+  res = proxy_ftp_data_timers_get_delay();
+  ck_assert_msg(res == -1, "Expected no pending resets, got delay %d", res);
+
+  res = proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_IDLE);
+  ck_assert_msg(res == 0, "Expected deferred reset, got %d", res);
+
+  res = proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_STALLED);
+  ck_assert_msg(res == 0, "Expected deferred reset, got %d", res);
+
+  res = proxy_ftp_data_timers_get_delay();
+  ck_assert_msg(res > 0 && res <= 60, "Expected delay of 1-60, got %d", res);
+
+  res = proxy_ftp_data_timers_get_stats(&nresets, &ndeferred);
+  ck_assert_msg(res == 0, "Failed to get stats: %s", strerror(errno));
+  ck_assert_msg(nresets == 3, "Expected 3 resets, got %lu", nresets);
+  ck_assert_msg(ndeferred == 2, "Expected 2 deferred, got %lu", ndeferred);
+
+  /* Stopping applies the pending resets. */
+  res = proxy_ftp_data_timers_stop();
+  ck_assert_msg(res == 2, "Expected 2 resets, got %d", res);
+
+  res = proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_IDLE);
+  ck_assert_msg(res == 1, "Expected 1 reset, got %d", res);
+
+  /* The tick stays below the smallest configured timeout. */
+  pr_data_set_timeout(PR_DATA_TIMEOUT_STALLED, 5);
+  res = proxy_ftp_data_timers_start(60);
+  ck_assert_msg(res == 4, "Expected tick 4, got %d", res);
+
+  pr_data_set_timeout(PR_DATA_TIMEOUT_STALLED, 1);
+  res = proxy_ftp_data_timers_start(60);
+  ck_assert_msg(res == 0, "Expected tick 0, got %d", res);
+
+  pr_data_set_timeout(PR_DATA_TIMEOUT_STALLED, PR_TUNABLE_TIMEOUTSTALLED);
+  (void) proxy_ftp_data_timers_stop();
+}
+END_TEST
+
+START_TEST (timers_benchmark_test) {
+  register unsigned int i, j;
+  size_t bufsz[2] = { 4096, 262144 };
+  int ticks[2] = { 0, 1 };
+  off_t total = 1024 * 1024 * 1024;
+
+  /* Simulate the timer bookkeeping of relaying 1 GB, for small and large
+   * buffer sizes, with and without the coarse tick.  Each timer reset costs
+   * a few syscalls, so the reset count is our syscall proxy.
+   */
+  for (i = 0; i < 2; i++) {
+    for (j = 0; j < 2; j++) {
+      unsigned long count, k, nresets = 0, ndeferred = 0;
+      struct rusage start, end;
+      long usecs;
+
+      count = (unsigned long) (total / bufsz[i]);
+
+      getrusage(RUSAGE_SELF, &start);
+      (void) proxy_ftp_data_timers_start(ticks[j]);
+
+      for (k = 0; k < count; k++) {
+        /* Matches the relay loop: readable, recv, buffer, send. */
+        (void) proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_IDLE);
+        (void) proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_ALL);
+        (void) proxy_ftp_data_timers_touch(
+          PROXY_FTP_DATA_TIMER_NOXFER|PROXY_FTP_DATA_TIMER_STALLED);
+        (void) proxy_ftp_data_timers_touch(PROXY_FTP_DATA_TIMER_ALL);
+      }
+
+      (void) proxy_ftp_data_timers_get_stats(&nresets, &ndeferred);
+      (void) proxy_ftp_data_timers_stop();
+      getrusage(RUSAGE_SELF, &end);
+
+      usecs = ((end.ru_utime.tv_sec - start.ru_utime.tv_sec) * 1000000L) +
+        (end.ru_utime.tv_usec - start.ru_utime.tv_usec) +
+        ((end.ru_stime.tv_sec - start.ru_stime.tv_sec) * 1000000L) +
+        (end.ru_stime.tv_usec - start.ru_stime.tv_usec);
+
+      if (ticks[j] > 0) {
+        ck_assert_msg(nresets < count,
+          "Expected fewer than %lu resets with tick, got %lu", count, nresets);
+      }
+
+      if (getenv("TEST_VERBOSE") != NULL) {
+        fprintf(stdout, "ftp.data timers: %lu-byte buffers, tick %d: "
+          "%lu resets, %lu deferred, %ld CPU usecs per GB\n",
+          (unsigned long) bufsz[i], ticks[j], nresets, ndeferred, usecs);
+      }
+    }
+  }
+}
+END_TEST
+
+START_TEST (bulk_test) {
+  int res;
+  unsigned long nbatches = 0, nbuffers = 0;
+
+  mark_point();
+  res = proxy_ftp_data_bulk_start(-1, 0);
+  ck_assert_msg(res < 0, "Failed to handle negative max bytes");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_data_bulk_get_stats(NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null stats");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Without bulk transfers, every buffer ends the batch. */
+  res = proxy_ftp_data_bulk_start(0, 0);
+  ck_assert_msg(res == 0, "Failed to start bulk transfer: %s",
+    strerror(errno));
+
+  res = proxy_ftp_data_bulk_next(1024);
+  ck_assert_msg(res == FALSE, "Expected batch to end, got %d", res);
+
+  (void) proxy_ftp_data_bulk_stop();
+
+  /* A batch continues until its byte budget is used up. */
+  res = proxy_ftp_data_bulk_start(4096, 60000);
+  ck_assert_msg(res == 0, "Failed to start bulk transfer: %s",
+    strerror(errno));
+
+  res = proxy_ftp_data_bulk_next(1024);
+  ck_assert_msg(res == TRUE, "Expected batch to continue, got %d", res);
+
+  res = proxy_ftp_data_bulk_next(1024);
+  ck_assert_msg(res == TRUE, "Expected batch to continue, got %d", res);
+
+  res = proxy_ftp_data_bulk_next(1024);
+  ck_assert_msg(res == TRUE, "Expected batch to continue, got %d", res);
+
+  res = proxy_ftp_data_bulk_next(1024);
+  ck_assert_msg(res == FALSE, "Expected batch to end, got %d", res);
+
+  /* The next buffer starts a new batch, as does ending one early. */
+  res = proxy_ftp_data_bulk_next(1024);
+  ck_assert_msg(res == TRUE, "Expected batch to continue, got %d", res);
+
+  res = proxy_ftp_data_bulk_end();
+  ck_assert_msg(res == 0, "Failed to end batch: %s", strerror(errno));
+
+  res = proxy_ftp_data_bulk_next(1024);
+  ck_assert_msg(res == TRUE, "Expected batch to continue, got %d", res);
+
+  res = proxy_ftp_data_bulk_get_stats(&nbatches, &nbuffers);
+  ck_assert_msg(res == 0, "Failed to get stats: %s", strerror(errno));
+  ck_assert_msg(nbatches == 3, "Expected 3 batches, got %lu", nbatches);
+  ck_assert_msg(nbuffers == 6, "Expected 6 buffers, got %lu", nbuffers);
+
+  /* As well as until its time budget is used up. */
+  res = proxy_ftp_data_bulk_start(1024 * 1024, 50);
+  ck_assert_msg(res == 0, "Failed to start bulk transfer: %s",
+    strerror(errno));
+
+  res = proxy_ftp_data_bulk_next(1024);
+  ck_assert_msg(res == TRUE, "Expected batch to continue, got %d", res);
+
+  usleep(60 * 1000);
+  res = proxy_ftp_data_bulk_next(1024);
+  ck_assert_msg(res == FALSE, "Expected batch to end, got %d", res);
+
+  res = proxy_ftp_data_bulk_stop();
+  ck_assert_msg(res == 0, "Failed to stop bulk transfer: %s",
+    strerror(errno));
+}
+END_TEST
+
+/* Relays the given number of bytes from a producer process to a consumer
+ * process, the way the data transfer loop does: wait for the source data
+ * connection (and, between batches, the control connection) to be readable,
+ * then read a buffer and send it on.  Returns the number of bytes relayed,
+ * and the number of times the control connection was polled.
+ */
+static off_t bulk_relay(off_t total, off_t max_bytes,
+    unsigned long *nctrl_polls) {
+  int src_fds[2], dst_fds[2], ctrl_fds[2], in_batch = FALSE;
+  pid_t producer, consumer;
+  conn_t *src_conn, *dst_conn;
+  off_t nrelayed = 0;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, src_fds) < 0 ||
+      socketpair(AF_UNIX, SOCK_STREAM, 0, dst_fds) < 0 ||
+      socketpair(AF_UNIX, SOCK_STREAM, 0, ctrl_fds) < 0) {
+    return -1;
+  }
+
+  producer = fork();
+  if (producer == 0) {
+    char buf[65536];
+    off_t nwritten = 0;
+
+    (void) close(src_fds[0]);
+    (void) close(dst_fds[0]);
+    (void) close(dst_fds[1]);
+
+    memset(buf, 'A', sizeof(buf));
+    while (nwritten < total) {
+      ssize_t len;
+
+      len = write(src_fds[1], buf, total - nwritten < (off_t) sizeof(buf) ?
+        (size_t) (total - nwritten) : sizeof(buf));
+      if (len < 0) {
+        _exit(1);
+      }
+
+      nwritten += len;
+    }
+
+    _exit(0);
+  }
+
+  consumer = fork();
+  if (consumer == 0) {
+    char buf[65536];
+
+    /* Only the relay may hold the source connection open. */
+    (void) close(src_fds[0]);
+    (void) close(src_fds[1]);
+    (void) close(dst_fds[1]);
+
+    while (read(dst_fds[0], buf, sizeof(buf)) > 0) {
+    }
+
+    _exit(0);
+  }
+
+  (void) close(src_fds[1]);
+  (void) close(dst_fds[0]);
+
+  src_conn = pcalloc(p, sizeof(conn_t));
+  src_conn->instrm = pr_netio_open(p, PR_NETIO_STRM_DATA, src_fds[0],
+    PR_NETIO_IO_RD);
+
+  dst_conn = pcalloc(p, sizeof(conn_t));
+  dst_conn->outstrm = pr_netio_open(p, PR_NETIO_STRM_DATA, dst_fds[1],
+    PR_NETIO_IO_WR);
+
+  *nctrl_polls = 0;
+  (void) proxy_ftp_data_bulk_start(max_bytes, 0);
+
+  while (TRUE) {
+    fd_set rfds;
+    struct timeval tv;
+    int maxfd, res;
+    pr_buffer_t *pbuf;
+    size_t nread;
+
+    FD_ZERO(&rfds);
+    FD_SET(src_fds[0], &rfds);
+    maxfd = src_fds[0];
+
+    tv.tv_sec = in_batch ? 0 : 15;
+    tv.tv_usec = 0;
+
+    if (in_batch == FALSE) {
+      FD_SET(ctrl_fds[0], &rfds);
+      if (ctrl_fds[0] > maxfd) {
+        maxfd = ctrl_fds[0];
+      }
+
+      (*nctrl_polls)++;
+    }
+
+    res = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+    if (res == 0 &&
+        in_batch == TRUE) {
+      (void) proxy_ftp_data_bulk_end();
+      in_batch = FALSE;
+      continue;
+    }
+
+    in_batch = FALSE;
+    if (res <= 0 ||
+        !FD_ISSET(src_fds[0], &rfds)) {
+      break;
+    }
+
+    pbuf = proxy_ftp_data_recv(p, src_conn, TRUE);
+    if (pbuf == NULL) {
+      break;
+    }
+
+    nread = pbuf->current - pbuf->buf;
+    if (nread == 0) {
+      break;
+    }
+
+    if (proxy_ftp_data_send(p, dst_conn, pbuf, TRUE) != (int) nread) {
+      break;
+    }
+
+    nrelayed += nread;
+    in_batch = proxy_ftp_data_bulk_next(nread);
+  }
+
+  (void) proxy_ftp_data_bulk_stop();
+
+  pr_netio_close(src_conn->instrm);
+  pr_netio_close(dst_conn->outstrm);
+  (void) close(ctrl_fds[0]);
+  (void) close(ctrl_fds[1]);
+
+  (void) waitpid(producer, NULL, 0);
+  (void) waitpid(consumer, NULL, 0);
+
+  return nrelayed;
+}
+
+START_TEST (bulk_benchmark_test) {
+  register unsigned int i, j;
+  off_t sizes[3] = { 1024 * 1024, 10 * 1024 * 1024, 100 * 1024 * 1024 };
+  off_t max_bytes[2] = { 0, PROXY_FTP_DATA_BULK_DEFAULT_MAX_BYTES };
+
+  /* Measure the relay throughput for 1, 10, and 100 MB files, with the
+   * control connection polled for every buffer, and in bulk batches.
+   */
+  for (i = 0; i < 3; i++) {
+    unsigned long polled_nctrl_polls = 0;
+
+    for (j = 0; j < 2; j++) {
+      unsigned long nctrl_polls = 0;
+      struct timeval start, end;
+      off_t nrelayed;
+      long usecs;
+
+      gettimeofday(&start, NULL);
+      nrelayed = bulk_relay(sizes[i], max_bytes[j], &nctrl_polls);
+      gettimeofday(&end, NULL);
+
+      ck_assert_msg(nrelayed == sizes[i],
+        "Expected to relay %" PR_LU " bytes, relayed %" PR_LU,
+        (pr_off_t) sizes[i], (pr_off_t) nrelayed);
+
+      if (max_bytes[j] > 0) {
+        ck_assert_msg(nctrl_polls <= polled_nctrl_polls,
+          "Expected at most %lu control polls in bulk batches, got %lu",
+          polled_nctrl_polls, nctrl_polls);
+
+      } else {
+        polled_nctrl_polls = nctrl_polls;
+      }
+
+      usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+        (end.tv_usec - start.tv_usec);
+      if (usecs <= 0) {
+        usecs = 1;
+      }
+
+      if (getenv("TEST_VERBOSE") != NULL) {
+        fprintf(stdout, "ftp.data bulk: %" PR_LU " MB, %s: %.1f MB/s, "
+          "%lu control polls\n", (pr_off_t) (sizes[i] / (1024 * 1024)),
+          max_bytes[j] > 0 ? "bulk batches" : "per-buffer polling",
+          ((double) sizes[i] / (1024 * 1024)) / ((double) usecs / 1000000),
+          nctrl_polls);
+      }
+    }
+  }
+}
+END_TEST
+
 Suite *tests_get_ftp_data_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -176,6 +593,11 @@ Suite *tests_get_ftp_data_suite(void) {
 
   tcase_add_test(testcase, recv_test);
   tcase_add_test(testcase, send_test);
+  tcase_add_test(testcase, timers_test);
+  tcase_add_test(testcase, timers_tick_test);
+  tcase_add_test(testcase, timers_benchmark_test);
+  tcase_add_test(testcase, bulk_test);
+  tcase_add_test(testcase, bulk_benchmark_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
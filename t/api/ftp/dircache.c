@@ -0,0 +1,369 @@
+/*
+ * ProFTPD - mod_proxy testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* FTP Directory Cache API tests. */
+
+#include "../tests.h"
+
+static pool *p = NULL;
+
+static const char *mlsd_text =
+  "type=cdir;modify=20200101000000;perm=flcdmpe; .\r\n"
+  "type=pdir;modify=20200101000000;perm=flcdmpe; ..\r\n"
+  "type=file;size=1234;modify=20200102030405.123;perm=adfrw; foo.txt\r\n"
+  "type=dir;modify=20200103000000;perm=flcdmpe; bar\r\n"
+  "Type=file;Size=42;Modify=20200104000000; with space.txt\r\n";
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = permanent_pool = session.pool = make_sub_pool(NULL);
+    session.c = NULL;
+    session.notes = NULL;
+  }
+
+  session.sf_flags = 0;
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.ftp.dircache", 1, 20);
+  }
+}
+
+static void tear_down(void) {
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.ftp.dircache", 0, 0);
+  }
+
+  if (p != NULL) {
+    destroy_pool(p);
+    p = permanent_pool = session.pool = NULL;
+    session.c = NULL;
+    session.notes = NULL;
+  }
+}
+
+static cmd_rec *make_cmd(const char *name, const char *arg) {
+  cmd_rec *cmd;
+
+  if (arg == NULL) {
+    cmd = pr_cmd_alloc(p, 1, name);
+    cmd->arg = "";
+
+  } else {
+    cmd = pr_cmd_alloc(p, 2, name, arg);
+    cmd->arg = pstrdup(p, arg);
+  }
+
+  return cmd;
+}
+
+START_TEST (init_test) {
+  int res;
+  struct proxy_session *proxy_sess;
+
+  mark_point();
+  res = proxy_ftp_dircache_init(NULL, NULL, 0, 0);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_dircache_init(p, NULL, 0, 0);
+  ck_assert_msg(res < 0, "Failed to handle null proxy_sess");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  proxy_sess = (struct proxy_session *) proxy_session_alloc(p);
+  ck_assert_msg(proxy_sess != NULL, "Failed to allocate proxy session: %s",
+    strerror(errno));
+
+  mark_point();
+  res = proxy_ftp_dircache_init(p, proxy_sess, 0, 0);
+  ck_assert_msg(res < 0, "Failed to handle zero burst");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_dircache_init(p, proxy_sess, 3, 5);
+  ck_assert_msg(res == 0, "Failed to init dircache: %s", strerror(errno));
+  ck_assert_msg(proxy_sess->dircache_ctx != NULL, "Expected dircache_ctx");
+
+  mark_point();
+  res = proxy_ftp_dircache_free(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null proxy_sess");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_dircache_free(proxy_sess);
+  ck_assert_msg(res == 0, "Failed to free dircache: %s", strerror(errno));
+  ck_assert_msg(proxy_sess->dircache_ctx == NULL, "Expected null dircache_ctx");
+
+  proxy_session_free(p, proxy_sess);
+}
+END_TEST
+
+START_TEST (add_text_test) {
+  int res;
+  struct proxy_session *proxy_sess;
+
+  mark_point();
+  res = proxy_ftp_dircache_add_text(NULL, NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null proxy_sess");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  proxy_sess = (struct proxy_session *) proxy_session_alloc(p);
+
+  mark_point();
+  res = proxy_ftp_dircache_add_text(proxy_sess, NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null dir");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_dircache_add_text(proxy_sess, "", NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null text");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_dircache_add_text(proxy_sess, "", mlsd_text,
+    strlen(mlsd_text));
+  ck_assert_msg(res < 0, "Failed to handle missing dircache_ctx");
+  ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got %s (%d)", EPERM,
+    strerror(errno), errno);
+
+  res = proxy_ftp_dircache_init(p, proxy_sess, 3, 5);
+  ck_assert_msg(res == 0, "Failed to init dircache: %s", strerror(errno));
+
+  mark_point();
+  res = proxy_ftp_dircache_add_text(proxy_sess, "", mlsd_text,
+    strlen(mlsd_text));
+  ck_assert_msg(res == 3, "Expected 3 entries, got %d", res);
+
+  mark_point();
+  res = proxy_ftp_dircache_add_text(proxy_sess, "", "foo\r\n", 5);
+  ck_assert_msg(res == 0, "Expected 0 entries, got %d", res);
+
+  proxy_session_free(p, proxy_sess);
+}
+END_TEST
+
+START_TEST (get_resp_test) {
+  int res;
+  struct proxy_session *proxy_sess;
+  pr_response_t *resp;
+  unsigned int resp_nlines = 0;
+  cmd_rec *cmd;
+  const char *expected;
+
+  mark_point();
+  resp = proxy_ftp_dircache_get_resp(NULL, NULL, NULL, NULL);
+  ck_assert_msg(resp == NULL, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  proxy_sess = (struct proxy_session *) proxy_session_alloc(p);
+  cmd = make_cmd(C_SIZE, "foo.txt");
+
+  mark_point();
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess, cmd, NULL);
+  ck_assert_msg(resp == NULL, "Failed to handle null resp_nlines");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess, cmd, &resp_nlines);
+  ck_assert_msg(resp == NULL, "Failed to handle missing dircache_ctx");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  res = proxy_ftp_dircache_init(p, proxy_sess, 3, 5);
+  ck_assert_msg(res == 0, "Failed to init dircache: %s", strerror(errno));
+
+  res = proxy_ftp_dircache_add_text(proxy_sess, "", mlsd_text,
+    strlen(mlsd_text));
+  ck_assert_msg(res == 3, "Expected 3 entries, got %d", res);
+
+  mark_point();
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess, cmd, &resp_nlines);
+  ck_assert_msg(resp != NULL, "Failed to get SIZE response: %s",
+    strerror(errno));
+  ck_assert_msg(strcmp(resp->num, R_213) == 0, "Expected '%s', got '%s'",
+    R_213, resp->num);
+  ck_assert_msg(strcmp(resp->msg, "1234") == 0, "Expected '1234', got '%s'",
+    resp->msg);
+  ck_assert_msg(resp_nlines == 1, "Expected 1 line, got %u", resp_nlines);
+
+  /* SIZE of a directory is left to the backend. */
+  mark_point();
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess, make_cmd(C_SIZE, "bar"),
+    &resp_nlines);
+  ck_assert_msg(resp == NULL, "Failed to handle SIZE of directory");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  /* As is SIZE in ASCII mode. */
+  mark_point();
+  session.sf_flags |= SF_ASCII;
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess, cmd, &resp_nlines);
+  ck_assert_msg(resp == NULL, "Failed to handle SIZE in ASCII mode");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+  session.sf_flags &= ~SF_ASCII;
+
+  /* Unknown names are left to the backend. */
+  mark_point();
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess,
+    make_cmd(C_SIZE, "missing.txt"), &resp_nlines);
+  ck_assert_msg(resp == NULL, "Failed to handle missing name");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  mark_point();
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess,
+    make_cmd(C_MDTM, "foo.txt"), &resp_nlines);
+  ck_assert_msg(resp != NULL, "Failed to get MDTM response: %s",
+    strerror(errno));
+  ck_assert_msg(strcmp(resp->msg, "20200102030405") == 0,
+    "Expected '20200102030405', got '%s'", resp->msg);
+
+  mark_point();
+  cmd = make_cmd(C_MLST, "with space.txt");
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess, cmd, &resp_nlines);
+  ck_assert_msg(resp != NULL, "Failed to get MLST response: %s",
+    strerror(errno));
+  ck_assert_msg(strcmp(resp->num, R_250) == 0, "Expected '%s', got '%s'",
+    R_250, resp->num);
+  expected = "Start of list for with space.txt\r\n"
+    " Type=file;Size=42;Modify=20200104000000; with space.txt\r\n"
+    "250 End of list";
+  ck_assert_msg(strcmp(resp->msg, expected) == 0, "Expected '%s', got '%s'",
+    expected, resp->msg);
+  ck_assert_msg(resp_nlines == 3, "Expected 3 lines, got %u", resp_nlines);
+
+  /* Entries in other directories are not in this snapshot. */
+  mark_point();
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess,
+    make_cmd(C_SIZE, "bar/foo.txt"), &resp_nlines);
+  ck_assert_msg(resp == NULL, "Failed to handle other directory");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  proxy_session_free(p, proxy_sess);
+}
+END_TEST
+
+START_TEST (note_cmd_test) {
+  int res;
+  struct proxy_session *proxy_sess;
+  pr_response_t *resp;
+  unsigned int resp_nlines = 0;
+  cmd_rec *cmd;
+
+  mark_point();
+  res = proxy_ftp_dircache_note_cmd(NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null proxy_sess");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  proxy_sess = (struct proxy_session *) proxy_session_alloc(p);
+
+  mark_point();
+  res = proxy_ftp_dircache_note_cmd(proxy_sess, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null cmd");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ftp_dircache_init(p, proxy_sess, 3, 5);
+  ck_assert_msg(res == 0, "Failed to init dircache: %s", strerror(errno));
+
+  res = proxy_ftp_dircache_add_text(proxy_sess, "/home", mlsd_text,
+    strlen(mlsd_text));
+  ck_assert_msg(res == 3, "Expected 3 entries, got %d", res);
+
+  cmd = make_cmd(C_SIZE, "/home/foo.txt");
+
+  /* Read-only commands leave the snapshot alone. */
+  mark_point();
+  res = proxy_ftp_dircache_note_cmd(proxy_sess, make_cmd(C_NOOP, NULL));
+  ck_assert_msg(res == 0, "Failed to note NOOP: %s", strerror(errno));
+
+  res = proxy_ftp_dircache_note_cmd(proxy_sess, make_cmd(C_MDTM,
+    "/home/foo.txt"));
+  ck_assert_msg(res == 0, "Failed to note MDTM: %s", strerror(errno));
+
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess, cmd, &resp_nlines);
+  ck_assert_msg(resp != NULL, "Failed to get SIZE response: %s",
+    strerror(errno));
+
+  /* Modifying commands invalidate it. */
+  mark_point();
+  res = proxy_ftp_dircache_note_cmd(proxy_sess, make_cmd(C_DELE,
+    "/home/foo.txt"));
+  ck_assert_msg(res == 0, "Failed to note DELE: %s", strerror(errno));
+
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess, cmd, &resp_nlines);
+  ck_assert_msg(resp == NULL, "Expected invalidated snapshot after DELE");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  /* As does the "set" form of MDTM. */
+  res = proxy_ftp_dircache_add_text(proxy_sess, "/home", mlsd_text,
+    strlen(mlsd_text));
+  ck_assert_msg(res == 3, "Expected 3 entries, got %d", res);
+
+  mark_point();
+  cmd = pr_cmd_alloc(p, 3, C_MDTM, "20200101000000", "/home/foo.txt");
+  cmd->arg = "20200101000000 /home/foo.txt";
+  res = proxy_ftp_dircache_note_cmd(proxy_sess, cmd);
+  ck_assert_msg(res == 0, "Failed to note MDTM: %s", strerror(errno));
+
+  resp = proxy_ftp_dircache_get_resp(p, proxy_sess,
+    make_cmd(C_SIZE, "/home/foo.txt"), &resp_nlines);
+  ck_assert_msg(resp == NULL, "Expected invalidated snapshot after MDTM set");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  proxy_session_free(p, proxy_sess);
+}
+END_TEST
+
+Suite *tests_get_ftp_dircache_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("ftp.dircache");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, init_test);
+  tcase_add_test(testcase, add_text_test);
+  tcase_add_test(testcase, get_resp_test);
+  tcase_add_test(testcase, note_cmd_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
@@ -57,6 +57,79 @@ START_TEST (parse_facts_test) {
 }
 END_TEST
 
+START_TEST (parse_entry_test) {
+  int res;
+  const char *text;
+  struct proxy_ftp_facts_entry entry;
+
+  mark_point();
+  res = proxy_ftp_facts_parse_entry(NULL, NULL, 0, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_facts_parse_entry(p, NULL, 0, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null text");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  text = "type=file; foo";
+
+  mark_point();
+  res = proxy_ftp_facts_parse_entry(p, text, strlen(text), NULL);
+  ck_assert_msg(res < 0, "Failed to handle null entry");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Entries without facts, or without a pathname. */
+  text = "foo";
+
+  mark_point();
+  res = proxy_ftp_facts_parse_entry(p, text, strlen(text), &entry);
+  ck_assert_msg(res < 0, "Failed to handle missing facts");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  text = "type=file; ";
+
+  mark_point();
+  res = proxy_ftp_facts_parse_entry(p, text, strlen(text), &entry);
+  ck_assert_msg(res < 0, "Failed to handle missing pathname");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Fact names are case-insensitive; pathnames may contain "; ". */
+  text = "Type=file;SIZE=1024;Modify=20200101120000;UNIX.mode=0644; a; b";
+
+  mark_point();
+  res = proxy_ftp_facts_parse_entry(p, text, strlen(text), &entry);
+  ck_assert_msg(res == 0, "Failed to parse entry: %s", strerror(errno));
+  ck_assert_msg(strcmp(entry.facts,
+    "Type=file;SIZE=1024;Modify=20200101120000;UNIX.mode=0644;") == 0,
+    "Unexpected facts '%s'", entry.facts);
+  ck_assert_msg(strcmp(entry.path, "a; b") == 0, "Expected 'a; b', got '%s'",
+    entry.path);
+  ck_assert_msg(entry.type != NULL && strcmp(entry.type, "file") == 0,
+    "Expected type 'file', got '%s'", entry.type);
+  ck_assert_msg(entry.size != NULL && strcmp(entry.size, "1024") == 0,
+    "Expected size '1024', got '%s'", entry.size);
+  ck_assert_msg(entry.modify != NULL &&
+    strcmp(entry.modify, "20200101120000") == 0,
+    "Expected modify '20200101120000', got '%s'", entry.modify);
+
+  /* Only the given length of the text is parsed. */
+  text = "type=dir; bar\r\n";
+
+  mark_point();
+  res = proxy_ftp_facts_parse_entry(p, text, strlen(text) - 2, &entry);
+  ck_assert_msg(res == 0, "Failed to parse entry: %s", strerror(errno));
+  ck_assert_msg(strcmp(entry.path, "bar") == 0, "Expected 'bar', got '%s'",
+    entry.path);
+  ck_assert_msg(entry.size == NULL, "Expected no size, got '%s'", entry.size);
+}
+END_TEST
+
 Suite *tests_get_ftp_facts_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -68,6 +141,7 @@ Suite *tests_get_ftp_facts_suite(void) {
 
   tcase_add_test(testcase, get_facts_test);
   tcase_add_test(testcase, parse_facts_test);
+  tcase_add_test(testcase, parse_entry_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
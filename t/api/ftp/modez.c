@@ -0,0 +1,391 @@
+/*
+ * ProFTPD - mod_proxy testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* FTP MODE Z API tests. */
+
+#include "../tests.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = permanent_pool = make_sub_pool(NULL);
+  }
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.ftp.modez", 1, 20);
+  }
+}
+
+static void tear_down(void) {
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.ftp.modez", 0, 0);
+  }
+
+  if (p != NULL) {
+    destroy_pool(p);
+    p = permanent_pool = NULL;
+  }
+}
+
+START_TEST (alloc_test) {
+#ifdef HAVE_ZLIB_H
+  struct proxy_ftp_modez *modez;
+
+  mark_point();
+  modez = proxy_ftp_modez_alloc(NULL, 0, 0);
+  ck_assert_msg(modez == NULL, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  modez = proxy_ftp_modez_alloc(p, -1, 0);
+  ck_assert_msg(modez == NULL, "Failed to handle invalid direction");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  modez = proxy_ftp_modez_alloc(p, PROXY_FTP_MODEZ_DEFLATE, 10);
+  ck_assert_msg(modez == NULL, "Failed to handle invalid level");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  modez = proxy_ftp_modez_alloc(p, PROXY_FTP_MODEZ_DEFLATE, 3);
+  ck_assert_msg(modez != NULL, "Failed to allocate context: %s",
+    strerror(errno));
+  ck_assert_msg(proxy_ftp_modez_get_level(modez) == 3, "Expected level 3");
+  proxy_ftp_modez_free(modez);
+
+  mark_point();
+  modez = proxy_ftp_modez_alloc(p, PROXY_FTP_MODEZ_INFLATE,
+    PROXY_FTP_MODEZ_LEVEL_ADAPTIVE);
+  ck_assert_msg(modez != NULL, "Failed to allocate context: %s",
+    strerror(errno));
+  proxy_ftp_modez_free(modez);
+#endif /* HAVE_ZLIB_H */
+}
+END_TEST
+
+START_TEST (process_test) {
+  int res;
+  char *out;
+  size_t outlen;
+
+  mark_point();
+  res = proxy_ftp_modez_process(NULL, NULL, 0, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null context");
+#ifdef HAVE_ZLIB_H
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+#endif /* HAVE_ZLIB_H */
+
+#ifdef HAVE_ZLIB_H
+  {
+    struct proxy_ftp_modez *modez;
+
+    mark_point();
+    modez = proxy_ftp_modez_alloc(p, PROXY_FTP_MODEZ_INFLATE, 0);
+    ck_assert_msg(modez != NULL, "Failed to allocate context: %s",
+      strerror(errno));
+
+    res = proxy_ftp_modez_process(modez, NULL, 0, &out, &outlen);
+    ck_assert_msg(res < 0, "Failed to handle null input");
+    ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+      strerror(errno), errno);
+
+    mark_point();
+    res = proxy_ftp_modez_process(modez, "not compressed", 14, &out, &outlen);
+    ck_assert_msg(res < 0, "Failed to handle invalid compressed data");
+    ck_assert_msg(errno == EIO, "Expected EIO (%d), got %s (%d)", EIO,
+      strerror(errno), errno);
+
+    proxy_ftp_modez_free(modez);
+  }
+#else
+  (void) out;
+  (void) outlen;
+#endif /* HAVE_ZLIB_H */
+}
+END_TEST
+
+#ifdef HAVE_ZLIB_H
+/* Compresses the given data in chunks of different sizes, decompresses the
+ * result a few bytes at a time, and checks that we get the original data.
+ */
+static void assert_round_trip(const char *data, size_t datalen, int level) {
+  struct proxy_ftp_modez *deflater, *inflater;
+  char *compressed, *res, *out;
+  size_t compressed_len = 0, res_len = 0, outlen = 0, off, chunk = 1, i;
+  int rc;
+
+  deflater = proxy_ftp_modez_alloc(p, PROXY_FTP_MODEZ_DEFLATE, level);
+  ck_assert_msg(deflater != NULL, "Failed to allocate context: %s",
+    strerror(errno));
+
+  inflater = proxy_ftp_modez_alloc(p, PROXY_FTP_MODEZ_INFLATE, 0);
+  ck_assert_msg(inflater != NULL, "Failed to allocate context: %s",
+    strerror(errno));
+
+  /* Compression never expands the data by more than this. */
+  compressed = palloc(p, datalen + (datalen / 8) + 1024);
+  res = palloc(p, datalen + 1);
+
+  for (off = 0; off < datalen; off += chunk, chunk = (chunk * 3) % 8191 + 1) {
+    if (off + chunk > datalen) {
+      chunk = datalen - off;
+    }
+
+    rc = proxy_ftp_modez_process(deflater, data + off, chunk, &out, &outlen);
+    ck_assert_msg(rc == 0, "Failed to compress data: %s", strerror(errno));
+    memcpy(compressed + compressed_len, out, outlen);
+    compressed_len += outlen;
+  }
+
+  rc = proxy_ftp_modez_finish(deflater, &out, &outlen);
+  ck_assert_msg(rc == 0, "Failed to finish compression: %s", strerror(errno));
+  memcpy(compressed + compressed_len, out, outlen);
+  compressed_len += outlen;
+
+  for (i = 0; i < compressed_len; i += 7) {
+    size_t len;
+
+    len = compressed_len - i < 7 ? compressed_len - i : 7;
+    rc = proxy_ftp_modez_process(inflater, compressed + i, len, &out, &outlen);
+    ck_assert_msg(rc == 0, "Failed to decompress data: %s", strerror(errno));
+    ck_assert_msg(res_len + outlen <= datalen, "Decompressed too much data");
+    memcpy(res + res_len, out, outlen);
+    res_len += outlen;
+
+    while (proxy_ftp_modez_pending(inflater) == TRUE) {
+      rc = proxy_ftp_modez_process(inflater, compressed + i, 0, &out,
+        &outlen);
+      ck_assert_msg(rc == 0, "Failed to decompress data: %s",
+        strerror(errno));
+      ck_assert_msg(res_len + outlen <= datalen, "Decompressed too much data");
+      memcpy(res + res_len, out, outlen);
+      res_len += outlen;
+    }
+  }
+
+  rc = proxy_ftp_modez_finish(inflater, &out, &outlen);
+  ck_assert_msg(rc == 0, "Failed to finish decompression: %s",
+    strerror(errno));
+
+  ck_assert_msg(res_len == datalen, "Expected %lu bytes, got %lu",
+    (unsigned long) datalen, (unsigned long) res_len);
+  ck_assert_msg(memcmp(res, data, datalen) == 0,
+    "Decompressed data does not match original data");
+
+  proxy_ftp_modez_free(deflater);
+  proxy_ftp_modez_free(inflater);
+}
+#endif /* HAVE_ZLIB_H */
+
+START_TEST (round_trip_test) {
+#ifdef HAVE_ZLIB_H
+  char *data;
+  size_t datalen, i;
+  unsigned int seed = 1;
+
+  mark_point();
+  assert_round_trip("", 0, 6);
+  assert_round_trip("foo\r\nbar\r\n", 10, 1);
+
+  /* Enough data for the adaptive level to be adjusted a few times. */
+  datalen = 4 * 1024 * 1024;
+  data = palloc(p, datalen);
+  for (i = 0; i < datalen; i++) {
+    seed = (seed * 1103515245) + 12345;
+    data[i] = "abcdefgh\n"[(seed >> 16) % 9];
+  }
+
+  mark_point();
+  assert_round_trip(data, datalen, 9);
+
+  mark_point();
+  assert_round_trip(data, datalen, PROXY_FTP_MODEZ_LEVEL_ADAPTIVE);
+#endif /* HAVE_ZLIB_H */
+}
+END_TEST
+
+START_TEST (inflate_bounded_test) {
+#ifdef HAVE_ZLIB_H
+  struct proxy_ftp_modez *deflater, *inflater;
+  char *data, *compressed, *out;
+  size_t datalen, compressed_len = 0, outlen = 0, total = 0, max_outlen;
+  unsigned int ncalls = 0;
+  int res;
+
+  /* Highly compressible data: a single small read of compressed data must not
+   * produce (and so buffer) all of it at once.
+   */
+  datalen = 8 * 1024 * 1024;
+  data = pcalloc(p, datalen);
+  compressed = palloc(p, datalen / 8);
+
+  deflater = proxy_ftp_modez_alloc(p, PROXY_FTP_MODEZ_DEFLATE, 9);
+  ck_assert_msg(deflater != NULL, "Failed to allocate context: %s",
+    strerror(errno));
+
+  res = proxy_ftp_modez_process(deflater, data, datalen, &out, &outlen);
+  ck_assert_msg(res == 0, "Failed to compress data: %s", strerror(errno));
+  memcpy(compressed, out, outlen);
+  compressed_len = outlen;
+
+  res = proxy_ftp_modez_finish(deflater, &out, &outlen);
+  ck_assert_msg(res == 0, "Failed to finish compression: %s", strerror(errno));
+  memcpy(compressed + compressed_len, out, outlen);
+  compressed_len += outlen;
+  proxy_ftp_modez_free(deflater);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stderr, "MODE Z: %lu bytes compressed to %lu bytes\n",
+      (unsigned long) datalen, (unsigned long) compressed_len);
+  }
+
+  inflater = proxy_ftp_modez_alloc(p, PROXY_FTP_MODEZ_INFLATE, 0);
+  ck_assert_msg(inflater != NULL, "Failed to allocate context: %s",
+    strerror(errno));
+
+  mark_point();
+  res = proxy_ftp_modez_pending(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null context");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_modez_process(inflater, compressed, compressed_len, &out,
+    &outlen);
+  ck_assert_msg(res == 0, "Failed to decompress data: %s", strerror(errno));
+  ck_assert_msg(outlen < datalen, "Expected bounded output, got %lu bytes",
+    (unsigned long) outlen);
+  ck_assert_msg(proxy_ftp_modez_pending(inflater) == TRUE,
+    "Expected pending input");
+  max_outlen = total = outlen;
+
+  /* New input is refused until the pending input has been processed. */
+  mark_point();
+  res = proxy_ftp_modez_process(inflater, compressed, compressed_len, &out,
+    &outlen);
+  ck_assert_msg(res < 0, "Failed to handle new input while pending");
+  ck_assert_msg(errno == EAGAIN, "Expected EAGAIN (%d), got %s (%d)", EAGAIN,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_modez_finish(inflater, &out, &outlen);
+  ck_assert_msg(res < 0, "Failed to handle finish while pending");
+  ck_assert_msg(errno == EAGAIN, "Expected EAGAIN (%d), got %s (%d)", EAGAIN,
+    strerror(errno), errno);
+
+  while (proxy_ftp_modez_pending(inflater) == TRUE) {
+    res = proxy_ftp_modez_process(inflater, compressed, 0, &out, &outlen);
+    ck_assert_msg(res == 0, "Failed to decompress data: %s", strerror(errno));
+    ck_assert_msg(outlen <= max_outlen, "Output buffer grew from %lu to %lu",
+      (unsigned long) max_outlen, (unsigned long) outlen);
+    total += outlen;
+    ncalls++;
+  }
+
+  ck_assert_msg(ncalls > 0, "Expected more than one call");
+  ck_assert_msg(total == datalen, "Expected %lu bytes, got %lu",
+    (unsigned long) datalen, (unsigned long) total);
+
+  res = proxy_ftp_modez_finish(inflater, &out, &outlen);
+  ck_assert_msg(res == 0, "Failed to finish decompression: %s",
+    strerror(errno));
+
+  proxy_ftp_modez_free(inflater);
+#endif /* HAVE_ZLIB_H */
+}
+END_TEST
+
+START_TEST (finish_test) {
+  int res;
+  char *out;
+  size_t outlen;
+
+  mark_point();
+  res = proxy_ftp_modez_finish(NULL, &out, &outlen);
+  ck_assert_msg(res < 0, "Failed to handle null context");
+#ifdef HAVE_ZLIB_H
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  {
+    struct proxy_ftp_modez *deflater, *inflater;
+    char *compressed;
+    size_t compressed_len = 0;
+
+    deflater = proxy_ftp_modez_alloc(p, PROXY_FTP_MODEZ_DEFLATE, 6);
+    inflater = proxy_ftp_modez_alloc(p, PROXY_FTP_MODEZ_INFLATE, 0);
+    compressed = palloc(p, 1024);
+
+    res = proxy_ftp_modez_process(deflater, "foo bar baz", 11, &out, &outlen);
+    ck_assert_msg(res == 0, "Failed to compress data: %s", strerror(errno));
+    memcpy(compressed, out, outlen);
+    compressed_len = outlen;
+
+    res = proxy_ftp_modez_finish(deflater, &out, &outlen);
+    ck_assert_msg(res == 0, "Failed to finish compression: %s",
+      strerror(errno));
+    memcpy(compressed + compressed_len, out, outlen);
+    compressed_len += outlen;
+
+    /* A truncated stream is an error. */
+    mark_point();
+    res = proxy_ftp_modez_process(inflater, compressed, compressed_len - 4,
+      &out, &outlen);
+    ck_assert_msg(res == 0, "Failed to decompress data: %s", strerror(errno));
+
+    res = proxy_ftp_modez_finish(inflater, &out, &outlen);
+    ck_assert_msg(res < 0, "Failed to handle truncated stream");
+    ck_assert_msg(errno == EPIPE, "Expected EPIPE (%d), got %s (%d)", EPIPE,
+      strerror(errno), errno);
+
+    proxy_ftp_modez_free(deflater);
+    proxy_ftp_modez_free(inflater);
+  }
+#endif /* HAVE_ZLIB_H */
+}
+END_TEST
+
+Suite *tests_get_ftp_modez_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("ftp.modez");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, alloc_test);
+  tcase_add_test(testcase, process_test);
+  tcase_add_test(testcase, round_trip_test);
+  tcase_add_test(testcase, inflate_bounded_test);
+  tcase_add_test(testcase, finish_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
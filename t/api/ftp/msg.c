@@ -483,6 +483,432 @@ START_TEST (parse_ext_addr_test) {
 }
 END_TEST
 
+START_TEST (fmt_addr2_test) {
+  int res;
+  char buf[PROXY_FTP_MSG_ADDR_BUFSZ];
+  const pr_netaddr_t *addr;
+  const char *expected;
+
+  res = proxy_ftp_msg_fmt_addr2(NULL, 0, FALSE, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null addr");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  addr = pr_netaddr_get_addr(p, "255.255.255.255", NULL);
+  ck_assert_msg(addr != NULL, "Failed to get addr for 255.255.255.255: %s",
+    strerror(errno));
+
+  res = proxy_ftp_msg_fmt_addr2(addr, 0, FALSE, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null buffer");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ftp_msg_fmt_addr2(addr, 0, FALSE, buf, sizeof(buf)-1);
+  ck_assert_msg(res < 0, "Failed to handle too-small buffer");
+  ck_assert_msg(errno == ENOSPC, "Expected ENOSPC (%d), got '%s' (%d)", ENOSPC,
+    strerror(errno), errno);
+
+  /* The longest possible PORT address. */
+  mark_point();
+  res = proxy_ftp_msg_fmt_addr2(addr, 65535, FALSE, buf, sizeof(buf));
+  expected = "255,255,255,255,255,255";
+  ck_assert_msg(res == (int) strlen(expected), "Expected %d, got %d",
+    (int) strlen(expected), res);
+  ck_assert_msg(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+    expected, buf);
+
+  addr = pr_netaddr_get_addr(p, "10.0.0.1", NULL);
+  ck_assert_msg(addr != NULL, "Failed to get addr for 10.0.0.1: %s",
+    strerror(errno));
+
+  mark_point();
+  res = proxy_ftp_msg_fmt_addr2(addr, 256, FALSE, buf, sizeof(buf));
+  expected = "10,0,0,1,1,0";
+  ck_assert_msg(res == (int) strlen(expected), "Expected %d, got %d",
+    (int) strlen(expected), res);
+  ck_assert_msg(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+    expected, buf);
+
+#ifdef PR_USE_IPV6
+  if (use_ipv6) {
+    addr = pr_netaddr_get_addr(p, "::ffff:10.0.0.1", NULL);
+    ck_assert_msg(addr != NULL, "Failed to get addr for ::ffff:10.0.0.1: %s",
+      strerror(errno));
+
+    mark_point();
+    res = proxy_ftp_msg_fmt_addr2(addr, 256, FALSE, buf, sizeof(buf));
+    ck_assert_msg(res > 0, "Failed to format addr: %s", strerror(errno));
+    ck_assert_msg(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+      expected, buf);
+
+    /* A non-mapped IPv6 address cannot be expressed for PORT/PASV. */
+    addr = pr_netaddr_get_addr(p, "::1", NULL);
+    ck_assert_msg(addr != NULL, "Failed to get addr for ::1: %s",
+      strerror(errno));
+
+    mark_point();
+    res = proxy_ftp_msg_fmt_addr2(addr, 256, FALSE, buf, sizeof(buf));
+    ck_assert_msg(res < 0, "Failed to handle IPv6 address");
+    ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)",
+      EINVAL, strerror(errno), errno);
+  }
+#endif /* PR_USE_IPV6 */
+}
+END_TEST
+
+START_TEST (fmt_ext_addr2_test) {
+  int res;
+  char buf[PROXY_FTP_MSG_EXT_ADDR_BUFSZ];
+  const pr_netaddr_t *addr;
+  const char *expected;
+
+  res = proxy_ftp_msg_fmt_ext_addr2(NULL, 0, 0, FALSE, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null addr");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  addr = pr_netaddr_get_addr(p, "127.0.0.1", NULL);
+  ck_assert_msg(addr != NULL, "Failed to get addr for 127.0.0.1: %s",
+    strerror(errno));
+
+  res = proxy_ftp_msg_fmt_ext_addr2(addr, 0, 0, FALSE, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null buffer");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ftp_msg_fmt_ext_addr2(addr, 2121, 0, FALSE, buf, sizeof(buf));
+  ck_assert_msg(res < 0, "Failed to handle invalid command ID");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ftp_msg_fmt_ext_addr2(addr, 2121, PR_CMD_EPRT_ID, FALSE, buf,
+    10);
+  ck_assert_msg(res < 0, "Failed to handle too-small buffer");
+  ck_assert_msg(errno == ENOSPC, "Expected ENOSPC (%d), got '%s' (%d)", ENOSPC,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ftp_msg_fmt_ext_addr2(addr, 65535, PR_CMD_EPRT_ID, FALSE, buf,
+    sizeof(buf));
+  expected = "|1|127.0.0.1|65535|";
+  ck_assert_msg(res == (int) strlen(expected), "Expected %d, got %d",
+    (int) strlen(expected), res);
+  ck_assert_msg(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+    expected, buf);
+
+  mark_point();
+  res = proxy_ftp_msg_fmt_ext_addr2(addr, 0, PR_CMD_EPSV_ID, FALSE, buf,
+    sizeof(buf));
+  expected = "|||0|";
+  ck_assert_msg(res == (int) strlen(expected), "Expected %d, got %d",
+    (int) strlen(expected), res);
+  ck_assert_msg(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+    expected, buf);
+
+#ifdef PR_USE_IPV6
+  if (use_ipv6) {
+    addr = pr_netaddr_get_addr(p, "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff",
+      NULL);
+    ck_assert_msg(addr != NULL, "Failed to get IPv6 addr: %s",
+      strerror(errno));
+
+    mark_point();
+    res = proxy_ftp_msg_fmt_ext_addr2(addr, 65535, PR_CMD_EPRT_ID, FALSE, buf,
+      sizeof(buf));
+    expected = "|2|ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff|65535|";
+    ck_assert_msg(res == (int) strlen(expected), "Expected %d, got %d",
+      (int) strlen(expected), res);
+    ck_assert_msg(strcmp(buf, expected) == 0, "Expected '%s', got '%s'",
+      expected, buf);
+  }
+#endif /* PR_USE_IPV6 */
+}
+END_TEST
+
+START_TEST (parse_addr2_test) {
+  register unsigned int i;
+  int res;
+  pr_netaddr_t addr;
+  const char *msg, *ip_str, *expected;
+
+  /* Malformed messages, and the errors they should yield. */
+  struct {
+    const char *msg;
+    int xerrno;
+  } bad_msgs[] = {
+    { "", EPERM },
+    { "(", EPERM },
+    { ",,,,,", EPERM },
+    { "1,2,3,4,5", EPERM },
+    { "(1,2,3,4,5,)", EPERM },
+    { "(1,2,3,4,,6)", EPERM },
+    { "(1;2;3;4;5;6)", EPERM },
+    { "(1 ,2,3,4,5,6)", EPERM },
+    { "(1,2,3,4,5,-6)", EPERM },
+    { "(a,b,c,d,e,f)", EPERM },
+    { "(256,2,3,4,5,6)", EINVAL },
+    { "(1,2,3,4,5,256)", EINVAL },
+    { "(1,2,3,4,5,99999999999999999999)", EINVAL },
+    { "(0,0,0,0,1,2)", EINVAL },
+    { "(1,2,3,4,0,0)", EINVAL },
+    { NULL, 0 }
+  };
+
+  res = proxy_ftp_msg_parse_addr2(NULL, 0, 0, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null message");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  msg = "(127,0,0,1,8,73)";
+  res = proxy_ftp_msg_parse_addr2(msg, strlen(msg), 0, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null address");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  for (i = 0; bad_msgs[i].msg != NULL; i++) {
+    mark_point();
+    res = proxy_ftp_msg_parse_addr2(bad_msgs[i].msg, strlen(bad_msgs[i].msg),
+      AF_INET, &addr);
+    ck_assert_msg(res < 0, "Failed to reject message '%s'", bad_msgs[i].msg);
+    ck_assert_msg(errno == bad_msgs[i].xerrno,
+      "Expected %s (%d) for '%s', got '%s' (%d)",
+      strerror(bad_msgs[i].xerrno), bad_msgs[i].xerrno, bad_msgs[i].msg,
+      strerror(errno), errno);
+  }
+
+  /* Every truncation of a valid message must be rejected, without reading
+   * past the given length.
+   */
+  msg = "Entering Passive Mode (195,144,107,198,8,73)";
+
+  /* Stop before "...,8,7", which is itself a valid address/port. */
+  for (i = 0; i < 42; i++) {
+    mark_point();
+    res = proxy_ftp_msg_parse_addr2(msg, i, AF_INET, &addr);
+    ck_assert_msg(res < 0, "Failed to reject truncated message '%.*s'",
+      (int) i, msg);
+  }
+
+  /* Whitespace after the separators is tolerated, as some servers send it. */
+  msg = "Entering Passive Mode (195, 144, 107, 198, 8, 73).";
+
+  mark_point();
+  res = proxy_ftp_msg_parse_addr2(msg, strlen(msg), AF_INET, &addr);
+  ck_assert_msg(res == 0, "Failed to parse message '%s': %s", msg,
+    strerror(errno));
+  ip_str = pr_netaddr_get_ipstr(&addr);
+  expected = "195.144.107.198";
+  ck_assert_msg(strcmp(ip_str, expected) == 0, "Expected '%s', got '%s'",
+    expected, ip_str);
+  ck_assert_msg(ntohs(pr_netaddr_get_port(&addr)) == 2121,
+    "Expected port 2121, got %u", ntohs(pr_netaddr_get_port(&addr)));
+
+  /* The address starts at the first number which parses. */
+  msg = "227 1,2 (001,002,003,004,005,006)";
+
+  mark_point();
+  res = proxy_ftp_msg_parse_addr2(msg, strlen(msg), AF_INET, &addr);
+  ck_assert_msg(res == 0, "Failed to parse message '%s': %s", msg,
+    strerror(errno));
+  ip_str = pr_netaddr_get_ipstr(&addr);
+  expected = "1.2.3.4";
+  ck_assert_msg(strcmp(ip_str, expected) == 0, "Expected '%s', got '%s'",
+    expected, ip_str);
+  ck_assert_msg(ntohs(pr_netaddr_get_port(&addr)) == 1286,
+    "Expected port 1286, got %u", ntohs(pr_netaddr_get_port(&addr)));
+
+#ifdef PR_USE_IPV6
+  if (use_ipv6) {
+    msg = "(127,0,0,1,8,73)";
+
+    mark_point();
+    res = proxy_ftp_msg_parse_addr2(msg, strlen(msg), AF_INET6, &addr);
+    ck_assert_msg(res == 0, "Failed to parse message '%s': %s", msg,
+      strerror(errno));
+    ck_assert_msg(pr_netaddr_get_family(&addr) == AF_INET6,
+      "Expected AF_INET6 (%d), got %d", AF_INET6,
+      pr_netaddr_get_family(&addr));
+    ip_str = pr_netaddr_get_ipstr(&addr);
+    expected = "::ffff:127.0.0.1";
+    ck_assert_msg(strcmp(ip_str, expected) == 0, "Expected '%s', got '%s'",
+      expected, ip_str);
+  }
+#endif /* PR_USE_IPV6 */
+}
+END_TEST
+
+START_TEST (parse_ext_addr2_test) {
+  register unsigned int i;
+  int res;
+  pr_netaddr_t na;
+  const pr_netaddr_t *addr;
+  const char *msg;
+
+  /* Malformed EPSV responses, and the errors they should yield. */
+  struct {
+    const char *msg;
+    int xerrno;
+  } bad_msgs[] = {
+    { "", EINVAL },
+    { "(", EINVAL },
+    { ")", EINVAL },
+    { "(.", EINVAL },
+    { "()", EPROTOTYPE },
+    { "().", EPROTOTYPE },
+    { "(|)", EPROTOTYPE },
+    { "(||)", EINVAL },
+    { "(|||)", EPERM },
+    { "(|||5)", EPERM },
+    { "(|||5|", EINVAL },
+    { "(|||x|)", EPERM },
+    { "(|||65536|)", EPERM },
+    { "(|||99999999999999999999|)", EPERM },
+    { "(|3|1.2.3.4|5|)", EPROTOTYPE },
+    { "(|1|1.2.3|5|)", EPERM },
+    { "(|1|1.2.3.4.5|5|)", EPERM },
+    { "(|1|1.2.3.256|5|)", EPERM },
+    { "(|1|0123456789012345678901234567890123456789"
+      "012345678901234567890123456789|5|)", EPERM },
+    { NULL, 0 }
+  };
+
+  res = proxy_ftp_msg_parse_ext_addr2(NULL, 0, NULL, 0, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null message");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  addr = pr_netaddr_get_addr(p, "127.0.0.1", NULL);
+  ck_assert_msg(addr != NULL, "Failed to get address for 127.0.0.1: %s",
+    strerror(errno));
+
+  msg = "(|||5|)";
+  res = proxy_ftp_msg_parse_ext_addr2(msg, strlen(msg), addr, PR_CMD_EPSV_ID,
+    NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null result");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  for (i = 0; bad_msgs[i].msg != NULL; i++) {
+    mark_point();
+    res = proxy_ftp_msg_parse_ext_addr2(bad_msgs[i].msg,
+      strlen(bad_msgs[i].msg), addr, PR_CMD_EPSV_ID, NULL, &na);
+    ck_assert_msg(res < 0, "Failed to reject message '%s'", bad_msgs[i].msg);
+    ck_assert_msg(errno == bad_msgs[i].xerrno,
+      "Expected %s (%d) for '%s', got '%s' (%d)",
+      strerror(bad_msgs[i].xerrno), bad_msgs[i].xerrno, bad_msgs[i].msg,
+      strerror(errno), errno);
+  }
+
+  /* Every truncation of a valid message must be rejected, without reading
+   * past the given length.
+   */
+  msg = "|1|1.2.3.4|65535|";
+  for (i = 0; i < strlen(msg); i++) {
+    mark_point();
+    res = proxy_ftp_msg_parse_ext_addr2(msg, i, addr, PR_CMD_EPRT_ID, NULL,
+      &na);
+    ck_assert_msg(res < 0, "Failed to reject truncated message '%.*s'",
+      (int) i, msg);
+  }
+
+  mark_point();
+  res = proxy_ftp_msg_parse_ext_addr2(msg, strlen(msg), addr, PR_CMD_EPRT_ID,
+    NULL, &na);
+  ck_assert_msg(res == 0, "Failed to parse message '%s': %s", msg,
+    strerror(errno));
+  ck_assert_msg(strcmp(pr_netaddr_get_ipstr(&na), "1.2.3.4") == 0,
+    "Expected '1.2.3.4', got '%s'", pr_netaddr_get_ipstr(&na));
+  ck_assert_msg(ntohs(pr_netaddr_get_port(&na)) == 65535,
+    "Expected port 65535, got %u", ntohs(pr_netaddr_get_port(&na)));
+
+  /* Arbitrary delimiters, and a trailing period, are allowed. */
+  msg = "Entering Extended Passive Mode (!!!2121!).";
+
+  mark_point();
+  res = proxy_ftp_msg_parse_ext_addr2(msg, strlen(msg), addr, PR_CMD_EPSV_ID,
+    NULL, &na);
+  ck_assert_msg(res == 0, "Failed to parse message '%s': %s", msg,
+    strerror(errno));
+  ck_assert_msg(pr_netaddr_cmp(&na, addr) == 0, "Expected '%s', got '%s'",
+    pr_netaddr_get_ipstr(addr), pr_netaddr_get_ipstr(&na));
+  ck_assert_msg(ntohs(pr_netaddr_get_port(&na)) == 2121,
+    "Expected port 2121, got %u", ntohs(pr_netaddr_get_port(&na)));
+}
+END_TEST
+
+START_TEST (msg_benchmark_test) {
+  register unsigned int i;
+  unsigned int count = 100000;
+  struct timeval start, end;
+  long pool_usecs, buf_usecs;
+  const pr_netaddr_t *addr;
+  const char *pasv_msg, *epsv_msg;
+
+  addr = pr_netaddr_get_addr(p, "195.144.107.198", NULL);
+  ck_assert_msg(addr != NULL, "Failed to get addr: %s", strerror(errno));
+
+  pasv_msg = "Entering Passive Mode (195,144,107,198,8,73).";
+  epsv_msg = "Entering Extended Passive Mode (|||2121|)";
+
+  /* A round of formatting and parsing, as done on both legs of a passive
+   * transfer, using the pool-allocated results...
+   */
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    pool *tmp_pool;
+    const pr_netaddr_t *res;
+    const char *str;
+
+    tmp_pool = make_sub_pool(p);
+
+    str = proxy_ftp_msg_fmt_addr(tmp_pool, addr, 2121, FALSE);
+    ck_assert_msg(str != NULL, "Failed to format addr: %s", strerror(errno));
+    str = proxy_ftp_msg_fmt_ext_addr(tmp_pool, addr, 2121, PR_CMD_EPSV_ID,
+      FALSE);
+    ck_assert_msg(str != NULL, "Failed to format addr: %s", strerror(errno));
+
+    res = proxy_ftp_msg_parse_addr(tmp_pool, pasv_msg, AF_INET);
+    ck_assert_msg(res != NULL, "Failed to parse addr: %s", strerror(errno));
+    res = proxy_ftp_msg_parse_ext_addr(tmp_pool, epsv_msg, addr,
+      PR_CMD_EPSV_ID, NULL);
+    ck_assert_msg(res != NULL, "Failed to parse addr: %s", strerror(errno));
+
+    destroy_pool(tmp_pool);
+  }
+  gettimeofday(&end, NULL);
+  pool_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  /* ...and using caller-provided storage. */
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    char buf[PROXY_FTP_MSG_EXT_ADDR_BUFSZ];
+    pr_netaddr_t na;
+    int res;
+
+    res = proxy_ftp_msg_fmt_addr2(addr, 2121, FALSE, buf, sizeof(buf));
+    ck_assert_msg(res > 0, "Failed to format addr: %s", strerror(errno));
+    res = proxy_ftp_msg_fmt_ext_addr2(addr, 2121, PR_CMD_EPSV_ID, FALSE, buf,
+      sizeof(buf));
+    ck_assert_msg(res > 0, "Failed to format addr: %s", strerror(errno));
+
+    res = proxy_ftp_msg_parse_addr2(pasv_msg, strlen(pasv_msg), AF_INET, &na);
+    ck_assert_msg(res == 0, "Failed to parse addr: %s", strerror(errno));
+    res = proxy_ftp_msg_parse_ext_addr2(epsv_msg, strlen(epsv_msg), addr,
+      PR_CMD_EPSV_ID, NULL, &na);
+    ck_assert_msg(res == 0, "Failed to parse addr: %s", strerror(errno));
+  }
+  gettimeofday(&end, NULL);
+  buf_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stdout, "ftp.msg: %u rounds in %ld usecs (pool), "
+      "%ld usecs (caller storage)\n", count, pool_usecs, buf_usecs);
+  }
+}
+END_TEST
+
 Suite *tests_get_ftp_msg_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -496,6 +922,11 @@ Suite *tests_get_ftp_msg_suite(void) {
   tcase_add_test(testcase, fmt_ext_addr_test);
   tcase_add_test(testcase, parse_addr_test);
   tcase_add_test(testcase, parse_ext_addr_test);
+  tcase_add_test(testcase, fmt_addr2_test);
+  tcase_add_test(testcase, fmt_ext_addr2_test);
+  tcase_add_test(testcase, parse_addr2_test);
+  tcase_add_test(testcase, parse_ext_addr2_test);
+  tcase_add_test(testcase, msg_benchmark_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
@@ -158,6 +158,274 @@ START_TEST (send_pbsz_prot_test) {
 }
 END_TEST
 
+START_TEST (parse_feat_test) {
+  int res;
+  struct proxy_session *proxy_sess;
+  char *buf;
+  const char *feats, *val;
+  unsigned long expected;
+
+  res = proxy_ftp_sess_parse_feat(NULL, NULL, 0, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ftp_sess_parse_feat(p, NULL, 0, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null buffer");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  buf = pstrdup(p, "");
+  res = proxy_ftp_sess_parse_feat(p, buf, 0, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null proxy session");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  proxy_sess = (struct proxy_session *) proxy_session_alloc(p);
+
+  /* As seen from IIS, with a blank line for good measure. */
+  feats = "Extended features supported:\r\n"
+    " LANG EN*\r\n"
+    " UTF8\r\n"
+    " AUTH TLS;TLS-C;SSL;TLS-P;\r\n"
+    " PBSZ\r\n"
+    " PROT C;P;\r\n"
+    "\r\n"
+    " CCC\r\n"
+    " HOST\r\n"
+    " SIZE\r\n"
+    " MDTM\r\n"
+    " REST STREAM\r\n"
+    " EPRT\r\n"
+    " epsv\n"
+    " MLST type*;size*;modify*;\r\n"
+    "End";
+
+  buf = pstrdup(p, feats);
+
+  mark_point();
+  res = proxy_ftp_sess_parse_feat(p, buf, strlen(buf), proxy_sess);
+  ck_assert_msg(res == 13, "Expected 13 features, got %d", res);
+  expected = PROXY_SESS_FEAT_FL_EPSV|PROXY_SESS_FEAT_FL_EPRT|
+    PROXY_SESS_FEAT_FL_MLST|PROXY_SESS_FEAT_FL_UTF8|
+    PROXY_SESS_FEAT_FL_REST_STREAM|PROXY_SESS_FEAT_FL_AUTH|
+    PROXY_SESS_FEAT_FL_PBSZ|PROXY_SESS_FEAT_FL_SIZE|PROXY_SESS_FEAT_FL_MDTM|
+    PROXY_SESS_FEAT_FL_HOST;
+  ck_assert_msg(proxy_sess->backend_feat_flags == expected,
+    "Unexpected feature flags %#lx", proxy_sess->backend_feat_flags);
+
+  ck_assert_msg(proxy_sess->backend_auth_feat != NULL, "Expected AUTH value");
+  ck_assert_msg(strcmp(proxy_sess->backend_auth_feat,
+    "TLS;TLS-C;SSL;TLS-P;") == 0, "Expected 'TLS;TLS-C;SSL;TLS-P;', got '%s'",
+    proxy_sess->backend_auth_feat);
+  ck_assert_msg(proxy_sess->backend_mlst_feat != NULL, "Expected MLST value");
+  ck_assert_msg(strcmp(proxy_sess->backend_mlst_feat,
+    "type*;size*;modify*;") == 0, "Expected 'type*;size*;modify*;', got '%s'",
+    proxy_sess->backend_mlst_feat);
+
+  /* The unknown features are kept in the table; the known ones are not. */
+  ck_assert_msg(pr_table_count(proxy_sess->backend_features) == 3,
+    "Expected 3 table entries, got %d",
+    pr_table_count(proxy_sess->backend_features));
+
+  val = pr_table_get(proxy_sess->backend_features, "LANG", NULL);
+  ck_assert_msg(val != NULL, "Expected LANG feature");
+  ck_assert_msg(strcmp(val, "EN*") == 0, "Expected 'EN*', got '%s'", val);
+
+  val = pr_table_get(proxy_sess->backend_features, C_PROT, NULL);
+  ck_assert_msg(val != NULL, "Expected PROT feature");
+  ck_assert_msg(strcmp(val, "C;P;") == 0, "Expected 'C;P;', got '%s'", val);
+
+  val = pr_table_get(proxy_sess->backend_features, "CCC", NULL);
+  ck_assert_msg(val != NULL, "Expected CCC feature");
+  ck_assert_msg(*val == '\0', "Expected empty value, got '%s'", val);
+
+  val = pr_table_get(proxy_sess->backend_features, C_EPSV, NULL);
+  ck_assert_msg(val == NULL, "Expected no EPSV table entry");
+
+  proxy_session_free(p, proxy_sess);
+
+  /* Handing over the response in chunks of lines yields the same results. */
+  proxy_sess = (struct proxy_session *) proxy_session_alloc(p);
+
+  buf = pstrdup(p, " EPSV\r\n REST 100\r\n");
+  res = proxy_ftp_sess_parse_feat(p, buf, strlen(buf), proxy_sess);
+  ck_assert_msg(res == 2, "Expected 2 features, got %d", res);
+
+  buf = pstrdup(p, " MDTM\r\n");
+  res = proxy_ftp_sess_parse_feat(p, buf, strlen(buf), proxy_sess);
+  ck_assert_msg(res == 1, "Expected 1 feature, got %d", res);
+
+  expected = PROXY_SESS_FEAT_FL_EPSV|PROXY_SESS_FEAT_FL_MDTM;
+  ck_assert_msg(proxy_sess->backend_feat_flags == expected,
+    "Unexpected feature flags %#lx", proxy_sess->backend_feat_flags);
+
+  /* A REST feature other than "REST STREAM" goes into the table. */
+  val = pr_table_get(proxy_sess->backend_features, C_REST, NULL);
+  ck_assert_msg(val != NULL, "Expected REST feature");
+  ck_assert_msg(strcmp(val, "100") == 0, "Expected '100', got '%s'", val);
+
+  /* Unknown feature names are stored uppercased, for later lookups. */
+  buf = pstrdup(p, " prot C;P;\r\n Mode Z\r\n");
+  res = proxy_ftp_sess_parse_feat(p, buf, strlen(buf), proxy_sess);
+  ck_assert_msg(res == 2, "Expected 2 features, got %d", res);
+
+  val = pr_table_get(proxy_sess->backend_features, C_PROT, NULL);
+  ck_assert_msg(val != NULL, "Expected PROT feature");
+  ck_assert_msg(strcmp(val, "C;P;") == 0, "Expected 'C;P;', got '%s'", val);
+
+  val = pr_table_get(proxy_sess->backend_features, C_MODE, NULL);
+  ck_assert_msg(val != NULL, "Expected MODE feature");
+  ck_assert_msg(strcmp(val, "Z") == 0, "Expected 'Z', got '%s'", val);
+
+  proxy_session_free(p, proxy_sess);
+}
+END_TEST
+
+START_TEST (parse_feat_fuzz_test) {
+  register unsigned int i;
+  const char *alphabet = " \r\n;*EPSVRTMLUF8AHOBZDIC";
+  size_t alphabetlen;
+  unsigned long known_flags;
+
+  known_flags = PROXY_SESS_FEAT_FL_EPSV|PROXY_SESS_FEAT_FL_EPRT|
+    PROXY_SESS_FEAT_FL_MLST|PROXY_SESS_FEAT_FL_UTF8|
+    PROXY_SESS_FEAT_FL_REST_STREAM|PROXY_SESS_FEAT_FL_AUTH|
+    PROXY_SESS_FEAT_FL_PBSZ|PROXY_SESS_FEAT_FL_SIZE|PROXY_SESS_FEAT_FL_MDTM|
+    PROXY_SESS_FEAT_FL_HOST;
+  alphabetlen = strlen(alphabet);
+  srandom(1);
+
+  for (i = 0; i < 5000; i++) {
+    register unsigned int j;
+    int res;
+    pool *tmp_pool;
+    struct proxy_session *proxy_sess;
+    char *buf;
+    size_t buflen;
+
+    pr_signals_handle();
+
+    tmp_pool = make_sub_pool(p);
+    proxy_sess = (struct proxy_session *) proxy_session_alloc(tmp_pool);
+
+    buflen = random() % 512;
+    buf = palloc(tmp_pool, buflen + 1);
+    for (j = 0; j < buflen; j++) {
+      /* Mostly the interesting characters, with the occasional any byte. */
+      if (random() % 8 == 0) {
+        buf[j] = (char) (random() % 256);
+
+      } else {
+        buf[j] = alphabet[random() % alphabetlen];
+      }
+    }
+    buf[buflen] = '\0';
+
+    mark_point();
+    res = proxy_ftp_sess_parse_feat(tmp_pool, buf, buflen, proxy_sess);
+    ck_assert_msg(res >= 0, "Failed to parse fuzzed FEAT response: %s",
+      strerror(errno));
+    ck_assert_msg((proxy_sess->backend_feat_flags & ~known_flags) == 0,
+      "Unexpected feature flags %#lx", proxy_sess->backend_feat_flags);
+    ck_assert_msg(pr_table_count(proxy_sess->backend_features) <= res,
+      "Expected at most %d table entries, got %d", res,
+      pr_table_count(proxy_sess->backend_features));
+
+    destroy_pool(tmp_pool);
+  }
+}
+END_TEST
+
+START_TEST (parse_feat_benchmark_test) {
+  register unsigned int i;
+  unsigned int count = 100000, nfound = 0;
+  struct proxy_session *proxy_sess;
+  struct timeval start, end;
+  long parse_usecs, table_usecs, flag_usecs;
+  const char *feats;
+  size_t feats_len;
+  pr_table_t *tab;
+
+  feats = "Extended features supported:\r\n"
+    " LANG EN*\r\n"
+    " UTF8\r\n"
+    " AUTH TLS;TLS-C;SSL;TLS-P;\r\n"
+    " PBSZ\r\n"
+    " PROT C;P;\r\n"
+    " CCC\r\n"
+    " HOST\r\n"
+    " SIZE\r\n"
+    " MDTM\r\n"
+    " REST STREAM\r\n"
+    " EPRT\r\n"
+    " EPSV\r\n"
+    " MLST type*;size*;modify*;\r\n"
+    "End";
+  feats_len = strlen(feats);
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count / 10; i++) {
+    pool *tmp_pool;
+    char *buf;
+
+    tmp_pool = make_sub_pool(p);
+    proxy_sess = (struct proxy_session *) proxy_session_alloc(tmp_pool);
+    buf = pstrndup(tmp_pool, feats, feats_len);
+    (void) proxy_ftp_sess_parse_feat(tmp_pool, buf, feats_len, proxy_sess);
+    destroy_pool(tmp_pool);
+  }
+  gettimeofday(&end, NULL);
+  parse_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  /* Compare the per-command checks, as a table lookup and as a flag test. */
+  tab = pr_table_nalloc(p, 0, 4);
+  (void) pr_table_add(tab, C_EPSV, "", 0);
+  (void) pr_table_add(tab, C_EPRT, "", 0);
+  (void) pr_table_add(tab, C_MLST, "type*;", 0);
+  (void) pr_table_add(tab, C_PROT, "C;P;", 0);
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    if (pr_table_get(tab, C_EPSV, NULL) != NULL) {
+      nfound++;
+    }
+  }
+  gettimeofday(&end, NULL);
+  table_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  proxy_sess = (struct proxy_session *) proxy_session_alloc(p);
+  proxy_sess->backend_feat_flags = PROXY_SESS_FEAT_FL_EPSV;
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    volatile unsigned long *flags;
+
+    flags = &(proxy_sess->backend_feat_flags);
+    if (*flags & PROXY_SESS_FEAT_FL_EPSV) {
+      nfound++;
+    }
+  }
+  gettimeofday(&end, NULL);
+  flag_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  ck_assert_msg(nfound == count * 2, "Expected %u lookups to succeed, got %u",
+    count * 2, nfound);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stdout, "ftp.sess: %u FEAT parses in %ld usecs\n", count / 10,
+      parse_usecs);
+    fprintf(stdout, "ftp.sess: %u table lookups in %ld usecs, "
+      "%u flag checks in %ld usecs\n", count, table_usecs, count, flag_usecs);
+  }
+
+  proxy_session_free(p, proxy_sess);
+}
+END_TEST
+
 Suite *tests_get_ftp_sess_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -168,6 +436,9 @@ Suite *tests_get_ftp_sess_suite(void) {
   tcase_add_checked_fixture(testcase, set_up, tear_down);
 
   tcase_add_test(testcase, get_feat_test);
+  tcase_add_test(testcase, parse_feat_test);
+  tcase_add_test(testcase, parse_feat_fuzz_test);
+  tcase_add_test(testcase, parse_feat_benchmark_test);
   tcase_add_test(testcase, send_auth_tls_test);
   tcase_add_test(testcase, send_host_test);
   tcase_add_test(testcase, send_pbsz_prot_test);
@@ -29,6 +29,7 @@
 extern xaset_t *server_list;
 
 static pool *p = NULL;
+static const char *test_dir = "/tmp/mod_proxy-test-ftp-xfer";
 
 static void create_main_server(void) {
   server_rec *s;
@@ -39,9 +40,25 @@ static void create_main_server(void) {
   main_server = s;
 }
 
+static int create_test_dir(void) {
+  int res;
+  mode_t perms;
+
+  perms = 0770;
+  res = mkdir(test_dir, perms);
+  ck_assert_msg(res == 0, "Failed to create tmp directory '%s': %s", test_dir,
+    strerror(errno));
+
+  res = chmod(test_dir, perms);
+  ck_assert_msg(res == 0, "Failed to set perms %04o on directory '%s': %s",
+    perms, test_dir, strerror(errno));
+
+  return 0;
+}
+
 static void set_up(void) {
   if (p == NULL) {
-    p = permanent_pool = session.pool = make_sub_pool(NULL);
+    p = permanent_pool = proxy_pool = session.pool = make_sub_pool(NULL);
     main_server = NULL;
     server_list = NULL;
     session.c = NULL;
@@ -64,6 +81,10 @@ static void set_up(void) {
     pr_trace_set_levels("proxy.ftp.xfer", 1, 20);
   }
 
+  (void) tests_rmpath(p, test_dir);
+  (void) create_test_dir();
+  proxy_db_init(p);
+
   pr_inet_set_default_family(p, AF_INET);
 }
 
@@ -75,13 +96,18 @@ static void tear_down(void) {
     pr_trace_set_levels("proxy.ftp.xfer", 0, 0);
   }
 
+  (void) proxy_ftp_xfer_sess_free(p);
+  (void) proxy_ftp_xfer_free(p);
+  proxy_db_free();
+  (void) tests_rmpath(p, test_dir);
+
   pr_response_set_pool(NULL);
   pr_parser_cleanup();
   pr_inet_clear();
 
   if (p) {
     destroy_pool(p);
-    p = permanent_pool = session.pool = NULL;
+    p = permanent_pool = proxy_pool = session.pool = NULL;
     main_server = NULL;
     server_list = NULL;
     session.c = NULL;
@@ -269,6 +295,127 @@ START_TEST (prepare_passive_test) {
 }
 END_TEST
 
+/* Returns a backend control connection using one end of a socketpair, with
+ * the given responses already waiting to be read; the other end, from which
+ * the commands sent to the "backend" can be read, is returned in fd.
+ */
+static conn_t *get_backend_ctrl_conn(const char *resps, int *fd) {
+  int fds[2], res;
+  conn_t *conn;
+
+  res = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  ck_assert_msg(res == 0, "Failed to create socketpair: %s", strerror(errno));
+
+  res = write(fds[1], resps, strlen(resps));
+  ck_assert_msg(res == (int) strlen(resps), "Failed to write responses: %s",
+    strerror(errno));
+
+  conn = pr_inet_create_conn(p, -1, NULL, INPORT_ANY, FALSE);
+  ck_assert_msg(conn != NULL, "Failed to create backend control conn: %s",
+    strerror(errno));
+
+  conn->remote_addr = session.c->remote_addr;
+  conn->instrm = pr_netio_open(p, PR_NETIO_STRM_CTRL, fds[0], PR_NETIO_IO_RD);
+  conn->outstrm = pr_netio_open(p, PR_NETIO_STRM_CTRL, fds[0], PR_NETIO_IO_WR);
+
+  *fd = fds[1];
+  return conn;
+}
+
+START_TEST (prepare_passive_shared_flags_test) {
+  int fd, res;
+  const pr_netaddr_t *addr;
+  const struct proxy_conn *pconn;
+  cmd_rec *cmd;
+  struct proxy_session *proxy_sess;
+  char buf[256];
+  const char *pasv_resp = "227 Entering Passive Mode (127,0,0,1,4,1).\r\n";
+
+  res = proxy_ftp_xfer_init(NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null arguments");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ftp_xfer_init(p, test_dir, PROXY_DB_OPEN_FL_SKIP_VACUUM);
+  ck_assert_msg(res == 0, "Failed to init FTP data transfers: %s",
+    strerror(errno));
+
+  session.c = pr_inet_create_conn(p, -1, NULL, INPORT_ANY, FALSE);
+  ck_assert_msg(session.c != NULL,
+    "Failed to open session control conn: %s", strerror(errno));
+
+  session.c->local_addr = session.c->remote_addr = pr_netaddr_get_addr(p,
+    "127.0.0.1", NULL);
+  ck_assert_msg(session.c->remote_addr != NULL, "Failed to get address: %s",
+    strerror(errno));
+
+  pconn = proxy_conn_create(p, "ftp://127.0.0.1:21", 0);
+  ck_assert_msg(pconn != NULL, "Failed to create backend conn: %s",
+    strerror(errno));
+
+  cmd = pr_cmd_alloc(p, 1, "EPSV");
+
+  /* The first session learns that the backend server rejects EPSV. */
+  proxy_sess = (struct proxy_session *) proxy_session_alloc(p);
+  proxy_sess->dst_pconn = pconn;
+  proxy_sess->backend_feat_flags |= PROXY_SESS_FEAT_FL_EPSV;
+
+  res = proxy_ftp_xfer_sess_init(p, proxy_sess, 0);
+  ck_assert_msg(res == 0, "Failed to init FTP data transfer session: %s",
+    strerror(errno));
+
+  proxy_sess->backend_ctrl_conn = get_backend_ctrl_conn(
+    pstrcat(p, "500 EPSV not understood\r\n", pasv_resp, NULL), &fd);
+
+  mark_point();
+  addr = proxy_ftp_xfer_prepare_passive(PR_CMD_EPSV_ID, cmd, "500", proxy_sess,
+    0);
+  ck_assert_msg(addr != NULL, "Failed to fall back to PASV: %s",
+    strerror(errno));
+  ck_assert_msg(proxy_sess->dataxfer_flags & PROXY_SESS_DATA_TRANSFER_FL_EPSV_FAILED,
+    "Expected EPSV_FAILED flag, got %lu", proxy_sess->dataxfer_flags);
+
+  memset(buf, '\0', sizeof(buf));
+  res = read(fd, buf, sizeof(buf)-1);
+  ck_assert_msg(res > 0, "Failed to read commands: %s", strerror(errno));
+  ck_assert_msg(strcmp(buf, "EPSV\r\nPASV\r\n") == 0,
+    "Expected EPSV, then PASV; got '%s'", buf);
+
+  (void) close(fd);
+  (void) proxy_ftp_xfer_sess_free(p);
+  proxy_session_free(p, proxy_sess);
+
+  /* A later session to the same backend server goes straight to PASV. */
+  proxy_sess = (struct proxy_session *) proxy_session_alloc(p);
+  proxy_sess->dst_pconn = pconn;
+  proxy_sess->backend_feat_flags |= PROXY_SESS_FEAT_FL_EPSV;
+
+  res = proxy_ftp_xfer_sess_init(p, proxy_sess, 0);
+  ck_assert_msg(res == 0, "Failed to init FTP data transfer session: %s",
+    strerror(errno));
+
+  proxy_sess->backend_ctrl_conn = get_backend_ctrl_conn(pasv_resp, &fd);
+
+  mark_point();
+  addr = proxy_ftp_xfer_prepare_passive(PR_CMD_EPSV_ID, cmd, "500", proxy_sess,
+    0);
+  ck_assert_msg(addr != NULL, "Failed to prepare passive transfer: %s",
+    strerror(errno));
+
+  memset(buf, '\0', sizeof(buf));
+  res = read(fd, buf, sizeof(buf)-1);
+  ck_assert_msg(res > 0, "Failed to read commands: %s", strerror(errno));
+  ck_assert_msg(strcmp(buf, "PASV\r\n") == 0, "Expected only PASV, got '%s'",
+    buf);
+
+  (void) close(fd);
+  (void) proxy_ftp_xfer_sess_free(p);
+  proxy_session_free(p, proxy_sess);
+  pr_inet_close(p, session.c);
+  session.c = NULL;
+}
+END_TEST
+
 Suite *tests_get_ftp_xfer_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -280,6 +427,7 @@ Suite *tests_get_ftp_xfer_suite(void) {
 
   tcase_add_test(testcase, prepare_active_test);
   tcase_add_test(testcase, prepare_passive_test);
+  tcase_add_test(testcase, prepare_passive_shared_flags_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
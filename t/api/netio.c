@@ -400,6 +400,241 @@ START_TEST (netio_use_test) {
 }
 END_TEST
 
+static unsigned int frontend_writes = 0, backend_writes = 0;
+
+static int frontend_write_cb(pr_netio_stream_t *nstrm, char *buf,
+    size_t buflen) {
+  frontend_writes++;
+  return write(nstrm->strm_fd, buf, buflen);
+}
+
+static int backend_write_cb(pr_netio_stream_t *nstrm, char *buf,
+    size_t buflen) {
+  backend_writes++;
+  return write(nstrm->strm_fd, buf, buflen);
+}
+
+START_TEST (netio_bind_test) {
+  int res, fds[2];
+  pr_netio_t *frontend_netio, *backend_netio;
+  pr_netio_stream_t *nstrm;
+
+  mark_point();
+  res = proxy_netio_bind(NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null stream");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  ck_assert_msg(res == 0, "Failed to create socket pair: %s", strerror(errno));
+
+  /* The NetIO registered for e.g. the frontend connection must be neither
+   * used for, nor disturbed by, I/O on our streams.
+   */
+  frontend_netio = pr_alloc_netio2(p, NULL, "testsuite.frontend");
+  frontend_netio->write = frontend_write_cb;
+  res = pr_register_netio(frontend_netio, PR_NETIO_STRM_CTRL);
+  ck_assert_msg(res == 0, "Failed to register ctrl netio: %s",
+    strerror(errno));
+
+  backend_netio = pr_alloc_netio2(p, NULL, "testsuite.backend");
+  backend_netio->write = backend_write_cb;
+  res = proxy_netio_use(PR_NETIO_STRM_CTRL, backend_netio);
+  ck_assert_msg(res == 0, "Failed to use ctrl netio: %s", strerror(errno));
+
+  frontend_writes = backend_writes = 0;
+
+  mark_point();
+  nstrm = proxy_netio_open(p, PR_NETIO_STRM_CTRL, fds[0], PR_NETIO_IO_WR);
+  ck_assert_msg(nstrm != NULL, "Failed to open ctrl stream: %s",
+    strerror(errno));
+
+  mark_point();
+  res = proxy_netio_write(nstrm, "foo", 3);
+  ck_assert_msg(res == 3, "Expected 3, got %d (%s)", res, strerror(errno));
+  ck_assert_msg(backend_writes == 1, "Expected 1 backend write, got %u",
+    backend_writes);
+  ck_assert_msg(frontend_writes == 0, "Expected 0 frontend writes, got %u",
+    frontend_writes);
+  ck_assert_msg(pr_get_netio(PR_NETIO_STRM_CTRL) == frontend_netio,
+    "Registered ctrl netio changed unexpectedly");
+
+  mark_point();
+  res = proxy_netio_printf(nstrm, "%s\r\n", "bar");
+  ck_assert_msg(res == 5, "Expected 5, got %d (%s)", res, strerror(errno));
+  ck_assert_msg(backend_writes == 2, "Expected 2 backend writes, got %u",
+    backend_writes);
+
+  /* Once bound to the core NetIO, neither test NetIO is used. */
+  mark_point();
+  res = proxy_netio_bind(nstrm, NULL);
+  ck_assert_msg(res == 0, "Failed to bind core netio: %s", strerror(errno));
+
+  res = proxy_netio_write(nstrm, "baz", 3);
+  ck_assert_msg(res == 3, "Expected 3, got %d (%s)", res, strerror(errno));
+  ck_assert_msg(backend_writes == 2, "Expected 2 backend writes, got %u",
+    backend_writes);
+  ck_assert_msg(frontend_writes == 0, "Expected 0 frontend writes, got %u",
+    frontend_writes);
+
+  (void) proxy_netio_close(nstrm);
+  (void) close(fds[1]);
+
+  /* A closed stream's binding does not linger, for any later stream. */
+  res = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  ck_assert_msg(res == 0, "Failed to create socket pair: %s", strerror(errno));
+
+  mark_point();
+  nstrm = pr_netio_open(p, PR_NETIO_STRM_CTRL, fds[0], PR_NETIO_IO_WR);
+  ck_assert_msg(nstrm != NULL, "Failed to open ctrl stream: %s",
+    strerror(errno));
+
+  res = proxy_netio_write(nstrm, "foo", 3);
+  ck_assert_msg(res == 3, "Expected 3, got %d (%s)", res, strerror(errno));
+  ck_assert_msg(backend_writes == 3, "Expected 3 backend writes, got %u",
+    backend_writes);
+
+  (void) pr_netio_close(nstrm);
+  (void) close(fds[1]);
+
+  proxy_netio_use(PR_NETIO_STRM_CTRL, NULL);
+  (void) pr_unregister_netio(PR_NETIO_STRM_CTRL);
+}
+END_TEST
+
+START_TEST (netio_bind_abort_test) {
+  int res, fds[2];
+  char buf[8];
+  pr_netio_stream_t *nstrm;
+
+  res = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  ck_assert_msg(res == 0, "Failed to create socket pair: %s", strerror(errno));
+
+  /* Data streams of an aborted transfer are neither written nor read. */
+  nstrm = proxy_netio_open(p, PR_NETIO_STRM_DATA, fds[0], PR_NETIO_IO_WR);
+  ck_assert_msg(nstrm != NULL, "Failed to open data stream: %s",
+    strerror(errno));
+  res = proxy_netio_bind(nstrm, NULL);
+  ck_assert_msg(res == 0, "Failed to bind core netio: %s", strerror(errno));
+
+  session.sf_flags |= SF_ABORT;
+
+  mark_point();
+  res = proxy_netio_write(nstrm, "foo", 3);
+  ck_assert_msg(res == -2, "Expected -2, got %d (%s)", res, strerror(errno));
+  (void) proxy_netio_close(nstrm);
+  (void) close(fds[1]);
+
+  res = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  ck_assert_msg(res == 0, "Failed to create socket pair: %s", strerror(errno));
+
+  res = write(fds[1], "bar", 3);
+  ck_assert_msg(res == 3, "Failed to write data: %s", strerror(errno));
+
+  nstrm = proxy_netio_open(p, PR_NETIO_STRM_DATA, fds[0], PR_NETIO_IO_RD);
+  ck_assert_msg(nstrm != NULL, "Failed to open data stream: %s",
+    strerror(errno));
+  res = proxy_netio_bind(nstrm, NULL);
+  ck_assert_msg(res == 0, "Failed to bind core netio: %s", strerror(errno));
+
+  mark_point();
+  res = proxy_netio_read(nstrm, buf, sizeof(buf), 1);
+  ck_assert_msg(res == 0, "Expected EOF, got %d (%s)", res, strerror(errno));
+
+  session.sf_flags &= ~SF_ABORT;
+
+  mark_point();
+  res = proxy_netio_read(nstrm, buf, sizeof(buf), 1);
+  ck_assert_msg(res == 3, "Expected 3, got %d (%s)", res, strerror(errno));
+  (void) proxy_netio_close(nstrm);
+  (void) close(fds[1]);
+
+  /* A broken pipe on the control connection aborts the transfer. */
+  res = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  ck_assert_msg(res == 0, "Failed to create socket pair: %s", strerror(errno));
+  (void) close(fds[1]);
+
+  nstrm = proxy_netio_open(p, PR_NETIO_STRM_CTRL, fds[0], PR_NETIO_IO_WR);
+  ck_assert_msg(nstrm != NULL, "Failed to open ctrl stream: %s",
+    strerror(errno));
+  res = proxy_netio_bind(nstrm, NULL);
+  ck_assert_msg(res == 0, "Failed to bind core netio: %s", strerror(errno));
+
+  (void) signal(SIGPIPE, SIG_IGN);
+  session.sf_flags |= SF_XFER;
+
+  mark_point();
+  res = proxy_netio_write(nstrm, "baz", 3);
+  ck_assert_msg(res < 0, "Wrote to closed connection unexpectedly");
+  ck_assert_msg(errno == EPIPE, "Expected EPIPE (%d), got '%s' (%d)", EPIPE,
+    strerror(errno), errno);
+  ck_assert_msg(session.sf_flags & SF_ABORT,
+    "Expected transfer to be aborted");
+
+  session.sf_flags &= ~(SF_XFER|SF_ABORT);
+  (void) proxy_netio_close(nstrm);
+}
+END_TEST
+
+START_TEST (netio_bind_benchmark_test) {
+  register unsigned int i;
+  unsigned int count = 10000;
+  int res, fds[2];
+  long unbound_usecs, bound_usecs;
+  char buf[1];
+  pr_netio_t *frontend_netio;
+  pr_netio_stream_t *nstrm;
+  struct timeval start, end;
+
+  res = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+  ck_assert_msg(res == 0, "Failed to create socket pair: %s", strerror(errno));
+
+  frontend_netio = pr_alloc_netio2(p, NULL, "testsuite.frontend");
+  res = pr_register_netio(frontend_netio, PR_NETIO_STRM_CTRL);
+  ck_assert_msg(res == 0, "Failed to register ctrl netio: %s",
+    strerror(errno));
+
+  /* An unbound stream uses the unregister/register path for every call. */
+  nstrm = pr_netio_open(p, PR_NETIO_STRM_CTRL, fds[0], PR_NETIO_IO_WR);
+  ck_assert_msg(nstrm != NULL, "Failed to open ctrl stream: %s",
+    strerror(errno));
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    res = proxy_netio_write(nstrm, "a", 1);
+    ck_assert_msg(res == 1, "Expected 1, got %d (%s)", res, strerror(errno));
+    (void) read(fds[1], buf, sizeof(buf));
+  }
+  gettimeofday(&end, NULL);
+
+  unbound_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  res = proxy_netio_bind(nstrm, NULL);
+  ck_assert_msg(res == 0, "Failed to bind core netio: %s", strerror(errno));
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    res = proxy_netio_write(nstrm, "a", 1);
+    ck_assert_msg(res == 1, "Expected 1, got %d (%s)", res, strerror(errno));
+    (void) read(fds[1], buf, sizeof(buf));
+  }
+  gettimeofday(&end, NULL);
+
+  bound_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stdout, "netio: %u writes, %ld usecs unbound, %ld usecs bound\n",
+      count, unbound_usecs, bound_usecs);
+  }
+
+  (void) proxy_netio_close(nstrm);
+  (void) close(fds[1]);
+  (void) pr_unregister_netio(PR_NETIO_STRM_CTRL);
+}
+END_TEST
+
 Suite *tests_get_netio_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -422,6 +657,9 @@ Suite *tests_get_netio_suite(void) {
 
   tcase_add_test(testcase, netio_set_test);
   tcase_add_test(testcase, netio_use_test);
+  tcase_add_test(testcase, netio_bind_test);
+  tcase_add_test(testcase, netio_bind_abort_test);
+  tcase_add_test(testcase, netio_bind_benchmark_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
@@ -97,6 +97,139 @@ START_TEST (random_next_range_1000_test) {
 }
 END_TEST
 
+START_TEST (random_next_invalid_range_test) {
+  long num;
+
+  num = proxy_random_next(5, 4);
+  ck_assert_msg(num == -1, "Expected -1 for invalid range, got %ld", num);
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  num = proxy_random_next(7, 7);
+  ck_assert_msg(num == 7, "Expected 7 for single-value range, got %ld", num);
+}
+END_TEST
+
+START_TEST (random_seed_test) {
+  register unsigned int i;
+  long nums[32];
+
+  proxy_random_seed(1);
+  for (i = 0; i < 32; i++) {
+    nums[i] = proxy_random_next(0, 1000000);
+  }
+
+  /* The same seed yields the same sequence. */
+  proxy_random_seed(1);
+  for (i = 0; i < 32; i++) {
+    long num;
+
+    num = proxy_random_next(0, 1000000);
+    ck_assert_msg(num == nums[i], "Expected %ld for draw #%u, got %ld",
+      nums[i], i+1, num);
+  }
+}
+END_TEST
+
+START_TEST (random_next_chi_square_test) {
+  register unsigned int i;
+  unsigned int count = 7, rounds = 70000, seen[7];
+  double chi_square = 0.0, expected;
+
+  /* A fixed seed keeps this test deterministic. */
+  proxy_random_seed(42);
+
+  memset(seen, 0, sizeof(seen));
+  for (i = 0; i < rounds; i++) {
+    long num;
+
+    num = proxy_random_next(0, count-1);
+    ck_assert_msg(num >= 0 && num < (long) count,
+      "random number %ld out of range", num);
+    seen[num]++;
+  }
+
+  expected = (double) rounds / count;
+  for (i = 0; i < count; i++) {
+    double diff;
+
+    diff = (double) seen[i] - expected;
+    chi_square += (diff * diff) / expected;
+  }
+
+  /* The critical value for 6 degrees of freedom, at p = 0.001, is 22.46. */
+  ck_assert_msg(chi_square < 22.46,
+    "Chi-square statistic %f too high for uniform distribution", chi_square);
+}
+END_TEST
+
+START_TEST (random_shuffle_test) {
+  register unsigned int i;
+  int res, count = 10, seen[10], moved = 0;
+  array_header *list;
+
+  res = proxy_random_shuffle(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null list");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  list = make_array(p, count, sizeof(int));
+  for (i = 0; i < (unsigned int) count; i++) {
+    *((int *) push_array(list)) = i;
+  }
+
+  proxy_random_seed(7);
+
+  res = proxy_random_shuffle(list);
+  ck_assert_msg(res == 0, "Failed to shuffle list: %s", strerror(errno));
+  ck_assert_msg(list->nelts == count, "Expected %d elements, got %d", count,
+    list->nelts);
+
+  /* Every element appears exactly once. */
+  memset(seen, 0, sizeof(seen));
+  for (i = 0; i < (unsigned int) count; i++) {
+    int elt;
+
+    elt = ((int *) list->elts)[i];
+    ck_assert_msg(elt >= 0 && elt < count, "Unexpected element %d", elt);
+    seen[elt]++;
+
+    if (elt != (int) i) {
+      moved++;
+    }
+  }
+
+  for (i = 0; i < (unsigned int) count; i++) {
+    ck_assert_msg(seen[i] == 1, "Expected element %u once, saw it %d times",
+      i, seen[i]);
+  }
+
+  ck_assert_msg(moved > 0, "Shuffled list is unchanged");
+}
+END_TEST
+
+START_TEST (random_next_benchmark_test) {
+  register unsigned int i;
+  unsigned int count = 1000000;
+  struct timeval start, end;
+  long sum = 0, usecs;
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    sum += proxy_random_next(0, 6);
+  }
+  gettimeofday(&end, NULL);
+
+  usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stdout, "random: %u draws in %ld usecs (sum %ld)\n", count, usecs,
+      sum);
+  }
+}
+END_TEST
+
 Suite *tests_get_random_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -109,6 +242,11 @@ Suite *tests_get_random_suite(void) {
 
   tcase_add_test(testcase, random_next_range_10_test);
   tcase_add_test(testcase, random_next_range_1000_test);
+  tcase_add_test(testcase, random_next_invalid_range_test);
+  tcase_add_test(testcase, random_seed_test);
+  tcase_add_test(testcase, random_next_chi_square_test);
+  tcase_add_test(testcase, random_shuffle_test);
+  tcase_add_test(testcase, random_next_benchmark_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
@@ -72,6 +72,7 @@ static void tear_down(void) {
     pr_trace_set_levels("proxy.session", 0, 0);
   }
 
+  (void) proxy_session_set_current(NULL);
   pr_parser_cleanup();
   pr_inet_clear();
 
@@ -234,6 +235,142 @@ START_TEST (session_setup_env_test) {
 }
 END_TEST
 
+START_TEST (session_current_test) {
+  const struct proxy_session *proxy_sess, *res_sess;
+  struct proxy_session_ctx *sess_ctx;
+  const void *note;
+  int res;
+
+  res_sess = proxy_session_get_current();
+  ck_assert_msg(res_sess == NULL, "Unexpectedly found current session");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got '%s' (%d)", ENOENT,
+    strerror(errno), errno);
+
+  sess_ctx = proxy_session_get_ctx();
+  ck_assert_msg(sess_ctx != NULL, "Failed to get session context");
+  ck_assert_msg(sess_ctx->proxy_sess == NULL,
+    "Expected no session in context");
+
+  session.notes = pr_table_alloc(p, 0);
+
+  proxy_sess = proxy_session_alloc(p);
+  ck_assert_msg(proxy_sess != NULL, "Failed to allocate proxy session: %s",
+    strerror(errno));
+
+  res = proxy_session_set_current(proxy_sess);
+  ck_assert_msg(res == 0, "Failed to set current session: %s",
+    strerror(errno));
+
+  res_sess = proxy_session_get_current();
+  ck_assert_msg(res_sess == proxy_sess, "Expected session %p, got %p",
+    proxy_sess, res_sess);
+  ck_assert_msg(proxy_session_get_ctx()->proxy_sess == proxy_sess,
+    "Expected session %p in context", proxy_sess);
+
+  /* The session note mirrors the context. */
+  note = pr_table_get(session.notes, PROXY_SESSION_NOTE_KEY, NULL);
+  ck_assert_msg(note == proxy_sess, "Expected note %p, got %p", proxy_sess,
+    note);
+
+  /* Setting it again replaces the note, rather than failing. */
+  res = proxy_session_set_current(proxy_sess);
+  ck_assert_msg(res == 0, "Failed to set current session: %s",
+    strerror(errno));
+
+  res = proxy_session_set_current(NULL);
+  ck_assert_msg(res == 0, "Failed to clear current session: %s",
+    strerror(errno));
+
+  res_sess = proxy_session_get_current();
+  ck_assert_msg(res_sess == NULL, "Unexpectedly found current session");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got '%s' (%d)", ENOENT,
+    strerror(errno), errno);
+
+  note = pr_table_get(session.notes, PROXY_SESSION_NOTE_KEY, NULL);
+  ck_assert_msg(note == NULL, "Expected no session note, got %p", note);
+
+  /* A session stashed only in the notes is still found. */
+  res = pr_table_add(session.notes, PROXY_SESSION_NOTE_KEY,
+    (void *) proxy_sess, sizeof(struct proxy_session));
+  ck_assert_msg(res == 0, "Failed to add session note: %s", strerror(errno));
+
+  res_sess = proxy_session_get_current();
+  ck_assert_msg(res_sess == proxy_sess, "Expected session %p, got %p",
+    proxy_sess, res_sess);
+  (void) pr_table_remove(session.notes, PROXY_SESSION_NOTE_KEY, NULL);
+
+  /* Freeing the current session clears it. */
+  res = proxy_session_set_current(proxy_sess);
+  ck_assert_msg(res == 0, "Failed to set current session: %s",
+    strerror(errno));
+
+  mark_point();
+  proxy_session_free(p, proxy_sess);
+
+  ck_assert_msg(proxy_session_get_ctx()->proxy_sess == NULL,
+    "Expected no session in context after free");
+  note = pr_table_get(session.notes, PROXY_SESSION_NOTE_KEY, NULL);
+  ck_assert_msg(note == NULL, "Expected no session note, got %p", note);
+}
+END_TEST
+
+START_TEST (session_current_benchmark_test) {
+  register unsigned int i;
+  unsigned int count = 1000000, nfound = 0;
+  const struct proxy_session *proxy_sess;
+  struct timeval start, end;
+  long notes_usecs, ctx_usecs;
+  int res;
+
+  session.notes = pr_table_alloc(p, 0);
+
+  /* Populate the notes table the way a typical session would. */
+  (void) pr_table_add_dup(session.notes, "mod_auth.orig-user", "test", 0);
+  (void) pr_table_add_dup(session.notes, "mod_proxy.backend-ip", "127.0.0.1",
+    0);
+  (void) pr_table_add_dup(session.notes, "mod_proxy.backend-port", "21", 0);
+  (void) pr_table_add_dup(session.notes, "mod_core.xfer", "", 0);
+
+  proxy_sess = proxy_session_alloc(p);
+  res = proxy_session_set_current(proxy_sess);
+  ck_assert_msg(res == 0, "Failed to set current session: %s",
+    strerror(errno));
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    if (pr_table_get(session.notes, PROXY_SESSION_NOTE_KEY, NULL) != NULL) {
+      nfound++;
+    }
+  }
+  gettimeofday(&end, NULL);
+
+  notes_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    if (proxy_session_get_current() != NULL) {
+      nfound++;
+    }
+  }
+  gettimeofday(&end, NULL);
+
+  ctx_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  ck_assert_msg(nfound == count * 2, "Expected %u sessions found, got %u",
+    count * 2, nfound);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stdout, "session: %u lookups removed: session.notes %ld usecs, "
+      "session context %ld usecs\n", count, notes_usecs, ctx_usecs);
+  }
+
+  mark_point();
+  proxy_session_free(p, proxy_sess);
+}
+END_TEST
+
 Suite *tests_get_session_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -248,6 +385,8 @@ Suite *tests_get_session_suite(void) {
   tcase_add_test(testcase, session_reset_dataxfer_test);
   tcase_add_test(testcase, session_check_password_test);
   tcase_add_test(testcase, session_setup_env_test);
+  tcase_add_test(testcase, session_current_test);
+  tcase_add_test(testcase, session_current_benchmark_test);
 
   suite_add_tcase(suite, testcase);
   return suite;
@@ -0,0 +1,297 @@
+/*
+ * ProFTPD - mod_proxy testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+
+/* Socket options API tests. */
+
+#include "tests.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.sockopts", 1, 20);
+  }
+}
+
+static void tear_down(void) {
+  (void) proxy_sockopts_free();
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.sockopts", 0, 0);
+  }
+
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+START_TEST (sockopts_get_role_test) {
+  int role;
+  const char *name;
+
+  mark_point();
+  role = proxy_sockopts_get_role(NULL);
+  ck_assert_msg(role < 0, "Failed to handle null name");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  role = proxy_sockopts_get_role("foo");
+  ck_assert_msg(role < 0, "Failed to handle unknown name");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  mark_point();
+  role = proxy_sockopts_get_role("Backend-Data");
+  ck_assert_msg(role == PROXY_SOCKOPTS_ROLE_BACKEND_DATA,
+    "Expected role %d, got %d", PROXY_SOCKOPTS_ROLE_BACKEND_DATA, role);
+
+  mark_point();
+  name = proxy_sockopts_get_role_name(-1);
+  ck_assert_msg(name == NULL, "Failed to handle invalid role");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  name = proxy_sockopts_get_role_name(PROXY_SOCKOPTS_ROLE_SSH);
+  ck_assert_msg(name != NULL, "Failed to get role name: %s", strerror(errno));
+  ck_assert_msg(strcmp(name, "ssh") == 0, "Expected 'ssh', got '%s'", name);
+}
+END_TEST
+
+START_TEST (sockopts_parse_test) {
+  int res;
+  struct proxy_sockopts opts;
+  const char *bad_text = NULL;
+  char *argv[8];
+
+  mark_point();
+  res = proxy_sockopts_parse(NULL, NULL, 0, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  proxy_sockopts_clear(&opts);
+
+  mark_point();
+  argv[0] = "Foo";
+  argv[1] = "on";
+  res = proxy_sockopts_parse(p, &opts, 2, argv, &bad_text);
+  ck_assert_msg(res < 0, "Failed to handle unknown option");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+  ck_assert_msg(bad_text != NULL && strcmp(bad_text, "Foo") == 0,
+    "Expected bad text 'Foo', got '%s'", bad_text);
+
+  mark_point();
+  argv[0] = "NoDelay";
+  res = proxy_sockopts_parse(p, &opts, 1, argv, &bad_text);
+  ck_assert_msg(res < 0, "Failed to handle missing value");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  argv[0] = "DSCP";
+  argv[1] = "64";
+  res = proxy_sockopts_parse(p, &opts, 2, argv, &bad_text);
+  ck_assert_msg(res < 0, "Failed to handle out-of-range DSCP");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+  ck_assert_msg(bad_text != NULL && strcmp(bad_text, "64") == 0,
+    "Expected bad text '64', got '%s'", bad_text);
+
+  mark_point();
+  argv[0] = "CongestionControl";
+  argv[1] = "abcdefghijklmnopqrstuvwxyz";
+  res = proxy_sockopts_parse(p, &opts, 2, argv, &bad_text);
+  ck_assert_msg(res < 0, "Failed to handle too-long algorithm name");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  proxy_sockopts_clear(&opts);
+  argv[0] = "latency";
+  argv[1] = "DSCP";
+  argv[2] = "AF41";
+  argv[3] = "UserTimeout";
+  argv[4] = "30000";
+  argv[5] = "CongestionControl";
+  argv[6] = "cubic";
+  res = proxy_sockopts_parse(p, &opts, 7, argv, &bad_text);
+  ck_assert_msg(res == 0, "Failed to parse options: %s", strerror(errno));
+  ck_assert_msg(opts.nodelay == TRUE, "Expected NoDelay on");
+  ck_assert_msg(opts.quickack == TRUE, "Expected QuickAck on");
+  ck_assert_msg(opts.dscp == 34, "Expected DSCP 34, got %d", opts.dscp);
+  ck_assert_msg(opts.user_timeout == 30000,
+    "Expected UserTimeout 30000, got %d", opts.user_timeout);
+  ck_assert_msg(opts.congestion != NULL &&
+    strcmp(opts.congestion, "cubic") == 0, "Expected 'cubic', got '%s'",
+    opts.congestion);
+  ck_assert_msg(opts.busy_poll == -1, "Expected unset BusyPoll, got %d",
+    opts.busy_poll);
+
+  mark_point();
+  proxy_sockopts_clear(&opts);
+  argv[0] = "throughput";
+  argv[1] = "DSCP";
+  argv[2] = "EF";
+  argv[3] = "NoDelay";
+  argv[4] = "on";
+  res = proxy_sockopts_parse(p, &opts, 5, argv, &bad_text);
+  ck_assert_msg(res == 0, "Failed to parse options: %s", strerror(errno));
+  ck_assert_msg(opts.nodelay == TRUE, "Expected NoDelay on");
+  ck_assert_msg(opts.quickack == FALSE, "Expected QuickAck off");
+  ck_assert_msg(opts.dscp == 46, "Expected DSCP 46, got %d", opts.dscp);
+}
+END_TEST
+
+START_TEST (sockopts_profile_test) {
+  int res;
+  struct proxy_sockopts opts;
+  const struct proxy_sockopts *profile;
+
+  mark_point();
+  res = proxy_sockopts_set_profile(-1, NULL);
+  ck_assert_msg(res < 0, "Failed to handle invalid role");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  profile = proxy_sockopts_get_profile(PROXY_SOCKOPTS_ROLE_BACKEND_CTRL);
+  ck_assert_msg(profile == NULL, "Failed to handle unconfigured role");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  proxy_sockopts_clear(&opts);
+  opts.busy_poll = 50;
+
+  mark_point();
+  res = proxy_sockopts_set_profile(PROXY_SOCKOPTS_ROLE_BACKEND_CTRL, &opts);
+  ck_assert_msg(res == 0, "Failed to set profile: %s", strerror(errno));
+
+  profile = proxy_sockopts_get_profile(PROXY_SOCKOPTS_ROLE_BACKEND_CTRL);
+  ck_assert_msg(profile != NULL, "Failed to get profile: %s", strerror(errno));
+  ck_assert_msg(profile->busy_poll == 50, "Expected BusyPoll 50, got %d",
+    profile->busy_poll);
+
+  mark_point();
+  res = proxy_sockopts_set_profile(PROXY_SOCKOPTS_ROLE_BACKEND_CTRL, NULL);
+  ck_assert_msg(res == 0, "Failed to clear profile: %s", strerror(errno));
+
+  profile = proxy_sockopts_get_profile(PROXY_SOCKOPTS_ROLE_BACKEND_CTRL);
+  ck_assert_msg(profile == NULL, "Failed to clear profile");
+}
+END_TEST
+
+START_TEST (sockopts_apply_test) {
+  int fd, res, val;
+  socklen_t len;
+  struct proxy_sockopts opts;
+
+  mark_point();
+  res = proxy_sockopts_apply(-1, PROXY_SOCKOPTS_ROLE_BACKEND_DATA);
+  ck_assert_msg(res < 0, "Failed to handle invalid fd");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_sockopts_apply_conn(NULL, PROXY_SOCKOPTS_ROLE_BACKEND_DATA);
+  ck_assert_msg(res < 0, "Failed to handle null conn");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  ck_assert_msg(fd >= 0, "Failed to create socket: %s", strerror(errno));
+
+  /* Without a configured profile, nothing changes. */
+  mark_point();
+  res = proxy_sockopts_apply(fd, PROXY_SOCKOPTS_ROLE_BACKEND_DATA);
+  ck_assert_msg(res == 0, "Failed to apply options: %s", strerror(errno));
+
+  val = -1;
+  len = sizeof(val);
+  res = getsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *) &val, &len);
+  ck_assert_msg(res == 0, "Failed to get TCP_NODELAY: %s", strerror(errno));
+  ck_assert_msg(val == 0, "Expected TCP_NODELAY 0, got %d", val);
+
+  proxy_sockopts_clear(&opts);
+  opts.nodelay = TRUE;
+  opts.user_timeout = 15000;
+  opts.dscp = 10;
+  (void) proxy_sockopts_set_profile(PROXY_SOCKOPTS_ROLE_BACKEND_DATA, &opts);
+
+  mark_point();
+  res = proxy_sockopts_apply(fd, PROXY_SOCKOPTS_ROLE_BACKEND_DATA);
+  ck_assert_msg(res == 0, "Failed to apply options: %s", strerror(errno));
+
+  val = -1;
+  len = sizeof(val);
+  res = getsockopt(fd, IPPROTO_TCP, TCP_NODELAY, (void *) &val, &len);
+  ck_assert_msg(res == 0, "Failed to get TCP_NODELAY: %s", strerror(errno));
+  ck_assert_msg(val != 0, "Expected TCP_NODELAY to be set");
+
+#if defined(TCP_USER_TIMEOUT)
+  val = -1;
+  len = sizeof(val);
+  res = getsockopt(fd, IPPROTO_TCP, TCP_USER_TIMEOUT, (void *) &val, &len);
+  ck_assert_msg(res == 0, "Failed to get TCP_USER_TIMEOUT: %s",
+    strerror(errno));
+  ck_assert_msg(val == 15000, "Expected TCP_USER_TIMEOUT 15000, got %d", val);
+#endif /* TCP_USER_TIMEOUT */
+
+#if defined(IP_TOS)
+  val = -1;
+  len = sizeof(val);
+  res = getsockopt(fd, IPPROTO_IP, IP_TOS, (void *) &val, &len);
+  ck_assert_msg(res == 0, "Failed to get IP_TOS: %s", strerror(errno));
+  ck_assert_msg(val == (10 << 2), "Expected IP_TOS %d, got %d", 10 << 2, val);
+#endif /* IP_TOS */
+
+  (void) close(fd);
+}
+END_TEST
+
+Suite *tests_get_sockopts_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("sockopts");
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, sockopts_get_role_test);
+  tcase_add_test(testcase, sockopts_parse_test);
+  tcase_add_test(testcase, sockopts_profile_test);
+  tcase_add_test(testcase, sockopts_apply_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
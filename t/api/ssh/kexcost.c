@@ -0,0 +1,210 @@
+/*
+ * ProFTPD - mod_proxy testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* SSH KEX cost API tests. */
+
+#include "../tests.h"
+
+static pool *p = NULL;
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.ssh.kexcost", 1, 20);
+  }
+}
+
+static void tear_down(void) {
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.ssh.kexcost", 0, 0);
+  }
+
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+static array_header *make_costs(pool *cost_pool) {
+  return make_array(cost_pool, 0, sizeof(struct proxy_ssh_kexcost *));
+}
+
+static void add_cost(array_header *costs, const char *algo,
+    unsigned long wall_usecs, unsigned long cpu_usecs) {
+  struct proxy_ssh_kexcost *cost;
+
+  cost = pcalloc(p, sizeof(struct proxy_ssh_kexcost));
+  cost->algo = algo;
+  cost->wall_usecs = wall_usecs;
+  cost->cpu_usecs = cpu_usecs;
+  cost->count = 1;
+
+  *((struct proxy_ssh_kexcost **) push_array(costs)) = cost;
+}
+
+START_TEST (kexcost_get_security_bits_test) {
+  int res;
+
+  mark_point();
+  res = proxy_ssh_kexcost_get_security_bits(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null algo");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ssh_kexcost_get_security_bits("ext-info-c");
+  ck_assert_msg(res < 0, "Failed to handle unknown algo");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ssh_kexcost_get_security_bits("curve25519-sha256");
+  ck_assert_msg(res == 128, "Expected 128, got %d", res);
+
+  mark_point();
+  res = proxy_ssh_kexcost_get_security_bits("diffie-hellman-group14-sha1");
+  ck_assert_msg(res == 80, "Expected 80, got %d", res);
+}
+END_TEST
+
+START_TEST (kexcost_update_test) {
+  int res;
+  struct proxy_ssh_kexcost cost;
+
+  mark_point();
+  res = proxy_ssh_kexcost_update(NULL, 0, 0);
+  ck_assert_msg(res < 0, "Failed to handle null cost");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  memset(&cost, 0, sizeof(cost));
+  cost.algo = "curve25519-sha256";
+
+  mark_point();
+  res = proxy_ssh_kexcost_update(&cost, 1000, 400);
+  ck_assert_msg(res == 0, "Failed to update cost: %s", strerror(errno));
+  ck_assert_msg(cost.count == 1, "Expected count 1, got %u", cost.count);
+  ck_assert_msg(cost.wall_usecs == 1000, "Expected wall 1000, got %lu",
+    cost.wall_usecs);
+  ck_assert_msg(cost.cpu_usecs == 400, "Expected CPU 400, got %lu",
+    cost.cpu_usecs);
+
+  mark_point();
+  res = proxy_ssh_kexcost_update(&cost, 3000, 200);
+  ck_assert_msg(res == 0, "Failed to update cost: %s", strerror(errno));
+  ck_assert_msg(cost.count == 2, "Expected count 2, got %u", cost.count);
+  ck_assert_msg(cost.wall_usecs == 2000, "Expected wall 2000, got %lu",
+    cost.wall_usecs);
+  ck_assert_msg(cost.cpu_usecs == 300, "Expected CPU 300, got %lu",
+    cost.cpu_usecs);
+}
+END_TEST
+
+START_TEST (kexcost_reorder_test) {
+  const char *algos, *res, *expected;
+  array_header *costs;
+
+  mark_point();
+  res = proxy_ssh_kexcost_reorder(NULL, NULL, NULL, 0);
+  ck_assert_msg(res == NULL, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ssh_kexcost_reorder(p, NULL, NULL, 0);
+  ck_assert_msg(res == NULL, "Failed to handle null algos");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got %s (%d)", EINVAL,
+    strerror(errno), errno);
+
+  algos = "diffie-hellman-group16-sha512,curve25519-sha256,ecdh-sha2-nistp256,diffie-hellman-group14-sha1,ext-info-c";
+
+  /* With no recorded costs, the configured order is preserved. */
+  mark_point();
+  res = proxy_ssh_kexcost_reorder(p, algos, NULL, 112);
+  ck_assert_msg(res != NULL, "Failed to reorder '%s': %s", algos,
+    strerror(errno));
+  ck_assert_msg(strcmp(res, algos) == 0, "Expected '%s', got '%s'", algos,
+    res);
+
+  /* The cheapest measured algorithms are promoted, but unmeasured ones are
+   * offered first.
+   */
+  costs = make_costs(p);
+  add_cost(costs, "diffie-hellman-group16-sha512", 90000, 60000);
+  add_cost(costs, "curve25519-sha256", 4000, 300);
+
+  mark_point();
+  res = proxy_ssh_kexcost_reorder(p, algos, costs, 112);
+  expected = "ecdh-sha2-nistp256,curve25519-sha256,diffie-hellman-group16-sha512,diffie-hellman-group14-sha1,ext-info-c";
+  ck_assert_msg(res != NULL, "Failed to reorder '%s': %s", algos,
+    strerror(errno));
+  ck_assert_msg(strcmp(res, expected) == 0, "Expected '%s', got '%s'",
+    expected, res);
+
+  /* A cheap algorithm below the security floor is never promoted. */
+  add_cost(costs, "ecdh-sha2-nistp256", 5000, 500);
+  add_cost(costs, "diffie-hellman-group14-sha1", 1000, 100);
+
+  mark_point();
+  res = proxy_ssh_kexcost_reorder(p, algos, costs, 112);
+  expected = "curve25519-sha256,ecdh-sha2-nistp256,diffie-hellman-group16-sha512,diffie-hellman-group14-sha1,ext-info-c";
+  ck_assert_msg(res != NULL, "Failed to reorder '%s': %s", algos,
+    strerror(errno));
+  ck_assert_msg(strcmp(res, expected) == 0, "Expected '%s', got '%s'",
+    expected, res);
+
+  /* With a floor above all of these, the configured order is kept. */
+  mark_point();
+  res = proxy_ssh_kexcost_reorder(p, algos, costs, 192);
+  expected = "diffie-hellman-group16-sha512,curve25519-sha256,ecdh-sha2-nistp256,diffie-hellman-group14-sha1,ext-info-c";
+  ck_assert_msg(res != NULL, "Failed to reorder '%s': %s", algos,
+    strerror(errno));
+  ck_assert_msg(strcmp(res, expected) == 0, "Expected '%s', got '%s'",
+    expected, res);
+
+  mark_point();
+  proxy_ssh_kexcost_dump("sftp://127.0.0.1:22", costs);
+}
+END_TEST
+
+Suite *tests_get_ssh_kexcost_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("ssh.kexcost");
+
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, kexcost_get_security_bits_test);
+  tcase_add_test(testcase, kexcost_update_test);
+  tcase_add_test(testcase, kexcost_reorder_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
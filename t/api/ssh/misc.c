@@ -0,0 +1,330 @@
+/*
+ * ProFTPD - mod_proxy testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* SSH misc API tests. */
+
+#include "../tests.h"
+
+static pool *p = NULL;
+
+#if defined(PR_USE_OPENSSL)
+/* Typical KEXINIT name-lists, as we would send and a server might send. */
+static const char *client_kex_algos =
+  "curve25519-sha256,curve25519-sha256@libssh.org,ecdh-sha2-nistp256,"
+  "ecdh-sha2-nistp384,ecdh-sha2-nistp521,diffie-hellman-group-exchange-sha256,"
+  "diffie-hellman-group16-sha512,diffie-hellman-group18-sha512,"
+  "diffie-hellman-group14-sha256,diffie-hellman-group14-sha1,ext-info-c,"
+  "kex-strict-c-v00@openssh.com";
+static const char *server_kex_algos =
+  "sntrup761x25519-sha512@openssh.com,mlkem768x25519-sha256,"
+  "ecdh-sha2-nistp521,ecdh-sha2-nistp384,ecdh-sha2-nistp256,"
+  "diffie-hellman-group14-sha256,ext-info-s,kex-strict-s-v00@openssh.com";
+
+static const char *client_ciphers =
+  "aes256-ctr,aes192-ctr,aes128-ctr,aes256-gcm@openssh.com,"
+  "aes128-gcm@openssh.com,aes256-cbc,aes192-cbc,aes128-cbc,3des-cbc";
+static const char *server_ciphers =
+  "chacha20-poly1305@openssh.com,aes128-gcm@openssh.com,"
+  "aes256-gcm@openssh.com,aes128-ctr,aes192-ctr,aes256-ctr";
+#endif /* PR_USE_OPENSSL */
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+#if defined(PR_USE_OPENSSL)
+START_TEST (namelist_contains_test) {
+  int res;
+
+  mark_point();
+  res = proxy_ssh_misc_namelist_contains(p, NULL, NULL);
+  ck_assert_msg(res == FALSE, "Failed to handle null arguments");
+
+  res = proxy_ssh_misc_namelist_contains(p, "", "foo");
+  ck_assert_msg(res == FALSE, "Failed to handle empty name-list");
+
+  res = proxy_ssh_misc_namelist_contains(p, "foo,bar,baz", "bar");
+  ck_assert_msg(res == TRUE, "Expected 'bar' in name-list");
+
+  res = proxy_ssh_misc_namelist_contains(p, "foo,bar,baz", "baz");
+  ck_assert_msg(res == TRUE, "Expected 'baz' in name-list");
+
+  res = proxy_ssh_misc_namelist_contains(p, "foo,bar,baz", "ba");
+  ck_assert_msg(res == FALSE, "Unexpectedly matched prefix 'ba'");
+
+  res = proxy_ssh_misc_namelist_contains(p, "foo,bar,baz", "bazz");
+  ck_assert_msg(res == FALSE, "Unexpectedly matched 'bazz'");
+
+  res = proxy_ssh_misc_namelist_contains(p, server_kex_algos,
+    "kex-strict-s-v00@openssh.com");
+  ck_assert_msg(res == TRUE, "Expected strict KEX in name-list");
+}
+END_TEST
+
+START_TEST (namelist_shared_test) {
+  const char *res;
+
+  mark_point();
+  res = proxy_ssh_misc_namelist_shared(p, NULL, NULL);
+  ck_assert_msg(res == NULL, "Failed to handle null arguments");
+
+  res = proxy_ssh_misc_namelist_shared(p, "foo,bar", "baz,quxx");
+  ck_assert_msg(res == NULL, "Expected no shared name, got '%s'", res);
+
+  /* The client's order decides. */
+  res = proxy_ssh_misc_namelist_shared(p, "foo,bar,baz", "baz,bar");
+  ck_assert_msg(res != NULL, "Expected shared name");
+  ck_assert_msg(strcmp(res, "bar") == 0, "Expected 'bar', got '%s'", res);
+
+  res = proxy_ssh_misc_namelist_shared(p, ",foo", ",foo");
+  ck_assert_msg(res != NULL, "Expected shared name");
+  ck_assert_msg(strcmp(res, "foo") == 0, "Expected 'foo', got '%s'", res);
+
+  res = proxy_ssh_misc_namelist_shared(p, client_kex_algos, server_kex_algos);
+  ck_assert_msg(res != NULL, "Expected shared name");
+  ck_assert_msg(strcmp(res, "ecdh-sha2-nistp256") == 0,
+    "Expected 'ecdh-sha2-nistp256', got '%s'", res);
+}
+END_TEST
+
+START_TEST (namelist_compile_test) {
+  struct proxy_ssh_namelist *list;
+
+  mark_point();
+  list = proxy_ssh_misc_namelist_compile(NULL, NULL);
+  ck_assert_msg(list == NULL, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  list = proxy_ssh_misc_namelist_compile(p, NULL);
+  ck_assert_msg(list == NULL, "Failed to handle null names");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  list = proxy_ssh_misc_namelist_compile(p, "");
+  ck_assert_msg(list != NULL, "Failed to compile empty names: %s",
+    strerror(errno));
+  ck_assert_msg(list->count == 0, "Expected 0 names, got %u", list->count);
+
+  /* Empty and duplicate names are skipped. */
+  mark_point();
+  list = proxy_ssh_misc_namelist_compile(p, "foo,,bar,foo,baz,");
+  ck_assert_msg(list != NULL, "Failed to compile names: %s", strerror(errno));
+  ck_assert_msg(list->count == 3, "Expected 3 names, got %u", list->count);
+  ck_assert_msg(strcmp(list->elts[0], "foo") == 0, "Expected 'foo', got '%s'",
+    list->elts[0]);
+  ck_assert_msg(strcmp(list->elts[1], "bar") == 0, "Expected 'bar', got '%s'",
+    list->elts[1]);
+  ck_assert_msg(strcmp(list->elts[2], "baz") == 0, "Expected 'baz', got '%s'",
+    list->elts[2]);
+  ck_assert_msg(strcmp(list->names, "foo,,bar,foo,baz,") == 0,
+    "Expected original names, got '%s'", list->names);
+
+  mark_point();
+  list = proxy_ssh_misc_namelist_compile(p, client_kex_algos);
+  ck_assert_msg(list != NULL, "Failed to compile names: %s", strerror(errno));
+  ck_assert_msg(list->count == 12, "Expected 12 names, got %u", list->count);
+  ck_assert_msg(list->idsz >= list->count * 2,
+    "Expected table size of at least %u, got %u", list->count * 2, list->idsz);
+}
+END_TEST
+
+START_TEST (namelist_get_id_test) {
+  int res;
+  struct proxy_ssh_namelist *list;
+
+  mark_point();
+  res = proxy_ssh_misc_namelist_get_id(NULL, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null list");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  list = proxy_ssh_misc_namelist_compile(p, client_ciphers);
+  ck_assert_msg(list != NULL, "Failed to compile names: %s", strerror(errno));
+
+  mark_point();
+  res = proxy_ssh_misc_namelist_get_id(list, NULL, 0);
+  ck_assert_msg(res < 0, "Failed to handle null name");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ssh_misc_namelist_get_id(list, "aes256-ctr", 10);
+  ck_assert_msg(res == 0, "Expected ID 0, got %d", res);
+
+  res = proxy_ssh_misc_namelist_get_id(list, "3des-cbc", 8);
+  ck_assert_msg(res == 8, "Expected ID 8, got %d", res);
+
+  /* Only the given length of the name is used. */
+  res = proxy_ssh_misc_namelist_get_id(list, "aes128-cbc,3des-cbc", 10);
+  ck_assert_msg(res == 7, "Expected ID 7, got %d", res);
+
+  res = proxy_ssh_misc_namelist_get_id(list, "aes256", 6);
+  ck_assert_msg(res < 0, "Unexpectedly matched prefix 'aes256'");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got '%s' (%d)", ENOENT,
+    strerror(errno), errno);
+
+  res = proxy_ssh_misc_namelist_get_id(list,
+    "chacha20-poly1305@openssh.com", 29);
+  ck_assert_msg(res < 0, "Unexpectedly matched 'chacha20-poly1305'");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got '%s' (%d)", ENOENT,
+    strerror(errno), errno);
+}
+END_TEST
+
+START_TEST (namelist_negotiate_test) {
+  int res;
+  struct proxy_ssh_namelist *list;
+
+  mark_point();
+  res = proxy_ssh_misc_namelist_negotiate(NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null list");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  list = proxy_ssh_misc_namelist_compile(p, client_ciphers);
+  ck_assert_msg(list != NULL, "Failed to compile names: %s", strerror(errno));
+
+  mark_point();
+  res = proxy_ssh_misc_namelist_negotiate(list, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null names");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ssh_misc_namelist_negotiate(list, "");
+  ck_assert_msg(res < 0, "Unexpectedly negotiated empty names");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got '%s' (%d)", ENOENT,
+    strerror(errno), errno);
+
+  res = proxy_ssh_misc_namelist_negotiate(list,
+    "chacha20-poly1305@openssh.com,aes256,,des");
+  ck_assert_msg(res < 0, "Unexpectedly negotiated unshared names");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got '%s' (%d)", ENOENT,
+    strerror(errno), errno);
+
+  /* Our order decides, not the server's. */
+  res = proxy_ssh_misc_namelist_negotiate(list, server_ciphers);
+  ck_assert_msg(res == 0, "Expected ID 0, got %d", res);
+  ck_assert_msg(strcmp(list->elts[res], "aes256-ctr") == 0,
+    "Expected 'aes256-ctr', got '%s'", list->elts[res]);
+
+  res = proxy_ssh_misc_namelist_negotiate(list,
+    "3des-cbc,aes128-gcm@openssh.com");
+  ck_assert_msg(res == 4, "Expected ID 4, got %d", res);
+
+  /* Negotiating must agree with the uncompiled shared lookup. */
+  list = proxy_ssh_misc_namelist_compile(p, client_kex_algos);
+  ck_assert_msg(list != NULL, "Failed to compile names: %s", strerror(errno));
+
+  res = proxy_ssh_misc_namelist_negotiate(list, server_kex_algos);
+  ck_assert_msg(res >= 0, "Failed to negotiate names: %s", strerror(errno));
+  ck_assert_msg(strcmp(list->elts[res],
+    proxy_ssh_misc_namelist_shared(p, client_kex_algos, server_kex_algos)) == 0,
+    "Negotiated '%s' does not match shared name", list->elts[res]);
+}
+END_TEST
+
+START_TEST (namelist_benchmark_test) {
+  register unsigned int i;
+  unsigned int count = 100000;
+  struct timeval start, end;
+  long shared_usecs, negotiate_usecs;
+  struct proxy_ssh_namelist *kex_list, *cipher_list;
+  pool *tmp_pool;
+
+  /* Simulate the name-list negotiations of many KEXINITs, first by scanning
+   * both lists each time, then using our lists compiled once.
+   */
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    tmp_pool = make_sub_pool(p);
+    (void) proxy_ssh_misc_namelist_shared(tmp_pool, client_kex_algos,
+      server_kex_algos);
+    (void) proxy_ssh_misc_namelist_shared(tmp_pool, client_ciphers,
+      server_ciphers);
+    destroy_pool(tmp_pool);
+  }
+  gettimeofday(&end, NULL);
+
+  shared_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  kex_list = proxy_ssh_misc_namelist_compile(p, client_kex_algos);
+  cipher_list = proxy_ssh_misc_namelist_compile(p, client_ciphers);
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    int res;
+
+    res = proxy_ssh_misc_namelist_negotiate(kex_list, server_kex_algos);
+    ck_assert_msg(res == 2, "Expected ID 2, got %d", res);
+
+    res = proxy_ssh_misc_namelist_negotiate(cipher_list, server_ciphers);
+    ck_assert_msg(res == 0, "Expected ID 0, got %d", res);
+  }
+  gettimeofday(&end, NULL);
+
+  negotiate_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stdout, "namelist: %u negotiations, shared %ld usecs, "
+      "compiled %ld usecs\n", count, shared_usecs, negotiate_usecs);
+  }
+}
+END_TEST
+#endif /* PR_USE_OPENSSL */
+
+Suite *tests_get_ssh_misc_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("ssh.misc");
+
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+#if defined(PR_USE_OPENSSL)
+  tcase_add_test(testcase, namelist_contains_test);
+  tcase_add_test(testcase, namelist_shared_test);
+  tcase_add_test(testcase, namelist_compile_test);
+  tcase_add_test(testcase, namelist_get_id_test);
+  tcase_add_test(testcase, namelist_negotiate_test);
+  tcase_add_test(testcase, namelist_benchmark_test);
+#endif /* PR_USE_OPENSSL */
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
@@ -0,0 +1,456 @@
+/*
+ * ProFTPD - mod_proxy testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+
+/* SSH packet logging API tests. */
+
+#include "../tests.h"
+
+#include "proxy/ssh/ssh2.h"
+
+extern xaset_t *server_list;
+
+static pool *p = NULL;
+
+static void create_main_server(void) {
+  server_rec *s;
+
+  s = pr_parser_server_ctxt_open("127.0.0.1");
+  s->ServerName = "Test Server";
+
+  main_server = s;
+}
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = permanent_pool = make_sub_pool(NULL);
+  }
+
+  init_config();
+
+  server_list = xaset_create(p, NULL);
+  pr_parser_prepare(p, &server_list);
+  create_main_server();
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.ssh.pktlog", 1, 20);
+  }
+}
+
+static void tear_down(void) {
+  if (getenv("TEST_VERBOSE") != NULL) {
+    pr_trace_set_levels("proxy.ssh.pktlog", 0, 0);
+  }
+
+  (void) proxy_ssh_pktlog_free();
+  pr_parser_cleanup();
+
+  if (p) {
+    destroy_pool(p);
+    p = permanent_pool = NULL;
+    main_server = NULL;
+    server_list = NULL;
+  }
+}
+
+static void add_extendedlog(const char *path, const char *classes) {
+  config_rec *c;
+
+  c = add_config_param("ExtendedLog", 3, NULL, NULL, NULL);
+  c->argv[0] = pstrdup(c->pool, path);
+  if (classes != NULL) {
+    c->argv[1] = pstrdup(c->pool, classes);
+  }
+}
+
+START_TEST (pktlog_init_test) {
+  int res;
+
+  res = proxy_ssh_pktlog_init(NULL, NULL, 0, 0);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ssh_pktlog_init(p, NULL, 0, 0);
+  ck_assert_msg(res < 0, "Failed to handle unknown policy");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ssh_pktlog_init(p, NULL, PROXY_SSH_PKTLOG_POLICY_AUTO, 0);
+  ck_assert_msg(res < 0, "Failed to handle auto policy without server");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ssh_pktlog_init(p, NULL, PROXY_SSH_PKTLOG_POLICY_ALL, 0);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  /* Reinitializing is allowed. */
+  res = proxy_ssh_pktlog_init(p, main_server, PROXY_SSH_PKTLOG_POLICY_NONE,
+    0);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  res = proxy_ssh_pktlog_free();
+  ck_assert_msg(res == 0, "Failed to free packet logging: %s",
+    strerror(errno));
+}
+END_TEST
+
+START_TEST (pktlog_want_msg_type_test) {
+  int res;
+
+  /* Without initialization, everything is logged, as always. */
+  res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_CHANNEL_DATA);
+  ck_assert_msg(res == TRUE, "Expected TRUE, got %d", res);
+
+  res = proxy_ssh_pktlog_init(p, NULL, PROXY_SSH_PKTLOG_POLICY_NONE, 0);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_KEXINIT);
+  ck_assert_msg(res == FALSE, "Expected FALSE, got %d", res);
+
+  res = proxy_ssh_pktlog_init(p, NULL, PROXY_SSH_PKTLOG_POLICY_ALL, 0);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_KEXINIT);
+  ck_assert_msg(res == TRUE, "Expected TRUE, got %d", res);
+
+  res = proxy_ssh_pktlog_set_msg_type(PROXY_SSH_MSG_KEXINIT, -1);
+  ck_assert_msg(res < 0, "Failed to handle invalid enabled value");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Once a message type is configured, only configured types are logged. */
+  res = proxy_ssh_pktlog_set_msg_type(PROXY_SSH_MSG_USER_AUTH_REQUEST, TRUE);
+  ck_assert_msg(res == 0, "Failed to enable message type: %s",
+    strerror(errno));
+
+  res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_USER_AUTH_REQUEST);
+  ck_assert_msg(res == TRUE, "Expected TRUE, got %d", res);
+
+  res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_KEXINIT);
+  ck_assert_msg(res == FALSE, "Expected FALSE, got %d", res);
+
+  res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_CHANNEL_DATA);
+  ck_assert_msg(res == FALSE, "Expected FALSE, got %d", res);
+
+  res = proxy_ssh_pktlog_set_msg_type(PROXY_SSH_MSG_USER_AUTH_REQUEST, FALSE);
+  ck_assert_msg(res == 0, "Failed to disable message type: %s",
+    strerror(errno));
+
+  res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_USER_AUTH_REQUEST);
+  ck_assert_msg(res == FALSE, "Expected FALSE, got %d", res);
+
+  /* Reinitializing resets the configured message types. */
+  res = proxy_ssh_pktlog_init(p, NULL, PROXY_SSH_PKTLOG_POLICY_ALL, 0);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_KEXINIT);
+  ck_assert_msg(res == TRUE, "Expected TRUE, got %d", res);
+}
+END_TEST
+
+START_TEST (pktlog_sample_rate_test) {
+  register unsigned int i;
+  int res;
+  unsigned int logged = 0;
+
+  res = proxy_ssh_pktlog_init(p, NULL, PROXY_SSH_PKTLOG_POLICY_ALL, 4);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  for (i = 0; i < 12; i++) {
+    unsigned char msg_type;
+
+    /* Channel data and window adjust packets share the sampling. */
+    msg_type = (i % 2 == 0) ? PROXY_SSH_MSG_CHANNEL_DATA :
+      PROXY_SSH_MSG_CHANNEL_WINDOW_ADJUST;
+
+    if (proxy_ssh_pktlog_want_msg_type(msg_type) == TRUE) {
+      ck_assert_msg(i % 4 == 0, "Unexpectedly logged packet #%u", i);
+      logged++;
+    }
+  }
+
+  ck_assert_msg(logged == 3, "Expected 3 logged packets, got %u", logged);
+
+  /* Other message types are not sampled. */
+  for (i = 0; i < 4; i++) {
+    res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_CHANNEL_REQUEST);
+    ck_assert_msg(res == TRUE, "Expected TRUE, got %d", res);
+  }
+
+  /* A sample rate of 1 logs every packet. */
+  res = proxy_ssh_pktlog_init(p, NULL, PROXY_SSH_PKTLOG_POLICY_ALL, 1);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  for (i = 0; i < 4; i++) {
+    res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_CHANNEL_DATA);
+    ck_assert_msg(res == TRUE, "Expected TRUE, got %d", res);
+  }
+}
+END_TEST
+
+START_TEST (pktlog_get_cmd_test) {
+  register unsigned int i;
+  cmd_rec *cmd, *cmd2;
+  const char *note;
+  pool *cmd_pool;
+  int res;
+
+  mark_point();
+  cmd = proxy_ssh_pktlog_get_cmd(PROXY_SSH_MSG_CHANNEL_DATA, NULL, FALSE);
+  ck_assert_msg(cmd == NULL, "Failed to handle null name");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  cmd = proxy_ssh_pktlog_get_cmd(PROXY_SSH_MSG_CHANNEL_DATA, "CHANNEL_DATA",
+    FALSE);
+  ck_assert_msg(cmd == NULL, "Failed to handle uninitialized logging");
+  ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got '%s' (%d)", EPERM,
+    strerror(errno), errno);
+
+  res = proxy_ssh_pktlog_init(p, NULL, PROXY_SSH_PKTLOG_POLICY_ALL, 0);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  cmd = proxy_ssh_pktlog_get_cmd(PROXY_SSH_MSG_CHANNEL_DATA, "CHANNEL_DATA",
+    FALSE);
+  ck_assert_msg(cmd != NULL, "Failed to get cmd_rec: %s", strerror(errno));
+  ck_assert_msg(strcmp(cmd->argv[0], "CHANNEL_DATA") == 0,
+    "Expected 'CHANNEL_DATA', got '%s'", (char *) cmd->argv[0]);
+  ck_assert_msg(strcmp(cmd->arg, "-") == 0, "Expected '-', got '%s'",
+    cmd->arg);
+  ck_assert_msg(cmd->cmd_class == (CL_MISC|CL_SSH),
+    "Expected class %d, got %d", CL_MISC|CL_SSH, cmd->cmd_class);
+
+  note = pr_table_get(cmd->notes, "proxy.ssh.direction", NULL);
+  ck_assert_msg(note != NULL, "Failed to get direction note: %s",
+    strerror(errno));
+  ck_assert_msg(strcmp(note, "frontend") == 0,
+    "Expected 'frontend', got '%s'", note);
+
+  /* The same cmd_rec is reused for the same message type and direction,
+   * without whatever the previous dispatch left on it.
+   */
+  cmd->stash_index = 7;
+  res = pr_table_add_dup(cmd->notes, "testsuite.note",
+    pstrdup(cmd->pool, "foo"), 0);
+  ck_assert_msg(res == 0, "Failed to add note: %s", strerror(errno));
+  cmd_pool = cmd->pool;
+
+  cmd2 = proxy_ssh_pktlog_get_cmd(PROXY_SSH_MSG_CHANNEL_DATA, "CHANNEL_DATA",
+    FALSE);
+  ck_assert_msg(cmd2 == cmd, "Expected reused cmd_rec %p, got %p", cmd, cmd2);
+  ck_assert_msg(cmd2->stash_index == -1, "Expected stash index -1, got %d",
+    cmd2->stash_index);
+  ck_assert_msg(cmd2->tmp_pool != NULL, "Expected tmp pool");
+  ck_assert_msg(cmd2->pool == cmd_pool, "Expected reused cmd_rec pool");
+  ck_assert_msg(strcmp(cmd2->argv[0], "CHANNEL_DATA") == 0,
+    "Expected 'CHANNEL_DATA', got '%s'", (char *) cmd2->argv[0]);
+
+  note = pr_table_get(cmd2->notes, "testsuite.note", NULL);
+  ck_assert_msg(note == NULL, "Expected previous note to be cleared");
+
+  note = pr_table_get(cmd2->notes, "proxy.ssh.direction", NULL);
+  ck_assert_msg(note != NULL, "Failed to get direction note: %s",
+    strerror(errno));
+  ck_assert_msg(strcmp(note, "frontend") == 0,
+    "Expected 'frontend', got '%s'", note);
+
+  /* The cmd_rec pool is recreated, but only every so many dispatches. */
+  for (i = 0; i < 1000 && cmd2->pool == cmd_pool; i++) {
+    cmd2 = proxy_ssh_pktlog_get_cmd(PROXY_SSH_MSG_CHANNEL_DATA, "CHANNEL_DATA",
+      FALSE);
+  }
+  ck_assert_msg(cmd2->pool != cmd_pool, "Expected new cmd_rec pool");
+  ck_assert_msg(i > 1, "Expected cmd_rec pool to be reused, recreated after %u",
+    i);
+
+  note = pr_table_get(cmd2->notes, "proxy.ssh.direction", NULL);
+  ck_assert_msg(note != NULL, "Failed to get direction note: %s",
+    strerror(errno));
+
+  /* But not for the other direction. */
+  cmd2 = proxy_ssh_pktlog_get_cmd(PROXY_SSH_MSG_CHANNEL_DATA, "CHANNEL_DATA",
+    TRUE);
+  ck_assert_msg(cmd2 != NULL, "Failed to get cmd_rec: %s", strerror(errno));
+  ck_assert_msg(cmd2 != cmd, "Expected different cmd_rec for other direction");
+
+  note = pr_table_get(cmd2->notes, "proxy.ssh.direction", NULL);
+  ck_assert_msg(note != NULL, "Failed to get direction note: %s",
+    strerror(errno));
+  ck_assert_msg(strcmp(note, "backend") == 0, "Expected 'backend', got '%s'",
+    note);
+}
+END_TEST
+
+START_TEST (pktlog_have_extendedlog_test) {
+  int res;
+
+  res = proxy_ssh_pktlog_have_extendedlog(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null server");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  res = proxy_ssh_pktlog_have_extendedlog(main_server);
+  ck_assert_msg(res == FALSE, "Expected FALSE without ExtendedLog, got %d",
+    res);
+
+  add_extendedlog("/tmp/auth.log", "AUTH,WRITE");
+  res = proxy_ssh_pktlog_have_extendedlog(main_server);
+  ck_assert_msg(res == FALSE, "Expected FALSE for AUTH,WRITE, got %d", res);
+
+  add_extendedlog("/tmp/none.log", "ALL,!MISC,!SSH");
+  res = proxy_ssh_pktlog_have_extendedlog(main_server);
+  ck_assert_msg(res == FALSE, "Expected FALSE for ALL,!MISC,!SSH, got %d",
+    res);
+
+  /* The auto policy disables logging, lacking any suitable ExtendedLog. */
+  res = proxy_ssh_pktlog_init(p, main_server, PROXY_SSH_PKTLOG_POLICY_AUTO, 0);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_KEXINIT);
+  ck_assert_msg(res == FALSE, "Expected FALSE, got %d", res);
+
+  add_extendedlog("/tmp/ssh.log", "AUTH, SSH");
+  res = proxy_ssh_pktlog_have_extendedlog(main_server);
+  ck_assert_msg(res == TRUE, "Expected TRUE for AUTH,SSH, got %d", res);
+
+  res = proxy_ssh_pktlog_init(p, main_server, PROXY_SSH_PKTLOG_POLICY_AUTO, 0);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  res = proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_KEXINIT);
+  ck_assert_msg(res == TRUE, "Expected TRUE, got %d", res);
+}
+END_TEST
+
+START_TEST (pktlog_have_extendedlog_default_classes_test) {
+  int res;
+
+  /* An ExtendedLog without classes logs ALL. */
+  add_extendedlog("/tmp/all.log", NULL);
+  res = proxy_ssh_pktlog_have_extendedlog(main_server);
+  ck_assert_msg(res == TRUE, "Expected TRUE for default classes, got %d", res);
+}
+END_TEST
+
+START_TEST (pktlog_benchmark_test) {
+  register unsigned int i;
+  unsigned int count = 100000, logged = 0;
+  struct timeval start, end;
+  long alloc_usecs, reuse_usecs, sampled_usecs;
+  int res;
+
+  /* The per-packet allocations used before cmd_recs were reused. */
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    pool *pkt_pool;
+    cmd_rec *cmd;
+
+    pkt_pool = make_sub_pool(p);
+    cmd = pr_cmd_alloc(pkt_pool, 1, pstrdup(pkt_pool, "CHANNEL_DATA"));
+    cmd->arg = pstrdup(pkt_pool, "-");
+    cmd->cmd_class = CL_MISC|CL_SSH;
+    (void) pr_table_add_dup(cmd->notes, "proxy.ssh.direction", "backend", 0);
+    destroy_pool(cmd->pool);
+    destroy_pool(pkt_pool);
+  }
+  gettimeofday(&end, NULL);
+
+  alloc_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  res = proxy_ssh_pktlog_init(p, NULL, PROXY_SSH_PKTLOG_POLICY_ALL, 0);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    if (proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_CHANNEL_DATA) == TRUE) {
+      (void) proxy_ssh_pktlog_get_cmd(PROXY_SSH_MSG_CHANNEL_DATA,
+        "CHANNEL_DATA", TRUE);
+    }
+  }
+  gettimeofday(&end, NULL);
+
+  reuse_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  res = proxy_ssh_pktlog_init(p, NULL, PROXY_SSH_PKTLOG_POLICY_ALL, 100);
+  ck_assert_msg(res == 0, "Failed to init packet logging: %s",
+    strerror(errno));
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    if (proxy_ssh_pktlog_want_msg_type(PROXY_SSH_MSG_CHANNEL_DATA) == TRUE) {
+      (void) proxy_ssh_pktlog_get_cmd(PROXY_SSH_MSG_CHANNEL_DATA,
+        "CHANNEL_DATA", TRUE);
+      logged++;
+    }
+  }
+  gettimeofday(&end, NULL);
+
+  sampled_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  ck_assert_msg(logged == count / 100, "Expected %u sampled packets, got %u",
+    count / 100, logged);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stdout, "ssh.pktlog: %u packets: allocated cmd_recs %ld usecs, "
+      "reused cmd_recs %ld usecs, sampled (1/100) %ld usecs\n", count,
+      alloc_usecs, reuse_usecs, sampled_usecs);
+  }
+}
+END_TEST
+
+Suite *tests_get_ssh_pktlog_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("ssh.pktlog");
+
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, pktlog_init_test);
+  tcase_add_test(testcase, pktlog_want_msg_type_test);
+  tcase_add_test(testcase, pktlog_sample_rate_test);
+  tcase_add_test(testcase, pktlog_get_cmd_test);
+  tcase_add_test(testcase, pktlog_have_extendedlog_test);
+  tcase_add_test(testcase, pktlog_have_extendedlog_default_classes_test);
+  tcase_add_test(testcase, pktlog_benchmark_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
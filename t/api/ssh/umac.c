@@ -0,0 +1,307 @@
+/*
+ * ProFTPD - mod_proxy testsuite
+ * Copyright (c) 2026 TJ Saunders <tj@castaglia.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Suite 500, Boston, MA 02110-1335, USA.
+ *
+ * As a special exemption, TJ Saunders and other respective copyright holders
+ * give permission to link this program with OpenSSL, and distribute the
+ * resulting executable, without including the source code for OpenSSL in the
+ * source distribution.
+ */
+
+/* SSH UMAC API tests. */
+
+#include "../tests.h"
+
+#if defined(PR_USE_OPENSSL)
+# include <openssl/evp.h>
+# include <openssl/hmac.h>
+#endif /* PR_USE_OPENSSL */
+
+static pool *p = NULL;
+
+static const char *umac_impls[] = {
+  "scalar",
+  "sse2",
+  "avx2",
+  "neon",
+  NULL
+};
+
+static const unsigned char *umac_key = (const unsigned char *)
+  "abcdefghijklmnop";
+static const unsigned char *umac_nonce = (const unsigned char *) "bcdefghi";
+
+static void set_up(void) {
+  if (p == NULL) {
+    p = make_sub_pool(NULL);
+  }
+}
+
+static void tear_down(void) {
+  (void) proxy_ssh_umac_set_impl(NULL);
+  (void) proxy_ssh_umac128_set_impl(NULL);
+
+  if (p) {
+    destroy_pool(p);
+    p = NULL;
+  }
+}
+
+#if defined(PR_USE_OPENSSL)
+static void umac64_tag(const unsigned char *data, long datalen,
+    unsigned char *tag) {
+  struct umac_ctx *ctx;
+
+  ctx = proxy_ssh_umac_new(umac_key);
+  proxy_ssh_umac_update(ctx, data, datalen);
+  proxy_ssh_umac_final(ctx, tag, umac_nonce);
+  proxy_ssh_umac_delete(ctx);
+}
+
+static void umac128_tag(const unsigned char *data, long datalen,
+    unsigned char *tag) {
+  struct umac_ctx *ctx;
+
+  ctx = proxy_ssh_umac128_new(umac_key);
+  proxy_ssh_umac128_update(ctx, data, datalen);
+  proxy_ssh_umac128_final(ctx, tag, umac_nonce);
+  proxy_ssh_umac128_delete(ctx);
+}
+
+static const char *hex_tag(const unsigned char *tag, size_t taglen) {
+  register unsigned int i;
+  char *hex;
+
+  hex = pcalloc(p, (taglen * 2) + 1);
+  for (i = 0; i < taglen; i++) {
+    pr_snprintf(hex + (i * 2), 3, "%02X", tag[i]);
+  }
+
+  return hex;
+}
+
+static int set_impl(const char *name) {
+  if (proxy_ssh_umac_set_impl(name) < 0) {
+    return -1;
+  }
+
+  return proxy_ssh_umac128_set_impl(name);
+}
+#endif /* PR_USE_OPENSSL */
+
+START_TEST (umac_set_impl_test) {
+#if defined(PR_USE_OPENSSL)
+  int res;
+  const char *impl;
+
+  mark_point();
+  res = proxy_ssh_umac_set_impl("foobar");
+  ck_assert_msg(res < 0, "Failed to handle unknown implementation");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got %s (%d)", ENOENT,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_ssh_umac_set_impl("scalar");
+  ck_assert_msg(res == 0, "Failed to select scalar implementation: %s",
+    strerror(errno));
+  impl = proxy_ssh_umac_get_impl();
+  ck_assert_msg(strcmp(impl, "scalar") == 0, "Expected 'scalar', got '%s'",
+    impl);
+
+  mark_point();
+  res = proxy_ssh_umac128_set_impl(NULL);
+  ck_assert_msg(res == 0, "Failed to select best implementation: %s",
+    strerror(errno));
+  impl = proxy_ssh_umac128_get_impl();
+  ck_assert_msg(impl != NULL, "Expected implementation name, got null");
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
+START_TEST (umac_test_vectors_test) {
+#if defined(PR_USE_OPENSSL)
+  register unsigned int i, j;
+  unsigned char *data, tag[16];
+  size_t datalen = 1024;
+
+  /* Test vectors from RFC 4418, Appendix, with key "abcdefghijklmnop" and
+   * nonce "bcdefghi".
+   */
+  struct {
+    const char *pattern;
+    unsigned int count;
+    const char *umac64;
+    const char *umac128;
+  } vectors[] = {
+    { "",    0,    "6E155FAD26900BE1", "32FEDB100C79AD58F07FF7643CC60465" },
+    { "a",   3,    "44B5CB542F220104", "185E4FE905CBA7BD85E4C2DC3D117D8D" },
+    { "a",   1024, "26BF2F5D60118BD9", "7A54ABE04AF82D60FB298C3CBD195BCB" },
+    { "abc", 1,    "D4D7B9F6BD4FBFCF", "883C3D4B97A61976FFCF232308CBA5A5" },
+    { NULL,  0,    NULL, NULL }
+  };
+
+  data = palloc(p, datalen * 3);
+
+  for (i = 0; umac_impls[i] != NULL; i++) {
+    if (set_impl(umac_impls[i]) < 0) {
+      /* Not supported on this platform/CPU. */
+      continue;
+    }
+
+    for (j = 0; vectors[j].pattern != NULL; j++) {
+      register unsigned int k;
+      size_t patternlen, len = 0;
+      const char *hex;
+
+      patternlen = strlen(vectors[j].pattern);
+      for (k = 0; k < vectors[j].count; k++) {
+        memcpy(data + len, vectors[j].pattern, patternlen);
+        len += patternlen;
+      }
+
+      mark_point();
+      umac64_tag(data, len, tag);
+      hex = hex_tag(tag, 8);
+      ck_assert_msg(strcmp(hex, vectors[j].umac64) == 0,
+        "%s: expected UMAC-64 '%s' for vector #%u, got '%s'", umac_impls[i],
+        vectors[j].umac64, j, hex);
+
+      mark_point();
+      umac128_tag(data, len, tag);
+      hex = hex_tag(tag, 16);
+      ck_assert_msg(strcmp(hex, vectors[j].umac128) == 0,
+        "%s: expected UMAC-128 '%s' for vector #%u, got '%s'", umac_impls[i],
+        vectors[j].umac128, j, hex);
+    }
+  }
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
+START_TEST (umac_impls_match_scalar_test) {
+#if defined(PR_USE_OPENSSL)
+  register unsigned int i;
+  unsigned char *data;
+  size_t datalen = 4096;
+
+  data = palloc(p, datalen + 1);
+  for (i = 0; i < datalen + 1; i++) {
+    data[i] = (unsigned char) ((i * 131) + (i >> 7));
+  }
+
+  for (i = 1; umac_impls[i] != NULL; i++) {
+    size_t len;
+
+    if (set_impl(umac_impls[i]) < 0) {
+      continue;
+    }
+
+    /* Cover every partial-block length, and unaligned input. */
+    for (len = 0; len <= datalen; len += (len < 256 ? 1 : 61)) {
+      unsigned char expected[16], tag[16];
+
+      mark_point();
+      set_impl("scalar");
+      umac64_tag(data + 1, len, expected);
+      set_impl(umac_impls[i]);
+      umac64_tag(data + 1, len, tag);
+      ck_assert_msg(memcmp(expected, tag, 8) == 0,
+        "%s: UMAC-64 mismatch with scalar for %lu bytes", umac_impls[i],
+        (unsigned long) len);
+
+      mark_point();
+      set_impl("scalar");
+      umac128_tag(data + 1, len, expected);
+      set_impl(umac_impls[i]);
+      umac128_tag(data + 1, len, tag);
+      ck_assert_msg(memcmp(expected, tag, 16) == 0,
+        "%s: UMAC-128 mismatch with scalar for %lu bytes", umac_impls[i],
+        (unsigned long) len);
+    }
+  }
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
+START_TEST (umac_benchmark_test) {
+#if defined(PR_USE_OPENSSL)
+  register unsigned int i, j;
+  unsigned int count = 2000;
+  unsigned char *data, tag[EVP_MAX_MD_SIZE];
+  unsigned int taglen;
+  size_t datalen = 32768;
+  struct timeval start, end;
+  long usecs;
+
+  data = pcalloc(p, datalen);
+
+  for (i = 0; umac_impls[i] != NULL; i++) {
+    if (set_impl(umac_impls[i]) < 0) {
+      continue;
+    }
+
+    gettimeofday(&start, NULL);
+    for (j = 0; j < count; j++) {
+      umac64_tag(data, datalen, tag);
+    }
+    gettimeofday(&end, NULL);
+
+    usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+      (end.tv_usec - start.tv_usec);
+
+    if (getenv("TEST_VERBOSE") != NULL) {
+      fprintf(stdout, "umac-64 (%s): %u x %lu bytes in %ld usecs\n",
+        umac_impls[i], count, (unsigned long) datalen, usecs);
+    }
+  }
+
+  gettimeofday(&start, NULL);
+  for (j = 0; j < count; j++) {
+    taglen = sizeof(tag);
+    HMAC(EVP_sha256(), umac_key, 16, data, datalen, tag, &taglen);
+  }
+  gettimeofday(&end, NULL);
+
+  usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stdout, "hmac-sha2-256: %u x %lu bytes in %ld usecs\n", count,
+      (unsigned long) datalen, usecs);
+  }
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
+Suite *tests_get_ssh_umac_suite(void) {
+  Suite *suite;
+  TCase *testcase;
+
+  suite = suite_create("ssh.umac");
+
+  testcase = tcase_create("base");
+
+  tcase_add_checked_fixture(testcase, set_up, tear_down);
+
+  tcase_add_test(testcase, umac_set_impl_test);
+  tcase_add_test(testcase, umac_test_vectors_test);
+  tcase_add_test(testcase, umac_impls_match_scalar_test);
+  tcase_add_test(testcase, umac_benchmark_test);
+
+  suite_add_tcase(suite, testcase);
+  return suite;
+}
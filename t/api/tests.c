@@ -38,18 +38,28 @@ static struct testsuite_info suites[] = {
   { "random", 		tests_get_random_suite },
   { "reverse", 		tests_get_reverse_suite },
   { "forward", 		tests_get_forward_suite },
+  { "forward.dstcache",	tests_get_forward_dstcache_suite },
+  { "forward.filter",	tests_get_forward_filter_suite },
   { "str", 		tests_get_str_suite },
   { "tls", 		tests_get_tls_suite },
   { "uri", 		tests_get_uri_suite },
   { "session", 		tests_get_session_suite },
+  { "sockopts",		tests_get_sockopts_suite },
   { "ftp.msg", 		tests_get_ftp_msg_suite },
+  { "ftp.ascii",	tests_get_ftp_ascii_suite },
   { "ftp.conn",		tests_get_ftp_conn_suite },
   { "ftp.ctrl",		tests_get_ftp_ctrl_suite },
   { "ftp.data",		tests_get_ftp_data_suite },
+  { "ftp.dircache",	tests_get_ftp_dircache_suite },
   { "ftp.dirlist",	tests_get_ftp_dirlist_suite },
   { "ftp.facts",	tests_get_ftp_facts_suite },
+  { "ftp.modez",	tests_get_ftp_modez_suite },
   { "ftp.sess",		tests_get_ftp_sess_suite },
   { "ftp.xfer",		tests_get_ftp_xfer_suite },
+  { "ssh.kexcost",	tests_get_ssh_kexcost_suite },
+  { "ssh.misc",		tests_get_ssh_misc_suite },
+  { "ssh.pktlog",	tests_get_ssh_pktlog_suite },
+  { "ssh.umac",		tests_get_ssh_umac_suite },
 
   { NULL, NULL }
 };
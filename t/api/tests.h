@@ -41,18 +41,28 @@
 #include "proxy/tls/db.h"
 #include "proxy/tls/redis.h"
 #include "proxy/session.h"
+#include "proxy/sockopts.h"
 #include "proxy/reverse.h"
 #include "proxy/reverse/db.h"
 #include "proxy/reverse/redis.h"
 #include "proxy/forward.h"
+#include "proxy/forward/dstcache.h"
+#include "proxy/forward/filter.h"
 #include "proxy/ftp/msg.h"
+#include "proxy/ftp/ascii.h"
 #include "proxy/ftp/conn.h"
 #include "proxy/ftp/ctrl.h"
 #include "proxy/ftp/data.h"
+#include "proxy/ftp/dircache.h"
 #include "proxy/ftp/dirlist.h"
 #include "proxy/ftp/facts.h"
+#include "proxy/ftp/modez.h"
 #include "proxy/ftp/sess.h"
 #include "proxy/ftp/xfer.h"
+#include "proxy/ssh/kexcost.h"
+#include "proxy/ssh/misc.h"
+#include "proxy/ssh/pktlog.h"
+#include "proxy/ssh/umac.h"
 
 #ifdef HAVE_CHECK_H
 # include <check.h>
@@ -71,20 +81,31 @@ Suite *tests_get_netio_suite(void);
 Suite *tests_get_random_suite(void);
 Suite *tests_get_reverse_suite(void);
 Suite *tests_get_forward_suite(void);
+Suite *tests_get_forward_dstcache_suite(void);
+Suite *tests_get_forward_filter_suite(void);
 Suite *tests_get_str_suite(void);
 Suite *tests_get_tls_suite(void);
 Suite *tests_get_uri_suite(void);
 Suite *tests_get_session_suite(void);
+Suite *tests_get_sockopts_suite(void);
 
 Suite *tests_get_ftp_msg_suite(void);
+Suite *tests_get_ftp_ascii_suite(void);
 Suite *tests_get_ftp_conn_suite(void);
 Suite *tests_get_ftp_ctrl_suite(void);
 Suite *tests_get_ftp_data_suite(void);
+Suite *tests_get_ftp_dircache_suite(void);
 Suite *tests_get_ftp_dirlist_suite(void);
 Suite *tests_get_ftp_facts_suite(void);
+Suite *tests_get_ftp_modez_suite(void);
 Suite *tests_get_ftp_sess_suite(void);
 Suite *tests_get_ftp_xfer_suite(void);
 
+Suite *tests_get_ssh_kexcost_suite(void);
+Suite *tests_get_ssh_misc_suite(void);
+Suite *tests_get_ssh_pktlog_suite(void);
+Suite *tests_get_ssh_umac_suite(void);
+
 extern volatile unsigned int recvd_signal_flags;
 extern pid_t mpid;
 extern server_rec *main_server;
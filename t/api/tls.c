@@ -320,6 +320,1344 @@ START_TEST (tls_set_data_prot_test) {
 }
 END_TEST
 
+#if defined(PR_USE_OPENSSL)
+static X509 *create_cert(long valid_secs) {
+  X509 *cert;
+  X509_NAME *name;
+  EVP_PKEY *pkey = NULL;
+  EVP_PKEY_CTX *pctx;
+
+  pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+  if (pctx == NULL) {
+    return NULL;
+  }
+
+  if (EVP_PKEY_keygen_init(pctx) != 1 ||
+      EVP_PKEY_CTX_set_rsa_keygen_bits(pctx, 2048) != 1 ||
+      EVP_PKEY_keygen(pctx, &pkey) != 1) {
+    EVP_PKEY_CTX_free(pctx);
+    return NULL;
+  }
+  EVP_PKEY_CTX_free(pctx);
+
+  cert = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_get_notBefore(cert), -60);
+  X509_gmtime_adj(X509_get_notAfter(cert), valid_secs);
+  X509_set_pubkey(cert, pkey);
+
+  name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+    (const unsigned char *) "ftp.example.com", -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+
+  if (X509_sign(cert, pkey, EVP_sha256()) == 0) {
+    X509_free(cert);
+    cert = NULL;
+  }
+
+  EVP_PKEY_free(pkey);
+  return cert;
+}
+#endif /* PR_USE_OPENSSL */
+
+START_TEST (tls_verify_cache_test) {
+#if defined(PR_USE_OPENSSL)
+  int res;
+  X509 *cert, *expiring_cert;
+  STACK_OF(X509) *chain;
+  struct proxy_tls_verify_cache_stats stats;
+  const char *host = "ftp.example.com 127.0.0.1";
+
+  proxy_tls_verify_cache_clear();
+
+  mark_point();
+  res = proxy_tls_verify_cache_add(NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null cert");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_verify_cache_get(NULL, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null cert");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_verify_cache_get_stats(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null stats");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  cert = create_cert(86400);
+  ck_assert_msg(cert != NULL, "Failed to create certificate: %s",
+    proxy_tls_get_errors());
+
+  mark_point();
+  res = proxy_tls_verify_cache_add(cert, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null host");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_verify_cache_get(cert, NULL, host);
+  ck_assert_msg(res < 0, "Found uncached certificate unexpectedly");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got '%s' (%d)", ENOENT,
+    strerror(errno), errno);
+
+  chain = sk_X509_new_null();
+  sk_X509_push(chain, cert);
+
+  mark_point();
+  res = proxy_tls_verify_cache_add(cert, chain, host);
+  ck_assert_msg(res == 0, "Failed to cache certificate: %s", strerror(errno));
+
+  mark_point();
+  res = proxy_tls_verify_cache_get(cert, chain, host);
+  ck_assert_msg(res == 0, "Failed to find cached certificate: %s",
+    strerror(errno));
+
+  /* A different expected host, or a different chain, must not match. */
+  mark_point();
+  res = proxy_tls_verify_cache_get(cert, chain, "ftp.example.com 127.0.0.2");
+  ck_assert_msg(res < 0, "Found certificate for other host unexpectedly");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got '%s' (%d)", ENOENT,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_verify_cache_get(cert, NULL, host);
+  ck_assert_msg(res < 0, "Found certificate for other chain unexpectedly");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got '%s' (%d)", ENOENT,
+    strerror(errno), errno);
+
+  /* Certificates expiring before the cached entry would must not be cached. */
+  expiring_cert = create_cert(30);
+  ck_assert_msg(expiring_cert != NULL, "Failed to create certificate: %s",
+    proxy_tls_get_errors());
+
+  mark_point();
+  res = proxy_tls_verify_cache_add(expiring_cert, NULL, host);
+  ck_assert_msg(res < 0, "Cached expiring certificate unexpectedly");
+  ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got '%s' (%d)", EPERM,
+    strerror(errno), errno);
+
+  mark_point();
+  sk_X509_push(chain, expiring_cert);
+  res = proxy_tls_verify_cache_add(cert, chain, "ftp.example.com 127.0.0.2");
+  ck_assert_msg(res < 0, "Cached certificate despite expiring chain");
+  ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got '%s' (%d)", EPERM,
+    strerror(errno), errno);
+  (void) sk_X509_pop(chain);
+
+  mark_point();
+  res = proxy_tls_verify_cache_get_stats(&stats);
+  ck_assert_msg(res == 0, "Failed to get cache stats: %s", strerror(errno));
+  ck_assert_msg(stats.lookups == 4, "Expected 4 lookups, got %lu",
+    stats.lookups);
+  ck_assert_msg(stats.hits == 1, "Expected 1 hit, got %lu", stats.hits);
+  ck_assert_msg(stats.misses == 3, "Expected 3 misses, got %lu", stats.misses);
+  ck_assert_msg(stats.adds == 1, "Expected 1 add, got %lu", stats.adds);
+  ck_assert_msg(stats.evictions == 0, "Expected 0 evictions, got %lu",
+    stats.evictions);
+
+  mark_point();
+  proxy_tls_verify_cache_clear();
+  res = proxy_tls_verify_cache_get(cert, chain, host);
+  ck_assert_msg(res < 0, "Found cleared certificate unexpectedly");
+  ck_assert_msg(errno == ENOENT, "Expected ENOENT (%d), got '%s' (%d)", ENOENT,
+    strerror(errno), errno);
+
+  sk_X509_free(chain);
+  X509_free(expiring_cert);
+  X509_free(cert);
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
+#if defined(PR_USE_OPENSSL)
+static SSL_CTX *create_server_ctx(void) {
+  SSL_CTX *ctx;
+  X509 *cert;
+  X509_NAME *name;
+  EVP_PKEY *pkey = NULL;
+  EVP_PKEY_CTX *pctx;
+
+  pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+  if (pctx == NULL) {
+    return NULL;
+  }
+
+  if (EVP_PKEY_keygen_init(pctx) != 1 ||
+      EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) != 1 ||
+      EVP_PKEY_keygen(pctx, &pkey) != 1) {
+    EVP_PKEY_CTX_free(pctx);
+    return NULL;
+  }
+  EVP_PKEY_CTX_free(pctx);
+
+  cert = X509_new();
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+  X509_gmtime_adj(X509_get_notBefore(cert), -60);
+  X509_gmtime_adj(X509_get_notAfter(cert), 86400);
+  X509_set_pubkey(cert, pkey);
+
+  name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+    (const unsigned char *) "ftp.example.com", -1, -1, 0);
+  X509_set_issuer_name(cert, name);
+  X509_sign(cert, pkey, EVP_sha256());
+
+  ctx = SSL_CTX_new(SSLv23_server_method());
+  if (ctx != NULL) {
+    if (SSL_CTX_use_certificate(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey(ctx, pkey) != 1) {
+      SSL_CTX_free(ctx);
+      ctx = NULL;
+    }
+  }
+
+  X509_free(cert);
+  EVP_PKEY_free(pkey);
+  return ctx;
+}
+
+/* Performs an in-memory handshake, returning TRUE if it succeeded. */
+static int tls_handshake(SSL_CTX *server_ctx, SSL_CTX *client_ctx,
+    int use_diags) {
+  register unsigned int i;
+  SSL *client, *server;
+  BIO *client_bio = NULL, *server_bio = NULL;
+  int client_done = FALSE, server_done = FALSE;
+
+  if (BIO_new_bio_pair(&client_bio, 0, &server_bio, 0) != 1) {
+    return FALSE;
+  }
+
+  client = SSL_new(client_ctx);
+  SSL_set_bio(client, client_bio, client_bio);
+  SSL_set_connect_state(client);
+
+  server = SSL_new(server_ctx);
+  SSL_set_bio(server, server_bio, server_bio);
+  SSL_set_accept_state(server);
+
+  if (use_diags == TRUE) {
+    (void) proxy_tls_diags_set_callbacks(client);
+  }
+
+  for (i = 0; i < 32; i++) {
+    if (client_done == FALSE &&
+        SSL_do_handshake(client) == 1) {
+      client_done = TRUE;
+    }
+
+    if (server_done == FALSE &&
+        SSL_do_handshake(server) == 1) {
+      server_done = TRUE;
+    }
+
+    if (client_done == TRUE &&
+        server_done == TRUE) {
+      break;
+    }
+  }
+
+  SSL_free(client);
+  SSL_free(server);
+
+  return (client_done == TRUE && server_done == TRUE);
+}
+#endif /* PR_USE_OPENSSL */
+
+#if defined(PR_USE_OPENSSL) && \
+    !defined(OPENSSL_NO_TLSEXT) && \
+    defined(TLSEXT_STATUSTYPE_ocsp)
+struct tls_ocsp_staple {
+  unsigned char *der;
+  int derlen;
+};
+
+static EVP_PKEY *tls_ocsp_make_key(void) {
+  EVP_PKEY *pkey = NULL;
+  EVP_PKEY_CTX *pctx;
+
+  pctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, NULL);
+  if (pctx == NULL) {
+    return NULL;
+  }
+
+  if (EVP_PKEY_keygen_init(pctx) != 1 ||
+      EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pctx, NID_X9_62_prime256v1) != 1 ||
+      EVP_PKEY_keygen(pctx, &pkey) != 1) {
+    pkey = NULL;
+  }
+
+  EVP_PKEY_CTX_free(pctx);
+  return pkey;
+}
+
+/* Creates a certificate for the given key, signed by the given issuer; a
+ * NULL issuer makes a self-signed CA certificate.
+ */
+static X509 *tls_ocsp_make_cert(EVP_PKEY *pkey, const char *cn, long serial,
+    X509 *issuer, EVP_PKEY *issuer_pkey) {
+  X509 *cert;
+  X509_NAME *name;
+
+  cert = X509_new();
+  X509_set_version(cert, 2);
+  ASN1_INTEGER_set(X509_get_serialNumber(cert), serial);
+  X509_gmtime_adj(X509_get_notBefore(cert), -60);
+  X509_gmtime_adj(X509_get_notAfter(cert), 86400);
+  X509_set_pubkey(cert, pkey);
+
+  name = X509_get_subject_name(cert);
+  X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+    (const unsigned char *) cn, -1, -1, 0);
+
+  if (issuer == NULL) {
+    X509_EXTENSION *ext;
+    X509V3_CTX v3_ctx;
+
+    X509_set_issuer_name(cert, name);
+
+    X509V3_set_ctx(&v3_ctx, cert, cert, NULL, NULL, 0);
+    ext = X509V3_EXT_conf_nid(NULL, &v3_ctx, NID_basic_constraints,
+      "critical,CA:TRUE");
+    X509_add_ext(cert, ext, -1);
+    X509_EXTENSION_free(ext);
+
+    X509_sign(cert, pkey, EVP_sha256());
+
+  } else {
+    X509_set_issuer_name(cert, X509_get_subject_name(issuer));
+    X509_sign(cert, issuer_pkey, EVP_sha256());
+  }
+
+  return cert;
+}
+
+/* Creates a DER-encoded OCSP response, signed by the CA, with the given
+ * status for the certificate.
+ */
+static int tls_ocsp_make_staple(X509 *cert, X509 *ca_cert, EVP_PKEY *ca_pkey,
+    int status, struct tls_ocsp_staple *staple) {
+  OCSP_CERTID *cert_id;
+  OCSP_BASICRESP *basic_resp;
+  OCSP_RESPONSE *resp;
+  ASN1_TIME *revoked_at, *this_update, *next_update;
+
+  cert_id = OCSP_cert_to_id(EVP_sha1(), cert, ca_cert);
+  basic_resp = OCSP_BASICRESP_new();
+
+  revoked_at = X509_gmtime_adj(NULL, -120);
+  this_update = X509_gmtime_adj(NULL, -60);
+  next_update = X509_gmtime_adj(NULL, 3600);
+
+  OCSP_basic_add1_status(basic_resp, cert_id, status,
+    status == V_OCSP_CERTSTATUS_REVOKED ? OCSP_REVOKED_STATUS_KEYCOMPROMISE : 0,
+    status == V_OCSP_CERTSTATUS_REVOKED ? revoked_at : NULL, this_update,
+    next_update);
+  OCSP_basic_sign(basic_resp, ca_cert, ca_pkey, EVP_sha256(), NULL, 0);
+
+  resp = OCSP_response_create(OCSP_RESPONSE_STATUS_SUCCESSFUL, basic_resp);
+
+  staple->der = NULL;
+  staple->derlen = i2d_OCSP_RESPONSE(resp, &(staple->der));
+
+  OCSP_RESPONSE_free(resp);
+  OCSP_BASICRESP_free(basic_resp);
+  OCSP_CERTID_free(cert_id);
+  ASN1_TIME_free(revoked_at);
+  ASN1_TIME_free(this_update);
+  ASN1_TIME_free(next_update);
+
+  return staple->derlen > 0 ? 0 : -1;
+}
+
+static int tls_ocsp_staple_cb(SSL *ssl, void *user_data) {
+  struct tls_ocsp_staple *staple;
+  unsigned char *der;
+
+  staple = user_data;
+  der = OPENSSL_malloc(staple->derlen);
+  memcpy(der, staple->der, staple->derlen);
+  SSL_set_tlsext_status_ocsp_resp(ssl, der, staple->derlen);
+
+  return SSL_TLSEXT_ERR_OK;
+}
+
+/* As for a verified certificate cache hit: no chain is built. */
+static int tls_ocsp_cached_verify_cb(X509_STORE_CTX *ctx, void *user_data) {
+  X509_STORE_CTX_set_error(ctx, X509_V_OK);
+  return 1;
+}
+
+/* Performs an in-memory handshake with the server stapling the given OCSP
+ * response, then checks that response as the client would.
+ */
+static int tls_ocsp_check(SSL_CTX *server_ctx, SSL_CTX *client_ctx,
+    struct tls_ocsp_staple *staple, int *check_errno) {
+  register unsigned int i;
+  SSL *client, *server;
+  BIO *client_bio = NULL, *server_bio = NULL;
+  int client_done = FALSE, server_done = FALSE, res = -2;
+
+  SSL_CTX_set_tlsext_status_cb(server_ctx, tls_ocsp_staple_cb);
+  SSL_CTX_set_tlsext_status_arg(server_ctx, staple);
+
+  if (BIO_new_bio_pair(&client_bio, 0, &server_bio, 0) != 1) {
+    return -2;
+  }
+
+  client = SSL_new(client_ctx);
+  SSL_set_bio(client, client_bio, client_bio);
+  SSL_set_connect_state(client);
+  SSL_set_tlsext_status_type(client, TLSEXT_STATUSTYPE_ocsp);
+
+  server = SSL_new(server_ctx);
+  SSL_set_bio(server, server_bio, server_bio);
+  SSL_set_accept_state(server);
+
+  for (i = 0; i < 32; i++) {
+    if (client_done == FALSE &&
+        SSL_do_handshake(client) == 1) {
+      client_done = TRUE;
+    }
+
+    if (server_done == FALSE &&
+        SSL_do_handshake(server) == 1) {
+      server_done = TRUE;
+    }
+
+    if (client_done == TRUE &&
+        server_done == TRUE) {
+      break;
+    }
+  }
+
+  if (client_done == TRUE &&
+      server_done == TRUE) {
+    errno = 0;
+    res = proxy_tls_verify_stapled_ocsp(client);
+    *check_errno = errno;
+  }
+
+  SSL_free(client);
+  SSL_free(server);
+
+  return res;
+}
+#endif /* OCSP support */
+
+START_TEST (tls_verify_stapled_ocsp_test) {
+#if defined(PR_USE_OPENSSL) && \
+    !defined(OPENSSL_NO_TLSEXT) && \
+    defined(TLSEXT_STATUSTYPE_ocsp)
+  int res, check_errno = 0;
+  EVP_PKEY *ca_pkey, *pkey;
+  X509 *ca_cert, *cert;
+  SSL_CTX *server_ctx, *client_ctx;
+  struct tls_ocsp_staple revoked, good;
+
+  mark_point();
+  res = proxy_tls_verify_stapled_ocsp(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null SSL");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  ca_pkey = tls_ocsp_make_key();
+  pkey = tls_ocsp_make_key();
+  ck_assert_msg(ca_pkey != NULL && pkey != NULL, "Failed to create keys: %s",
+    proxy_tls_get_errors());
+
+  ca_cert = tls_ocsp_make_cert(ca_pkey, "Test CA", 1, NULL, NULL);
+  cert = tls_ocsp_make_cert(pkey, "ftp.example.com", 2, ca_cert, ca_pkey);
+
+  res = tls_ocsp_make_staple(cert, ca_cert, ca_pkey, V_OCSP_CERTSTATUS_REVOKED,
+    &revoked);
+  ck_assert_msg(res == 0, "Failed to create OCSP response: %s",
+    proxy_tls_get_errors());
+
+  res = tls_ocsp_make_staple(cert, ca_cert, ca_pkey, V_OCSP_CERTSTATUS_GOOD,
+    &good);
+  ck_assert_msg(res == 0, "Failed to create OCSP response: %s",
+    proxy_tls_get_errors());
+
+  /* The server sends only its own certificate; the CA certificate is only
+   * in the client's trust store.
+   */
+  server_ctx = SSL_CTX_new(SSLv23_server_method());
+  ck_assert_msg(server_ctx != NULL, "Failed to create server context: %s",
+    proxy_tls_get_errors());
+  ck_assert_msg(SSL_CTX_use_certificate(server_ctx, cert) == 1 &&
+    SSL_CTX_use_PrivateKey(server_ctx, pkey) == 1,
+    "Failed to use server certificate: %s", proxy_tls_get_errors());
+
+  client_ctx = SSL_CTX_new(SSLv23_client_method());
+  ck_assert_msg(client_ctx != NULL, "Failed to create client context: %s",
+    proxy_tls_get_errors());
+  SSL_CTX_set_verify(client_ctx, SSL_VERIFY_NONE, NULL);
+  X509_STORE_add_cert(SSL_CTX_get_cert_store(client_ctx), ca_cert);
+  SSL_CTX_set_cert_verify_callback(client_ctx, tls_ocsp_cached_verify_cb,
+    NULL);
+
+  /* A revoked certificate must be caught even when the verification of its
+   * chain came from the cache.
+   */
+  mark_point();
+  res = tls_ocsp_check(server_ctx, client_ctx, &revoked, &check_errno);
+  ck_assert_msg(res != -2, "Failed TLS handshake: %s", proxy_tls_get_errors());
+  ck_assert_msg(res < 0, "Failed to reject revoked certificate");
+  ck_assert_msg(check_errno == EPERM, "Expected EPERM (%d), got '%s' (%d)",
+    EPERM, strerror(check_errno), check_errno);
+
+  mark_point();
+  res = tls_ocsp_check(server_ctx, client_ctx, &good, &check_errno);
+  ck_assert_msg(res != -2, "Failed TLS handshake: %s", proxy_tls_get_errors());
+  ck_assert_msg(res == 0, "Failed to accept good certificate: %s",
+    strerror(check_errno));
+
+  SSL_CTX_free(client_ctx);
+  SSL_CTX_free(server_ctx);
+  OPENSSL_free(revoked.der);
+  OPENSSL_free(good.der);
+  X509_free(cert);
+  X509_free(ca_cert);
+  EVP_PKEY_free(pkey);
+  EVP_PKEY_free(ca_pkey);
+#endif /* OCSP support */
+}
+END_TEST
+
+START_TEST (tls_diags_test) {
+#if defined(PR_USE_OPENSSL)
+  int res;
+  unsigned int count;
+  SSL_CTX *server_ctx, *client_ctx;
+
+  mark_point();
+  res = proxy_tls_diags_init(NULL, 0, 0);
+  ck_assert_msg(res < 0, "Failed to handle null pool");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_diags_init(p, 0, 0);
+  ck_assert_msg(res < 0, "Failed to handle zero count");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_diags_set_callbacks(NULL);
+  ck_assert_msg(res < 0, "Failed to handle null SSL");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  server_ctx = create_server_ctx();
+  ck_assert_msg(server_ctx != NULL, "Failed to create server context: %s",
+    proxy_tls_get_errors());
+
+  client_ctx = SSL_CTX_new(SSLv23_client_method());
+  ck_assert_msg(client_ctx != NULL, "Failed to create client context: %s",
+    proxy_tls_get_errors());
+  SSL_CTX_set_verify(client_ctx, SSL_VERIFY_NONE, NULL);
+
+  /* Without initialization, nothing is recorded. */
+  mark_point();
+  res = tls_handshake(server_ctx, client_ctx, TRUE);
+  ck_assert_msg(res == TRUE, "Handshake failed: %s", proxy_tls_get_errors());
+  count = proxy_tls_diags_get_count();
+  ck_assert_msg(count == 0, "Expected 0 events, got %u", count);
+
+  mark_point();
+  res = proxy_tls_diags_init(p, 8, 0);
+  ck_assert_msg(res == 0, "Failed to init diags: %s", strerror(errno));
+
+  /* Without the callbacks, nothing is recorded either. */
+  mark_point();
+  res = tls_handshake(server_ctx, client_ctx, FALSE);
+  ck_assert_msg(res == TRUE, "Handshake failed: %s", proxy_tls_get_errors());
+  count = proxy_tls_diags_get_count();
+  ck_assert_msg(count == 0, "Expected 0 events, got %u", count);
+
+  /* A full handshake has more events than the buffer holds; only the most
+   * recent are kept.
+   */
+  mark_point();
+  res = tls_handshake(server_ctx, client_ctx, TRUE);
+  ck_assert_msg(res == TRUE, "Handshake failed: %s", proxy_tls_get_errors());
+  count = proxy_tls_diags_get_count();
+  ck_assert_msg(count == 8, "Expected 8 events, got %u", count);
+
+  mark_point();
+  res = proxy_tls_diags_flush();
+  ck_assert_msg(res == 8, "Expected 8 flushed events, got %d", res);
+  count = proxy_tls_diags_get_count();
+  ck_assert_msg(count == 0, "Expected 0 events after flush, got %u", count);
+
+  mark_point();
+  res = proxy_tls_diags_flush();
+  ck_assert_msg(res == 0, "Expected 0 flushed events, got %d", res);
+
+  /* When logging all events, nothing remains buffered. */
+  mark_point();
+  res = proxy_tls_diags_init(p, 8, PROXY_TLS_DIAGS_FL_LOG_ALL);
+  ck_assert_msg(res == 0, "Failed to init diags: %s", strerror(errno));
+
+  res = tls_handshake(server_ctx, client_ctx, TRUE);
+  ck_assert_msg(res == TRUE, "Handshake failed: %s", proxy_tls_get_errors());
+  count = proxy_tls_diags_get_count();
+  ck_assert_msg(count == 0, "Expected 0 events, got %u", count);
+
+  mark_point();
+  res = proxy_tls_diags_free();
+  ck_assert_msg(res == 0, "Failed to free diags: %s", strerror(errno));
+
+  SSL_CTX_free(client_ctx);
+  SSL_CTX_free(server_ctx);
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
+START_TEST (tls_diags_benchmark_test) {
+#if defined(PR_USE_OPENSSL)
+  register unsigned int i;
+  unsigned int count = 50;
+  int res;
+  long off_usecs, deferred_usecs;
+  struct timeval start, end;
+  SSL_CTX *server_ctx, *client_ctx;
+
+  server_ctx = create_server_ctx();
+  ck_assert_msg(server_ctx != NULL, "Failed to create server context: %s",
+    proxy_tls_get_errors());
+
+  client_ctx = SSL_CTX_new(SSLv23_client_method());
+  ck_assert_msg(client_ctx != NULL, "Failed to create client context: %s",
+    proxy_tls_get_errors());
+  SSL_CTX_set_verify(client_ctx, SSL_VERIFY_NONE, NULL);
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    res = tls_handshake(server_ctx, client_ctx, FALSE);
+    ck_assert_msg(res == TRUE, "Handshake failed: %s", proxy_tls_get_errors());
+  }
+  gettimeofday(&end, NULL);
+
+  off_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  res = proxy_tls_diags_init(p, PROXY_TLS_DIAGS_DEFAULT_COUNT, 0);
+  ck_assert_msg(res == 0, "Failed to init diags: %s", strerror(errno));
+
+  gettimeofday(&start, NULL);
+  for (i = 0; i < count; i++) {
+    res = tls_handshake(server_ctx, client_ctx, TRUE);
+    ck_assert_msg(res == TRUE, "Handshake failed: %s", proxy_tls_get_errors());
+  }
+  gettimeofday(&end, NULL);
+
+  deferred_usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+
+  (void) proxy_tls_diags_free();
+
+  if (getenv("TEST_VERBOSE") != NULL) {
+    fprintf(stdout, "tls diags: %u handshakes, %ld usecs without diags, "
+      "%ld usecs with deferred diags\n", count, off_usecs, deferred_usecs);
+  }
+
+  SSL_CTX_free(client_ctx);
+  SSL_CTX_free(server_ctx);
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
+START_TEST (tls_buffer_policy_test) {
+#if defined(PR_USE_OPENSSL)
+  int res, policy = 0;
+  size_t read_buflen = 0;
+  SSL_CTX *ctx;
+  SSL *ssl;
+
+  mark_point();
+  res = proxy_tls_set_buffer_policy(-1, PROXY_TLS_BUFFER_POLICY_KEEP, 0);
+  ck_assert_msg(res < 0, "Failed to handle invalid role");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_set_buffer_policy(PROXY_TLS_BUFFER_ROLE_DATA, -1, 0);
+  ck_assert_msg(res < 0, "Failed to handle invalid policy");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_set_buffer_policy(PROXY_TLS_BUFFER_ROLE_CTRL,
+    PROXY_TLS_BUFFER_POLICY_READ_AHEAD, 0);
+  ck_assert_msg(res < 0, "Failed to reject read-ahead for control role");
+  ck_assert_msg(errno == EPERM, "Expected EPERM (%d), got '%s' (%d)", EPERM,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_get_buffer_policy(PROXY_TLS_BUFFER_ROLE_DATA, NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null arguments");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_apply_buffer_policy(NULL, PROXY_TLS_BUFFER_ROLE_DATA);
+  ck_assert_msg(res < 0, "Failed to handle null SSL");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Check the defaults. */
+  res = proxy_tls_get_buffer_policy(PROXY_TLS_BUFFER_ROLE_CTRL, &policy,
+    &read_buflen);
+  ck_assert_msg(res == 0, "Failed to get control policy: %s",
+    strerror(errno));
+  ck_assert_msg(policy == PROXY_TLS_BUFFER_POLICY_RELEASE,
+    "Expected release policy (%d), got %d", PROXY_TLS_BUFFER_POLICY_RELEASE,
+    policy);
+
+  res = proxy_tls_get_buffer_policy(PROXY_TLS_BUFFER_ROLE_DATA, &policy,
+    &read_buflen);
+  ck_assert_msg(res == 0, "Failed to get data policy: %s", strerror(errno));
+  ck_assert_msg(policy == PROXY_TLS_BUFFER_POLICY_READ_AHEAD,
+    "Expected read-ahead policy (%d), got %d",
+    PROXY_TLS_BUFFER_POLICY_READ_AHEAD, policy);
+  ck_assert_msg(read_buflen == PROXY_TLS_DEFAULT_READ_BUFFER_LEN,
+    "Expected read buffer length %lu, got %lu",
+    (unsigned long) PROXY_TLS_DEFAULT_READ_BUFFER_LEN,
+    (unsigned long) read_buflen);
+
+  ctx = SSL_CTX_new(SSLv23_client_method());
+  ck_assert_msg(ctx != NULL, "Failed to create context: %s",
+    proxy_tls_get_errors());
+  SSL_CTX_set_mode(ctx, SSL_MODE_RELEASE_BUFFERS);
+
+  ssl = SSL_new(ctx);
+  ck_assert_msg(ssl != NULL, "Failed to create SSL: %s",
+    proxy_tls_get_errors());
+
+  mark_point();
+  res = proxy_tls_apply_buffer_policy(ssl, PROXY_TLS_BUFFER_ROLE_DATA);
+  ck_assert_msg(res == 0, "Failed to apply data policy: %s", strerror(errno));
+  ck_assert_msg(!(SSL_get_mode(ssl) & SSL_MODE_RELEASE_BUFFERS),
+    "Expected buffers to be kept for data role");
+  ck_assert_msg(SSL_get_read_ahead(ssl) != 0,
+    "Expected read-ahead for data role");
+
+  mark_point();
+  res = proxy_tls_apply_buffer_policy(ssl, PROXY_TLS_BUFFER_ROLE_CTRL);
+  ck_assert_msg(res == 0, "Failed to apply control policy: %s",
+    strerror(errno));
+  ck_assert_msg(SSL_get_mode(ssl) & SSL_MODE_RELEASE_BUFFERS,
+    "Expected buffers to be released for control role");
+  ck_assert_msg(SSL_get_read_ahead(ssl) == 0,
+    "Expected no read-ahead for control role");
+
+  mark_point();
+  res = proxy_tls_set_buffer_policy(PROXY_TLS_BUFFER_ROLE_DATA,
+    PROXY_TLS_BUFFER_POLICY_KEEP, 0);
+  ck_assert_msg(res == 0, "Failed to set data policy: %s", strerror(errno));
+
+  res = proxy_tls_apply_buffer_policy(ssl, PROXY_TLS_BUFFER_ROLE_DATA);
+  ck_assert_msg(res == 0, "Failed to apply data policy: %s", strerror(errno));
+  ck_assert_msg(!(SSL_get_mode(ssl) & SSL_MODE_RELEASE_BUFFERS),
+    "Expected buffers to be kept for data role");
+  ck_assert_msg(SSL_get_read_ahead(ssl) == 0,
+    "Expected no read-ahead for keep policy");
+
+  /* Session cleanup restores the defaults. */
+  mark_point();
+  (void) proxy_tls_sess_free(p);
+  res = proxy_tls_get_buffer_policy(PROXY_TLS_BUFFER_ROLE_DATA, &policy,
+    NULL);
+  ck_assert_msg(res == 0, "Failed to get data policy: %s", strerror(errno));
+  ck_assert_msg(policy == PROXY_TLS_BUFFER_POLICY_READ_AHEAD,
+    "Expected read-ahead policy (%d), got %d",
+    PROXY_TLS_BUFFER_POLICY_READ_AHEAD, policy);
+
+  SSL_free(ssl);
+  SSL_CTX_free(ctx);
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
+START_TEST (tls_get_poll_flags_test) {
+  int flags;
+  pr_netio_stream_t *nstrm;
+
+  mark_point();
+  flags = proxy_tls_get_poll_flags(NULL);
+  ck_assert_msg(flags < 0, "Failed to handle null stream");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  nstrm = pr_netio_open(p, PR_NETIO_STRM_DATA, -1, PR_NETIO_IO_RD);
+  ck_assert_msg(nstrm != NULL, "Failed to open stream: %s", strerror(errno));
+
+  /* Without TLS, only readability matters. */
+  mark_point();
+  flags = proxy_tls_get_poll_flags(nstrm);
+  ck_assert_msg(flags == PROXY_TLS_POLL_FL_READ,
+    "Expected READ poll flag (%d), got %d", PROXY_TLS_POLL_FL_READ, flags);
+
+  (void) pr_netio_close(nstrm);
+}
+END_TEST
+
+#if defined(PR_USE_OPENSSL)
+static unsigned long tls_bench_nreads = 0;
+
+# if OPENSSL_VERSION_NUMBER >= 0x10101000L && \
+     !defined(LIBRESSL_VERSION_NUMBER)
+static long tls_bench_bio_cb(BIO *bio, int oper, const char *argp, size_t len,
+    int argi, long argl, int ret, size_t *processed) {
+  if (oper == (BIO_CB_READ|BIO_CB_RETURN)) {
+    tls_bench_nreads++;
+  }
+
+  return ret;
+}
+# endif /* OpenSSL-1.1.1 and later */
+
+/* Relays the given number of bytes from a server over a loopback socket pair
+ * to a client using the given data buffer policy, returning the elapsed
+ * usecs, or -1 on error.
+ */
+static long tls_bench_relay(SSL_CTX *server_ctx, SSL_CTX *client_ctx,
+    int policy, size_t total, unsigned long *nreads) {
+  register unsigned int i;
+  int fds[2], client_done = FALSE, server_done = FALSE;
+  size_t nsent = 0, nrecvd = 0;
+  char buf[16384];
+  SSL *client, *server;
+  struct timeval start, end;
+  long usecs = -1;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    return -1;
+  }
+
+  (void) fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL)|O_NONBLOCK);
+  (void) fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL)|O_NONBLOCK);
+
+  (void) proxy_tls_set_buffer_policy(PROXY_TLS_BUFFER_ROLE_DATA, policy,
+    policy == PROXY_TLS_BUFFER_POLICY_READ_AHEAD ?
+      PROXY_TLS_DEFAULT_READ_BUFFER_LEN : 0);
+
+  client = SSL_new(client_ctx);
+  SSL_set_fd(client, fds[0]);
+  SSL_set_connect_state(client);
+  (void) proxy_tls_apply_buffer_policy(client, PROXY_TLS_BUFFER_ROLE_DATA);
+
+  server = SSL_new(server_ctx);
+  SSL_set_fd(server, fds[1]);
+  SSL_set_accept_state(server);
+
+  for (i = 0; i < 1024; i++) {
+    if (client_done == FALSE &&
+        SSL_do_handshake(client) == 1) {
+      client_done = TRUE;
+    }
+
+    if (server_done == FALSE &&
+        SSL_do_handshake(server) == 1) {
+      server_done = TRUE;
+    }
+
+    if (client_done == TRUE &&
+        server_done == TRUE) {
+      break;
+    }
+  }
+
+  if (client_done == FALSE ||
+      server_done == FALSE) {
+    goto done;
+  }
+
+# if OPENSSL_VERSION_NUMBER >= 0x10101000L && \
+     !defined(LIBRESSL_VERSION_NUMBER)
+  BIO_set_callback_ex(SSL_get_rbio(client), tls_bench_bio_cb);
+# endif /* OpenSSL-1.1.1 and later */
+  tls_bench_nreads = 0;
+
+  memset(buf, 'A', sizeof(buf));
+
+  gettimeofday(&start, NULL);
+  while (nrecvd < total) {
+    int res;
+
+    /* Fill the socket, then drain it. */
+    while (nsent < total) {
+      size_t len;
+
+      len = total - nsent;
+      if (len > sizeof(buf)) {
+        len = sizeof(buf);
+      }
+
+      res = SSL_write(server, buf, len);
+      if (res <= 0) {
+        break;
+      }
+
+      nsent += res;
+    }
+
+    while (TRUE) {
+      res = SSL_read(client, buf, sizeof(buf));
+      if (res <= 0) {
+        if (SSL_get_error(client, res) != SSL_ERROR_WANT_READ) {
+          goto done;
+        }
+
+        break;
+      }
+
+      nrecvd += res;
+    }
+  }
+  gettimeofday(&end, NULL);
+
+  usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec);
+  *nreads = tls_bench_nreads;
+
+  done:
+  SSL_free(client);
+  SSL_free(server);
+  (void) close(fds[0]);
+  (void) close(fds[1]);
+
+  return usecs;
+}
+#endif /* PR_USE_OPENSSL */
+
+START_TEST (tls_buffer_policy_benchmark_test) {
+#if defined(PR_USE_OPENSSL)
+  register unsigned int i;
+  size_t total = 32 * 1024 * 1024;
+  int policies[3] = {
+    PROXY_TLS_BUFFER_POLICY_RELEASE,
+    PROXY_TLS_BUFFER_POLICY_KEEP,
+    PROXY_TLS_BUFFER_POLICY_READ_AHEAD
+  };
+  const char *names[3] = { "release", "keep", "read-ahead" };
+  SSL_CTX *server_ctx, *client_ctx;
+
+  server_ctx = create_server_ctx();
+  ck_assert_msg(server_ctx != NULL, "Failed to create server context: %s",
+    proxy_tls_get_errors());
+
+  client_ctx = SSL_CTX_new(SSLv23_client_method());
+  ck_assert_msg(client_ctx != NULL, "Failed to create client context: %s",
+    proxy_tls_get_errors());
+  SSL_CTX_set_verify(client_ctx, SSL_VERIFY_NONE, NULL);
+
+  /* As for the proxy's own context. */
+  SSL_CTX_set_mode(client_ctx, SSL_MODE_RELEASE_BUFFERS);
+
+  for (i = 0; i < 3; i++) {
+    unsigned long nreads = 0;
+    long usecs;
+
+    usecs = tls_bench_relay(server_ctx, client_ctx, policies[i], total,
+      &nreads);
+    ck_assert_msg(usecs >= 0, "Failed to relay data with %s policy: %s",
+      names[i], proxy_tls_get_errors());
+
+    if (getenv("TEST_VERBOSE") != NULL) {
+      fprintf(stdout, "tls buffers: %s policy: %lu bytes in %ld usecs "
+        "(%.1f MB/s), %lu socket reads\n", names[i], (unsigned long) total,
+        usecs, usecs > 0 ? ((double) total / usecs) : 0.0, nreads);
+    }
+  }
+
+  (void) proxy_tls_sess_free(p);
+
+  SSL_CTX_free(client_ctx);
+  SSL_CTX_free(server_ctx);
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
+START_TEST (tls_shutdown_policy_test) {
+#if defined(PR_USE_OPENSSL)
+  int res, policy = 0;
+  unsigned int linger_ms = 0;
+
+  mark_point();
+  res = proxy_tls_set_shutdown_policy(-1, 0);
+  ck_assert_msg(res < 0, "Failed to handle invalid policy");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_get_shutdown_policy(NULL, NULL);
+  ck_assert_msg(res < 0, "Failed to handle null arguments");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  mark_point();
+  res = proxy_tls_end_data_sess(NULL, -1);
+  ck_assert_msg(res < 0, "Failed to handle null SSL");
+  ck_assert_msg(errno == EINVAL, "Expected EINVAL (%d), got '%s' (%d)", EINVAL,
+    strerror(errno), errno);
+
+  /* Check the defaults. */
+  res = proxy_tls_get_shutdown_policy(&policy, &linger_ms);
+  ck_assert_msg(res == 0, "Failed to get shutdown policy: %s",
+    strerror(errno));
+  ck_assert_msg(policy == PROXY_TLS_SHUTDOWN_POLICY_DEFERRED,
+    "Expected deferred policy (%d), got %d",
+    PROXY_TLS_SHUTDOWN_POLICY_DEFERRED, policy);
+  ck_assert_msg(linger_ms == PROXY_TLS_DEFAULT_SHUTDOWN_LINGER_MS,
+    "Expected linger %u ms, got %u", PROXY_TLS_DEFAULT_SHUTDOWN_LINGER_MS,
+    linger_ms);
+
+  mark_point();
+  res = proxy_tls_set_shutdown_policy(PROXY_TLS_SHUTDOWN_POLICY_BIDIRECTIONAL,
+    2000);
+  ck_assert_msg(res == 0, "Failed to set shutdown policy: %s",
+    strerror(errno));
+
+  res = proxy_tls_get_shutdown_policy(&policy, &linger_ms);
+  ck_assert_msg(res == 0, "Failed to get shutdown policy: %s",
+    strerror(errno));
+  ck_assert_msg(policy == PROXY_TLS_SHUTDOWN_POLICY_BIDIRECTIONAL,
+    "Expected bidirectional policy (%d), got %d",
+    PROXY_TLS_SHUTDOWN_POLICY_BIDIRECTIONAL, policy);
+  ck_assert_msg(linger_ms == 2000, "Expected linger 2000 ms, got %u",
+    linger_ms);
+
+  /* A linger time of zero means the default. */
+  mark_point();
+  res = proxy_tls_set_shutdown_policy(PROXY_TLS_SHUTDOWN_POLICY_UNIDIRECTIONAL,
+    0);
+  ck_assert_msg(res == 0, "Failed to set shutdown policy: %s",
+    strerror(errno));
+
+  res = proxy_tls_get_shutdown_policy(NULL, &linger_ms);
+  ck_assert_msg(res == 0, "Failed to get shutdown policy: %s",
+    strerror(errno));
+  ck_assert_msg(linger_ms == PROXY_TLS_DEFAULT_SHUTDOWN_LINGER_MS,
+    "Expected linger %u ms, got %u", PROXY_TLS_DEFAULT_SHUTDOWN_LINGER_MS,
+    linger_ms);
+
+  /* Session cleanup restores the defaults. */
+  mark_point();
+  (void) proxy_tls_sess_free(p);
+  res = proxy_tls_get_shutdown_policy(&policy, NULL);
+  ck_assert_msg(res == 0, "Failed to get shutdown policy: %s",
+    strerror(errno));
+  ck_assert_msg(policy == PROXY_TLS_SHUTDOWN_POLICY_DEFERRED,
+    "Expected deferred policy (%d), got %d",
+    PROXY_TLS_SHUTDOWN_POLICY_DEFERRED, policy);
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
+#if defined(PR_USE_OPENSSL)
+/* Sets up a TLS session between a client and a server over a non-blocking
+ * socket pair, returning TRUE if the handshake succeeded.
+ */
+static int tls_shutdown_pair(SSL_CTX *server_ctx, SSL_CTX *client_ctx,
+    SSL **client, SSL **server, int *fds) {
+  register unsigned int i;
+  int client_done = FALSE, server_done = FALSE;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+    return FALSE;
+  }
+
+  (void) fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL)|O_NONBLOCK);
+  (void) fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL)|O_NONBLOCK);
+
+  *client = SSL_new(client_ctx);
+  SSL_set_fd(*client, fds[0]);
+  SSL_set_connect_state(*client);
+
+  *server = SSL_new(server_ctx);
+  SSL_set_fd(*server, fds[1]);
+  SSL_set_accept_state(*server);
+
+  for (i = 0; i < 1024; i++) {
+    if (client_done == FALSE &&
+        SSL_do_handshake(*client) == 1) {
+      client_done = TRUE;
+    }
+
+    if (server_done == FALSE &&
+        SSL_do_handshake(*server) == 1) {
+      server_done = TRUE;
+    }
+
+    if (client_done == TRUE &&
+        server_done == TRUE) {
+      break;
+    }
+  }
+
+  return (client_done == TRUE && server_done == TRUE);
+}
+
+/* Has the server received the client's 'close_notify'?  If so, and if
+ * requested, the server replies with its own.
+ */
+static int tls_shutdown_recvd(SSL *server, int reply) {
+  char buf[256];
+  int res;
+
+  res = SSL_read(server, buf, sizeof(buf));
+  if (res > 0 ||
+      SSL_get_error(server, res) != SSL_ERROR_ZERO_RETURN) {
+    return FALSE;
+  }
+
+  if (reply == TRUE) {
+    (void) SSL_shutdown(server);
+  }
+
+  return TRUE;
+}
+
+/* Has the client closed the connection, after its 'close_notify'? */
+static int tls_shutdown_closed(SSL *server, int fd) {
+  char buf[1];
+
+  if (tls_shutdown_recvd(server, FALSE) == FALSE) {
+    return FALSE;
+  }
+
+  return (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) == 0);
+}
+#endif /* PR_USE_OPENSSL */
+
+START_TEST (tls_end_data_sess_test) {
+#if defined(PR_USE_OPENSSL)
+  register unsigned int i;
+  int res, fds[2];
+  unsigned int linger_ms = 200;
+  int policies[3] = {
+    PROXY_TLS_SHUTDOWN_POLICY_BIDIRECTIONAL,
+    PROXY_TLS_SHUTDOWN_POLICY_UNIDIRECTIONAL,
+    PROXY_TLS_SHUTDOWN_POLICY_DEFERRED
+  };
+  const char *names[3] = { "bidirectional", "unidirectional", "deferred" };
+  SSL_CTX *server_ctx, *client_ctx;
+  SSL *client, *server, *servers[PROXY_TLS_MAX_DEFERRED_SHUTDOWNS + 1];
+  int server_fds[PROXY_TLS_MAX_DEFERRED_SHUTDOWNS + 1];
+  struct timeval start, end;
+
+  server_ctx = create_server_ctx();
+  ck_assert_msg(server_ctx != NULL, "Failed to create server context: %s",
+    proxy_tls_get_errors());
+
+  client_ctx = SSL_CTX_new(SSLv23_client_method());
+  ck_assert_msg(client_ctx != NULL, "Failed to create client context: %s",
+    proxy_tls_get_errors());
+  SSL_CTX_set_verify(client_ctx, SSL_VERIFY_NONE, NULL);
+
+  /* Measure how long each policy delays the completion of a transfer, when
+   * the server is slow to send its 'close_notify'.
+   */
+  for (i = 0; i < 3; i++) {
+    long usecs;
+
+    res = proxy_tls_set_shutdown_policy(policies[i], linger_ms);
+    ck_assert_msg(res == 0, "Failed to set %s policy: %s", names[i],
+      strerror(errno));
+
+    res = tls_shutdown_pair(server_ctx, client_ctx, &client, &server, fds);
+    ck_assert_msg(res == TRUE, "Failed TLS handshake: %s",
+      proxy_tls_get_errors());
+
+    gettimeofday(&start, NULL);
+    res = proxy_tls_end_data_sess(client, fds[0]);
+    gettimeofday(&end, NULL);
+
+    /* As the NetIO close would. */
+    (void) close(fds[0]);
+
+    usecs = ((end.tv_sec - start.tv_sec) * 1000000L) +
+      (end.tv_usec - start.tv_usec);
+
+    if (policies[i] == PROXY_TLS_SHUTDOWN_POLICY_DEFERRED) {
+      ck_assert_msg(res == 1, "Expected deferred shutdown, got %d", res);
+      ck_assert_msg(proxy_tls_reap_data_sess(FALSE) == 1,
+        "Expected 1 pending shutdown");
+
+      /* The deferred session still owns the socket, even though we closed
+       * our fd; once the server replies, it is reaped.
+       */
+      res = tls_shutdown_recvd(server, TRUE);
+      ck_assert_msg(res == TRUE, "Server did not receive 'close_notify'");
+
+      res = proxy_tls_reap_data_sess(FALSE);
+      ck_assert_msg(res == 0, "Expected 0 pending shutdowns, got %d", res);
+
+    } else {
+      ck_assert_msg(res == 0, "Expected shutdown not to be deferred, got %d",
+        res);
+      ck_assert_msg(tls_shutdown_recvd(server, FALSE) == TRUE,
+        "Server did not receive 'close_notify'");
+
+      if (policies[i] == PROXY_TLS_SHUTDOWN_POLICY_BIDIRECTIONAL) {
+        ck_assert_msg(usecs >= (long) (linger_ms * 1000) - 10000,
+          "Expected to wait for %u ms, waited %ld usecs", linger_ms, usecs);
+      }
+    }
+
+    if (getenv("TEST_VERBOSE") != NULL) {
+      fprintf(stdout, "tls shutdown: %s policy: transfer completion delayed "
+        "%ld usecs\n", names[i], usecs);
+    }
+
+    SSL_free(server);
+    (void) close(fds[1]);
+  }
+
+  /* A server which has already sent its 'close_notify' is done at once. */
+  res = proxy_tls_set_shutdown_policy(PROXY_TLS_SHUTDOWN_POLICY_BIDIRECTIONAL,
+    linger_ms);
+  ck_assert_msg(res == 0, "Failed to set policy: %s", strerror(errno));
+
+  res = tls_shutdown_pair(server_ctx, client_ctx, &client, &server, fds);
+  ck_assert_msg(res == TRUE, "Failed TLS handshake: %s",
+    proxy_tls_get_errors());
+  (void) SSL_shutdown(server);
+
+  gettimeofday(&start, NULL);
+  res = proxy_tls_end_data_sess(client, fds[0]);
+  gettimeofday(&end, NULL);
+  ck_assert_msg(res == 0, "Expected shutdown not to be deferred, got %d", res);
+  ck_assert_msg((((end.tv_sec - start.tv_sec) * 1000000L) +
+    (end.tv_usec - start.tv_usec)) < (long) (linger_ms * 1000),
+    "Expected not to wait for server's 'close_notify'");
+
+  SSL_free(server);
+  (void) close(fds[0]);
+  (void) close(fds[1]);
+
+  /* Deferred shutdowns are abandoned once their linger time passes. */
+  res = proxy_tls_set_shutdown_policy(PROXY_TLS_SHUTDOWN_POLICY_DEFERRED,
+    linger_ms);
+  ck_assert_msg(res == 0, "Failed to set policy: %s", strerror(errno));
+
+  res = tls_shutdown_pair(server_ctx, client_ctx, &client, &server, fds);
+  ck_assert_msg(res == TRUE, "Failed TLS handshake: %s",
+    proxy_tls_get_errors());
+
+  res = proxy_tls_end_data_sess(client, fds[0]);
+  ck_assert_msg(res == 1, "Expected deferred shutdown, got %d", res);
+  (void) close(fds[0]);
+
+  res = proxy_tls_reap_data_sess(FALSE);
+  ck_assert_msg(res == 1, "Expected 1 pending shutdown, got %d", res);
+
+  usleep((linger_ms + 50) * 1000);
+  res = proxy_tls_reap_data_sess(FALSE);
+  ck_assert_msg(res == 0, "Expected 0 pending shutdowns, got %d", res);
+
+  SSL_free(server);
+  (void) close(fds[1]);
+
+  /* And forcibly reaped, regardless. */
+  res = tls_shutdown_pair(server_ctx, client_ctx, &client, &server, fds);
+  ck_assert_msg(res == TRUE, "Failed TLS handshake: %s",
+    proxy_tls_get_errors());
+
+  res = proxy_tls_end_data_sess(client, fds[0]);
+  ck_assert_msg(res == 1, "Expected deferred shutdown, got %d", res);
+  (void) close(fds[0]);
+
+  res = proxy_tls_reap_data_sess(TRUE);
+  ck_assert_msg(res == 0, "Expected 0 pending shutdowns, got %d", res);
+
+  SSL_free(server);
+  (void) close(fds[1]);
+
+  /* When too many are pending, the one deferred longest ago is abandoned,
+   * wherever it now sits in the table.
+   */
+  res = proxy_tls_set_shutdown_policy(PROXY_TLS_SHUTDOWN_POLICY_DEFERRED,
+    5000);
+  ck_assert_msg(res == 0, "Failed to set policy: %s", strerror(errno));
+
+  for (i = 0; i < PROXY_TLS_MAX_DEFERRED_SHUTDOWNS + 1; i++) {
+    res = tls_shutdown_pair(server_ctx, client_ctx, &client, &(servers[i]),
+      fds);
+    ck_assert_msg(res == TRUE, "Failed TLS handshake: %s",
+      proxy_tls_get_errors());
+    server_fds[i] = fds[1];
+
+    res = proxy_tls_end_data_sess(client, fds[0]);
+    ck_assert_msg(res == 1, "Expected deferred shutdown, got %d", res);
+    (void) close(fds[0]);
+
+    if (i == PROXY_TLS_MAX_DEFERRED_SHUTDOWNS - 1) {
+      /* Completing the first moves the last into its place. */
+      res = tls_shutdown_recvd(servers[0], TRUE);
+      ck_assert_msg(res == TRUE, "Server did not receive 'close_notify'");
+
+      res = proxy_tls_reap_data_sess(FALSE);
+      ck_assert_msg(res == PROXY_TLS_MAX_DEFERRED_SHUTDOWNS - 1,
+        "Expected %d pending shutdowns, got %d",
+        PROXY_TLS_MAX_DEFERRED_SHUTDOWNS - 1, res);
+
+      SSL_free(servers[0]);
+      (void) close(server_fds[0]);
+      servers[0] = NULL;
+    }
+
+    /* Ensure distinct expiration times. */
+    usleep(2000);
+  }
+
+  res = tls_shutdown_pair(server_ctx, client_ctx, &client, &server, fds);
+  ck_assert_msg(res == TRUE, "Failed TLS handshake: %s",
+    proxy_tls_get_errors());
+
+  res = proxy_tls_end_data_sess(client, fds[0]);
+  ck_assert_msg(res == 1, "Expected deferred shutdown, got %d", res);
+  (void) close(fds[0]);
+
+  res = proxy_tls_reap_data_sess(FALSE);
+  ck_assert_msg(res == PROXY_TLS_MAX_DEFERRED_SHUTDOWNS,
+    "Expected %d pending shutdowns, got %d", PROXY_TLS_MAX_DEFERRED_SHUTDOWNS,
+    res);
+
+  ck_assert_msg(tls_shutdown_closed(servers[1], server_fds[1]) == TRUE,
+    "Expected oldest deferred shutdown to be abandoned");
+
+  i = PROXY_TLS_MAX_DEFERRED_SHUTDOWNS - 1;
+  ck_assert_msg(tls_shutdown_closed(servers[i], server_fds[i]) == FALSE,
+    "Expected newer deferred shutdown not to be abandoned");
+
+  res = proxy_tls_reap_data_sess(TRUE);
+  ck_assert_msg(res == 0, "Expected 0 pending shutdowns, got %d", res);
+
+  SSL_free(server);
+  (void) close(fds[1]);
+
+  for (i = 1; i < PROXY_TLS_MAX_DEFERRED_SHUTDOWNS + 1; i++) {
+    SSL_free(servers[i]);
+    (void) close(server_fds[i]);
+  }
+
+  (void) proxy_tls_sess_free(p);
+
+  SSL_CTX_free(client_ctx);
+  SSL_CTX_free(server_ctx);
+#endif /* PR_USE_OPENSSL */
+}
+END_TEST
+
 Suite *tests_get_tls_suite(void) {
   Suite *suite;
   TCase *testcase;
@@ -336,6 +1674,15 @@ Suite *tests_get_tls_suite(void) {
   tcase_add_test(testcase, tls_using_tls_test);
   tcase_add_test(testcase, tls_match_client_tls_test);
   tcase_add_test(testcase, tls_set_data_prot_test);
+  tcase_add_test(testcase, tls_verify_cache_test);
+  tcase_add_test(testcase, tls_verify_stapled_ocsp_test);
+  tcase_add_test(testcase, tls_diags_test);
+  tcase_add_test(testcase, tls_diags_benchmark_test);
+  tcase_add_test(testcase, tls_buffer_policy_test);
+  tcase_add_test(testcase, tls_get_poll_flags_test);
+  tcase_add_test(testcase, tls_buffer_policy_benchmark_test);
+  tcase_add_test(testcase, tls_shutdown_policy_test);
+  tcase_add_test(testcase, tls_end_data_sess_test);
 
   suite_add_tcase(suite, testcase);
   return suite;